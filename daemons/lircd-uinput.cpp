@@ -23,12 +23,12 @@
 #include <string>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 #include <linux/input.h>
 #include "lirc/input_map.h"
 
 #include "lirc_private.h"
-#include "line_buffer.h"
 
 
 static const logchannel_t logchannel = LOG_APP;
@@ -45,6 +45,7 @@ static const char* const HELP =
 	"\t -r --release-suffix=suffix \tRelease events suffix [_EVUP]\n"
 	"\t -R --repeat=delay[,period]\tSet kernel repeat parameters [none]\n"
 	"\t -a --add-release-events\tAdd synthetic release events [no]\n"
+	"\t -k --kernel-repeat\t\tLet the kernel repeat held keys [no]\n"
 	"\t -d --disable=file\t\tDisable buttons listed in file\n"
         "\t -D[level] --loglevel[=level]\t"
 			"'info', 'warning', 'notice', etc., or 3..10.\n"
@@ -63,6 +64,7 @@ static const struct option cli_options[] = {
 	{ "release-suffix",     required_argument, NULL, 'r' },
 	{ "repeat",             required_argument, NULL, 'R' },
 	{ "add-release-events", no_argument,       NULL, 'a' },
+	{ "kernel-repeat",      no_argument,       NULL, 'k' },
 	{ "loglevel",	        optional_argument, NULL, 'D' },
 	{ "disable",	        required_argument, NULL, 'd' },
 	{ "logfile",	        required_argument, NULL, 'L' },
@@ -71,7 +73,7 @@ static const struct option cli_options[] = {
 
 
 /** Used in parse_options(), matches cli_options above. */
-static const char* const optstring = "ad:D::hO:r:R:u:L:v";
+static const char* const optstring = "ad:D::hkO:r:R:u:L:v";
 
 /** Max for --repeat period and delay parts (ms). */
 static const int MAX_INTERVAL = 20000;
@@ -84,6 +86,7 @@ static const char* const SUFFIX_OPT   =	"lircd-uinput:release-suffix";
 static const char* const TIMEOUT_OPT  =	"lircd-uinput:release-timeout";
 static const char* const RELEASE_OPT  =	"lircd-uinput:add-release-events";
 static const char* const REPEAT_OPT   =	"lircd-uinput:repeat";
+static const char* const KERNEL_OPT   =	"lircd-uinput:kernel-repeat";
 static const char* const INPUT_ARG    =	"lircd-uinput:output";
 static const char* const DISABLED_OPT =	"lircd-uinput:disabled";
 
@@ -96,6 +99,7 @@ struct options {
 	unsigned repeat_delay;      /**< delay part of --repeat option. */
 	unsigned repeat_period;     /**< period part of --repeat option. */
 	bool add_release_events;    /**< The --add-release-events option. */
+	bool kernel_repeat;         /**< The --kernel-repeat option. */
 	loglevel_t loglevel;        /**< The --loglevel option. */
 	const char* logfile;        /**< The --logfile option. */
 	const char* disabled_path;  /**< The --disable file path option. */
@@ -106,40 +110,76 @@ struct options {
 };
 
 
-/** Cached code lookups for button names. */
+/** Max number of cached buttons, bounds memory used by garbage names. */
+static const size_t CODE_CACHE_SIZE = 512;
+
+
+/** Cached code lookups for button names, looked up without a copy. */
 class CodeCache {
 
-	private:
+	public:
 		struct Entry {
+			std::string name;
 			linux_input_code code;
 			bool is_release;  /**< Button is a release event. */
+			bool disabled;    /**< Button is --disabled. */
 		};
 
-		typedef std::unordered_map<std::string, struct Entry> code_map;
+	private:
+		/* By name hash. Entries don't move when others are added. */
+		typedef std::unordered_multimap<size_t, struct Entry> code_map;
 		code_map cache;
+		/* Returned by add() when cache is full, valid until next add(). */
+		Entry overflow;
+
+		static size_t hash(const char* name, size_t len)
+		{
+			size_t h = 2166136261u;         /* FNV-1a */
+			size_t i;
+
+			for (i = 0; i < len; i++) {
+				h ^= (unsigned char)name[i];
+				h *= 16777619u;
+			}
+			return h;
+		};
 
 	public:
-		void add(const char* button, linux_input_code c, bool release)
+		const Entry* add(const std::string& button,
+				 linux_input_code c, bool release,
+				 bool disabled)
 		{
-			Entry* entry = new Entry();
-			entry->code = c;
-			entry->is_release = release;
-			cache[button] = *entry;
+			Entry entry;
+
+			entry.name = button;
+			entry.code = c;
+			entry.is_release = release;
+			entry.disabled = disabled;
+			if (cache.size() >= CODE_CACHE_SIZE) {
+				overflow = entry;
+				return &overflow;
+			}
+			auto it = cache.insert(std::make_pair(
+				hash(button.data(), button.size()), entry));
+			return &it->second;
 		};
 
-		bool lookup(const std::string button_name,
-			    linux_input_code* code,
-			    bool* is_release)
+		/** Return entry for button, len chars, or NULL. */
+		const Entry* lookup(const char* button, size_t len)
 		{
-			auto it = cache.find(button_name);
-			if (it == cache.end())
-				return false;
-			*code = it->second.code;
-			*is_release = it->second.is_release;
-			return true;
+			auto range = cache.equal_range(hash(button, len));
+
+			for (auto it = range.first; it != range.second; ++it) {
+				const Entry* entry = &it->second;
+
+				if (entry->name.size() == len
+				    && memcmp(entry->name.data(), button, len) == 0)
+					return entry;
+			}
+			return NULL;
 		};
 
-		CodeCache() { cache = code_map(); }
+		CodeCache() { cache.reserve(CODE_CACHE_SIZE); }
 };
 
 
@@ -147,7 +187,7 @@ class CodeCache {
 static CodeCache code_cache = CodeCache();
 
 /** Set by send_message(), used when sending release events. */
-static std::string last_button_press = std::string("");
+static const CodeCache::Entry* last_button_press = NULL;
 
 
 /** Setup defaults for the CLI options parsing. */
@@ -160,6 +200,7 @@ static void add_defaults(void)
 	const char* const socket = options_getstring("lircd:output");
 	const char* const timeout = options_getstring(TIMEOUT_OPT);
 	const char* const release_opt = options_getstring(RELEASE_OPT);
+	const char* const kernel_opt = options_getstring(KERNEL_OPT);
 	const char* const uinput_opt = options_getstring(UINPUT_OPT);
 	const char* const logfile_opt = options_getstring(LOGFILE_OPT);
 
@@ -171,6 +212,7 @@ static void add_defaults(void)
 		SUFFIX_OPT,	    suffix ? suffix : "_EVUP",
 		TIMEOUT_OPT,	    timeout ? timeout : "200",
 		RELEASE_OPT,	    release_opt ? release_opt : "false",
+		KERNEL_OPT,	    kernel_opt ? kernel_opt : "false",
 		INPUT_ARG,	    socket ? socket : LIRCD,
 		DISABLED_OPT,	    (const char*)NULL,
 		(const char*)NULL,  (const char*)NULL
@@ -209,6 +251,9 @@ static void parse_options(int argc, char** const argv)
 		case 'a':
 			options_set_opt(RELEASE_OPT, "True");
 			break;
+		case 'k':
+			options_set_opt(KERNEL_OPT, "True");
+			break;
 		case 'd':
 			options_set_opt(DISABLED_OPT, optarg);
 			break;
@@ -310,6 +355,8 @@ static void log_options(const struct options* opts)
 		log_info("Using \"%s\" as release suffix",
 			 opts->release_suffix);
 	}
+	if (opts->kernel_repeat)
+		log_info("Not forwarding repeats, using kernel autorepeat");
 	if (opts->disabled_path != NULL) {
 		log_info("Disabling %d key(s)",
 			 opts->disabled_buttons.size());
@@ -335,6 +382,10 @@ static void options_new(struct options* opts)
 	opts->release_timeout = options_getint(TIMEOUT_OPT);
 	opts->release_suffix = options_getstring(SUFFIX_OPT);
 	opts->add_release_events = options_getboolean(RELEASE_OPT);
+	opts->kernel_repeat = options_getboolean(KERNEL_OPT);
+	if (opts->kernel_repeat)
+		/* Else a held key would repeat forever. */
+		opts->add_release_events = true;
 	if( !parse_repeat(opts)) {
 		fputs("Warning: Cannot parse --repeat option.\n", stderr);
 		fputs("Warning: Using kernel defaults\n", stderr);
@@ -389,8 +440,12 @@ static linux_input_code get_keycode(const char* button_name,
 }
 
 
-/** Send a struct input_event to an uinput fd, return success. */
-static bool write_event(int fd, unsigned type, linux_input_code code, int val)
+/** Events not yet written to uinput, see flush_events(). */
+static std::vector<struct input_event> pending_events;
+
+
+/** Queue a struct input_event, written by flush_events(). */
+static void queue_event(unsigned type, linux_input_code code, int val)
 {
 	struct input_event event;
 
@@ -398,73 +453,137 @@ static bool write_event(int fd, unsigned type, linux_input_code code, int val)
 	event.type = type;
 	event.code = code;
 	event.value = val;
-	return write(fd, &event, sizeof(event)) == sizeof(event);
+	pending_events.push_back(event);
 }
 
 
-/** Given a button, format and send struct input_events to /dev/uinput. */
-static void send_message(const struct options* opts, const char* button, int reps)
+/** Write all queued events to an uinput fd at once, return success. */
+static bool flush_events(int fd)
+{
+	const ssize_t size = pending_events.size() * sizeof(struct input_event);
+	ssize_t r;
+
+	if (size == 0)
+		return true;
+	r = write(fd, pending_events.data(), size);
+	pending_events.clear();
+	return r == size;
+}
+
+
+/** Send a struct input_event to an uinput fd, return success. */
+static bool write_event(int fd, unsigned type, linux_input_code code, int val)
 {
+	queue_event(type, code, val);
+	return flush_events(fd);
+}
+
+
+/** Return the cache entry for a button, len chars, adding it if needed. */
+static const CodeCache::Entry* lookup_button(const struct options* opts,
+					     const char* button, size_t len)
+{
+	const CodeCache::Entry* entry;
 	linux_input_code code;
 	bool is_release;
+	bool disabled;
+
+	entry = code_cache.lookup(button, len);
+	if (entry != NULL)
+		return entry;
+	std::string name(button, len);
+	log_trace("Cache miss for %s", name.c_str());
+	code = get_keycode(name.c_str(), opts->release_suffix, &is_release);
+	disabled = opts->disabled_path
+		   && opts->disabled_buttons.count(name) == 1;
+	return code_cache.add(name, code, is_release, disabled);
+}
 
-	button = button == NULL ? "(null)" : button;
-	if (!code_cache.lookup(button, &code, &is_release)) {
-		log_trace("Cache miss for %s", button);
-		code = get_keycode(button, opts->release_suffix, &is_release);
-		code_cache.add(button, code, is_release);
-	}
-	if (code == KEY_RESERVED) {
-		log_info("Dropping non-standard symbol %s", button);
+
+/**
+ * Given a button, format struct input_events for /dev/uinput. They are
+ * queued, the caller must flush_events().
+ */
+static void send_message(const struct options* opts,
+			 const CodeCache::Entry* button, int reps)
+{
+	if (button->code == KEY_RESERVED) {
+		log_info("Dropping non-standard symbol %s",
+			 button->name.c_str());
 		return;
 	}
 	// event.value: 0 => release, 1 => press, 2 => repeat
 	//       reps: -1 => release, 0 => press, > 0 => repeat
-	const int value = reps + 1 > 2 ? 2 : reps + 1;
-	log_debug("Sending %s as %d:%d", button, code, value);
+	int value = reps + 1 > 2 ? 2 : reps + 1;
+
+	if (opts->kernel_repeat && reps >= 0 && !button->is_release) {
+		// Only one key is held, the kernel repeats it.
+		if (last_button_press != NULL) {
+			queue_event(EV_KEY, last_button_press->code, 0);
+			queue_event(EV_SYN, SYN_REPORT, 0);
+		}
+		value = 1;
+	}
+	log_debug("Sending %s as %d:%d", button->name.c_str(), button->code,
+		  value);
 
-	if (!write_event(opts->uinputfd, EV_KEY, code, value))
-		log_perror_err("Writing regular event to uinput failed");
-	if (!write_event(opts->uinputfd, EV_SYN, SYN_REPORT, 0))
-		log_perror_err("Writing EV_SYN to uinput failed");
+	queue_event(EV_KEY, button->code, value);
+	queue_event(EV_SYN, SYN_REPORT, 0);
 	// send_release_event() needs to know if an event is required
-	if (opts->add_release_events && !is_release)
-		last_button_press = std::string(button);
+	if (opts->add_release_events && !button->is_release)
+		last_button_press = button;
 	else
-		last_button_press = "";
+		last_button_press = NULL;
 }
 
 
-/** Process a single line of input from the socket (or test file). */
-static void process_line(const struct options* opts, std::string line)
+/** Process a single line of input from the socket, len chars. */
+static void process_line(const struct options* opts,
+			 const char* line, size_t len)
 {
-	int r;
-	char button[PACKET_SIZE + 1];
-	char remote[PACKET_SIZE + 1];
-	int reps;
+	const CodeCache::Entry* button;
+	struct code_line parsed;
 
-	r = sscanf(line.c_str(), "%*x %x %s %s\n", &reps, button, remote);
-	if (r != 3) {
-		log_warn("Cannot parse line: %s", line.c_str());
+	if (code_line_parse(line, len, &parsed) != 1) {
+		log_warn("Cannot parse line: %.*s", (int)len, line);
 		return;
 	}
-	if (opts->disabled_path && opts->disabled_buttons.count(button) == 1)
-		log_debug("Skipping disabled key %s", button)
-	else
-		send_message(opts, button, reps);
+	button = lookup_button(opts, parsed.button, parsed.button_len);
+	if (button->disabled) {
+		log_debug("Skipping disabled key %s", button->name.c_str());
+		return;
+	}
+	if (opts->kernel_repeat && parsed.reps > 0
+	    && last_button_press != NULL
+	    && last_button_press->code == button->code)
+		/* Still held, just keeps the release timeout running. */
+		return;
+	send_message(opts, button, parsed.reps);
 }
 
 
-/** Process all available lines in line_buffer. */
-static void process_lines(const struct options* opts, LineBuffer* line_buffer)
+/**
+ * Process the complete lines in buffer, len chars, writing their events
+ * at once. The rest is moved to the start of buffer.
+ * @return Length of the incomplete last line.
+ */
+static size_t process_lines(const struct options* opts,
+			    char* buffer, size_t len)
 {
-	std::string line;
-
-	while (line_buffer->has_lines()) {
-		line = line_buffer->get_next_line();
-		log_trace("Input: %s", line.c_str());
-		process_line(opts, line);
+	const char* end = buffer + len;
+	const char* line = buffer;
+	const char* nl;
+
+	while ((nl = (const char*)memchr(line, '\n', end - line)) != NULL) {
+		log_trace("Input: %.*s", (int)(nl - line), line);
+		process_line(opts, line, nl - line);
+		line = nl + 1;
 	}
+	if (!flush_events(opts->uinputfd))
+		log_perror_err("Writing events to uinput failed");
+	len = end - line;
+	memmove(buffer, line, len);
+	return len;
 }
 
 
@@ -474,13 +593,19 @@ static void process_lines(const struct options* opts, LineBuffer* line_buffer)
  */
 static void send_release_event(const struct options* opts)
 {
+	const CodeCache::Entry* button;
+
 	if (!opts->add_release_events)
 		return;
-	if (last_button_press == "")
+	if (last_button_press == NULL)
 		return;
-	std::string button_name = last_button_press + opts->release_suffix;
-	send_message(opts, button_name.c_str(), -1);
-	last_button_press = "";
+	std::string button_name = last_button_press->name
+				  + opts->release_suffix;
+	button = lookup_button(opts, button_name.data(), button_name.size());
+	send_message(opts, button, -1);
+	last_button_press = NULL;
+	if (!flush_events(opts->uinputfd))
+		log_perror_err("Writing release event to uinput failed");
 }
 
 
@@ -488,8 +613,8 @@ static void send_release_event(const struct options* opts)
 static void lircd_uinput(const struct options* opts)
 {
 	int r;
-        char buffer[PACKET_SIZE + 1];
-	LineBuffer line_buffer;
+	char buffer[16 * PACKET_SIZE];
+	size_t used = 0;
 	struct pollfd fds;
 	int timeout = opts->add_release_events ? opts->release_timeout : -1;
 
@@ -506,10 +631,14 @@ static void lircd_uinput(const struct options* opts)
 			log_notice("POLLERR or curl_poll() error, exiting.");
 			exit(EXIT_FAILURE);
 		}
-		r = read(opts->inputfd, buffer, PACKET_SIZE);
+		/* Everything available, the events are written at once. */
+		r = read(opts->inputfd, buffer + used, sizeof(buffer) - used);
 		if (r > 0) {
-			line_buffer.append(buffer, static_cast<size_t>(r));
-			process_lines(opts, &line_buffer);
+			used = process_lines(opts, buffer, used + r);
+			if (used == sizeof(buffer)) {
+				log_warn("Dropping too long input line");
+				used = 0;
+			}
 		} else if (r == -1) {
 			log_perror_warn("lircd_uinput(): read() error");
 		} else  {
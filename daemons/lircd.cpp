@@ -42,32 +42,73 @@
 #include <getopt.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fnmatch.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <sys/file.h>
 #include <pwd.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #ifdef HAVE_SYSTEMD
 #include "systemd/sd-daemon.h"
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+#ifdef HAVE_LIBUDEV_H
+#include <libudev.h>
+#endif
+
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #if defined __APPLE__ || defined __FreeBSD__
 #include <sys/ioctl.h>
 #endif
 
+#ifdef USE_UINPUT
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
-#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "lirc_private.h"
+#include "event_record.h"
+#include "event_ring.h"
+#include "line_buffer.h"
 
 #ifndef HAVE_CLOCK_GETTIME
 
@@ -112,20 +153,145 @@ int clock_gettime(int clk_id, struct timespec *t){
 
 static const logchannel_t logchannel = LOG_APP;
 
-/** How long we sleep while waiting for busy write sockets. */
+/** How long we wait for a busy write socket to drain, per retry. */
 static const int WRITE_SLEEP_US = 20000;
 
 /** How many times we retry busy write sockets. */
 static const int WRITE_RETRIES = 50;
 
+/** Idle time before the first TCP keepalive probe [s]. */
+static const int TCP_KEEPALIVE_IDLE = 60;
+
+/** Time between TCP keepalive probes [s]. */
+static const int TCP_KEEPALIVE_INTERVAL = 10;
+
+/** Unanswered TCP keepalive probes before a peer is considered dead. */
+static const int TCP_KEEPALIVE_COUNT = 3;
+
+/** Least send buffer of a TCP socket, holds a LIST of a large remote. */
+static const int TCP_SNDBUF_MIN = 65536;
+
+/** Smallest accepted --queue-size. */
+static const size_t QUEUE_SIZE_MIN = 1024;
+
+/** Average message size assumed when sizing out_queue.msgs. */
+static const size_t QUEUE_MSG_SIZE_MIN = 16;
+
+/** What to do when a client's output queue is full. */
+enum queue_overflow_policy {
+	OVERFLOW_DROP_OLDEST,
+	OVERFLOW_DROP_CLIENT
+};
+
+/**
+ * Broadcast messages not yet written to a client, a ring buffer with
+ * the message boundaries in a companion ring so that only complete
+ * messages are dropped.
+ */
+struct out_queue {
+	char*		buf;            /**< NULL until first used. */
+	size_t		size;           /**< Allocated size of buf. */
+	size_t		head;           /**< First unwritten byte in buf. */
+	size_t		len;            /**< Number of queued bytes. */
+	size_t*		msgs;           /**< Unwritten bytes of each message. */
+	size_t		msgs_size;
+	size_t		msg_head;
+	size_t		msg_count;
+	int		partial;        /**< First message partially written. */
+	unsigned long	dropped;        /**< Messages dropped on overflow. */
+	unsigned long	queued;         /**< Messages queued, numbers them. */
+};
+
+/** Event types of a subscription. */
+enum {
+	EV_PRESS = 0x1,         /**< First event of a keypress. */
+	EV_REPEAT = 0x2,        /**< Following ones. */
+	EV_RELEASE = 0x4,       /**< Button with LIRC_RELEASE_SUFFIX. */
+	EV_ALL = EV_PRESS | EV_REPEAT | EV_RELEASE
+};
+
+/** A SUBSCRIBE filter: glob patterns and event types. */
+struct subscription {
+	std::string	remote;
+	std::string	button;
+	int		events;
+};
+
+/** A decoded event as parsed from a broadcast message. */
+struct event_info {
+	int		parsed;         /**< 1: parsed, -1: not an event. */
+	int		type;           /**< EV_PRESS, EV_REPEAT or EV_RELEASE. */
+	unsigned long long code;
+	int		reps;
+	char		name[PACKET_SIZE + 1];          /**< Button. */
+	char		button[PACKET_SIZE + 1];        /**< Without suffix. */
+	char		remote[PACKET_SIZE + 1];
+};
+
+/** A connected client. */
+struct client {
+	int		fd;
+	int		type;           /**< CT_LOCAL or CT_REMOTE. */
+	int		events;         /**< Events in poll set. */
+	struct out_queue queue;
+	LineBuffer*	input;          /**< Commands not yet run. */
+	int		send_wait;      /**< Waits for the transmitter. */
+	int		binary;         /**< Gets event_record.h records. */
+	int		ring;           /**< Reads events from the ring. */
+	int		coalesce;       /**< Newer repeats replace queued ones. */
+	unsigned long	repeat_seq;     /**< queue.queued of repeat_name, or 0. */
+	std::string	repeat_name;    /**< Remote and button of the repeat. */
+	std::vector<lirc_t> sim_raw;    /**< SIMULATE_RAW train so far. */
+	int		backlog;        /**< Commands left over by the budget. */
+	std::shared_ptr<const std::string> listing; /**< LIST in progress. */
+	size_t		listing_pos;    /**< Bytes of it written. */
+	std::string	held;           /**< Broadcasts held during the LIST. */
+	/** Events wanted if any matches, all events if empty. */
+	std::vector<struct subscription> subscriptions;
+};
+
 struct peer_connection {
 	char*		host;
 	unsigned short	port;
-	struct timeval	reconnect;
+	struct timeval	reconnect;      /**< Next attempt or connect timeout. */
 	int		connection_failure;
 	int		socket;
+	int		connecting;     /**< Non-blocking connect() pending. */
+	struct addrinfo* addrinfos;     /**< Addresses for connect(). */
+	struct addrinfo* next_addr;     /**< Next one to try. */
+	LineBuffer*	input;          /**< Incomplete packet lines. */
+};
+
+/** An extra device, read by a child process. */
+struct receiver {
+	std::string	driver;
+	std::string	device;
+	std::string	options;        /**< As for --driver-options. */
+	pid_t		pid;            /**< Child, or -1. */
+	int		fd;             /**< Message pipe read end, or -1. */
+	LineBuffer*	input;          /**< Incomplete messages. */
 };
 
+/** Delay before trying a peer again after the first failure [s]. */
+static const int PEER_RETRY_MIN = 1;
+
+/** Max reconnect delay, reached by doubling for each failure [s]. */
+static const int PEER_RETRY_MAX = 60;
+
+/** Max time for a connect() to a peer address [s]. */
+static const int PEER_CONNECT_TIMEOUT = 5;
+
+/** Commands run for a client per wakeup before the others get a turn. */
+static const int COMMAND_BUDGET = 16;
+
+/** Bytes of a LIST reply written per step, a step is a command. */
+static const size_t LIST_STEP = 16384;
+
+#ifdef USE_UINPUT
+/** The name used to register the --uinput-output device. */
+static const char* const UINPUT_DEVNAME = "lircd";
+#endif
+
 
 static const char* const help =
 	"Usage: lircd [options] <config-file>\n"
@@ -140,16 +306,71 @@ static const char* const help =
 	"\t -U --plugindir=dir\t\tDir where drivers are loaded from\n"
 	"\t -l --listen[=[[address:]port]\tListen for network connections\n"
 	"\t -c --connect=host[:port]\tConnect to remote lircd server\n"
+	"\t    --multicast=group[:port]\tAlso send events to this group\n"
+	"\t    --multicast-ttl=hops\tMulticast time to live (default 1)\n"
 	"\t -o --output=socket\t\tOutput socket filename\n"
 	"\t -P --pidfile=file\t\tDaemon pid file\n"
 	"\t -L --logfile=file\t\tLog file path (default: use syslog)'\n"
 	"\t -D[level] --loglevel[=level]\t'info', 'warning', 'notice', etc., or 3..10.\n"
+	"\t    --async-log[=bytes]\t\tWrite log in a thread, buffer size\n"
 	"\t -a --allow-simulate\t\tAccept SIMULATE command\n"
 	"\t -Y --dynamic-codes\t\tEnable dynamic code generation\n"
 	"\t -A --driver-options=key:value[|key:value...]\n"
 	"\t\t\t\t\tSet driver options\n"
 	"\t -e --effective-user=uid\tRun as uid after init as root\n"
-	"\t -R --repeat-max=limit\t\tAllow at most this many repeats\n";
+	"\t -R --repeat-max=limit\t\tAllow at most this many repeats\n"
+	"\t    --queue-size=bytes\t\tOutput buffer size per client\n"
+	"\t    --queue-overflow=policy\t'drop-oldest' or 'drop-client'\n"
+	"\t    --decode-thread\t\tRead and decode input in a separate thread\n"
+	"\t    --rec-buffer-size=edges\tInput buffer size (default 512)\n"
+	"\t    --send-concat-gap=us\tSend repeats with shorter gaps at once\n"
+	"\t    --send-thread\t\tTransmit in a separate thread\n"
+	"\t    --idle-timeout=secs\t\tKeep hardware open when unused\n"
+	"\t    --virtual-clock\t\tTime input by its durations, not the clock\n"
+	"\t    --low-latency\t\tDecode frames without waiting for the gap\n"
+	"\t    --adaptive-order\t\tTry the most used remotes first\n"
+	"\t    --remember-bursts\t\tDecode repeated signals from memory\n"
+	"\t    --realtime=priority\t\tRun with SCHED_FIFO priority\n"
+	"\t    --cpu-affinity=cpus\t\tRun on these cpus e. g., 1 or 0,2-3\n"
+	"\t    --lock-memory\t\tLock all memory, avoiding page faults\n"
+	"\t    --event-ring=slots\t\tShare events in memory with clients\n"
+	"\t    --decode-trace=events\tKeep this many decoding events (4096)\n"
+	"\t    --config-cache=file\t\tCompiled config file cache\n"
+	"\t    --lazy-raw-codes\t\tLoad raw codes when first used\n"
+	"\t    --extra-devices=driver:device[|options][,...]\n"
+	"\t\t\t\t\tAlso receive from these devices\n"
+#ifdef USE_UINPUT
+	"\t    --uinput-output[=device]\tWrite decoded keys to uinput\n"
+#endif
+	;
+
+
+/** getopt_long() values for options without a short form. */
+enum long_only_option {
+	OPT_QUEUE_SIZE = 256,
+	OPT_QUEUE_OVERFLOW,
+	OPT_DECODE_THREAD,
+	OPT_REC_BUFFER_SIZE,
+	OPT_SEND_CONCAT_GAP,
+	OPT_SEND_THREAD,
+	OPT_IDLE_TIMEOUT,
+	OPT_VIRTUAL_CLOCK,
+	OPT_ASYNC_LOG,
+	OPT_DECODE_TRACE,
+	OPT_CONFIG_CACHE,
+	OPT_LAZY_RAW_CODES,
+	OPT_EXTRA_DEVICES,
+	OPT_UINPUT_OUTPUT,
+	OPT_LOW_LATENCY,
+	OPT_ADAPTIVE_ORDER,
+	OPT_REMEMBER_BURSTS,
+	OPT_REALTIME,
+	OPT_CPU_AFFINITY,
+	OPT_LOCK_MEMORY,
+	OPT_EVENT_RING,
+	OPT_MULTICAST,
+	OPT_MULTICAST_TTL
+};
 
 
 static const struct option lircd_options[] = {
@@ -175,6 +396,29 @@ static const struct option lircd_options[] = {
 	{ "effective-user", required_argument, NULL, 'e' },
 	{ "uinput",         no_argument,       NULL, 'u' },
 	{ "repeat-max",	    required_argument, NULL, 'R' },
+	{ "queue-size",	    required_argument, NULL, OPT_QUEUE_SIZE },
+	{ "queue-overflow", required_argument, NULL, OPT_QUEUE_OVERFLOW },
+	{ "decode-thread",  no_argument,       NULL, OPT_DECODE_THREAD },
+	{ "rec-buffer-size", required_argument, NULL, OPT_REC_BUFFER_SIZE },
+	{ "send-concat-gap", required_argument, NULL, OPT_SEND_CONCAT_GAP },
+	{ "send-thread",    no_argument,       NULL, OPT_SEND_THREAD },
+	{ "idle-timeout",   required_argument, NULL, OPT_IDLE_TIMEOUT },
+	{ "virtual-clock",  no_argument,       NULL, OPT_VIRTUAL_CLOCK },
+	{ "async-log",	    optional_argument, NULL, OPT_ASYNC_LOG },
+	{ "decode-trace",   required_argument, NULL, OPT_DECODE_TRACE },
+	{ "config-cache",   required_argument, NULL, OPT_CONFIG_CACHE },
+	{ "lazy-raw-codes", no_argument,       NULL, OPT_LAZY_RAW_CODES },
+	{ "extra-devices",  required_argument, NULL, OPT_EXTRA_DEVICES },
+	{ "uinput-output",  optional_argument, NULL, OPT_UINPUT_OUTPUT },
+	{ "low-latency",    no_argument,       NULL, OPT_LOW_LATENCY },
+	{ "adaptive-order", no_argument,       NULL, OPT_ADAPTIVE_ORDER },
+	{ "remember-bursts", no_argument,      NULL, OPT_REMEMBER_BURSTS },
+	{ "realtime",	    required_argument, NULL, OPT_REALTIME },
+	{ "cpu-affinity",   required_argument, NULL, OPT_CPU_AFFINITY },
+	{ "lock-memory",    no_argument,       NULL, OPT_LOCK_MEMORY },
+	{ "event-ring",	    required_argument, NULL, OPT_EVENT_RING },
+	{ "multicast",	    required_argument, NULL, OPT_MULTICAST },
+	{ "multicast-ttl",  required_argument, NULL, OPT_MULTICAST_TTL },
 	{ 0,		    0,		       0,    0	 }
 };
 
@@ -184,13 +428,35 @@ static const struct option lircd_options[] = {
 static int list(int fd, char* message, char* arguments);
 static int set_transmitters(int fd, char* message, char* arguments);
 static int set_inputlog(int fd, char* message, char* arguments);
+static int set_clock(int fd, char* message, char* arguments);
+static int dump_decode_trace(int fd, char* message, char* arguments);
+static int startup_times(int fd, char* message, char* arguments);
+static int metrics(int fd, char* message, char* arguments);
+static int memory(int fd, char* message, char* arguments);
+static void log_memory_usage(void);
+static void list_cache_clear(void);
 static int simulate(int fd, char* message, char* arguments);
+static int simulate_raw(int fd, char* message, char* arguments);
+static int simulate_code(int fd, char* message, char* arguments);
 static int send_once(int fd, char* message, char* arguments);
 static int drv_option(int fd, char* message, char* arguments);
+static int timing(int fd, char* message, char* arguments);
 static int send_start(int fd, char* message, char* arguments);
 static int send_stop(int fd, char* message, char* arguments);
 static int send_core(int fd, char* message, char* arguments, int once);
+static int send_macro(int fd, char* message, char* arguments);
 static int version(int fd, char* message, char* arguments);
+static int subscribe(int fd, char* message, char* arguments);
+static int binary(int fd, char* message, char* arguments);
+static int event_ring(int fd, char* message, char* arguments);
+static int coalesce(int fd, char* message, char* arguments);
+static int run_command(int fd, char* line, size_t length);
+static int make_pipe(int fds[2]);
+static void receivers_start(void);
+static void receivers_stop(void);
+
+void broadcast_message(const char* message);
+void remove_client(int fd);
 
 struct protocol_directive {
 	const char* name;
@@ -215,10 +481,30 @@ static struct ir_remote* remotes;
 static struct ir_remote* free_remotes = NULL;
 
 static int repeat_fd = -1;
+
+/** A SEND_MACRO step. */
+struct macro_item {
+	struct ir_remote*	remote;
+	struct ir_ncode*	code;
+	int			reps;
+};
+
+/* The running SEND_MACRO, replied to on repeat_fd when done. */
+static std::vector<struct macro_item> macro_items;
+static size_t macro_next;
+static int macro_gap_wait;      /* Timer runs for gap before next item. */
+/* Former repeat_fds with buffered commands to run in the main loop. */
+static std::vector<int> pending_fds;
+/* The pending_fds run in this wakeup, the new ones wait for the next. */
+static std::vector<int> pending_batch;
 static char* repeat_message = NULL;
+
+/** Input of the client running a command in run_commands(), or NULL. */
+static LineBuffer* running_input = NULL;
 static uint32_t repeat_max = REPEAT_MAX_DEFAULT;
 
 static const char* configfile = NULL;
+static const char* config_cache = NULL;
 static FILE* pidf;
 static const char* pidfile = PIDFILE;
 static const char* lircdfile = LIRCD;
@@ -229,10 +515,23 @@ static const struct protocol_directive directives[] = {
 	{ "SEND_START",	      send_start       },
 	{ "SEND_STOP",	      send_stop	       },
 	{ "SET_INPUTLOG",     set_inputlog     },
+	{ "SET_CLOCK",	      set_clock	       },
+	{ "DUMP_DECODE_TRACE", dump_decode_trace },
+	{ "STARTUP_TIMES",    startup_times    },
+	{ "METRICS",	      metrics	       },
+	{ "MEMORY",	      memory	       },
 	{ "DRV_OPTION",	      drv_option       },
+	{ "TIMING",	      timing	       },
 	{ "VERSION",	      version	       },
 	{ "SET_TRANSMITTERS", set_transmitters },
 	{ "SIMULATE",	      simulate	       },
+	{ "SIMULATE_RAW",     simulate_raw     },
+	{ "SIMULATE_CODE",    simulate_code    },
+	{ "SEND_MACRO",	      send_macro       },
+	{ "SUBSCRIBE",	      subscribe	       },
+	{ "BINARY",	      binary	       },
+	{ "EVENT_RING",	      event_ring       },
+	{ "COALESCE",	      coalesce	       },
 	{ NULL,		      NULL	       }
 	/*
 	 * {"DEBUG",debug},
@@ -258,35 +557,182 @@ static const char* const protocol_string[] = {
 	"SIGHUP\n"
 };
 
-/* Used to be depending on FD_SETSIZE, but using poll() it's now arbitrary. */
-static const int MAX_PEERS  = 256;
-static const int MAX_CLIENTS = 256;
-
 static int sockfd, sockinet;
 static int do_shutdown;
 
-static int clis[MAX_CLIENTS];
+/*
+ * Clients in no particular order, removed by moving the last one into
+ * the empty slot. client_slot[fd] is the index of fd in it, or -1.
+ */
+static std::vector<struct client> clients;
+static std::vector<int> client_slot;
 
 static int nodaemon = 0;
+
+/** Seconds to keep unused hardware initialized, see release_hw(). */
+static int idle_timeout = 0;
+/** Hardware is initialized but unused, TIMER_IDLE running. */
+static int hw_idle = 0;
 static loglevel_t loglevel_opt = LIRC_NOLOG;
 
 #define CT_LOCAL  1
 #define CT_REMOTE 2
 
-static int cli_type[MAX_CLIENTS];
-static int clin = 0; /* Number of clients */
+
+/* Hardware is read by the decode thread instead of the main loop. */
+static int decode_thread = 0;
+
+/*
+ * The optional decode thread reads and decodes driver input, handing
+ * the decoded messages to the main loop through a single producer,
+ * single consumer queue and waking it up with a pipe. It decodes with
+ * decode_remotes, swapped by config(). The old remotes are freed when
+ * the thread has completed a cycle after the swap, see
+ * free_old_remotes().
+ */
+
+static const size_t DECODE_QUEUE_SIZE = 256;
+
+static struct {
+	char			msgs[DECODE_QUEUE_SIZE][PACKET_SIZE + 1];
+	std::atomic<size_t>	head;   /* Next to read, main loop only. */
+	std::atomic<size_t>	tail;   /* Next to write, thread only. */
+} decode_queue;
+
+static std::atomic<struct ir_remote*> decode_remotes(NULL);
+static std::atomic<unsigned long> decode_cycles(0);
+static unsigned long decode_swap_cycle;
+
+static pthread_t decode_tid;
+static int decode_wakeup[2] = { -1, -1 };       /* thread -> main loop */
+static int decode_stop[2] = { -1, -1 };         /* main loop -> thread */
+static int decode_kick[2] = { -1, -1 };         /* remotes swapped */
+
+
+/** Publish remotes to the decode thread, from config(). */
+static void decode_swap_remotes(void)
+{
+	decode_remotes.store(remotes);
+	decode_swap_cycle = decode_cycles.load();
+	if (decode_thread && write(decode_kick[1], "", 1) == -1
+	    && errno != EAGAIN)
+		log_perror_warn("Cannot notify decode thread");
+}
+
+
+static void decode_join(void)
+{
+	static int joined = 0;
+
+	if (!decode_thread || joined)
+		return;
+	joined = 1;
+	if (write(decode_stop[1], "", 1) == 1)
+		pthread_join(decode_tid, NULL);
+}
+
+
+/* Transmissions run in a separate thread instead of the main loop. */
+static int send_thread = 0;
+
+/*
+ * The optional send thread runs the driver's send_func() so the main
+ * loop keeps serving clients while a code is sent. The main loop still
+ * runs the repeat and macro logic: it hands over one send_job at a time
+ * through a pipe and calls its done function when the thread has
+ * signaled completion. Meanwhile, clients with send commands wait in a
+ * FIFO for the transmitter mask set by SET_TRANSMITTERS when they were
+ * queued, see send_dispatch().
+ */
+struct send_job {
+	struct ir_remote*	remote;
+	struct ir_ncode*	code;
+	/* If not empty, sent instead of code, see transmit_frames(). */
+	std::vector<struct macro_item>	sequence;
+	uint32_t		tx_mask;        /* Transmitters, 0: not set. */
+	void			(*done)(const struct send_job* job);
+	int			result;         /* From send_ir_ncode(). */
+	struct timespec		before_send;
+	lirc_t			sum;            /* send_buffer_sum(). */
+};
+
+static struct send_job send_job;
+static int send_busy = 0;               /* Thread or TIMER_SEND has it. */
+static int send_deferred = 0;           /* send_job waits for TIMER_SEND. */
+static pthread_t send_tid;
+static int send_request[2] = { -1, -1 };        /* main loop -> thread */
+static int send_result[2] = { -1, -1 };         /* thread -> main loop */
+
+static uint32_t tx_mask = 0;            /* Last SET_TRANSMITTERS mask. */
+static uint32_t command_tx_mask = 0;    /* For the command being run. */
+static uint32_t applied_tx_mask = 0;    /* In the driver, thread only. */
+
+/* Waiting clients by transmitter mask, and the mask served last. */
+static std::map<uint32_t, std::deque<int> > send_fifos;
+static uint32_t send_fifo_last = 0;
+/* Also answered like repeat_fd, their SEND_ONCE was sent with it. */
+static std::vector<int> coalesced_fds;
+
+
+static void send_join(void)
+{
+	static int joined = 0;
+
+	if (!send_thread || joined)
+		return;
+	joined = 1;
+	if (write(send_request[1], "q", 1) == 1)
+		pthread_join(send_tid, NULL);
+}
+
+
+/** Remove fd from the FIFOs of waiting clients. */
+static void send_unwait(int fd)
+{
+	std::map<uint32_t, std::deque<int> >::iterator it;
+
+	it = send_fifos.begin();
+	while (it != send_fifos.end()) {
+		it->second.erase(std::remove(it->second.begin(),
+					     it->second.end(), fd),
+				 it->second.end());
+		if (it->second.empty())
+			send_fifos.erase(it++);
+		else
+			++it;
+	}
+}
+
+
+static size_t queue_size = 16384;
+static enum queue_overflow_policy queue_overflow = OVERFLOW_DROP_OLDEST;
 
 static int listen_tcpip = 0;
 static unsigned short int port = LIRC_INET_PORT;
 static struct in_addr address;
 
-static struct peer_connection* peers[MAX_PEERS];
-static int peern = 0;
+/** --multicast socket and group, -1 if disabled. */
+static int multicast_fd = -1;
+static int multicast = 0;
+static struct sockaddr_in multicast_addr;
+static uint64_t multicast_seq = 0;      /**< Of the last datagram. */
+
+static std::vector<struct peer_connection*> peers;
+
+/*
+ * Extra devices given by --extra-devices. Plugins keep their state in
+ * drv and in static variables, so each of them runs in a forked child
+ * with its own plugin instance, driver state and decoder. The child
+ * decodes using the remotes parsed by the main process and writes the
+ * messages to a pipe; the main loop broadcasts them like its own. The
+ * children are restarted after SIGHUP to use the new config.
+ */
+static std::vector<struct receiver> receivers;
 
 static int daemonized = 0;
 static int allow_simulate = 0;
 
-static sig_atomic_t term = 0, hup = 0, alrm = 0;
+static sig_atomic_t term = 0, hup = 0, restart = 0;
 static int termsig;
 
 static uint32_t setup_min_freq = 0, setup_max_freq = 0;
@@ -297,7 +743,8 @@ static lirc_t setup_max_pulse = 0, setup_max_space = 0;
 /* Use already opened hardware? */
 int use_hw(void)
 {
-	return clin > 0 || repeat_remote != NULL;
+	return decode_thread || send_thread || !clients.empty()
+	       || repeat_remote != NULL || multicast;
 }
 
 /* set_transmitters only supports 32 bit int */
@@ -308,1677 +755,6031 @@ int max(int a, int b)
 	return a > b ? a : b;
 }
 
-/* cut'n'paste from fileutils-3.16: */
 
-#define isodigit(c) ((c) >= '0' && (c) <= '7')
+/*
+ * Serializes driver calls with the decode and send threads, if any, and
+ * with the startup init thread while it runs.
+ */
+static pthread_mutex_t driver_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/* Return a positive integer containing the value of the ASCII
-* octal number S.  If S is not an octal number, return -1.  */
+/* Set while startup_init() runs in its own thread. */
+static int init_pending = 0;
 
-static int oatoi(const char* s)
+
+static void driver_lock(void)
 {
-	register int i;
+	if (decode_thread || send_thread || init_pending)
+		pthread_mutex_lock(&driver_mutex);
+}
 
-	if (*s == 0)
-		return -1;
-	for (i = 0; isodigit(*s); ++s)
-		i = i * 8 + *s - '0';
-	if (*s)
+
+static void driver_unlock(void)
+{
+	if (decode_thread || send_thread || init_pending)
+		pthread_mutex_unlock(&driver_mutex);
+}
+
+/*
+ * The main loop waits on a persistent set of file descriptors. Entries
+ * are added and removed as clients, peers and the driver come and go
+ * instead of rebuilding the complete set on every wakeup. On Linux the
+ * set is an epoll instance which only reports the ready fds, elsewhere
+ * it's a pollfd array handed to curl_poll().
+ */
+
+/** What a fd in the poll set represents. */
+enum fd_kind {
+	FD_SOCKFD = 1,
+	FD_SOCKINET,
+	FD_DRIVER,
+	FD_CLIENT,
+	FD_PEER,
+	FD_REPEAT,
+	FD_DECODER,
+	FD_SENDER,
+	FD_RECEIVER,
+	FD_HOTPLUG
+};
+
+/** A fd reported as ready by poll_wait(). */
+struct ready_fd {
+	int		fd;
+	enum fd_kind	kind;
+	int		revents;        /* POLLIN, POLLHUP, ... */
+};
+
+/** Max number of ready fds handled in one wakeup. */
+static const int POLL_BATCH = 64;
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0
+#endif
+
+/** Driver fd currently in the poll set, or -1. */
+static int driver_pollfd = -1;
+
+/** Events polled on driver_pollfd. */
+static int driver_pollevents = 0;
+
+/**
+ * Wakeups with the driver fd hung up but readable in a row. Drivers
+ * may read what's left, but not all of them close the device on read
+ * errors.
+ */
+static int driver_hangups = 0;
+
+/** Max driver_hangups before lircd closes the device itself. */
+static const int DRIVER_HANGUPS_MAX = 16;
+
+
+/** A poll timeout in ms, rounded up so short waits don't spin. */
+static int timeout_ms(const struct timespec* timeout)
+{
+	if (timeout == NULL)
 		return -1;
-	return i;
+	return timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
 }
 
-/* A safer write(), since sockets might not write all but only some of the
- * bytes requested */
-int write_socket(int fd, const char* buf, int len)
+#ifdef HAVE_SYS_EPOLL_H
+
+static int epoll_fd = -1;
+
+/** Fds which cannot be used with epoll e. g., regular files. */
+static std::vector<struct ready_fd> always_ready;
+
+
+static int poll_init(void)
 {
-	int done, todo = len;
-	int retries = WRITE_RETRIES;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		log_perror_err("Cannot create epoll instance");
+		return 0;
+	}
+	return 1;
+}
 
-	while (todo) {
-		done = write(fd, buf, todo);
-		if (done <= 0) {
-			log_perror_debug("Error in write_socket");
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				retries -= 1;
-				if (retries <= 0)
-					return done;
-				usleep(WRITE_SLEEP_US);
-				continue;
-			} else {
-				return done;
-			}
+
+static void poll_remove(int fd)
+{
+	std::vector<struct ready_fd>::iterator it;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == 0)
+		return;
+	for (it = always_ready.begin(); it != always_ready.end(); it++) {
+		if (it->fd == fd) {
+			always_ready.erase(it);
+			return;
 		}
-		buf += done;
-		todo -= done;
 	}
-	return len;
 }
 
-int write_socket_len(int fd, const char* buf)
+
+/** Set the events (POLLIN, POLLOUT) to wait for on fd, 0 removes it. */
+static int poll_set(int fd, enum fd_kind kind, int events)
 {
-	int len;
+	struct epoll_event ev;
+	struct ready_fd rfd = { fd, kind, POLLIN };
 
-	len = strlen(buf);
-	if (write_socket(fd, buf, len) < len)
-		return 0;
-	return 1;
+	if (events == 0) {
+		poll_remove(fd);
+		return 1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	/* EPOLLIN, EPOLLOUT etc. have the same values as POLL*. */
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+		return 1;
+	if (errno == ENOENT && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+		return 1;
+	if (errno == EPERM) {
+		/* Not pollable, which poll(2) reports as always ready. */
+		always_ready.push_back(rfd);
+		return 1;
+	}
+	log_perror_warn("Cannot add fd %d to epoll set", fd);
+	return 0;
 }
 
 
-int read_timeout(int fd, char* buf, int len, int timeout_us)
+/**
+ * Wait for ready fds at most timeout, forever if NULL. sigmask is the
+ * signal mask while waiting, set atomically as for ppoll(2).
+ */
+static int poll_wait(struct ready_fd* ready, int max,
+		     const struct timespec* timeout, const sigset_t* sigmask)
 {
-	int ret, n;
-	struct pollfd  pfd = {fd, POLLIN, 0}; // fd, events, revents
-	int timeout = timeout_us > 0 ? timeout_us/1000 : -1;
-
+	static const struct timespec zero = { 0, 0 };
+	struct epoll_event events[POLL_BATCH];
+	unsigned int i;
+	int n;
+#ifdef HAVE_EPOLL_PWAIT2
+	static int have_pwait2 = 1;
+#endif
 
-	/* CAVEAT: (from libc documentation)
-	 * Any signal will cause `select' to return immediately.  So if your
-	 * program uses signals, you can't rely on `select' to keep waiting
-	 * for the full time specified.  If you want to be sure of waiting
-	 * for a particular amount of time, you must check for `EINTR' and
-	 * repeat the `select' with a newly calculated timeout based on the
-	 * current time.  See the example below.
-	 *
-	 * The timeout is not recalculated here although it should, we keep
-	 * waiting as long as there are EINTR.
-	 */
-	do
-		ret = curl_poll(&pfd, 1, timeout);
-	while (ret == -1 && errno == EINTR);
-	if (ret == -1) {
-		log_perror_err("read_timeout: curl_poll() failed");
-		return -1;
-	};
-	if (ret == 0)
-		return 0;       /* timeout */
-	n = read(fd, buf, len);
-	if (n == -1) {
-		log_perror_err("read_timeout: read() failed");
+	if (max > POLL_BATCH)
+		max = POLL_BATCH;
+	if (!always_ready.empty())
+		timeout = &zero;
+#ifdef HAVE_EPOLL_PWAIT2
+	n = -1;
+	if (have_pwait2) {
+		n = epoll_pwait2(epoll_fd, events, max, timeout, sigmask);
+		if (n == -1 && errno == ENOSYS)
+			have_pwait2 = 0;        /* Kernel before 5.11. */
+	}
+	if (!have_pwait2)
+#endif
+		n = epoll_pwait(epoll_fd, events, max, timeout_ms(timeout),
+				sigmask);
+	if (n == -1)
 		return -1;
+	for (i = 0; i < (unsigned int)n; i += 1) {
+		ready[i].fd = (int)(events[i].data.u64 & 0xffffffff);
+		ready[i].kind = (enum fd_kind)(events[i].data.u64 >> 32);
+		ready[i].revents = events[i].events;
 	}
+	for (i = 0; i < always_ready.size() && n < max; i += 1)
+		ready[n++] = always_ready[i];
 	return n;
 }
 
+#else   /* HAVE_SYS_EPOLL_H */
 
-static int setup_frequency(void)
+static std::vector<struct pollfd> pollfds;
+static std::vector<enum fd_kind> pollfd_kinds;
+
+
+static int poll_init(void)
 {
-	uint32_t freq;
+	return 1;
+}
 
-	if (!(curr_driver->features & LIRC_CAN_SET_REC_CARRIER))
+
+static void poll_remove(int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < pollfds.size(); i += 1) {
+		if (pollfds[i].fd == fd) {
+			pollfds[i] = pollfds.back();
+			pollfd_kinds[i] = pollfd_kinds.back();
+			pollfds.pop_back();
+			pollfd_kinds.pop_back();
+			return;
+		}
+	}
+}
+
+
+/** Set the events (POLLIN, POLLOUT) to wait for on fd, 0 removes it. */
+static int poll_set(int fd, enum fd_kind kind, int events)
+{
+	struct pollfd pfd = { fd, (short)events, 0 };
+	unsigned int i;
+
+	if (events == 0) {
+		poll_remove(fd);
 		return 1;
-	if (setup_min_freq == 0 || setup_max_freq == 0) {
-		setup_min_freq = DEFAULT_FREQ;
-		setup_max_freq = DEFAULT_FREQ;
 	}
-	if (curr_driver->features & LIRC_CAN_SET_REC_CARRIER_RANGE
-	    && setup_min_freq != setup_max_freq
-	) {
-		if (curr_driver->drvctl_func(LIRC_SET_REC_CARRIER_RANGE,
-					     &setup_min_freq) == -1
-		) {
-			log_error("could not set receive carrier");
-			log_perror_err(__func__);
-			return 0;
+	for (i = 0; i < pollfds.size(); i += 1) {
+		if (pollfds[i].fd == fd) {
+			pollfds[i].events = events;
+			pollfd_kinds[i] = kind;
+			return 1;
 		}
-		freq = setup_max_freq;
-	} else {
-		freq = (setup_min_freq + setup_max_freq) / 2;
-	}
-	if (curr_driver->drvctl_func(LIRC_SET_REC_CARRIER, &freq) == -1) {
-		log_error("could not set receive carrier");
-		log_perror_err(__func__);
-		return 0;
 	}
+	pollfds.push_back(pfd);
+	pollfd_kinds.push_back(kind);
 	return 1;
 }
 
 
-static int setup_timeout(void)
+static int poll_wait(struct ready_fd* ready, int max,
+		     const struct timespec* timeout, const sigset_t* sigmask)
 {
-	// Previously, the first three variables used "lirc_t"  here. Since
-	// they are used to denote timeouts (in micro seconds() and can
-	// impossibly be used to denote the durations that are marks, spaces,
-	// or timeouts; lirc_t is not the appropriate data type.
-	uint32_t val;
-	uint32_t min_timeout = 0;
-	uint32_t max_timeout = PULSE_MASK; // largest duration a lirct_t can hold
-	uint32_t enable = 1;
-
-	if (!(curr_driver->features & LIRC_CAN_SET_REC_TIMEOUT))
-		return 1;
-
-	if (setup_max_space == 0)
-		return 1;
-	if (curr_driver->drvctl_func(LIRC_GET_MIN_TIMEOUT, &min_timeout) != 0
-	    || curr_driver->drvctl_func(LIRC_GET_MAX_TIMEOUT, &max_timeout) != 0
-	) {
-		return 0;
-	}
-	if ((uint32_t) setup_max_gap >= min_timeout &&
-	    (uint32_t) setup_max_gap <= max_timeout
-	) {
-		/* may help to detect end of signal faster */
-		val = setup_max_gap;
-	} else {
-		/* keep timeout to a minimum */
-		val = setup_max_space + 1;
-		if (val < min_timeout)
-			val = min_timeout;
-		else if (val > max_timeout)
-			/* maximum timeout smaller than maximum possible
-			 * space, hmm */
-			val = max_timeout;
-	}
+	unsigned int i;
+	int n;
+	int r;
 
-	if (curr_driver->drvctl_func(LIRC_SET_REC_TIMEOUT, &val) != 0) {
-		log_error("could not set timeout");
-		log_perror_err(__func__);
-		return 0;
+#ifdef HAVE_PPOLL
+	r = ppoll(pollfds.data(), pollfds.size(), timeout, sigmask);
+#else
+	r = curl_poll(pollfds.data(), pollfds.size(), timeout_ms(timeout));
+#endif
+	if (r <= 0)
+		return r;
+	n = 0;
+	for (i = 0; i < pollfds.size() && n < max; i += 1) {
+		if (pollfds[i].revents == 0)
+			continue;
+		ready[n].fd = pollfds[i].fd;
+		ready[n].kind = pollfd_kinds[i];
+		ready[n].revents = pollfds[i].revents;
+		n += 1;
 	}
-	curr_driver->drvctl_func(LIRC_SET_REC_TIMEOUT_REPORTS, &enable);
-	return 1;
+	return n;
 }
 
+#endif  /* HAVE_SYS_EPOLL_H */
 
-static int setup_hardware(void)
+
+static int poll_add(int fd, enum fd_kind kind)
 {
-	int ret = 1;
+	return poll_set(fd, kind, POLLIN);
+}
 
-	if (curr_driver->fd != -1 && curr_driver->drvctl_func) {
-		if ((curr_driver->features & LIRC_CAN_SET_REC_CARRIER)
-		    || (curr_driver->features & LIRC_CAN_SET_REC_TIMEOUT)
-		    || (curr_driver->features & LIRC_CAN_SET_REC_FILTER)) {
-				ret = setup_frequency() && setup_timeout();
-		}
-	}
-	return ret;
+
+/*
+ * Deadlines of the main loop, a peer reconnect or connect() timeout,
+ * the driver timer and the repeat timer without timerfd. They are kept
+ * ordered by time, so the poll timeout is the first one. Each owner has
+ * at most one timer of a kind.
+ */
+
+enum timer_kind {
+	TIMER_PEER,             /**< Owner is a struct peer_connection. */
+	TIMER_REPEAT,           /**< No owner. */
+	TIMER_IDLE,             /**< No owner, see release_hw(). */
+	TIMER_SEND,             /**< No owner, see start_send(). */
+	TIMER_DRIVER            /**< No owner, see sync_driver_timer(). */
+};
+
+typedef std::pair<int, const void*> timer_key;
+typedef std::multimap<long long, timer_key> timer_queue;
+
+static timer_queue timers;
+static std::map<timer_key, timer_queue::iterator> timer_index;
+
+
+static long long timeval_usecs(const struct timeval* tv)
+{
+	return tv->tv_sec * 1000000LL + tv->tv_usec;
 }
 
-static void check_config_duplicates(const struct ir_remote* head)
+
+/** Record how late a wait started at start for timeout timed out. */
+static void observe_wakeup(const struct timeval* start,
+			   const struct timeval* timeout,
+			   const struct timeval* now)
 {
-	std::set<std::string> names;
-	const struct ir_remote* ir;
-	const char* const errmsg =
-		"Duplicate remotes \"%s\" found, problems ahead";
+	long long late;
 
-	for (ir = head; ir != NULL; ir = ir->next) {
-		std::string name(ir->name);
-		if (names.count(name) == 1)
-			log_warn(errmsg, name.c_str())
-		else
-			names.insert(name);
-	}
+	late = timeval_usecs(now) - timeval_usecs(start)
+	       - timeval_usecs(timeout);
+	metrics_observe(METRIC_WAKEUP_LATENCY, late > 0 ? late : 0);
 }
 
 
-void config(void)
+static void timer_clear(enum timer_kind kind, const void* owner)
 {
-	FILE* fd;
-	struct ir_remote* config_remotes;
-	const char* filename = configfile;
+	auto it = timer_index.find(timer_key(kind, owner));
 
-	if (filename == NULL)
-		filename = LIRCDCFGFILE;
-
-	if (free_remotes != NULL) {
-		log_error("cannot read config file");
-		log_error("old config is still in use");
+	if (it == timer_index.end())
 		return;
-	}
-	fd = fopen(filename, "r");
-	if (fd == NULL && errno == ENOENT && configfile == NULL) {
-		/* try old lircd.conf location */
-		int save_errno = errno;
+	timers.erase(it->second);
+	timer_index.erase(it);
+}
 
-		fd = fopen(LIRCDOLDCFGFILE, "r");
-		if (fd != NULL)
-			filename = LIRCDOLDCFGFILE;
-		else
-			errno = save_errno;
-	}
-	if (fd == NULL) {
-		log_perror_err("could not open config file '%s'", filename);
-		return;
-	}
-	configfile = filename;
-	config_remotes = read_config(fd, configfile);
-	check_config_duplicates(config_remotes);
-	fclose(fd);
-	if (config_remotes == (void*)-1) {
-		log_error("reading of config file failed");
-	} else {
-		log_trace("config file read");
-		if (config_remotes == NULL) {
-			log_warn("config file %s contains no valid remote control definition",
-				  filename);
-		}
-		/* I cannot free the data structure
-		 * as they could still be in use */
-		free_remotes = remotes;
-		remotes = config_remotes;
 
-		get_frequency_range(remotes, &setup_min_freq, &setup_max_freq);
-		get_filter_parameters(remotes, &setup_max_gap, &setup_min_pulse,
-				      &setup_min_space, &setup_max_pulse,
-				      &setup_max_space);
+/** Set the timer of kind and owner to expire at when (monotonic). */
+static void timer_set(enum timer_kind kind, const void* owner,
+		      const struct timeval* when)
+{
+	timer_key key(kind, owner);
 
-		setup_hardware();
-	}
+	timer_clear(kind, owner);
+	timer_index[key] = timers.insert(std::make_pair(timeval_usecs(when),
+							key));
 }
 
 
-void remove_client(int fd)
+/** Set left to the time until the first timer, return 0 if none. */
+static int timer_next(struct timeval* left)
 {
-	int i;
+	struct timeval now;
+	long long usecs;
 
-	for (i = 0; i < clin; i++) {
-		if (clis[i] == fd) {
-			shutdown(clis[i], 2);
-			close(clis[i]);
-			log_info("removed client");
-
-			clin--;
-			if (!use_hw() && curr_driver->deinit_func)
-				curr_driver->deinit_func();
-			for (; i < clin; i++)
-				clis[i] = clis[i + 1];
-			return;
+	if (timers.empty())
+		return 0;
+	get_monotonic_time(&now);
+	usecs = timers.begin()->first - timeval_usecs(&now);
+	if (usecs < 0)
+		usecs = 0;
+	left->tv_sec = usecs / 1000000;
+	left->tv_usec = usecs % 1000000;
+	return 1;
+}
+
+
+/** Remove the expired timers of kind, return their number. */
+static int timers_expire(enum timer_kind kind)
+{
+	struct timeval now;
+	long long usecs;
+	timer_queue::iterator it;
+	int count = 0;
+
+	get_monotonic_time(&now);
+	usecs = timeval_usecs(&now);
+	for (it = timers.begin(); it != timers.end() && it->first <= usecs; ) {
+		if (it->second.first != kind) {
+			++it;
+			continue;
 		}
+		timer_index.erase(it->second);
+		it = timers.erase(it);
+		count++;
 	}
-	log_trace("internal error in remove_client: no such fd");
+	return count;
 }
 
 
-void sigterm(int sig)
+/*
+ * Repeats are timed by a timerfd in the poll set when available, else
+ * by the poll timeout of the timers above. The deadline is an absolute
+ * CLOCK_MONOTONIC time computed from the start of the previous
+ * transmission, so the time spent in the main loop does not add to the
+ * gap.
+ */
+
+#ifdef HAVE_SYS_TIMERFD_H
+
+static int repeat_timer_fd = -1;
+
+
+static int repeat_timer_init(void)
 {
-	/* all signals are blocked now */
-	if (term)
-		return;
-	term = 1;
-	termsig = sig;
+	repeat_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					 TFD_NONBLOCK | TFD_CLOEXEC);
+	if (repeat_timer_fd == -1) {
+		log_perror_err("Cannot create repeat timer");
+		return 0;
+	}
+	return poll_add(repeat_timer_fd, FD_REPEAT);
 }
 
-void dosigterm(int sig)
+
+/** Arm the timer to expire at when, or disarm it if when is NULL. */
+static void repeat_timer_set(const struct timespec* when)
 {
-	int i;
+	struct itimerspec spec;
+
+	memset(&spec, 0, sizeof(spec));
+	if (when != NULL)
+		spec.it_value = *when;
+	if (timerfd_settime(repeat_timer_fd, TFD_TIMER_ABSTIME,
+			    &spec, NULL) == -1)
+		log_perror_warn("Cannot set repeat timer");
+}
 
-	signal(SIGALRM, SIG_IGN);
-	log_notice("caught signal");
 
-	if (free_remotes != NULL)
-		free_config(free_remotes);
-	free_config(remotes);
-	repeat_remote = NULL;
-	for (i = 0; i < clin; i++) {
-		shutdown(clis[i], 2);
-		close(clis[i]);
-	}
-	;
-	if (do_shutdown)
-		shutdown(sockfd, 2);
-	close(sockfd);
+/** Return true if the timer has expired since last armed. */
+static int repeat_timer_expired(void)
+{
+	uint64_t expirations;
 
-	if (listen_tcpip) {
-		shutdown(sockinet, 2);
-		close(sockinet);
-	}
-	fclose(pidf);
-	(void)unlink(pidfile);
-	if (curr_driver->close_func)
-		curr_driver->close_func();
-	if (use_hw() && curr_driver->deinit_func)
-		curr_driver->deinit_func();
-	if (curr_driver->close_func)
-		curr_driver->close_func();
-	lirc_log_close();
-	signal(sig, SIG_DFL);
-	if (sig == SIGUSR1)
-		exit(0);
-	raise(sig);
+	return read(repeat_timer_fd, &expirations, sizeof(expirations))
+	       == sizeof(expirations);
 }
 
-void sighup(int sig)
+#else   /* HAVE_SYS_TIMERFD_H */
+
+static int repeat_timer_init(void)
 {
-	hup = 1;
+	return 1;
 }
 
-void dosighup(int sig)
+
+static void repeat_timer_set(const struct timespec* when)
 {
-	int i;
+	struct timeval tv;
 
-	/* reopen logfile first */
-	if (lirc_log_reopen() != 0) {
-		/* can't print any error messagees */
-		dosigterm(SIGTERM);
+	if (when == NULL) {
+		timer_clear(TIMER_REPEAT, NULL);
+		return;
 	}
+	tv.tv_sec = when->tv_sec;
+	tv.tv_usec = when->tv_nsec / 1000;
+	timer_set(TIMER_REPEAT, NULL, &tv);
+}
 
-	config();
 
-	for (i = 0; i < clin; i++) {
-		if (!
-		    (write_socket_len(clis[i], protocol_string[P_BEGIN])
-		     && write_socket_len(clis[i], protocol_string[P_SIGHUP])
-		     && write_socket_len(clis[i], protocol_string[P_END]))) {
-			remove_client(clis[i]);
-			i--;
-		}
-	}
-	/* restart all connection timers */
-	for (i = 0; i < peern; i++) {
-		if (peers[i]->socket == -1) {
-			gettimeofday(&peers[i]->reconnect, NULL);
-			peers[i]->connection_failure = 0;
-		}
-	}
+static int repeat_timer_expired(void)
+{
+	return timers_expire(TIMER_REPEAT) > 0;
 }
 
-void nolinger(int sock)
+#endif  /* HAVE_SYS_TIMERFD_H */
+
+
+/** Mirror the driver timer of drv_timer_set() in the main loop timers. */
+static void sync_driver_timer(void)
 {
-	static struct linger linger = { 0, 0 };
-	int lsize = sizeof(struct linger);
+	struct timeval when;
 
-	setsockopt(sock, SOL_SOCKET, SO_LINGER, (void*)&linger, lsize);
+	if (use_hw() && curr_driver->rec_mode != 0 && !decode_thread
+	    && drv_timer_deadline(&when))
+		timer_set(TIMER_DRIVER, NULL, &when);
+	else
+		timer_clear(TIMER_DRIVER, NULL);
 }
 
 
-void drop_privileges(void)
+/** Update the poll set after the driver might have changed its fd. */
+static void sync_driver_fd(void)
 {
-	const char* user;
-	struct passwd* pw;
-	GETGROUPS_T groups[32];
-	int group_cnt = sizeof(groups)/sizeof(gid_t);
-	char groupnames[256] = {0};
-	char buff[12];
-	int r;
-	int i;
+	int fd = -1;
+	int events = 0;
 
-	if (getuid() != 0)
-		return;
-	user = options_getstring("lircd:effective-user");
-	if (user == NULL || strlen(user) == 0) {
-		log_warn("Running as root");
-		return;
-	}
-	pw = getpwnam(user);
-	if (pw == NULL) {
-		log_perror_warn("Illegal effective uid: %s", user);
-		return;
-	}
-	r = getgrouplist(user, pw->pw_gid, groups, &group_cnt);
-	if (r == -1) {
-		log_perror_warn("Cannot get supplementary groups");
-		return;
+	if (use_hw() && curr_driver->rec_mode != 0 && !decode_thread) {
+		fd = curr_driver->fd;
+		events = POLLIN;
 	}
-	r = setgroups(group_cnt, (const gid_t*) groups);
-	if (r == -1) {
-		log_perror_warn("Cannot set supplementary groups");
-		return;
-	}
-	r = setgid(pw->pw_gid);
-	if (r == -1) {
-		log_perror_warn("Cannot set GID");
-		return;
+	/* Output queued by tty_write_async(), flushed when writable. */
+	if (curr_driver->fd != -1 && tty_async_pending(curr_driver->fd) > 0) {
+		fd = curr_driver->fd;
+		events |= POLLOUT;
 	}
-	r = setuid(pw->pw_uid);
-	if (r == -1) {
-		log_perror_warn("Cannot change UID");
+	if (fd == driver_pollfd && events == driver_pollevents)
 		return;
-	}
-	log_notice("Running as user %s", user);
-	for (i = 0; i < group_cnt; i += 1) {
-		snprintf(buff, 5, " %d", groups[i]);
-		strcat(groupnames, buff);
-	}
-	log_debug("Groups: [%d]:%s", pw->pw_gid, groupnames);
+	if (driver_pollfd != -1 && fd != driver_pollfd)
+		poll_remove(driver_pollfd);
+	driver_pollfd = fd;
+	driver_pollevents = events;
+	if (fd != -1)
+		poll_set(fd, FD_DRIVER, events);
 }
 
 
-void add_client(int sock)
-{
-	int fd;
-	socklen_t clilen;
-	struct sockaddr client_addr;
-	int flags;
+/*
+ * While the hardware is gone, wait for udev to report a device instead
+ * of retrying driver init every second. Only for devices below /dev or
+ * found by the driver itself, others like the file driver's input are
+ * not seen by udev and are still polled.
+ */
 
-	clilen = sizeof(client_addr);
-	fd = accept(sock, (struct sockaddr*)&client_addr, &clilen);
-	if (fd == -1) {
-		log_perror_err("accept() failed for new client");
-		dosigterm(SIGTERM);
-	}
-	;
+#ifdef HAVE_LIBUDEV_H
+static struct udev* hotplug_udev = NULL;
+static struct udev_monitor* hotplug_monitor = NULL;
+#endif
 
-	if (clin >= MAX_CLIENTS) {
-		log_error("connection rejected (too many clients)");
-		shutdown(fd, 2);
-		close(fd);
+/** A device event arrived, or the monitor was just started. */
+static int hotplug_pending = 0;
+
+
+static void hotplug_stop(void)
+{
+#ifdef HAVE_LIBUDEV_H
+	if (hotplug_monitor == NULL)
 		return;
-	}
-	nolinger(fd);
-	flags = fcntl(fd, F_GETFL, 0);
-	if (flags != -1)
-		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-	if (client_addr.sa_family == AF_UNIX) {
-		cli_type[clin] = CT_LOCAL;
-		log_notice("accepted new client on %s", lircdfile);
-	} else if (client_addr.sa_family == AF_INET) {
-		cli_type[clin] = CT_REMOTE;
-		log_notice(
-			"accepted new client from %s",
-			inet_ntoa(
-				((struct sockaddr_in*)&client_addr)->sin_addr)
-		);
-	} else {
-		cli_type[clin] = 0;     /* what? */
-	}
-	clis[clin] = fd;
-	if (!use_hw()) {
-		if (curr_driver->init_func) {
-			if (!curr_driver->init_func()) {
-				log_warn("Failed to initialize hardware");
-			/* Don't exit here, otherwise lirc
-			 * bails out, and lircd exits, making
-			 * it impossible to connect to when we
-			 * have a device actually plugged
-			 * in. */
-			} else {
-				setup_hardware();
-			}
-		}
-	}
-	clin++;
+	poll_remove(udev_monitor_get_fd(hotplug_monitor));
+	udev_monitor_unref(hotplug_monitor);
+	udev_unref(hotplug_udev);
+	hotplug_monitor = NULL;
+	hotplug_udev = NULL;
+#endif
+	hotplug_pending = 0;
 }
 
-int add_peer_connection(const char* server_arg)
-{
-	char* sep;
-	struct servent* service;
-	char server[strlen(server_arg) + 1];
 
-	strncpy(server, server_arg, sizeof(server));
+/** Watch for devices, return 0 if unsupported and polling is needed. */
+static int hotplug_start(void)
+{
+#ifdef HAVE_LIBUDEV_H
+	const char* device = curr_driver->device;
 
-	if (peern < MAX_PEERS) {
-		peers[peern] = (struct peer_connection*) malloc(sizeof(
-						    struct peer_connection));
-		if (peers[peern] != NULL) {
-			gettimeofday(&peers[peern]->reconnect, NULL);
-			peers[peern]->connection_failure = 0;
-			sep = strchr(server, ':');
-			if (sep != NULL) {
-				*sep = 0;
-				sep++;
-				peers[peern]->host = strdup(server);
-				service = getservbyname(sep, "tcp");
-				if (service) {
-					peers[peern]->port =
-						ntohs(service->s_port);
-				} else {
-					long p;
-					char* endptr;
-
-					p = strtol(sep, &endptr, 10);
-					if (!*sep || *endptr || p < 1
-					    || p > USHRT_MAX
-					) {
-						fprintf(stderr,
-							"%s: bad port number \"%s\"\n",
-							progname, sep);
-						return 0;
-					}
-
-					peers[peern]->port =
-						(unsigned short int)p;
-				}
-			} else {
-				peers[peern]->host = strdup(server);
-				peers[peern]->port = LIRC_INET_PORT;
-			}
-			if (peers[peern]->host == NULL)
-				fprintf(stderr,
-					"%s: out of memory\n", progname);
-		} else {
-			fprintf(stderr, "%s: out of memory\n", progname);
-			return 0;
-		}
-		peers[peern]->socket = -1;
-		peern++;
+	if (hotplug_monitor != NULL)
 		return 1;
+	if (device != NULL && strncmp(device, "/dev/", 5) != 0)
+		return 0;
+	hotplug_udev = udev_new();
+	if (hotplug_udev == NULL)
+		return 0;
+	hotplug_monitor = udev_monitor_new_from_netlink(hotplug_udev, "udev");
+	if (hotplug_monitor == NULL
+	    || udev_monitor_enable_receiving(hotplug_monitor) < 0
+	    || !poll_add(udev_monitor_get_fd(hotplug_monitor), FD_HOTPLUG)) {
+		log_debug("Cannot monitor udev, polling for devices");
+		if (hotplug_monitor != NULL)
+			udev_monitor_unref(hotplug_monitor);
+		udev_unref(hotplug_udev);
+		hotplug_monitor = NULL;
+		hotplug_udev = NULL;
+		return 0;
 	}
-	fprintf(stderr, "%s: too many client connections\n", progname);
+	log_debug("Waiting for udev to report the device");
+	/* The device might have come back before the monitor started. */
+	hotplug_pending = 1;
+	return 1;
+#else
 	return 0;
+#endif
 }
 
 
-void connect_to_peer(peer_connection* peer)
+/** Read the events on the monitor fd, flag added or changed devices. */
+static void hotplug_read(void)
 {
-	int r;
-	char service[64];
-	struct addrinfo* addrinfos;
-	struct addrinfo* a;
-	int enable = 1;
+#ifdef HAVE_LIBUDEV_H
+	struct udev_device* device;
+	const char* action;
 
-	snprintf(service, sizeof(service), "%d", peer->port);
-	peer->socket = socket(AF_INET, SOCK_STREAM, 0);
-	r = getaddrinfo(peer->host, service, NULL, &addrinfos);
-	if (r != 0) {
-		log_perror_err("Name lookup failure connecting to %s",
-			       peer->host);
-		goto errexit;
-	}
-	(void)setsockopt(peer->socket,
-			 SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
-	for (a = addrinfos; a != NULL; a = a->ai_next) {
-		r = connect(peer->socket, a->ai_addr, a->ai_addrlen);
-		if (r >= 0)
-			break;
-	}
-	freeaddrinfo(addrinfos);
-	if (r == -1) {
-		log_perror_err("Cannot connect to %s", peer->host);
-		goto errexit;
+	if (hotplug_monitor == NULL)
+		return;
+	while ((device = udev_monitor_receive_device(hotplug_monitor))
+	       != NULL) {
+		action = udev_device_get_action(device);
+		if (action != NULL && (strcmp(action, "add") == 0
+				       || strcmp(action, "change") == 0))
+			hotplug_pending = 1;
+		udev_device_unref(device);
 	}
-	log_notice("Connected to %s", peer->host);
-	peer->connection_failure = 0;
-	return;
+#endif
+}
 
-errexit:
-	peer->connection_failure++;
-	gettimeofday(&peer->reconnect, NULL);
-	peer->reconnect.tv_sec += 5 * peer->connection_failure;
-	close(peer->socket);
-	peer->socket = -1;
-	return;
+
+/*
+ * Driver init/deinit might close the driver fd and reuse the number. Drop
+ * it from the poll set while it's still open, and re-add it afterwards.
+ */
+static void forget_driver_fd(void)
+{
+	if (driver_pollfd != -1) {
+		poll_remove(driver_pollfd);
+		driver_pollfd = -1;
+		driver_pollevents = 0;
+	}
 }
 
 
-void connect_to_peers(void)
+static int driver_init(void)
 {
-	int i;
-	struct timeval now;
+	int r;
 
-	gettimeofday(&now, NULL);
-	for (i = 0; i < peern; i++) {
-		if (peers[i]->socket != -1)
-			continue;
-		/* some timercmp() definitions don't work with <= */
-		if (timercmp(&peers[i]->reconnect, &now, <)) {
-			connect_to_peer(peers[i]);
-		}
-	}
+	forget_driver_fd();
+	r = curr_driver->init_func();
+	sync_driver_fd();
+	return r;
 }
 
 
-int get_peer_message(struct peer_connection* peer)
+static int driver_deinit(void)
 {
-	int length;
-	char buffer[PACKET_SIZE + 1];
-	char* end;
-	int i;
+	forget_driver_fd();
+	return curr_driver->deinit_func();
+}
 
-	length = read_timeout(peer->socket, buffer, PACKET_SIZE, 0);
-	if (length) {
-		buffer[length] = 0;
-		end = strrchr(buffer, '\n');
-		if (end == NULL || end[1] != 0) {
-			log_error("bad send packet: \"%s\"", buffer);
-			/* remove clients that behave badly */
-			return 0;
-		}
-		end++;          /* include the \n */
-		end[0] = 0;
-		length = strlen(buffer);
-		log_trace("received peer message: \"%s\"", buffer);
-		for (i = 0; i < clin; i++) {
-			/* don't relay messages to remote clients */
-			if (cli_type[i] == CT_REMOTE)
-				continue;
-			log_trace("writing to client %d", i);
-			if (write_socket(clis[i], buffer, length) < length) {
-				remove_client(clis[i]);
-				i--;
-			}
-		}
-	}
 
-	if (length == 0)        /* EOF: connection closed by client */
+/** The driver fd is hung up: close it, lircd reconnects as usual. */
+static void driver_lost(void)
+{
+	log_error("Lost driver device %s", curr_driver->device);
+	driver_hangups = 0;
+	driver_lock();
+	driver_deinit();
+	driver_unlock();
+}
+
+
+static int queue_alloc(struct out_queue* q)
+{
+	q->size = queue_size;
+	q->msgs_size = queue_size / QUEUE_MSG_SIZE_MIN;
+	q->buf = (char*)malloc(q->size);
+	q->msgs = (size_t*)malloc(q->msgs_size * sizeof(size_t));
+	if (q->buf == NULL || q->msgs == NULL) {
+		log_error("Cannot allocate client output queue");
+		free(q->buf);
+		free(q->msgs);
+		q->buf = NULL;
+		q->msgs = NULL;
 		return 0;
+	}
+	q->head = q->len = 0;
+	q->msg_head = q->msg_count = 0;
+	q->partial = 0;
 	return 1;
 }
 
-void start_server(mode_t permission, int nodaemon, loglevel_t loglevel)
+
+static void queue_free(struct out_queue* q)
 {
-	struct sockaddr_un serv_addr;
-	struct sockaddr_in serv_addr_in;
-	struct stat s;
-	int ret;
-	int new_socket = 1;
-	int fd;
+	free(q->buf);
+	free(q->msgs);
+	memset(q, 0, sizeof(struct out_queue));
+}
 
-#ifdef HAVE_SYSTEMD
-	int n;
-#endif
 
-	lirc_log_open("lircd", nodaemon, loglevel);
+/** Index of the n'th queued message in q->msgs. */
+static size_t queue_msg(const struct out_queue* q, size_t n)
+{
+	return (q->msg_head + n) % q->msgs_size;
+}
 
-	/* create pid lockfile in /var/run */
-	fd = open(pidfile, O_RDWR | O_CREAT, 0644);
-	if (fd > 0)
-		pidf = fdopen(fd, "r+");
-	if (fd == -1 || pidf == NULL) {
-		perrorf("can't open or create %s", pidfile);
-		exit(EXIT_FAILURE);
-	}
-	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
-		pid_t otherpid;
 
-		if (fscanf(pidf, "%d\n", &otherpid) > 0) {
-			fprintf(stderr,
-				"%s: there seems to be a lircd process with pid %d\n",
-				progname, otherpid);
-			fprintf(stderr,
-				"%s: otherwise delete stale lockfile %s\n",
-				progname, pidfile);
-		} else {
-			fprintf(stderr, "%s: invalid %s encountered\n",
-				progname, pidfile);
-		}
-		exit(EXIT_FAILURE);
-	}
-	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
-	rewind(pidf);
-	(void)fprintf(pidf, "%d\n", getpid());
-	(void)fflush(pidf);
-	if (ftruncate(fileno(pidf), ftell(pidf)) != 0)
-		log_perror_warn("lircd: ftruncate()");
-	ir_remote_init(options_getboolean("lircd:dynamic-codes"));
+/**
+ * Drop the oldest complete message. A partially written first message
+ * is kept, the following one is dropped instead and the remainder of
+ * the first one moved into its place. Returns 0 if nothing can be dropped.
+ */
+static int queue_drop_oldest(struct out_queue* q)
+{
+	size_t first = q->msgs[q->msg_head];
+	size_t victim;
+	size_t i;
 
-	/* create socket */
-	sockfd = -1;
-	do_shutdown = 0;
-#ifdef HAVE_SYSTEMD
-	n = sd_listen_fds(0);
-	if (n > 1) {
-		fprintf(stderr, "Too many file descriptors received.\n");
-		goto start_server_failed0;
-	} else if (n == 1) {
-	        log_notice("Using systemd fd");
-		sockfd = SD_LISTEN_FDS_START + 0;
+	if (q->msg_count <= (q->partial ? 1u : 0u))
+		return 0;
+	if (!q->partial) {
+		q->head = (q->head + first) % q->size;
+		q->len -= first;
+		q->msg_head = queue_msg(q, 1);
+		q->msg_count -= 1;
+	} else {
+		victim = q->msgs[queue_msg(q, 1)];
+		for (i = first; i > 0; i -= 1)
+			q->buf[(q->head + victim + i - 1) % q->size] =
+				q->buf[(q->head + i - 1) % q->size];
+		q->head = (q->head + victim) % q->size;
+		q->len -= victim;
+		q->msgs[queue_msg(q, 1)] = first;
+		q->msg_head = queue_msg(q, 1);
+		q->msg_count -= 1;
 	}
-#endif
-	if (sockfd == -1) {
-	        log_debug("No systemd fd found");
-		sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-		if (sockfd == -1) {
-			perror("Could not create socket");
-			goto start_server_failed0;
-		}
-		do_shutdown = 1;
+	q->dropped += 1;
+	metrics_inc(METRIC_QUEUE_DROPPED);
+	return 1;
+}
 
-		/*
-		 * get owner, permissions, etc.
-		 * so new socket can be the same since we
-		 * have to delete the old socket.
-		 */
-		ret = stat(lircdfile, &s);
-		if (ret == -1 && errno != ENOENT) {
-			perrorf("Could not get file information for %s\n",
-				lircdfile);
-			goto start_server_failed1;
-		}
-		if (ret != -1) {
-			new_socket = 0;
-			ret = unlink(lircdfile);
-			if (ret == -1) {
-				perrorf("Could not delete %s", lircdfile);
-				goto start_server_failed1;
-			}
-		}
 
-		serv_addr.sun_family = AF_UNIX;
-		strcpy(serv_addr.sun_path, lircdfile);
-		if (bind(sockfd,
-			 (struct sockaddr*)&serv_addr, sizeof(serv_addr)) == -1
-		) {
-			perrorf("Could not assign address to socket%s",
-				lircdfile);
-			goto start_server_failed1;
-		}
+/** Append a message, applying the overflow policy. 0 on errors. */
+static int queue_put(struct out_queue* q, const char* data, size_t len)
+{
+	size_t tail;
+	size_t chunk;
 
-		if (new_socket ? chmod(lircdfile, permission)
-		    : (chmod(lircdfile, s.st_mode) == -1
-			  || chown(lircdfile, s.st_uid, s.st_gid) == -1)
-		) {
-			perrorf("Could not set file permissions on %s",
-				lircdfile);
-			goto start_server_failed1;
+	if (q->buf == NULL && !queue_alloc(q))
+		return 0;
+	while (q->size - q->len < len || q->msg_count == q->msgs_size) {
+		if (queue_overflow == OVERFLOW_DROP_CLIENT) {
+			log_warn("Client output queue full, dropping client");
+			metrics_inc(METRIC_CLIENT_DROPPED);
+			return 0;
+		}
+		if (!queue_drop_oldest(q)) {
+			log_warn("Client output queue full, dropping message");
+			q->dropped += 1;
+			metrics_inc(METRIC_QUEUE_DROPPED);
+			return 1;
 		}
-		listen(sockfd, 3);
 	}
-	nolinger(sockfd);
+	tail = (q->head + q->len) % q->size;
+	chunk = len < q->size - tail ? len : q->size - tail;
+	memcpy(q->buf + tail, data, chunk);
+	memcpy(q->buf, data + chunk, len - chunk);
+	q->len += len;
+	q->msgs[queue_msg(q, q->msg_count)] = len;
+	q->msg_count += 1;
+	q->queued += 1;
+	return 1;
+}
 
-	drop_privileges();
-	if (listen_tcpip) {
-		int enable = 1;
 
-		/* create socket */
-		sockinet = socket(PF_INET, SOCK_STREAM, IPPROTO_IP);
-		if (sockinet == -1) {
-			perror("Could not create TCP/IP socket");
-			goto start_server_failed1;
-		}
-		(void)setsockopt(sockinet,
-				 SOL_SOCKET, SO_REUSEADDR,
-				 &enable, sizeof(enable));
-		serv_addr_in.sin_family = AF_INET;
-		serv_addr_in.sin_addr = address;
-		serv_addr_in.sin_port = htons(port);
+/** Return true if the last message of q is queued and not partially written. */
+static int queue_last_unwritten(const struct out_queue* q)
+{
+	return q->msg_count > (q->partial ? 1u : 0u);
+}
 
-		if (bind(sockinet,
-			 (struct sockaddr*)&serv_addr_in,
-			 sizeof(serv_addr_in)) == -1
-		) {
-			perror("could not assign address to socket");
-			goto start_server_failed2;
 
-		}
+/** Remove the last message, which must be unwritten. */
+static void queue_drop_last(struct out_queue* q)
+{
+	q->msg_count -= 1;
+	q->len -= q->msgs[queue_msg(q, q->msg_count)];
+}
 
-		listen(sockinet, 3);
-		nolinger(sockinet);
-	}
-	log_trace("started server socket");
-	return;
 
-start_server_failed2:
-	if (listen_tcpip)
-		close(sockinet);
-start_server_failed1:
-	close(sockfd);
-start_server_failed0:
-	fclose(pidf);
-	(void)unlink(pidfile);
-	exit(EXIT_FAILURE);
+/** Remove n written bytes from the head of q. */
+static void queue_consume(struct out_queue* q, size_t n)
+{
+	size_t* first;
+
+	q->head = (q->head + n) % q->size;
+	q->len -= n;
+	while (n > 0) {
+		first = &q->msgs[q->msg_head];
+		if (n < *first) {
+			*first -= n;
+			q->partial = 1;
+			return;
+		}
+		n -= *first;
+		q->msg_head = queue_msg(q, 1);
+		q->msg_count -= 1;
+		q->partial = 0;
+	}
 }
 
 
-void daemonize(void)
+/** Write as much as possible of q to fd without blocking. 0 on errors. */
+static int queue_flush(int fd, struct out_queue* q)
 {
-	if (daemon(0, 0) == -1) {
-		log_perror_err("daemon() failed");
-		dosigterm(SIGTERM);
+	struct iovec iov[2];
+	size_t first;
+	ssize_t r;
+
+	if (q->len == 0)
+		return 1;
+	first = q->size - q->head;
+	if (first > q->len)
+		first = q->len;
+	iov[0].iov_base = q->buf + q->head;
+	iov[0].iov_len = first;
+	iov[1].iov_base = q->buf;
+	iov[1].iov_len = q->len - first;
+	r = writev(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+	if (r == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 1;
+		log_perror_debug("Error writing client output queue");
+		return 0;
 	}
-	umask(0);
-	rewind(pidf);
-	fprintf(pidf, "%d\n", getpid());
-	fflush(pidf);
-	if (ftruncate(fileno(pidf), ftell(pidf)) != 0)
-		log_perror_warn("lircd: ftruncate()");
-	daemonized = 1;
+	queue_consume(q, r);
+	if (q->len == 0 && q->dropped > 0) {
+		log_notice("Slow client missed %lu messages", q->dropped);
+		q->dropped = 0;
+	}
+	return 1;
 }
 
 
-int send_success(int fd, char* message)
+static int client_index(int fd)
 {
-	log_debug("Sending success");
-	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
-	      && write_socket_len(fd, message)
-	      && write_socket_len(fd, protocol_string[P_SUCCESS])
-	      && write_socket_len(fd, protocol_string[P_END]))
-	) {
-		return 0;
+	if (fd < 0 || fd >= (int)client_slot.size())
+		return -1;
+	return client_slot[fd];
+}
+
+
+/**
+ * Update the poll set for client i: wait for commands unless it is
+ * waiting for a repeat to complete, in which case only a hangup is of
+ * interest, and for the socket to become writable while there is
+ * queued output.
+ */
+static void update_client_events(int i)
+{
+	int events = 0;
+
+	if (clients[i].fd != repeat_fd && !clients[i].send_wait
+	    && !clients[i].backlog)
+		events |= POLLIN;
+	else
+		events |= POLLRDHUP;
+	if (clients[i].queue.len > 0)
+		events |= POLLOUT;
+	if (events == clients[i].events)
+		return;
+	if (poll_set(clients[i].fd, FD_CLIENT, events))
+		clients[i].events = events;
+}
+
+
+/** Write a broadcast message to client i without blocking. 0 on errors. */
+static int send_to_client(int i, const char* message, size_t len)
+{
+	struct out_queue* q = &clients[i].queue;
+	ssize_t done = 0;
+	int r;
+
+	if (clients[i].listing) {
+		/* Not inside the reply, sent when it's done. */
+		clients[i].held.append(message, len);
+		return 1;
+	}
+	if (q->len == 0) {
+		done = write(clients[i].fd, message, len);
+		if (done == (ssize_t)len)
+			return 1;
+		if (done == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				log_perror_debug("Error writing to client");
+				return 0;
+			}
+			done = 0;
+		}
+	}
+	r = queue_put(q, message + done, len - done);
+	if (r && done > 0)
+		q->partial = 1;
+	update_client_events(i);
+	return r;
+}
+
+
+/**
+ * Wait up to WRITE_SLEEP_US for fd to become writable. Returns as soon
+ * as the peer has read some data, so a client pipelining commands gets
+ * its replies at the rate it reads them. The callers give up after
+ * WRITE_RETRIES waits without progress.
+ */
+static void wait_writable(int fd)
+{
+	struct pollfd pfd = { fd, POLLOUT, 0 };
+
+	if (poll(&pfd, 1, WRITE_SLEEP_US / 1000) == -1 && errno != EINTR)
+		usleep(WRITE_SLEEP_US);
+}
+
+
+/**
+ * Write queued output for client i, waiting for a busy socket like
+ * write_socket() does. Used before replies which must not be mixed with
+ * partially written broadcasts. 0 on errors.
+ */
+static int flush_client_blocking(int i)
+{
+	int retries = WRITE_RETRIES;
+	size_t len;
+
+	while (clients[i].queue.len > 0) {
+		len = clients[i].queue.len;
+		if (!queue_flush(clients[i].fd, &clients[i].queue))
+			return 0;
+		if (clients[i].queue.len == 0)
+			break;
+		if (clients[i].queue.len < len)
+			retries = WRITE_RETRIES;
+		retries -= 1;
+		if (retries <= 0)
+			return 0;
+		wait_writable(clients[i].fd);
 	}
+	update_client_events(i);
 	return 1;
 }
 
 
-int send_error(int fd, char* message, const char* format_str, ...)
+/** Names interned for binary clients, the id is the index. */
+static std::vector<std::string> record_names;
+static std::unordered_map<std::string, int> record_ids;
+
+
+static void record_init(struct lirc_record* rec, int type, size_t size)
 {
-	log_debug("Sending error");
-	char lines[16], buffer[PACKET_SIZE + 1];
-	int i, n, len;
-	va_list ap;
-	char* s1;
-	char* s2;
-	char buffer2[PACKET_SIZE + 2];
+	struct timespec now;
 
-	va_start(ap, format_str);
-	vsprintf(buffer, format_str, ap);
-	va_end(ap);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	memset(rec, 0, sizeof(struct lirc_record));
+	rec->type = type;
+	rec->size = size;
+	rec->timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
 
-	s1 = strrchr(message, '\n');
-	s2 = strrchr(buffer, '\n');
-	if (s1 != NULL)
-		s1[0] = 0;
-	if (s2 != NULL)
-		s2[0] = 0;
-	log_error("error processing command: %s", message);
-	log_error("%s", buffer);
-	if (s1 != NULL)
-		s1[0] = '\n';
-	snprintf(buffer2, sizeof(buffer2), "%s\n", buffer);
 
-	n = 0;
-	len = strlen(buffer2);
-	for (i = 0; i < len; i++)
-		if (buffer2[i] == '\n')
-			n++;
-	sprintf(lines, "%d\n", n);
+/** Queue rec and its payload for client i like send_to_client(). */
+static int send_record(int i, const struct lirc_record* rec,
+		       const char* payload)
+{
+	char buf[sizeof(struct lirc_record) + PACKET_SIZE];
 
-	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
-	      && write_socket_len(fd, message)
-	      && write_socket_len(fd, protocol_string[P_ERROR])
-	      && write_socket_len(fd, protocol_string[P_DATA])
-	      && write_socket_len(fd, lines)
-	      && write_socket_len(fd, buffer2)
-	      && write_socket_len(fd, protocol_string[P_END])))
+	if (rec->size > PACKET_SIZE)
 		return 0;
+	lirc_record_put(buf, rec);
+	memcpy(buf + sizeof(struct lirc_record), payload, rec->size);
+	return send_to_client(i, buf, sizeof(struct lirc_record) + rec->size);
+}
+
+
+/** Send message to binary client i as TEXT records. 0 on errors. */
+static int send_text_record(int i, const char* message, size_t len)
+{
+	struct lirc_record rec;
+	size_t chunk;
+
+	for (; len > 0; message += chunk, len -= chunk) {
+		chunk = len < PACKET_SIZE ? len : PACKET_SIZE;
+		record_init(&rec, LIRC_RECORD_TEXT, chunk);
+		if (!send_record(i, &rec, message))
+			return 0;
+	}
 	return 1;
 }
 
 
-void sigalrm(int sig)
+static int send_name_record(int i, int id)
 {
-	alrm = 1;
+	struct lirc_record rec;
+
+	record_init(&rec, LIRC_RECORD_NAME, record_names[id].size());
+	rec.remote = id;
+	return send_record(i, &rec, record_names[id].c_str());
 }
 
 
-static void schedule_repeat_timer (struct timespec* last)
+/** Send RESET and all names to binary client i. 0 on errors. */
+static int send_names(int i)
 {
-	unsigned long secs;
-	lirc_t usecs, gap, diff;
-	struct timespec current;
-	struct itimerval repeat_timer;
-	gap = send_buffer_sum() + repeat_remote->min_remaining_gap;
-	clock_gettime (CLOCK_MONOTONIC, &current);
-	secs = current.tv_sec - last->tv_sec;
-	diff = 1000000 * secs + (current.tv_nsec - last->tv_nsec) / 1000;
-	usecs = (diff < gap ? gap - diff : 0);
-	if (usecs < 10)
-		usecs = 10;
-	log_trace("alarm in %lu usecs", (unsigned long)usecs);
-	repeat_timer.it_value.tv_sec = 0;
-	repeat_timer.it_value.tv_usec = usecs;
-	repeat_timer.it_interval.tv_sec = 0;
-	repeat_timer.it_interval.tv_usec = 0;
-
-	setitimer(ITIMER_REAL, &repeat_timer, NULL);
+	struct lirc_record rec;
+	unsigned int id;
+
+	record_init(&rec, LIRC_RECORD_RESET, 0);
+	rec.code = LIRC_RECORD_MAGIC;
+	if (!send_record(i, &rec, ""))
+		return 0;
+	for (id = 0; id < record_names.size(); id++)
+		if (!send_name_record(i, id))
+			return 0;
+	return 1;
 }
 
-void dosigalrm(int sig)
+
+/** Return the id of name, interning it if new, else -1 if full. */
+static int record_intern(const char* name, int* added)
 {
-	if (repeat_remote->last_code != repeat_code) {
-		/* we received a different code from the original
-		 * remote control we could repeat the wrong code so
-		 * better stop repeating */
-		if (repeat_fd != -1)
-			send_error(repeat_fd, repeat_message,
-				   "repeating interrupted\n");
+	std::unordered_map<std::string, int>::iterator it;
+	int id;
+
+	it = record_ids.find(name);
+	if (it != record_ids.end())
+		return it->second;
+	if (record_names.size() > LIRC_RECORD_MAX
+	    || strlen(name) > PACKET_SIZE)
+		return -1;
+	id = record_names.size();
+	record_names.push_back(name);
+	record_ids[name] = id;
+	*added = 1;
+	return id;
+}
 
-		repeat_remote = NULL;
-		repeat_code = NULL;
-		repeat_fd = -1;
-		if (repeat_message != NULL) {
-			free(repeat_message);
-			repeat_message = NULL;
+
+/** Send the new name id to all binary clients. */
+static void broadcast_name(int id)
+{
+	int i;
+
+	for (i = 0; i < (int)clients.size(); i++) {
+		if (clients[i].binary && !send_name_record(i, id)) {
+			remove_client(clients[i].fd);
+			i--;
 		}
-		if (!use_hw() && curr_driver->deinit_func)
-			curr_driver->deinit_func();
-		return;
-	}
-	if (repeat_code->next == NULL
-	    || (repeat_code->transmit_state != NULL
-		&& repeat_code->transmit_state->next == NULL)
-	) {
-		repeat_remote->repeat_countdown--;
-	}
-	struct timespec before_send;
-	clock_gettime (CLOCK_MONOTONIC, &before_send);
-	if (send_ir_ncode(repeat_remote, repeat_code, 1)
-	    && repeat_remote->repeat_countdown > 0
-	) {
-		schedule_repeat_timer(&before_send);
-		return;
-	}
-	repeat_remote = NULL;
-	repeat_code = NULL;
-	if (repeat_fd != -1) {
-		send_success(repeat_fd, repeat_message);
-		free(repeat_message);
-		repeat_message = NULL;
-		repeat_fd = -1;
 	}
-	if (!use_hw() && curr_driver->deinit_func)
-		curr_driver->deinit_func();
 }
 
 
-int parse_rc(int fd,
-	     char* message, char* arguments,
-	     struct ir_remote** remote, struct ir_ncode** code,
-	     unsigned int* reps, int n, int* err)
+/** Intern the names in remotes, announce them to binary clients. */
+static void record_names_load(const struct ir_remote* head)
 {
-	char* name = NULL;
-	char* command = NULL;
-	char* repeats;
-	char* end_ptr = NULL;
-
-	*remote = NULL;
-	*code = NULL;
-	*err = 1;
-	if (arguments == NULL)
-		goto arg_check;
+	const struct ir_remote* remote;
+	const struct ir_ncode* code;
+	int added;
+	int i;
 
-	name = strtok(arguments, WHITE_SPACE);
-	if (name == NULL)
-		goto arg_check;
-	*remote = get_ir_remote(remotes, name);
-	if (*remote == NULL) {
-		return send_error(fd, message,
-				  "unknown remote: \"%s\"\n",
-				  name);
-	}
-	command = strtok(NULL, WHITE_SPACE);
-	if (command == NULL)
-		goto arg_check;
-	*code = get_code_by_name(*remote, command);
-	if (*code == NULL) {
-		return send_error(fd, message,
-				  "unknown command: \"%s\"\n",
-				  command);
+	record_names.clear();
+	record_ids.clear();
+	for (remote = head; remote != NULL; remote = remote->next) {
+		record_intern(remote->name, &added);
+		for (code = remote->codes; code && code->name; code++)
+			record_intern(code->name, &added);
 	}
-	if (reps != NULL) {
-		repeats = strtok(NULL, WHITE_SPACE);
-		if (repeats != NULL) {
-			*reps = strtol(repeats, &end_ptr, 10);
-			if (*end_ptr || *reps < 0) {
-				return send_error(
-					fd, message,
-					"bad send packet (reps/eol)\n");
-			}
-			if (*reps > repeat_max) {
-				return send_error(
-					fd, message,
-					"too many repeats: \"%d\" > \"%u\"\n",
-					*reps, repeat_max);
-			}
-		} else {
-			*reps = -1;
+	for (i = 0; i < (int)clients.size(); i++) {
+		if (clients[i].binary && !send_names(i)) {
+			remove_client(clients[i].fd);
+			i--;
 		}
 	}
-	if (strtok(NULL, WHITE_SPACE) != NULL)
-		return send_error(fd, message,
-				  "bad send packet (trailing ws)\n");
-arg_check:
-	if (n > 0 && *remote == NULL)
-		return send_error(fd, message, "remote missing\n");
-	if (n > 1 && *code == NULL)
-		return send_error(fd, message, "code missing\n");
-	*err = 0;
-	return 1;
 }
 
 
-int send_remote_list(int fd, char* message)
+/** The --event-ring mapping, NULL if disabled. */
+static struct lirc_ring_header* ring = NULL;
+static size_t ring_size;
+static std::string ring_path;
+
+#ifdef HAVE_LINUX_FUTEX_H
+
+/**
+ * Create the ring file next to the socket, before dropping privileges.
+ * Readers get the read permissions and owner of the socket, falling
+ * back to permission if it's not a file.
+ */
+static int event_ring_create(int slots, mode_t permission)
 {
-	char buffer[PACKET_SIZE + 1];
-	struct ir_remote* all;
-	int n, len;
+	uint32_t n = 1;
+	void* addr;
+	struct stat s;
+	uid_t uid = (uid_t)-1;
+	gid_t gid = (gid_t)-1;
+	int fd;
 
-	n = 0;
-	all = remotes;
-	while (all) {
-		n++;
-		all = all->next;
+	while (n < (uint32_t)slots && n < LIRC_RING_MAX_SLOTS)
+		n <<= 1;
+	ring_path = std::string(lircdfile) + ".ring";
+	ring_size = lirc_ring_size(n);
+	(void)unlink(ring_path.c_str());
+	if (stat(lircdfile, &s) == 0) {
+		permission = s.st_mode;
+		uid = s.st_uid;
+		gid = s.st_gid;
 	}
-
-	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
-	      && write_socket_len(fd, message)
-	      && write_socket_len(fd, protocol_string[P_SUCCESS]))
-	) {
+	permission &= S_IRUSR | S_IRGRP | S_IROTH;
+	fd = open(ring_path.c_str(),
+		  O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		log_perror_err("Cannot create %s", ring_path.c_str());
 		return 0;
 	}
-	if (n == 0)
-		return write_socket_len(fd, protocol_string[P_END]);
-	sprintf(buffer, "%d\n", n);
-	if (!(write_socket_len(fd, protocol_string[P_DATA])
-	      && write_socket_len(fd, buffer))
-	) {
+	/* Like the socket, and unlike O_CREAT not subject to umask. */
+	if (fchown(fd, uid, gid) == -1
+	    || fchmod(fd, permission) == -1) {
+		log_perror_err("Cannot set permissions on %s",
+			       ring_path.c_str());
+		close(fd);
+		(void)unlink(ring_path.c_str());
 		return 0;
 	}
-	all = remotes;
-	while (all) {
-		len = snprintf(buffer, PACKET_SIZE + 1, "%s\n", all->name);
-		if (len >= PACKET_SIZE + 1)
-			len = sprintf(buffer, "name_too_long\n");
-		if (write_socket(fd, buffer, len) < len)
-			return 0;
-		all = all->next;
+	if (ftruncate(fd, ring_size) == -1) {
+		log_perror_err("Cannot size %s", ring_path.c_str());
+		close(fd);
+		(void)unlink(ring_path.c_str());
+		return 0;
 	}
-	return write_socket_len(fd, protocol_string[P_END]);
+	addr = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		log_perror_err("Cannot map %s", ring_path.c_str());
+		(void)unlink(ring_path.c_str());
+		return 0;
+	}
+	ring = (struct lirc_ring_header*)addr;
+	ring->slots = n;
+	ring->slot_size = sizeof(struct lirc_ring_slot);
+	__atomic_store_n(&ring->magic, LIRC_RING_MAGIC, __ATOMIC_RELEASE);
+	log_info("Event ring %s: %u slots", ring_path.c_str(), n);
+	return 1;
 }
 
-int send_remote(int fd, char* message, struct ir_remote* remote)
+
+static void event_ring_wake(void)
+{
+	syscall(SYS_futex, &ring->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+/** Write ev into the next slot and wake the readers. */
+static void event_ring_put(const struct event_info* ev)
+{
+	struct lirc_ring_slot* slot;
+	struct timespec now;
+	uint64_t n = ring->head;
+	size_t button_len = strlen(ev->name);
+	size_t remote_len = strlen(ev->remote);
+
+	if (button_len + remote_len + 2 > LIRC_RING_NAMES_SIZE)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	slot = lirc_ring_slot(ring, n);
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->code = ev->code;
+	slot->timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	slot->reps = ev->reps;
+	slot->button_len = button_len;
+	slot->remote_len = remote_len;
+	memcpy(slot->names, ev->name, button_len + 1);
+	memcpy(slot->names + button_len + 1, ev->remote, remote_len + 1);
+	__atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->futex, (uint32_t)(n + 1), __ATOMIC_RELEASE);
+	event_ring_wake();
+}
+
+
+/** Tell the readers the ring is dead, remove it. */
+static void event_ring_close(void)
+{
+	if (ring == NULL)
+		return;
+	__atomic_or_fetch(&ring->flags, LIRC_RING_CLOSED, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&ring->futex, 1, __ATOMIC_RELEASE);
+	event_ring_wake();
+	munmap(ring, ring_size);
+	ring = NULL;
+	(void)unlink(ring_path.c_str());
+}
+
+#else /* HAVE_LINUX_FUTEX_H */
+
+static int event_ring_create(int slots, mode_t permission)
+{
+	log_error("--event-ring is not supported on this system");
+	return 0;
+}
+
+static void event_ring_put(const struct event_info* ev) {}
+
+static void event_ring_close(void) {}
+
+#endif /* HAVE_LINUX_FUTEX_H */
+
+
+/* cut'n'paste from fileutils-3.16: */
+
+#define isodigit(c) ((c) >= '0' && (c) <= '7')
+
+/* Return a positive integer containing the value of the ASCII
+* octal number S.  If S is not an octal number, return -1.  */
+
+static int oatoi(const char* s)
+{
+	register int i;
+
+	if (*s == 0)
+		return -1;
+	for (i = 0; isodigit(*s); ++s)
+		i = i * 8 + *s - '0';
+	if (*s)
+		return -1;
+	return i;
+}
+
+/* A safer write(), since sockets might not write all but only some of the
+ * bytes requested */
+static int write_all(int fd, const char* buf, int len)
+{
+	int done, todo = len;
+	int retries = WRITE_RETRIES;
+
+	while (todo) {
+		done = write(fd, buf, todo);
+		if (done <= 0) {
+			log_perror_debug("Error in write_socket");
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				retries -= 1;
+				if (retries <= 0)
+					return done;
+				wait_writable(fd);
+				continue;
+			} else {
+				return done;
+			}
+		}
+		buf += done;
+		todo -= done;
+		retries = WRITE_RETRIES;
+	}
+	return len;
+}
+
+/** The fd of the reply being assembled by a ReplyBuffer, or -1. */
+static int reply_fd = -1;
+
+/** The reply being assembled. */
+static std::string reply_data;
+
+
+/** write_all() to fd, as TEXT records for binary clients. */
+int write_socket(int fd, const char* buf, int len)
+{
+	struct lirc_record rec;
+	char wire[sizeof(struct lirc_record)];
+	int i;
+	int chunk;
+	int done;
+
+	if (fd == reply_fd) {
+		reply_data.append(buf, len);
+		return len;
+	}
+	i = client_index(fd);
+	if (i != -1 && clients[i].queue.len > 0 && !flush_client_blocking(i))
+		return -1;
+	if (i == -1 || !clients[i].binary)
+		return write_all(fd, buf, len);
+	for (done = 0; done < len; done += chunk) {
+		chunk = len - done < LIRC_RECORD_MAX ? len - done
+						     : LIRC_RECORD_MAX;
+		record_init(&rec, LIRC_RECORD_TEXT, chunk);
+		lirc_record_put(wire, &rec);
+		if (write_all(fd, wire, sizeof(wire)) < (int)sizeof(wire)
+		    || write_all(fd, buf + done, chunk) < chunk)
+			return -1;
+	}
+	return len;
+}
+
+
+int write_socket_len(int fd, const char* buf)
+{
+	int len;
+
+	len = strlen(buf);
+	if (write_socket(fd, buf, len) < len)
+		return 0;
+	return 1;
+}
+
+
+/**
+ * Assembles a reply, BEGIN to END, while in scope: write_socket() to fd
+ * appends to a buffer, which flush() writes at once. Otherwise a reply
+ * is several small writes, which over TCP interact badly with delayed
+ * ACKs on the peer. A reply not flushed is discarded. Replies are not
+ * nested; an inner ReplyBuffer for the same fd does nothing.
+ */
+class ReplyBuffer {
+public:
+	explicit ReplyBuffer(int fd) : fd(fd), active(reply_fd == -1)
+	{
+		if (active) {
+			reply_fd = fd;
+			reply_data.clear();
+		}
+	}
+
+	~ReplyBuffer()
+	{
+		if (active) {
+			reply_fd = -1;
+			reply_data.clear();
+		}
+	}
+
+	/** Kept allocated between replies, a LIST of a large remote fits. */
+	static const size_t REPLY_KEEP_SIZE = 65536;
+
+	/** Write the assembled reply. 0 on errors, else 1. */
+	int flush()
+	{
+		int len = reply_data.size();
+
+		int r;
+
+		if (!active)
+			return 1;
+		reply_fd = -1;
+		active = false;
+		r = write_socket(fd, reply_data.data(), len) == len;
+		if (reply_data.capacity() > REPLY_KEEP_SIZE)
+			std::string().swap(reply_data);
+		else
+			reply_data.clear();
+		return r;
+	}
+
+private:
+	int fd;
+	bool active;
+};
+
+
+int read_timeout(int fd, char* buf, int len, int timeout_us)
+{
+	int ret, n;
+	struct pollfd  pfd = {fd, POLLIN, 0}; // fd, events, revents
+	int timeout = timeout_us > 0 ? timeout_us/1000 : -1;
+
+
+	/* CAVEAT: (from libc documentation)
+	 * Any signal will cause `select' to return immediately.  So if your
+	 * program uses signals, you can't rely on `select' to keep waiting
+	 * for the full time specified.  If you want to be sure of waiting
+	 * for a particular amount of time, you must check for `EINTR' and
+	 * repeat the `select' with a newly calculated timeout based on the
+	 * current time.  See the example below.
+	 *
+	 * The timeout is not recalculated here although it should, we keep
+	 * waiting as long as there are EINTR.
+	 */
+	do
+		ret = curl_poll(&pfd, 1, timeout);
+	while (ret == -1 && errno == EINTR);
+	if (ret == -1) {
+		log_perror_err("read_timeout: curl_poll() failed");
+		return -1;
+	};
+	if (ret == 0)
+		return 0;       /* timeout */
+	n = read(fd, buf, len);
+	if (n == -1) {
+		log_perror_err("read_timeout: read() failed");
+		return -1;
+	}
+	return n;
+}
+
+
+static int setup_frequency(void)
+{
+	uint32_t freq;
+
+	if (!(curr_driver->features & LIRC_CAN_SET_REC_CARRIER))
+		return 1;
+	if (setup_min_freq == 0 || setup_max_freq == 0) {
+		setup_min_freq = DEFAULT_FREQ;
+		setup_max_freq = DEFAULT_FREQ;
+	}
+	if (curr_driver->features & LIRC_CAN_SET_REC_CARRIER_RANGE
+	    && setup_min_freq != setup_max_freq
+	) {
+		if (curr_driver->drvctl_func(LIRC_SET_REC_CARRIER_RANGE,
+					     &setup_min_freq) == -1
+		) {
+			log_error("could not set receive carrier");
+			log_perror_err(__func__);
+			return 0;
+		}
+		freq = setup_max_freq;
+	} else {
+		freq = (setup_min_freq + setup_max_freq) / 2;
+	}
+	if (curr_driver->drvctl_func(LIRC_SET_REC_CARRIER, &freq) == -1) {
+		log_error("could not set receive carrier");
+		log_perror_err(__func__);
+		return 0;
+	}
+	return 1;
+}
+
+
+static int setup_timeout(void)
+{
+	// Previously, the first three variables used "lirc_t"  here. Since
+	// they are used to denote timeouts (in micro seconds() and can
+	// impossibly be used to denote the durations that are marks, spaces,
+	// or timeouts; lirc_t is not the appropriate data type.
+	uint32_t val;
+	uint32_t min_timeout = 0;
+	uint32_t max_timeout = PULSE_MASK; // largest duration a lirct_t can hold
+	uint32_t enable = 1;
+
+	if (!(curr_driver->features & LIRC_CAN_SET_REC_TIMEOUT))
+		return 1;
+
+	if (setup_max_space == 0)
+		return 1;
+	if (curr_driver->drvctl_func(LIRC_GET_MIN_TIMEOUT, &min_timeout) != 0
+	    || curr_driver->drvctl_func(LIRC_GET_MAX_TIMEOUT, &max_timeout) != 0
+	) {
+		return 0;
+	}
+	if ((uint32_t) setup_max_gap >= min_timeout &&
+	    (uint32_t) setup_max_gap <= max_timeout
+	) {
+		/* may help to detect end of signal faster */
+		val = setup_max_gap;
+	} else {
+		/* keep timeout to a minimum */
+		val = setup_max_space + 1;
+		if (val < min_timeout)
+			val = min_timeout;
+		else if (val > max_timeout)
+			/* maximum timeout smaller than maximum possible
+			 * space, hmm */
+			val = max_timeout;
+	}
+
+	if (curr_driver->drvctl_func(LIRC_SET_REC_TIMEOUT, &val) != 0) {
+		log_error("could not set timeout");
+		log_perror_err(__func__);
+		return 0;
+	}
+	curr_driver->drvctl_func(LIRC_SET_REC_TIMEOUT_REPORTS, &enable);
+	return 1;
+}
+
+
+static int setup_hardware(void)
+{
+	int ret = 1;
+
+	driver_lock();
+	if (curr_driver->fd != -1 && curr_driver->drvctl_func) {
+		if ((curr_driver->features & LIRC_CAN_SET_REC_CARRIER)
+		    || (curr_driver->features & LIRC_CAN_SET_REC_TIMEOUT)
+		    || (curr_driver->features & LIRC_CAN_SET_REC_FILTER)) {
+				ret = setup_frequency() && setup_timeout();
+		}
+	}
+	driver_unlock();
+	return ret;
+}
+
+
+/*
+ * Deinit the hardware when nothing uses it any more. With --idle-timeout
+ * this is done by the TIMER_IDLE timer, so clients connecting briefly
+ * and often such as irsend don't reinitialize it each time.
+ */
+static void release_hw(void)
+{
+	struct timeval when;
+
+	if (use_hw() || curr_driver->deinit_func == NULL)
+		return;
+	if (idle_timeout == 0) {
+		driver_deinit();
+		return;
+	}
+	get_monotonic_time(&when);
+	when.tv_sec += idle_timeout;
+	timer_set(TIMER_IDLE, NULL, &when);
+	hw_idle = 1;
+}
+
+
+/** Initialize the hardware for the first user, unless still idle. */
+static void acquire_hw(void)
+{
+	if (hw_idle) {
+		timer_clear(TIMER_IDLE, NULL);
+		hw_idle = 0;
+		return;
+	}
+	if (curr_driver->init_func) {
+		if (!driver_init()) {
+			log_warn("Failed to initialize hardware");
+			/* Don't exit here, otherwise lirc
+			 * bails out, and lircd exits, making
+			 * it impossible to connect to when we
+			 * have a device actually plugged
+			 * in. */
+		} else {
+			setup_hardware();
+		}
+	}
+}
+
+
+/*
+ * Hash indexes for looking up directives, remotes and codes by name,
+ * matching names case-insensitively like strcasecmp().
+ */
+
+struct nocase_hash {
+	size_t operator()(const std::string& s) const
+	{
+		size_t h = 2166136261u;         /* FNV-1a */
+		size_t i;
+
+		for (i = 0; i < s.size(); i++) {
+			h ^= tolower((unsigned char)s[i]);
+			h *= 16777619u;
+		}
+		return h;
+	}
+};
+
+struct nocase_equal {
+	bool operator()(const std::string& a, const std::string& b) const
+	{
+		return strcasecmp(a.c_str(), b.c_str()) == 0;
+	}
+};
+
+typedef std::unordered_map<std::string, struct ir_ncode*,
+			   nocase_hash, nocase_equal> code_index;
+
+struct remote_entry {
+	struct ir_remote*	remote;
+	code_index		codes;
+};
+
+typedef std::unordered_map<std::string, struct remote_entry,
+			   nocase_hash, nocase_equal> remote_index;
+
+typedef std::unordered_map<std::string, const struct protocol_directive*,
+			   nocase_hash, nocase_equal> directive_index;
+
+/** Index of remotes, rebuilt whenever remotes changes. */
+static remote_index* remotes_index = NULL;
+
+
+/** Index remotes and their codes. The first of duplicate names wins. */
+static remote_index* build_remote_index(struct ir_remote* head)
+{
+	remote_index* index = new remote_index();
+	struct ir_remote* ir;
+	struct ir_ncode* code;
+
+	for (ir = head; ir != NULL; ir = ir->next) {
+		if (index->count(ir->name) > 0)
+			continue;
+		struct remote_entry& entry = (*index)[ir->name];
+
+		entry.remote = ir;
+		for (code = ir->codes; code && code->name != NULL; code++)
+			entry.codes.insert(std::make_pair(code->name, code));
+	}
+	return index;
+}
+
+
+/** Replace remotes_index with an index of head. */
+static void update_remote_index(struct ir_remote* head)
+{
+	remote_index* index = build_remote_index(head);
+
+	delete remotes_index;
+	remotes_index = index;
+}
+
+
+/** get_ir_remote(remotes, name) using the index. */
+static struct ir_remote* find_remote(const char* name)
+{
+	remote_index::const_iterator it;
+
+	if (remotes_index == NULL || strcmp(name, "lirc") == 0)
+		return get_ir_remote(remotes, name);
+	it = remotes_index->find(name);
+	return it == remotes_index->end() ? NULL : it->second.remote;
+}
+
+
+/** get_code_by_name(remote, name) using the index when possible. */
+static struct ir_ncode* find_code(const struct ir_remote* remote,
+				  const char* name)
+{
+	remote_index::const_iterator it;
+	code_index::const_iterator code;
+
+	if (remotes_index == NULL)
+		return get_code_by_name(remote, name);
+	it = remotes_index->find(remote->name);
+	if (it == remotes_index->end() || it->second.remote != remote)
+		/* Not in current config, e. g. the "lirc" remote. */
+		return get_code_by_name(remote, name);
+	code = it->second.codes.find(name);
+	return code == it->second.codes.end() ? NULL : code->second;
+}
+
+
+static const struct protocol_directive* find_directive(const char* name)
+{
+	static directive_index index;
+	directive_index::const_iterator it;
+	int i;
+
+	if (index.empty()) {
+		for (i = 0; directives[i].name != NULL; i++)
+			index[directives[i].name] = &directives[i];
+	}
+	it = index.find(name);
+	return it == index.end() ? NULL : it->second;
+}
+
+
+static void check_config_duplicates(const struct ir_remote* head)
+{
+	std::unordered_set<std::string> names;
+	const struct ir_remote* ir;
+	const char* const errmsg =
+		"Duplicate remotes \"%s\" found, problems ahead";
+
+	for (ir = head; ir != NULL; ir = ir->next) {
+		if (!names.insert(ir->name).second)
+			log_warn(errmsg, ir->name);
+	}
+}
+
+
+#ifdef USE_UINPUT
+
+/** An input key for a code, sent by the in-process uinput output. */
+struct uinput_key {
+	linux_input_code	code;
+	bool			is_release;     /**< Code is KEY_..._EVUP. */
+};
+
+/** Keys of the codes in remotes, rebuilt by config(). */
+static std::unordered_map<const struct ir_ncode*, struct uinput_key>
+	uinput_keys;
+
+/** The --uinput-output device, or -1. */
+static int uinput_fd = -1;
+
+
+/** Open and create the uinput device, return fd or -1. */
+static int uinput_open(const char* path)
+{
+	struct uinput_user_dev dev;
+	int key;
+	int fd;
+	bool ok;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1) {
+		log_perror_err("Cannot open uinput device: %s", path);
+		return -1;
+	}
+	memset(&dev, 0, sizeof(dev));
+	strncpy(dev.name, UINPUT_DEVNAME, sizeof(dev.name) - 1);
+	ok = write(fd, &dev, sizeof(dev)) == sizeof(dev)
+	     && ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0
+	     && ioctl(fd, UI_SET_EVBIT, EV_REP) == 0;
+	for (key = KEY_RESERVED; ok && key <= KEY_MAX; key++)
+		ok = ioctl(fd, UI_SET_KEYBIT, key) == 0;
+	if (ok && ioctl(fd, UI_DEV_CREATE) == 0)
+		return fd;
+	log_perror_err("Cannot setup uinput device: %s", path);
+	close(fd);
+	return -1;
+}
+
+
+static void uinput_close(void)
+{
+	if (uinput_fd == -1)
+		return;
+	ioctl(uinput_fd, UI_DEV_DESTROY);
+	close(uinput_fd);
+	uinput_fd = -1;
+}
+
+
+/**
+ * Map the codes in head named as input keys, optionally with the
+ * LIRC_RELEASE_SUFFIX, to their key codes.
+ */
+static void uinput_map_keys(const struct ir_remote* head)
+{
+	const size_t suffix_len = strlen(LIRC_RELEASE_SUFFIX);
+	const struct ir_remote* ir;
+	const struct ir_ncode* code;
+	struct uinput_key key;
+	size_t len;
+
+	uinput_keys.clear();
+	if (uinput_fd == -1)
+		return;
+	for (ir = head; ir != NULL; ir = ir->next) {
+		for (code = ir->codes; code && code->name != NULL; code++) {
+			key.is_release = false;
+			if (get_input_code(code->name, &key.code) == -1) {
+				len = strlen(code->name);
+				if (len <= suffix_len
+				    || strcasecmp(code->name + len - suffix_len,
+						  LIRC_RELEASE_SUFFIX) != 0)
+					continue;
+				std::string name(code->name, len - suffix_len);
+
+				if (get_input_code(name.c_str(),
+						   &key.code) == -1)
+					continue;
+				key.is_release = true;
+			}
+			uinput_keys[code] = key;
+		}
+	}
+	log_debug("uinput: %d codes mapped to keys", (int)uinput_keys.size());
+}
+
+
+/** Write the key of a broadcast code line to uinput, if there is one. */
+static void uinput_message(const char* message)
+{
+	char names[PACKET_SIZE + 1];
+	struct input_event events[2];
+	struct code_line parsed;
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	const char* nl;
+	size_t len;
+
+	nl = strchr(message, '\n');
+	len = nl != NULL ? nl - message : strlen(message);
+	if (len > PACKET_SIZE || code_line_parse(message, len, &parsed) != 1)
+		return;
+	/* find_*() need C strings: button and remote, NUL-terminated. */
+	memcpy(names, parsed.button, parsed.button_len);
+	names[parsed.button_len] = '\0';
+	memcpy(names + parsed.button_len + 1, parsed.remote, parsed.remote_len);
+	names[parsed.button_len + 1 + parsed.remote_len] = '\0';
+	remote = find_remote(names + parsed.button_len + 1);
+	if (remote == NULL)
+		return;
+	code = find_code(remote, names);
+	if (code == NULL)
+		return;
+	auto it = uinput_keys.find(code);
+
+	if (it == uinput_keys.end())
+		return;
+	memset(events, 0, sizeof(events));
+	events[0].type = EV_KEY;
+	events[0].code = it->second.code;
+	if (it->second.is_release)
+		events[0].value = 0;
+	else
+		events[0].value = parsed.reps > 0 ? 2 : 1;
+	events[1].type = EV_SYN;
+	events[1].code = SYN_REPORT;
+	if (write(uinput_fd, events, sizeof(events)) != sizeof(events))
+		log_perror_warn("Cannot write to uinput device");
+}
+
+#else
+
+static void uinput_map_keys(const struct ir_remote* head) {}
+
+#endif /* USE_UINPUT */
+
+
+void config(void)
+{
+	FILE* fd;
+	struct ir_remote* config_remotes;
+	const char* filename = configfile;
+
+	if (filename == NULL)
+		filename = LIRCDCFGFILE;
+
+	if (free_remotes != NULL) {
+		log_error("cannot read config file");
+		log_error("old config is still in use");
+		return;
+	}
+	fd = fopen(filename, "r");
+	if (fd == NULL && errno == ENOENT && configfile == NULL) {
+		/* try old lircd.conf location */
+		int save_errno = errno;
+
+		fd = fopen(LIRCDOLDCFGFILE, "r");
+		if (fd != NULL)
+			filename = LIRCDOLDCFGFILE;
+		else
+			errno = save_errno;
+	}
+	if (fd == NULL) {
+		log_perror_err("could not open config file '%s'", filename);
+		return;
+	}
+	configfile = filename;
+	/* Only computing signal lengths takes driver_lock(), see main(). */
+	config_remotes = read_config_compiled(fd, configfile, config_cache);
+	check_config_duplicates(config_remotes);
+	fclose(fd);
+	if (config_remotes == (void*)-1) {
+		log_error("reading of config file failed");
+	} else {
+		log_trace("config file read");
+		if (config_remotes == NULL) {
+			log_warn("config file %s contains no valid remote control definition",
+				  filename);
+		}
+		/* I cannot free the data structure
+		 * as they could still be in use */
+		free_remotes = remotes;
+		remotes = config_remotes;
+		driver_lock();
+		send_buffer_cache_clear();
+		driver_unlock();
+		list_cache_clear();
+		update_remote_index(remotes);
+		uinput_map_keys(remotes);
+		record_names_load(remotes);
+		decode_swap_remotes();
+
+		get_frequency_range(remotes, &setup_min_freq, &setup_max_freq);
+		get_filter_parameters(remotes, &setup_max_gap, &setup_min_pulse,
+				      &setup_min_space, &setup_max_pulse,
+				      &setup_max_space);
+
+		/* Else done by main() when the startup init is done. */
+		if (!init_pending)
+			setup_hardware();
+		log_memory_usage();
+	}
+}
+
+
+/*
+ * Ignore the client waiting for a SEND_ONCE reply until codes have been
+ * sent and it will get an answer. Otherwise we could mix up answer packets
+ * and send them back in the wrong order.
+ */
+static void set_repeat_fd(int fd)
+{
+	int old = client_index(repeat_fd);
+
+	repeat_fd = fd;
+	if (old != -1) {
+		update_client_events(old);
+		if (clients[old].input->has_lines()
+		    && std::find(pending_fds.begin(), pending_fds.end(),
+				 clients[old].fd) == pending_fds.end())
+			pending_fds.push_back(clients[old].fd);
+	}
+	if (client_index(fd) != -1)
+		update_client_events(client_index(fd));
+}
+
+
+void remove_client(int fd)
+{
+	int i = client_index(fd);
+
+	if (i == -1) {
+		log_trace("internal error in remove_client: no such fd");
+		return;
+	}
+	if (fd == repeat_fd)
+		repeat_fd = -1;
+	poll_remove(fd);
+	shutdown(fd, 2);
+	close(fd);
+	queue_free(&clients[i].queue);
+	if (clients[i].input == running_input)
+		running_input = NULL;   /* Deleted by run_commands(). */
+	else
+		delete clients[i].input;
+	pending_fds.erase(std::remove(pending_fds.begin(), pending_fds.end(),
+				      fd),
+			  pending_fds.end());
+	coalesced_fds.erase(std::remove(coalesced_fds.begin(),
+					coalesced_fds.end(), fd),
+			    coalesced_fds.end());
+	if (clients[i].send_wait)
+		send_unwait(fd);
+	log_info("removed client");
+
+	client_slot[fd] = -1;
+	if (i != (int)clients.size() - 1) {
+		clients[i] = clients.back();
+		client_slot[clients[i].fd] = i;
+	}
+	clients.pop_back();
+	release_hw();
+}
+
+
+void sigterm(int sig)
+{
+	/* all signals are blocked now */
+	if (term)
+		return;
+	term = 1;
+	termsig = sig;
+}
+
+void dosigterm(int sig)
+{
+	int i;
+
+	signal(SIGALRM, SIG_IGN);
+	log_notice("caught signal");
+	send_join();
+	decode_join();
+	receivers_stop();
+	event_ring_close();
+#ifdef USE_UINPUT
+	uinput_close();
+#endif
+
+	if (free_remotes != NULL)
+		free_config(free_remotes);
+	free_config(remotes);
+	free_config_cache();
+	repeat_remote = NULL;
+	for (i = 0; i < (int)clients.size(); i++) {
+		shutdown(clients[i].fd, 2);
+		close(clients[i].fd);
+	}
+	;
+	if (do_shutdown)
+		shutdown(sockfd, 2);
+	close(sockfd);
+
+	if (listen_tcpip) {
+		shutdown(sockinet, 2);
+		close(sockinet);
+	}
+	if (multicast_fd != -1)
+		close(multicast_fd);
+	fclose(pidf);
+	(void)unlink(pidfile);
+	if (curr_driver->close_func)
+		curr_driver->close_func();
+	if ((use_hw() || hw_idle) && curr_driver->deinit_func)
+		curr_driver->deinit_func();
+	if (curr_driver->close_func)
+		curr_driver->close_func();
+	lirc_log_close();
+	signal(sig, SIG_DFL);
+	if (sig == SIGUSR1)
+		exit(0);
+	raise(sig);
+}
+
+void sighup(int sig)
+{
+	hup = 1;
+}
+
+void dosighup(int sig)
+{
+	char packet[32];
+	int i;
+
+	/* reopen logfile first */
+	if (lirc_log_reopen() != 0) {
+		/* can't print any error messagees */
+		dosigterm(SIGTERM);
+	}
+
+	config();
+	receivers_stop();
+	receivers_start();
+
+	snprintf(packet, sizeof(packet), "%s%s%s",
+		 protocol_string[P_BEGIN],
+		 protocol_string[P_SIGHUP],
+		 protocol_string[P_END]);
+	broadcast_message(packet);
+	/* restart all connection timers */
+	for (i = 0; i < (int)peers.size(); i++) {
+		if (peers[i]->socket == -1) {
+			get_monotonic_time(&peers[i]->reconnect);
+			peers[i]->connection_failure = 0;
+			timer_set(TIMER_PEER, peers[i], &peers[i]->reconnect);
+		}
+	}
+}
+
+void nolinger(int sock)
+{
+	static struct linger linger = { 0, 0 };
+	int lsize = sizeof(struct linger);
+
+	setsockopt(sock, SOL_SOCKET, SO_LINGER, (void*)&linger, lsize);
+}
+
+
+/**
+ * Set the options of a TCP client or peer socket. Replies are written
+ * at once, so Nagle's algorithm only delays them by waiting for the
+ * peer's delayed ACK. Keepalive probes detect a peer which has gone
+ * away without closing the connection, as does the user timeout for
+ * data which is never acknowledged.
+ */
+static void tcp_tune(int sock)
+{
+	int enable = 1;
+	int value;
+	socklen_t size = sizeof(value);
+
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
+			 &enable, sizeof(enable));
+	(void)setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE,
+			 &enable, sizeof(enable));
+#ifdef TCP_KEEPIDLE
+	value = TCP_KEEPALIVE_IDLE;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE,
+			 &value, sizeof(value));
+	value = TCP_KEEPALIVE_INTERVAL;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL,
+			 &value, sizeof(value));
+	value = TCP_KEEPALIVE_COUNT;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT,
+			 &value, sizeof(value));
+#endif
+#ifdef TCP_USER_TIMEOUT
+	value = (TCP_KEEPALIVE_IDLE
+		 + TCP_KEEPALIVE_INTERVAL * TCP_KEEPALIVE_COUNT) * 1000;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT,
+			 &value, sizeof(value));
+#endif
+	if (getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &value, &size) == 0
+	    && value < TCP_SNDBUF_MIN) {
+		value = TCP_SNDBUF_MIN;
+		(void)setsockopt(sock, SOL_SOCKET, SO_SNDBUF,
+				 &value, sizeof(value));
+	}
+}
+
+
+void drop_privileges(void)
+{
+	const char* user;
+	struct passwd* pw;
+	GETGROUPS_T groups[32];
+	int group_cnt = sizeof(groups)/sizeof(gid_t);
+	char groupnames[256] = {0};
+	char buff[12];
+	int r;
+	int i;
+
+	if (getuid() != 0)
+		return;
+	user = options_getstring("lircd:effective-user");
+	if (user == NULL || strlen(user) == 0) {
+		log_warn("Running as root");
+		return;
+	}
+	pw = getpwnam(user);
+	if (pw == NULL) {
+		log_perror_warn("Illegal effective uid: %s", user);
+		return;
+	}
+	r = getgrouplist(user, pw->pw_gid, groups, &group_cnt);
+	if (r == -1) {
+		log_perror_warn("Cannot get supplementary groups");
+		return;
+	}
+	r = setgroups(group_cnt, (const gid_t*) groups);
+	if (r == -1) {
+		log_perror_warn("Cannot set supplementary groups");
+		return;
+	}
+	r = setgid(pw->pw_gid);
+	if (r == -1) {
+		log_perror_warn("Cannot set GID");
+		return;
+	}
+	r = setuid(pw->pw_uid);
+	if (r == -1) {
+		log_perror_warn("Cannot change UID");
+		return;
+	}
+	log_notice("Running as user %s", user);
+	for (i = 0; i < group_cnt; i += 1) {
+		snprintf(buff, 5, " %d", groups[i]);
+		strcat(groupnames, buff);
+	}
+	log_debug("Groups: [%d]:%s", pw->pw_gid, groupnames);
+}
+
+
+static int client_attach(int fd, int type);
+
+void add_client(int sock)
+{
+	int fd;
+	socklen_t clilen;
+	struct sockaddr client_addr;
+	int flags;
+	int type;
+
+	clilen = sizeof(client_addr);
+	fd = accept(sock, (struct sockaddr*)&client_addr, &clilen);
+	if (fd == -1) {
+		log_perror_err("accept() failed for new client");
+		dosigterm(SIGTERM);
+	}
+	;
+
+	nolinger(fd);
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags != -1)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	if (client_addr.sa_family == AF_UNIX) {
+		type = CT_LOCAL;
+		log_notice("accepted new client on %s", lircdfile);
+	} else if (client_addr.sa_family == AF_INET) {
+		type = CT_REMOTE;
+		tcp_tune(fd);
+		log_notice(
+			"accepted new client from %s",
+			inet_ntoa(
+				((struct sockaddr_in*)&client_addr)->sin_addr)
+		);
+	} else {
+		type = 0;     /* what? */
+	}
+	client_attach(fd, type);
+}
+
+
+/** Add connected socket fd as a new client, return its index. */
+static int client_attach(int fd, int type)
+{
+	struct client cli;
+
+	cli.fd = fd;
+	cli.type = type;
+	cli.events = POLLIN;
+	cli.send_wait = 0;
+	cli.binary = 0;
+	cli.ring = 0;
+	cli.coalesce = 0;
+	cli.repeat_seq = 0;
+	cli.backlog = 0;
+	cli.listing_pos = 0;
+	cli.subscriptions.clear();
+	memset(&cli.queue, 0, sizeof(struct out_queue));
+	cli.input = new LineBuffer();
+	poll_add(fd, FD_CLIENT);
+	if (!use_hw())
+		acquire_hw();
+	if (fd >= (int)client_slot.size())
+		client_slot.resize(fd + 1, -1);
+	client_slot[fd] = clients.size();
+	clients.push_back(cli);
+	return clients.size() - 1;
+}
+
+int add_peer_connection(const char* server_arg)
+{
+	char* sep;
+	struct servent* service;
+	char server[strlen(server_arg) + 1];
+	struct peer_connection* peer;
+
+	strncpy(server, server_arg, sizeof(server));
+
+	peer = (struct peer_connection*) malloc(sizeof(struct peer_connection));
+	if (peer == NULL) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		return 0;
+	}
+	get_monotonic_time(&peer->reconnect);
+	timer_set(TIMER_PEER, peer, &peer->reconnect);
+	peer->connection_failure = 0;
+	peer->connecting = 0;
+	peer->addrinfos = NULL;
+	peer->next_addr = NULL;
+	peer->input = NULL;
+	sep = strchr(server, ':');
+	if (sep != NULL) {
+		*sep = 0;
+		sep++;
+		peer->host = strdup(server);
+		service = getservbyname(sep, "tcp");
+		if (service) {
+			peer->port = ntohs(service->s_port);
+		} else {
+			long p;
+			char* endptr;
+
+			p = strtol(sep, &endptr, 10);
+			if (!*sep || *endptr || p < 1 || p > USHRT_MAX) {
+				fprintf(stderr,
+					"%s: bad port number \"%s\"\n",
+					progname, sep);
+				free(peer->host);
+				free(peer);
+				return 0;
+			}
+
+			peer->port = (unsigned short int)p;
+		}
+	} else {
+		peer->host = strdup(server);
+		peer->port = LIRC_INET_PORT;
+	}
+	if (peer->host == NULL)
+		fprintf(stderr, "%s: out of memory\n", progname);
+	peer->socket = -1;
+	peers.push_back(peer);
+	return 1;
+}
+
+
+/** Close the peer socket, if any. */
+static void close_peer(struct peer_connection* peer)
+{
+	if (peer->socket != -1) {
+		poll_remove(peer->socket);
+		shutdown(peer->socket, 2);
+		close(peer->socket);
+		peer->socket = -1;
+	}
+	delete peer->input;
+	peer->input = NULL;
+	peer->connecting = 0;
+}
+
+
+/** Schedule next connection attempt with exponential backoff and jitter. */
+static void retry_peer_later(struct peer_connection* peer)
+{
+	static unsigned int seed = 0;
+	long delay = PEER_RETRY_MAX * 1000000L;
+	struct timeval tv;
+
+	if (peer->addrinfos != NULL) {
+		freeaddrinfo(peer->addrinfos);
+		peer->addrinfos = NULL;
+		peer->next_addr = NULL;
+	}
+	close_peer(peer);
+	if (seed == 0)
+		seed = time(NULL) ^ getpid();
+	if (peer->connection_failure < 16
+	    && PEER_RETRY_MIN * 1000000L << peer->connection_failure < delay)
+		delay = PEER_RETRY_MIN * 1000000L << peer->connection_failure;
+	peer->connection_failure++;
+	/* Wait between delay/2 and delay so peers don't retry in lockstep. */
+	delay = delay / 2 + rand_r(&seed) % (delay / 2 + 1);
+	get_monotonic_time(&peer->reconnect);
+	tv.tv_sec = delay / 1000000;
+	tv.tv_usec = delay % 1000000;
+	timeradd(&peer->reconnect, &tv, &peer->reconnect);
+	timer_set(TIMER_PEER, peer, &peer->reconnect);
+	log_trace("Retrying %s in %ld ms", peer->host, delay / 1000);
+}
+
+
+static void peer_connected(struct peer_connection* peer)
+{
+	log_notice("Connected to %s", peer->host);
+	freeaddrinfo(peer->addrinfos);
+	peer->addrinfos = NULL;
+	peer->next_addr = NULL;
+	peer->connecting = 0;
+	peer->connection_failure = 0;
+	timer_clear(TIMER_PEER, peer);
+	peer->input = new LineBuffer();
+	poll_add(peer->socket, FD_PEER);
+}
+
+
+/**
+ * Start a non-blocking connect() to the next address of peer. Completion
+ * is reported by POLLOUT, see peer_connect_done(). Schedules a retry when
+ * there are no more addresses.
+ */
+static void connect_next_address(struct peer_connection* peer)
+{
+	struct addrinfo* a;
+
+	while (peer->next_addr != NULL) {
+		a = peer->next_addr;
+		peer->next_addr = a->ai_next;
+		peer->socket = socket(a->ai_family, a->ai_socktype, 0);
+		if (peer->socket == -1)
+			continue;
+		tcp_tune(peer->socket);
+		(void)fcntl(peer->socket, F_SETFD, FD_CLOEXEC);
+		if (fcntl(peer->socket, F_SETFL, O_NONBLOCK) == -1) {
+			log_perror_warn("Cannot make peer socket non-blocking");
+		} else if (connect(peer->socket, a->ai_addr, a->ai_addrlen)
+			   == 0) {
+			peer_connected(peer);
+			return;
+		} else if (errno == EINPROGRESS) {
+			peer->connecting = 1;
+			get_monotonic_time(&peer->reconnect);
+			peer->reconnect.tv_sec += PEER_CONNECT_TIMEOUT;
+			timer_set(TIMER_PEER, peer, &peer->reconnect);
+			poll_set(peer->socket, FD_PEER, POLLOUT);
+			return;
+		} else {
+			log_perror_debug("Cannot connect to %s", peer->host);
+		}
+		close(peer->socket);
+		peer->socket = -1;
+	}
+	log_error("Cannot connect to %s", peer->host);
+	retry_peer_later(peer);
+}
+
+
+/** Handle POLLOUT on a connecting peer socket. */
+static void peer_connect_done(struct peer_connection* peer)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(peer->socket, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+		err = errno;
+	if (err == 0) {
+		peer_connected(peer);
+		return;
+	}
+	errno = err;
+	log_perror_debug("Cannot connect to %s", peer->host);
+	close_peer(peer);
+	connect_next_address(peer);
+}
+
+
+void connect_to_peer(peer_connection* peer)
+{
+	int r;
+	char service[64];
+	struct addrinfo hints;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", peer->port);
+	r = getaddrinfo(peer->host, service, &hints, &peer->addrinfos);
+	if (r != 0) {
+		log_error("Name lookup failure connecting to %s: %s",
+			  peer->host, gai_strerror(r));
+		peer->addrinfos = NULL;
+		retry_peer_later(peer);
+		return;
+	}
+	peer->next_addr = peer->addrinfos;
+	connect_next_address(peer);
+}
+
+
+void connect_to_peers(void)
+{
+	int i;
+	struct timeval now;
+
+	get_monotonic_time(&now);
+	for (i = 0; i < (int)peers.size(); i++) {
+		if (peers[i]->socket != -1 && !peers[i]->connecting)
+			continue;
+		/* some timercmp() definitions don't work with <= */
+		if (!timercmp(&peers[i]->reconnect, &now, <))
+			continue;
+		if (peers[i]->connecting) {
+			log_debug("Timeout connecting to %s", peers[i]->host);
+			close_peer(peers[i]);
+			connect_next_address(peers[i]);
+		} else {
+			connect_to_peer(peers[i]);
+		}
+	}
+}
+
+
+/**
+ * Read from a peer and relay all complete lines to local clients.
+ * Return 0 if the connection should be closed.
+ */
+int get_peer_message(struct peer_connection* peer)
+{
+	int length;
+	char buffer[PACKET_SIZE + 1];
+	std::string packet;
+	int i;
+
+	length = read(peer->socket, buffer, PACKET_SIZE);
+	if (length == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 1;
+		log_perror_warn("Cannot read from %s", peer->host);
+		return 0;
+	}
+	if (length == 0)        /* EOF: connection closed by peer */
+		return 0;
+	peer->input->append(buffer, length);
+	while (peer->input->has_lines())
+		packet += peer->input->get_next_line();
+	if (strlen(peer->input->c_str()) > PACKET_SIZE) {
+		log_error("bad send packet: \"%.*s\"",
+			  PACKET_SIZE, peer->input->c_str());
+		/* remove peers that behave badly */
+		return 0;
+	}
+	if (packet.empty())
+		return 1;
+	log_trace("received peer message: \"%s\"", packet.c_str());
+	for (i = 0; i < (int)clients.size(); i++) {
+		/* don't relay messages to remote clients */
+		if (clients[i].type == CT_REMOTE)
+			continue;
+		log_trace("writing to client %d", i);
+		if (!send_to_client(i, packet.c_str(), packet.size())) {
+			remove_client(clients[i].fd);
+			i--;
+		}
+	}
+	return 1;
+}
+
+/** Create the --multicast socket, 0 on errors. */
+static int multicast_open(void)
+{
+	unsigned char ttl = options_getint("lircd:multicast-ttl");
+	unsigned char loop = 1;
+
+	multicast_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (multicast_fd == -1) {
+		log_perror_err("Could not create multicast socket");
+		return 0;
+	}
+	if (setsockopt(multicast_fd, IPPROTO_IP, IP_MULTICAST_TTL,
+		       &ttl, sizeof(ttl)) == -1
+	    || setsockopt(multicast_fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+			  &loop, sizeof(loop)) == -1) {
+		log_perror_err("Could not set up multicast socket");
+		close(multicast_fd);
+		multicast_fd = -1;
+		return 0;
+	}
+	return 1;
+}
+
+
+/**
+ * Send message to the --multicast group, prefixed by its sequence
+ * number. Never blocks, a datagram which cannot be sent is lost like
+ * any other, and shows up as a gap to the receivers.
+ */
+static void multicast_send(const char* message, int len)
+{
+	char buf[PACKET_SIZE * 2 + 32];
+	int n;
+
+	multicast_seq++;
+	n = snprintf(buf, sizeof(buf), "%llu ",
+		     (unsigned long long)multicast_seq);
+	if (n + len > (int)sizeof(buf)) {
+		log_warn("Multicast: message too long, dropped");
+		return;
+	}
+	memcpy(buf + n, message, len);
+	if (sendto(multicast_fd, buf, n + len, MSG_DONTWAIT,
+		   (struct sockaddr*)&multicast_addr,
+		   sizeof(multicast_addr)) == -1)
+		log_perror_debug("Multicast: sendto");
+}
+
+
+/*
+ * SIGUSR2 re-executes lircd, keeping the locked pidfile, the listening
+ * sockets, clients, connected peers and the uinput device. Their fds are
+ * kept open across execv() and listed in a state file, an unlinked
+ * temporary file whose fd is in LIRCD_RESTART_FD. Everything else is set
+ * up from the options and the config as on a normal start.
+ */
+
+/** A client handed over by the previous process. */
+struct restart_client {
+	int		fd;
+	int		type;
+	int		binary;
+	int		coalesce;
+	std::vector<struct subscription> subscriptions;
+};
+
+/** What the previous process handed over, fds are -1 if none. */
+static struct {
+	int		active;
+	int		daemonized;
+	int		pidfd;
+	int		sockfd;
+	int		do_shutdown;
+	int		sockinet;
+	int		uinput;
+	std::vector<struct restart_client> clients;
+	/** Index in peers, fd. */
+	std::vector<std::pair<int, int> > peers;
+} handover = { 0, 0, -1, -1, 0, -1, -1 };
+
+/** The executable and arguments to restart with, set by main(). */
+static char restart_exe[PATH_MAX];
+static char** restart_argv = NULL;
+
+
+void sigrestart(int sig)
+{
+	restart = 1;
+}
+
+
+static void restart_cloexec(int fd, const std::vector<int>& keep)
+{
+	int flags = fcntl(fd, F_GETFD);
+
+	if (flags == -1)
+		return;
+	if (std::find(keep.begin(), keep.end(), fd) != keep.end())
+		flags &= ~FD_CLOEXEC;
+	else
+		flags |= FD_CLOEXEC;
+	fcntl(fd, F_SETFD, flags);
+}
+
+
+/** Set FD_CLOEXEC on all fds above stderr except those in keep. */
+static void restart_set_cloexec(const std::vector<int>& keep)
+{
+	struct dirent* ent;
+	DIR* dir;
+	int fd;
+
+	dir = opendir("/proc/self/fd");
+	if (dir == NULL) {
+		for (fd = 3; fd < 1024; fd++)
+			restart_cloexec(fd, keep);
+		return;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		fd = atoi(ent->d_name);
+		if (fd > 2 && fd != dirfd(dir))
+			restart_cloexec(fd, keep);
+	}
+	closedir(dir);
+}
+
+
+/** Write the state file for the new process, 0 on errors. */
+static int restart_write_state(FILE* f, std::vector<int>* keep)
+{
+	size_t j;
+	int i;
+
+	fprintf(f, "lircd-restart 1\n");
+	fprintf(f, "daemonized %d\n", daemonized);
+	fprintf(f, "pidfile %d\n", fileno(pidf));
+	keep->push_back(fileno(pidf));
+	fprintf(f, "sockfd %d %d\n", sockfd, do_shutdown);
+	keep->push_back(sockfd);
+	if (listen_tcpip) {
+		fprintf(f, "sockinet %d\n", sockinet);
+		keep->push_back(sockinet);
+	}
+#ifdef USE_UINPUT
+	if (uinput_fd != -1) {
+		fprintf(f, "uinput %d\n", uinput_fd);
+		keep->push_back(uinput_fd);
+	}
+#endif
+	for (i = 0; i < (int)clients.size(); i++) {
+		if (!flush_client_blocking(i))
+			log_warn("Restart: output for client %d lost",
+				 clients[i].fd);
+		fprintf(f, "client %d %d %d %d\n",
+			clients[i].fd, clients[i].type, clients[i].binary,
+			clients[i].coalesce);
+		for (j = 0; j < clients[i].subscriptions.size(); j++) {
+			const struct subscription* sub =
+				&clients[i].subscriptions[j];
+
+			fprintf(f, "subscribe %d %d %s %s\n", clients[i].fd,
+				sub->events, sub->remote.c_str(),
+				sub->button.c_str());
+		}
+		keep->push_back(clients[i].fd);
+	}
+	for (i = 0; i < (int)peers.size(); i++) {
+		if (peers[i]->socket == -1 || peers[i]->connecting)
+			continue;
+		fprintf(f, "peer %d %d\n", i, peers[i]->socket);
+		keep->push_back(peers[i]->socket);
+	}
+	keep->push_back(fileno(f));
+	return fflush(f) == 0 && !ferror(f) && fseek(f, 0, SEEK_SET) == 0;
+}
+
+
+/**
+ * Re-execute restart_exe with the same arguments. Returns only if the
+ * restart could not be started, execv() errors are fatal.
+ */
+static void dorestart(void)
+{
+	std::vector<int> keep;
+	const char* user;
+	sigset_t none;
+	char buf[16];
+	FILE* state;
+	int i;
+
+	/* The pidfile and the device may not be reopened unprivileged. */
+	user = options_getstring("lircd:effective-user");
+	if (getuid() != 0 && user != NULL && *user != '\0') {
+		log_error("Cannot restart running as effective user %s",
+			  user);
+		return;
+	}
+	if (restart_argv == NULL || access(restart_exe, X_OK) != 0) {
+		log_perror_err("Cannot restart %s", restart_exe);
+		return;
+	}
+	state = tmpfile();
+	if (state == NULL) {
+		log_perror_err("Cannot create restart state");
+		return;
+	}
+	/* The event ring is recreated, its readers must reconnect. */
+	for (i = (int)clients.size() - 1; i >= 0; i--)
+		if (clients[i].ring)
+			remove_client(clients[i].fd);
+	if (!restart_write_state(state, &keep)) {
+		log_perror_err("Cannot write restart state");
+		fclose(state);
+		return;
+	}
+	log_notice("Restarting %s, keeping %d clients",
+		   restart_exe, (int)clients.size());
+	signal(SIGALRM, SIG_IGN);
+	send_join();
+	decode_join();
+	receivers_stop();
+	event_ring_close();
+	if ((use_hw() || hw_idle) && curr_driver->deinit_func)
+		curr_driver->deinit_func();
+	if (curr_driver->close_func)
+		curr_driver->close_func();
+	/* The locked pidfile fd is handed over, the lock is kept. */
+	restart_set_cloexec(keep);
+	snprintf(buf, sizeof(buf), "%d", fileno(state));
+	setenv("LIRCD_RESTART_FD", buf, 1);
+	lirc_log_close();
+	sigemptyset(&none);
+	pthread_sigmask(SIG_SETMASK, &none, NULL);
+	execv(restart_exe, restart_argv);
+
+	lirc_log_open("lircd", nodaemon, loglevel_opt);
+	log_perror_err("Cannot execute %s", restart_exe);
+	exit(EXIT_FAILURE);
+}
+
+
+/** Return 1 if fd is open, else log a warning. */
+static int handover_fd_ok(int fd, const char* what)
+{
+	if (fd >= 0 && fcntl(fd, F_GETFD) != -1)
+		return 1;
+	log_warn("Restart: bad %s fd %d", what, fd);
+	return 0;
+}
+
+
+/** Read the state file of the previous process into handover. */
+static void handover_load(void)
+{
+	struct restart_client client;
+	struct subscription sub;
+	char remote[PACKET_SIZE + 1];
+	char button[PACKET_SIZE + 1];
+	char line[2 * PACKET_SIZE + 64];
+	char format[64];
+	const char* env;
+	FILE* f;
+	int fd;
+	int a;
+	int b;
+	int n;
+	size_t i;
+
+	env = getenv("LIRCD_RESTART_FD");
+	if (env == NULL)
+		return;
+	fd = atoi(env);
+	unsetenv("LIRCD_RESTART_FD");
+	f = fdopen(fd, "r");
+	if (f == NULL) {
+		log_perror_err("Cannot read restart state");
+		return;
+	}
+	handover.active = 1;
+	snprintf(format, sizeof(format), "subscribe %%d %%d %%%ds %%%ds",
+		 PACKET_SIZE, PACKET_SIZE);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "daemonized %d", &a) == 1) {
+			handover.daemonized = a;
+		} else if (sscanf(line, "pidfile %d", &a) == 1) {
+			if (handover_fd_ok(a, "pidfile"))
+				handover.pidfd = a;
+		} else if (sscanf(line, "sockfd %d %d", &a, &b) == 2) {
+			if (handover_fd_ok(a, "socket")) {
+				handover.sockfd = a;
+				handover.do_shutdown = b;
+			}
+		} else if (sscanf(line, "sockinet %d", &a) == 1) {
+			if (handover_fd_ok(a, "TCP socket"))
+				handover.sockinet = a;
+		} else if (sscanf(line, "uinput %d", &a) == 1) {
+			if (handover_fd_ok(a, "uinput"))
+				handover.uinput = a;
+		} else if ((n = sscanf(line, "client %d %d %d %d",
+				       &client.fd, &client.type,
+				       &client.binary, &a)) >= 3) {
+			/* No coalesce flag from older versions. */
+			client.coalesce = n == 4 ? a : 0;
+			if (handover_fd_ok(client.fd, "client"))
+				handover.clients.push_back(client);
+		} else if (sscanf(line, format, &a, &sub.events,
+				  remote, button) == 4) {
+			sub.remote = remote;
+			sub.button = button;
+			for (i = 0; i < handover.clients.size(); i++)
+				if (handover.clients[i].fd == a)
+					handover.clients[i].subscriptions
+					.push_back(sub);
+		} else if (sscanf(line, "peer %d %d", &a, &b) == 2) {
+			if (handover_fd_ok(b, "peer"))
+				handover.peers.push_back(std::make_pair(a, b));
+		}
+	}
+	fclose(f);
+	log_notice("Restarted, got %d clients and %d peers",
+		   (int)handover.clients.size(), (int)handover.peers.size());
+}
+
+
+/** Make clients and peers of the previous process ours. */
+static void handover_connections(void)
+{
+	struct peer_connection* peer;
+	size_t j;
+	int i;
+
+	for (j = 0; j < handover.peers.size(); j++) {
+		i = handover.peers[j].first;
+		if (i < 0 || i >= (int)peers.size()
+		    || peers[i]->socket != -1) {
+			close(handover.peers[j].second);
+			continue;
+		}
+		peer = peers[i];
+		peer->socket = handover.peers[j].second;
+		peer_connected(peer);
+	}
+	for (j = 0; j < handover.clients.size(); j++) {
+		i = client_attach(handover.clients[j].fd,
+				  handover.clients[j].type);
+		clients[i].subscriptions = handover.clients[j].subscriptions;
+		clients[i].coalesce = handover.clients[j].coalesce;
+		if (handover.clients[j].binary) {
+			clients[i].binary = 1;
+			if (!send_names(i))
+				remove_client(clients[i].fd);
+		}
+	}
+	handover.clients.clear();
+	handover.peers.clear();
+}
+
+
+void start_server(mode_t permission, int nodaemon, loglevel_t loglevel)
+{
+	struct sockaddr_un serv_addr;
+	struct sockaddr_in serv_addr_in;
+	struct stat s;
+	int ret;
+	int new_socket = 1;
+	int fd;
+
+#ifdef HAVE_SYSTEMD
+	int n;
+#endif
+
+	lirc_log_open("lircd", nodaemon, loglevel);
+
+	/* create pid lockfile in /var/run */
+	fd = handover.pidfd;
+	if (fd == -1)
+		fd = open(pidfile, O_RDWR | O_CREAT, 0644);
+	if (fd > 0)
+		pidf = fdopen(fd, "r+");
+	if (fd == -1 || pidf == NULL) {
+		perrorf("can't open or create %s", pidfile);
+		exit(EXIT_FAILURE);
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		pid_t otherpid;
+
+		if (fscanf(pidf, "%d\n", &otherpid) > 0) {
+			fprintf(stderr,
+				"%s: there seems to be a lircd process with pid %d\n",
+				progname, otherpid);
+			fprintf(stderr,
+				"%s: otherwise delete stale lockfile %s\n",
+				progname, pidfile);
+		} else {
+			fprintf(stderr, "%s: invalid %s encountered\n",
+				progname, pidfile);
+		}
+		exit(EXIT_FAILURE);
+	}
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	rewind(pidf);
+	(void)fprintf(pidf, "%d\n", getpid());
+	(void)fflush(pidf);
+	if (ftruncate(fileno(pidf), ftell(pidf)) != 0)
+		log_perror_warn("lircd: ftruncate()");
+	ir_remote_init(options_getboolean("lircd:dynamic-codes"));
+
+	/* create socket */
+	sockfd = -1;
+	do_shutdown = 0;
+#ifdef HAVE_SYSTEMD
+	n = sd_listen_fds(0);
+	if (n > 1) {
+		fprintf(stderr, "Too many file descriptors received.\n");
+		goto start_server_failed0;
+	} else if (n == 1) {
+	        log_notice("Using systemd fd");
+		sockfd = SD_LISTEN_FDS_START + 0;
+	}
+#endif
+	if (sockfd == -1 && handover.sockfd != -1) {
+		log_notice("Using socket of previous process");
+		sockfd = handover.sockfd;
+		do_shutdown = handover.do_shutdown;
+	}
+	if (sockfd == -1) {
+	        log_debug("No systemd fd found");
+		sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sockfd == -1) {
+			perror("Could not create socket");
+			goto start_server_failed0;
+		}
+		do_shutdown = 1;
+
+		/*
+		 * get owner, permissions, etc.
+		 * so new socket can be the same since we
+		 * have to delete the old socket.
+		 */
+		ret = stat(lircdfile, &s);
+		if (ret == -1 && errno != ENOENT) {
+			perrorf("Could not get file information for %s\n",
+				lircdfile);
+			goto start_server_failed1;
+		}
+		if (ret != -1) {
+			new_socket = 0;
+			ret = unlink(lircdfile);
+			if (ret == -1) {
+				perrorf("Could not delete %s", lircdfile);
+				goto start_server_failed1;
+			}
+		}
+
+		serv_addr.sun_family = AF_UNIX;
+		strcpy(serv_addr.sun_path, lircdfile);
+		if (bind(sockfd,
+			 (struct sockaddr*)&serv_addr, sizeof(serv_addr)) == -1
+		) {
+			perrorf("Could not assign address to socket%s",
+				lircdfile);
+			goto start_server_failed1;
+		}
+
+		if (new_socket ? chmod(lircdfile, permission)
+		    : (chmod(lircdfile, s.st_mode) == -1
+			  || chown(lircdfile, s.st_uid, s.st_gid) == -1)
+		) {
+			perrorf("Could not set file permissions on %s",
+				lircdfile);
+			goto start_server_failed1;
+		}
+		listen(sockfd, 3);
+	}
+	nolinger(sockfd);
+	if (options_getint("lircd:event-ring") > 0
+	    && !event_ring_create(options_getint("lircd:event-ring"),
+				  permission))
+		goto start_server_failed1;
+
+	drop_privileges();
+	if (handover.sockinet != -1) {
+		if (listen_tcpip)
+			sockinet = handover.sockinet;
+		else
+			close(handover.sockinet);
+	}
+	if (listen_tcpip && handover.sockinet == -1) {
+		int enable = 1;
+
+		/* create socket */
+		sockinet = socket(PF_INET, SOCK_STREAM, IPPROTO_IP);
+		if (sockinet == -1) {
+			perror("Could not create TCP/IP socket");
+			goto start_server_failed1;
+		}
+		(void)setsockopt(sockinet,
+				 SOL_SOCKET, SO_REUSEADDR,
+				 &enable, sizeof(enable));
+		serv_addr_in.sin_family = AF_INET;
+		serv_addr_in.sin_addr = address;
+		serv_addr_in.sin_port = htons(port);
+
+		if (bind(sockinet,
+			 (struct sockaddr*)&serv_addr_in,
+			 sizeof(serv_addr_in)) == -1
+		) {
+			perror("could not assign address to socket");
+			goto start_server_failed2;
+
+		}
+
+		listen(sockinet, 3);
+		nolinger(sockinet);
+	}
+	if (multicast && !multicast_open())
+		goto start_server_failed2;
+	if (!poll_init() || !repeat_timer_init())
+		goto start_server_failed2;
+	poll_add(sockfd, FD_SOCKFD);
+	if (listen_tcpip)
+		poll_add(sockinet, FD_SOCKINET);
+	log_trace("started server socket");
+	return;
+
+start_server_failed2:
+	if (listen_tcpip)
+		close(sockinet);
+start_server_failed1:
+	close(sockfd);
+start_server_failed0:
+	fclose(pidf);
+	(void)unlink(pidfile);
+	exit(EXIT_FAILURE);
+}
+
+
+void daemonize(void)
+{
+	if (daemon(0, 0) == -1) {
+		log_perror_err("daemon() failed");
+		dosigterm(SIGTERM);
+	}
+	umask(0);
+	rewind(pidf);
+	fprintf(pidf, "%d\n", getpid());
+	fflush(pidf);
+	if (ftruncate(fileno(pidf), ftell(pidf)) != 0)
+		log_perror_warn("lircd: ftruncate()");
+	daemonized = 1;
+}
+
+
+int send_success(int fd, char* message)
+{
+	ReplyBuffer reply(fd);
+
+	log_debug("Sending success");
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
+	      && write_socket_len(fd, message)
+	      && write_socket_len(fd, protocol_string[P_SUCCESS])
+	      && write_socket_len(fd, protocol_string[P_END]))
+	) {
+		return 0;
+	}
+	return reply.flush();
+}
+
+
+int send_error(int fd, char* message, const char* format_str, ...)
+{
+	log_debug("Sending error");
+	char lines[16], buffer[PACKET_SIZE + 1];
+	int i, n, len;
+	va_list ap;
+	char* s1;
+	char* s2;
+	char buffer2[PACKET_SIZE + 2];
+
+	ReplyBuffer reply(fd);
+
+	va_start(ap, format_str);
+	vsprintf(buffer, format_str, ap);
+	va_end(ap);
+
+	s1 = strrchr(message, '\n');
+	s2 = strrchr(buffer, '\n');
+	if (s1 != NULL)
+		s1[0] = 0;
+	if (s2 != NULL)
+		s2[0] = 0;
+	log_error("error processing command: %s", message);
+	log_error("%s", buffer);
+	if (s1 != NULL)
+		s1[0] = '\n';
+	snprintf(buffer2, sizeof(buffer2), "%s\n", buffer);
+
+	n = 0;
+	len = strlen(buffer2);
+	for (i = 0; i < len; i++)
+		if (buffer2[i] == '\n')
+			n++;
+	sprintf(lines, "%d\n", n);
+
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
+	      && write_socket_len(fd, message)
+	      && write_socket_len(fd, protocol_string[P_ERROR])
+	      && write_socket_len(fd, protocol_string[P_DATA])
+	      && write_socket_len(fd, lines)
+	      && write_socket_len(fd, buffer2)
+	      && write_socket_len(fd, protocol_string[P_END])
+	      && reply.flush()))
+		return 0;
+	return 1;
+}
+
+
+static void schedule_repeat_timer(const struct timespec* last, lirc_t sum)
+{
+	lirc_t gap;
+	struct timespec deadline;
+	struct timespec current;
+	long long nsecs;
+
+	gap = sum + repeat_remote->min_remaining_gap;
+	nsecs = last->tv_nsec + 1000LL * gap;
+	deadline.tv_sec = last->tv_sec + nsecs / 1000000000;
+	deadline.tv_nsec = nsecs % 1000000000;
+	clock_gettime(CLOCK_MONOTONIC, &current);
+	nsecs = (deadline.tv_sec - current.tv_sec) * 1000000000LL
+		+ deadline.tv_nsec - current.tv_nsec;
+	if (nsecs < 10000) {
+		/* late, send as soon as possible */
+		nsecs = current.tv_nsec + 10000;
+		deadline.tv_sec = current.tv_sec + nsecs / 1000000000;
+		deadline.tv_nsec = nsecs % 1000000000;
+		nsecs = 10000;
+	}
+	log_trace("alarm in %lu usecs", (unsigned long)(nsecs / 1000));
+	repeat_timer_set(&deadline);
+}
+
+
+/** Add fd to the clients with buffered commands to run later. */
+static void add_pending_fd(int fd)
+{
+	if (std::find(pending_fds.begin(), pending_fds.end(), fd)
+	    == pending_fds.end())
+		pending_fds.push_back(fd);
+}
+
+
+/**
+ * Reply with error, or success if NULL, to the clients waiting for the
+ * running transmission and let them run further commands. Return 0 if
+ * the reply to repeat_fd failed.
+ */
+static int send_reply(const char* error)
+{
+	size_t j;
+	int i;
+	int r = 1;
+
+	if (repeat_fd != -1)
+		r = error ? send_error(repeat_fd, repeat_message, error)
+			  : send_success(repeat_fd, repeat_message);
+	for (j = 0; j < coalesced_fds.size(); j++) {
+		i = client_index(coalesced_fds[j]);
+		if (i == -1)
+			continue;
+		clients[i].send_wait = 0;
+		update_client_events(i);
+		if (error)
+			send_error(clients[i].fd, repeat_message, error);
+		else
+			send_success(clients[i].fd, repeat_message);
+		if (clients[i].input->has_lines())
+			add_pending_fd(clients[i].fd);
+	}
+	coalesced_fds.clear();
+	free(repeat_message);
+	repeat_message = NULL;
+	set_repeat_fd(-1);
+	return r;
+}
+
+
+/** Reset the toggle and sequence state of code, sent as a new code. */
+static void prepare_code(struct ir_remote* remote, struct ir_ncode* code)
+{
+	if (has_toggle_mask(remote))
+		remote->toggle_mask_state = 0;
+	if (has_toggle_bit_mask(remote))
+		remote->toggle_bit_mask_state =
+			(remote->toggle_bit_mask_state
+				^ remote->toggle_bit_mask);
+	code->transmit_state = NULL;
+}
+
+
+/**
+ * Send the items of job->sequence and their repeats using a single call
+ * of the driver's send_frames_func(), so the gaps between them are timed
+ * by the driver rather than the repeat timer.
+ */
+static int transmit_frames(struct send_job* job)
+{
+	struct send_frames frames;
+	struct timeval now;
+	size_t i;
+	int r = 1;
+
+	send_frames_init(&frames);
+	for (i = 0; i < job->sequence.size() && r; i++) {
+		prepare_code(job->sequence[i].remote, job->sequence[i].code);
+		r = send_frames_add(&frames, job->sequence[i].remote,
+				    job->sequence[i].code,
+				    job->sequence[i].reps);
+	}
+	if (r)
+		r = curr_driver->send_frames_func(frames.frames, frames.count);
+	if (r) {
+		get_monotonic_time(&now);
+		for (i = 0; i < job->sequence.size(); i++) {
+			job->sequence[i].remote->last_send = now;
+			job->sequence[i].remote->last_code =
+				job->sequence[i].code;
+		}
+	}
+	send_frames_free(&frames);
+	return r;
+}
+
+
+/** Run job in the calling thread, serialized with the decode thread. */
+static void transmit(struct send_job* job)
+{
+	uint32_t mask = job->tx_mask;
+
+	clock_gettime(CLOCK_MONOTONIC, &job->before_send);
+	driver_lock();
+	job->result = 1;
+	if (mask != 0 && mask != applied_tx_mask) {
+		if (curr_driver->drvctl_func(LIRC_SET_TRANSMITTER_MASK,
+					     &mask) == 0) {
+			applied_tx_mask = job->tx_mask;
+		} else {
+			log_error("Cannot set transmitter mask 0x%x",
+				  job->tx_mask);
+			job->result = 0;
+		}
+	}
+	if (job->result && !job->sequence.empty())
+		job->result = transmit_frames(job);
+	else if (job->result)
+		job->result = send_ir_ncode(job->remote, job->code, 1);
+	job->sum = send_buffer_sum();
+	driver_unlock();
+	metrics_inc(job->result ? METRIC_SENT : METRIC_SEND_FAILED);
+	metrics_observe(METRIC_SEND_TIME,
+			metrics_now() - job->before_send.tv_sec * 1000000ULL
+			- job->before_send.tv_nsec / 1000);
+}
+
+
+/** Transmit send_job now, in this or the send thread. */
+static void run_send(void)
+{
+	if (!send_thread) {
+		transmit(&send_job);
+		send_job.done(&send_job);
+		return;
+	}
+	send_busy = 1;
+	if (write(send_request[1], "s", 1) != 1) {
+		log_perror_err("Cannot start transmission");
+		send_busy = 0;
+		send_job.result = 0;
+		send_job.done(&send_job);
+	}
+}
+
+
+/**
+ * Send code, sending the job's transmitter mask first if needed, and
+ * call done with the result. This happens at once only without the send
+ * thread and if the gap after the last code of the remote has passed.
+ * Else the main loop runs on, and done is called when the job is back
+ * from the thread, or has been sent after the gap. So this must be the
+ * last thing callers do with the transmit state.
+ */
+static void start_send(struct ir_remote*	remote,
+		       struct ir_ncode*		code,
+		       void			(*done)(const struct send_job*))
+{
+	struct timeval when;
+	struct timeval gap;
+	unsigned long usecs;
+
+	send_job.remote = remote;
+	send_job.code = code;
+	send_job.done = done;
+	usecs = send_ir_ncode_gap(remote, code);
+	if (usecs == 0) {
+		run_send();
+		return;
+	}
+	log_trace("Deferring send for %lu us", usecs);
+	get_monotonic_time(&when);
+	gap.tv_sec = usecs / 1000000;
+	gap.tv_usec = usecs % 1000000;
+	timeradd(&when, &gap, &when);
+	timer_set(TIMER_SEND, NULL, &when);
+	send_busy = 1;
+	send_deferred = 1;
+}
+
+
+/** Run the send deferred by start_send() when its gap has passed. */
+static void send_gap_done(void)
+{
+	if (!send_deferred)
+		return;
+	send_deferred = 0;
+	send_busy = 0;
+	run_send();
+}
+
+
+static void* send_loop(void* arg)
+{
+	struct pollfd pfd;
+	char c;
+
+	while (1) {
+		pfd.fd = send_request[0];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (curl_poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			log_perror_err("send_loop: curl_poll() failed");
+			break;
+		}
+		if (read(send_request[0], &c, 1) != 1)
+			continue;
+		if (c == 'q')
+			break;
+		transmit(&send_job);
+		if (write(send_result[1], "", 1) == -1)
+			log_perror_err("Cannot wake up main loop");
+	}
+	return NULL;
+}
+
+
+static int send_start_thread(void)
+{
+	if (!make_pipe(send_request) || !make_pipe(send_result)) {
+		log_perror_err("Cannot create send thread pipes");
+		return 0;
+	}
+	poll_add(send_result[0], FD_SENDER);
+	if (pthread_create(&send_tid, NULL, send_loop, NULL) != 0) {
+		log_error("Cannot create send thread");
+		return 0;
+	}
+	log_info("Started send thread");
+	return 1;
+}
+
+
+/** True while a send, or a SEND_ONCE or SEND_MACRO sequence, runs. */
+static int transmitter_busy(void)
+{
+	return send_busy
+	       || (repeat_remote != NULL
+		   && (repeat_fd != -1 || !macro_items.empty()));
+}
+
+
+/**
+ * True if the directive of line is name. Like run_command(), leading
+ * white space is skipped and case is ignored.
+ */
+static int is_directive(const char* line, const char* name)
+{
+	size_t len;
+
+	line += strspn(line, WHITE_SPACE);
+	len = strcspn(line, WHITE_SPACE "\r\n");
+	return strlen(name) == len && strncasecmp(line, name, len) == 0;
+}
+
+
+/** True if line holds one of the commands using the transmitter. */
+static int is_send_command(const char* line)
+{
+	static const char* const names[] = {
+		"SEND_ONCE", "SEND_START", "SEND_STOP", "SEND_MACRO", NULL
+	};
+	int i;
+
+	for (i = 0; names[i] != NULL; i++)
+		if (is_directive(line, names[i]))
+			return 1;
+	return 0;
+}
+
+
+/** Let client i wait in the FIFO of the transmitters it uses. */
+static void send_wait(int i)
+{
+	clients[i].send_wait = 1;
+	update_client_events(i);
+	send_fifos[command_tx_mask].push_back(clients[i].fd);
+}
+
+
+/**
+ * Move the clients with line as next command at the head of other
+ * masks' FIFOs into coalesced_fds, they are answered with the running
+ * SEND_ONCE. Return their combined transmitter mask.
+ */
+static uint32_t send_coalesce(const std::string& line, uint32_t mask)
+{
+	std::map<uint32_t, std::deque<int> >::iterator it;
+	uint32_t coalesced = 0;
+	int i;
+
+	it = send_fifos.begin();
+	while (it != send_fifos.end()) {
+		i = client_index(it->second.front());
+		if (mask == 0 || it->first == 0 || i == -1
+		    || strncmp(clients[i].input->c_str(),
+			       line.c_str(), line.size()) != 0) {
+			++it;
+			continue;
+		}
+		clients[i].input->get_next_line();
+		coalesced_fds.push_back(clients[i].fd);
+		coalesced |= it->first;
+		it->second.pop_front();
+		if (it->second.empty())
+			send_fifos.erase(it++);
+		else
+			++it;
+	}
+	return coalesced;
+}
+
+
+/** Run a copy of line, which is kept for the coalesced clients. */
+static int run_line(int fd, const std::string& line)
+{
+	std::string copy(line);
+
+	return run_command(fd, &copy[0], copy.size());
+}
+
+
+/**
+ * Run the next waiting command when the transmitter is free, taking
+ * turns between the FIFOs of different transmitter masks. The same
+ * SEND_ONCE waiting for other transmitters is sent to all of them at
+ * once.
+ */
+static void send_dispatch(void)
+{
+	std::map<uint32_t, std::deque<int> >::iterator it;
+	std::vector<int> failed;
+	std::string line;
+	uint32_t mask;
+	size_t j;
+	int fd;
+	int i;
+
+	while (!transmitter_busy() && !send_fifos.empty()) {
+		it = send_fifos.upper_bound(send_fifo_last);
+		if (it == send_fifos.end())
+			it = send_fifos.begin();
+		mask = it->first;
+		send_fifo_last = mask;
+		fd = it->second.front();
+		it->second.pop_front();
+		if (it->second.empty())
+			send_fifos.erase(it);
+		i = client_index(fd);
+		if (i == -1)
+			continue;
+		clients[i].send_wait = 0;
+		update_client_events(i);
+		line = clients[i].input->get_next_line();
+		if (is_directive(line.c_str(), "SEND_ONCE"))
+			mask |= send_coalesce(line, mask);
+		command_tx_mask = mask;
+		if (!run_line(fd, line))
+			remove_client(fd);
+		command_tx_mask = tx_mask;
+		if (repeat_fd != fd && !coalesced_fds.empty()) {
+			/* Failed before sending, let each get its error. */
+			failed.swap(coalesced_fds);
+			for (j = 0; j < failed.size(); j++) {
+				i = client_index(failed[j]);
+				if (i == -1)
+					continue;
+				clients[i].send_wait = 0;
+				update_client_events(i);
+				if (!run_line(failed[j], line))
+					remove_client(failed[j]);
+				else
+					add_pending_fd(failed[j]);
+			}
+			failed.clear();
+		}
+		if (client_index(fd) != -1)
+			add_pending_fd(fd);
+	}
+}
+
+
+/** Continue with the job returned by the send thread. */
+static void send_finished(void)
+{
+	char buff[16];
+
+	while (read(send_result[0], buff, sizeof(buff)) > 0)
+		;
+	if (!send_busy || send_deferred)
+		return;
+	send_busy = 0;
+	send_job.done(&send_job);
+}
+
+
+static void send_once_done(const struct send_job* job);
+static void send_start_done(const struct send_job* job);
+static void macro_step_done(const struct send_job* job);
+static void sequence_done(const struct send_job* job);
+
+/*
+ * Send the next SEND_MACRO item. Its repeats and the gap before the
+ * following item are timed by the repeat timer, see dosigalrm(). The
+ * client gets a single reply when all items are sent.
+ */
+static void macro_step(void)
+{
+	struct macro_item item = macro_items[macro_next++];
+	struct ir_remote* remote = item.remote;
+	struct ir_ncode* code = item.code;
+
+	prepare_code(remote, code);
+	/* Else init_send_or_sim() would take this for a repeat. */
+	repeat_remote = NULL;
+	remote->repeat_countdown = item.reps;
+	send_buffer_set_repeats(item.reps);
+	start_send(remote, code, macro_step_done);
+}
+
+
+static void macro_step_done(const struct send_job* job)
+{
+	struct ir_remote* remote = job->remote;
+	struct ir_ncode* code = job->code;
+
+	send_buffer_set_repeats(0);
+	if (!job->result) {
+		macro_items.clear();
+		repeat_code = NULL;
+		send_reply("transmission failed\n");
+		release_hw();
+		return;
+	}
+	repeat_remote = remote;
+	repeat_code = code;
+	if (remote->repeat_countdown > 0 || code->next != NULL) {
+		schedule_repeat_timer(&job->before_send, job->sum);
+		return;
+	}
+	if (macro_next < macro_items.size()) {
+		/* no repeats, wait for the gap before the next item */
+		macro_gap_wait = 1;
+		schedule_repeat_timer(&job->before_send, job->sum);
+		return;
+	}
+	macro_items.clear();
+	repeat_remote = NULL;
+	repeat_code = NULL;
+	send_reply(NULL);
+}
+
+
+/** Reply to a SEND_MACRO or SEND_ONCE sent by transmit_frames(). */
+static void sequence_done(const struct send_job* job)
+{
+	int result = job->result;
+
+	send_job.sequence.clear();
+	if (!result) {
+		send_reply("transmission failed\n");
+		release_hw();
+		return;
+	}
+	send_reply(NULL);
+}
+
+
+/**
+ * Send items, moved to send_job, as a single transmission of a driver
+ * implementing send_frames_func().
+ */
+static void start_sequence(std::vector<struct macro_item>* items)
+{
+	struct macro_item first = (*items)[0];
+
+	send_job.sequence.swap(*items);
+	items->clear();
+	start_send(first.remote, first.code, sequence_done);
+}
+
+
+static void repeat_done(const struct send_job* job)
+{
+	if (job->result && repeat_remote->repeat_countdown > 0) {
+		schedule_repeat_timer(&job->before_send, job->sum);
+		return;
+	}
+	if (macro_next < macro_items.size()) {
+		/* wait for the gap, then send next macro item */
+		macro_gap_wait = 1;
+		schedule_repeat_timer(&job->before_send, job->sum);
+		return;
+	}
+	macro_items.clear();
+	repeat_remote = NULL;
+	repeat_code = NULL;
+	send_reply(NULL);
+	release_hw();
+}
+
+
+void dosigalrm(int sig)
+{
+	if (macro_gap_wait) {
+		macro_gap_wait = 0;
+		macro_step();
+		return;
+	}
+	if (repeat_remote->last_code != repeat_code) {
+		/* we received a different code from the original
+		 * remote control we could repeat the wrong code so
+		 * better stop repeating */
+		repeat_remote = NULL;
+		repeat_code = NULL;
+		macro_items.clear();
+		send_reply("repeating interrupted\n");
+		release_hw();
+		return;
+	}
+	if (repeat_code->next == NULL
+	    || (repeat_code->transmit_state != NULL
+		&& repeat_code->transmit_state->next == NULL)
+	) {
+		repeat_remote->repeat_countdown--;
+	}
+	start_send(repeat_remote, repeat_code, repeat_done);
+}
+
+
+int parse_rc(int fd,
+	     char* message, char* arguments,
+	     struct ir_remote** remote, struct ir_ncode** code,
+	     unsigned int* reps, int n, int* err)
+{
+	char* name = NULL;
+	char* command = NULL;
+	char* repeats;
+	char* end_ptr = NULL;
+
+	*remote = NULL;
+	*code = NULL;
+	*err = 1;
+	if (arguments == NULL)
+		goto arg_check;
+
+	name = strtok(arguments, WHITE_SPACE);
+	if (name == NULL)
+		goto arg_check;
+	*remote = find_remote(name);
+	if (*remote == NULL) {
+		return send_error(fd, message,
+				  "unknown remote: \"%s\"\n",
+				  name);
+	}
+	command = strtok(NULL, WHITE_SPACE);
+	if (command == NULL)
+		goto arg_check;
+	*code = find_code(*remote, command);
+	if (*code == NULL) {
+		return send_error(fd, message,
+				  "unknown command: \"%s\"\n",
+				  command);
+	}
+	if (reps != NULL) {
+		repeats = strtok(NULL, WHITE_SPACE);
+		if (repeats != NULL) {
+			*reps = strtol(repeats, &end_ptr, 10);
+			if (*end_ptr || *reps < 0) {
+				return send_error(
+					fd, message,
+					"bad send packet (reps/eol)\n");
+			}
+			if (*reps > repeat_max) {
+				return send_error(
+					fd, message,
+					"too many repeats: \"%d\" > \"%u\"\n",
+					*reps, repeat_max);
+			}
+		} else {
+			*reps = -1;
+		}
+	}
+	if (strtok(NULL, WHITE_SPACE) != NULL)
+		return send_error(fd, message,
+				  "bad send packet (trailing ws)\n");
+arg_check:
+	if (n > 0 && *remote == NULL)
+		return send_error(fd, message, "remote missing\n");
+	if (n > 1 && *code == NULL)
+		return send_error(fd, message, "code missing\n");
+	*err = 0;
+	return 1;
+}
+
+
+/*
+ * The data of LIST replies, everything after SUCCESS, by remote and
+ * NULL for the list of remotes. Built on first use and kept until the
+ * config is reloaded. A reply in progress keeps its own reference.
+ */
+static std::unordered_map<const struct ir_remote*,
+			  std::shared_ptr<const std::string> > list_cache;
+
+
+/** Forget the LIST replies of the old config. */
+static void list_cache_clear(void)
+{
+	list_cache.clear();
+}
+
+
+/** Return the bytes allocated for the LIST replies. */
+static size_t list_cache_memory(void)
+{
+	size_t size = 0;
+
+	for (const auto& entry : list_cache)
+		size += sizeof(entry) + entry.second->capacity();
+	return size;
+}
+
+
+/** Format the names of all remotes as LIST data. */
+static void format_remote_list(std::string* data)
+{
+	char buffer[PACKET_SIZE + 1];
+	struct ir_remote* all;
+	int n, len;
+
+	n = 0;
+	all = remotes;
+	while (all) {
+		n++;
+		all = all->next;
+	}
+	if (n == 0) {
+		data->append(protocol_string[P_END]);
+		return;
+	}
+	sprintf(buffer, "%d\n", n);
+	data->append(protocol_string[P_DATA]);
+	data->append(buffer);
+	all = remotes;
+	while (all) {
+		len = snprintf(buffer, PACKET_SIZE + 1, "%s\n", all->name);
+		if (len >= PACKET_SIZE + 1)
+			len = sprintf(buffer, "name_too_long\n");
+		data->append(buffer, len);
+		all = all->next;
+	}
+	data->append(protocol_string[P_END]);
+}
+
+
+/** Format the codes of remote as LIST data. */
+static void format_remote(std::string* data, const struct ir_remote* remote)
+{
+	struct ir_ncode* codes;
+	char buffer[PACKET_SIZE + 1];
+	int n, len;
+
+	n = 0;
+	codes = remote->codes;
+	if (codes != NULL) {
+		while (codes->name != NULL) {
+			n++;
+			codes++;
+		}
+	}
+	if (n == 0) {
+		data->append(protocol_string[P_END]);
+		return;
+	}
+	sprintf(buffer, "%d\n", n);
+	data->append(protocol_string[P_DATA]);
+	data->append(buffer);
+
+	codes = remote->codes;
+	while (codes->name != NULL) {
+		len = snprintf(buffer, PACKET_SIZE, "%016llx %s\n",
+			       (unsigned long long)codes->code, codes->name);
+		if (len >= PACKET_SIZE + 1)
+			len = sprintf(buffer, "code_too_long\n");
+		data->append(buffer, len);
+		codes++;
+	}
+	data->append(protocol_string[P_END]);
+}
+
+
+/** Return the LIST data of remote, or of all remotes if NULL. */
+static std::shared_ptr<const std::string>
+list_data(const struct ir_remote* remote)
+{
+	auto found = list_cache.find(remote);
+	std::string data;
+
+	if (found != list_cache.end())
+		return found->second;
+	if (remote == NULL)
+		format_remote_list(&data);
+	else
+		format_remote(&data, remote);
+	auto entry = std::make_shared<const std::string>(std::move(data));
+
+	list_cache[remote] = entry;
+	return entry;
+}
+
+
+/*
+ * Reply with the cached LIST data. More than LIST_STEP bytes are written
+ * in steps: the rest is written by list_continue() from run_commands(),
+ * one step per command of the budget, so other clients and the driver
+ * are served in between. Broadcasts to the client are held until the
+ * reply is done.
+ */
+static int send_list(int fd, char* message, const struct ir_remote* remote)
+{
+	std::shared_ptr<const std::string> data = list_data(remote);
+	int i = client_index(fd);
+	size_t len = data->size();
+	ReplyBuffer reply(fd);
+
+	if (i != -1 && len > LIST_STEP)
+		len = LIST_STEP;
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
+	      && write_socket_len(fd, message)
+	      && write_socket_len(fd, protocol_string[P_SUCCESS])
+	      && write_socket(fd, data->data(), len) == (int)len)
+	) {
+		return 0;
+	}
+	if (len < data->size()) {
+		clients[i].listing = data;
+		clients[i].listing_pos = len;
+	}
+	return reply.flush();
+}
+
+
+/** Write the next step of the LIST reply to client i. 0 on errors. */
+static int list_continue(int i)
+{
+	std::shared_ptr<const std::string> data = clients[i].listing;
+	size_t pos = clients[i].listing_pos;
+	size_t len = data->size() - pos;
+	std::string held;
+
+	if (len > LIST_STEP)
+		len = LIST_STEP;
+	if (write_socket(clients[i].fd, data->data() + pos, len) < (int)len)
+		return 0;
+	clients[i].listing_pos = pos + len;
+	if (clients[i].listing_pos < data->size())
+		return 1;
+	clients[i].listing.reset();
+	if (clients[i].held.empty())
+		return 1;
+	held.swap(clients[i].held);
+	return send_to_client(i, held.data(), held.size());
+}
+
+
+int send_remote_list(int fd, char* message)
+{
+	return send_list(fd, message, NULL);
+}
+
+
+int send_remote(int fd, char* message, struct ir_remote* remote)
+{
+	return send_list(fd, message, remote);
+}
+
+int send_name(int fd, char* message, struct ir_ncode* code)
+{
+	char buffer[PACKET_SIZE + 1];
+	int len;
+	ReplyBuffer reply(fd);
+
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
+	     && write_socket_len(fd, message)
+	     && write_socket_len(fd, protocol_string[P_SUCCESS])
+	     && write_socket_len(fd, protocol_string[P_DATA]))
+	) {
+		return 0;
+	}
+	len = snprintf(buffer, PACKET_SIZE, "1\n%016llx %s\n",
+		       (unsigned long long)code->code, code->name);
+	if (len >= PACKET_SIZE + 1)
+		len = sprintf(buffer, "1\ncode_too_long\n");
+	if (write_socket(fd, buffer, len) < len)
+		return 0;
+	return write_socket_len(fd, protocol_string[P_END]) && reply.flush();
+}
+
+static int list(int fd, char* message, char* arguments)
+{
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	int err;
+
+	if (parse_rc(fd, message, arguments, &remote, &code, 0, 0, &err) == 0)
+		return 0;
+	if (err)
+		return 1;
+
+	if (remote == NULL)
+		return send_remote_list(fd, message);
+	if (code == NULL)
+		return send_remote(fd, message, remote);
+	return send_name(fd, message, code);
+}
+
+static int set_transmitters(int fd, char* message, char* arguments)
+{
+	char* next_arg = NULL;
+	char* end_ptr;
+	uint32_t next_tx_int = 0;
+	uint32_t next_tx_hex = 0;
+	uint32_t channels = 0;
+	int retval = 0;
+	unsigned int i;
+
+	if (arguments == NULL)
+		goto string_error;
+	if (curr_driver->send_mode == 0) {
+		return send_error(fd,
+				  message,
+				  "hardware does not support sending\n");
+	}
+	if (curr_driver->drvctl_func == NULL
+	    || !(curr_driver->features & LIRC_CAN_SET_TRANSMITTER_MASK)
+	) {
+		return send_error(
+			fd,
+			message,
+			"hardware does not support multiple transmitters\n");
+	}
+	next_arg = strtok(arguments, WHITE_SPACE);
+	if (next_arg == NULL)
+		goto string_error;
+	do {
+		next_tx_int = strtoul(next_arg, &end_ptr, 10);
+		if (*end_ptr || next_tx_int == 0
+		    || (next_tx_int == ULONG_MAX && errno == ERANGE)
+		) {
+			return send_error(fd, message, "invalid argument\n");
+		}
+		if (next_tx_int > MAX_TX)
+			return send_error(
+				fd, message,
+				"cannot support more than %d transmitters\n",
+				MAX_TX);
+		next_tx_hex = 1;
+		for (i = 1; i < next_tx_int; i++)
+			next_tx_hex = next_tx_hex << 1;
+		channels |= next_tx_hex;
+	} while ((next_arg = strtok(NULL, WHITE_SPACE)) != NULL);
+
+	if (send_thread) {
+		/* Set by the send thread before sending with this mask. */
+		tx_mask = channels;
+		command_tx_mask = channels;
+		return send_success(fd, message);
+	}
+	driver_lock();
+	retval = curr_driver->drvctl_func(LIRC_SET_TRANSMITTER_MASK,
+					  &channels);
+	driver_unlock();
+	if (retval < 0) {
+		return send_error(fd, message,
+				  "error - could not set transmitters\n");
+	}
+	if (retval > 0) {
+		return send_error(fd, message,
+				  "error - maximum of %d transmitters\n",
+				  retval);
+	}
+	return send_success(fd, message);
+
+string_error:
+	return send_error(fd, message, "no arguments given\n");
+}
+
+
+/** Parse an event message, else mark ev as no event. */
+static void parse_event(const char* message, struct event_info* ev)
+{
+	const size_t suffix_len = strlen(LIRC_RELEASE_SUFFIX);
+	struct code_line line;
+	size_t len;
+
+	ev->parsed = -1;
+	len = strcspn(message, "\n");
+	if (code_line_parse(message, len, &line) != 1
+	    || line.button_len > PACKET_SIZE || line.remote_len > PACKET_SIZE)
+		return;
+	ev->parsed = 1;
+	ev->code = line.code;
+	ev->reps = line.reps;
+	ev->type = line.reps == 0 ? EV_PRESS : EV_REPEAT;
+	memcpy(ev->name, line.button, line.button_len);
+	ev->name[line.button_len] = '\0';
+	memcpy(ev->button, line.button, line.button_len + 1);
+	memcpy(ev->remote, line.remote, line.remote_len);
+	ev->remote[line.remote_len] = '\0';
+	len = line.button_len;
+	if (len > suffix_len
+	    && strcmp(ev->name + len - suffix_len, LIRC_RELEASE_SUFFIX) == 0) {
+		/* Patterns match the button name without the suffix. */
+		ev->button[len - suffix_len] = '\0';
+		ev->type = EV_RELEASE;
+	}
+}
+
+
+/**
+ * Make the EVENT record for message in rec, announcing new names to the
+ * binary clients. Return 0 if message is no event, or the names cannot
+ * be interned; it is then sent as TEXT.
+ */
+static int record_event(const char* message, struct event_info* ev,
+			struct lirc_record* rec)
+{
+	int remote_added = 0;
+	int button_added = 0;
+	int remote;
+	int button;
+
+	if (ev->parsed == 0)
+		parse_event(message, ev);
+	if (ev->parsed < 0)
+		return 0;
+	remote = record_intern(ev->remote, &remote_added);
+	button = record_intern(ev->name, &button_added);
+	if (remote < 0 || button < 0)
+		return 0;
+	if (remote_added)
+		broadcast_name(remote);
+	if (button_added)
+		broadcast_name(button);
+	record_init(rec, LIRC_RECORD_EVENT, 0);
+	rec->remote = remote;
+	rec->button = button;
+	rec->reps = ev->reps;
+	rec->code = ev->code;
+	return 1;
+}
+
+
+/** Return true if client i wants message, parsed into ev on demand. */
+static int client_wants(int i, const char* message, struct event_info* ev)
+{
+	const std::vector<struct subscription>& subs = clients[i].subscriptions;
+	unsigned int j;
+
+	if (subs.empty() && !clients[i].ring)
+		return 1;
+	if (ev->parsed == 0)
+		parse_event(message, ev);
+	if (ev->parsed < 0)
+		return 1;               /* SIGHUP notices etc. go to all. */
+	if (clients[i].ring)
+		return 0;               /* Read from the ring instead. */
+	for (j = 0; j < subs.size(); j++) {
+		if ((subs[j].events & ev->type)
+		    && fnmatch(subs[j].remote.c_str(), ev->remote, 0) == 0
+		    && fnmatch(subs[j].button.c_str(), ev->button, 0) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Send event data to client i like send_to_client(). For a COALESCE
+ * client, a repeat replaces the previous one if that is of the same
+ * button, still unwritten and the last message queued; the client then
+ * only sees the newest repeat count. The queued repeat is identified by
+ * its number in the queue, so anything queued after it, or its loss to
+ * an overflow, keeps it from being replaced.
+ */
+static int send_event(int i, const char* message, const char* data,
+		      size_t len, struct event_info* ev)
+{
+	struct client* c = &clients[i];
+	char name[2 * PACKET_SIZE + 2];
+	unsigned long queued;
+	int repeat;
+	int r;
+
+	if (!c->coalesce)
+		return send_to_client(i, data, len);
+	if (ev->parsed == 0)
+		parse_event(message, ev);
+	repeat = ev->parsed > 0 && ev->type == EV_REPEAT;
+	if (repeat)
+		snprintf(name, sizeof(name), "%s %s", ev->remote, ev->name);
+	if (repeat && c->repeat_seq != 0 && c->repeat_seq == c->queue.queued
+	    && queue_last_unwritten(&c->queue) && c->repeat_name == name) {
+		queue_drop_last(&c->queue);
+		metrics_inc(METRIC_REPEATS_COALESCED);
+	}
+	c->repeat_seq = 0;
+	queued = c->queue.queued;
+	r = send_to_client(i, data, len);
+	if (r && repeat && c->queue.queued != queued
+	    && queue_last_unwritten(&c->queue)) {
+		c->repeat_seq = c->queue.queued;
+		c->repeat_name = name;
+	}
+	return r;
+}
+
+
+void broadcast_message(const char* message)
+{
+	struct event_info ev;
+	struct lirc_record rec;
+	char wire[sizeof(struct lirc_record)];
+	int have_record = 0;
+	int len, i, r;
+
+	len = strlen(message);
+#ifdef USE_UINPUT
+	if (uinput_fd != -1)
+		uinput_message(message);
+#endif
+	if (multicast_fd != -1)
+		multicast_send(message, len);
+
+	ev.parsed = 0;
+	if (ring != NULL) {
+		parse_event(message, &ev);
+		if (ev.parsed > 0)
+			event_ring_put(&ev);
+	}
+	for (i = 0; i < (int)clients.size(); i++) {
+		if (clients[i].binary) {
+			have_record = record_event(message, &ev, &rec);
+			if (have_record)
+				lirc_record_put(wire, &rec);
+			break;
+		}
+	}
+	for (i = 0; i < (int)clients.size(); i++) {
+		if (!client_wants(i, message, &ev))
+			continue;
+		log_trace("writing to client %d: %s", i, message);
+		if (!clients[i].binary)
+			r = send_event(i, message, message, len, &ev);
+		else if (have_record)
+			r = send_event(i, message, wire, sizeof(wire), &ev);
+		else
+			r = send_text_record(i, message, len);
+		if (!r) {
+			remove_client(clients[i].fd);
+			i--;
+		}
+	}
+}
+
+
+static int simulate(int fd, char* message, char* arguments)
+{
+	int i;
+	char* sim;
+	char* s;
+	char* space;
+
+	log_debug("simulate: enter");
+
+	if (!allow_simulate)
+		return send_error(fd, message,
+				  "SIMULATE command is disabled\n");
+	if (arguments == NULL)
+		return send_error(fd, message, "no arguments given\n");
+
+	s = arguments;
+	for (i = 0; i < 16; i++, s++)
+		if (!isxdigit(*s))
+			goto simulate_invalid_event;
+	if (*s != ' ')
+		goto simulate_invalid_event;
+	s++;
+	if (*s == ' ')
+		goto simulate_invalid_event;
+	for (; *s != ' '; s++)
+		if (!isxdigit(*s))
+			goto simulate_invalid_event;
+	s++;
+	space = strchr(s, ' ');
+	if (space == NULL || space == s)
+		goto simulate_invalid_event;
+	s = space + 1;
+	space = strchr(s, ' ');
+	if (strlen(s) == 0 || space != NULL)
+		goto simulate_invalid_event;
+
+	sim = (char*) malloc(strlen(arguments) + 1 + 1);
+	if (sim == NULL)
+		return send_error(fd, message, "out of memory\n");
+	strcpy(sim, arguments);
+	strcat(sim, "\n");
+	broadcast_message(sim);
+	free(sim);
+
+	return send_success(fd, message);
+simulate_invalid_event:
+	return send_error(fd, message, "invalid event\n");
+}
+
+
+/** Longest pulse/space train accepted by SIMULATE_RAW. */
+static const size_t SIM_RAW_MAX = 4096;
+
+
+/**
+ * Decode durations as if read from the driver, and send the results to
+ * clients. Called with driver_lock() held, returns with it released.
+ */
+static int simulate_input(const lirc_t* data, int count)
+{
+	/* Decoders sync on a gap before the first signal. */
+	static const lirc_t idle = 1000000;
+	char* message;
+	int r;
+
+	r = rec_buffer_inject(&idle, 1) && rec_buffer_inject(data, count);
+	while (r && (message = rec_buffer_decode_injected(remotes)) != NULL)
+		broadcast_message(message);
+	driver_unlock();
+	return r;
+}
+
+
+/** Check SIMULATE_RAW/SIMULATE_CODE can run, else reply the error. */
+static const char* simulate_input_error(void)
+{
+	if (!allow_simulate)
+		return "SIMULATE command is disabled\n";
+	if (curr_driver->rec_mode != LIRC_MODE_MODE2)
+		return "driver does not receive pulses\n";
+	return NULL;
+}
+
+
+/**
+ * SIMULATE_RAW duration... [+]: decode this pulse/space train, starting
+ * with a pulse, as if received. A trailing + continues it on the next
+ * line, lines being limited to PACKET_SIZE.
+ */
+static int simulate_raw(int fd, char* message, char* arguments)
+{
+	std::vector<lirc_t>* train;
+	const char* error;
+	char* saveptr;
+	char* token;
+	char* end;
+	unsigned long value;
+	int more = 0;
+	int i;
+	int r;
+
+	i = client_index(fd);
+	if (i == -1)
+		return send_error(fd, message, "not a client connection\n");
+	error = simulate_input_error();
+	if (error != NULL)
+		return send_error(fd, message, "%s", error);
+	train = &clients[i].sim_raw;
+	for (token = arguments ? strtok_r(arguments, WHITE_SPACE, &saveptr)
+		     : NULL;
+	     token != NULL; token = strtok_r(NULL, WHITE_SPACE, &saveptr)) {
+		if (strcmp(token, "+") == 0) {
+			more = 1;
+			continue;
+		}
+		value = strtoul(token, &end, 10);
+		if (more || *end != '\0' || value == 0 || value > PULSE_MASK) {
+			train->clear();
+			return send_error(fd, message,
+					  "bad duration: %s\n", token);
+		}
+		if (train->size() >= SIM_RAW_MAX) {
+			train->clear();
+			return send_error(fd, message, "too many durations\n");
+		}
+		train->push_back(train->size() % 2 == 0 ? value | PULSE_BIT
+				 : value);
+	}
+	if (more)
+		return send_success(fd, message);
+	if (train->empty())
+		return send_error(fd, message, "no arguments given\n");
+	driver_lock();
+	r = simulate_input(train->data(), train->size());
+	train->clear();
+	if (!r)
+		return send_error(fd, message, "out of memory\n");
+	return send_success(fd, message);
+}
+
+
+/** The gap following a signal encoded by init_sim(). */
+static lirc_t simulate_gap(const struct ir_remote* remote, int repeat)
+{
+	if (has_repeat_gap(remote) && repeat && has_repeat(remote))
+		return remote->repeat_gap;
+	if (is_const(remote) && min_gap(remote) > send_buffer_sum())
+		return min_gap(remote) - send_buffer_sum();
+	return min_gap(remote);
+}
+
+
+/**
+ * SIMULATE_CODE remote code [repeats]: encode code as SEND_ONCE would,
+ * and decode it as if received, followed by repeats repeated signals.
+ */
+static int simulate_code(int fd, char* message, char* arguments)
+{
+	std::vector<lirc_t> train;
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	const char* error;
+	unsigned int reps;
+	unsigned int n;
+	int err;
+	int i;
+
+	error = simulate_input_error();
+	if (error != NULL)
+		return send_error(fd, message, "%s", error);
+	if (parse_rc(fd, message, arguments, &remote, &code,
+		     &reps, 2, &err) == 0)
+		return 0;
+	if (err)
+		return 1;
+	if (reps == (unsigned int)-1)
+		reps = 0;
+	driver_lock();
+	for (n = 0; n <= reps; n++) {
+		if (!init_sim(remote, code, n > 0)) {
+			driver_unlock();
+			return send_error(fd, message,
+					  "cannot encode %s\n", code->name);
+		}
+		for (i = 0; i < send_buffer_length(); i++)
+			train.push_back(i % 2 == 0
+					? send_buffer_data()[i] | PULSE_BIT
+					: send_buffer_data()[i]);
+		if (train.size() % 2 == 0)
+			train.back() += simulate_gap(remote, n > 0);
+		else
+			train.push_back(simulate_gap(remote, n > 0));
+	}
+	if (!simulate_input(train.data(), train.size()))
+		return send_error(fd, message, "out of memory\n");
+	return send_success(fd, message);
+}
+
+static int send_once(int fd, char* message, char* arguments)
+{
+	return send_core(fd, message, arguments, 1);
+}
+
+static int send_start(int fd, char* message, char* arguments)
+{
+	return send_core(fd, message, arguments, 0);
+}
+
+/*
+ * SEND_MACRO remote code [repeats] [, remote code [repeats]]...
+ * Send the items one after the other, like consecutive SEND_ONCE
+ * commands, but with a single reply.
+ */
+static int send_macro(int fd, char* message, char* arguments)
+{
+	struct macro_item item;
+	unsigned int reps;
+	char* saveptr;
+	char* arg;
+	int err;
+
+	if (curr_driver->send_mode == 0)
+		return send_error(fd, message,
+				  "hardware does not support sending\n");
+	if (repeat_remote != NULL)
+		return send_error(fd, message, "busy: repeating\n");
+	if (send_busy)
+		return send_error(fd, message, "busy: sending\n");
+	if (arguments == NULL)
+		return send_error(fd, message, "remote missing\n");
+	macro_items.clear();
+	for (arg = strtok_r(arguments, ",", &saveptr);
+	     arg != NULL;
+	     arg = strtok_r(NULL, ",", &saveptr)) {
+		if (parse_rc(fd, message, arg,
+			     &item.remote, &item.code, &reps, 2, &err) == 0
+		) {
+			macro_items.clear();
+			return 0;
+		}
+		if (err) {
+			macro_items.clear();
+			return 1;
+		}
+		item.reps = reps;
+		macro_items.push_back(item);
+	}
+	if (macro_items.empty())
+		return send_error(fd, message, "remote missing\n");
+	repeat_message = strdup(message);
+	if (repeat_message == NULL) {
+		macro_items.clear();
+		return send_error(fd, message, "out of memory\n");
+	}
+	log_debug("Sending macro, %zu items", macro_items.size());
+	macro_next = 0;
+	set_repeat_fd(fd);
+	send_job.tx_mask = command_tx_mask;
+	if (send_frames_supported())
+		start_sequence(&macro_items);
+	else
+		macro_step();
+	return 1;
+}
+
+
+static int send_core(int fd, char* message, char* arguments, int once)
+{
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	unsigned int reps;
+	int err;
+
+	log_debug("Sending once, msg: %s, args: %s, once: %d",
+		  message, arguments, once);
+	if (curr_driver->send_mode == 0)
+		return send_error(fd, message,
+				  "hardware does not support sending\n");
+
+	if (parse_rc(fd, message, arguments,
+		     &remote, &code, once ? &reps : NULL, 2, &err) == 0
+	) {
+		return 0;
+	}
+	if (err)
+		return 1;
+
+	if (send_busy)
+		return send_error(fd, message, "busy: sending\n");
+	if (once) {
+		if (repeat_remote != NULL)
+			return send_error(fd, message, "busy: repeating\n");
+	} else {
+		if (repeat_remote != NULL)
+			return send_error(fd, message, "already repeating\n");
+	}
+	if (once && (int)reps > 0 && send_frames_supported()) {
+		/* Repeats with long gaps too are sent by the driver. */
+		std::vector<struct macro_item> items(1);
+
+		items[0].remote = remote;
+		items[0].code = code;
+		items[0].reps = reps;
+		repeat_message = strdup(message);
+		if (repeat_message == NULL)
+			return send_error(fd, message, "out of memory\n");
+		set_repeat_fd(fd);
+		send_job.tx_mask = command_tx_mask;
+		start_sequence(&items);
+		return 1;
+	}
+	prepare_code(remote, code);
+	/* Repeats with short gaps are sent with the code, the countdown
+	 * only stays for drivers not using send_buffer_put(). */
+	remote->repeat_countdown = once ? reps : 0;
+	repeat_message = strdup(message);
+	if (repeat_message == NULL)
+		return send_error(fd, message, "out of memory\n");
+	set_repeat_fd(fd);
+	send_buffer_set_repeats(remote->repeat_countdown);
+	send_job.tx_mask = command_tx_mask;
+	start_send(remote, code, once ? send_once_done : send_start_done);
+	return 1;
+}
+
+
+/** Reply to the SEND_ONCE or SEND_START, repeat if needed. */
+static void send_core_done(const struct send_job* job, int once)
+{
+	struct ir_remote* remote = job->remote;
+	struct ir_ncode* code = job->code;
+
+	send_buffer_set_repeats(0);
+	if (!job->result) {
+		send_reply("transmission failed\n");
+		return;
+	}
+	get_monotonic_time(&remote->last_send);
+	remote->last_code = code;
+	if (!once)
+		/* you've been warned, now we have a limit */
+		remote->repeat_countdown = repeat_max;
+	if (remote->repeat_countdown <= 0 && code->next == NULL) {
+		send_reply(NULL);
+		return;
+	}
+	repeat_remote = remote;
+	repeat_code = code;
+	if (!once && !send_reply(NULL)) {
+		repeat_remote = NULL;
+		repeat_code = NULL;
+		return;
+	}
+	schedule_repeat_timer(&job->before_send, job->sum);
+}
+
+
+static void send_once_done(const struct send_job* job)
+{
+	send_core_done(job, 1);
+}
+
+
+static void send_start_done(const struct send_job* job)
+{
+	send_core_done(job, 0);
+}
+
+static int send_stop(int fd, char* message, char* arguments)
+{
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	int err;
+
+	if (parse_rc(fd, message, arguments, &remote, &code, 0, 0, &err) == 0)
+		return 0;
+	if (err)
+		return 1;
+
+	if (!macro_items.empty())
+		return send_error(fd, message, "busy: sending macro\n");
+	if (repeat_remote && repeat_code) {
+		int done;
+
+		if (remote && !lirc_atom_equal(remote->name, remote->atom,
+					       repeat_remote->name,
+					       repeat_remote->atom)) {
+			return send_error(fd, message,
+					  "specified remote does not match\n");
+		}
+		if (code && !lirc_atom_equal(code->name, code->atom,
+					     repeat_code->name,
+					     repeat_code->atom))
+			return send_error(fd, message,
+					  "specified code does not match\n");
+
+		done = repeat_max - repeat_remote->repeat_countdown;
+		if (done < repeat_remote->min_repeat) {
+			/* we still have some repeats to do */
+			repeat_remote->repeat_countdown =
+				repeat_remote->min_repeat - done;
+			return send_success(fd, message);
+		}
+		repeat_timer_set(NULL);
+
+		repeat_remote->toggle_mask_state = 0;
+		repeat_remote = NULL;
+		repeat_code = NULL;
+		/* a client exists, so we don't have to deinit hardware */
+		return send_success(fd, message);
+	} else {
+		return send_error(fd, message, "not repeating\n");
+	}
+}
+
+
+static int version(int fd, char* message, char* arguments)
+{
+	char buffer[PACKET_SIZE + 1];
+	ReplyBuffer reply(fd);
+
+	sprintf(buffer, "1\n%s\n", VERSION);
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN]) &&
+	      write_socket_len(fd, message)
+			&& write_socket_len(fd, protocol_string[P_SUCCESS])
+			&& write_socket_len(fd, protocol_string[P_DATA])
+			&& write_socket_len(fd, buffer)
+			&& write_socket_len(fd, protocol_string[P_END])))
+		return 0;
+	return reply.flush();
+}
+
+
+/**
+ * SUBSCRIBE [remote [button [events]]]: only get events matching this or
+ * an earlier subscription. No arguments drop all, getting all events.
+ */
+static int subscribe(int fd, char* message, char* arguments)
+{
+	struct subscription sub;
+	char remote[PACKET_SIZE + 1];
+	char button[PACKET_SIZE + 1];
+	char events[PACKET_SIZE + 1];
+	char format[64];
+	char* type;
+	char* saveptr;
+	int n;
+	int i;
+
+	i = client_index(fd);
+	if (i == -1)
+		return send_error(fd, message, "not a client connection\n");
+	snprintf(format, sizeof(format), "%%%ds %%%ds %%%ds",
+		 PACKET_SIZE, PACKET_SIZE, PACKET_SIZE);
+	n = arguments ? sscanf(arguments, format, remote, button, events) : 0;
+	if (n <= 0) {
+		clients[i].subscriptions.clear();
+		return send_success(fd, message);
+	}
+	sub.remote = remote;
+	sub.button = n >= 2 ? button : "*";
+	sub.events = n >= 3 ? 0 : EV_ALL;
+	if (n >= 3) {
+		for (type = strtok_r(events, ",", &saveptr); type != NULL;
+		     type = strtok_r(NULL, ",", &saveptr)) {
+			if (strcasecmp(type, "press") == 0)
+				sub.events |= EV_PRESS;
+			else if (strcasecmp(type, "repeat") == 0)
+				sub.events |= EV_REPEAT;
+			else if (strcasecmp(type, "release") == 0)
+				sub.events |= EV_RELEASE;
+			else if (strcasecmp(type, "all") == 0)
+				sub.events |= EV_ALL;
+			else
+				return send_error(fd, message,
+						  "bad event type: %s\n", type);
+		}
+	}
+	clients[i].subscriptions.push_back(sub);
+	log_debug("Client %d subscribed to %s %s 0x%x", fd,
+		  sub.remote.c_str(), sub.button.c_str(), sub.events);
+	return send_success(fd, message);
+}
+
+
+/**
+ * BINARY: switch the client to the records in event_record.h, starting
+ * with the names after this reply.
+ */
+static int binary(int fd, char* message, char* arguments)
+{
+	int i;
+
+	i = client_index(fd);
+	if (i == -1)
+		return send_error(fd, message, "not a client connection\n");
+	if (clients[i].binary)
+		return send_success(fd, message);
+	if (!send_success(fd, message))
+		return 0;
+	clients[i].binary = 1;
+	return send_names(i);
+}
+
+
+/** COALESCE [on|off]: replace queued repeats by newer ones, or not. */
+static int coalesce(int fd, char* message, char* arguments)
+{
+	int i;
+	int on = 1;
+
+	i = client_index(fd);
+	if (i == -1)
+		return send_error(fd, message, "not a client connection\n");
+	if (arguments != NULL) {
+		if (strcasecmp(arguments, "off") == 0)
+			on = 0;
+		else if (strcasecmp(arguments, "on") != 0)
+			return send_error(fd, message,
+					  "bad argument \"%s\"\n", arguments);
+	}
+	clients[i].coalesce = on;
+	clients[i].repeat_seq = 0;
+	return send_success(fd, message);
+}
+
+
+/**
+ * EVENT_RING: stop sending events to the client, which reads them from
+ * the --event-ring file in the reply data instead.
+ */
+static int event_ring(int fd, char* message, char* arguments)
+{
+	int i;
+
+	i = client_index(fd);
+	if (i == -1 || clients[i].type != CT_LOCAL)
+		return send_error(fd, message, "not a local client\n");
+	if (ring == NULL)
+		return send_error(fd, message, "event ring is disabled\n");
+	ReplyBuffer reply(fd);
+
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
+	      && write_socket_len(fd, message)
+	      && write_socket_len(fd, protocol_string[P_SUCCESS])
+	      && write_socket_len(fd, protocol_string[P_DATA])
+	      && write_socket_len(fd, "1\n")
+	      && write_socket_len(fd, ring_path.c_str())
+	      && write_socket_len(fd, "\n")
+	      && write_socket_len(fd, protocol_string[P_END])
+	      && reply.flush()))
+		return 0;
+	clients[i].ring = 1;
+	return 1;
+}
+
+
+static int drv_option(int fd, char* message, char* arguments)
+{
+	struct option_t option;
+	int r;
+
+	r = sscanf(arguments, "%32s %64s", option.key, option.value);
+	if (r != 2) {
+		return send_error(fd, message,
+				  "Illegal argument (protocol error): %s",
+				  arguments);
+	}
+	driver_lock();
+	r = curr_driver->drvctl_func(DRVCTL_SET_OPTION, (void*)&option);
+	driver_unlock();
+	if (r != 0) {
+		log_warn("Cannot set driver option");
+		return send_error(fd, message,
+				  "Cannot set driver option, code: %d", errno);
+	}
+	return send_success(fd, message);
+}
+
+
+/**
+ * TIMING remote [eps|aeps|gap value]: set a timing parameter of a loaded
+ * remote in place, then reply with the current values. Only this remote
+ * is recomputed, the rest of the config is left alone. The next SIGHUP
+ * restores the values in the config file.
+ */
+static int timing(int fd, char* message, char* arguments)
+{
+	char name[PACKET_SIZE + 1];
+	char param[8];
+	char buffer[PACKET_SIZE + 1];
+	char format[64];
+	struct ir_remote* remote;
+	unsigned long value;
+	char* end;
+	int n;
+
+	if (arguments == NULL)
+		return send_error(fd, message, "remote missing\n");
+	snprintf(format, sizeof(format), "%%%ds %%7s %%%ds",
+		 PACKET_SIZE, PACKET_SIZE);
+	n = sscanf(arguments, format, name, param, buffer);
+	if (n != 1 && n != 3)
+		return send_error(fd, message,
+				  "Illegal argument (protocol error): %s",
+				  arguments);
+	remote = find_remote(name);
+	if (remote == NULL)
+		return send_error(fd, message, "unknown remote: \"%s\"\n",
+				  name);
+	if (n == 3) {
+		errno = 0;
+		value = strtoul(buffer, &end, 10);
+		if (*end != '\0' || errno != 0 || value > UINT32_MAX
+		    || (strcasecmp(param, "eps") == 0 && value > 100)
+		    || (strcasecmp(param, "gap") == 0 && value == 0))
+			return send_error(fd, message, "bad value: %s\n",
+					  buffer);
+		driver_lock();
+		if (strcasecmp(param, "eps") == 0) {
+			remote->eps = value;
+		} else if (strcasecmp(param, "aeps") == 0) {
+			remote->aeps = value;
+		} else if (strcasecmp(param, "gap") == 0) {
+			remote->gap = value;
+		} else {
+			driver_unlock();
+			return send_error(fd, message,
+					  "unknown parameter: %s\n", param);
+		}
+		config_update_timing(remote);
+		driver_unlock();
+		log_notice("Timing of %s: %s set to %lu",
+			   remote->name, param, value);
+		get_filter_parameters(remotes, &setup_max_gap,
+				      &setup_min_pulse, &setup_min_space,
+				      &setup_max_pulse, &setup_max_space);
+		setup_hardware();
+	}
+	snprintf(buffer, sizeof(buffer), "3\neps %d\naeps %u\ngap %lu\n",
+		 remote->eps, remote->aeps, (unsigned long)remote->gap);
+	ReplyBuffer reply(fd);
+
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
+	      && write_socket_len(fd, message)
+	      && write_socket_len(fd, protocol_string[P_SUCCESS])
+	      && write_socket_len(fd, protocol_string[P_DATA])
+	      && write_socket_len(fd, buffer)
+	      && write_socket_len(fd, protocol_string[P_END]))
+	) {
+		return 0;
+	}
+	return reply.flush();
+}
+
+
+static int set_inputlog(int fd, char* message, char* arguments)
+{
+	char buff[128];
+	size_t len;
+	FILE* f;
+	int r = 1;
+
+	if (arguments) {
+		r = sscanf(arguments, "%128s", buff);
+		if (r != 1) {
+			return send_error(
+				fd, message,
+				"Illegal argument (protocol error): %s",
+				arguments
+			);
+		}
+	}
+	if (!arguments || strcasecmp(buff, "null") == 0) {
+		driver_lock();
+		rec_buffer_set_logfile(NULL);
+		driver_unlock();
+		return send_success(fd, message);
+	}
+	f = fopen(buff, "w");
+	if (f == NULL) {
+		log_warn("Cannot open input logfile: %s", buff);
+		return send_error(fd, message,
+				  "Cannot open input logfile: %s (errno: %d)",
+				  buff, errno);
+	}
+	len = strlen(buff);
+	driver_lock();
+	if (len > 3 && strcmp(buff + len - 3, ".m2") == 0)
+		r = rec_buffer_set_binary_logfile(f);
+	else
+		rec_buffer_set_logfile(f);
+	driver_unlock();
+	if (!r) {
+		log_warn("Cannot write input logfile: %s", buff);
+		return send_error(fd, message,
+				  "Cannot write input logfile: %s", buff);
+	}
+	return send_success(fd, message);
+}
+
+
+static int set_clock(int fd, char* message, char* arguments)
+{
+	char buff[16];
+
+	if (!arguments || sscanf(arguments, "%15s", buff) != 1)
+		return send_error(fd, message, "Missing clock argument");
+	driver_lock();
+	if (strcasecmp(buff, "virtual") == 0)
+		rec_set_virtual_clock(1);
+	else if (strcasecmp(buff, "monotonic") == 0)
+		rec_set_virtual_clock(0);
+	else
+		buff[0] = '\0';
+	driver_unlock();
+	if (buff[0] == '\0')
+		return send_error(fd, message,
+				  "Illegal clock (protocol error): %s",
+				  arguments);
+	return send_success(fd, message);
+}
+
+
+static int dump_decode_trace(int fd, char* message, char* arguments)
+{
+	char buff[128];
+	FILE* f;
+	int r;
+
+	if (!arguments || sscanf(arguments, "%127s", buff) != 1)
+		return send_error(fd, message, "Missing path argument");
+	f = fopen(buff, "w");
+	if (f == NULL) {
+		log_warn("Cannot open decode trace file: %s", buff);
+		return send_error(fd, message,
+				  "Cannot open decode trace file: %s (errno: %d)",
+				  buff, errno);
+	}
+	driver_lock();
+	r = decode_trace_dump(f, remotes);
+	driver_unlock();
+	if (fclose(f) != 0 || r < 0) {
+		log_warn("Cannot write decode trace file: %s", buff);
+		return send_error(fd, message,
+				  "Cannot write decode trace file: %s", buff);
+	}
+	log_info("Wrote %d decode trace events to %s", r, buff);
+	return send_success(fd, message);
+}
+
+
+/*
+ * Startup timeline. Phases may overlap, the hardware is initialized
+ * while the config file is parsed.
+ */
+struct startup_phase {
+	const char*	name;
+	struct timeval	start;
+	struct timeval	end;
+};
+
+static struct timeval startup_time;
+static struct startup_phase startup_phases[8];
+static int startup_phase_count = 0;
+
+
+/** Start timing a phase, return its index for startup_end(). */
+static int startup_begin(const char* name)
+{
+	struct startup_phase* phase;
+
+	if (startup_phase_count == 0)
+		get_monotonic_time(&startup_time);
+	if (startup_phase_count >= (int)(sizeof(startup_phases)
+					 / sizeof(*startup_phases)))
+		return -1;
+	phase = &startup_phases[startup_phase_count];
+	phase->name = name;
+	get_monotonic_time(&phase->start);
+	phase->end = phase->start;
+	return startup_phase_count++;
+}
+
+
+/** Stop timing phase, might be called from another thread. */
+static void startup_end(int phase)
 {
-	struct ir_ncode* codes;
-	char buffer[PACKET_SIZE + 1];
-	int n, len;
+	if (phase != -1)
+		get_monotonic_time(&startup_phases[phase].end);
+}
 
-	n = 0;
-	codes = remote->codes;
-	if (codes != NULL) {
-		while (codes->name != NULL) {
-			n++;
-			codes++;
-		}
+
+static void startup_log(void)
+{
+	char buff[256] = "";
+	const struct startup_phase* phase;
+	struct timeval now;
+	int len = 0;
+	int i;
+
+	for (i = 0; i < startup_phase_count; i += 1) {
+		phase = &startup_phases[i];
+		len += snprintf(buff + len, sizeof(buff) - len, "%s %s %.1f ms",
+				i == 0 ? "" : ",", phase->name,
+				time_elapsed(&phase->start, &phase->end)
+				/ 1000.0);
+		if (len >= (int)sizeof(buff))
+			break;
 	}
+	get_monotonic_time(&now);
+	log_notice("Startup:%s, ready after %.1f ms", buff,
+		   time_elapsed(&startup_time, &now) / 1000.0);
+}
+
+
+static int startup_times(int fd, char* message, char* arguments)
+{
+	char buffer[PACKET_SIZE + 1];
+	const struct startup_phase* phase;
+	int i;
+	ReplyBuffer reply(fd);
 
+	sprintf(buffer, "%d\n", startup_phase_count);
 	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
 	      && write_socket_len(fd, message)
-	      && write_socket_len(fd, protocol_string[P_SUCCESS]))
-	) {
+	      && write_socket_len(fd, protocol_string[P_SUCCESS])
+	      && write_socket_len(fd, protocol_string[P_DATA])
+	      && write_socket_len(fd, buffer)))
 		return 0;
+	for (i = 0; i < startup_phase_count; i += 1) {
+		phase = &startup_phases[i];
+		snprintf(buffer, sizeof(buffer), "%s %lu %lu\n", phase->name,
+			 time_elapsed(&startup_time, &phase->start),
+			 time_elapsed(&phase->start, &phase->end));
+		if (!write_socket_len(fd, buffer))
+			return 0;
 	}
-	if (n == 0)
-		return write_socket_len(fd, protocol_string[P_END]);
-	sprintf(buffer, "%d\n", n);
-	if (!(write_socket_len(fd, protocol_string[P_DATA])
-	      && write_socket_len(fd, buffer))
-	) {
+	return write_socket_len(fd, protocol_string[P_END]) && reply.flush();
+}
+
+
+/** Pools of memory_usage(). */
+enum memory_pool {
+	MEM_CONFIG = 0,         /**< Remotes, config cache and names. */
+	MEM_RAW_CODES,          /**< Signals of raw codes. */
+	MEM_STALE,              /**< Old config waiting in free_remotes. */
+	MEM_CLIENTS,            /**< Client state and queues, event ring. */
+	MEM_LOGGING,            /**< Async log rings, decode trace. */
+	MEM_POOL_COUNT
+};
+
+static const char* const memory_pools[MEM_POOL_COUNT] = {
+	"config", "raw_codes", "stale_config", "clients", "logging"
+};
+
+
+static size_t client_memory(struct client* client)
+{
+	size_t size;
+
+	size = client->queue.size
+	       + client->queue.msgs_size * sizeof(client->queue.msgs[0])
+	       + client->repeat_name.capacity()
+	       + client->held.capacity()
+	       + client->sim_raw.capacity() * sizeof(lirc_t)
+	       + client->subscriptions.capacity() * sizeof(struct subscription);
+	if (client->input != NULL)
+		size += sizeof(LineBuffer) + client->input->capacity();
+	for (const auto& sub : client->subscriptions)
+		size += sub.remote.capacity() + sub.button.capacity();
+	return size;
+}
+
+
+/** Set pools to the bytes allocated for each memory_pool. */
+static void memory_usage(size_t pools[MEM_POOL_COUNT])
+{
+	struct config_memory config = { 0, 0 };
+	struct config_memory stale = { 0, 0 };
+	size_t i;
+
+	driver_lock();
+	config_memory(remotes, &config);
+	config_cache_memory(&config);
+	config_memory(free_remotes, &stale);
+	driver_unlock();
+	pools[MEM_CONFIG] = config.config + lirc_atom_memory()
+			    + list_cache_memory();
+	pools[MEM_RAW_CODES] = config.raw;
+	pools[MEM_STALE] = stale.config + stale.raw;
+	pools[MEM_CLIENTS] = clients.capacity() * sizeof(struct client);
+	for (i = 0; i < clients.size(); i++)
+		pools[MEM_CLIENTS] += client_memory(&clients[i]);
+	if (ring != NULL)
+		pools[MEM_CLIENTS] += ring_size;
+	pools[MEM_LOGGING] = lirc_log_memory() + decode_trace_memory();
+}
+
+
+static void log_memory_usage(void)
+{
+	size_t pools[MEM_POOL_COUNT];
+
+	memory_usage(pools);
+	log_notice("Memory: config %zu kB, raw codes %zu kB, stale config"
+		   " %zu kB, clients %zu kB, logging %zu kB",
+		   pools[MEM_CONFIG] / 1024, pools[MEM_RAW_CODES] / 1024,
+		   pools[MEM_STALE] / 1024, pools[MEM_CLIENTS] / 1024,
+		   pools[MEM_LOGGING] / 1024);
+}
+
+
+/**
+ * MEMORY: return one line per memory_pool, its name and size in bytes,
+ * and the total. malloc() overhead is not included.
+ */
+static int memory(int fd, char* message, char* arguments)
+{
+	char buffer[PACKET_SIZE + 1];
+	size_t pools[MEM_POOL_COUNT];
+	size_t total = 0;
+	int i;
+
+	ReplyBuffer reply(fd);
+
+	memory_usage(pools);
+	sprintf(buffer, "%d\n", MEM_POOL_COUNT + 1);
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
+	      && write_socket_len(fd, message)
+	      && write_socket_len(fd, protocol_string[P_SUCCESS])
+	      && write_socket_len(fd, protocol_string[P_DATA])
+	      && write_socket_len(fd, buffer)))
 		return 0;
+	for (i = 0; i < MEM_POOL_COUNT; i++) {
+		snprintf(buffer, sizeof(buffer), "%s %zu\n",
+			 memory_pools[i], pools[i]);
+		if (!write_socket_len(fd, buffer))
+			return 0;
+		total += pools[i];
 	}
+	snprintf(buffer, sizeof(buffer), "total %zu\n", total);
+	return write_socket_len(fd, buffer)
+	       && write_socket_len(fd, protocol_string[P_END])
+	       && reply.flush();
+}
 
-	codes = remote->codes;
-	while (codes->name != NULL) {
-		len = snprintf(buffer, PACKET_SIZE, "%016llx %s\n",
-			       (unsigned long long)codes->code, codes->name);
-		if (len >= PACKET_SIZE + 1)
-			len = sprintf(buffer, "code_too_long\n");
-		if (write_socket(fd, buffer, len) < len)
+
+/** Write the metrics, including the client queue and memory gauges, on f. */
+static int write_metrics(FILE* f)
+{
+	size_t pools[MEM_POOL_COUNT];
+	size_t queued = 0;
+	size_t max_queued = 0;
+	size_t i;
+	int r;
+
+	for (i = 0; i < clients.size(); i++) {
+		queued += clients[i].queue.len;
+		if (clients[i].queue.len > max_queued)
+			max_queued = clients[i].queue.len;
+	}
+	driver_lock();
+	r = metrics_write(f, remotes);
+	driver_unlock();
+	if (r < 0)
+		return -1;
+	if (fprintf(f, "# HELP lirc_clients Connected clients.\n"
+		    "# TYPE lirc_clients gauge\nlirc_clients %zu\n"
+		    "# HELP lirc_queued_bytes Output queued for clients.\n"
+		    "# TYPE lirc_queued_bytes gauge\nlirc_queued_bytes %zu\n"
+		    "# HELP lirc_queued_bytes_max Longest client queue.\n"
+		    "# TYPE lirc_queued_bytes_max gauge\n"
+		    "lirc_queued_bytes_max %zu\n",
+		    clients.size(), queued, max_queued) < 0)
+		return -1;
+	r += 9;
+	memory_usage(pools);
+	if (fprintf(f, "# HELP lirc_memory_bytes Allocated memory by pool.\n"
+		    "# TYPE lirc_memory_bytes gauge\n") < 0)
+		return -1;
+	for (i = 0; i < MEM_POOL_COUNT; i++)
+		if (fprintf(f, "lirc_memory_bytes{pool=\"%s\"} %zu\n",
+			    memory_pools[i], pools[i]) < 0)
+			return -1;
+	return r + 2 + MEM_POOL_COUNT;
+}
+
+
+/*
+ * METRICS replies with the Prometheus text as data lines. METRICS path
+ * writes it to a file instead, replaced atomically so that e. g. the
+ * node exporter's textfile collector never reads a partial file.
+ */
+static int metrics(int fd, char* message, char* arguments)
+{
+	char path[128];
+	char tmp[sizeof(path) + 8];
+	char buffer[32];
+	char* data = NULL;
+	size_t size = 0;
+	FILE* f;
+	int r;
+
+	if (arguments != NULL && sscanf(arguments, "%127s", path) == 1) {
+		snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+		f = fopen(tmp, "w");
+		if (f == NULL)
+			return send_error(fd, message,
+					  "Cannot open metrics file: %s", tmp);
+		r = write_metrics(f);
+		if (fclose(f) != 0 || r < 0 || rename(tmp, path) != 0) {
+			unlink(tmp);
+			return send_error(fd, message,
+					  "Cannot write metrics file: %s",
+					  path);
+		}
+		return send_success(fd, message);
+	}
+	f = open_memstream(&data, &size);
+	if (f == NULL)
+		return send_error(fd, message, "Out of memory");
+	r = write_metrics(f);
+	if (fclose(f) != 0 || r < 0) {
+		free(data);
+		return send_error(fd, message, "Cannot format metrics");
+	}
+	snprintf(buffer, sizeof(buffer), "%d\n", r);
+	ReplyBuffer reply(fd);
+
+	r = write_socket_len(fd, protocol_string[P_BEGIN])
+	    && write_socket_len(fd, message)
+	    && write_socket_len(fd, protocol_string[P_SUCCESS])
+	    && write_socket_len(fd, protocol_string[P_DATA])
+	    && write_socket_len(fd, buffer)
+	    && write_socket(fd, data, size) == (int)size
+	    && write_socket_len(fd, protocol_string[P_END])
+	    && reply.flush();
+	free(data);
+	return r;
+}
+
+
+/**
+ * Run a single command line, including the newline. The line is
+ * tokenized in place, only the message echoed in the reply is copied.
+ * 0 on errors.
+ */
+static int run_command(int fd, char* line, size_t length)
+{
+	char message[length + 1];
+	char* directive;
+	char* arguments;
+	char* saveptr;
+	const struct protocol_directive* entry;
+
+	memcpy(message, line, length);
+	message[length] = '\0';
+	line[length - 1] = '\0';
+	/* remove DOS line endings */
+	if (length > 1 && line[length - 2] == '\r')
+		line[length - 2] = '\0';
+	log_trace("received command: \"%s\"", line);
+
+	directive = strtok_r(line, WHITE_SPACE, &saveptr);
+	if (directive == NULL)
+		return send_error(fd, message, "bad send packet\n");
+	arguments = strtok_r(NULL, "", &saveptr);
+	entry = find_directive(directive);
+	if (entry != NULL)
+		return entry->function(fd, message, arguments);
+	return send_error(fd, message,
+			  "unknown directive: \"%s\"\n", directive);
+}
+
+
+/*
+ * Run the complete commands buffered for client fd. Stop after a
+ * SEND_ONCE which has to repeat or is sent by the send thread, and at
+ * send commands waiting for the transmitter. The rest runs when it's
+ * done.
+ *
+ * At most COMMAND_BUDGET commands run per call. What is left over is a
+ * backlog, run in the next wakeup after the other clients had their
+ * turn. The client is not read while it has one, so a flood of commands
+ * is throttled by the socket.
+ */
+static int run_commands(int fd)
+{
+	int i;
+	int budget = COMMAND_BUDGET;
+	LineBuffer* input;
+	char* line;
+	size_t length;
+	int r;
+
+	while (1) {
+		/* A broadcast may have dropped or moved the client. */
+		i = client_index(fd);
+		if (i == -1)
 			return 0;
-		codes++;
+		input = clients[i].input;
+		if (fd == repeat_fd || clients[i].send_wait)
+			break;
+		if (!clients[i].listing && !input->has_lines())
+			break;
+		if (budget == 0) {
+			clients[i].backlog = 1;
+			update_client_events(i);
+			add_pending_fd(fd);
+			return 1;
+		}
+		budget -= 1;
+		if (clients[i].listing) {
+			if (!list_continue(i))
+				return 0;
+			continue;
+		}
+		if (send_thread && transmitter_busy()
+		    && is_send_command(input->c_str())) {
+			send_wait(i);
+			break;
+		}
+		line = input->next_line(&length);
+		if (length > PACKET_SIZE + 1) {
+			log_error("bad send packet: \"%.*s\"",
+				  PACKET_SIZE, line);
+			return 0;
+		}
+		/* The arguments point into input, keep it if fd goes away. */
+		running_input = input;
+		r = run_command(fd, line, length);
+		if (running_input == NULL) {
+			delete input;
+			return 0;
+		}
+		running_input = NULL;
+		if (!r)
+			return 0;
+	}
+	if (clients[i].backlog) {
+		clients[i].backlog = 0;
+		update_client_events(i);
 	}
-	return write_socket_len(fd, protocol_string[P_END]);
+	if (!input->has_lines() && strlen(input->c_str()) > PACKET_SIZE) {
+		log_error("bad send packet: \"%.*s\"",
+			  PACKET_SIZE, input->c_str());
+		/* remove clients that behave badly */
+		return 0;
+	}
+	return 1;
 }
 
-int send_name(int fd, char* message, struct ir_ncode* code)
+
+/*
+ * Read available input from client fd and run the complete commands
+ * in it. Returns 0 if the client should be removed.
+ */
+int get_command(int fd)
 {
-	char buffer[PACKET_SIZE + 1];
-	int len;
+	char buffer[PACKET_SIZE * 16];
+	int i = client_index(fd);
+	ssize_t length;
 
-	if (!(write_socket_len(fd, protocol_string[P_BEGIN])
-	     && write_socket_len(fd, message)
-	     && write_socket_len(fd, protocol_string[P_SUCCESS])
-	     && write_socket_len(fd, protocol_string[P_DATA]))
-	) {
+	if (i == -1)
+		return 0;
+	length = read(fd, buffer, sizeof(buffer));
+	if (length == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 1;
+		log_perror_err("get_command: read() failed");
 		return 0;
 	}
-	len = snprintf(buffer, PACKET_SIZE, "1\n%016llx %s\n",
-		       (unsigned long long)code->code, code->name);
-	if (len >= PACKET_SIZE + 1)
-		len = sprintf(buffer, "1\ncode_too_long\n");
-	if (write_socket(fd, buffer, len) < len)
+	clients[i].input->append(buffer, length);
+	if (!run_commands(fd))
 		return 0;
-	return write_socket_len(fd, protocol_string[P_END]);
+	/* EOF: connection closed by client */
+	return length > 0;
 }
 
-static int list(int fd, char* message, char* arguments)
+
+static void input_message(const char* message,
+			  const char* remote_name,
+			  const char* button_name, int reps)
 {
-	struct ir_remote* remote;
-	struct ir_ncode* code;
-	int err;
+	broadcast_message(message);
+}
 
-	if (parse_rc(fd, message, arguments, &remote, &code, 0, 0, &err) == 0)
-		return 0;
-	if (err)
-		return 1;
 
-	if (remote == NULL)
-		return send_remote_list(fd, message);
+/** Move last_remote and its state from the old config to head. */
+static void map_last_remote(struct ir_remote* old, struct ir_remote* head)
+{
+	struct ir_remote* found;
+	struct ir_ncode* code;
+
+	if (last_remote == NULL)
+		return;
+	if (!is_in_remotes(old, last_remote)) {
+		last_remote = NULL;
+		return;
+	}
+	log_info("last_remote found");
+	found = get_ir_remote(head, last_remote->name);
+	if (found == NULL)
+		return;
+	code = get_code_by_name(found, last_remote->last_code->name);
 	if (code == NULL)
-		return send_remote(fd, message, remote);
-	return send_name(fd, message, code);
+		return;
+	found->reps = last_remote->reps;
+	found->toggle_bit_mask_state = last_remote->toggle_bit_mask_state;
+	found->min_remaining_gap = last_remote->min_remaining_gap;
+	found->max_remaining_gap = last_remote->max_remaining_gap;
+	found->last_send = last_remote->last_send;
+	last_remote = found;
+	last_remote->last_code = code;
+	log_info("mapped last_remote");
 }
 
-static int set_transmitters(int fd, char* message, char* arguments)
+
+void free_old_remotes(void)
 {
-	char* next_arg = NULL;
-	char* end_ptr;
-	uint32_t next_tx_int = 0;
-	uint32_t next_tx_hex = 0;
-	uint32_t channels = 0;
-	int retval = 0;
-	unsigned int i;
+	struct ir_remote* scan_remotes;
+	struct ir_remote* found;
+	struct ir_ncode* code;
 
-	if (arguments == NULL)
-		goto string_error;
-	if (curr_driver->send_mode == 0) {
-		return send_error(fd,
-				  message,
-				  "hardware does not support sending\n");
-	}
-	if (curr_driver->drvctl_func == NULL
-	    || !(curr_driver->features & LIRC_CAN_SET_TRANSMITTER_MASK)
-	) {
-		return send_error(
-			fd,
-			message,
-			"hardware does not support multiple transmitters\n");
-	}
-	next_arg = strtok(arguments, WHITE_SPACE);
-	if (next_arg == NULL)
-		goto string_error;
-	do {
-		next_tx_int = strtoul(next_arg, &end_ptr, 10);
-		if (*end_ptr || next_tx_int == 0
-		    || (next_tx_int == ULONG_MAX && errno == ERANGE)
-		) {
-			return send_error(fd, message, "invalid argument\n");
+	if (get_decoding() == free_remotes || send_busy)
+		return;
+
+	if (!decode_thread)
+		map_last_remote(free_remotes, remotes);
+	else if (decode_cycles.load() == decode_swap_cycle)
+		/* decode thread may still be using free_remotes */
+		return;
+	/* check if last config is still needed */
+	found = NULL;
+	if (repeat_remote != NULL) {
+		scan_remotes = free_remotes;
+		while (scan_remotes != NULL) {
+			if (repeat_remote == scan_remotes) {
+				found = repeat_remote;
+				break;
+			}
+			scan_remotes = scan_remotes->next;
 		}
-		if (next_tx_int > MAX_TX)
-			return send_error(
-				fd, message,
-				"cannot support more than %d transmitters\n",
-				MAX_TX);
-		next_tx_hex = 1;
-		for (i = 1; i < next_tx_int; i++)
-			next_tx_hex = next_tx_hex << 1;
-		channels |= next_tx_hex;
-	} while ((next_arg = strtok(NULL, WHITE_SPACE)) != NULL);
+		if (found != NULL) {
+			found = find_remote(repeat_remote->name);
+			if (found != NULL) {
+				code = find_code(found, repeat_code->name);
+				if (code != NULL) {
+					found->last_code = code;
+					found->last_send =
+						repeat_remote->last_send;
+					found->toggle_bit_mask_state =
+						repeat_remote->toggle_bit_mask_state;
+					found->min_remaining_gap =
+						repeat_remote->min_remaining_gap;
+					found->max_remaining_gap =
+						repeat_remote->max_remaining_gap;
 
-	retval = curr_driver->drvctl_func(LIRC_SET_TRANSMITTER_MASK,
-					  &channels);
-	if (retval < 0) {
-		return send_error(fd, message,
-				  "error - could not set transmitters\n");
+					repeat_remote = found;
+					repeat_code = code;
+					found = NULL;
+				}
+			} else {
+				found = repeat_remote;
+			}
+		}
 	}
-	if (retval > 0) {
-		return send_error(fd, message,
-				  "error - maximum of %d transmitters\n",
-				  retval);
+	/* SEND_MACRO items may still refer to the old config */
+	if (found == NULL && get_decoding() != free_remotes
+	    && macro_items.empty()) {
+		free_config(free_remotes);
+		free_remotes = NULL;
+	} else {
+		log_trace("free_remotes still in use");
 	}
-	return send_success(fd, message);
-
-string_error:
-	return send_error(fd, message, "no arguments given\n");
 }
 
 
-void broadcast_message(const char* message)
+/** waitfordata() for drivers called from the decode thread. */
+static int decode_waitfordata(uint32_t maxusec)
 {
-	int len, i;
+	struct pollfd pfd[2];
+	struct timeval start, timeout, now;
+	int ret;
+#ifdef HAVE_PPOLL
+	struct timespec ts;
 
-	len = strlen(message);
+	ts.tv_sec = maxusec / 1000000;
+	ts.tv_nsec = (maxusec % 1000000) * 1000;
+#endif
 
-	for (i = 0; i < clin; i++) {
-		log_trace("writing to client %d: %s", i, message);
-		if (write_socket(clis[i], message, len) < len) {
-			remove_client(clis[i]);
-			i--;
+	timeout.tv_sec = maxusec / 1000000;
+	timeout.tv_usec = maxusec % 1000000;
+	while (1) {
+		pfd[0].fd = curr_driver->fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = decode_stop[0];
+		pfd[1].events = POLLIN;
+		pfd[0].revents = pfd[1].revents = 0;
+		get_monotonic_time(&start);
+#ifdef HAVE_PPOLL
+		ret = ppoll(pfd, 2, maxusec > 0 ? &ts : NULL, NULL);
+#else
+		ret = curl_poll(pfd, 2,
+				maxusec > 0 ? (maxusec + 999) / 1000 : -1);
+#endif
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1) {
+			log_perror_err("decode_waitfordata: curl_poll() failed");
+			return 0;
+		}
+		if (ret == 0 && maxusec > 0) {
+			get_monotonic_time(&now);
+			observe_wakeup(&start, &timeout, &now);
 		}
+		if (ret == 0 || pfd[1].revents != 0)
+			return 0;
+		if (pfd[0].revents & POLLIN)
+			return 1;
 	}
 }
 
 
-static int simulate(int fd, char* message, char* arguments)
+static void decode_wake(void)
 {
-	int i;
-	char* sim;
-	char* s;
-	char* space;
-
-	log_debug("simulate: enter");
-
-	if (!allow_simulate)
-		return send_error(fd, message,
-				  "SIMULATE command is disabled\n");
-	if (arguments == NULL)
-		return send_error(fd, message, "no arguments given\n");
+	/* A full pipe wakes up the main loop as well. */
+	if (write(decode_wakeup[1], "", 1) == -1 && errno != EAGAIN)
+		log_perror_warn("Cannot wake up main loop");
+}
 
-	s = arguments;
-	for (i = 0; i < 16; i++, s++)
-		if (!isxdigit(*s))
-			goto simulate_invalid_event;
-	if (*s != ' ')
-		goto simulate_invalid_event;
-	s++;
-	if (*s == ' ')
-		goto simulate_invalid_event;
-	for (; *s != ' '; s++)
-		if (!isxdigit(*s))
-			goto simulate_invalid_event;
-	s++;
-	space = strchr(s, ' ');
-	if (space == NULL || space == s)
-		goto simulate_invalid_event;
-	s = space + 1;
-	space = strchr(s, ' ');
-	if (strlen(s) == 0 || space != NULL)
-		goto simulate_invalid_event;
 
-	sim = (char*) malloc(strlen(arguments) + 1 + 1);
-	if (sim == NULL)
-		return send_error(fd, message, "out of memory\n");
-	strcpy(sim, arguments);
-	strcat(sim, "\n");
-	broadcast_message(sim);
-	free(sim);
+/** Queue message for the main loop, waiting while the queue is full. */
+static void decode_push(const char* message)
+{
+	size_t tail = decode_queue.tail.load(std::memory_order_relaxed);
+	struct pollfd pfd = { decode_stop[0], POLLIN, 0 };
 
-	return send_success(fd, message);
-simulate_invalid_event:
-	return send_error(fd, message, "invalid event\n");
+	while (tail - decode_queue.head.load(std::memory_order_acquire)
+	       >= DECODE_QUEUE_SIZE) {
+		if (curl_poll(&pfd, 1, 1) == 1) {
+			log_warn("Stopping, dropped: %s", message);
+			return;
+		}
+	}
+	strncpy(decode_queue.msgs[tail % DECODE_QUEUE_SIZE], message,
+		PACKET_SIZE);
+	decode_queue.msgs[tail % DECODE_QUEUE_SIZE][PACKET_SIZE] = '\0';
+	decode_queue.tail.store(tail + 1, std::memory_order_release);
+	decode_wake();
 }
 
-static int send_once(int fd, char* message, char* arguments)
+
+/** Broadcast the messages from the decode thread. */
+static void decode_drain(void)
 {
-	return send_core(fd, message, arguments, 1);
+	char buff[64];
+	size_t head = decode_queue.head.load(std::memory_order_relaxed);
+
+	while (read(decode_wakeup[0], buff, sizeof(buff)) > 0)
+		;
+	while (head != decode_queue.tail.load(std::memory_order_acquire)) {
+		broadcast_message(decode_queue.msgs[head % DECODE_QUEUE_SIZE]);
+		head += 1;
+		decode_queue.head.store(head, std::memory_order_release);
+	}
 }
 
-static int send_start(int fd, char* message, char* arguments)
+
+static void* decode_loop(void* arg)
 {
-	return send_core(fd, message, arguments, 0);
+	struct ir_remote* seen = decode_remotes.load();
+	struct ir_remote* head;
+	struct pollfd pfd[3];
+	char buff[16];
+	char* message;
+	int swapped;
+	int pending;
+	int ret;
+
+	while (1) {
+		pending = rec_buffer_pending();
+		pfd[0].fd = curr_driver->fd;
+		pfd[1].fd = decode_stop[0];
+		pfd[2].fd = decode_kick[0];
+		for (ret = 0; ret < 3; ret++) {
+			pfd[ret].events = POLLIN;
+			pfd[ret].revents = 0;
+		}
+		ret = curl_poll(pfd, 3, pending ? 0 : drv_timer_timeout(1000));
+		if (pfd[1].revents != 0)
+			break;
+		while (read(decode_kick[0], buff, sizeof(buff)) > 0)
+			;
+		head = decode_remotes.load();
+		swapped = head != seen;
+		if (swapped) {
+			map_last_remote(seen, head);
+			seen = head;
+		}
+		if (curr_driver->fd == -1 && curr_driver->init_func) {
+			/* try to reconnect */
+			driver_lock();
+			ret = curr_driver->init_func();
+			driver_unlock();
+			if (ret)
+				setup_hardware();
+		} else if (drv_timer_due() || pending
+			   || (ret > 0 && pfd[0].revents != 0)) {
+			driver_lock();
+			if (drv_timer_due())
+				message = drv_timer_run(head);
+			else
+				message = curr_driver->rec_func(head);
+			if (message != NULL && curr_driver->drvctl_func
+			    && (curr_driver->features & LIRC_CAN_NOTIFY_DECODE)
+			) {
+				curr_driver->drvctl_func(DRVCTL_NOTIFY_DECODE,
+							 NULL);
+			}
+			driver_unlock();
+			if (message != NULL)
+				decode_push(message);
+		}
+		decode_cycles.fetch_add(1);
+		if (swapped)
+			/* main loop can now free the old remotes */
+			decode_wake();
+	}
+	return NULL;
 }
 
-static int send_core(int fd, char* message, char* arguments, int once)
-{
-	struct ir_remote* remote;
-	struct ir_ncode* code;
-	unsigned int reps;
-	int err;
 
-	log_debug("Sending once, msg: %s, args: %s, once: %d",
-		  message, arguments, once);
-	if (curr_driver->send_mode == 0)
-		return send_error(fd, message,
-				  "hardware does not support sending\n");
+static int make_pipe(int fds[2])
+{
+	int i;
 
-	if (parse_rc(fd, message, arguments,
-		     &remote, &code, once ? &reps : NULL, 2, &err) == 0
-	) {
+	if (pipe(fds) == -1)
 		return 0;
+	for (i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
 	}
-	if (err)
-		return 1;
+	return 1;
+}
 
-	if (once) {
-		if (repeat_remote != NULL)
-			return send_error(fd, message, "busy: repeating\n");
-	} else {
-		if (repeat_remote != NULL)
-			return send_error(fd, message, "already repeating\n");
-	}
-	if (has_toggle_mask(remote))
-		remote->toggle_mask_state = 0;
-	if (has_toggle_bit_mask(remote))
-		remote->toggle_bit_mask_state =
-			(remote->toggle_bit_mask_state
-				^ remote->toggle_bit_mask);
-	code->transmit_state = NULL;
-	struct timespec before_send;
-	clock_gettime (CLOCK_MONOTONIC, &before_send);
-	if (!send_ir_ncode(remote, code, 1))
-		return send_error(fd, message, "transmission failed\n");
-	gettimeofday(&remote->last_send, NULL);
-	remote->last_code = code;
-	if (once)
-		remote->repeat_countdown = max(remote->repeat_countdown, reps);
-	else
-		/* you've been warned, now we have a limit */
-		remote->repeat_countdown = repeat_max;
-	if (remote->repeat_countdown > 0 || code->next != NULL) {
-		repeat_remote = remote;
-		repeat_code = code;
-		if (once) {
-			repeat_message = strdup(message);
-			if (repeat_message == NULL) {
-				repeat_remote = NULL;
-				repeat_code = NULL;
-				return send_error(fd, message,
-						  "out of memory\n");
-			}
-			repeat_fd = fd;
-		} else if (!send_success(fd, message)) {
-			repeat_remote = NULL;
-			repeat_code = NULL;
+
+/**
+ * Parse a cpu list like "1" or "0,2-3" into set.
+ * @return 1 on success, 0 on syntax errors or bad cpu numbers.
+ */
+static int parse_cpu_list(const char* list, cpu_set_t* set)
+{
+	const char* s = list;
+	char* end;
+	long first;
+	long last;
+
+	CPU_ZERO(set);
+	while (1) {
+		first = strtol(s, &end, 10);
+		if (end == s || first < 0 || first >= CPU_SETSIZE)
 			return 0;
+		last = first;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtol(s, &end, 10);
+			if (end == s || last < first || last >= CPU_SETSIZE)
+				return 0;
 		}
-		schedule_repeat_timer(&before_send);
-		return 1;
-	} else {
-		return send_success(fd, message);
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		if (*end == '\0')
+			return 1;
+		if (*end != ',')
+			return 0;
+		s = end + 1;
 	}
 }
 
-static int send_stop(int fd, char* message, char* arguments)
+
+/**
+ * Apply the --realtime and --cpu-affinity options to the calling
+ * thread, inherited by the threads it creates and by daemon(). With
+ * --lock-memory, lift RLIMIT_MEMLOCK so lock_memory() works also after
+ * dropping privileges.
+ * @return 0 if an option is invalid, else 1.
+ */
+static int realtime_setup(void)
 {
-	struct ir_remote* remote;
-	struct ir_ncode* code;
-	struct itimerval repeat_timer;
-	int err;
+	struct sched_param param;
+	struct rlimit limit;
+	const char* cpus;
+	cpu_set_t set;
+
+	cpus = options_getstring("lircd:cpu-affinity");
+	if (cpus != NULL && *cpus != '\0') {
+		if (!parse_cpu_list(cpus, &set)) {
+			log_error("Invalid cpu-affinity: %s", cpus);
+			return 0;
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+			log_perror_warn("Cannot set cpu affinity %s", cpus);
+		} else {
+			log_info("Running on cpus %s", cpus);
+		}
+	}
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = options_getint("lircd:realtime");
+	if (param.sched_priority > 0) {
+		if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+			log_perror_warn("Cannot use SCHED_FIFO priority %d",
+					param.sched_priority);
+		} else {
+			log_info("Using SCHED_FIFO priority %d",
+				 param.sched_priority);
+		}
+	}
+	if (options_getboolean("lircd:lock-memory") && getuid() == 0) {
+		limit.rlim_cur = RLIM_INFINITY;
+		limit.rlim_max = RLIM_INFINITY;
+		if (setrlimit(RLIMIT_MEMLOCK, &limit) == -1)
+			log_perror_warn("Cannot raise RLIMIT_MEMLOCK");
+	}
+	return 1;
+}
 
-	if (parse_rc(fd, message, arguments, &remote, &code, 0, 0, &err) == 0)
-		return 0;
-	if (err)
-		return 1;
 
-	if (repeat_remote && repeat_code) {
-		int done;
+/** Touch 256 kB of stack, so it is mapped before it is locked. */
+static void prefault_stack(void)
+{
+	volatile char stack[256 * 1024];
+	size_t i;
 
-		if (remote && strcasecmp(remote->name,
-					 repeat_remote->name) != 0
-		) {
-			return send_error(fd, message,
-					  "specified remote does not match\n");
-		}
-		if (code && strcasecmp(code->name, repeat_code->name) != 0)
-			return send_error(fd, message,
-					  "specified code does not match\n");
+	for (i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
 
-		done = repeat_max - repeat_remote->repeat_countdown;
-		if (done < repeat_remote->min_repeat) {
-			/* we still have some repeats to do */
-			repeat_remote->repeat_countdown =
-				repeat_remote->min_repeat - done;
-			return send_success(fd, message);
-		}
-		repeat_timer.it_value.tv_sec = 0;
-		repeat_timer.it_value.tv_usec = 0;
-		repeat_timer.it_interval.tv_sec = 0;
-		repeat_timer.it_interval.tv_usec = 0;
 
-		setitimer(ITIMER_REAL, &repeat_timer, NULL);
+/** Lock current and future memory, avoiding page faults when decoding. */
+static void lock_memory(void)
+{
+	prefault_stack();
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+		log_perror_warn("Cannot lock memory");
+		return;
+	}
+	log_info("Memory locked");
+}
+
 
-		repeat_remote->toggle_mask_state = 0;
-		repeat_remote = NULL;
-		repeat_code = NULL;
-		/* clin!=0, so we don't have to deinit hardware */
-		alrm = 0;
-		return send_success(fd, message);
-	} else {
-		return send_error(fd, message, "not repeating\n");
+static int decode_start(void)
+{
+	if (!make_pipe(decode_wakeup) || !make_pipe(decode_stop)
+	    || !make_pipe(decode_kick)) {
+		log_perror_err("Cannot create decode thread pipes");
+		return 0;
+	}
+	poll_add(decode_wakeup[0], FD_DECODER);
+	set_waitfordata_func(decode_waitfordata);
+	if (pthread_create(&decode_tid, NULL, decode_loop, NULL) != 0) {
+		log_error("Cannot create decode thread");
+		return 0;
 	}
+	log_info("Started decode thread");
+	return 1;
 }
 
 
-static int version(int fd, char* message, char* arguments)
+/** Parse the --extra-devices list of driver:device[|options] items. */
+static int parse_extra_devices(const char* opt)
 {
-	char buffer[PACKET_SIZE + 1];
+	char buff[1024];
+	char* item;
+	char* sep;
+	char* end;
+	char* options;
+	struct receiver r;
 
-	sprintf(buffer, "1\n%s\n", VERSION);
-	if (!(write_socket_len(fd, protocol_string[P_BEGIN]) &&
-	      write_socket_len(fd, message)
-			&& write_socket_len(fd, protocol_string[P_SUCCESS])
-			&& write_socket_len(fd, protocol_string[P_DATA])
-			&& write_socket_len(fd, buffer)
-			&& write_socket_len(fd, protocol_string[P_END])))
-		return 0;
+	if (opt == NULL)
+		return 1;
+	strncpy(buff, opt, sizeof(buff) - 1);
+	buff[sizeof(buff) - 1] = '\0';
+	for (item = strtok(buff, ","); item; item = strtok(NULL, ",")) {
+		item += strspn(item, " \t");
+		end = item + strlen(item);
+		while (end > item && isspace((unsigned char)end[-1]))
+			*--end = '\0';
+		sep = strchr(item, ':');
+		if (sep == NULL || sep == item || sep[1] == '\0') {
+			fprintf(stderr,
+				"%s: bad extra device \"%s\" (driver:device)\n",
+				progname, item);
+			return 0;
+		}
+		*sep = '\0';
+		options = strchr(sep + 1, '|');
+		if (options != NULL)
+			*options++ = '\0';
+		r.driver = item;
+		r.device = sep + 1;
+		r.options = options != NULL ? options : "";
+		r.pid = -1;
+		r.fd = -1;
+		r.input = NULL;
+		receivers.push_back(r);
+	}
 	return 1;
 }
 
 
-static int drv_option(int fd, char* message, char* arguments)
+/** Child side: read and decode an extra device until SIGTERM. */
+static void receiver_run(const struct receiver* r, int fd)
 {
-	struct option_t option;
-	int r;
+	struct sigaction act;
+	struct pollfd pfd;
+	loglevel_t oldlevel;
+	char* message;
+	int i;
 
-	r = sscanf(arguments, "%32s %64s", option.key, option.value);
-	if (r != 2) {
-		return send_error(fd, message,
-				  "Illegal argument (protocol error): %s",
-				  arguments);
+	/* Without SA_RESTART, so that SIGTERM interrupts blocking calls. */
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sigterm;
+	sigfillset(&act.sa_mask);
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGINT, &act, NULL);
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGUSR1, SIG_DFL);
+	for (i = 0; i < (int)clients.size(); i++)
+		close(clients[i].fd);
+	close(sockfd);
+	if (listen_tcpip)
+		close(sockinet);
+	for (i = 0; i < (int)peers.size(); i++)
+		if (peers[i]->socket != -1)
+			close(peers[i]->socket);
+	for (i = 0; i < (int)receivers.size(); i++)
+		if (receivers[i].fd != -1)
+			close(receivers[i].fd);
+	if (curr_driver->fd != -1)
+		close(curr_driver->fd);
+	/* Blocking writes: the main loop reads whenever it can. */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	decode_thread = 0;
+	send_thread = 0;
+	set_waitfordata_func(NULL);
+
+	if (hw_choose_driver(r->driver.c_str()) != 0) {
+		log_error("Driver `%s' for %s not found or not loadable",
+			  r->driver.c_str(), r->device.c_str());
+		_exit(EXIT_FAILURE);
 	}
-	r = curr_driver->drvctl_func(DRVCTL_SET_OPTION, (void*)&option);
-	if (r != 0) {
-		log_warn("Cannot set driver option");
-		return send_error(fd, message,
-				  "Cannot set driver option, code: %d", errno);
+	if (curr_driver->rec_mode == 0 || curr_driver->rec_func == NULL) {
+		log_error("Driver %s cannot receive", curr_driver->name);
+		_exit(EXIT_FAILURE);
+	}
+	curr_driver->open_func(r->device.c_str());
+	if (drv_handle_options(r->options.c_str()) != 0) {
+		if (term)
+			_exit(EXIT_SUCCESS);
+		log_error("Bad driver options for %s: \"%s\"",
+			  r->device.c_str(), r->options.c_str());
+		_exit(EXIT_FAILURE);
+	}
+	rec_buffer_init();
+	log_info("Receiving from %s using %s",
+		 r->device.c_str(), curr_driver->name);
+	while (!term) {
+		if (curr_driver->fd == -1) {
+			/* (re)connect, errors only after the first try */
+			if (curr_driver->init_func && curr_driver->init_func())
+				setup_hardware();
+			if (curr_driver->fd == -1) {
+				oldlevel = loglevel;
+				lirc_log_setlevel(LIRC_ERROR);
+				sleep(1);
+				lirc_log_setlevel(oldlevel);
+				continue;
+			}
+		}
+		if (!rec_buffer_pending() && !drv_timer_due()) {
+			pfd.fd = curr_driver->fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (curl_poll(&pfd, 1, drv_timer_timeout(1000)) <= 0)
+				continue;
+		}
+		if (drv_timer_due())
+			message = drv_timer_run(remotes);
+		else
+			message = curr_driver->rec_func(remotes);
+		if (message == NULL)
+			continue;
+		if (curr_driver->drvctl_func
+		    && (curr_driver->features & LIRC_CAN_NOTIFY_DECODE))
+			curr_driver->drvctl_func(DRVCTL_NOTIFY_DECODE, NULL);
+		if (write(fd, message, strlen(message)) == -1)
+			break;          /* main process is gone */
 	}
-	return send_success(fd, message);
+	if (curr_driver->fd != -1 && curr_driver->deinit_func)
+		curr_driver->deinit_func();
+	if (curr_driver->close_func)
+		curr_driver->close_func();
+	_exit(EXIT_SUCCESS);
 }
 
 
-static int set_inputlog(int fd, char* message, char* arguments)
+/** Fork a child for each extra device. */
+static void receivers_start(void)
 {
-	char buff[128];
-	FILE* f;
-	int r;
+	struct receiver* r;
+	int fds[2];
+	pid_t pid;
+	int i;
 
-	if (arguments) {
-		r = sscanf(arguments, "%128s", buff);
-		if (r != 1) {
-			return send_error(
-				fd, message,
-				"Illegal argument (protocol error): %s",
-				arguments
-			);
+	for (i = 0; i < (int)receivers.size(); i++) {
+		r = &receivers[i];
+		if (!make_pipe(fds)) {
+			log_perror_err("Cannot create pipe for %s",
+				       r->device.c_str());
+			continue;
 		}
+		pid = fork();
+		if (pid == -1) {
+			log_perror_err("Cannot fork reader of %s",
+				       r->device.c_str());
+			close(fds[0]);
+			close(fds[1]);
+			continue;
+		}
+		if (pid == 0) {
+			close(fds[0]);
+			receiver_run(r, fds[1]);
+		}
+		close(fds[1]);
+		r->pid = pid;
+		r->fd = fds[0];
+		r->input = new LineBuffer();
+		poll_add(r->fd, FD_RECEIVER);
+		log_debug("Reading %s in process %d", r->device.c_str(), pid);
 	}
-	if (!arguments || strcasecmp(buff, "null") == 0) {
-		rec_buffer_set_logfile(NULL);
-		return send_success(fd, message);
-	}
-	f = fopen(buff, "w");
-	if (f == NULL) {
-		log_warn("Cannot open input logfile: %s", buff);
-		return send_error(fd, message,
-				  "Cannot open input logfile: %s (errno: %d)",
-				  buff, errno);
-	}
-	rec_buffer_set_logfile(f);
-	return send_success(fd, message);
 }
 
 
-int get_command(int fd)
+static void receiver_close(struct receiver* r)
 {
-	int length;
-	char buffer[PACKET_SIZE + 1], backup[PACKET_SIZE + 1];
-	char* end;
-	int packet_length, i;
-	char* directive;
+	int status;
+
+	poll_remove(r->fd);
+	close(r->fd);
+	r->fd = -1;
+	delete r->input;
+	r->input = NULL;
+	if (waitpid(r->pid, &status, 0) == r->pid
+	    && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	    && !(WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM))
+		log_error("Reader of %s failed", r->device.c_str());
+	r->pid = -1;
+}
 
-	length = read_timeout(fd, buffer, PACKET_SIZE, 0);
-	packet_length = 0;
-	while (length > packet_length) {
-		buffer[length] = 0;
-		end = strchr(buffer, '\n');
-		if (end == NULL) {
-			log_error("bad send packet: \"%s\"", buffer);
-			/* remove clients that behave badly */
-			return 0;
-		}
-		end[0] = 0;
-		log_trace("received command: \"%s\"", buffer);
-		packet_length = strlen(buffer) + 1;
 
-		strcpy(backup, buffer);
-		strcat(backup, "\n");
+/** Stop all children and wait for them. */
+static void receivers_stop(void)
+{
+	int i;
 
-		/* remove DOS line endings */
-		end = strrchr(buffer, '\r');
-		if (end && end[1] == 0)
-			*end = 0;
+	for (i = 0; i < (int)receivers.size(); i++)
+		if (receivers[i].pid != -1)
+			kill(receivers[i].pid, SIGTERM);
+	for (i = 0; i < (int)receivers.size(); i++)
+		if (receivers[i].pid != -1)
+			receiver_close(&receivers[i]);
+}
 
-		directive = strtok(buffer, WHITE_SPACE);
-		if (directive == NULL) {
-			if (!send_error(fd, backup, "bad send packet\n"))
-				return 0;
-			goto skip;
-		}
-		for (i = 0; directives[i].name != NULL; i++) {
-			if (strcasecmp(directive, directives[i].name) == 0) {
-				if (!directives[i].function(fd,
-							    backup,
-							    strtok(NULL, ""))
-				) {
-					return 0;
-				}
-				goto skip;
-			}
-		}
 
-		if (!send_error(fd, backup,
-			        "unknown directive: \"%s\"\n", directive)
-		) {
-			return 0;
-		}
-skip:
-		if (length > packet_length) {
-			int new_length;
-
-			memmove(buffer,
-				buffer + packet_length,
-				length - packet_length + 1);
-			if (strchr(buffer, '\n') == NULL) {
-				new_length = read_timeout(
-					fd,
-					buffer + length - packet_length,
-					PACKET_SIZE
-						- (length - packet_length),
-					5);
-				if (new_length > 0)
-					length = length - packet_length
-						+ new_length;
-				else
-					length = new_length;
-			} else {
-				length -= packet_length;
-			}
-			packet_length = 0;
-		}
-	}
+/** Broadcast the messages a child has decoded. */
+static void handle_receiver_input(int fd)
+{
+	struct receiver* r = NULL;
+	char buffer[4096];
+	std::string line;
+	ssize_t length;
+	int i;
 
-	if (length == 0)        /* EOF: connection closed by client */
-		return 0;
-	return 1;
+	for (i = 0; i < (int)receivers.size(); i++)
+		if (receivers[i].fd == fd)
+			r = &receivers[i];
+	if (r == NULL)
+		return;
+	length = read(fd, buffer, sizeof(buffer));
+	if (length == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (length <= 0) {
+		/* Not restarted before next SIGHUP, it would fail again. */
+		log_error("Stopped receiving from %s", r->device.c_str());
+		receiver_close(r);
+		return;
+	}
+	r->input->append(buffer, length);
+	while (r->input->has_lines()) {
+		line = r->input->get_next_line();
+		broadcast_message(line.c_str());
+	}
 }
 
-static void input_message(const char* message,
-			  const char* remote_name,
-			  const char* button_name, int reps)
+
+static struct peer_connection* get_peer_by_socket(int fd)
 {
-	broadcast_message(message);
+	int i;
+
+	for (i = 0; i < (int)peers.size(); i++)
+		if (peers[i]->socket == fd)
+			return peers[i];
+	return NULL;
 }
 
 
-void free_old_remotes(void)
+static void handle_peer_input(struct peer_connection* peer, int revents)
 {
-	struct ir_remote* scan_remotes;
-	struct ir_remote* found;
-	struct ir_ncode* code;
-
-	if (get_decoding() == free_remotes)
+	/* Level-triggered: a hangup without input would be reported forever. */
+	if (revents & POLLIN) {
+		if (get_peer_message(peer) != 0)
+			return;
+	} else if (!(revents & (POLLHUP | POLLERR | POLLNVAL))) {
 		return;
-
-	if (last_remote != NULL) {
-		if (is_in_remotes(free_remotes, last_remote)) {
-			log_info("last_remote found");
-			found = get_ir_remote(remotes, last_remote->name);
-			if (found != NULL) {
-				code = get_code_by_name(
-						found,
-						last_remote->last_code->name);
-				if (code != NULL) {
-					found->reps = last_remote->reps;
-					found->toggle_bit_mask_state =
-						last_remote->toggle_bit_mask_state;
-					found->min_remaining_gap =
-						last_remote->min_remaining_gap;
-					found->max_remaining_gap =
-						last_remote->max_remaining_gap;
-					found->last_send =
-						last_remote->last_send;
-					last_remote = found;
-					last_remote->last_code = code;
-					log_info("mapped last_remote");
-				}
-			}
-		} else {
-			last_remote = NULL;
-		}
 	}
-	/* check if last config is still needed */
-	found = NULL;
-	if (repeat_remote != NULL) {
-		scan_remotes = free_remotes;
-		while (scan_remotes != NULL) {
-			if (repeat_remote == scan_remotes) {
-				found = repeat_remote;
-				break;
-			}
-			scan_remotes = scan_remotes->next;
-		}
-		if (found != NULL) {
-			found = get_ir_remote(remotes, repeat_remote->name);
-			if (found != NULL) {
-				code = get_code_by_name(found,
-							repeat_code->name);
-				if (code != NULL) {
-					struct itimerval repeat_timer;
+	log_notice("Lost connection to %s", peer->host);
+	peer->connection_failure = 0;
+	retry_peer_later(peer);
+}
 
-					repeat_timer.it_value.tv_sec = 0;
-					repeat_timer.it_value.tv_usec = 0;
-					repeat_timer.it_interval.tv_sec = 0;
-					repeat_timer.it_interval.tv_usec = 0;
 
-					found->last_code = code;
-					found->last_send =
-						repeat_remote->last_send;
-					found->toggle_bit_mask_state =
-						repeat_remote->toggle_bit_mask_state;
-					found->min_remaining_gap =
-						repeat_remote->min_remaining_gap;
-					found->max_remaining_gap =
-						repeat_remote->max_remaining_gap;
+/** Flush queued output and read commands from a ready client. */
+static void handle_client(const struct ready_fd* rfd)
+{
+	int i = client_index(rfd->fd);
 
-					setitimer(ITIMER_REAL,
-						  &repeat_timer,
-						  &repeat_timer);
-					/* "atomic" (shouldn't be necessary any more) */
-					repeat_remote = found;
-					repeat_code = code;
-					/* end "atomic" */
-					setitimer(ITIMER_REAL, &repeat_timer, NULL);
-					found = NULL;
-				}
-			} else {
-				found = repeat_remote;
-			}
+	if (i == -1)
+		return;
+	if (rfd->revents & POLLOUT) {
+		if (!queue_flush(clients[i].fd, &clients[i].queue)) {
+			remove_client(rfd->fd);
+			return;
 		}
+		update_client_events(i);
 	}
-	if (found == NULL && get_decoding() != free_remotes) {
-		free_config(free_remotes);
-		free_remotes = NULL;
-	} else {
-		log_trace("free_remotes still in use");
+	if (rfd->fd == repeat_fd) {
+		/* Commands are read when the repeat is done. */
+		if (rfd->revents & (POLLRDHUP | POLLHUP | POLLERR))
+			remove_client(rfd->fd);
+		return;
 	}
+	if (rfd->revents & (POLLIN | POLLHUP | POLLERR))
+		if (get_command(rfd->fd) == 0)
+			remove_client(rfd->fd);
 }
 
-struct pollfd_byname {
-	struct pollfd sockfd;
-	struct pollfd sockinet;
-	struct pollfd curr_driver;
-	struct pollfd clis[MAX_CLIENTS];
-	struct pollfd peers[MAX_PEERS];
-};
-
-#define POLLFDS_SIZE (sizeof(struct pollfd_byname)/sizeof(pollfd))
-
-static union {
-	struct  pollfd_byname byname;
-	struct  pollfd byindex[POLLFDS_SIZE];
-} poll_fds;
-
 
 static int mywaitfordata(uint32_t maxusec)
 {
 	int i;
-	int ret, reconnect;
-	struct timeval tv, start, now, timeout, release_time;
+	int ret, timed;
+	int driver_ready;
+	int driver_due = 0;
+	int reconnect;
+	struct timeval tv, start, now, timeout;
+	struct timespec ts;
+	struct ready_fd ready[POLL_BATCH];
+	struct peer_connection* peer;
 	loglevel_t oldlevel;
+	sigset_t block, waitmask;
 
+	/*
+	 * The flags set by the handlers are checked with the signals
+	 * blocked, and poll_wait() unblocks them atomically: a signal
+	 * arriving in between then interrupts the wait instead of being
+	 * noticed only at the next wakeup.
+	 */
+	sigemptyset(&block);
+	sigaddset(&block, SIGHUP);
+	sigaddset(&block, SIGTERM);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGUSR2);
 	while (1) {
 		do {
+			pthread_sigmask(SIG_BLOCK, &block, &waitmask);
 			/* handle signals */
 			if (term)
 				dosigterm(termsig);
@@ -1987,117 +6788,71 @@ static int mywaitfordata(uint32_t maxusec)
 				dosighup(SIGHUP);
 				hup = 0;
 			}
-			if (alrm) {
-				dosigalrm(SIGALRM);
-				alrm = 0;
-			}
-			memset(&poll_fds, 0, sizeof(poll_fds));
-			for (i = 0; i < (int)POLLFDS_SIZE; i += 1)
-				poll_fds.byindex[i].fd = -1;
-
-			poll_fds.byname.sockfd.fd = sockfd;
-			poll_fds.byname.sockfd.events = POLLIN;
-
-			if (listen_tcpip) {
-				poll_fds.byname.sockinet.fd = sockinet;
-				poll_fds.byname.sockinet.events = POLLIN;
-			}
-			if (use_hw() && curr_driver->rec_mode != 0
-			    && curr_driver->fd != -1
-			) {
-				poll_fds.byname.curr_driver.fd =
-					curr_driver->fd;
-				poll_fds.byname.curr_driver.events =
-					POLLIN;
-			}
-
-			for (i = 0; i < clin; i++) {
-				/* Ignore this client until codes have been
-				 * sent and it will get an answer. Otherwise
-				 * we could mix up answer packets and send
-				 * them back in the wrong order. */
-				if (clis[i] != repeat_fd) {
-					poll_fds.byname.clis[i].fd = clis[i];
-					poll_fds.byname.clis[i].events =
-						POLLIN;
-				}
+			if (restart) {
+				restart = 0;
+				dorestart();
 			}
+#ifndef HAVE_SYS_TIMERFD_H
+			if (repeat_remote != NULL && repeat_timer_expired())
+				dosigalrm(SIGALRM);
+#endif
+			/* One budget each, in turns and then back to poll. */
+			pending_batch.swap(pending_fds);
+			for (i = 0; i < (int)pending_batch.size(); i++)
+				if (client_index(pending_batch[i]) != -1
+				    && !run_commands(pending_batch[i]))
+					remove_client(pending_batch[i]);
+			pending_batch.clear();
+			sync_driver_fd();
+			sync_driver_timer();
 			timerclear(&tv);
-			reconnect = 0;
-			for (i = 0; i < peern; i++) {
-				if (peers[i]->socket != -1) {
-					poll_fds.byname.peers[i].fd =
-						peers[i]->socket;
-					poll_fds.byname.peers[i].events =
-						POLLIN;
-				} else if (timerisset(&tv)) {
-					if (timercmp(&tv,
-						     &peers[i]->reconnect, >)
-					) {
-						tv = peers[i]->reconnect;
-					}
-				} else {
-					tv = peers[i]->reconnect;
-				}
-			}
-			if (timerisset(&tv)) {
-				gettimeofday(&now, NULL);
-				if (timercmp(&now, &tv, >)) {
-					timerclear(&tv);
-				} else {
-					timersub(&tv, &now, &start);
-					tv = start;
-				}
-				reconnect = 1;
+			timed = timer_next(&tv);
+			if (!pending_fds.empty()) {
+				/* Commands left to run, don't block. */
+				timerclear(&tv);
+				timed = 1;
 			}
-			gettimeofday(&start, NULL);
+			get_monotonic_time(&start);
 			if (maxusec > 0) {
 				tv.tv_sec = maxusec / 1000000;
 				tv.tv_usec = maxusec % 1000000;
 			}
-			if (curr_driver->fd == -1 && use_hw()) {
+			reconnect = curr_driver->fd == -1 && use_hw()
+				    && !decode_thread && curr_driver->init_func;
+			if (!reconnect) {
+				hotplug_stop();
+			} else if (hotplug_start()) {
+				/* Retry when udev reports a device. */
+				if (hotplug_pending) {
+					timerclear(&tv);
+					timed = 1;
+				}
+			} else {
 				/* try to reconnect */
+				hotplug_pending = 1;
 				timerclear(&timeout);
 				timeout.tv_sec = 1;
 
 				if (timercmp(&tv, &timeout, >)
-				    || (!reconnect && !timerisset(&tv)))
+				    || (!timed && !timerisset(&tv)))
 					tv = timeout;
 			}
-			get_release_time(&release_time);
-			if (timerisset(&release_time)) {
-				gettimeofday(&now, NULL);
-				if (timercmp(&now, &release_time, >)) {
-					timerclear(&tv);
-				} else {
-					struct timeval gap;
-
-					timersub(&release_time, &now, &gap);
-					if (!(timerisset(&tv)
-					      || reconnect)
-					    || timercmp(&tv, &gap, >))
-						tv = gap;
-				}
-			}
-			if (timerisset(&tv) || timerisset(&release_time)
-			    || reconnect
-			) {
-				ret = curl_poll((
-					struct pollfd *) &poll_fds.byindex,
-					POLLFDS_SIZE,
-					tv.tv_sec * 1000 + tv.tv_usec / 1000);
+			if (timerisset(&tv) || timed) {
+				ts.tv_sec = tv.tv_sec;
+				ts.tv_nsec = tv.tv_usec * 1000;
+				ret = poll_wait(ready, POLL_BATCH, &ts, &waitmask);
 			} else {
-				ret = curl_poll((
-					struct pollfd*)&poll_fds.byindex,
-					POLLFDS_SIZE,
-					-1);
+				ret = poll_wait(ready, POLL_BATCH, NULL, &waitmask);
 			}
+			pthread_sigmask(SIG_SETMASK, &waitmask, NULL);
 			if (ret == -1 && errno != EINTR) {
-				log_perror_err("curl_poll()() failed");
+				log_perror_err("poll_wait() failed");
 				raise(SIGTERM);
 				continue;
 			}
-			gettimeofday(&now, NULL);
+			get_monotonic_time(&now);
+			if (ret == 0 && (timerisset(&tv) || timed))
+				observe_wakeup(&start, &tv, &now);
 			if (free_remotes != NULL)
 				free_old_remotes();
 			if (maxusec > 0) {
@@ -2107,60 +6862,114 @@ static int mywaitfordata(uint32_t maxusec)
 					return 0;
 				maxusec -= time_elapsed(&start, &now);
 			}
-			if (reconnect)
+			if (timers_expire(TIMER_PEER) > 0)
 				connect_to_peers();
+			if (timers_expire(TIMER_SEND) > 0)
+				send_gap_done();
+			if (timers_expire(TIMER_DRIVER) > 0 && maxusec == 0)
+				driver_due = 1;
+			if (timers_expire(TIMER_IDLE) > 0 && hw_idle) {
+				hw_idle = 0;
+				log_debug("Hardware idle, deinitializing");
+				driver_deinit();
+			}
 		} while (ret == -1 && errno == EINTR);
 
-		if (curr_driver->fd == -1 && use_hw()
-		    && curr_driver->init_func
+		for (i = 0; i < ret; i++) {
+			if (ready[i].kind == FD_HOTPLUG)
+				hotplug_read();
+		}
+		if (curr_driver->fd == -1 && use_hw() && !decode_thread
+		    && curr_driver->init_func && hotplug_pending
 		) {
+			hotplug_pending = 0;
 			oldlevel = loglevel;
 			lirc_log_setlevel(LIRC_ERROR);
-			curr_driver->init_func();
+			driver_lock();
+			driver_init();
+			driver_unlock();
 			setup_hardware();
 			lirc_log_setlevel(oldlevel);
 		}
-		for (i = 0; i < clin; i++) {
-			if (poll_fds.byname.clis[i].revents & POLLIN) {
-				poll_fds.byname.clis[i].revents = 0;
-				if (get_command(clis[i]) == 0) {
-					remove_client(clis[i]);
-					i--;
-				}
+		/*
+		 * Handle clients and peers before accepting new clients:
+		 * a client removed here might otherwise see its fd reused
+		 * by a new one inheriting a stale event.
+		 */
+		driver_ready = 0;
+		for (i = 0; i < ret; i++) {
+			switch (ready[i].kind) {
+			case FD_CLIENT:
+				handle_client(&ready[i]);
+				break;
+			case FD_PEER:
+				peer = get_peer_by_socket(ready[i].fd);
+				if (peer == NULL)
+					break;
+				if (peer->connecting)
+					peer_connect_done(peer);
+				else
+					handle_peer_input(peer,
+							  ready[i].revents);
+				break;
+#ifdef HAVE_SYS_TIMERFD_H
+			case FD_REPEAT:
+				if (repeat_remote != NULL
+				    && repeat_timer_expired())
+					dosigalrm(SIGALRM);
+				break;
+#endif
+			case FD_DECODER:
+				decode_drain();
+				break;
+			case FD_SENDER:
+				send_finished();
+				break;
+			case FD_RECEIVER:
+				handle_receiver_input(ready[i].fd);
+				break;
+			case FD_DRIVER:
+				if (ready[i].fd != curr_driver->fd)
+					break;
+				if (ready[i].revents & POLLOUT)
+					tty_flush_async(ready[i].fd);
+				if (!(ready[i].revents
+				      & (POLLHUP | POLLERR | POLLNVAL)))
+					driver_hangups = 0;
+				else if (!(ready[i].revents & POLLIN)
+					 || ++driver_hangups > DRIVER_HANGUPS_MAX)
+					/* Reported until the fd is closed. */
+					driver_lost();
+				if (ready[i].revents & POLLIN
+				    && curr_driver->fd != -1)
+					driver_ready = 1;
+				break;
+			default:
+				break;
 			}
 		}
-		for (i = 0; i < peern; i++) {
-			if (peers[i]->socket != -1
-			    && poll_fds.byname.peers[i].revents & POLLIN) {
-				poll_fds.byname.peers[i].revents = 0;
-				if (get_peer_message(peers[i]) == 0) {
-					shutdown(peers[i]->socket, 2);
-					close(peers[i]->socket);
-					peers[i]->socket = -1;
-					peers[i]->connection_failure = 1;
-					gettimeofday(&peers[i]->reconnect,
-						     NULL);
-					peers[i]->reconnect.tv_sec += 5;
-				}
+		if (send_thread)
+			send_dispatch();
+		for (i = 0; i < ret; i++) {
+			if (!(ready[i].revents & POLLIN))
+				continue;
+			if (ready[i].kind == FD_SOCKFD) {
+				log_trace("registering local client");
+				add_client(sockfd);
+			} else if (ready[i].kind == FD_SOCKINET) {
+				log_trace("registering inet client");
+				add_client(sockinet);
 			}
 		}
-		if (poll_fds.byname.sockfd.revents & POLLIN) {
-			poll_fds.byname.sockfd.revents = 0;
-			log_trace("registering local client");
-			add_client(sockfd);
-		}
-		if (poll_fds.byname.sockinet.revents & POLLIN) {
-			poll_fds.byname.sockinet.revents = 0;
-			log_trace("registering inet client");
-			add_client(sockinet);
-		}
 		if (use_hw() && curr_driver->rec_mode != 0
-		    && curr_driver->fd != -1
-		    && poll_fds.byname.curr_driver.revents & POLLIN
+		    && curr_driver->fd != -1 && driver_ready
 		) {
 			/* we will read later */
 			return 1;
 		}
+		if (driver_due && drv_timer_due())
+			/* loop() runs the driver timer */
+			return 1;
 	}
 }
 
@@ -2170,10 +6979,15 @@ void loop(void)
 
 	log_notice("lircd(%s) ready, using %s", curr_driver->name, lircdfile);
 	while (1) {
-		(void)mywaitfordata(0);
+		/* Input already read from the driver cannot wake poll(). */
+		if (!rec_buffer_pending() && !drv_timer_due())
+			(void)mywaitfordata(0);
 		if (!curr_driver->rec_func)
 			continue;
-		message = curr_driver->rec_func(remotes);
+		if (drv_timer_due())
+			message = drv_timer_run(remotes);
+		else
+			message = curr_driver->rec_func(remotes);
 
 		if (message != NULL) {
 			const char* remote_name;
@@ -2251,6 +7065,28 @@ static void lircd_add_defaults(void)
 		"lircd:configfile",	LIRCDCFGFILE,
 		"lircd:driver-options",	"",
 		"lircd:effective-user",	"",
+		"lircd:queue-size",	"16384",
+		"lircd:queue-overflow",	"drop-oldest",
+		"lircd:decode-thread",	"False",
+		"lircd:rec-buffer-size", "512",
+		"lircd:send-concat-gap", "10000",
+		"lircd:send-thread",	"False",
+		"lircd:idle-timeout",	"0",
+		"lircd:virtual-clock",	"False",
+		"lircd:low-latency",	"False",
+		"lircd:adaptive-order",	"False",
+		"lircd:remember-bursts", "False",
+		"lircd:realtime",	"0",
+		"lircd:cpu-affinity",	NULL,
+		"lircd:lock-memory",	"False",
+		"lircd:event-ring",	"0",
+		"lircd:multicast",	NULL,
+		"lircd:multicast-ttl",	"1",
+		"lircd:async-log",	NULL,
+		"lircd:decode-trace",	"4096",
+		"lircd:config-cache",	"",
+		"lircd:lazy-raw-codes",	"False",
+		"lircd:extra-devices",	NULL,
 
 		(const char*)NULL,	(const char*)NULL
 	};
@@ -2352,6 +7188,77 @@ static void lircd_parse_options(int argc, char** const argv)
 		case 'R':
 			options_set_opt("lircd:repeat-max", optarg);
 			break;
+		case OPT_QUEUE_SIZE:
+			options_set_opt("lircd:queue-size", optarg);
+			break;
+		case OPT_QUEUE_OVERFLOW:
+			options_set_opt("lircd:queue-overflow", optarg);
+			break;
+		case OPT_DECODE_THREAD:
+			options_set_opt("lircd:decode-thread", "True");
+			break;
+		case OPT_REC_BUFFER_SIZE:
+			options_set_opt("lircd:rec-buffer-size", optarg);
+			break;
+		case OPT_SEND_CONCAT_GAP:
+			options_set_opt("lircd:send-concat-gap", optarg);
+			break;
+		case OPT_SEND_THREAD:
+			options_set_opt("lircd:send-thread", "True");
+			break;
+		case OPT_IDLE_TIMEOUT:
+			options_set_opt("lircd:idle-timeout", optarg);
+			break;
+		case OPT_VIRTUAL_CLOCK:
+			options_set_opt("lircd:virtual-clock", "True");
+			break;
+		case OPT_LOW_LATENCY:
+			options_set_opt("lircd:low-latency", "True");
+			break;
+		case OPT_ADAPTIVE_ORDER:
+			options_set_opt("lircd:adaptive-order", "True");
+			break;
+		case OPT_REMEMBER_BURSTS:
+			options_set_opt("lircd:remember-bursts", "True");
+			break;
+		case OPT_REALTIME:
+			options_set_opt("lircd:realtime", optarg);
+			break;
+		case OPT_CPU_AFFINITY:
+			options_set_opt("lircd:cpu-affinity", optarg);
+			break;
+		case OPT_LOCK_MEMORY:
+			options_set_opt("lircd:lock-memory", "True");
+			break;
+		case OPT_EVENT_RING:
+			options_set_opt("lircd:event-ring", optarg);
+			break;
+		case OPT_MULTICAST:
+			options_set_opt("lircd:multicast", optarg);
+			break;
+		case OPT_MULTICAST_TTL:
+			options_set_opt("lircd:multicast-ttl", optarg);
+			break;
+		case OPT_DECODE_TRACE:
+			options_set_opt("lircd:decode-trace", optarg);
+			break;
+		case OPT_ASYNC_LOG:
+			options_set_opt("lircd:async-log",
+					optarg ? optarg : DEFAULT_ASYNC_LOG);
+			break;
+		case OPT_CONFIG_CACHE:
+			options_set_opt("lircd:config-cache", optarg);
+			break;
+		case OPT_LAZY_RAW_CODES:
+			options_set_opt("lircd:lazy-raw-codes", "True");
+			break;
+		case OPT_EXTRA_DEVICES:
+			options_set_opt("lircd:extra-devices", optarg);
+			break;
+		case OPT_UINPUT_OUTPUT:
+			options_set_opt("lircd:uinput-output",
+					optarg ? optarg : "/dev/uinput");
+			break;
 		case 'Y':
 			options_set_opt("lircd:dynamic-codes", "True");
 			break;
@@ -2421,13 +7328,53 @@ static void log_options(void)
 		log_notice("Options: listen address: %s", buff);
 	}
 	log_notice("Options: connect: %s", optvalue("lircd:connect"));
+	log_notice("Options: multicast: %s", optvalue("lircd:multicast"));
+	log_notice("Options: multicast_ttl: %d",
+		   options_getint("lircd:multicast-ttl"));
 	log_notice("Options: effective_user: %s",
 		   optvalue("lircd:effective_user"));
 	log_notice("Options: allow_simulate: %d", allow_simulate);
 	log_notice("Options: repeat_max: %d", repeat_max);
+	log_notice("Options: queue_size: %zu", queue_size);
+	log_notice("Options: queue_overflow: %s",
+		   optvalue("lircd:queue-overflow"));
+	log_notice("Options: decode_thread: %d",
+		   options_getboolean("lircd:decode-thread"));
+	log_notice("Options: rec_buffer_size: %d",
+		   options_getint("lircd:rec-buffer-size"));
+	log_notice("Options: send_concat_gap: %d",
+		   options_getint("lircd:send-concat-gap"));
+	log_notice("Options: send_thread: %d",
+		   options_getboolean("lircd:send-thread"));
+	log_notice("Options: idle_timeout: %d", idle_timeout);
+	log_notice("Options: async_log: %s", optvalue("lircd:async-log"));
+	log_notice("Options: decode_trace: %d",
+		   options_getint("lircd:decode-trace"));
+	log_notice("Options: virtual_clock: %d",
+		   options_getboolean("lircd:virtual-clock"));
+	log_notice("Options: low_latency: %d",
+		   options_getboolean("lircd:low-latency"));
+	log_notice("Options: adaptive_order: %d",
+		   options_getboolean("lircd:adaptive-order"));
+	log_notice("Options: remember_bursts: %d",
+		   options_getboolean("lircd:remember-bursts"));
+	log_notice("Options: realtime: %d", options_getint("lircd:realtime"));
+	log_notice("Options: cpu_affinity: %s",
+		   optvalue("lircd:cpu-affinity"));
+	log_notice("Options: lock_memory: %d",
+		   options_getboolean("lircd:lock-memory"));
+	log_notice("Options: event_ring: %d",
+		   options_getint("lircd:event-ring"));
 	log_notice("Options: configfile: %s", optvalue("lircd:configfile"));
+	log_notice("Options: config_cache: %s", optvalue("lircd:config-cache"));
+	log_notice("Options: lazy_raw_codes: %d",
+		   options_getboolean("lircd:lazy-raw-codes"));
 	log_notice("Options: dynamic_codes: %s",
 		   optvalue("lircd:dynamic_codes"));
+	log_notice("Options: extra_devices: %s",
+		   optvalue("lircd:extra-devices"));
+	log_notice("Options: uinput_output: %s",
+		   optvalue("lircd:uinput-output"));
 }
 
 
@@ -2441,6 +7388,21 @@ static void log_driver(void)
 }
 
 
+/** Result of startup_init(). */
+static int startup_init_ok = 0;
+
+
+/** Initialize the hardware while main() parses the config file. */
+static void* startup_init(void* arg)
+{
+	driver_lock();
+	startup_init_ok = curr_driver->init_func();
+	driver_unlock();
+	startup_end((int)(intptr_t)arg);
+	return NULL;
+}
+
+
 int main(int argc, char** argv)
 {
 	struct sigaction act;
@@ -2449,7 +7411,16 @@ int main(int argc, char** argv)
 	char errmsg[128];
 	const char* opt;
 	int immediate_init = 0;
-
+	int init_at_start;
+	int init_threaded = 0;
+	pthread_t init_tid;
+	int phase;
+
+	phase = startup_begin("options");
+	restart_argv = argv;
+	if (readlink("/proc/self/exe", restart_exe, sizeof(restart_exe) - 1)
+	    <= 0)
+		strncpy(restart_exe, argv[0], sizeof(restart_exe) - 1);
 	address.s_addr = htonl(INADDR_ANY);
 	hw_choose_driver(NULL);
 	options_load(argc, argv, NULL, lircd_parse_options);
@@ -2479,6 +7450,8 @@ int main(int argc, char** argv)
 		hw_print_drivers(stdout);
 		return EXIT_SUCCESS;
 	}
+	startup_end(phase);
+	phase = startup_begin("plugin");
 	if (hw_choose_driver(opt) != 0) {
 		fprintf(stderr, "Driver `%s' not found or not loadable", opt);
 		fprintf(stderr, " (wrong or missing -U/--plugindir?).\n");
@@ -2494,7 +7467,9 @@ int main(int argc, char** argv)
 			options_getstring("lircd:driver-options"));
 		return EXIT_FAILURE;
 	}
+	startup_end(phase);
 	pidfile = options_getstring("lircd:pidfile");
+	config_cache = options_getstring("lircd:config-cache");
 	lircdfile = options_getstring("lircd:output");
 	opt = options_getstring("lircd:logfile");
 	if (opt != NULL)
@@ -2512,15 +7487,106 @@ int main(int argc, char** argv)
 			port = LIRC_INET_PORT;
 		}
 	}
+	opt = options_getstring("lircd:multicast");
+	if (opt != NULL) {
+		std::string group(opt);
+		unsigned short mport;
+
+		if (group.find(':') == std::string::npos)
+			group += ":" + std::to_string(LIRC_INET_PORT);
+		if (opt2host_port(group.c_str(), &multicast_addr.sin_addr,
+				  &mport, errmsg) != 0) {
+			fputs(errmsg, stderr);
+			return EXIT_FAILURE;
+		}
+		if (!IN_MULTICAST(ntohl(multicast_addr.sin_addr.s_addr))) {
+			fprintf(stderr, "%s: %s is not a multicast group\n",
+				progname, opt);
+			return EXIT_FAILURE;
+		}
+		multicast_addr.sin_family = AF_INET;
+		multicast_addr.sin_port = htons(mport);
+		multicast = 1;
+	}
 	opt = options_getstring("lircd:connect");
 	if (!parse_peer_connections(opt))
 		return(EXIT_FAILURE);
+	if (!parse_extra_devices(options_getstring("lircd:extra-devices")))
+		return EXIT_FAILURE;
 	loglevel_opt = (loglevel_t) options_getint("lircd:debug");
 	allow_simulate = options_getboolean("lircd:allow-simulate");
 	repeat_max = options_getint("lircd:repeat-max");
+	if (options_getint("lircd:queue-size") < (int)QUEUE_SIZE_MIN) {
+		fprintf(stderr, "%s: queue-size must be at least %zu\n",
+			progname, QUEUE_SIZE_MIN);
+		return EXIT_FAILURE;
+	}
+	queue_size = options_getint("lircd:queue-size");
+	opt = options_getstring("lircd:queue-overflow");
+	if (strcmp(opt, "drop-oldest") == 0) {
+		queue_overflow = OVERFLOW_DROP_OLDEST;
+	} else if (strcmp(opt, "drop-client") == 0) {
+		queue_overflow = OVERFLOW_DROP_CLIENT;
+	} else {
+		fprintf(stderr, "%s: Invalid queue-overflow policy %s\n",
+			progname, opt);
+		return EXIT_FAILURE;
+	}
+	decode_thread = options_getboolean("lircd:decode-thread");
+	if (decode_thread
+	    && (curr_driver->rec_mode == 0 || curr_driver->rec_func == NULL)) {
+		log_warn("Driver cannot receive, not using decode thread");
+		decode_thread = 0;
+	}
+	send_thread = options_getboolean("lircd:send-thread");
+	if (send_thread && curr_driver->send_mode == 0) {
+		log_warn("Driver cannot send, not using send thread");
+		send_thread = 0;
+	}
+	if (send_thread && !decode_thread && curr_driver->rec_mode != 0
+	    && curr_driver->rec_func != NULL) {
+		/* Else the main loop could hold the driver while waiting. */
+		log_info("Using decode thread with send thread");
+		decode_thread = 1;
+	}
+	if (!rec_buffer_set_size(options_getint("lircd:rec-buffer-size"))) {
+		fprintf(stderr, "%s: Invalid rec-buffer-size %s\n",
+			progname, options_getstring("lircd:rec-buffer-size"));
+		return EXIT_FAILURE;
+	}
+	if (options_getint("lircd:send-concat-gap") < 0) {
+		fprintf(stderr, "%s: Invalid send-concat-gap %s\n",
+			progname, options_getstring("lircd:send-concat-gap"));
+		return EXIT_FAILURE;
+	}
+	send_buffer_set_concat_gap(options_getint("lircd:send-concat-gap"));
+	if (options_getint("lircd:idle-timeout") < 0) {
+		fprintf(stderr, "%s: Invalid idle-timeout %s\n",
+			progname, options_getstring("lircd:idle-timeout"));
+		return EXIT_FAILURE;
+	}
+	idle_timeout = options_getint("lircd:idle-timeout");
+	if (options_getint("lircd:realtime") < 0
+	    || options_getint("lircd:realtime") > sched_get_priority_max(SCHED_FIFO)) {
+		fprintf(stderr, "%s: Invalid realtime priority %s\n",
+			progname, options_getstring("lircd:realtime"));
+		return EXIT_FAILURE;
+	}
+	rec_set_virtual_clock(options_getboolean("lircd:virtual-clock"));
+	rec_set_low_latency(options_getboolean("lircd:low-latency"));
+	ir_remote_set_adaptive_order(options_getboolean("lircd:adaptive-order"));
+	ir_remote_set_scancode_index(1);
+	rec_set_recall(options_getboolean("lircd:remember-bursts"));
+	if (options_getint("lircd:decode-trace") < 0
+	    || !decode_trace_set_size(options_getint("lircd:decode-trace"))) {
+		fprintf(stderr, "%s: Invalid decode-trace %s\n",
+			progname, options_getstring("lircd:decode-trace"));
+		return EXIT_FAILURE;
+	}
 	configfile = options_getstring("lircd:configfile");
 	curr_driver->open_func(device);
-	if (strcmp(curr_driver->name, "null") == 0 && peern == 0) {
+	if (strcmp(curr_driver->name, "null") == 0 && peers.empty()
+	    && receivers.empty()) {
 		fprintf(stderr,
 			"%s: there's no hardware I can use and no peers are specified\n",
 			progname);
@@ -2540,8 +7606,36 @@ int main(int argc, char** argv)
 	log_driver();
 
 	signal(SIGPIPE, SIG_IGN);
-
+	handover_load();
+
+#ifdef USE_UINPUT
+	opt = options_getstring("lircd:uinput-output");
+	if (opt != NULL && handover.uinput != -1) {
+		uinput_fd = handover.uinput;
+	} else if (opt != NULL) {
+		/* Before start_server() drops privileges. */
+		uinput_fd = uinput_open(opt);
+		if (uinput_fd == -1)
+			return EXIT_FAILURE;
+	} else if (handover.uinput != -1) {
+		ioctl(handover.uinput, UI_DEV_DESTROY);
+		close(handover.uinput);
+	}
+#endif
+	/* Needs privileges, inherited by the daemon and all threads. */
+	if (!realtime_setup())
+		return EXIT_FAILURE;
+	phase = startup_begin("server");
 	start_server(permission, nodaemon, loglevel_opt);
+	startup_end(phase);
+#ifdef HAVE_SYSTEMD
+	/*
+	 * Sockets accept connections, commands are handled when the main
+	 * loop starts. When daemonizing, only the child can notify.
+	 */
+	if (nodaemon)
+		sd_notify(0, "READY=1");
+#endif
 
 	act.sa_handler = sigterm;
 	sigfillset(&act.sa_mask);
@@ -2549,50 +7643,86 @@ int main(int argc, char** argv)
 	sigaction(SIGTERM, &act, NULL);
 	sigaction(SIGINT, &act, NULL);
 
-	act.sa_handler = sigalrm;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = SA_RESTART;      /* don't fiddle with EINTR */
-	sigaction(SIGALRM, &act, NULL);
-
 	act.sa_handler = dosigterm;
 	sigemptyset(&act.sa_mask);
 	act.sa_flags = SA_RESTART;
 	sigaction(SIGUSR1, &act, NULL);
 
+	/* The threads and --multicast keep hardware open all the time. */
+	init_at_start = curr_driver->init_func != NULL
+			&& (decode_thread || send_thread || multicast
+			    || immediate_init);
+	if (init_at_start) {
+		if (!decode_thread && !send_thread && !multicast)
+			log_info("Doing immediate init, as requested");
+		/* Plugins probing USB devices can take seconds. */
+		phase = startup_begin("hardware");
+		forget_driver_fd();
+		init_pending = 1;
+		init_threaded = pthread_create(&init_tid, NULL, startup_init,
+					       (void*)(intptr_t)phase) == 0;
+		if (!init_threaded) {
+			init_pending = 0;
+			startup_init((void*)(intptr_t)phase);
+		}
+	}
+
 	remotes = NULL;
+	set_send_lock_funcs(driver_lock, driver_unlock);
+	phase = startup_begin("config");
 	config();		/* read config file */
+	startup_end(phase);
 	set_waitfordata_func(mywaitfordata);  /* receive uses my waitfordata.*/
 
 	act.sa_handler = sighup;
 	sigemptyset(&act.sa_mask);
 	act.sa_flags = SA_RESTART;      /* don't fiddle with EINTR */
 	sigaction(SIGHUP, &act, NULL);
-
-	if (immediate_init && curr_driver->init_func) {
-		log_info("Doing immediate init, as requested");
-		int status = curr_driver->init_func();
-		if (status)
-			setup_hardware();
-		else {
+	act.sa_handler = sigrestart;
+	sigaction(SIGUSR2, &act, NULL);
+
+	if (init_at_start) {
+		if (init_threaded)
+			pthread_join(init_tid, NULL);
+		init_pending = 0;
+		sync_driver_fd();
+		if (!startup_init_ok) {
 			log_error("Failed to initialize hardware");
 			return(EXIT_FAILURE);
 		}
-		if (curr_driver->deinit_func) {
-			int status = curr_driver->deinit_func();
-			if (!status)
+		setup_hardware();
+		if (!use_hw() && curr_driver->deinit_func) {
+			if (!driver_deinit())
 				log_error("Failed to de-initialize hardware");
 		}
 	}
 
+	handover_connections();
+
 	/* ready to accept connections */
-	if (!nodaemon)
+	if (handover.daemonized)
+		daemonized = 1;
+	else if (!nodaemon)
 		daemonize();
 
 #ifdef HAVE_SYSTEMD
 	/* Tell systemd that we started up correctly */
-	sd_notify(0, "READY=1");
+	if (!nodaemon)
+		sd_notify(0, "READY=1");
 #endif
 
+	receivers_start();
+	opt = options_getstring("lircd:async-log");
+	if (opt != NULL && !lirc_log_set_async(strtoul(opt, NULL, 10)))
+		log_warn("Cannot start async logging, logging synchronously");
+	if (decode_thread && !decode_start())
+		return EXIT_FAILURE;
+	if (send_thread && !send_start_thread())
+		return EXIT_FAILURE;
+	/* Not inherited by daemon(), and covers the thread stacks. */
+	if (options_getboolean("lircd:lock-memory"))
+		lock_memory();
+	startup_log();
 	loop();
 
 	/* never reached */
@@ -15,6 +15,7 @@
 # include <config.h>
 #endif
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -31,6 +32,11 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #ifdef HAVE_LINUX_INPUT_H
 #include <linux/input.h>
 #include <linux/uinput.h>
@@ -38,11 +44,17 @@
 
 #include "lirc_options.h"
 #include "lirc_log.h"
+#include "code_line.h"
+#include "curl_poll.h"
+#include "ir_remote.h"
 
 #define CLICK_DELAY 50000       /* usecs */
 #define WHITE_SPACE " \t"
 #define ALL ((char*)(-1))
 #define CIRCLE 10
+#define MOTION_FRAME 8000       /* usecs, pointer motion update period */
+#define MOTION_GAP 110000       /* usecs, assumed gap between repeats */
+#define MOTION_MAX_GAP 500000   /* usecs, longer gaps are a new press */
 
 #define BUTTONS 3               /* 3 buttons supported */
 
@@ -154,8 +166,20 @@ struct trans_mouse {
 	char*			tm_remote;
 	char*			tm_button;
 	enum directive		tm_directive;
+	int			tm_line;        /* In config, orders matches. */
 } *tm_first = NULL;
 
+typedef std::vector<struct trans_mouse*> tm_list_t;
+typedef std::unordered_map<std::string, tm_list_t> tm_map_t;
+
+/* tm_first by lower case remote and/or button, see build_tm_index(). */
+static struct {
+	tm_map_t	both;           /* "remote button" */
+	tm_map_t	remote;         /* Any button */
+	tm_map_t	button;         /* Any remote */
+	tm_list_t	any;
+} tm_index;
+
 enum state_button { button_up, button_down };
 enum state_axis { axis_none, axis_up, axis_down };
 
@@ -183,6 +207,78 @@ sig_atomic_t hup = 0;
 
 static struct trans_mouse* read_config(FILE* fd);
 
+/** Append lower case s to key. */
+static void fold(std::string* key, const char* s)
+{
+	for (; *s != '\0'; s++)
+		key->push_back(tolower((unsigned char)*s));
+}
+
+/** Rebuild tm_index from tm_first. */
+void build_tm_index(void)
+{
+	struct trans_mouse* tm;
+	std::string key;
+
+	tm_index.both.clear();
+	tm_index.remote.clear();
+	tm_index.button.clear();
+	tm_index.any.clear();
+	for (tm = tm_first; tm != NULL; tm = tm->tm_next) {
+		key.clear();
+		if (tm->tm_remote == ALL && tm->tm_button == ALL) {
+			tm_index.any.push_back(tm);
+		} else if (tm->tm_button == ALL) {
+			fold(&key, tm->tm_remote);
+			tm_index.remote[key].push_back(tm);
+		} else if (tm->tm_remote == ALL) {
+			fold(&key, tm->tm_button);
+			tm_index.button[key].push_back(tm);
+		} else {
+			fold(&key, tm->tm_remote);
+			key.push_back(' ');
+			fold(&key, tm->tm_button);
+			tm_index.both[key].push_back(tm);
+		}
+	}
+}
+
+static void add_matches(tm_list_t* matches, const tm_map_t& map,
+			const std::string& key)
+{
+	tm_map_t::const_iterator it = map.find(key);
+
+	if (it != map.end())
+		matches->insert(matches->end(),
+				it->second.begin(), it->second.end());
+}
+
+static bool by_line(const struct trans_mouse* a, const struct trans_mouse* b)
+{
+	return a->tm_line < b->tm_line;
+}
+
+/** Set matches to the entries for remote and button, in config order. */
+static void find_tm(tm_list_t* matches, const char* remote, const char* button)
+{
+	static std::string key;
+	size_t remote_len;
+
+	matches->clear();
+	key.clear();
+	fold(&key, remote);
+	remote_len = key.size();
+	add_matches(matches, tm_index.remote, key);
+	key.push_back(' ');
+	fold(&key, button);
+	add_matches(matches, tm_index.both, key);
+	key.erase(0, remote_len + 1);
+	add_matches(matches, tm_index.button, key);
+	matches->insert(matches->end(),
+			tm_index.any.begin(), tm_index.any.end());
+	std::sort(matches->begin(), matches->end(), by_line);
+}
+
 void freetm(struct trans_mouse* tm_all)
 {
 	struct trans_mouse* tm;
@@ -244,6 +340,7 @@ void dohup(void)
 	} else {
 		freetm(tm_first);
 		tm_first = tm_list;
+		build_tm_index();
 		ms = new_ms;
 	}
 }
@@ -305,17 +402,33 @@ setup_error:
 	return -1;
 }
 
-void write_uinput(uint16_t type, uint16_t code, int32_t value)
+#ifdef USE_UINPUT
+/** Events written by flush_uinput(), one mwrite() queues at most 17. */
+static struct input_event uinput_events[17];
+static int uinput_count = 0;
+#endif
+
+void queue_uinput(uint16_t type, uint16_t code, int32_t value)
 {
 #ifdef USE_UINPUT
-	struct input_event event;
+	struct input_event* event = &uinput_events[uinput_count++];
+
+	memset(event, 0, sizeof(*event));
+	event->type = type;
+	event->code = code;
+	event->value = value;
+#endif
+}
 
-	memset(&event, 0, sizeof(event));
-	event.type = type;
-	event.code = code;
-	event.value = value;
+void flush_uinput(void)
+{
+#ifdef USE_UINPUT
+	ssize_t size = uinput_count * sizeof(struct input_event);
 
-	if (write(uinputfd, &event, sizeof(event)) != sizeof(event)) {
+	uinput_count = 0;
+	if (size == 0)
+		return;
+	if (write(uinputfd, uinput_events, size) != size) {
 		static int once = 1;
 
 		if (once) {
@@ -330,20 +443,12 @@ void write_uinput(uint16_t type, uint16_t code, int32_t value)
 #endif
 }
 
-void msend(int dx, int dy, int dz, int rep, int buttp, int buttr)
+/** Write one packet, |dx|, |dy| and |dz| must fit in it. */
+void mwrite(int dx, int dy, int dz, int buttp, int buttr)
 {
 	static int buttons = 0;
-	int i;
-	int f = 1;
 	char buffer[5];
 
-	if (rep >= ms.acc_start) {
-		if (rep * ms.acc_fak >= ms.acc_max)
-			f = ms.acc_max;
-		else
-			f = rep * ms.acc_fak;
-	}
-
 	buttons |= buttp;
 	buttons &= ~buttr;
 
@@ -354,10 +459,8 @@ void msend(int dx, int dy, int dz, int rep, int buttp, int buttr)
 		buffer[1] = dx;
 		buffer[2] = dy;
 		buffer[3] = buffer[4] = 0;
-		if (lircm != -1) {
-			for (i = 0; i < f; i++)
-				chk_write(lircm, buffer, 4);
-		}
+		if (lircm != -1)
+			chk_write(lircm, buffer, 4);
 	case imps_2:
 		buffer[0] = ((buttons & BUTTON1) ? 0x01 : 0x00)
 			    | ((buttons & BUTTON3) ? 0x02 : 0x00)
@@ -367,10 +470,8 @@ void msend(int dx, int dy, int dz, int rep, int buttp, int buttr)
 		buffer[1] = dx + (dx >= 0 ? 0 : 256);
 		buffer[2] = dy + (dy >= 0 ? 0 : 256);
 		buffer[3] = dz;
-		if (lircm != -1) {
-			for (i = 0; i < f; i++)
-				chk_write(lircm, buffer, 4);
-		}
+		if (lircm != -1)
+			chk_write(lircm, buffer, 4);
 		break;
 	case im_serial:
 		dy = -dy;
@@ -383,56 +484,180 @@ void msend(int dx, int dy, int dz, int rep, int buttp, int buttr)
 		buffer[3] = ((dz < 0) ? 0x0f : 0x00)
 			    | ((dz > 0) ? 0x01 : 0x00)
 			    | ((buttons & BUTTON2) ? 0x10 : 0x00);
-		if (lircm != -1) {
-			for (i = 0; i < f; i++)
-				chk_write(lircm, buffer, 4);
-		}
+		if (lircm != -1)
+			chk_write(lircm, buffer, 4);
 	}
 
 #if defined(USE_UINPUT)
 	if (uinputfd != -1) {
-		for (i = 0; i < f; i++) {
-			if ((dx != 0) || (dy != 0)) {
-				write_uinput(EV_REL, REL_X, dx);
-				write_uinput(EV_REL, REL_Y, dy);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
-			if (dz != 0) {
-				write_uinput(EV_REL, REL_WHEEL, dz);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
-			if (buttp & BUTTON1) {
-				write_uinput(EV_KEY, BTN_LEFT, 1);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
-			if (buttr & BUTTON1) {
-				write_uinput(EV_KEY, BTN_LEFT, 0);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
-			if (buttp & BUTTON2) {
-				write_uinput(EV_KEY, BTN_MIDDLE, 1);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
-			if (buttr & BUTTON2) {
-				write_uinput(EV_KEY, BTN_MIDDLE, 0);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
-			if (buttp & BUTTON3) {
-				write_uinput(EV_KEY, BTN_RIGHT, 1);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
-			if (buttr & BUTTON3) {
-				write_uinput(EV_KEY, BTN_RIGHT, 0);
-				write_uinput(EV_SYN, SYN_REPORT, 0);
-			}
+		if ((dx != 0) || (dy != 0)) {
+			queue_uinput(EV_REL, REL_X, dx);
+			queue_uinput(EV_REL, REL_Y, dy);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
+		}
+		if (dz != 0) {
+			queue_uinput(EV_REL, REL_WHEEL, dz);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
+		}
+		if (buttp & BUTTON1) {
+			queue_uinput(EV_KEY, BTN_LEFT, 1);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
+		}
+		if (buttr & BUTTON1) {
+			queue_uinput(EV_KEY, BTN_LEFT, 0);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
+		}
+		if (buttp & BUTTON2) {
+			queue_uinput(EV_KEY, BTN_MIDDLE, 1);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
+		}
+		if (buttr & BUTTON2) {
+			queue_uinput(EV_KEY, BTN_MIDDLE, 0);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
+		}
+		if (buttp & BUTTON3) {
+			queue_uinput(EV_KEY, BTN_RIGHT, 1);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
 		}
+		if (buttr & BUTTON3) {
+			queue_uinput(EV_KEY, BTN_RIGHT, 0);
+			queue_uinput(EV_SYN, SYN_REPORT, 0);
+		}
+		flush_uinput();
 	}
 #endif
 }
 
+/** The acceleration factor for a repeat count. */
+int acceleration(int rep)
+{
+	if (rep < ms.acc_start)
+		return 1;
+	if (rep * ms.acc_fak >= ms.acc_max)
+		return ms.acc_max;
+	return rep * ms.acc_fak;
+}
+
+void msend(int dx, int dy, int dz, int rep, int buttp, int buttr)
+{
+	int f = acceleration(rep);
+	int i;
+
+	for (i = 0; i < f; i++)
+		mwrite(dx, dy, dz, buttp, buttr);
+}
+
+/*
+ * Accelerated pointer motion is not written in a burst for each IR
+ * repeat. It is spread over the time until the next repeat is expected,
+ * one packet for each MOTION_FRAME, so the pointer moves smoothly.
+ * The total distance is the same.
+ */
+static int motion_pending[3];           /* dx, dy, dz not yet written */
+static struct timeval motion_end;       /* When pending should be done */
+static struct timeval motion_next;      /* Next frame */
+static struct timeval motion_last;      /* Last mouse_move() */
+
+static long usecs(const struct timeval* tv)
+{
+	return tv->tv_sec * 1000000L + tv->tv_usec;
+}
+
+static int motion_active(void)
+{
+	return motion_pending[0] || motion_pending[1] || motion_pending[2];
+}
+
+/** Clamp v to what fits in a packet. */
+static int packet_value(int v)
+{
+	return v > 127 ? 127 : v < -127 ? -127 : v;
+}
+
+/** Write the part of the pending motion due until now. */
+static void motion_frame(const struct timeval* now)
+{
+	long left = usecs(&motion_end) - usecs(now);
+	int step[3];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (left <= MOTION_FRAME)
+			step[i] = motion_pending[i];
+		else
+			step[i] = (long)motion_pending[i] * MOTION_FRAME / left;
+		motion_pending[i] -= step[i];
+	}
+	while (step[0] || step[1] || step[2]) {
+		int dx = packet_value(step[0]);
+		int dy = packet_value(step[1]);
+		int dz = packet_value(step[2]);
+
+		mwrite(dx, dy, dz, 0, 0);
+		step[0] -= dx;
+		step[1] -= dy;
+		step[2] -= dz;
+	}
+	motion_next.tv_sec = now->tv_sec;
+	motion_next.tv_usec = now->tv_usec + MOTION_FRAME;
+	if (motion_next.tv_usec >= 1000000) {
+		motion_next.tv_sec++;
+		motion_next.tv_usec -= 1000000;
+	}
+}
+
+/** Write a due motion frame, return ms until the next one or -1. */
+int motion_update(void)
+{
+	struct timeval now;
+	long wait;
+
+	if (!motion_active())
+		return -1;
+	get_monotonic_time(&now);
+	wait = usecs(&motion_next) - usecs(&now);
+	if (wait <= 0) {
+		motion_frame(&now);
+		if (!motion_active())
+			return -1;
+		wait = MOTION_FRAME;
+	}
+	return (wait + 999) / 1000;
+}
+
+/** Add motion to be written until the next repeat is expected. */
+static void motion_add(int dx, int dy, int dz, int rep)
+{
+	struct timeval now;
+	long gap = 0;           /* A new press moves at once. */
+	int idle = !motion_active();
+
+	get_monotonic_time(&now);
+	if (rep > 0) {
+		gap = usecs(&now) - usecs(&motion_last);
+		if (gap > MOTION_MAX_GAP || gap < MOTION_FRAME)
+			gap = MOTION_GAP;
+	}
+	motion_last = now;
+	motion_end.tv_sec = now.tv_sec + gap / 1000000;
+	motion_end.tv_usec = now.tv_usec + gap % 1000000;
+	if (motion_end.tv_usec >= 1000000) {
+		motion_end.tv_sec++;
+		motion_end.tv_usec -= 1000000;
+	}
+	motion_pending[0] += dx;
+	motion_pending[1] += dy;
+	motion_pending[2] += dz;
+	if (idle || gap == 0)
+		/* No frame is scheduled, or the motion is due now. */
+		motion_frame(&now);
+}
+
 void mouse_move(int dx, int dy, int dz, int rep)
 {
-	msend(dx, dy, dz, rep, 0, 0);
+	int f = acceleration(rep);
+
+	motion_add(dx * f, dy * f, dz * f, rep);
 }
 
 void mouse_button(int down, int up, int rep)
@@ -476,9 +701,9 @@ void mouse_circle(int r, int dirx, int diry)
 				y--;
 				incY -= 2;
 				d -= incY;
-				mouse_move(dirx * dd[i], diry * dd[(i + 8 - 6) % 8], 0, 0);
+				msend(dirx * dd[i], diry * dd[(i + 8 - 6) % 8], 0, 0, 0, 0);
 			} else {
-				mouse_move(dirx * dd[(i + 8 - 1) % 8], diry * dd[(i + 8 - 7) % 8], 0, 0);
+				msend(dirx * dd[(i + 8 - 1) % 8], diry * dd[(i + 8 - 7) % 8], 0, 0, 0, 0);
 			}
 			x++;
 			incX += 2;
@@ -504,23 +729,12 @@ void deactivate(void)
 
 void mouse_conv(int rep, char* button, char* remote)
 {
+	static tm_list_t matches;
 	struct trans_mouse* tm;
-	int found = 0;
 
-	tm = tm_first;
-	while (tm != NULL) {
-		if (tm->tm_remote != ALL) {
-			if (strcasecmp(remote, tm->tm_remote) != 0) {
-				tm = tm->tm_next;
-				continue;
-			}
-		}
-		if (tm->tm_button != ALL) {
-			if (strcasecmp(button, tm->tm_button) != 0) {
-				tm = tm->tm_next;
-				continue;
-			}
-		}
+	find_tm(&matches, remote, button);
+	for (auto it = matches.begin(); it != matches.end(); ++it) {
+		tm = *it;
 		if (tm->tm_directive == mouse_activate) {
 			if (ms.active == 0 && ms.always_active == 0)
 				activate();
@@ -577,10 +791,8 @@ void mouse_conv(int rep, char* button, char* remote)
 				}
 			}
 		}
-		found = 1;
-		tm = tm->tm_next;
 	}
-	if (found == 0)
+	if (matches.empty())
 		if (ms.active == 1 && ms.always_active == 0 && ms.toggle_active == 0)
 			deactivate();
 }
@@ -728,6 +940,7 @@ struct trans_mouse* read_config(FILE* fd)
 		tm_new->tm_remote = remote;
 		tm_new->tm_button = button;
 		tm_new->tm_directive = d;
+		tm_new->tm_line = line;
 		if (tm_list == NULL) {
 			tm_list = tm_new;
 			tm_last = tm_new;
@@ -824,43 +1037,57 @@ void loop(void)
 {
 	ssize_t len = 0;
 	char buffer[PACKET_SIZE + 1];
-	int rep, ret;
-	char button[PACKET_SIZE + 1];
-	char remote[PACKET_SIZE + 1];
+	size_t used = 0;
+	struct code_line parsed;
+	struct pollfd pfd;
 	char* end;
-	int end_len = 0;
 	sigset_t block;
+	int r;
 
 	sigemptyset(&block);
 	sigaddset(&block, SIGHUP);
-	buffer[0] = 0;
 	while (1) {
 		if (hup) {
 			dohup();
 			hup = 0;
 		}
-		if (strchr(buffer, '\n') == NULL) {
+		end = (char*)memchr(buffer, '\n', used);
+		if (end == NULL) {
+			if (used == PACKET_SIZE)
+				used = 0;       /* Drop garbage without newline. */
+			pfd.fd = lircd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
 			sigprocmask(SIG_UNBLOCK, &block, NULL);
-			len = read(lircd, buffer + end_len, PACKET_SIZE - end_len);
+			r = curl_poll(&pfd, 1, motion_update());
+			if (r > 0)
+				len = read(lircd, buffer + used,
+					   PACKET_SIZE - used);
 			sigprocmask(SIG_BLOCK, &block, NULL);
+			if (r == 0)
+				continue;
+			if (r == -1)
+				len = -1;
 			if (len <= 0) {
 				if (len == -1 && errno == EINTR)
 					continue;
 				raise(SIGTERM);
+				continue;
 			}
-		}
-		buffer[len + end_len] = 0;
-		ret = sscanf(buffer, "%*x %x %s %s\n", &rep, button, remote);
-		end = strchr(buffer, '\n');
-		if (end == NULL) {
-			end_len = 0;
+			used += len;
 			continue;
 		}
-		end++;
-		end_len = strlen(end);
-		memmove(buffer, end, end_len + 1);
-		if (ret == 3)
-			mouse_conv(rep, button, remote);
+		if (code_line_parse(buffer, end - buffer, &parsed) == 1) {
+			/* Both are followed by a blank or the newline. */
+			buffer[parsed.button + parsed.button_len - buffer] = '\0';
+			buffer[parsed.remote + parsed.remote_len - buffer] = '\0';
+			mouse_conv(parsed.reps,
+				   buffer + (parsed.button - buffer),
+				   buffer + (parsed.remote - buffer));
+		}
+		used -= end + 1 - buffer;
+		memmove(buffer, end + 1, used);
+		motion_update();
 	}
 }
 
@@ -942,6 +1169,7 @@ int main(int argc, char** argv)
 		fprintf(stderr, "%s: reading of config file failed\n", progname);
 		exit(EXIT_FAILURE);
 	} else {
+		build_tm_index();
 		ms = new_ms;
 	}
 
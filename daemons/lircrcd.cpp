@@ -31,8 +31,14 @@
 #include <sys/types.h>
 #include <syslog.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <string>
 #include <deque>
+#include <utility>
+#include <vector>
 
 #include "lirc_client.h"
 #include "lirc/lirc_log.h"
@@ -56,7 +62,6 @@ struct event_info {
 struct client_data {
 	int			fd;
 	char*			ident_string;
-	std::deque<std::string> pending_codes;
 	std::deque<std::string> pending_strings;
 	std::string             last_code;
 };
@@ -66,21 +71,19 @@ struct protocol_directive {
 	int (*function)(int fd, char* message, char* arguments);
 };
 
-struct pfd_byname{
-	struct pollfd sockfd;
-	struct pollfd clis[MAX_CLIENTS];
-};
-
 
 static int code_func(int fd, char* message, char* arguments);
+static int codes_func(int fd, char* message, char* arguments);
 static int ident_func(int fd, char* message, char* arguments);
 static int getmode_func(int fd, char* message, char* arguments);
 static int setmode_func(int fd, char* message, char* arguments);
 static int send_result(int fd, char* message, const char* result);
+static int send_data(int fd, char* message, int lines, const char* data);
 static int send_success(int fd, char* message);
 
 const struct protocol_directive directives[] = {
 	{ "CODE",    code_func	  },
+	{ "CODES",   codes_func	  },
 	{ "IDENT",   ident_func	  },
 	{ "GETMODE", getmode_func },
 	{ "SETMODE", setmode_func },
@@ -114,6 +117,8 @@ static sig_atomic_t term = 0;
 static int termsig;
 static int clin = 0;
 static struct client_data clis[MAX_CLIENTS];
+/** Index in clis[] by client fd, -1 for unused fds. */
+static std::vector<int> client_index;
 
 static int daemonized = 0;
 
@@ -124,15 +129,120 @@ static int send_error(int fd, char* message, const char* format_str, ...);
 
 static int get_client_index(int fd)
 {
+	if (fd < 0 || fd >= (int)client_index.size())
+		/* shouldn't ever happen */
+		return -1;
+	return client_index[fd];
+}
+
+
+/*
+ * The main loop waits on a persistent set of the listening socket and the
+ * client fds, updated as clients come and go. On Linux it's an epoll
+ * instance, elsewhere a pollfd array handed to curl_poll().
+ */
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static int epoll_fd = -1;
+
+
+static int poll_init(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		log_perror_err("Cannot create epoll instance");
+		return 0;
+	}
+	return 1;
+}
+
+
+static int poll_add(int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+
+static void poll_remove(int fd)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+
+/** Wait for input, store the ready fds in ready, return count or -1. */
+static int poll_wait(int* ready, int max)
+{
+	struct epoll_event events[MAX_CLIENTS + 1];
 	int i;
+	int n;
 
-	for (i = 0; i < clin; i++)
-		if (fd == clis[i].fd)
-			return i;
-	/* shouldn't ever happen */
-	return -1;
+	if (max > MAX_CLIENTS + 1)
+		max = MAX_CLIENTS + 1;
+	n = epoll_wait(epoll_fd, events, max, -1);
+	for (i = 0; i < n; i++)
+		ready[i] = events[i].data.fd;
+	return n;
+}
+
+#else   /* HAVE_SYS_EPOLL_H */
+
+static struct pollfd pollfds[MAX_CLIENTS + 1];
+static int pollfd_count = 0;
+
+
+static int poll_init(void)
+{
+	return 1;
+}
+
+
+static int poll_add(int fd)
+{
+	if (pollfd_count >= MAX_CLIENTS + 1)
+		return 0;
+	pollfds[pollfd_count].fd = fd;
+	pollfds[pollfd_count].events = POLLIN;
+	pollfds[pollfd_count].revents = 0;
+	pollfd_count++;
+	return 1;
+}
+
+
+static void poll_remove(int fd)
+{
+	int i;
+
+	for (i = 0; i < pollfd_count; i++) {
+		if (pollfds[i].fd == fd) {
+			pollfds[i] = pollfds[--pollfd_count];
+			return;
+		}
+	}
+}
+
+
+static int poll_wait(int* ready, int max)
+{
+	int i;
+	int n = 0;
+
+	if (curl_poll(pollfds, pollfd_count, -1) == -1)
+		return -1;
+	for (i = 0; i < pollfd_count && n < max; i++)
+		if (pollfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+			ready[n++] = pollfds[i].fd;
+	return n;
 }
 
+#endif  /* HAVE_SYS_EPOLL_H */
+
+
 /* cut'n'paste from fileutils-3.16: */
 
 #define isodigit(c) ((c) >= '0' && (c) <= '7')
@@ -233,6 +343,8 @@ static void nolinger(int sock)
 
 static void remove_client(int i)
 {
+	poll_remove(clis[i].fd);
+	client_index[clis[i].fd] = -1;
 	shutdown(clis[i].fd, 2);
 	close(clis[i].fd);
 	if (clis[i].ident_string)
@@ -240,9 +352,13 @@ static void remove_client(int i)
 
 	log_trace("removed client");
 
+	/* Move the last client into the hole. */
 	clin--;
-	for (; i < clin; i++)
-		clis[i] = clis[i + 1];
+	if (i != clin) {
+		clis[i] = std::move(clis[clin]);
+		client_index[clis[i].fd] = i;
+	}
+	clis[clin] = client_data();
 }
 
 void add_client(int sock)
@@ -270,7 +386,15 @@ void add_client(int sock)
 	flags = fcntl(fd, F_GETFL, 0);
 	if (flags != -1)
 		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-        log_trace2( "accepted new client");
+	if (!poll_add(fd)) {
+		log_perror_err("Cannot watch new client");
+		close(fd);
+		return;
+	}
+	log_trace2("accepted new client");
+	if (fd >= (int)client_index.size())
+		client_index.resize(fd + 1, -1);
+	client_index[fd] = clin;
 	clis[clin].fd = fd;
 	clis[clin].ident_string = NULL;
 	clin++;
@@ -348,54 +472,107 @@ opensocket_failed:
 }
 
 
-static int code_func(int fd, char* message, char* arguments)
+/** Send and remove the first pending string of client. */
+static int send_pending(struct client_data* client, char* message)
 {
-	int index;
+	std::string s = std::move(client->pending_strings.front());
 
-	if (arguments == NULL)
-		return send_error(fd, message, "protocol error\n");
-	index = get_client_index(fd);
-	if (index == -1)
-		return send_error(fd, message, "identify yourself first!\n");
-	log_trace2("%s asking for code -%s-", clis[index].ident_string, arguments);
+	client->pending_strings.pop_front();
+	return send_result(client->fd, message, s.c_str());
+}
 
-	if (clis[index].last_code == arguments) {
-		// client checking for more strings
-		if (!clis[index].pending_strings.empty()) {
-			std::string s = clis[index].pending_strings.front();
-			clis[index].pending_strings.pop_front();
-			return send_result(fd, message, s.c_str());
-		} else {
-			clis[index].last_code = "A never used code";
-			return send_success(fd, message);
-		}
-	}
-	clis[index].last_code = arguments;
-	clis[index].pending_codes.push_back(arguments);
 
-	const char* const_code = clis[index].pending_codes.front().c_str();
-	char* var_code = strdup(const_code);
-	char* prog = clis[index].ident_string;
+/** Translate code into the pending strings of client, 0 on errors. */
+static int translate(struct client_data* client, const char* code)
+{
+	char* var_code = strdup(code);
+	char* prog = client->ident_string;
 	char* s;
 	int r;
 
-	clis[index].pending_codes.pop_front();
+	client->last_code = code;
+	client->pending_strings.clear();
+	if (var_code == NULL)
+		return 0;
 	while (true) {
 		r = lirc_code2charprog(config, var_code, &s, &prog);
 		if ( r != 0 || s == NULL || *s == '\0')
 			break;
-		clis[index].pending_strings.push_back(s);
+		client->pending_strings.emplace_back(s);
 	}
 	free(var_code);
-	if ( r != 0 ) {
+	return r == 0;
+}
+
+
+static int code_func(int fd, char* message, char* arguments)
+{
+	struct client_data* client;
+	int index;
+
+	if (arguments == NULL)
+		return send_error(fd, message, "protocol error\n");
+	index = get_client_index(fd);
+	if (index == -1)
+		return send_error(fd, message, "identify yourself first!\n");
+	client = &clis[index];
+	log_trace2("%s asking for code -%s-", client->ident_string, arguments);
+
+	if (client->last_code == arguments) {
+		// client checking for more strings
+		if (!client->pending_strings.empty())
+			return send_pending(client, message);
+		client->last_code = "A never used code";
+		return send_success(fd, message);
+	}
+	if (!translate(client, arguments))
 		return send_error(fd, message, "Cannor decode: %s", arguments);
-	} else if (clis[index].pending_strings.size() == 0) {
+	else if (client->pending_strings.empty())
 		return send_success(fd, message);
-	} else {
-		std::string s = clis[index].pending_strings.front();
-		clis[index].pending_strings.pop_front();
-		return send_result(fd, message, s.c_str());
+	return send_pending(client, message);
+}
+
+
+/**
+ * Like CODE, but reply with all strings in one packet. The first data
+ * line is the number of strings which did not fit, left for CODE.
+ */
+static int codes_func(int fd, char* message, char* arguments)
+{
+	struct client_data* client;
+	std::string data;
+	char count[16];
+	int index;
+	int n = 0;
+
+	if (arguments == NULL)
+		return send_error(fd, message, "protocol error\n");
+	index = get_client_index(fd);
+	if (index == -1)
+		return send_error(fd, message, "identify yourself first!\n");
+	client = &clis[index];
+	log_trace2("%s asking for codes -%s-", client->ident_string, arguments);
+
+	if (!translate(client, arguments))
+		return send_error(fd, message, "Cannor decode: %s", arguments);
+	/* The client keeps the reply in PACKET_SIZE bytes. */
+	while (!client->pending_strings.empty()) {
+		const std::string& s = client->pending_strings.front();
+
+		snprintf(count, sizeof(count), "%d",
+			 (int)client->pending_strings.size());
+		if (strlen(count) + data.size() + s.size() + 1 >= PACKET_SIZE)
+			break;
+		data += s;
+		data += "\n";
+		client->pending_strings.pop_front();
+		n++;
 	}
+	if (client->pending_strings.empty())
+		client->last_code = "A never used code";
+	snprintf(count, sizeof(count), "%d\n",
+		 (int)client->pending_strings.size());
+	return send_data(fd, message, n + 1, (count + data).c_str());
 }
 
 
@@ -459,6 +636,24 @@ static int send_result(int fd, char* message, const char* result)
 }
 
 
+/** Send a reply with lines data lines, each ending with a newline. */
+static int send_data(int fd, char* message, int lines, const char* data)
+{
+	char count[16];
+
+	snprintf(count, sizeof(count), "%d\n", lines);
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN]) &&
+	      write_socket_len(fd, message) &&
+	      write_socket_len(fd, protocol_string[P_SUCCESS]) &&
+	      write_socket_len(fd, protocol_string[P_DATA]) &&
+	      write_socket_len(fd, count) &&
+	      write_socket_len(fd, data) &&
+	      write_socket_len(fd, protocol_string[P_END])))
+		return 0;
+	return 1;
+}
+
+
 static int send_success(int fd, char* message)
 {
 	if (!(write_socket_len(fd, protocol_string[P_BEGIN]) &&
@@ -579,57 +774,48 @@ skip:
 
 static void loop(int sockfd)
 {
-	static const int POLLFDS_SIZE =
-		sizeof(struct pfd_byname) / sizeof(struct pollfd);
-	union {
-		struct pfd_byname byname;
-		struct pollfd byindex[POLLFDS_SIZE];
-	} poll_fds;
+	int ready[MAX_CLIENTS + 1];
+	int accept_ready;
+	int index;
 	int i;
-	int ret;
+	int n;
 
+	if (!poll_init() || !poll_add(sockfd)) {
+		log_perror_err("loop: cannot watch socket");
+		return;
+	}
 	while (1) {
-		do {
-			/* handle signals */
-			if (term) {
-				log_notice("caught signal");
-				return;
-			}
-			memset(&poll_fds, 0, sizeof(poll_fds));
-			for (i = 0; i < POLLFDS_SIZE; i += 1)
-				poll_fds.byindex[i].fd = -1;
-			poll_fds.byname.sockfd.fd = sockfd;
-			poll_fds.byname.sockfd.events = POLLIN;
-
-			for (i = 0; i < clin; i++) {
-				poll_fds.byname.clis[i].fd = clis[i].fd;
-				poll_fds.byname.clis[i].events = POLLIN;
-			}
-			log_trace2("poll");
-			ret = curl_poll((struct pollfd*) &poll_fds.byindex,
-				         POLLFDS_SIZE,
-				         0);
-			if (ret == -1 && errno != EINTR) {
-				log_perror_err("loop: curl_poll() failed");
+		/* handle signals */
+		if (term) {
+			log_notice("caught signal");
+			return;
+		}
+		log_trace2("poll");
+		n = poll_wait(ready, MAX_CLIENTS + 1);
+		if (n == -1) {
+			if (errno != EINTR) {
+				log_perror_err("loop: poll failed");
 				raise(SIGTERM);
+			}
+			continue;
+		}
+		/* Clients first, a new client might reuse a removed fd. */
+		accept_ready = 0;
+		for (i = 0; i < n; i++) {
+			if (ready[i] == sockfd) {
+				accept_ready = 1;
 				continue;
 			}
-		} while (ret == -1 && errno == EINTR);
-
-		for (i = 0; i < clin; i++) {
-			if (poll_fds.byname.clis[i].revents & POLLIN) {
-				poll_fds.byname.clis[i].revents	= 0;
-				if (get_command(clis[i].fd) == 0) {
-					remove_client(i);
-					i--;
-					if (clin == 0) {
-						log_info("last client disconnected, shutting down");
-						return;
-					}
-				}
+			index = get_client_index(ready[i]);
+			if (index == -1 || get_command(ready[i]) != 0)
+				continue;
+			remove_client(index);
+			if (clin == 0) {
+				log_info("last client disconnected, shutting down");
+				return;
 			}
 		}
-		if (poll_fds.byname.sockfd.revents & POLLIN) {
+		if (accept_ready) {
 			log_trace("registering local client");
 			add_client(sockfd);
 		}
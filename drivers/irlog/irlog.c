@@ -1,17 +1,35 @@
 /**
  *  irlog - logging wrapper for /dev/lirc devices.
  *
+ * Besides the debug logging, all words read from or written to the
+ * logged device are captured with a CLOCK_MONOTONIC timestamp as
+ * struct irlog_record (see irlog.h) in a per device ring of
+ * 'capture_size' records. The ring is read from
+ * <debugfs>/irlog/<minor>/capture, which blocks unless O_NONBLOCK and
+ * supports poll(). When the ring is full new records are dropped, the
+ * source device is never blocked; the drops are counted in
+ * <debugfs>/irlog/<minor>/overflows.
+ *
+ * All words of a single read(2) or write(2) share its timestamp.
  */
 
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/errno.h>
 #include <linux/fcntl.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/ktime.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include "irlog.h"
 
 #define PULSE_BIT       0x01000000
 #define PULSE_MASK      0x00FFFFFF
@@ -26,6 +44,9 @@
 /** Default device logged a. k a. device_to_log parameter. */
 #define CHILD_DEVICE    "/dev/lirc0"
 
+/** Default capture ring size, records. */
+#define CAPTURE_SIZE    4096
+
 
 #define IR_WARN(fmt, args ...) \
 	pr_warn("irlog (%d): " fmt "\n", current->pid, ## args)
@@ -39,11 +60,18 @@
 
 
 const struct file_operations fops;
+const struct file_operations capture_fops;
 
 /** Persistent data structure for each allocated device. */
 struct ir_device {
 	struct file* filp;               /**< logged file */
 	ktime_t start;
+	DECLARE_KFIFO_PTR(capture, struct irlog_record);
+	spinlock_t capture_lock;         /**< Writers of capture, counters */
+	struct mutex capture_read_lock;  /**< Readers of capture */
+	wait_queue_head_t capture_wait;  /**< Readers waiting for records */
+	u64 captured;                    /**< Records added to capture. */
+	u64 overflows;                   /**< Records dropped, ring full. */
 };
 
 
@@ -56,6 +84,12 @@ static bool debug = 1;
 /** Default device to log a. k. a. device_to_log parameter */
 static char* device_to_log = CHILD_DEVICE;
 
+/** Capture ring size in records, 0 disables capture (parameter). */
+static int capture_size = CAPTURE_SIZE;
+
+/** debugfs directory holding the capture files. */
+static struct dentry* debugfs_root;
+
 /** Persistent data for each device. */
 static struct ir_device* ir_devices;
 
@@ -68,14 +102,73 @@ static struct class* class;     /**< /sys/class struct, set by init */
 static bool ir_device_init(struct ir_device* dev, int minor)
 {
 
+	char name[8];
+	struct dentry* dir;
+
 	IR_DEBUG("Loading device %d", minor);
 	memset(dev, 0, sizeof(struct ir_device));
+	spin_lock_init(&dev->capture_lock);
+	mutex_init(&dev->capture_read_lock);
+	init_waitqueue_head(&dev->capture_wait);
+	if (capture_size <= 0)
+		return 1;
+	if (kfifo_alloc(&dev->capture, capture_size, GFP_KERNEL) != 0)
+		return 0;
+	if (IS_ERR_OR_NULL(debugfs_root))
+		return 1;
+	snprintf(name, sizeof(name), "%d", minor);
+	dir = debugfs_create_dir(name, debugfs_root);
+	debugfs_create_file("capture", 0400, dir, dev, &capture_fops);
+	debugfs_create_u64("captured", 0444, dir, &dev->captured);
+	debugfs_create_u64("overflows", 0444, dir, &dev->overflows);
 	return 1;
 }
 
 
 /** Dealloc what ir_device_init() created. */
-static void ir_device_destroy(struct ir_device* d) {}
+static void ir_device_destroy(struct ir_device* d)
+{
+	if (capture_size > 0)
+		kfifo_free(&d->capture);
+}
+
+
+/**
+ * Add the words in user buffer buff to the capture ring, dropping what
+ * does not fit. Never blocks.
+ */
+static void
+capture(struct ir_device* dev, const char __user* buff, ssize_t bytes,
+	__u32 flags)
+{
+	struct irlog_record records[16];
+	__u32 words[16];
+	u64 now = ktime_get_ns();
+	unsigned int added;
+	unsigned int n;
+	unsigned int i;
+
+	if (capture_size <= 0)
+		return;
+	while (bytes >= (ssize_t)sizeof(__u32)) {
+		n = min_t(size_t, bytes / sizeof(__u32), ARRAY_SIZE(words));
+		if (copy_from_user(words, buff, n * sizeof(__u32)) != 0)
+			break;
+		for (i = 0; i < n; i += 1) {
+			records[i].timestamp = now;
+			records[i].sample = words[i];
+			records[i].flags = flags;
+		}
+		spin_lock(&dev->capture_lock);
+		added = kfifo_in(&dev->capture, records, n);
+		dev->captured += added;
+		dev->overflows += n - added;
+		spin_unlock(&dev->capture_lock);
+		buff += n * sizeof(__u32);
+		bytes -= n * sizeof(__u32);
+	}
+	wake_up_interruptible(&dev->capture_wait);
+}
 
 
 
@@ -176,6 +269,8 @@ irlog_read(struct file* file, char* buff, size_t length, loff_t* ppos)
 	int delta;
 
 	r = file_read(dev->filp, buff, length, ppos);
+	if (r > 0)
+		capture(dev, buff, r, 0);
 	ints[0] = '\0';
 	for (i = 0; i < r && i < 16; i += 4) {
 		memcpy(&u32, &buff[i], 4);
@@ -204,6 +299,8 @@ irlog_write(struct file* file, const char* buff, size_t length, loff_t* ppos)
 	int i;
 
 	r = file_write(dev->filp, buff, length, ppos);
+	if (r > 0)
+		capture(dev, buff, r, IRLOG_TX);
 	delta = ktime_to_ns(ktime_sub(ktime_get(), dev->start)) / 1000;
 	IR_DEBUG("[%d] %d bytes of %d (%d ints) written",
 		 delta, r, (int) length, (int) length / 4);
@@ -243,6 +340,46 @@ static unsigned int irlog_poll(struct file* file, poll_table* wait)
 }
 
 
+/** read(2) of the capture file: whole records, oldest first. */
+static ssize_t
+capture_read(struct file* file, char __user* buff, size_t length,
+	     loff_t* ppos)
+{
+	struct ir_device* const dev = (struct ir_device*)file->private_data;
+	unsigned int copied;
+	int r;
+
+	if (length < sizeof(struct irlog_record))
+		return -EINVAL;
+	if (mutex_lock_interruptible(&dev->capture_read_lock))
+		return -ERESTARTSYS;
+	while (kfifo_is_empty(&dev->capture)) {
+		mutex_unlock(&dev->capture_read_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(dev->capture_wait,
+					     !kfifo_is_empty(&dev->capture)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&dev->capture_read_lock))
+			return -ERESTARTSYS;
+	}
+	length -= length % sizeof(struct irlog_record);
+	r = kfifo_to_user(&dev->capture, buff, length, &copied);
+	mutex_unlock(&dev->capture_read_lock);
+	return r != 0 ? r : copied;
+}
+
+
+/** select() and poll() of the capture file. */
+static unsigned int capture_poll(struct file* file, poll_table* wait)
+{
+	struct ir_device* const dev = (struct ir_device*)file->private_data;
+
+	poll_wait(file, &dev->capture_wait, wait);
+	return kfifo_is_empty(&dev->capture) ? 0 : POLLIN | POLLRDNORM;
+}
+
+
 /** Module load. */
 int irlog_init(void)
 {
@@ -251,6 +388,7 @@ int irlog_init(void)
 	int i;
 
 	IR_DEBUG("start loading");
+	debugfs_root = debugfs_create_dir(DEVICENAME, NULL);
 	ir_devices = kmalloc_array(nr_of_devices,
 				   sizeof(struct ir_device),
 				   GFP_KERNEL);
@@ -291,6 +429,7 @@ void irlog_exit(void)
 {
 	int i;
 
+	debugfs_remove_recursive(debugfs_root);
 	for (i = 0; i < nr_of_devices; i += 1) {
 		ir_device_destroy(&ir_devices[i]);
 		device_destroy(class, MKDEV(dev_major, i));
@@ -314,6 +453,15 @@ const struct file_operations fops = {
 };
 
 
+const struct file_operations capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= capture_read,
+	.poll		= capture_poll,
+	.llseek		= no_llseek,
+};
+
+
 MODULE_AUTHOR("Alec Leamas <leamas at gmail dot com>");
 MODULE_DESCRIPTION("Simple logging character device wrapper");
 MODULE_LICENSE("GPL");
@@ -327,5 +475,9 @@ MODULE_PARM_DESC(nr_of_devices, "Number of minor devices");
 module_param(device_to_log, charp, S_IRUGO);
 MODULE_PARM_DESC(device_to_log, "The device logged and wrapped by irlog");
 
+module_param(capture_size, int, S_IRUGO);
+MODULE_PARM_DESC(capture_size,
+		 "Capture ring size, records (default 4096, 0: disabled)");
+
 module_init(irlog_init);
 module_exit(irlog_exit);
@@ -0,0 +1,18 @@
+/** Binary capture records read from the irlog debugfs capture files. */
+
+#ifndef IRLOG_H
+#define IRLOG_H
+
+#include <linux/types.h>
+
+/** irlog_record.flags: sample was written (sent) rather than read. */
+#define IRLOG_TX        0x00000001
+
+/** One captured 4-byte word as read or written, in host byte order. */
+struct irlog_record {
+	__u64 timestamp;        /**< CLOCK_MONOTONIC ns of read/write. */
+	__u32 sample;           /**< The word, typically a mode2 lirc_t. */
+	__u32 flags;            /**< IRLOG_TX or 0. */
+};
+
+#endif /* IRLOG_H */
@@ -16,12 +16,15 @@
  *    - If the readers goes away during write(2) this fifo blocks
  *      until a reader is back instead of generating a EPIPE error.
  *    - Some extra ioctl commands for testing are in irpipe.h
- *    - No asynchronous mechanisms.
- *    - The select()/poll() support is only implemented on the
- *      reading side. Writing will always block.
+ *    - No asynchronous (SIGIO) notification.
  *    - The device does not report itself as a fifo when using
  *      stat().
- *    - Read buffer needs to be at least 2048 bytes (why?)
+ *
+ * Data is copied directly between the user buffers and a ring of
+ * 'buffsize' bytes, so reads and writes of any size up to the buffer
+ * size are a single copy. A blocking write returns when all data is
+ * written, a O_NONBLOCK write writes what fits or returns EAGAIN.
+ * poll() reports POLLOUT when there is a reader and space in the ring.
  *
  * The LIRC attributes reflected by the related ioctls are reset when
  * the device is opened for write.
@@ -44,6 +47,7 @@
 #include <linux/fs.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
+#include <linux/mutex.h>
 #include <linux/poll.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
@@ -86,7 +90,7 @@ const struct file_operations fops;
 
 /** Persistent data structure for each allocated device. */
 struct ir_device {
-	spinlock_t		mutex;		  /**< Fifo guard. */
+	struct mutex		mutex;		  /**< Fifo guard. */
 	char*			fifo;		  /**< Main buffer area. */
 	unsigned int		tail;		  /**< Next byte to fetch */
 	unsigned int		head;		  /**< Next pos to fill */
@@ -141,36 +145,43 @@ static bool fifo_have_data(struct ir_device* device)
 
 
 /**
- * Put at most count bytes from src into the fifo, return bytes written.
- * Needs locked mutex
+ * Copy at most count bytes from user buffer src into the fifo, return
+ * bytes written or -EFAULT. Needs locked mutex.
  */
-static size_t fifo_put(struct ir_device* d, const char* src, size_t count)
+static ssize_t fifo_put(struct ir_device* d,
+			const char __user* src, size_t count)
 {
-	int i;
+	size_t first;
 
 	count = MIN(count, fifo_get_space(d));
-	for (i = 0; i < count; i += 1) {
-		d->fifo[d->head] = *src++;
-		d->head = (d->head + 1) % buffsize;
-	}
+	first = MIN(count, buffsize - d->head);
+	if (copy_from_user(d->fifo + d->head, src, first) != 0)
+		return -EFAULT;
+	if (count > first
+	    && copy_from_user(d->fifo, src + first, count - first) != 0)
+		return -EFAULT;
+	d->head = (d->head + count) % buffsize;
 	atomic_add(count, &d->size);
 	return count;
 }
 
 
 /**
- * Get at most count bytes from fifo into dest buffer, return bytes read.
- * Needs locked mutex.
+ * Copy at most count bytes from fifo into user buffer dest, return bytes
+ * read or -EFAULT. Needs locked mutex.
  */
-static size_t fifo_get(struct ir_device* d, char* dest, size_t count)
+static ssize_t fifo_get(struct ir_device* d, char __user* dest, size_t count)
 {
-	int i;
+	size_t first;
 
 	count = MIN(count, atomic_read(&d->size));
-	for (i = 0; i < count; i += 1) {
-		*dest++ = d->fifo[d->tail];
-		d->tail = (d->tail + 1) % buffsize;
-	}
+	first = MIN(count, buffsize - d->tail);
+	if (copy_to_user(dest, d->fifo + d->tail, first) != 0)
+		return -EFAULT;
+	if (count > first
+	    && copy_to_user(dest + first, d->fifo, count - first) != 0)
+		return -EFAULT;
+	d->tail = (d->tail + count) % buffsize;
 	atomic_sub(count, &d->size);
 	return count;
 }
@@ -216,7 +227,7 @@ static bool ir_device_init(struct ir_device* d, int minor)
 		return 0;
 	atomic_set(&d->readers, 0);
 	atomic_set(&d->writers, 0);
-	spin_lock_init(&d->mutex);
+	mutex_init(&d->mutex);
 	init_waitqueue_head(&d->wait_for_reader);
 	init_waitqueue_head(&d->wait_for_writer);
 	ir_device_reset(d, minor);
@@ -250,11 +261,11 @@ static void cond_wait(bool			(*cond)(struct ir_device*),
 static int open_read_write(struct ir_device* dev, struct file* filp, int minor)
 {
 	IR_DEBUG("open_read/write, size: %d", atomic_read(&dev->size));
-	spin_lock(&dev->mutex);
+	mutex_lock(&dev->mutex);
 	ir_device_reset(dev, minor);
 	atomic_inc(&dev->writers);
 	atomic_inc(&dev->readers);
-	spin_unlock(&dev->mutex);
+	mutex_unlock(&dev->mutex);
 	wake_up_interruptible(&dev->wait_for_reader);
 	return 0;
 }
@@ -267,9 +278,9 @@ static int open_write(struct ir_device* dev, struct file* filp, int minor)
 		 atomic_read(&dev->readers),
 		 atomic_read(&dev->size));
 	atomic_inc(&dev->writers);
-	spin_lock(&dev->mutex);
+	mutex_lock(&dev->mutex);
 	while (!have_readers(dev)) {
-		spin_unlock(&dev->mutex);
+		mutex_unlock(&dev->mutex);
 		if (filp->f_flags & O_NONBLOCK)
 			return -ENXIO;
 		cond_wait(have_readers, &dev->wait_for_reader, dev);
@@ -277,10 +288,10 @@ static int open_write(struct ir_device* dev, struct file* filp, int minor)
 			IR_DEBUG("signals pending on open - ERESTARTSYS");
 			return -ERESTARTSYS;
 		}
-		spin_lock(&dev->mutex);
+		mutex_lock(&dev->mutex);
 	}
 	ir_device_reset(dev, minor);
-	spin_unlock(&dev->mutex);
+	mutex_unlock(&dev->mutex);
 	wake_up_interruptible(&dev->wait_for_writer);
 	IR_DEBUG("device opened for write");
 	return 0;
@@ -347,17 +358,24 @@ static int irpipe_close(struct inode* inode, struct file* filp)
 }
 
 
+/** True if the fifo has space and a reader (unlocked). */
+static bool can_write(struct ir_device* device)
+{
+	return fifo_have_space(device) && have_readers(device);
+}
+
+
 /** kernel side of userspace read(2). */
 static ssize_t
-irpipe_read(struct file* filp, char* buff, size_t length, loff_t* ppos)
+irpipe_read(struct file* filp, char __user* buff, size_t length,
+	    loff_t* ppos)
 {
 	struct ir_device* const dev = (struct ir_device*)filp->private_data;
-	char kbuff[buffsize];
-	int bytes;
+	ssize_t bytes;
 
-	spin_lock(&dev->mutex);
+	mutex_lock(&dev->mutex);
 	while (!fifo_have_data(dev) || !have_writers(dev)) {
-		spin_unlock(&dev->mutex);
+		mutex_unlock(&dev->mutex);
 		if (atomic_read(&dev->writers) <= 0)
 			return 0;
 		if (filp->f_flags & O_NONBLOCK)
@@ -367,45 +385,50 @@ irpipe_read(struct file* filp, char* buff, size_t length, loff_t* ppos)
 			IR_DEBUG("Signals pending on read- ERESTARTSYS");
 			return -ERESTARTSYS;
 		}
-		spin_lock(&dev->mutex);
+		mutex_lock(&dev->mutex);
 	}
-	bytes = fifo_get(dev, kbuff, length);
-	spin_unlock(&dev->mutex);
-	bytes -= copy_to_user(buff, kbuff, bytes);
+	bytes = fifo_get(dev, buff, length);
+	mutex_unlock(&dev->mutex);
 	wake_up_interruptible(&dev->wait_for_reader);
 	return bytes;
 }
 
 
-/** Kernel side of userspace write(2). */
+/**
+ * Kernel side of userspace write(2). Blocks until all data is written
+ * unless O_NONBLOCK, in which case what fits is written.
+ */
 static ssize_t
-irpipe_write(struct file* filp, const char* buff, size_t length, loff_t* ppos)
+irpipe_write(struct file* filp, const char __user* buff, size_t length,
+	     loff_t* ppos)
 {
 	struct ir_device* const dev = (struct ir_device*)filp->private_data;
-	char kbuff[buffsize];
-	unsigned int written;
-
-	length = MIN(length, buffsize - 1);
-	length -= copy_from_user(kbuff, buff, length);
-	spin_lock(&dev->mutex);
-	while (!fifo_have_space(dev) || !have_readers(dev)) {
-		spin_unlock(&dev->mutex);
-		if (!have_readers(dev)) {
-			IR_DEBUG("No readers on write: blocking.");
-			cond_wait(have_readers, &dev->wait_for_reader, dev);
+	size_t written = 0;
+	ssize_t r;
+
+	while (written < length) {
+		mutex_lock(&dev->mutex);
+		while (!can_write(dev)) {
+			mutex_unlock(&dev->mutex);
+			if (written > 0)
+				wake_up_interruptible(&dev->wait_for_writer);
+			if (filp->f_flags & O_NONBLOCK)
+				return written > 0 ? written : -EAGAIN;
+			if (!have_readers(dev))
+				IR_DEBUG("No readers on write: blocking.");
+			cond_wait(can_write, &dev->wait_for_reader, dev);
+			if (signal_pending(current)) {
+				IR_DEBUG("Write: signals pending: ERESTARTSYS.");
+				return written > 0 ? written : -ERESTARTSYS;
+			}
+			mutex_lock(&dev->mutex);
 		}
-		if (filp->f_flags & O_NONBLOCK)
-			return -EAGAIN;
-		cond_wait(fifo_have_space, &dev->wait_for_reader, dev);
-		if (signal_pending(current)) {
-			IR_DEBUG("Write: signals pending on write: ERESTARTSYS.");
-			return -ERESTARTSYS;
-		}
-		spin_lock(&dev->mutex);
+		r = fifo_put(dev, buff + written, length - written);
+		mutex_unlock(&dev->mutex);
+		if (r < 0)
+			return written > 0 ? written : r;
+		written += r;
 	}
-	written = fifo_put(dev, kbuff, length);
-	spin_unlock(&dev->mutex);
-
 	wake_up_interruptible(&dev->wait_for_writer);
 	return written;
 }
@@ -419,7 +442,7 @@ long irpipe_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
 	long r = 0;
 
 	IR_DEBUG("Running ioctl cmd %u (0x%x), arg: %lu\n", cmd, cmd, arg);
-	spin_lock(&dev->mutex);
+	mutex_lock(&dev->mutex);
 	switch (cmd) {
 	case FIOQSIZE:
 		r = atomic_read(&dev->size);
@@ -462,7 +485,7 @@ long irpipe_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
 		r = -ENOTTY;
 		break;
 	}
-	spin_unlock(&dev->mutex);
+	mutex_unlock(&dev->mutex);
 	return r;
 }
 
@@ -474,8 +497,11 @@ static unsigned int irpipe_poll(struct file *filp, poll_table *wait)
 	struct ir_device* const dev = (struct ir_device*)filp->private_data;
 
 	poll_wait(filp, &dev->wait_for_writer, wait);
-	if (fifo_have_data(dev))
-		mask = POLLIN | POLLRDNORM;
+	poll_wait(filp, &dev->wait_for_reader, wait);
+	if ((filp->f_mode & FMODE_READ) && fifo_have_data(dev))
+		mask |= POLLIN | POLLRDNORM;
+	if ((filp->f_mode & FMODE_WRITE) && can_write(dev))
+		mask |= POLLOUT | POLLWRNORM;
 	return mask;
 }
 
@@ -488,6 +514,10 @@ int irpipe_init(void)
 	int i;
 
 	IR_DEBUG("start loading");
+	if (buffsize < 2) {
+		IR_WARN("buffsize must be at least 2");
+		return -EINVAL;
+	}
 	ir_devices = kmalloc_array(nr_of_devices,
 				   sizeof(struct ir_device),
 				   GFP_KERNEL);
@@ -559,7 +589,7 @@ module_param(debug, bool, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(debug, " Enable (default off) debug logging");
 
 module_param(buffsize, int, S_IRUGO);
-MODULE_PARM_DESC(buffsize, "Internal buffer size");
+MODULE_PARM_DESC(buffsize, "Ring buffer size, bytes (default 8196)");
 
 module_param(nr_of_devices, int, S_IRUGO);
 MODULE_PARM_DESC(nr_of_devices, "Number of minor devices");
@@ -0,0 +1,257 @@
+/****************************************************************************
+** atom.c ******************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file atom.c
+ * @brief Implements atom.h.
+ *
+ * Two open addressing hash tables: one of exact spellings, giving the
+ * shared copy and its atom, and one of case-folded names, giving the
+ * atom of a new spelling. The strings live in chunks which are never
+ * freed.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "atom.h"
+
+#define ATOM_CHUNK_SIZE         16384
+#define ATOM_TABLE_MIN          256
+
+struct atom_slot {
+	uint32_t	hash;
+	lirc_atom_t	atom;           /**< 0 if the slot is free. */
+	const char*	name;
+};
+
+struct atom_table {
+	struct atom_slot*	slots;
+	uint32_t		size;   /**< A power of two. */
+	uint32_t		used;
+};
+
+struct atom_chunk {
+	struct atom_chunk*	next;
+	size_t			used;
+	char			data[ATOM_CHUNK_SIZE];
+};
+
+static pthread_mutex_t atom_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** By exact spelling, name is the shared copy. */
+static struct atom_table spellings;
+
+/** By case-folded name, name is the first spelling. */
+static struct atom_table atoms;
+
+static struct atom_chunk* chunks = NULL;
+
+
+static uint32_t hash_exact(const char* s)
+{
+	uint32_t h = 2166136261u;       /* FNV-1a */
+
+	for (; *s != '\0'; s++) {
+		h ^= (unsigned char)*s;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+static uint32_t hash_folded(const char* s)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *s != '\0'; s++) {
+		h ^= (unsigned char)tolower((unsigned char)*s);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/** Return the slot of name in t, or the free slot it would go to. */
+static struct atom_slot* table_find(const struct atom_table* t,
+				    const char* name, uint32_t hash,
+				    int folded)
+{
+	struct atom_slot* slot;
+	uint32_t i;
+
+	if (t->size == 0)
+		return NULL;
+	for (i = hash & (t->size - 1); ; i = (i + 1) & (t->size - 1)) {
+		slot = &t->slots[i];
+		if (slot->atom == 0)
+			return slot;
+		if (slot->hash == hash
+		    && (folded ? strcasecmp(slot->name, name)
+			: strcmp(slot->name, name)) == 0)
+			return slot;
+	}
+}
+
+
+/** Make room for one more item in t. 0 if out of memory. */
+static int table_reserve(struct atom_table* t)
+{
+	struct atom_slot* old = t->slots;
+	uint32_t old_size = t->size;
+	uint32_t i;
+	uint32_t j;
+
+	if (2 * (t->used + 1) <= t->size)
+		return 1;
+	t->size = old_size > 0 ? 2 * old_size : ATOM_TABLE_MIN;
+	t->slots = (struct atom_slot*)calloc(t->size, sizeof(*t->slots));
+	if (t->slots == NULL) {
+		t->slots = old;
+		t->size = old_size;
+		return 0;
+	}
+	for (i = 0; i < old_size; i++) {
+		if (old[i].atom == 0)
+			continue;
+		j = old[i].hash & (t->size - 1);
+		while (t->slots[j].atom != 0)
+			j = (j + 1) & (t->size - 1);
+		t->slots[j] = old[i];
+	}
+	free(old);
+	return 1;
+}
+
+
+static const char* store(const char* name)
+{
+	size_t len = strlen(name) + 1;
+	struct atom_chunk* chunk = chunks;
+	char* copy;
+
+	if (len > ATOM_CHUNK_SIZE)
+		return NULL;
+	if (chunk == NULL || ATOM_CHUNK_SIZE - chunk->used < len) {
+		chunk = (struct atom_chunk*)malloc(sizeof(*chunk));
+		if (chunk == NULL)
+			return NULL;
+		chunk->used = 0;
+		chunk->next = chunks;
+		chunks = chunk;
+	}
+	copy = chunk->data + chunk->used;
+	memcpy(copy, name, len);
+	chunk->used += len;
+	return copy;
+}
+
+
+/** Return the slot of name in spellings, adding it if new, or NULL. */
+static struct atom_slot* intern(const char* name)
+{
+	uint32_t hash = hash_exact(name);
+	uint32_t fhash;
+	struct atom_slot* slot;
+	struct atom_slot* fslot;
+	const char* copy;
+
+	slot = table_find(&spellings, name, hash, 0);
+	if (slot != NULL && slot->atom != 0)
+		return slot;
+	if (!table_reserve(&spellings) || !table_reserve(&atoms))
+		return NULL;
+	copy = store(name);
+	if (copy == NULL)
+		return NULL;
+	fhash = hash_folded(name);
+	fslot = table_find(&atoms, name, fhash, 1);
+	if (fslot->atom == 0) {
+		fslot->hash = fhash;
+		fslot->name = copy;
+		fslot->atom = atoms.used + 1;
+		atoms.used++;
+	}
+	slot = table_find(&spellings, name, hash, 0);
+	slot->hash = hash;
+	slot->name = copy;
+	slot->atom = fslot->atom;
+	spellings.used++;
+	return slot;
+}
+
+
+lirc_atom_t lirc_atom_intern(const char* name)
+{
+	lirc_atom_t atom;
+
+	lirc_atom_string(name, &atom);
+	return atom;
+}
+
+
+const char* lirc_atom_string(const char* name, lirc_atom_t* atom)
+{
+	struct atom_slot* slot;
+	const char* copy = NULL;
+
+	pthread_mutex_lock(&atom_lock);
+	slot = intern(name);
+	*atom = 0;
+	if (slot != NULL) {
+		*atom = slot->atom;
+		copy = slot->name;
+	}
+	pthread_mutex_unlock(&atom_lock);
+	return copy;
+}
+
+
+lirc_atom_t lirc_atom_find(const char* name)
+{
+	struct atom_slot* slot;
+	lirc_atom_t atom = 0;
+
+	pthread_mutex_lock(&atom_lock);
+	slot = table_find(&spellings, name, hash_exact(name), 0);
+	if (slot == NULL || slot->atom == 0)
+		slot = table_find(&atoms, name, hash_folded(name), 1);
+	if (slot != NULL)
+		atom = slot->atom;
+	pthread_mutex_unlock(&atom_lock);
+	return atom;
+}
+
+
+size_t lirc_atom_memory(void)
+{
+	const struct atom_chunk* chunk;
+	size_t size;
+
+	pthread_mutex_lock(&atom_lock);
+	size = (spellings.size + atoms.size) * sizeof(struct atom_slot);
+	for (chunk = chunks; chunk != NULL; chunk = chunk->next)
+		size += sizeof(*chunk);
+	pthread_mutex_unlock(&atom_lock);
+	return size;
+}
+
+
+uint32_t lirc_atom_count(void)
+{
+	uint32_t count;
+
+	pthread_mutex_lock(&atom_lock);
+	count = atoms.used;
+	pthread_mutex_unlock(&atom_lock);
+	return count;
+}
@@ -0,0 +1,79 @@
+/****************************************************************************
+** atom.h ******************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file atom.h
+ * @brief Interned remote and button names.
+ * @ingroup private_api
+ *
+ * Names are interned in a process wide table when a configuration is
+ * parsed. Each name gets an atom, a small integer which is the same for
+ * all names equal when compared with strcasecmp(), so lookups compare
+ * integers instead of strings. The table also keeps one copy of each
+ * exact spelling, which configurations held in an arena share instead
+ * of allocating their own.
+ *
+ * The table only grows, names are never removed. It is thread safe.
+ */
+
+#ifndef ATOM_H
+#define ATOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** An interned name, 0 is none. */
+typedef uint32_t lirc_atom_t;
+
+/**
+ * Intern name.
+ *
+ * @return The atom of name, 0 if out of memory.
+ */
+lirc_atom_t lirc_atom_intern(const char* name);
+
+/**
+ * Look up name without interning it.
+ *
+ * @return The atom of name, 0 if it is not interned.
+ */
+lirc_atom_t lirc_atom_find(const char* name);
+
+/**
+ * Return the interned copy of name, shared by all callers and valid
+ * until the process exits, and its atom in *atom.
+ *
+ * @return Copy of name, NULL if out of memory.
+ */
+const char* lirc_atom_string(const char* name, lirc_atom_t* atom);
+
+/**
+ * Return true if names a and b are equal ignoring case. Compares the
+ * atoms if both are interned, else the strings.
+ */
+static inline int lirc_atom_equal(const char* a, lirc_atom_t atom_a,
+				  const char* b, lirc_atom_t atom_b)
+{
+	if (atom_a != 0 && atom_b != 0)
+		return atom_a == atom_b;
+	return strcasecmp(a, b) == 0;
+}
+
+/** Return the number of atoms. */
+uint32_t lirc_atom_count(void);
+
+/** Return the bytes allocated for the table and the names. */
+size_t lirc_atom_memory(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ATOM_H */
@@ -0,0 +1,87 @@
+/****************************************************************************
+** code_line.c *************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file code_line.c
+ * @brief Implements code_line.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "code_line.h"
+
+
+/** Return start of next token from s, tokens are separated by blanks. */
+static const char* next_token(const char* s, const char* end, size_t* len)
+{
+	const char* start;
+
+	while (s < end && (*s == ' ' || *s == '\t'))
+		s++;
+	start = s;
+	while (s < end && *s != ' ' && *s != '\t')
+		s++;
+	*len = s - start;
+	return start;
+}
+
+
+/** Parse a hex token, return 0 if it's empty or not all hex digits. */
+static int parse_hex(const char* s, size_t len, unsigned long long* value)
+{
+	unsigned long long v = 0;
+	size_t i;
+	int c;
+
+	if (len == 0)
+		return 0;
+	for (i = 0; i < len; i++) {
+		c = s[i];
+		if (c >= '0' && c <= '9')
+			c -= '0';
+		else if (c >= 'a' && c <= 'f')
+			c -= 'a' - 10;
+		else if (c >= 'A' && c <= 'F')
+			c -= 'A' - 10;
+		else
+			return 0;
+		v = (v << 4) | c;
+	}
+	*value = v;
+	return 1;
+}
+
+
+int code_line_parse(const char* line, size_t len, struct code_line* parsed)
+{
+	const char* end = line + len;
+	const char* token;
+	unsigned long long reps;
+
+	if (end > line && end[-1] == '\r')
+		end--;
+	parsed->button = parsed->remote = NULL;
+	parsed->button_len = parsed->remote_len = 0;
+	token = next_token(line, end, &len);
+	if (!parse_hex(token, len, &parsed->code))
+		return -1;
+	token = next_token(token + len, end, &len);
+	if (!parse_hex(token, len, &reps))
+		return -1;
+	parsed->reps = (int)reps;
+	token = next_token(token + len, end, &len);
+	if (len == 0)
+		return 0;
+	parsed->button = token;
+	parsed->button_len = len;
+	token = next_token(token + len, end, &len);
+	if (len == 0)
+		return 0;
+	parsed->remote = token;
+	parsed->remote_len = len;
+	return 1;
+}
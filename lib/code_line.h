@@ -0,0 +1,52 @@
+/****************************************************************************
+** code_line.h *************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file code_line.h
+ * @brief Parse the code lines broadcast by lircd, in place.
+ * @ingroup private_api
+ *
+ * lircd broadcasts each decoded button as a line
+ * "<code> <repeat count> <button> <remote>", code and repeat count in
+ * hex. code_line_parse() only points into the caller's buffer, it never
+ * copies nor allocates; the names are not NUL-terminated.
+ */
+
+#ifndef CODE_LINE_H
+#define CODE_LINE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A parsed code line, the names point into the parsed buffer. */
+struct code_line {
+	unsigned long long	code;
+	int			reps;           /**< 0 on first press. */
+	const char*		button;
+	size_t			button_len;
+	const char*		remote;
+	size_t			remote_len;
+};
+
+/**
+ * Parse a code line.
+ *
+ * @param line Start of line, not necessarily NUL-terminated.
+ * @param len Length of line, without the newline. A trailing '\r' is
+ *     ignored.
+ * @param[out] parsed Updated as far as the line could be parsed.
+ * @return 1 if parsed, 0 if button or remote is missing, -1 if code
+ *     or repeat count is missing or not hex.
+ */
+int code_line_parse(const char* line, size_t len, struct code_line* parsed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CODE_LINE_H */
@@ -30,10 +30,12 @@
 #include <libgen.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #ifdef HAVE_KERNEL_LIRC_H
 #include <linux/lirc.h>
@@ -41,12 +43,14 @@
 #include "media/lirc.h"
 #endif
 
+#include "lirc/atom.h"
 #include "lirc/lirc_log.h"
 #include "lirc/lirc_options.h"
 #include "lirc/ir_remote.h"
 #include "lirc/config_file.h"
 #include "lirc/transmit.h"
 #include "lirc/config_flags.h"
+#include "lirc/receive.h"
 
 
 static const logchannel_t logchannel = LOG_LIB;
@@ -73,11 +77,54 @@ typedef void* (*array_guest_func)(void* item, void* arg);
 
 #define LINE_LEN 1024
 #define MAX_INCLUDES 10
+#define MAX_INCLUDE_WORKERS 8
 
 const char* whitespace = " \t";
 
-static int line;
-static int parse_error;
+/** State of one parse, included files share the one of their parent. */
+struct parse_ctx {
+	int			line;
+	int			parse_error;
+	int			include_seen;   /**< Current file has include lines. */
+	int			error_logged;   /**< Failed file has been logged. */
+	int			worker;         /**< In an include_worker() thread. */
+	int			dyncodes;       /**< lircd:dynamic-codes option. */
+	int			lazy_raw;       /**< lircd:lazy-raw-codes option. */
+	struct config_arena*	arena;          /**< Where s_malloc() allocates. */
+};
+
+static __thread struct parse_ctx* pctx = NULL;
+
+static struct lirc_option opt_dynamic_codes =
+	LIRC_OPTION("lircd:dynamic-codes");
+static struct lirc_option opt_lazy_raw_codes =
+	LIRC_OPTION("lircd:lazy-raw-codes");
+
+/* Taken by include workers to use the caches and the send buffer. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Taken while loading lazy raw codes, see load_raw_signals(). */
+static pthread_mutex_t raw_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Also taken around signal lengths, see set_send_lock_funcs(). */
+static void (*send_lock_func)(void) = NULL;
+static void (*send_unlock_func)(void) = NULL;
+
+/** Parsed remotes of an included file, see read_config_cached(). */
+struct config_cache_entry {
+	char*				path;
+	dev_t				dev;
+	ino_t				ino;
+	off_t				size;
+	struct timespec			mtime;
+	struct ir_remote*		remotes;  /**< Private copy. */
+	unsigned int			generation;
+	struct config_cache_entry*	next;
+};
+
+static struct config_cache_entry* config_cache = NULL;
+static unsigned int cache_generation = 0;
+static int cache_active = 0;     /* Inside read_config_cached(). */
 
 static struct ir_remote* read_config_recursive(FILE* f, const char* name, int depth);
 static void calculate_signal_lengths(struct ir_remote* remote);
@@ -90,7 +137,7 @@ void** init_void_array(struct void_array* ar, size_t chunk_size, size_t item_siz
 	ar->ptr = calloc(chunk_size, ar->item_size);
 	if (!ar->ptr) {
 		log_error("out of memory");
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return NULL;
 	}
 	return ar->ptr;
@@ -132,7 +179,7 @@ int add_void_array(struct void_array* ar, void* dataptr)
 			      (ar->nr_items + ar->chunk_size + 1));
 		if (!ptr) {
 			log_error("out of memory");
-			parse_error = 1;
+			pctx->parse_error = 1;
 			return 0;
 		}
 		ar->ptr = ptr;
@@ -223,17 +270,295 @@ static void* array_guest_ncode_cmp(void* item, void* arg)
 }
 
 
+/*
+ * Storage of one config generation, see read_config_cached(). The
+ * remotes, codes, names and signals are carved out of large chunks
+ * which are all freed when the last remote using them is freed.
+ */
+
+#define ARENA_CHUNK_SIZE        16384
+#define ARENA_ALIGN             8
+
+struct arena_chunk {
+	struct arena_chunk*	next;
+	size_t			used;
+	size_t			size;
+};
+
+struct config_arena {
+	struct arena_chunk*	chunks;
+	size_t			refs;   /**< Remotes + the parser while reading. */
+	void*			map;    /**< Compiled cache raw signals are in. */
+	size_t			map_size;
+};
+
+static struct config_arena* arena_new(void)
+{
+	struct config_arena* arena;
+
+	arena = (struct config_arena*)calloc(1, sizeof(*arena));
+	if (arena != NULL)
+		arena->refs = 1;
+	return arena;
+}
+
+
+static void arena_release(struct config_arena* arena)
+{
+	struct arena_chunk* chunk;
+
+	if (arena == NULL || --arena->refs > 0)
+		return;
+	while (arena->chunks != NULL) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+	if (arena->map != NULL)
+		munmap(arena->map, arena->map_size);
+	free(arena);
+}
+
+
+/** Return size zeroed bytes from arena, or from calloc() if it's NULL. */
+static void* arena_malloc(struct config_arena* arena, size_t size)
+{
+	const size_t header = (sizeof(struct arena_chunk) + ARENA_ALIGN - 1)
+			      & ~(size_t)(ARENA_ALIGN - 1);
+	struct arena_chunk* chunk;
+	size_t chunk_size;
+	char* ptr;
+
+	if (arena == NULL)
+		return calloc(1, size ? size : 1);
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		chunk_size = header + size;
+		if (chunk_size < ARENA_CHUNK_SIZE)
+			chunk_size = ARENA_CHUNK_SIZE;
+		chunk = (struct arena_chunk*)malloc(chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->used = header;
+		chunk->size = chunk_size;
+		if (arena->chunks != NULL && size > ARENA_CHUNK_SIZE / 4) {
+			/* Keep using the current chunk for small items. */
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+	ptr = (char*)chunk + chunk->used;
+	chunk->used += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+
+static char* arena_strdup(struct config_arena* arena, const char* s)
+{
+	size_t len = strlen(s) + 1;
+	char* ptr = (char*)arena_malloc(arena, len);
+
+	if (ptr != NULL)
+		memcpy(ptr, s, len);
+	return ptr;
+}
+
+
+/**
+ * Return a copy of the remote or button name with its atom in *atom.
+ * Names of remotes in an arena share the copy in the atom table.
+ */
+static char* arena_strdup_name(struct config_arena* arena, const char* name,
+			       uint32_t* atom)
+{
+	if (arena != NULL)
+		return (char*)lirc_atom_string(name, atom);
+	*atom = lirc_atom_intern(name);
+	return arena_strdup(arena, name);
+}
+
+
+/** Free ptr from arena_malloc(), a no-op for arena memory. */
+static void arena_free(struct config_arena* arena, void* ptr)
+{
+	if (arena == NULL)
+		free(ptr);
+}
+
+
+/** Allocate a remote from arena, which it then holds a reference to. */
+static struct ir_remote* arena_new_remote(struct config_arena* arena)
+{
+	struct ir_remote* rem;
+
+	rem = (struct ir_remote*)arena_malloc(arena, sizeof(*rem));
+	if (rem != NULL && arena != NULL) {
+		rem->arena = arena;
+		arena->refs += 1;
+	}
+	return rem;
+}
+
+
+/*
+ * The config file of a remote with lazy loaded raw codes, which must be
+ * unchanged when they are loaded.
+ */
+struct raw_source {
+	dev_t		dev;
+	ino_t		ino;
+	off_t		size;
+	struct timespec	mtime;
+	char		path[1];
+};
+
+static size_t raw_source_size(const struct raw_source* src)
+{
+	return sizeof(*src) + strlen(src->path);
+}
+
+
+/** Describe the open config file f, NULL if it cannot be lazy loaded. */
+static struct raw_source* raw_source_new(FILE* f, const char* name)
+{
+	char path[PATH_MAX];
+	struct raw_source* src;
+	struct stat st;
+
+	/* lircd changes directory when daemonizing. */
+	if (realpath(name, path) == NULL || fstat(fileno(f), &st) != 0)
+		return NULL;
+	src = (struct raw_source*)arena_malloc(pctx->arena,
+						 sizeof(*src) + strlen(path));
+	if (src == NULL)
+		return NULL;
+	strcpy(src->path, path);
+	src->dev = st.st_dev;
+	src->ino = st.st_ino;
+	src->size = st.st_size;
+	src->mtime = st.st_mtim;
+	return src;
+}
+
+
+/**
+ * Read the length signals at offset in src. Returns a malloc()'ed
+ * array, or NULL after logging errors.
+ */
+static lirc_t* read_raw_signals(const struct raw_source* src,
+				long offset,
+				int length)
+{
+	char buf[LINE_LEN + 1];
+	char* token;
+	char* tok;
+	char* endptr;
+	unsigned long n;
+	lirc_t* signals;
+	struct stat st;
+	FILE* f;
+	int count = 0;
+
+	f = fopen(src->path, "r");
+	if (f == NULL) {
+		log_perror_err("Cannot load raw codes from %s", src->path);
+		return NULL;
+	}
+	if (fstat(fileno(f), &st) != 0
+	    || st.st_dev != src->dev
+	    || st.st_ino != src->ino
+	    || st.st_size != src->size
+	    || st.st_mtim.tv_sec != src->mtime.tv_sec
+	    || st.st_mtim.tv_nsec != src->mtime.tv_nsec) {
+		log_error("Cannot load raw codes, %s has changed", src->path);
+		fclose(f);
+		return NULL;
+	}
+	signals = (lirc_t*)malloc(length * sizeof(lirc_t));
+	if (signals == NULL || fseek(f, offset, SEEK_SET) != 0) {
+		log_error("Cannot load raw codes from %s", src->path);
+		free(signals);
+		fclose(f);
+		return NULL;
+	}
+	/* The parser has checked the signals following offset. */
+	while (count < length && fgets(buf, LINE_LEN, f) != NULL) {
+		if (buf[0] == '#')
+			continue;
+		token = strtok_r(buf, " \t\r\n", &tok);
+		for (; token != NULL && count < length;
+		     token = strtok_r(NULL, " \t\r\n", &tok)) {
+			n = strtoul(token, &endptr, 0);
+			if (*endptr != '\0')
+				break;
+			signals[count++] = (lirc_t)n;
+		}
+		if (token != NULL && count < length)
+			break;
+	}
+	fclose(f);
+	if (count < length) {
+		log_error("Cannot load raw codes, bad signals in %s",
+			  src->path);
+		free(signals);
+		return NULL;
+	}
+	return signals;
+}
+
+
+int load_raw_signals(const struct ir_remote* remote, struct ir_ncode* code)
+{
+	int ok;
+
+	if (remote->raw_source == NULL)
+		return code->signals != NULL;
+	pthread_mutex_lock(&raw_lock);
+	if (code->signals == NULL && code->raw_offset > 0) {
+		code->signals = read_raw_signals(remote->raw_source,
+						 code->raw_offset,
+						 code->length);
+		if (code->signals == NULL)
+			code->raw_offset = -1;  /* Don't retry. */
+		else
+			log_debug("Loaded raw code %s of %s",
+				  code->name, remote->name);
+	}
+	ok = code->signals != NULL;
+	pthread_mutex_unlock(&raw_lock);
+	return ok;
+}
+
+
+/** Drop the signals of lazy loaded raw codes, reloaded when used. */
+static void unload_raw_signals(struct ir_remote* rem)
+{
+	struct ir_ncode* code;
+
+	for (code = rem->codes; code != NULL && code->name != NULL; code++) {
+		if (code->raw_offset != 0) {
+			free(code->signals);
+			code->signals = NULL;
+		}
+	}
+}
+
+
 void* s_malloc(size_t size)
 {
 	void* ptr;
 
-	ptr = malloc(size);
+	ptr = arena_malloc(pctx->arena, size);
 	if (ptr == NULL) {
 		log_error("out of memory");
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return NULL;
 	}
-	memset(ptr, 0, size);
 	return ptr;
 }
 
@@ -241,15 +566,66 @@ char* s_strdup(char* string)
 {
 	char* ptr;
 
-	ptr = strdup(string);
+	ptr = arena_strdup(pctx->arena, string);
+	if (!ptr) {
+		log_error("out of memory");
+		pctx->parse_error = 1;
+		return NULL;
+	}
+	return ptr;
+}
+
+
+/** s_strdup() for names, see arena_strdup_name(). */
+static char* s_strdup_name(const char* name, uint32_t* atom)
+{
+	char* ptr;
+
+	ptr = arena_strdup_name(pctx->arena, name, atom);
 	if (!ptr) {
 		log_error("out of memory");
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return NULL;
 	}
 	return ptr;
 }
 
+
+/** Free memory from s_malloc() or s_strdup(). */
+static void s_free(void* ptr)
+{
+	arena_free(pctx->arena, ptr);
+}
+
+
+/**
+ * Return the final array of ar including the terminating zero item,
+ * moved to the arena if parsing into one.
+ */
+static void* finish_void_array(struct void_array* ar)
+{
+	void* ptr;
+
+	if (pctx->arena == NULL || ar->ptr == NULL)
+		return ar->ptr;
+	ptr = s_malloc(ar->item_size * (ar->nr_items + 1));
+	if (ptr != NULL)
+		memcpy(ptr, ar->ptr, ar->item_size * (ar->nr_items + 1));
+	free(ar->ptr);
+	ar->ptr = ptr;
+	return ptr;
+}
+
+
+/** Like finish_void_array(), but lazy loaded signals stay malloc()'ed. */
+static lirc_t* finish_signals(struct void_array* signals,
+			      const struct ir_ncode* code)
+{
+	if (code->raw_offset != 0)
+		return (lirc_t*)get_void_array(signals);
+	return (lirc_t*)finish_void_array(signals);
+}
+
 ir_code s_strtocode(const char* val)
 {
 	ir_code code = 0;
@@ -258,9 +634,9 @@ ir_code s_strtocode(const char* val)
 	errno = 0;
 	code = strtoull(val, &endptr, 0);
 	if ((code == (uint64_t) -1 && errno == ERANGE) || strlen(endptr) != 0 || strlen(val) == 0) {
-		log_error("error in configfile line %d:", line);
+		log_error("error in configfile line %d:", pctx->line);
 		log_error("\"%s\": must be a valid (uint64_t) number", val);
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return 0;
 	}
 	return code;
@@ -273,9 +649,9 @@ uint32_t s_strtou32(char* val)
 
 	n = strtoul(val, &endptr, 0);
 	if (!*val || *endptr) {
-		log_error("error in configfile line %d:", line);
+		log_error("error in configfile line %d:", pctx->line);
 		log_error("\"%s\": must be a valid (uint32_t) number", val);
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return 0;
 	}
 	return n;
@@ -290,9 +666,9 @@ int s_strtoi(char* val)
 	n = strtol(val, &endptr, 0);
 	h = (int)n;
 	if (!*val || *endptr || n != ((long)h)) {
-		log_error("error in configfile line %d:", line);
+		log_error("error in configfile line %d:", pctx->line);
 		log_error("\"%s\": must be a valid (int) number", val);
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return 0;
 	}
 	return h;
@@ -307,9 +683,9 @@ unsigned int s_strtoui(char* val)
 	n = strtoul(val, &endptr, 0);
 	h = (unsigned int)n;
 	if (!*val || *endptr || n != ((uint32_t)h)) {
-		log_error("error in configfile line %d:", line);
+		log_error("error in configfile line %d:", pctx->line);
 		log_error("\"%s\": must be a valid (unsigned int) number", val);
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return 0;
 	}
 	return h;
@@ -324,13 +700,13 @@ lirc_t s_strtolirc_t(char* val)
 	n = strtoul(val, &endptr, 0);
 	h = (lirc_t)n;
 	if (!*val || *endptr || n != ((uint32_t)h)) {
-		log_error("error in configfile line %d:", line);
+		log_error("error in configfile line %d:", pctx->line);
 		log_error("\"%s\": must be a valid (lirc_t) number", val);
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return 0;
 	}
 	if (h < 0) {
-		log_warn("error in configfile line %d:", line);
+		log_warn("error in configfile line %d:", pctx->line);
 		log_warn("\"%s\" is out of range", val);
 	}
 	return h;
@@ -339,9 +715,9 @@ lirc_t s_strtolirc_t(char* val)
 int checkMode(int is_mode, int c_mode, char* error)
 {
 	if (is_mode != c_mode) {
-		log_error("fatal error in configfile line %d:", line);
+		log_error("fatal error in configfile line %d:", pctx->line);
 		log_error("\"%s\" isn't valid at this position", error);
-		parse_error = 1;
+		pctx->parse_error = 1;
 		return 0;
 	}
 	return 1;
@@ -352,7 +728,7 @@ int addSignal(struct void_array* signals, char* val)
 	unsigned int t;
 
 	t = s_strtoui(val);
-	if (parse_error)
+	if (pctx->parse_error)
 		return 0;
 	if (!add_void_array(signals, &t))
 		return 0;
@@ -363,7 +739,7 @@ int addSignal(struct void_array* signals, char* val)
 struct ir_ncode* defineCode(char* key, char* val, struct ir_ncode* code)
 {
 	memset(code, 0, sizeof(*code));
-	code->name = s_strdup(key);
+	code->name = s_strdup_name(key, &code->atom);
 	code->code = s_strtocode(val);
 	log_trace2("      %-20s 0x%016llX", code->name, code->code);
 	return code;
@@ -414,9 +790,9 @@ int parseFlags(char* val)
 		while (flaglptr->name != NULL) {
 			if (strcasecmp(flaglptr->name, flag) == 0) {
 				if (flaglptr->flag & IR_PROTOCOL_MASK && flags & IR_PROTOCOL_MASK) {
-					log_error("error in configfile line %d:", line);
+					log_error("error in configfile line %d:", pctx->line);
 					log_error("multiple protocols given in flags: \"%s\"", flag);
-					parse_error = 1;
+					pctx->parse_error = 1;
 					return 0;
 				}
 				flags = flags | flaglptr->flag;
@@ -426,9 +802,9 @@ int parseFlags(char* val)
 			flaglptr++;
 		}
 		if (flaglptr->name == NULL) {
-			log_error("error in configfile line %d:", line);
+			log_error("error in configfile line %d:", pctx->line);
 			log_error("unknown flag: \"%s\"", flag);
-			parse_error = 1;
+			pctx->parse_error = 1;
 			return 0;
 		}
 		flag = help;
@@ -442,21 +818,21 @@ int defineRemote(char* key, char* val, char* val2, struct ir_remote* rem)
 {
 	if ((strcasecmp("name", key)) == 0) {
 		if (rem->name != NULL)
-			free((void*)(rem->name));
-		rem->name = s_strdup(val);
+			s_free((void*)(rem->name));
+		rem->name = s_strdup_name(val, &rem->atom);
 		log_info("Using remote: %s.", val);
 		return 1;
 	}
-	if (options_getboolean("lircd:dynamic-codes")) {
+	if (pctx->dyncodes) {
 		if ((strcasecmp("dyncodes_name", key)) == 0) {
 			if (rem->dyncodes_name != NULL)
-				free(rem->dyncodes_name);
+				s_free(rem->dyncodes_name);
 			rem->dyncodes_name = s_strdup(val);
 			return 1;
 		}
 	} else if (strcasecmp("driver", key) == 0) {
 		if (rem->driver != NULL)
-			free((void*)(rem->driver));
+			s_free((void*)(rem->driver));
 		rem->driver = s_strdup(val);
 		return 1;
 	} else if ((strcasecmp("bits", key)) == 0) {
@@ -545,9 +921,9 @@ int defineRemote(char* key, char* val, char* val2, struct ir_remote* rem)
 		return 1;
 	} else if (strcasecmp("serial_mode", key) == 0) {
 		if (val[0] < '5' || val[0] > '9') {
-			log_error("error in configfile line %d:", line);
+			log_error("error in configfile line %d:", pctx->line);
 			log_error("bad bit count");
-			parse_error = 1;
+			pctx->parse_error = 1;
 			return 0;
 		}
 		rem->bits_in_byte = val[0] - '0';
@@ -562,9 +938,9 @@ int defineRemote(char* key, char* val, char* val2, struct ir_remote* rem)
 			rem->parity = IR_PARITY_ODD;
 			break;
 		default:
-			log_error("error in configfile line %d:", line);
+			log_error("error in configfile line %d:", pctx->line);
 			log_error("unsupported parity mode");
-			parse_error = 1;
+			pctx->parse_error = 1;
 			return 0;
 		}
 		if (strcmp(val + 2, "1.5") == 0)
@@ -612,13 +988,13 @@ int defineRemote(char* key, char* val, char* val2, struct ir_remote* rem)
 		}
 	}
 	if (val2) {
-		log_error("error in configfile line %d:", line);
+		log_error("error in configfile line %d:", pctx->line);
 		log_error("unknown definiton: \"%s %s %s\"", key, val, val2);
 	} else {
-		log_error("error in configfile line %d:", line);
+		log_error("error in configfile line %d:", pctx->line);
 		log_error("unknown definiton or too few arguments: \"%s %s\"", key, val);
 	}
-	parse_error = 1;
+	pctx->parse_error = 1;
 	return 0;
 }
 
@@ -834,165 +1210,1416 @@ ir_remotes_append(struct ir_remote* root, struct ir_remote* what)
 }
 
 
-struct ir_remote* read_config(FILE* f, const char* name)
+/** Parse the config file f using ctx. */
+static struct ir_remote* parse_config(FILE* f,
+				      const char* name,
+				      struct parse_ctx* ctx)
 {
+	struct parse_ctx* saved = pctx;
 	struct ir_remote* head;
 
+	/* Not thread safe, read it here for the include workers. */
+	ctx->dyncodes = option_boolean(&opt_dynamic_codes);
+	ctx->lazy_raw = ctx->arena != NULL
+			&& option_boolean(&opt_lazy_raw_codes);
+	pctx = ctx;
 	head = read_config_recursive(f, name, 0);
 	head = sort_by_bit_count(head);
+	pctx = saved;
 	return head;
 }
 
 
-/**
- * Parse a single config file.
- *
- * @param name Including file path.
- * @paran depth Include depth, increased for each recursive inclusion.
- * @param val include file absolute path, quoted.
- * @param top_rem root of ir_remotes list.
- * @return root of new list, with possibly added remotes.
- *
- */
-static struct ir_remote*
-read_included(const char* name, int depth, char* val, struct ir_remote* top_rem)
+struct ir_remote* read_config(FILE* f, const char* name)
 {
-	FILE* childFile;
-	const char* childName;
-	struct ir_remote* rem = NULL;
+	struct parse_ctx ctx;
 
-	if (depth > MAX_INCLUDES) {
-		log_error("error opening child file defined at %s:%d", name, line);
-		log_error("too many files included");
-		return top_rem;
-	}
-	childName = lirc_parse_include(val);
-	if (!childName) {
-		log_error("error parsing child file value defined at line %d:", line);
-		log_error("invalid quoting");
-		return top_rem;
-	}
-	childFile = fopen(childName, "r");
-	if (childFile == NULL) {
-		log_error("error opening child file '%s' defined at line %d:",
-			  childName, line);
-		log_error("ignoring this child file for now.");
-		return NULL;
-	}
-	rem = read_config_recursive(childFile, childName, depth + 1);
-	top_rem = ir_remotes_append(top_rem, rem);
-	fclose(childFile);
-	return top_rem;
+	memset(&ctx, 0, sizeof(ctx));
+	return parse_config(f, name, &ctx);
 }
 
 
 /**
- * Parse all include files matched by glob pattern
- *
- * @param name Including file path.
- * @paran depth Include depth, increased for each recursive inclusion.
- * @param val path in include parameter, quoted.
- * @param top_rem root of existing ir_remotes list.
- * @return root of new list, with possibly added remotes.
- *
+ * Return a deep copy of the remotes list head allocated from arena, or
+ * malloc()'ed if NULL. Returns NULL if out of memory.
  */
-static struct ir_remote* read_all_included(const char*		name,
-					   int			depth,
-					   char*		val,
-					   struct ir_remote*	top_rem)
+static struct ir_remote* clone_remotes(const struct ir_remote* head,
+				       struct config_arena* arena)
 {
-	int i;
-	glob_t globbuf;
-	char buff[256] = { '\0' };
-
-	memset(&globbuf, 0, sizeof(globbuf));
-	val = val + 1;   // Strip quotes
-	val[strlen(val) - 1] = '\0';
-	lirc_parse_relative(buff, sizeof(buff), val, name);
-	glob(buff, 0, NULL, &globbuf);
-	for (i = 0; i < globbuf.gl_pathc; i += 1) {
-		snprintf(buff, sizeof(buff), "\"%s\"", globbuf.gl_pathv[i]);
-		top_rem = read_included(name, depth, buff, top_rem);
+	struct ir_remote* root = NULL;
+	struct ir_remote** tail = &root;
+	struct ir_remote* rem;
+	struct ir_ncode* code;
+	struct ir_code_node* node;
+	struct ir_code_node** node_tail;
+	const struct ir_code_node* src_node;
+	size_t count;
+	size_t i;
+
+	for (; head != NULL; head = head->next) {
+		rem = (struct ir_remote*)arena_malloc(arena, sizeof(*rem));
+		if (rem == NULL)
+			goto nomem;
+		memcpy(rem, head, sizeof(*rem));
+		rem->codes = NULL;
+		rem->code_index = NULL;
+		rem->order = NULL;
+		rem->scancode_index = NULL;
+		rem->last_code = NULL;
+		rem->toggle_code = NULL;
+		rem->next = NULL;
+		rem->name = NULL;
+		rem->driver = NULL;
+		rem->dyncodes_name = NULL;
+		rem->raw_source = NULL;
+		rem->arena = arena;
+		if (arena != NULL)
+			arena->refs += 1;
+		*tail = rem;
+		tail = &rem->next;
+		if (head->name != NULL) {
+			rem->name = arena_strdup_name(arena, head->name,
+						      &rem->atom);
+			if (rem->name == NULL)
+				goto nomem;
+		}
+		if (head->driver != NULL)
+			rem->driver = arena_strdup(arena, head->driver);
+		if (head->dyncodes_name != NULL)
+			rem->dyncodes_name =
+				arena_strdup(arena, head->dyncodes_name);
+		rem->dyncodes[0].name = rem->dyncodes_name;
+		rem->dyncodes[1].name = rem->dyncodes_name;
+		if (head->raw_source != NULL) {
+			rem->raw_source = (struct raw_source*)arena_malloc(
+				arena, raw_source_size(head->raw_source));
+			if (rem->raw_source == NULL)
+				goto nomem;
+			memcpy(rem->raw_source, head->raw_source,
+			       raw_source_size(head->raw_source));
+		}
+		if (head->codes == NULL)
+			continue;
+		for (count = 0; head->codes[count].name != NULL; count++)
+			;
+		rem->codes = (struct ir_ncode*)arena_malloc(
+			arena, (count + 1) * sizeof(struct ir_ncode));
+		if (rem->codes == NULL)
+			goto nomem;
+		for (i = 0; i < count; i++) {
+			const struct ir_ncode* src = &head->codes[i];
+
+			code = &rem->codes[i];
+			code->name = arena_strdup_name(arena, src->name,
+						       &code->atom);
+			code->code = src->code;
+			code->length = src->length;
+			code->raw_offset = src->raw_offset;
+			if (code->name == NULL)
+				goto nomem;
+			if (src->signals != NULL && src->raw_offset == 0) {
+				code->signals = (lirc_t*)arena_malloc(
+					arena, src->length * sizeof(lirc_t));
+				if (code->signals == NULL)
+					goto nomem;
+				memcpy(code->signals, src->signals,
+				       src->length * sizeof(lirc_t));
+			}
+			node_tail = &code->next;
+			for (src_node = src->next; src_node != NULL;
+			     src_node = src_node->next) {
+				node = (struct ir_code_node*)arena_malloc(
+					arena, sizeof(*node));
+				if (node == NULL)
+					goto nomem;
+				node->code = src_node->code;
+				node->next = NULL;
+				*node_tail = node;
+				node_tail = &node->next;
+			}
+		}
+		ir_remote_index_codes(rem);
 	}
-	globfree(&globbuf);
-	return top_rem;
+	return root;
+nomem:
+	log_error("out of memory");
+	free_config(root);
+	return NULL;
 }
 
 
-static void check_ncode_dups(const char* path,
-			     const char* name,
-			     struct void_array* ar,
-			     struct ir_ncode* code)
+static struct config_cache_entry* cache_lookup(const char* path)
 {
-	if (foreach_void_array(ar, array_guest_ncode_cmp, code) != NULL) {
-		log_notice("%s: %s: Multiple definitions of: %s",
-			   path, name, code->name);
-	}
-	if (foreach_void_array(ar, array_guest_code_equals, code) != NULL) {
-		log_notice("%s: %s: Multiple values for same code: %s",
-			   path, name, code->name);
-	}
+	struct config_cache_entry* entry;
+
+	for (entry = config_cache; entry != NULL; entry = entry->next)
+		if (strcmp(entry->path, path) == 0)
+			return entry;
+	return NULL;
 }
 
 
-static struct ir_remote*
-read_config_recursive(FILE* f, const char* name, int depth)
+static int cache_is_valid(const struct config_cache_entry* entry,
+			  const struct stat* st)
 {
-	char buf[LINE_LEN + 1];
-	char* key;
-	char* val;
-	char* val2;
-	int len, argc;
-	struct ir_remote* top_rem = NULL;
-	struct ir_remote* rem = NULL;
-	struct void_array codes_list, raw_codes, signals;
-	struct ir_ncode raw_code = { NULL, 0, 0, NULL };
-	struct ir_ncode name_code = { NULL, 0, 0, NULL };
-	struct ir_ncode* code;
-	int mode = ID_none;
+	return entry->dev == st->st_dev
+	       && entry->ino == st->st_ino
+	       && entry->size == st->st_size
+	       && entry->mtime.tv_sec == st->st_mtim.tv_sec
+	       && entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
 
-	line = 0;
-	parse_error = 0;
-	log_trace1("parsing '%s'", name);
 
-	while (fgets(buf, LINE_LEN, f) != NULL) {
-		line++;
-		len = strlen(buf);
-		if (len == LINE_LEN && buf[len - 1] != '\n') {
-			log_error("line %d too long in config file", line);
-			parse_error = 1;
-			break;
+/** Remember a private copy of remotes parsed from path. */
+static void cache_store(const char* path,
+			const struct stat* st,
+			const struct ir_remote* remotes)
+{
+	struct config_cache_entry* entry = cache_lookup(path);
+
+	if (entry == NULL) {
+		entry = (struct config_cache_entry*)calloc(1, sizeof(*entry));
+		if (entry == NULL)
+			return;
+		entry->path = strdup(path);
+		if (entry->path == NULL) {
+			free(entry);
+			return;
 		}
+		entry->next = config_cache;
+		config_cache = entry;
+	} else {
+		free_config(entry->remotes);
+	}
+	entry->remotes = clone_remotes(remotes, NULL);
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+	entry->generation = cache_generation;
+	if (remotes != NULL && entry->remotes == NULL)
+		/* Out of memory, make sure this is never used. */
+		entry->size = -1;
+}
 
-		if (len > 0) {
-			len--;
-			if (buf[len] == '\n')
-				buf[len] = 0;
+
+/** Drop entries not used since generation. */
+static void cache_expire(unsigned int generation)
+{
+	struct config_cache_entry** link = &config_cache;
+	struct config_cache_entry* entry;
+
+	while (*link != NULL) {
+		entry = *link;
+		if (entry->generation == generation) {
+			link = &entry->next;
+			continue;
 		}
-		if (len > 0) {
-			len--;
-			if (buf[len] == '\r')
-				buf[len] = 0;
+		*link = entry->next;
+		free_config(entry->remotes);
+		free(entry->path);
+		free(entry);
+	}
+}
+
+
+struct ir_remote* read_config_cached(FILE* f, const char* name)
+{
+	struct ir_remote* head;
+	struct parse_ctx ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	cache_generation += 1;
+	cache_active = 1;
+	ctx.arena = arena_new();
+	head = parse_config(f, name, &ctx);
+	arena_release(ctx.arena);
+	cache_active = 0;
+	if (head != (void*)-1)
+		cache_expire(cache_generation);
+	return head;
+}
+
+
+void free_config_cache(void)
+{
+	cache_expire(cache_generation + 1);
+}
+
+
+/*
+ * Compiled config cache, see read_config_compiled(). The file holds a
+ * header, the sources the config was parsed from and the parsed remotes,
+ * all records aligned to 8 bytes in host byte order:
+ *
+ *   header
+ *   u32 source count, sources: struct cache_source, path(s)
+ *   u32 remote count, remotes: struct ir_remote, name, driver,
+ *       dyncodes_name, u32 code count, codes: struct cache_code, name,
+ *       signals, next codes.
+ *
+ * Pointers in the stored structs are cleared, strings are stored as an
+ * i32 length (-1 for NULL) followed by the bytes and a nul.
+ */
+
+#define CACHE_MAGIC     "LIRCCFG"
+#define CACHE_FORMAT    2
+#define CACHE_DYNCODES  0x1             /* lircd:dynamic-codes was set. */
+
+struct cache_header {
+	char		magic[8];
+	char		version[24];    /**< lirc VERSION which wrote it. */
+	uint32_t	format;
+	uint32_t	remote_size;
+	uint32_t	ncode_size;
+	uint32_t	code_size;
+	uint32_t	lirc_t_size;
+	uint32_t	flags;
+	uint64_t	payload_size;   /**< Bytes following the header. */
+	uint64_t	hash;           /**< FNV-1a of the payload. */
+};
+
+enum cache_source_kind {
+	SOURCE_FILE,            /* path */
+	SOURCE_GLOB             /* pattern and count matches, nul separated */
+};
+
+struct cache_source {
+	uint32_t	kind;
+	uint32_t	path_size;      /**< Bytes of path(s) including nuls. */
+	int64_t		size;           /**< File size or glob match count. */
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	uint64_t	dev;
+	uint64_t	ino;
+};
+
+struct cache_code {
+	ir_code		code;
+	int32_t		length;
+	uint32_t	has_signals;
+	uint32_t	node_count;
+	uint32_t	pad;
+};
+
+/** Growing output buffer, or bounded input cursor. */
+struct cache_buf {
+	char*	data;
+	size_t	len;
+	size_t	size;
+	int	failed;
+};
+
+/* While compiling: where read_included() records the sources. */
+static struct cache_buf* compile_sources = NULL;
+static uint32_t compile_source_count;
+static int compile_failed;
+
+
+/** Don't write the compiled cache for the config being read. */
+static void compile_fail(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	compile_failed = 1;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+
+static uint64_t fnv1a(const char* data, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+static void cache_put(struct cache_buf* buf, const void* data, size_t len)
+{
+	size_t padded = (len + 7) & ~(size_t)7;
+	size_t size;
+	char* p;
+
+	if (buf->failed)
+		return;
+	if (buf->len + padded > buf->size) {
+		size = buf->size ? buf->size : 4096;
+		while (size < buf->len + padded)
+			size *= 2;
+		p = (char*)realloc(buf->data, size);
+		if (p == NULL) {
+			buf->failed = 1;
+			return;
+		}
+		buf->data = p;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	memset(buf->data + buf->len + len, 0, padded - len);
+	buf->len += padded;
+}
+
+
+static void cache_put_u32(struct cache_buf* buf, uint32_t value)
+{
+	cache_put(buf, &value, sizeof(value));
+}
+
+
+static void cache_put_string(struct cache_buf* buf, const char* s)
+{
+	int32_t len = s == NULL ? -1 : (int32_t)strlen(s);
+
+	cache_put(buf, &len, sizeof(len));
+	if (s != NULL)
+		cache_put(buf, s, len + 1);
+}
+
+
+/** Point at the next len bytes of buf, NULL if truncated. */
+static const void* cache_get(struct cache_buf* buf, size_t len)
+{
+	size_t padded = (len + 7) & ~(size_t)7;
+	const char* p;
+
+	if (buf->failed || padded < len || buf->size - buf->len < padded) {
+		buf->failed = 1;
+		return NULL;
+	}
+	p = buf->data + buf->len;
+	buf->len += padded;
+	return p;
+}
+
+
+static uint32_t cache_get_u32(struct cache_buf* buf)
+{
+	const uint32_t* p = (const uint32_t*)cache_get(buf, sizeof(*p));
+
+	return p == NULL ? 0 : *p;
+}
+
+
+/** Return a copy of the next string in config_arena, NULL on errors. */
+/** Return the next string in buf, in place, NULL if none or on errors. */
+static const char* cache_get_cstr(struct cache_buf* buf, int* is_null)
+{
+	const int32_t* len = (const int32_t*)cache_get(buf, sizeof(*len));
+	const char* s;
+
+	*is_null = 0;
+	if (len == NULL)
+		return NULL;
+	if (*len == -1) {
+		*is_null = 1;
+		return NULL;
+	}
+	s = (const char*)cache_get(buf, (size_t)*len + 1);
+	if (*len < 0 || s == NULL || s[*len] != '\0') {
+		buf->failed = 1;
+		return NULL;
+	}
+	return s;
+}
+
+
+static char* cache_get_string(struct cache_buf* buf, int* is_null)
+{
+	const char* s = cache_get_cstr(buf, is_null);
+
+	return s == NULL ? NULL : arena_strdup(pctx->arena, s);
+}
+
+
+/** cache_get_string() for names, see arena_strdup_name(). */
+static char* cache_get_name(struct cache_buf* buf, int* is_null,
+			    uint32_t* atom)
+{
+	const char* s = cache_get_cstr(buf, is_null);
+
+	*atom = 0;
+	return s == NULL ? NULL : arena_strdup_name(pctx->arena, s, atom);
+}
+
+
+static void source_set_stat(struct cache_source* src, const struct stat* st)
+{
+	src->size = st->st_size;
+	src->mtime_sec = st->st_mtim.tv_sec;
+	src->mtime_nsec = st->st_mtim.tv_nsec;
+	src->dev = st->st_dev;
+	src->ino = st->st_ino;
+}
+
+
+/** Record a config file opened while compiling. */
+static void record_file(const char* path, FILE* f)
+{
+	struct cache_source src;
+	struct stat st;
+
+	if (compile_sources == NULL)
+		return;
+	if (fstat(fileno(f), &st) != 0) {
+		compile_fail();
+		return;
+	}
+	memset(&src, 0, sizeof(src));
+	src.kind = SOURCE_FILE;
+	src.path_size = strlen(path) + 1;
+	source_set_stat(&src, &st);
+	pthread_mutex_lock(&cache_lock);
+	cache_put(compile_sources, &src, sizeof(src));
+	cache_put(compile_sources, path, src.path_size);
+	compile_source_count += 1;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+
+/** Record an include pattern and the files it matched while compiling. */
+static void record_glob(const char* pattern, const glob_t* globbuf)
+{
+	struct cache_source src;
+	char* paths;
+	char* p;
+	size_t i;
+
+	if (compile_sources == NULL)
+		return;
+	memset(&src, 0, sizeof(src));
+	src.kind = SOURCE_GLOB;
+	src.size = globbuf->gl_pathc;
+	src.path_size = strlen(pattern) + 1;
+	for (i = 0; i < globbuf->gl_pathc; i++)
+		src.path_size += strlen(globbuf->gl_pathv[i]) + 1;
+	paths = (char*)malloc(src.path_size);
+	if (paths == NULL) {
+		compile_fail();
+		return;
+	}
+	p = stpcpy(paths, pattern) + 1;
+	for (i = 0; i < globbuf->gl_pathc; i++)
+		p = stpcpy(p, globbuf->gl_pathv[i]) + 1;
+	pthread_mutex_lock(&cache_lock);
+	cache_put(compile_sources, &src, sizeof(src));
+	cache_put(compile_sources, paths, src.path_size);
+	compile_source_count += 1;
+	pthread_mutex_unlock(&cache_lock);
+	free(paths);
+}
+
+
+/** Check that a recorded source is unchanged. */
+static int source_is_valid(const struct cache_source* src, const char* path)
+{
+	struct stat st;
+	glob_t globbuf;
+	const char* match;
+	int ok;
+	size_t i;
+
+	if (src->kind == SOURCE_FILE) {
+		if (stat(path, &st) != 0)
+			return 0;
+		return (int64_t)st.st_size == src->size
+		       && (int64_t)st.st_mtim.tv_sec == src->mtime_sec
+		       && (int64_t)st.st_mtim.tv_nsec == src->mtime_nsec
+		       && (uint64_t)st.st_dev == src->dev
+		       && (uint64_t)st.st_ino == src->ino;
+	}
+	if (src->kind != SOURCE_GLOB)
+		return 0;
+	memset(&globbuf, 0, sizeof(globbuf));
+	glob(path, 0, NULL, &globbuf);
+	ok = (int64_t)globbuf.gl_pathc == src->size;
+	match = path + strlen(path) + 1;
+	for (i = 0; ok && i < globbuf.gl_pathc; i++) {
+		if (match >= path + src->path_size
+		    || strcmp(match, globbuf.gl_pathv[i]) != 0)
+			ok = 0;
+		else
+			match += strlen(match) + 1;
+	}
+	globfree(&globbuf);
+	return ok;
+}
+
+
+/** Clear the pointers in a remote about to be stored or just loaded. */
+static void remote_clear_pointers(struct ir_remote* rem)
+{
+	rem->name = NULL;
+	rem->driver = NULL;
+	rem->codes = NULL;
+	rem->dyncodes_name = NULL;
+	memset(rem->dyncodes, 0, sizeof(rem->dyncodes));
+	rem->last_code = NULL;
+	rem->toggle_code = NULL;
+	rem->next = NULL;
+	rem->code_index = NULL;
+	rem->order = NULL;
+	rem->scancode_index = NULL;
+	rem->arena = NULL;
+	rem->raw_source = NULL;
+	memset(&rem->stats, 0, sizeof(rem->stats));
+}
+
+
+static void cache_put_remotes(struct cache_buf* buf,
+			      const struct ir_remote* remotes)
+{
+	const struct ir_remote* rem;
+	const struct ir_ncode* code;
+	const struct ir_code_node* node;
+	struct ir_remote copy;
+	struct cache_code rec;
+	lirc_t* signals;
+	uint32_t count = 0;
+
+	for (rem = remotes; rem != NULL; rem = rem->next)
+		count++;
+	cache_put_u32(buf, count);
+	for (rem = remotes; rem != NULL; rem = rem->next) {
+		memcpy(&copy, rem, sizeof(copy));
+		remote_clear_pointers(&copy);
+		cache_put(buf, &copy, sizeof(copy));
+		cache_put_string(buf, rem->name);
+		cache_put_string(buf, rem->driver);
+		cache_put_string(buf, rem->dyncodes_name);
+		count = 0;
+		for (code = rem->codes; code && code->name; code++)
+			count++;
+		cache_put_u32(buf, count);
+		for (code = rem->codes; code && code->name; code++) {
+			memset(&rec, 0, sizeof(rec));
+			rec.code = code->code;
+			rec.length = code->length;
+			for (node = code->next; node != NULL; node = node->next)
+				rec.node_count++;
+			signals = code->signals;
+			if (signals == NULL && code->raw_offset > 0) {
+				signals = read_raw_signals(rem->raw_source,
+							   code->raw_offset,
+							   code->length);
+				if (signals == NULL)
+					buf->failed = 1;
+			}
+			rec.has_signals = signals != NULL;
+			cache_put(buf, &rec, sizeof(rec));
+			cache_put_string(buf, code->name);
+			if (signals != NULL)
+				cache_put(buf, signals,
+					  code->length * sizeof(lirc_t));
+			if (signals != code->signals)
+				free(signals);
+			for (node = code->next; node != NULL; node = node->next)
+				cache_put(buf, &node->code, sizeof(ir_code));
+		}
+	}
+}
+
+
+/** Rebuild the stored remotes, NULL and buf->failed set on errors. */
+static struct ir_remote* cache_get_remotes(struct cache_buf* buf)
+{
+	struct ir_remote* root = NULL;
+	struct ir_remote** tail = &root;
+	struct ir_remote* rem;
+	struct ir_ncode* code;
+	struct ir_code_node** node_tail;
+	struct ir_code_node* node;
+	const struct cache_code* rec;
+	const void* p;
+	uint32_t remote_count;
+	uint32_t code_count;
+	uint32_t i;
+	uint32_t j;
+	uint32_t k;
+	int is_null;
+
+	remote_count = cache_get_u32(buf);
+	for (i = 0; i < remote_count && !buf->failed; i++) {
+		p = cache_get(buf, sizeof(*rem));
+		rem = arena_new_remote(pctx->arena);
+		if (p == NULL || rem == NULL) {
+			if (rem != NULL)
+				free_config(rem);
+			buf->failed = 1;
+			break;
+		}
+		memcpy(rem, p, sizeof(*rem));
+		remote_clear_pointers(rem);
+		rem->arena = pctx->arena;
+		*tail = rem;
+		tail = &rem->next;
+		rem->name = cache_get_name(buf, &is_null, &rem->atom);
+		rem->driver = cache_get_string(buf, &is_null);
+		rem->dyncodes_name = cache_get_string(buf, &is_null);
+		rem->dyncodes[0].name = rem->dyncodes_name;
+		rem->dyncodes[1].name = rem->dyncodes_name;
+		code_count = cache_get_u32(buf);
+		if (buf->failed || code_count > buf->size / sizeof(*rec))
+			break;
+		rem->codes = (struct ir_ncode*)arena_malloc(
+			pctx->arena, (code_count + 1) * sizeof(struct ir_ncode));
+		if (rem->codes == NULL)
+			break;
+		for (j = 0; j < code_count && !buf->failed; j++) {
+			code = &rem->codes[j];
+			rec = (const struct cache_code*)cache_get(buf,
+								  sizeof(*rec));
+			if (rec == NULL)
+				break;
+			code->name = cache_get_name(buf, &is_null,
+						    &code->atom);
+			if (code->name == NULL) {
+				buf->failed = 1;
+				break;
+			}
+			code->code = rec->code;
+			code->length = rec->length;
+			if (rec->has_signals) {
+				if (rec->length <= 0) {
+					buf->failed = 1;
+					break;
+				}
+				p = cache_get(buf,
+					      rec->length * sizeof(lirc_t));
+				if (p != NULL && pctx->arena != NULL
+				    && pctx->arena->map != NULL)
+					/* Lazy: paged in from the map when used. */
+					code->signals = (lirc_t*)p;
+				else if (p != NULL)
+					code->signals = (lirc_t*)arena_malloc(
+						pctx->arena,
+						rec->length * sizeof(lirc_t));
+				if (p == NULL || code->signals == NULL) {
+					buf->failed = 1;
+					break;
+				}
+				if (code->signals != p)
+					memcpy(code->signals, p,
+					       rec->length * sizeof(lirc_t));
+			}
+			node_tail = &code->next;
+			for (k = 0; k < rec->node_count; k++) {
+				p = cache_get(buf, sizeof(ir_code));
+				node = (struct ir_code_node*)arena_malloc(
+					pctx->arena, sizeof(*node));
+				if (p == NULL || node == NULL) {
+					arena_free(pctx->arena, node);
+					buf->failed = 1;
+					break;
+				}
+				memcpy(&node->code, p, sizeof(ir_code));
+				node->next = NULL;
+				*node_tail = node;
+				node_tail = &node->next;
+			}
+		}
+		if (!buf->failed && rem->name == NULL)
+			buf->failed = 1;
+		if (!buf->failed)
+			ir_remote_index_codes(rem);
+	}
+	if (buf->failed || i < remote_count) {
+		buf->failed = 1;
+		free_config(root);
+		return NULL;
+	}
+	return root;
+}
+
+
+static void cache_init_header(struct cache_header* header)
+{
+	memset(header, 0, sizeof(*header));
+	strncpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	strncpy(header->version, VERSION, sizeof(header->version) - 1);
+	header->format = CACHE_FORMAT;
+	header->remote_size = sizeof(struct ir_remote);
+	header->ncode_size = sizeof(struct ir_ncode);
+	header->code_size = sizeof(ir_code);
+	header->lirc_t_size = sizeof(lirc_t);
+	if (option_boolean(&opt_dynamic_codes))
+		header->flags |= CACHE_DYNCODES;
+}
+
+
+/**
+ * Load the remotes from the compiled cache at path if it was written for
+ * the same config and none of its sources have changed. Returns
+ * (void*)-1 if the cache cannot be used.
+ */
+static struct ir_remote* load_compiled(const char* path, const char* name)
+{
+	struct cache_header expected;
+	const struct cache_header* header;
+	const struct cache_source* src;
+	const char* src_path;
+	struct cache_buf buf = { NULL, 0, 0, 0 };
+	struct ir_remote* remotes = (struct ir_remote*)-1;
+	struct stat st;
+	void* map;
+	uint32_t count;
+	uint32_t i;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return remotes;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*header)) {
+		close(fd);
+		return remotes;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return remotes;
+	header = (const struct cache_header*)map;
+	cache_init_header(&expected);
+	expected.payload_size = st.st_size - sizeof(*header);
+	expected.hash = header->hash;
+	if (memcmp(header, &expected, sizeof(expected)) != 0) {
+		log_debug("Config cache %s: wrong format", path);
+		goto out;
+	}
+	buf.data = (char*)map + sizeof(*header);
+	buf.size = header->payload_size;
+	if (fnv1a(buf.data, buf.size) != header->hash) {
+		log_warn("Config cache %s is corrupt, ignored", path);
+		goto out;
+	}
+	count = cache_get_u32(&buf);
+	for (i = 0; i < count; i++) {
+		src = (const struct cache_source*)cache_get(&buf, sizeof(*src));
+		if (src == NULL)
+			goto out;
+		src_path = (const char*)cache_get(&buf, src->path_size);
+		if (src_path == NULL || src->path_size == 0
+		    || src_path[src->path_size - 1] != '\0')
+			goto out;
+		/* The first source is the main config file itself. */
+		if (i == 0 && strcmp(src_path, name) != 0) {
+			log_debug("Config cache %s: written for %s",
+				  path, src_path);
+			goto out;
+		}
+		if (!source_is_valid(src, src_path)) {
+			log_debug("Config cache %s: %s changed",
+				  path, src_path);
+			goto out;
+		}
+	}
+	if (pctx->lazy_raw && pctx->arena != NULL) {
+		/* Raw signals are used in place, unmapped with the arena. */
+		pctx->arena->map = map;
+		pctx->arena->map_size = st.st_size;
+	}
+	remotes = cache_get_remotes(&buf);
+	if (buf.failed) {
+		log_warn("Config cache %s is corrupt, ignored", path);
+		remotes = (struct ir_remote*)-1;
+	}
+out:
+	if (pctx->arena == NULL || pctx->arena->map != map)
+		munmap(map, st.st_size);
+	return remotes;
+}
+
+
+/** Atomically replace the compiled cache at path, log errors. */
+static void write_compiled(const char* path,
+			   struct cache_buf* sources,
+			   uint32_t source_count,
+			   const struct ir_remote* remotes)
+{
+	struct cache_header header;
+	struct cache_buf payload = { NULL, 0, 0, 0 };
+	char tmp[PATH_MAX];
+	int fd;
+	int ok;
+
+	cache_put_u32(&payload, source_count);
+	cache_put(&payload, sources->data, sources->len);
+	cache_put_remotes(&payload, remotes);
+	if (payload.failed || sources->failed) {
+		log_error("Config cache: out of memory");
+		free(payload.data);
+		return;
+	}
+	cache_init_header(&header);
+	header.payload_size = payload.len;
+	header.hash = fnv1a(payload.data, payload.len);
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+		log_error("Config cache: path too long: %s", path);
+		free(payload.data);
+		return;
+	}
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		log_perror_warn("Cannot create config cache %s", tmp);
+		free(payload.data);
+		return;
+	}
+	ok = fchmod(fd, 0644) == 0
+	     && write(fd, &header, sizeof(header)) == sizeof(header)
+	     && write(fd, payload.data, payload.len) == (ssize_t)payload.len;
+	ok = close(fd) == 0 && ok;
+	if (ok && rename(tmp, path) == 0) {
+		log_debug("Wrote config cache %s", path);
+	} else {
+		log_perror_warn("Cannot write config cache %s", path);
+		unlink(tmp);
+	}
+	free(payload.data);
+}
+
+
+struct ir_remote* read_config_compiled(FILE* f,
+				       const char* name,
+				       const char* cache_path)
+{
+	struct ir_remote* head;
+	struct cache_buf sources = { NULL, 0, 0, 0 };
+	struct parse_ctx ctx;
+
+	if (cache_path == NULL || *cache_path == '\0')
+		return read_config_cached(f, name);
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.arena = arena_new();
+	ctx.lazy_raw = option_boolean(&opt_lazy_raw_codes);
+	pctx = &ctx;
+	head = load_compiled(cache_path, name);
+	pctx = NULL;
+	arena_release(ctx.arena);
+	if (head != (void*)-1) {
+		log_info("Using compiled config %s", cache_path);
+		return head;
+	}
+	compile_sources = &sources;
+	compile_source_count = 0;
+	compile_failed = 0;
+	record_file(name, f);
+	head = read_config_cached(f, name);
+	compile_sources = NULL;
+	/* Don't cache configs missing files or having parse errors. */
+	if (head != (void*)-1 && !compile_failed)
+		write_compiled(cache_path, &sources, compile_source_count, head);
+	free(sources.data);
+	return head;
+}
+
+
+/**
+ * Parse a single config file.
+ *
+ * @param name Including file path.
+ * @paran depth Include depth, increased for each recursive inclusion.
+ * @param val include file absolute path, quoted.
+ * @param top_rem root of ir_remotes list.
+ * @return root of new list, with possibly added remotes.
+ *
+ */
+static struct ir_remote*
+read_included(const char* name, int depth, char* val, struct ir_remote* top_rem)
+{
+	FILE* childFile;
+	const char* childName;
+	struct ir_remote* rem = NULL;
+	struct config_cache_entry* entry = NULL;
+	struct stat st;
+	int saved_include_seen;
+
+	if (depth > MAX_INCLUDES) {
+		log_error("error opening child file defined at %s:%d", name, pctx->line);
+		log_error("too many files included");
+		compile_fail();
+		return top_rem;
+	}
+	childName = lirc_parse_include(val);
+	if (!childName) {
+		log_error("error parsing child file value defined at line %d:", pctx->line);
+		log_error("invalid quoting");
+		compile_fail();
+		return top_rem;
+	}
+	childFile = fopen(childName, "r");
+	if (childFile == NULL) {
+		log_error("error opening child file '%s' defined at line %d:",
+			  childName, pctx->line);
+		log_error("ignoring this child file for now.");
+		compile_fail();
+		return top_rem;
+	}
+	record_file(childName, childFile);
+	if (cache_active && fstat(fileno(childFile), &st) == 0) {
+		pthread_mutex_lock(&cache_lock);
+		entry = cache_lookup(childName);
+		if (entry != NULL && cache_is_valid(entry, &st)) {
+			log_trace("using cached '%s'", childName);
+			entry->generation = cache_generation;
+			rem = clone_remotes(entry->remotes, pctx->arena);
+			if (rem != NULL || entry->remotes == NULL) {
+				pthread_mutex_unlock(&cache_lock);
+				fclose(childFile);
+				return ir_remotes_append(top_rem, rem);
+			}
+		}
+		pthread_mutex_unlock(&cache_lock);
+	}
+	saved_include_seen = pctx->include_seen;
+	pctx->include_seen = 0;
+	rem = read_config_recursive(childFile, childName, depth + 1);
+	if (rem == (void*)-1)
+		compile_fail();
+	/* Files including other files are parsed each time. */
+	if (cache_active && !pctx->include_seen && rem != (void*)-1
+	    && fstat(fileno(childFile), &st) == 0) {
+		pthread_mutex_lock(&cache_lock);
+		cache_store(childName, &st, rem);
+		pthread_mutex_unlock(&cache_lock);
+	}
+	pctx->include_seen = saved_include_seen;
+	top_rem = ir_remotes_append(top_rem, rem);
+	fclose(childFile);
+	return top_rem;
+}
+
+
+/** The files matched by an include glob, parsed by include_worker(). */
+struct include_pool {
+	const char*		name;           /**< Including file. */
+	int			depth;
+	char**			paths;
+	size_t			count;
+	size_t			next;           /**< Next path to parse. */
+	int			use_arena;
+	int			dyncodes;
+	int			lazy_raw;
+	struct ir_remote**	remotes;        /**< Result for each path. */
+	int*			parse_errors;   /**< -1 if path wasn't parsed. */
+	pthread_mutex_t		lock;
+};
+
+
+/** Parse the next paths of an include_pool until all are taken. */
+static void* include_worker(void* arg)
+{
+	struct include_pool* pool = (struct include_pool*)arg;
+	struct parse_ctx* saved = pctx;
+	struct parse_ctx ctx;
+	char buff[256];
+	size_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.worker = 1;
+	ctx.dyncodes = pool->dyncodes;
+	ctx.lazy_raw = pool->lazy_raw;
+	ctx.arena = pool->use_arena ? arena_new() : NULL;
+	pctx = &ctx;
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->count)
+			break;
+		snprintf(buff, sizeof(buff), "\"%s\"", pool->paths[i]);
+		ctx.parse_error = -1;
+		pool->remotes[i] = read_included(pool->name, pool->depth,
+						 buff, NULL);
+		pool->parse_errors[i] = ctx.parse_error;
+	}
+	pctx = saved;
+	arena_release(ctx.arena);
+	return NULL;
+}
+
+
+/**
+ * Parse the files in globbuf on up to one thread per CPU, and append
+ * their remotes to top_rem in glob order. Returns (void*)-1 if the
+ * files have to be parsed sequentially.
+ */
+static struct ir_remote* read_parallel(const char*		name,
+				       int			depth,
+				       glob_t*			globbuf,
+				       struct ir_remote*	top_rem)
+{
+	struct include_pool pool;
+	pthread_t tids[MAX_INCLUDE_WORKERS];
+	long workers;
+	long started;
+	size_t i;
+
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > MAX_INCLUDE_WORKERS)
+		workers = MAX_INCLUDE_WORKERS;
+	if (workers > (long)globbuf->gl_pathc)
+		workers = globbuf->gl_pathc;
+	if (pctx->worker || workers < 2)
+		return (struct ir_remote*)-1;
+	memset(&pool, 0, sizeof(pool));
+	pool.name = name;
+	pool.depth = depth;
+	pool.paths = globbuf->gl_pathv;
+	pool.count = globbuf->gl_pathc;
+	pool.use_arena = pctx->arena != NULL;
+	pool.dyncodes = pctx->dyncodes;
+	pool.lazy_raw = pctx->lazy_raw;
+	pool.remotes = (struct ir_remote**)calloc(pool.count,
+						  sizeof(*pool.remotes));
+	pool.parse_errors = (int*)calloc(pool.count, sizeof(int));
+	if (pool.remotes == NULL || pool.parse_errors == NULL) {
+		free(pool.remotes);
+		free(pool.parse_errors);
+		return (struct ir_remote*)-1;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	for (started = 0; started < workers; started++)
+		if (pthread_create(&tids[started], NULL,
+				   include_worker, &pool) != 0)
+			break;
+	/* Whatever is left if threads could not be started. */
+	include_worker(&pool);
+	while (started > 0)
+		pthread_join(tids[--started], NULL);
+	pthread_mutex_destroy(&pool.lock);
+	for (i = 0; i < pool.count; i++) {
+		top_rem = ir_remotes_append(top_rem, pool.remotes[i]);
+		/* As if parsed in order: the last parsed file's result. */
+		if (pool.parse_errors[i] != -1)
+			pctx->parse_error = pool.parse_errors[i];
+	}
+	free(pool.remotes);
+	free(pool.parse_errors);
+	return top_rem;
+}
+
+
+/**
+ * Parse all include files matched by glob pattern
+ *
+ * @param name Including file path.
+ * @paran depth Include depth, increased for each recursive inclusion.
+ * @param val path in include parameter, quoted.
+ * @param top_rem root of existing ir_remotes list.
+ * @return root of new list, with possibly added remotes.
+ *
+ */
+static struct ir_remote* read_all_included(const char*		name,
+					   int			depth,
+					   char*		val,
+					   struct ir_remote*	top_rem)
+{
+	int i;
+	glob_t globbuf;
+	char buff[256] = { '\0' };
+	struct ir_remote* rem;
+
+	memset(&globbuf, 0, sizeof(globbuf));
+	val = val + 1;   // Strip quotes
+	val[strlen(val) - 1] = '\0';
+	lirc_parse_relative(buff, sizeof(buff), val, name);
+	glob(buff, 0, NULL, &globbuf);
+	record_glob(buff, &globbuf);
+	rem = read_parallel(name, depth, &globbuf, top_rem);
+	if (rem != (void*)-1) {
+		globfree(&globbuf);
+		return rem;
+	}
+	for (i = 0; i < globbuf.gl_pathc; i += 1) {
+		snprintf(buff, sizeof(buff), "\"%s\"", globbuf.gl_pathv[i]);
+		top_rem = read_included(name, depth, buff, top_rem);
+	}
+	globfree(&globbuf);
+	return top_rem;
+}
+
+
+/**
+ * Open addressing sets of the codes in a codes list, by name and by
+ * value, making the duplicate checks linear in the number of codes.
+ * Slots hold the codes list index + 1, 0 if free.
+ */
+struct ncode_index {
+	uint32_t*	names;
+	uint32_t*	values;
+	size_t		size;           /**< Slots in each set, power of two. */
+};
+
+
+static size_t ncode_name_hash(const struct ir_ncode* code)
+{
+	return fnv1a(code->name, strlen(code->name));
+}
+
+
+static size_t ncode_value_hash(const struct ir_ncode* code)
+{
+	const struct ir_code_node* node;
+	uint64_t hash = code->code * 0x9e3779b97f4a7c15ULL;
+
+	for (node = code->next; node != NULL; node = node->next)
+		hash = (hash ^ node->code) * 0x9e3779b97f4a7c15ULL;
+	return hash ^ (hash >> 32);
+}
+
+
+/** Return slot of a code in ar equal to code, or free slot. */
+static uint32_t* ncode_index_find(uint32_t* slots, size_t size,
+				  struct void_array* ar,
+				  struct ir_ncode* code,
+				  size_t hash,
+				  array_guest_func equals)
+{
+	size_t i;
+
+	for (i = hash & (size - 1); slots[i] != 0; i = (i + 1) & (size - 1)) {
+		if (equals(ar->ptr + (slots[i] - 1) * ar->item_size, code))
+			break;
+	}
+	return &slots[i];
+}
+
+
+/** Add code, which is or will be item i in ar, unless duplicated. */
+static void ncode_index_add(struct ncode_index* index,
+			    struct void_array* ar,
+			    struct ir_ncode* code,
+			    size_t i)
+{
+	uint32_t* slot;
+
+	slot = ncode_index_find(index->names, index->size, ar, code,
+				ncode_name_hash(code), array_guest_ncode_cmp);
+	if (*slot == 0)
+		*slot = i + 1;
+	slot = ncode_index_find(index->values, index->size, ar, code,
+				ncode_value_hash(code), array_guest_code_equals);
+	if (*slot == 0)
+		*slot = i + 1;
+}
+
+
+/** Double the sets and re-add the codes of ar, return 0 if no memory. */
+static int ncode_index_grow(struct ncode_index* index, struct void_array* ar)
+{
+	size_t size = index->size ? 2 * index->size : 64;
+	uint32_t* names = (uint32_t*)calloc(size, sizeof(uint32_t));
+	uint32_t* values = (uint32_t*)calloc(size, sizeof(uint32_t));
+	size_t i;
+
+	if (names == NULL || values == NULL) {
+		free(names);
+		free(values);
+		return 0;
+	}
+	free(index->names);
+	free(index->values);
+	index->names = names;
+	index->values = values;
+	index->size = size;
+	for (i = 0; i < ar->nr_items; i++)
+		ncode_index_add(index, ar, ar->ptr + i * ar->item_size, i);
+	return 1;
+}
+
+
+static void ncode_index_free(struct ncode_index* index)
+{
+	free(index->names);
+	free(index->values);
+	memset(index, 0, sizeof(struct ncode_index));
+}
+
+
+/**
+ * Log duplicated names and values of code, about to be added to ar, and
+ * add it to index.
+ */
+static void check_ncode_dups(const char* path,
+			     const char* name,
+			     struct void_array* ar,
+			     struct ncode_index* index,
+			     struct ir_ncode* code)
+{
+	int dup_name;
+	int dup_value;
+
+	if (ar->nr_items >= index->size / 2 && !ncode_index_grow(index, ar)) {
+		dup_name = foreach_void_array(ar, array_guest_ncode_cmp,
+					      code) != NULL;
+		dup_value = foreach_void_array(ar, array_guest_code_equals,
+					       code) != NULL;
+	} else {
+		dup_name = *ncode_index_find(index->names, index->size, ar,
+					     code, ncode_name_hash(code),
+					     array_guest_ncode_cmp) != 0;
+		dup_value = *ncode_index_find(index->values, index->size, ar,
+					      code, ncode_value_hash(code),
+					      array_guest_code_equals) != 0;
+		ncode_index_add(index, ar, code, ar->nr_items);
+	}
+	if (dup_name) {
+		log_notice("%s: %s: Multiple definitions of: %s",
+			   path, name, code->name);
+	}
+	if (dup_value) {
+		log_notice("%s: %s: Multiple values for same code: %s",
+			   path, name, code->name);
+	}
+}
+
+
+/**
+ * Finalize a parsed remote: handle the reverse and RC6 flags, convert
+ * legacy values and compute the signal lengths.
+ */
+static void finish_remote(struct ir_remote* rem)
+{
+	/* kick reverse flag */
+	/* handle RC6 flag to be backwards compatible: previous RC-6
+	 * config files did not set rc6_mask */
+	if ((!is_raw(rem)) && rem->flags & REVERSE) {
+		struct ir_ncode* codes;
+
+		if (has_pre(rem))
+			rem->pre_data = reverse(rem->pre_data, rem->pre_data_bits);
+		if (has_post(rem))
+			rem->post_data = reverse(rem->post_data, rem->post_data_bits);
+		codes = rem->codes;
+		while (codes->name != NULL) {
+			codes->code = reverse(codes->code, rem->bits);
+			codes++;
+		}
+		rem->flags = rem->flags & (~REVERSE);
+		rem->flags = rem->flags | COMPAT_REVERSE;
+		/* don't delete the flag because we still need
+		 * it to remain compatible with older versions
+		 */
+	}
+	if (rem->flags & RC6 && rem->rc6_mask == 0 && rem->toggle_bit > 0) {
+		int all_bits = bit_count(rem);
+
+		rem->rc6_mask = ((ir_code)1) << (all_bits - rem->toggle_bit);
+	}
+	if (rem->toggle_bit > 0) {
+		int all_bits = bit_count(rem);
+
+		if (has_toggle_bit_mask(rem)) {
+			log_warn("%s uses both toggle_bit and toggle_bit_mask", rem->name);
+		} else {
+			rem->toggle_bit_mask = ((ir_code)1) << (all_bits - rem->toggle_bit);
+		}
+		rem->toggle_bit = 0;
+	}
+	if (has_toggle_bit_mask(rem)) {
+		if (!is_raw(rem) && rem->codes) {
+			rem->toggle_bit_mask_state = (rem->codes->code & rem->toggle_bit_mask);
+			if (rem->toggle_bit_mask_state)
+				/* start with state set to 0 for backwards compatibility */
+				rem->toggle_bit_mask_state ^= rem->toggle_bit_mask;
+		}
+	}
+	if (is_serial(rem)) {
+		lirc_t base;
+
+		if (rem->baud > 0) {
+			base = 1000000 / rem->baud;
+			if (rem->pzero == 0 && rem->szero == 0)
+				rem->pzero = base;
+			if (rem->pone == 0 && rem->sone == 0)
+				rem->sone = base;
+		}
+		if (rem->bits_in_byte == 0)
+			rem->bits_in_byte = 8;
+	}
+	if (rem->min_code_repeat > 0) {
+		if (!has_repeat(rem) || rem->min_code_repeat > rem->min_repeat) {
+			log_warn("invalid min_code_repeat value");
+			rem->min_code_repeat = 0;
+		}
+	}
+	/* Uses the send buffer, shared with other include workers. */
+	if (send_lock_func != NULL)
+		send_lock_func();
+	pthread_mutex_lock(&sim_lock);
+	calculate_signal_lengths(rem);
+	pthread_mutex_unlock(&sim_lock);
+	if (send_unlock_func != NULL)
+		send_unlock_func();
+	if (rem->raw_source != NULL)
+		unload_raw_signals(rem);
+	ir_remote_index_codes(rem);
+}
+
+
+static struct ir_remote*
+read_config_recursive(FILE* f, const char* name, int depth)
+{
+	char buf[LINE_LEN + 1];
+	char* key;
+	char* val;
+	char* val2;
+	char* tok;
+	int len, argc;
+	struct ir_remote* top_rem = NULL;
+	struct ir_remote* rem = NULL;
+	struct void_array codes_list, raw_codes, signals;
+	struct ncode_index code_index = { NULL, NULL, 0 };
+	struct ir_ncode raw_code = { NULL, 0, 0, NULL };
+	struct ir_ncode name_code = { NULL, 0, 0, NULL };
+	struct ir_ncode* code;
+	int mode = ID_none;
+
+	pctx->line = 0;
+	pctx->parse_error = 0;
+	log_trace1("parsing '%s'", name);
+
+	while (fgets(buf, LINE_LEN, f) != NULL) {
+		pctx->line++;
+		len = strlen(buf);
+		if (len == LINE_LEN && buf[len - 1] != '\n') {
+			log_error("line %d too long in config file", pctx->line);
+			pctx->parse_error = 1;
+			break;
+		}
+
+		if (len > 0) {
+			len--;
+			if (buf[len] == '\n')
+				buf[len] = 0;
+		}
+		if (len > 0) {
+			len--;
+			if (buf[len] == '\r')
+				buf[len] = 0;
 		}
 		/* ignore comments */
 		if (buf[0] == '#')
 			continue;
-		key = strtok(buf, whitespace);
+		key = strtok_r(buf, whitespace, &tok);
 		/* ignore empty lines */
 		if (key == NULL)
 			continue;
-		val = strtok(NULL, whitespace);
+		val = strtok_r(NULL, whitespace, &tok);
 		if (val != NULL) {
-			val2 = strtok(NULL, whitespace);
+			val2 = strtok_r(NULL, whitespace, &tok);
 			log_trace2("Tokens: \"%s\" \"%s\" \"%s\"", key, val, (val2 == NULL ? "(null)" : val));
 			if (strcasecmp("include", key) == 0) {
-				int save_line = line;
+				int save_line = pctx->line;
 
+				pctx->include_seen = 1;
 				top_rem = read_all_included(name,
 							    depth,
 							    val,
 							    top_rem);
-				line = save_line;
+				pctx->line = save_line;
 			} else if (strcasecmp("begin", key) == 0) {
 				if (strcasecmp("codes", val) == 0) {
 					/* init codes mode */
@@ -1000,13 +2627,14 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					if (!checkMode(mode, ID_remote, "begin codes"))
 						break;
 					if (rem->codes) {
-						log_error("error in configfile line %d:", line);
+						log_error("error in configfile line %d:", pctx->line);
 						log_error("codes are already defined");
-						parse_error = 1;
+						pctx->parse_error = 1;
 						break;
 					}
 
 					init_void_array(&codes_list, 30, sizeof(struct ir_ncode));
+					ncode_index_free(&code_index);
 					mode = ID_codes;
 				} else if (strcasecmp("raw_codes", val) == 0) {
 					/* init raw_codes mode */
@@ -1014,14 +2642,16 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					if (!checkMode(mode, ID_remote, "begin raw_codes"))
 						break;
 					if (rem->codes) {
-						log_error("error in configfile line %d:", line);
+						log_error("error in configfile line %d:", pctx->line);
 						log_error("codes are already defined");
-						parse_error = 1;
+						pctx->parse_error = 1;
 						break;
 					}
 					set_protocol(rem, RAW_CODES);
 					raw_code.code = 0;
 					init_void_array(&raw_codes, 30, sizeof(struct ir_ncode));
+					if (pctx->lazy_raw && rem->raw_source == NULL)
+						rem->raw_source = raw_source_new(f, name);
 					mode = ID_raw_codes;
 				} else if (strcasecmp("remote", val) == 0) {
 					/* create new remote */
@@ -1032,35 +2662,36 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					if (!top_rem) {
 						/* create first remote */
 						log_trace1("creating first remote");
-						rem = top_rem = s_malloc(sizeof(struct ir_remote));
+						rem = top_rem = arena_new_remote(pctx->arena);
 						rem->freq = DEFAULT_FREQ;
 					} else {
 						/* create new remote */
 						log_trace1("creating next remote");
-						rem = s_malloc(sizeof(struct ir_remote));
+						rem = arena_new_remote(pctx->arena);
 						rem->freq = DEFAULT_FREQ;
 						ir_remotes_append(top_rem, rem);
 					}
 				} else if (mode == ID_codes) {
 					code = defineCode(key, val, &name_code);
-					while (!parse_error && val2 != NULL) {
+					while (!pctx->parse_error && val2 != NULL) {
 						if (val2[0] == '#')
 							break;  /* comment */
 						defineNode(code, val2);
-						val2 = strtok(NULL, whitespace);
+						val2 = strtok_r(NULL, whitespace, &tok);
 					}
 					code->current = NULL;
-					check_ncode_dups(name, rem->name, &codes_list, code);
+					check_ncode_dups(name, rem->name, &codes_list,
+							 &code_index, code);
 					add_void_array(&codes_list, code);
 				} else {
-					log_error("error in configfile line %d:", line);
+					log_error("error in configfile line %d:", pctx->line);
 					log_error("unknown section \"%s\"", val);
-					parse_error = 1;
+					pctx->parse_error = 1;
 				}
-				if (!parse_error && val2 != NULL) {
+				if (!pctx->parse_error && val2 != NULL) {
 					log_warn("%s: garbage after '%s' token "
 						  "in line %d ignored",
-						  rem->name, val, line);
+						  rem->name, val, pctx->line);
 				}
 			} else if (strcasecmp("end", key) == 0) {
 				if (strcasecmp("codes", val) == 0) {
@@ -1068,19 +2699,20 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					log_trace1("    end codes");
 					if (!checkMode(mode, ID_codes, "end codes"))
 						break;
-					rem->codes = get_void_array(&codes_list);
+					rem->codes = finish_void_array(&codes_list);
 					mode = ID_remote;       /* switch back */
 				} else if (strcasecmp("raw_codes", val) == 0) {
 					/* end raw codes mode */
 					log_trace1("    end raw_codes");
 
 					if (mode == ID_raw_name) {
-						raw_code.signals = get_void_array(&signals);
+						raw_code.signals = finish_signals(&signals,
+										  &raw_code);
 						raw_code.length = signals.nr_items;
 						if (raw_code.length % 2 == 0) {
-							log_error("error in configfile line %d:", line);
+							log_error("error in configfile line %d:", pctx->line);
 							log_error("bad signal length");
-							parse_error = 1;
+							pctx->parse_error = 1;
 						}
 						if (!add_void_array(&raw_codes, &raw_code))
 							break;
@@ -1088,7 +2720,7 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					}
 					if (!checkMode(mode, ID_raw_codes, "end raw_codes"))
 						break;
-					rem->codes = get_void_array(&raw_codes);
+					rem->codes = finish_void_array(&raw_codes);
 					mode = ID_remote;       /* switch back */
 				} else if (strcasecmp("remote", val) == 0) {
 					/* end remote mode */
@@ -1097,10 +2729,10 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					if (!checkMode(mode, ID_remote, "end remote"))
 						break;
 					if (!sanityChecks(rem, name)) {
-						parse_error = 1;
+						pctx->parse_error = 1;
 						break;
 					}
-					if (options_getboolean("lircd:dynamic-codes")) {
+					if (pctx->dyncodes) {
 						if (rem->dyncodes_name == NULL)
 							rem->dyncodes_name = s_strdup("unknown");
 						rem->dyncodes[0].name = rem->dyncodes_name;
@@ -1110,52 +2742,59 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					 * clear the alloced memory */
 					rem->next = NULL;
 					rem->last_code = NULL;
+					finish_remote(rem);
 					mode = ID_none; /* switch back */
 				} else if (mode == ID_codes) {
 					code = defineCode(key, val, &name_code);
-					while (!parse_error && val2 != NULL) {
+					while (!pctx->parse_error && val2 != NULL) {
 						if (val2[0] == '#')
 							break;  /* comment */
 						defineNode(code, val2);
-						val2 = strtok(NULL, whitespace);
+						val2 = strtok_r(NULL, whitespace, &tok);
 					}
 					code->current = NULL;
+					/* Compared with later codes, not checked. */
+					if (code_index.size > 0)
+						ncode_index_add(&code_index,
+								&codes_list, code,
+								codes_list.nr_items);
 					add_void_array(&codes_list, code);
 				} else {
-					log_error("error in configfile line %d:", line);
+					log_error("error in configfile line %d:", pctx->line);
 					log_error("unknown section %s", val);
-					parse_error = 1;
+					pctx->parse_error = 1;
 				}
-				if (!parse_error && val2 != NULL) {
+				if (!pctx->parse_error && val2 != NULL) {
 					log_warn(
 						  "%s: garbage after '%s'"
 						  " token in line %d ignored",
-						  rem->name, val, line);
+						  rem->name, val, pctx->line);
 				}
 			} else {
 				switch (mode) {
 				case ID_remote:
 					argc = defineRemote(key, val, val2, rem);
-					if (!parse_error
+					if (!pctx->parse_error
 					    && ((argc == 1 && val2 != NULL)
-						|| (argc == 2 && val2 != NULL && strtok(NULL, whitespace) != NULL))) {
+						|| (argc == 2 && val2 != NULL && strtok_r(NULL, whitespace, &tok) != NULL))) {
 						log_warn("%s: garbage after '%s'"
 							  " token in line %d ignored",
-							  rem->name, key, line);
+							  rem->name, key, pctx->line);
 					}
 					break;
 				case ID_codes:
 					code = defineCode(key, val, &name_code);
-					while (!parse_error && val2 != NULL) {
+					while (!pctx->parse_error && val2 != NULL) {
 						if (val2[0] == '#')
 							break;  /* comment */
 						defineNode(code, val2);
-						val2 = strtok(NULL, whitespace);
+						val2 = strtok_r(NULL, whitespace, &tok);
 					}
 					code->current = NULL;
 					check_ncode_dups(name,
 							 rem->name,
 							 &codes_list,
+							 &code_index,
 							 code);
 					add_void_array(&codes_list, code);
 					break;
@@ -1164,33 +2803,41 @@ read_config_recursive(FILE* f, const char* name, int depth)
 					if (strcasecmp("name", key) == 0) {
 						log_trace2("Button: \"%s\"", val);
 						if (mode == ID_raw_name) {
-							raw_code.signals = get_void_array(&signals);
+							raw_code.signals =
+								finish_signals(&signals,
+									       &raw_code);
 							raw_code.length = signals.nr_items;
 							if (raw_code.length % 2 == 0) {
 								log_error("error in configfile line %d:",
-									  line);
+									  pctx->line);
 								log_error("bad signal length");
-								parse_error = 1;
+								pctx->parse_error = 1;
 							}
 							if (!add_void_array(&raw_codes, &raw_code))
 								break;
 						}
-						raw_code.name = s_strdup(val);
+						raw_code.name = s_strdup_name(
+							val, &raw_code.atom);
 						if (!raw_code.name)
 							break;
 						raw_code.code++;
+						raw_code.raw_offset = 0;
+						if (rem->raw_source != NULL)
+							raw_code.raw_offset = ftell(f);
+						if (raw_code.raw_offset < 0)
+							raw_code.raw_offset = 0;
 						init_void_array(&signals, 50, sizeof(lirc_t));
 						mode = ID_raw_name;
-						if (!parse_error && val2 != NULL) {
+						if (!pctx->parse_error && val2 != NULL) {
 							log_warn("%s: garbage after '%s'"
 								 " token in line %d ignored",
-								 rem->name, key, line);
+								 rem->name, key, pctx->line);
 						}
 					} else {
 						if (mode == ID_raw_codes) {
 							log_error("no name for signal defined at line %d",
-								  line);
-							parse_error = 1;
+								  pctx->line);
+							pctx->parse_error = 1;
 							break;
 						}
 						if (!addSignal(&signals, key))
@@ -1200,7 +2847,7 @@ read_config_recursive(FILE* f, const char* name, int depth)
 						if (val2)
 							if (!addSignal(&signals, val2))
 								break;
-						while ((val = strtok(NULL, whitespace)))
+						while ((val = strtok_r(NULL, whitespace, &tok)))
 							if (!addSignal(&signals, val))
 								break;
 					}
@@ -1211,114 +2858,43 @@ read_config_recursive(FILE* f, const char* name, int depth)
 			if (!addSignal(&signals, key))
 				break;
 		} else {
-			log_error("error in configfile line %d", line);
-			parse_error = 1;
+			log_error("error in configfile line %d", pctx->line);
+			pctx->parse_error = 1;
 			break;
 		}
-		if (parse_error)
+		if (pctx->parse_error)
 			break;
 	}
 	if (mode != ID_none) {
 		switch (mode) {
 		case ID_raw_name:
 			if (raw_code.name != NULL) {
-				free(raw_code.name);
+				s_free(raw_code.name);
 				if (get_void_array(&signals) != NULL)
 					free(get_void_array(&signals));
 			}
 		case ID_raw_codes:
-			rem->codes = get_void_array(&raw_codes);
+			rem->codes = finish_void_array(&raw_codes);
 			break;
 		case ID_codes:
-			rem->codes = get_void_array(&codes_list);
+			rem->codes = finish_void_array(&codes_list);
 			break;
 		}
-		if (!parse_error) {
+		if (!pctx->parse_error) {
 			log_error("unexpected end of file");
-			parse_error = 1;
+			pctx->parse_error = 1;
 		}
 	}
-	if (parse_error) {
-		static int print_error = 1;
-
-		if (print_error) {
+	if (pctx->parse_error) {
+		if (!pctx->error_logged) {
 			log_error("reading of file '%s' failed", name);
-			print_error = 0;
+			pctx->error_logged = 1;
 		}
+		ncode_index_free(&code_index);
 		free_config(top_rem);
-		if (depth == 0)
-			print_error = 1;
 		return (void*)-1;
 	}
-	/* kick reverse flag */
-	/* handle RC6 flag to be backwards compatible: previous RC-6
-	 * config files did not set rc6_mask */
-	rem = top_rem;
-	while (rem != NULL) {
-		if ((!is_raw(rem)) && rem->flags & REVERSE) {
-			struct ir_ncode* codes;
-
-			if (has_pre(rem))
-				rem->pre_data = reverse(rem->pre_data, rem->pre_data_bits);
-			if (has_post(rem))
-				rem->post_data = reverse(rem->post_data, rem->post_data_bits);
-			codes = rem->codes;
-			while (codes->name != NULL) {
-				codes->code = reverse(codes->code, rem->bits);
-				codes++;
-			}
-			rem->flags = rem->flags & (~REVERSE);
-			rem->flags = rem->flags | COMPAT_REVERSE;
-			/* don't delete the flag because we still need
-			 * it to remain compatible with older versions
-			 */
-		}
-		if (rem->flags & RC6 && rem->rc6_mask == 0 && rem->toggle_bit > 0) {
-			int all_bits = bit_count(rem);
-
-			rem->rc6_mask = ((ir_code)1) << (all_bits - rem->toggle_bit);
-		}
-		if (rem->toggle_bit > 0) {
-			int all_bits = bit_count(rem);
-
-			if (has_toggle_bit_mask(rem)) {
-				log_warn("%s uses both toggle_bit and toggle_bit_mask", rem->name);
-			} else {
-				rem->toggle_bit_mask = ((ir_code)1) << (all_bits - rem->toggle_bit);
-			}
-			rem->toggle_bit = 0;
-		}
-		if (has_toggle_bit_mask(rem)) {
-			if (!is_raw(rem) && rem->codes) {
-				rem->toggle_bit_mask_state = (rem->codes->code & rem->toggle_bit_mask);
-				if (rem->toggle_bit_mask_state)
-					/* start with state set to 0 for backwards compatibility */
-					rem->toggle_bit_mask_state ^= rem->toggle_bit_mask;
-			}
-		}
-		if (is_serial(rem)) {
-			lirc_t base;
-
-			if (rem->baud > 0) {
-				base = 1000000 / rem->baud;
-				if (rem->pzero == 0 && rem->szero == 0)
-					rem->pzero = base;
-				if (rem->pone == 0 && rem->sone == 0)
-					rem->sone = base;
-			}
-			if (rem->bits_in_byte == 0)
-				rem->bits_in_byte = 8;
-		}
-		if (rem->min_code_repeat > 0) {
-			if (!has_repeat(rem) || rem->min_code_repeat > rem->min_repeat) {
-				log_warn("invalid min_code_repeat value");
-				rem->min_code_repeat = 0;
-			}
-		}
-		calculate_signal_lengths(rem);
-		rem = rem->next;
-	}
-
+	ncode_index_free(&code_index);
 	return top_rem;
 }
 
@@ -1403,16 +2979,133 @@ void calculate_signal_lengths(struct ir_remote* remote)
 	}
 	log_trace("lengths: %lu %lu %lu %lu", remote->min_total_signal_length, remote->max_total_signal_length,
 		  remote->min_gap_length, remote->max_gap_length);
+	ir_remote_calc_limits(remote);
+}
+
+
+void set_send_lock_funcs(void (*lock)(void), void (*unlock)(void))
+{
+	send_lock_func = lock;
+	send_unlock_func = unlock;
 }
 
+
+void config_update_timing(struct ir_remote* remote)
+{
+	pthread_mutex_lock(&sim_lock);
+	calculate_signal_lengths(remote);
+	pthread_mutex_unlock(&sim_lock);
+	send_buffer_cache_clear();
+	rec_buffer_forget_remotes();
+}
+
+static size_t arena_size(const struct config_arena* arena)
+{
+	const struct arena_chunk* chunk;
+	size_t size = sizeof(*arena);
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+		size += chunk->size;
+	return size;
+}
+
+
+/** Return true unless the signals of code are loaded lazily. */
+static int in_arena(const struct ir_remote*	remote,
+		    const struct ir_ncode*	code)
+{
+	return remote->raw_source == NULL || code->raw_offset == 0;
+}
+
+
+static int in_map(const struct config_arena* arena, const lirc_t* signals)
+{
+	return arena->map != NULL && (const char*)signals >= (char*)arena->map
+	       && (const char*)signals < (char*)arena->map + arena->map_size;
+}
+
+
+void config_memory(const struct ir_remote* remotes,
+		   struct config_memory* usage)
+{
+	const struct config_arena* arena = NULL;
+	const struct ir_remote* remote;
+	const struct ir_ncode* code;
+	const struct ir_code_node* node;
+	size_t arena_bytes = 0;
+	size_t arena_raw = 0;
+	size_t raw;
+
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		usage->config += ir_remote_index_memory(remote);
+		if (remote->arena != NULL && remote->arena != arena) {
+			/* Remotes sharing an arena follow each other. */
+			arena = remote->arena;
+			arena_bytes += arena_size(arena);
+		}
+		if (remote->arena == NULL) {
+			usage->config += sizeof(*remote);
+			if (remote->name != NULL)
+				usage->config += strlen(remote->name) + 1;
+			if (remote->dyncodes_name != NULL)
+				usage->config +=
+					strlen(remote->dyncodes_name) + 1;
+		}
+		for (code = remote->codes; code && code->name; code++) {
+			raw = code->signals != NULL ?
+			      code->length * sizeof(lirc_t) : 0;
+			if (remote->arena == NULL) {
+				usage->config += sizeof(*code)
+						 + strlen(code->name) + 1;
+				for (node = code->next; node; node = node->next)
+					usage->config += sizeof(*node);
+			} else if (in_map(remote->arena, code->signals)) {
+				raw = 0;
+			} else if (in_arena(remote, code)) {
+				arena_raw += raw;
+			}
+			usage->raw += raw;
+		}
+		if (remote->arena == NULL && remote->codes != NULL)
+			usage->config += sizeof(*code); /* End marker. */
+	}
+	usage->config += arena_bytes - (arena_raw < arena_bytes ?
+					arena_raw : arena_bytes);
+}
+
+
+void config_cache_memory(struct config_memory* usage)
+{
+	const struct config_cache_entry* entry;
+
+	for (entry = config_cache; entry != NULL; entry = entry->next) {
+		usage->config += sizeof(*entry) + strlen(entry->path) + 1;
+		config_memory(entry->remotes, usage);
+	}
+}
+
+
 void free_config(struct ir_remote* remotes)
 {
 	struct ir_remote* next;
 	struct ir_ncode* codes;
 
+	if (remotes != NULL)
+		rec_buffer_forget_remotes();
 	while (remotes != NULL) {
 		next = remotes->next;
 
+		ir_remote_free_index(remotes);
+		ir_remote_free_order(remotes);
+		ir_remote_free_scancode_index(remotes);
+		if (remotes->arena != NULL) {
+			/* All parts but loaded raw signals live in the arena. */
+			if (remotes->raw_source != NULL)
+				unload_raw_signals(remotes);
+			arena_release(remotes->arena);
+			remotes = next;
+			continue;
+		}
 		if (remotes->dyncodes_name != NULL)
 			free(remotes->dyncodes_name);
 		if (remotes->name != NULL)
@@ -1436,6 +3129,7 @@ void free_config(struct ir_remote* remotes)
 			}
 			free(remotes->codes);
 		}
+		free(remotes->raw_source);
 		free(remotes);
 		remotes = next;
 	}
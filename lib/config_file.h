@@ -30,12 +30,86 @@ extern "C" {
 /**
  * Parse a lircd.conf config file.
  *
+ * Files matched by an include glob are parsed by a thread per CPU,
+ * their remotes are appended in glob order. Signal lengths are computed
+ * in the send buffer, callers sending in other threads must serialize,
+ * see set_send_lock_funcs().
+ *
  * @param f Open FILE* connection to file.
  * @param name Normally the path for the open file f.
  * @return Pointer to dynamically allocated ir_remote or NULL on errors,
  */
 struct ir_remote* read_config(FILE* f, const char* name);
 
+/**
+ * Like read_config(), but remotes in included files which are unchanged
+ * since the last call are copied from a cache instead of being parsed
+ * again. A file is considered unchanged if device, inode, size and
+ * modification time are the same. Files which themselves include other
+ * files are always parsed. The returned list is owned by the caller like
+ * the one from read_config(). Its remotes are allocated from a single
+ * arena, released as a whole when the last of them is freed, so parts
+ * of them must not be free()'d individually.
+ */
+struct ir_remote* read_config_cached(FILE* f, const char* name);
+
+/**
+ * Like read_config_cached(), but first try to load the remotes from
+ * the compiled cache at cache_path. The cache is used if it was
+ * written by the same lirc version for the same main config file and
+ * none of the files read or directories searched by include lines have
+ * changed, otherwise the config is parsed and the cache rewritten. A
+ * NULL or empty cache_path disables the cache.
+ */
+struct ir_remote* read_config_compiled(FILE* f,
+				       const char* name,
+				       const char* cache_path);
+
+/**
+ * Make sure the signals of a raw code are loaded. If lircd:lazy-raw-codes
+ * is set, read_config_cached() only keeps the offsets of raw code
+ * signals in the config file and this reads them on first use. Returns
+ * 0 if the signals are missing, e. g. because the file has changed.
+ */
+int load_raw_signals(const struct ir_remote* remote, struct ir_ncode* code);
+
+/**
+ * Recompute what depends on the timing of a loaded remote after its eps,
+ * aeps or gap has been changed in place: the signal and gap lengths, the
+ * expect() limits, cached send signals and remembered bursts. Nothing
+ * may decode or send meanwhile. The change is not written to any file,
+ * the next read_config() restores the parsed values.
+ */
+void config_update_timing(struct ir_remote* remote);
+
+/**
+ * Set the functions called around computing the signal lengths of a
+ * parsed remote in the send buffer. A caller using the send buffer in
+ * other threads passes its lock here instead of holding it during the
+ * whole read_config(). NULL functions are not called.
+ */
+void set_send_lock_funcs(void (*lock)(void), void (*unlock)(void));
+
+/** Release all memory used by the read_config_cached() cache. */
+void free_config_cache(void);
+
+/** Memory used by remotes, see config_memory(). */
+struct config_memory {
+	size_t	config;         /**< Remotes, codes, names and indexes. */
+	size_t	raw;            /**< Signals of raw codes. */
+};
+
+/**
+ * Add the memory used by the list of remotes to *usage. Signals in a
+ * mapped compiled cache and names shared in the atom table are not
+ * counted, nor is the overhead of malloc().
+ */
+void config_memory(const struct ir_remote* remotes,
+		   struct config_memory* usage);
+
+/** Add the memory used by the read_config_cached() cache to *usage. */
+void config_cache_memory(struct config_memory* usage);
+
 /** Free() an ir_remote instance obtained using read_config(). */
 void free_config(struct ir_remote* remotes);
 
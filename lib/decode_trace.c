@@ -0,0 +1,153 @@
+/****************************************************************************
+** decode_trace.c **********************************************************
+****************************************************************************
+*/
+
+/**
+ * @file decode_trace.c
+ * @brief Implements decode_trace.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "lirc_log.h"
+#include "ir_remote_types.h"
+#include "decode_trace.h"
+
+static const logchannel_t logchannel = LOG_LIB;
+
+struct decode_trace decode_trace = { NULL, 0, 0 };
+
+static const char* const reasons[] = {
+	[DT_FAIL_NONE]			= "(none)",
+	[DT_FAIL_HEADER_MISMATCH]	= "header mismatch",
+	[DT_FAIL_SYNC]			= "sync",
+	[DT_FAIL_REPEAT_HEADER]		= "repeat header",
+	[DT_FAIL_LAST_CODE]		= "repeat without last code",
+	[DT_FAIL_HEADER]		= "header",
+	[DT_FAIL_RAW]			= "no raw code",
+	[DT_FAIL_LEAD]			= "leading pulse",
+	[DT_FAIL_PRE]			= "pre data",
+	[DT_FAIL_CODE]			= "code",
+	[DT_FAIL_POST]			= "post data",
+	[DT_FAIL_TRAIL]			= "trailing pulse",
+	[DT_FAIL_FOOT]			= "foot",
+	[DT_FAIL_GAP]			= "gap",
+	[DT_FAIL_LENGTH]		= "code length",
+};
+
+
+int decode_trace_set_size(unsigned int size)
+{
+	struct decode_trace_event* events = NULL;
+	uint32_t n = 0;
+
+	if (size > 0) {
+		for (n = 16; n < size && n < (1U << 24); n <<= 1)
+			;
+		events = (struct decode_trace_event*)
+			 calloc(n, sizeof(struct decode_trace_event));
+		if (events == NULL) {
+			log_error("Out of memory for decode trace");
+			n = 0;
+		}
+	}
+	decode_trace.mask = 0;
+	free(decode_trace.events);
+	decode_trace.events = events;
+	decode_trace.head = 0;
+	decode_trace.mask = n > 0 ? n - 1 : 0;
+	return size == 0 || events != NULL;
+}
+
+
+size_t decode_trace_memory(void)
+{
+	if (decode_trace.events == NULL)
+		return 0;
+	return (decode_trace.mask + 1) * sizeof(struct decode_trace_event);
+}
+
+
+static const char* remote_name(const struct ir_remote* remotes,
+			       const struct decode_trace_event* ev)
+{
+	const struct ir_remote* remote;
+	uintptr_t p = (uintptr_t)(((uint64_t)ev->aux << 32) | ev->value);
+
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		if ((uintptr_t)remote == p)
+			return remote->name;
+	}
+	return "(unknown remote)";
+}
+
+
+static int dump_event(FILE* f, const struct ir_remote* remotes,
+		      const struct decode_trace_event* ev,
+		      const char** last_remote)
+{
+	switch (ev->type) {
+	case DT_SAMPLE:
+		return fprintf(f, "%s %u\n",
+			       ev->value & PULSE_BIT ? "pulse" : "space",
+			       ev->value & PULSE_MASK);
+	case DT_TIMEOUT:
+		return fprintf(f, "timeout %u\n", ev->value);
+	case DT_SYNC:
+		return fprintf(f, "    sync %u\n", ev->value);
+	case DT_ATTEMPT:
+		*last_remote = remote_name(remotes, ev);
+		return fprintf(f, "  attempt %s\n", *last_remote);
+	case DT_MEMO:
+		return fprintf(f, "    same timing as before, result %u\n",
+			       ev->value);
+	case DT_EXPECT_PULSE:
+	case DT_EXPECT_SPACE:
+		return fprintf(f, "    expected %s %u, got %u\n",
+			       ev->type == DT_EXPECT_PULSE ? "pulse" : "space",
+			       ev->value, ev->aux);
+	case DT_REJECT:
+		return fprintf(f, "    rejected %s: %s\n", *last_remote,
+			       ev->reason < sizeof(reasons) / sizeof(*reasons)
+			       ? reasons[ev->reason] : "?");
+	case DT_DECODED:
+		return fprintf(f, "    decoded %s: 0x%08x%08x\n", *last_remote,
+			       ev->aux, ev->value);
+	case DT_RECALL:
+		return fprintf(f, "    remembered burst, %u edges\n",
+			       ev->value);
+	default:
+		return fprintf(f, "bad event type %u\n", ev->type);
+	}
+}
+
+
+int decode_trace_dump(FILE* f, const struct ir_remote* remotes)
+{
+	const char* last_remote = "(unknown remote)";
+	uint32_t head = decode_trace.head;
+	uint32_t size = decode_trace.mask + 1;
+	uint32_t i;
+	uint32_t first;
+
+	if (decode_trace.mask == 0)
+		return fprintf(f, "# decode trace disabled\n") < 0 ? -1 : 0;
+	first = head > size ? head - size : 0;
+	if (fprintf(f, "# lirc decode trace, %u of %u events\n",
+		    head - first, head) < 0)
+		return -1;
+	for (i = first; i != head; i++) {
+		if (dump_event(f, remotes,
+			       &decode_trace.events[i & decode_trace.mask],
+			       &last_remote) < 0)
+			return -1;
+	}
+	return head - first;
+}
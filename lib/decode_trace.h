@@ -0,0 +1,129 @@
+/****************************************************************************
+** decode_trace.h **********************************************************
+****************************************************************************
+*/
+
+/**
+ * @file decode_trace.h
+ * @brief In-memory ring of decoding events for post-mortem analysis.
+ * @ingroup private_api
+ *
+ * When enabled, receive.c records every sample read, every sync point,
+ * each remote tried, each failed expectation and why a remote was
+ * rejected in a fixed size ring, overwriting the oldest events. Adding
+ * an event is a few stores, so the ring can be kept on in production
+ * and dumped when a remote fails to decode, see the lircd
+ * DUMP_DECODE_TRACE command.
+ */
+
+#ifndef DECODE_TRACE_H
+#define DECODE_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ir_remote_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Kind of event, decode_trace_event.type. */
+enum decode_trace_type {
+	DT_SAMPLE = 1,          /**< value: lirc_t from driver. */
+	DT_TIMEOUT,             /**< value: timeout (us), no data. */
+	DT_SYNC,                /**< value: leading gap (us), 0 if none. */
+	DT_ATTEMPT,             /**< value, aux: struct ir_remote*. */
+	DT_MEMO,                /**< Result reused, value: result. */
+	DT_EXPECT_PULSE,        /**< value: expected, aux: got (us). */
+	DT_EXPECT_SPACE,        /**< value: expected, aux: got (us). */
+	DT_REJECT,              /**< reason: enum decode_trace_reason. */
+	DT_DECODED,             /**< value, aux: low, high code bits. */
+	DT_RECALL               /**< Burst remembered, value: edges. */
+};
+
+/** Why decoding a remote failed, decode_trace_event.reason. */
+enum decode_trace_reason {
+	DT_FAIL_NONE = 0,
+	DT_FAIL_HEADER_MISMATCH,        /**< reject_by_header(). */
+	DT_FAIL_SYNC,
+	DT_FAIL_REPEAT_HEADER,
+	DT_FAIL_LAST_CODE,              /**< Repeat without last code. */
+	DT_FAIL_HEADER,
+	DT_FAIL_RAW,                    /**< No raw code matched. */
+	DT_FAIL_LEAD,
+	DT_FAIL_PRE,
+	DT_FAIL_CODE,
+	DT_FAIL_POST,
+	DT_FAIL_TRAIL,
+	DT_FAIL_FOOT,
+	DT_FAIL_GAP,
+	DT_FAIL_LENGTH                  /**< Wrong code length (lirccode). */
+};
+
+/** One recorded event. */
+struct decode_trace_event {
+	uint8_t		type;           /**< enum decode_trace_type. */
+	uint8_t		reason;         /**< enum decode_trace_reason. */
+	uint16_t	reserved;
+	uint32_t	value;
+	uint32_t	aux;
+};
+
+/** The ring, only to be used by the inline functions below. */
+struct decode_trace {
+	struct decode_trace_event*	events;
+	uint32_t			mask;   /**< Size - 1, 0 if disabled. */
+	uint32_t			head;   /**< Events added, ever. */
+};
+
+extern struct decode_trace decode_trace;
+
+/**
+ * Enable the ring or change its size, discarding all events.
+ *
+ * @param size Number of events kept, rounded up to a power of two. 0
+ *     disables tracing.
+ * @return 1 if OK, 0 if out of memory, in which case tracing is off.
+ */
+int decode_trace_set_size(unsigned int size);
+
+/** Return the bytes allocated for the ring. */
+size_t decode_trace_memory(void);
+
+/** Add an event, a no-op unless decode_trace_set_size() was used. */
+static inline void decode_trace_add(int type, int reason,
+				    uint32_t value, uint32_t aux)
+{
+	struct decode_trace_event* ev;
+
+	if (decode_trace.mask == 0)
+		return;
+	ev = &decode_trace.events[decode_trace.head++ & decode_trace.mask];
+	ev->type = type;
+	ev->reason = reason;
+	ev->value = value;
+	ev->aux = aux;
+}
+
+/** Add a DT_ATTEMPT event for remote. */
+static inline void decode_trace_attempt(const struct ir_remote* remote)
+{
+	uint64_t p = (uintptr_t)remote;
+
+	decode_trace_add(DT_ATTEMPT, 0, (uint32_t)p, (uint32_t)(p >> 32));
+}
+
+/**
+ * Write the events, oldest first, as text lines on f. Remote attempts
+ * are printed by name if found in remotes.
+ *
+ * @return Number of events written, -1 on write errors.
+ */
+int decode_trace_dump(FILE* f, const struct ir_remote* remotes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DECODE_TRACE_H */
@@ -89,6 +89,72 @@ unsigned dictionary_hash(const char* key)
 	return hash;
 }
 
+/** Return the slot of key, or -1 if not found. */
+static int index_find(const dictionary* d, const char* key, unsigned hash)
+{
+	unsigned mask = d->index_size - 1;
+	unsigned i;
+	int e;
+
+	for (i = hash & mask; (e = d->index[i]) != 0; i = (i + 1) & mask) {
+		if (e > 0 && d->hash[e - 1] == hash
+		    && strcmp(key, d->key[e - 1]) == 0)
+			return e - 1;
+	}
+	return -1;
+}
+
+/** Add slot to index, which must not be full. */
+static void index_add(dictionary* d, int slot)
+{
+	unsigned mask = d->index_size - 1;
+	unsigned i;
+
+	for (i = d->hash[slot] & mask; d->index[i] > 0; i = (i + 1) & mask)
+		;
+	if (d->index[i] < 0)
+		d->deleted--;
+	d->index[i] = slot + 1;
+}
+
+/** Mark the index entry of slot as deleted. */
+static void index_remove(dictionary* d, int slot)
+{
+	unsigned mask = d->index_size - 1;
+	unsigned i;
+
+	for (i = d->hash[slot] & mask; d->index[i] != 0; i = (i + 1) & mask) {
+		if (d->index[i] == slot + 1) {
+			d->index[i] = -1;
+			d->deleted++;
+			return;
+		}
+	}
+}
+
+/** Rebuild index with room for at least 2 * d->size entries. */
+static int index_rebuild(dictionary* d)
+{
+	unsigned size = 16;
+	int* index;
+	int i;
+
+	while (size < 2 * (unsigned)d->size + 1)
+		size *= 2;
+	index = (int*)calloc(size, sizeof(int));
+	if (index == NULL)
+		return -1;
+	free(d->index);
+	d->index = index;
+	d->index_size = size;
+	d->deleted = 0;
+	for (i = 0; i < d->size; i++) {
+		if (d->key[i] != NULL)
+			index_add(d, i);
+	}
+	return 0;
+}
+
 dictionary* dictionary_new(int size)
 {
 	dictionary* d;
@@ -103,6 +169,11 @@ dictionary* dictionary_new(int size)
 	d->val = (char**)calloc(size, sizeof(char*));
 	d->key = (char**)calloc(size, sizeof(char*));
 	d->hash = (unsigned int*)calloc(size, sizeof(unsigned));
+	if (d->val == NULL || d->key == NULL || d->hash == NULL
+	    || index_rebuild(d) != 0) {
+		dictionary_del(d);
+		return NULL;
+	}
 	return d;
 }
 
@@ -112,7 +183,7 @@ void dictionary_del(dictionary* d)
 
 	if (d == NULL)
 		return;
-	for (i = 0; i < d->size; i++) {
+	for (i = 0; d->key != NULL && d->val != NULL && i < d->size; i++) {
 		if (d->key[i] != NULL)
 			free(d->key[i]);
 		if (d->val[i] != NULL)
@@ -121,27 +192,17 @@ void dictionary_del(dictionary* d)
 	free(d->val);
 	free(d->key);
 	free(d->hash);
+	free(d->index);
 	free(d);
 	return;
 }
 
 const char* dictionary_get(dictionary* d, const char* key, const char* def)
 {
-	unsigned hash;
 	int i;
 
-	hash = dictionary_hash(key);
-	for (i = 0; i < d->size; i++) {
-		if (d->key[i] == NULL)
-			continue;
-		/* Compare hash */
-		if (hash == d->hash[i]) {
-			/* Compare string, to avoid hash collisions */
-			if (!strcmp(key, d->key[i]))
-				return d->val[i];
-		}
-	}
-	return def;
+	i = index_find(d, key, dictionary_hash(key));
+	return i >= 0 ? d->val[i] : def;
 }
 
 int dictionary_set(dictionary* d, const char* key, const char* val)
@@ -155,23 +216,13 @@ int dictionary_set(dictionary* d, const char* key, const char* val)
 	/* Compute hash for this key */
 	hash = dictionary_hash(key);
 	/* Find if value is already in dictionary */
-	if (d->n > 0) {
-		for (i = 0; i < d->size; i++) {
-			if (d->key[i] == NULL)
-				continue;
-			/* Same hash value */
-			if (hash == d->hash[i]) {
-				/* Same key */
-				if (!strcmp(key, d->key[i])) {
-					/* Found a value: modify and return */
-					if (d->val[i] != NULL)
-						free(d->val[i]);
-					d->val[i] = val ? strdup(val) : NULL;
-					/* Value has been modified: return */
-					return 0;
-				}
-			}
-		}
+	i = index_find(d, key, hash);
+	if (i >= 0) {
+		/* Found a value: modify and return */
+		if (d->val[i] != NULL)
+			free(d->val[i]);
+		d->val[i] = val ? strdup(val) : NULL;
+		return 0;
 	}
 
 	/* Add a new value
@@ -187,46 +238,47 @@ int dictionary_set(dictionary* d, const char* key, const char* val)
 			return -1;
 		/* Double size */
 		d->size *= 2;
+		if (index_rebuild(d) != 0)
+			return -1;
+	} else if (2 * (unsigned)(d->n + d->deleted + 1) > d->index_size) {
+		/* Too many deleted entries, probes get long. */
+		if (index_rebuild(d) != 0)
+			return -1;
 	}
 
-	/* Insert key in the first empty slot */
-	for (i = 0; i < d->size; i++) {
-		if (d->key[i] == NULL)
-			/* Add key here */
-			break;
+	/* Insert key in the first empty slot, after the others if none. */
+	i = d->used;
+	if (d->used > d->n) {
+		for (i = 0; i < d->size; i++) {
+			if (d->key[i] == NULL)
+				/* Add key here */
+				break;
+		}
 	}
+	if (i == d->used)
+		d->used++;
 	/* Copy key */
 	d->key[i] = strdup(key);
 	d->val[i] = val ? strdup(val) : NULL;
 	d->hash[i] = hash;
 	d->n++;
+	index_add(d, i);
 	return 0;
 }
 
 void dictionary_unset(dictionary* d, const char* key)
 {
-	unsigned hash;
 	int i;
 
 	if (key == NULL)
 		return;
 
-	hash = dictionary_hash(key);
-	for (i = 0; i < d->size; i++) {
-		if (d->key[i] == NULL)
-			continue;
-		/* Compare hash */
-		if (hash == d->hash[i]) {
-			/* Compare string, to avoid hash collisions */
-			if (!strcmp(key, d->key[i]))
-				/* Found key */
-				break;
-		}
-	}
-	if (i >= d->size)
+	i = index_find(d, key, dictionary_hash(key));
+	if (i < 0)
 		/* Key not found */
 		return;
 
+	index_remove(d, i);
 	free(d->key[i]);
 	d->key[i] = NULL;
 	if (d->val[i] != NULL) {
@@ -235,6 +287,8 @@ void dictionary_unset(dictionary* d, const char* key)
 	}
 	d->hash[i] = 0;
 	d->n--;
+	while (d->used > 0 && d->key[d->used - 1] == NULL)
+		d->used--;
 	return;
 }
 
@@ -63,6 +63,11 @@ extern "C" {
  * association is identified by a unique string key. Looking up values
  * in the dictionary is speeded up by the use of a (hopefully collision-free)
  * hash function.
+ *
+ * The key, val and hash arrays keep the associations in insertion order
+ * and may be iterated over, empty slots have a NULL key. The index is a
+ * linear probing hash table of slot + 1, 0 for never used and -1 for
+ * deleted entries, making lookups independent of the size.
  */
 typedef struct _dictionary_ {
 	int		n;
@@ -70,6 +75,10 @@ typedef struct _dictionary_ {
 	char**		val;
 	char**		key;
 	unsigned*	hash;
+	int*		index;          /**< Open addressing on hash, see below. */
+	unsigned	index_size;     /**< Power of two, > 2 * (n + deleted). */
+	int		deleted;        /**< Deleted index entries. */
+	int		used;           /**< 1 + last slot holding a key. */
 } dictionary;
 
 /**
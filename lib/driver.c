@@ -15,6 +15,7 @@
 #include	<stdio.h>
 #include	"driver.h"
 #include	"config.h"
+#include	"ir_remote.h"
 #include	"lirc_log.h"
 
 static const logchannel_t logchannel = LOG_LIB;
@@ -33,6 +34,12 @@ const char* const OPTION_FMT = "%32s%64s";
 /** Read-only access to drv for client code. */
 const struct driver* const curr_driver = &drv;
 
+/** The driver timer, armed if func is non-NULL. */
+static struct {
+	drv_timer_func	func;
+	struct timeval	when;
+} drv_timer = { NULL, { 0, 0 } };
+
 
 int default_open(const char* path)
 {
@@ -89,3 +96,67 @@ int drv_handle_options(const char* options)
 	}
 	return 0;
 }
+
+
+void drv_timer_set(uint32_t delay_us, drv_timer_func func)
+{
+	struct timeval delay;
+
+	get_monotonic_time(&drv_timer.when);
+	delay.tv_sec = delay_us / 1000000;
+	delay.tv_usec = delay_us % 1000000;
+	timeradd(&drv_timer.when, &delay, &drv_timer.when);
+	drv_timer.func = func;
+}
+
+
+void drv_timer_cancel(void)
+{
+	drv_timer.func = NULL;
+}
+
+
+int drv_timer_deadline(struct timeval* when)
+{
+	if (drv_timer.func == NULL)
+		return 0;
+	*when = drv_timer.when;
+	return 1;
+}
+
+
+int drv_timer_timeout(int timeout_ms)
+{
+	struct timeval now;
+	struct timeval left;
+	long long ms;
+
+	if (drv_timer.func == NULL)
+		return timeout_ms;
+	get_monotonic_time(&now);
+	if (!timercmp(&now, &drv_timer.when, <))
+		return 0;
+	timersub(&drv_timer.when, &now, &left);
+	/* Round up, waking early would just poll again. */
+	ms = left.tv_sec * 1000LL + (left.tv_usec + 999) / 1000;
+	if (timeout_ms >= 0 && timeout_ms < ms)
+		return timeout_ms;
+	return (int)ms;
+}
+
+
+int drv_timer_due(void)
+{
+	return drv_timer.func != NULL && drv_timer_timeout(-1) == 0;
+}
+
+
+char* drv_timer_run(struct ir_remote* remotes)
+{
+	drv_timer_func func = drv_timer.func;
+
+	if (!drv_timer_due())
+		return NULL;
+	drv_timer.func = NULL;
+	return func(remotes);
+}
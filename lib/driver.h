@@ -29,6 +29,11 @@
 #include "media/lirc.h"
 #endif
 
+/* Missing in kernel headers before 4.16. */
+#ifndef LIRC_MODE_SCANCODE
+#define LIRC_MODE_SCANCODE 0x00000008
+#endif
+
 #include "lirc/ir_remote_types.h"
 #include "lirc/curl_poll.h"
 
@@ -65,6 +70,25 @@ struct option_t {
 	char	value[64];
 };
 
+/** Argument for DRVCTL_GET_STATS, counters since the driver was opened. */
+struct drv_stats {
+	unsigned long	dropped;        /**< Samples lost on a full queue. */
+	unsigned long	overflows;      /**< Input overruns of the device. */
+	unsigned long	underflows;     /**< Output underruns of the device. */
+};
+
+/**
+ * One frame of a sequence for send_frames_func(), an encoded signal
+ * and the space after it.
+ */
+struct send_frame {
+	const lirc_t*	data;           /**< Pulses and spaces, pulse first. */
+	int		length;         /**< Items in data. */
+	lirc_t		gap;            /**< Space after the frame, us. */
+	unsigned int	freq;           /**< Carrier frequency, Hz. */
+	unsigned int	duty_cycle;     /**< Carrier duty cycle, percent. */
+};
+
 /**
  * Parse an option string "key:value;key:value..." and invoke
  * drvctl DRV_SET_OPTION as appropriate.
@@ -72,6 +96,49 @@ struct option_t {
 int drv_handle_options(const char* options);
 
 
+/**
+ * A driver timer callback, run instead of rec_func() when the timer
+ * expires. Same contract as rec_func(): returns a decoded message or
+ * NULL. It may re-arm the timer.
+ */
+typedef char* (*drv_timer_func)(struct ir_remote* remotes);
+
+/**
+ * Arm the driver timer, replacing any armed before: func runs delay_us
+ * from now. Lets drivers synthesize repeats and releases without a
+ * thread of their own. The timer is serviced by lircd in the thread
+ * calling rec_func(), and must only be used from there. Hosts not
+ * servicing it, like irrecord, never run func.
+ */
+void drv_timer_set(uint32_t delay_us, drv_timer_func func);
+
+/** Disarm the driver timer, a no-op if not armed. */
+void drv_timer_cancel(void);
+
+/**
+ * For hosts: set *when to the expiry time of the driver timer, in the
+ * clock of get_monotonic_time().
+ * @return 0 if not armed, else 1.
+ */
+int drv_timer_deadline(struct timeval* when);
+
+/**
+ * For hosts: return timeout_ms, or less if the driver timer expires
+ * before. timeout_ms < 0 means forever, as for poll().
+ */
+int drv_timer_timeout(int timeout_ms);
+
+/** For hosts: return non-zero if the driver timer has expired. */
+int drv_timer_due(void);
+
+/**
+ * For hosts: if the driver timer has expired, disarm it and run its
+ * callback.
+ * @return The message of the callback, NULL if none or not expired.
+ */
+char* drv_timer_run(struct ir_remote* remotes);
+
+
 /** Drvctl cmd:  return current state as an int in *arg. */
 #define DRVCTL_GET_STATE                1
 
@@ -108,6 +175,9 @@ int drv_handle_options(const char* options);
 
 #define DRVCTL_NOTIFY_DECODE            7
 
+/** Drvctl cmd: get error counters. Arg is a *struct drv_stats, updated. */
+#define DRVCTL_GET_STATS                8
+
 /** Last well-known command. Remaining is used in driver-specific controls.*/
 #define  DRVCTL_MAX                     128
 
@@ -257,6 +327,41 @@ struct driver {
 	 *    - None          No device is silently configured.
 	 */
 	const char* const  device_hint;
+
+/* API version 4 addons: */
+	/**
+	 * Optional bulk variant of readdata(), used instead of it when
+	 * non-NULL. Waits at most timeout (us) for data like readdata(),
+	 * then stores as many pulses/spaces as are available without
+	 * blocking, in the same format.
+	 * @param data Buffer of count items.
+	 * @param count Max number of items to store, > 0.
+	 * @param timeout Max time to wait (us).
+	 * @return Number of items stored, 0 on timeout or errors.
+	 */
+	int (*const readdata_bulk)(lirc_t* data, int count, lirc_t timeout);
+
+	/**
+	 * Optional, for drivers using rec_func(). Return non-zero if
+	 * input already read from fd is waiting to be handled. Callers
+	 * should not block on fd before calling rec_func() again while
+	 * this is true.
+	 */
+	int (*const rec_pending)(void);
+
+/* API version 5 addons: */
+	/**
+	 * Optional. Send frames one after the other, each followed by its
+	 * gap, typically as a single transmission so the gaps are timed by
+	 * the hardware. Frames are built using send_frames_add(). The gap
+	 * of the last frame is the wait before the next transmission,
+	 * drivers need not send it.
+	 * @param frames Array of count frames.
+	 * @param count Number of frames, > 0.
+	 * @return Non-zero if all frames were sent.
+	 */
+	int (*const send_frames_func)(const struct send_frame* frames,
+				      int count);
 };
 
 /** @} */
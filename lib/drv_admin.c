@@ -14,6 +14,10 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_TERMIOS_H
 # include <termios.h>
@@ -35,6 +39,9 @@ static const logchannel_t logchannel = LOG_LIB;
 
 static const char* const PLUGIN_FILE_EXTENSION  = "so";
 
+/** Driver name -> plugin file index in a plugin dir, see hw_write_index(). */
+static const char* const PLUGIN_INDEX = "plugins.index";
+
 
 /** Max number if plugins handled. No point to malloc() this. */
 #define MAX_PLUGINS  256
@@ -50,6 +57,12 @@ typedef struct {
 /** Plugin currently in use, if non-NULL */
 static void* last_plugin = NULL;
 
+/** Applied to each directory in the plugin path by for_each_path(). */
+typedef struct driver* (*dir_guest_func)(const char* dirpath,
+					 plugin_guest_func plugin_guest,
+					 drv_guest_func drv_guest,
+					 void* arg);
+
 /** Default driver, a placeholder. */
 const struct driver drv_null = {
 	.name		= "null",
@@ -185,7 +198,8 @@ static struct driver* for_each_plugin_in_dir(const char*	dirpath,
 }
 
 
-static struct driver* for_each_path(plugin_guest_func	plg_guest,
+static struct driver* for_each_path(dir_guest_func	dir_guest,
+				    plugin_guest_func	plg_guest,
 				    drv_guest_func	drv_guest,
 				    void*		arg,
 				    const char*		pluginpath_arg)
@@ -205,18 +219,12 @@ static struct driver* for_each_path(plugin_guest_func	plg_guest,
 		pluginpath = pluginpath_arg;
 	}
 	if (strchr(pluginpath, ':') == (char*)NULL) {
-		return for_each_plugin_in_dir(pluginpath,
-					      plg_guest,
-					      drv_guest,
-					      arg);
+		return dir_guest(pluginpath, plg_guest, drv_guest, arg);
 	}
 	tmp_path = alloca(strlen(pluginpath) + 1);
 	strncpy(tmp_path, pluginpath, strlen(pluginpath) + 1);
 	for (s = strtok(tmp_path, ":"); s != NULL; s = strtok(NULL, ":")) {
-		result = for_each_plugin_in_dir(s,
-						plg_guest,
-						drv_guest,
-						arg);
+		result = dir_guest(s, plg_guest, drv_guest, arg);
 		if (result != (struct driver*)NULL)
 			break;
 	}
@@ -228,7 +236,8 @@ struct driver* for_each_driver(drv_guest_func func,
 			       void* arg,
 			       const char* pluginpath)
 {
-	return for_each_path(visit_plugin, func, arg, pluginpath);
+	return for_each_path(for_each_plugin_in_dir,
+			     visit_plugin, func, arg, pluginpath);
 }
 
 
@@ -236,7 +245,212 @@ void for_each_plugin(plugin_guest_func plugin_guest,
 		     void* arg,
 		     const char* pluginpath)
 {
-	for_each_path(plugin_guest, NULL, arg, pluginpath);
+	for_each_path(for_each_plugin_in_dir,
+		      plugin_guest, NULL, arg, pluginpath);
+}
+
+
+/* Path of the index in dirpath, without trailing '/' in dirpath. */
+static void index_path(const char* dirpath, char* path, size_t size)
+{
+	size_t len = strlen(dirpath);
+
+	while (len > 1 && dirpath[len - 1] == '/')
+		len -= 1;
+	snprintf(path, size, "%.*s/%s", (int)len, dirpath, PLUGIN_INDEX);
+}
+
+
+/** Return 1 if a was modified before b. */
+static int modified_before(const struct stat* a, const struct stat* b)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+		return a->st_mtim.tv_sec < b->st_mtim.tv_sec;
+	return a->st_mtim.tv_nsec < b->st_mtim.tv_nsec;
+#else
+	return a->st_mtime < b->st_mtime;
+#endif
+}
+
+
+/**
+ * Open the index of dirpath if it's up to date, i. e. not older than
+ * the directory: adding, removing or replacing a plugin by installing
+ * it changes the directory mtime.
+ */
+static FILE* open_index(const char* dirpath)
+{
+	char path[1024];
+	struct stat dir_st;
+	struct stat index_st;
+
+	index_path(dirpath, path, sizeof(path));
+	if (stat(path, &index_st) != 0 || stat(dirpath, &dir_st) != 0)
+		return NULL;
+	if (modified_before(&index_st, &dir_st)) {
+		log_debug("Ignoring outdated %s", path);
+		return NULL;
+	}
+	return fopen(path, "r");
+}
+
+
+/**
+ * Get next "driver plugin-file" entry from an index, skipping comments.
+ * @return 1 if name and file are updated, 0 at EOF.
+ */
+static int read_index_entry(FILE* f, char* name, char* file)
+{
+	char line[256];
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%127s %127s", name, file) == 2)
+			return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * dir_guest_func for a driver name lookup: visit only the plugin listed
+ * for the name in an up to date index. Falls back to scanning all
+ * plugins if there is no index, or if it's wrong.
+ */
+static struct driver* find_indexed_plugin(const char*		dirpath,
+					  plugin_guest_func	plugin_guest,
+					  drv_guest_func	drv_guest,
+					  void*			arg)
+{
+	const char* name = (const char*)arg;
+	struct driver* result = NULL;
+	char hw_name[128];
+	char file[128];
+	char path[1024];
+	int listed = 0;
+	FILE* f;
+
+	f = open_index(dirpath);
+	if (f == NULL)
+		return for_each_plugin_in_dir(dirpath, plugin_guest,
+					      drv_guest, arg);
+	while (result == NULL && read_index_entry(f, hw_name, file)) {
+		if (strcasecmp(hw_name, name) != 0)
+			continue;
+		listed = 1;
+		snprintf(path, sizeof(path), "%s/%s", dirpath, file);
+		result = plugin_guest(path, drv_guest, arg);
+	}
+	fclose(f);
+	if (listed && result == NULL) {
+		log_warn("%s in %s is wrong, rescanning plugins",
+			 PLUGIN_INDEX, dirpath);
+		return for_each_plugin_in_dir(dirpath, plugin_guest,
+					      drv_guest, arg);
+	}
+	return result;
+}
+
+
+/*
+ * dir_guest_func applying drv_guest to the drivers listed in an up to
+ * date index without loading them, only their name is set. Falls back
+ * to loading all plugins if there is no index.
+ */
+static struct driver* for_each_indexed_name(const char*		dirpath,
+					    plugin_guest_func	plugin_guest,
+					    drv_guest_func	drv_guest,
+					    void*		arg)
+{
+	struct driver* result = NULL;
+	struct driver hw;
+	char name[128];
+	char file[128];
+	FILE* f;
+
+	f = open_index(dirpath);
+	if (f == NULL)
+		return for_each_plugin_in_dir(dirpath, plugin_guest,
+					      drv_guest, arg);
+	memset(&hw, 0, sizeof(hw));
+	hw.name = name;
+	while (result == NULL && read_index_entry(f, name, file))
+		result = drv_guest(&hw, arg);
+	fclose(f);
+	return result;
+}
+
+
+/** Index being written by write_index_in_dir(). */
+struct index_writer {
+	FILE*		f;
+	const char*	file;   /**< Plugin being visited, basename. */
+};
+
+
+/** drv_guest_func writing the index entry of a driver. */
+static struct driver* write_index_entry(struct driver* hw, void* arg)
+{
+	struct index_writer* writer = (struct index_writer*)arg;
+
+	fprintf(writer->f, "%s %s\n", hw->name, writer->file);
+	return NULL;
+}
+
+
+/** plugin_guest_func visiting a plugin to index its drivers. */
+static struct driver* index_plugin(const char*		path,
+				   drv_guest_func	drv_guest,
+				   void*		arg)
+{
+	struct index_writer* writer = (struct index_writer*)arg;
+
+	writer->file = strrchr(path, '/') + 1;
+	return visit_plugin(path, write_index_entry, arg);
+}
+
+
+/* dir_guest_func (re)writing the index of a dir, arg is an int* error. */
+static struct driver* write_index_in_dir(const char*		dirpath,
+					 plugin_guest_func	plugin_guest,
+					 drv_guest_func		drv_guest,
+					 void*			arg)
+{
+	struct index_writer writer;
+	char path[1024];
+	char tmp_path[1040];
+
+	index_path(dirpath, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	writer.f = fopen(tmp_path, "w");
+	if (writer.f == NULL) {
+		log_perror_err("Cannot create %s", tmp_path);
+		*(int*)arg = 1;
+		return NULL;
+	}
+	fprintf(writer.f, "# lirc %s plugin index: driver plugin-file\n",
+		VERSION);
+	for_each_plugin_in_dir(dirpath, index_plugin, NULL, &writer);
+	if (fclose(writer.f) != 0 || rename(tmp_path, path) != 0) {
+		log_perror_err("Cannot write %s", path);
+		unlink(tmp_path);
+		*(int*)arg = 1;
+		return NULL;
+	}
+	/* The rename updated the dir mtime, the index must not be older. */
+	utime(path, NULL);
+	return NULL;
+}
+
+
+int hw_write_index(const char* pluginpath)
+{
+	int error = 0;
+
+	for_each_path(write_index_in_dir, NULL, NULL, &error, pluginpath);
+	return error ? -1 : 0;
 }
 
 
@@ -276,7 +490,8 @@ void hw_print_drivers(FILE* file)
 	char format[16];
 
 	names.size = 0;
-	if (for_each_driver(add_hw_name, (void*)&names, NULL) != NULL) {
+	if (for_each_path(for_each_indexed_name, visit_plugin,
+			  add_hw_name, (void*)&names, NULL) != NULL) {
 		fprintf(stderr, "Too many plugins (%d)\n", MAX_PLUGINS);
 		return;
 	}
@@ -306,7 +521,8 @@ int hw_choose_driver(const char* name)
 	if (strcasecmp(name, "dev/input") == 0)
 		/* backwards compatibility */
 		name = "devinput";
-	found = for_each_driver(match_hw_name, (void*)name, NULL);
+	found = for_each_path(find_indexed_plugin, visit_plugin,
+			      match_hw_name, (void*)name, NULL);
 	if (found != (struct driver*)NULL) {
 		memcpy(&drv, found, sizeof(struct driver));
 		drv.fd = -1;
@@ -50,6 +50,18 @@ int hw_choose_driver(const char* name);
 /* Print name of all drivers on FILE. */
 void hw_print_drivers(FILE*);
 
+/**
+ * Write the driver name -> plugin file index in each directory of the
+ * plugin path, overwriting existing ones. hw_choose_driver() then only
+ * loads the plugin with the selected driver, and hw_print_drivers() none,
+ * in the directories where the index is not older than the directory.
+ *
+ * @param pluginpath ':'-separated path, NULL for the default as for
+ *     for_each_driver().
+ * @return 0 if all indexes were written, else -1.
+ */
+int hw_write_index(const char* pluginpath);
+
 /**
  *
  * Apply func to all existing drivers. Returns pointer to a driver
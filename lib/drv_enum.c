@@ -11,9 +11,14 @@
 #endif
 
 #include <glob.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 #include <dirent.h>
 #include <errno.h>
 
@@ -36,6 +41,68 @@ static const logchannel_t logchannel = LOG_LIB;
 /** Allocation chunk in glob_t_* routines. */
 static const int GLOB_CHUNK_SIZE = 32;
 
+/** Max age of the snapshot if there is no udev monitor [s]. */
+static const int SNAPSHOT_MAX_AGE = 2;
+
+/*
+ * The snapshot: the udev devices having a device node, the glob(3)
+ * results and the libusb devices. Tools probing many plugins then scan
+ * once instead of once per plugin, each plugin matching its conditions
+ * against the snapshot in memory. It is dropped when the udev monitor
+ * reports any uevent, i. e. once per udev generation, or after
+ * SNAPSHOT_MAX_AGE if there is no monitor. All parts are built on first
+ * use, holding snapshot_lock.
+ */
+
+/** A device with a node, as listed by drv_enum_udev(). */
+struct snap_device {
+	char*		syspath;
+	char*		devnode;
+	char*		subsystem;      /**< NULL if none. */
+	char*		vendor;         /**< Own idVendor sysattr, or NULL. */
+	char*		product;        /**< Own idProduct sysattr, or NULL. */
+	dev_t		devnum;
+	int		is_block;
+	int		has_rc_parent;
+	int		has_ids;        /**< Some idVendor or idProduct found. */
+	char*		info;           /**< Vendor, product etc. */
+	char*		line;           /**< Node and info, as listed. */
+	glob_t		links;          /**< Formatted device links. */
+};
+
+/** The result of glob(3) for a pattern. */
+struct snap_glob {
+	char*			pattern;
+	int			result;         /**< Return value of glob(). */
+	glob_t			paths;
+	struct snap_glob*	next;
+};
+
+/** A device found by libusb. */
+struct snap_usb {
+	uint16_t	vendor;
+	uint16_t	product;
+	char*		path;   /**< /dev/bus/usb/bus/device. */
+};
+
+static struct {
+	int			valid;
+	struct timespec		built;
+	int			have_devices;
+	struct snap_device*	devices;        /**< Sorted by syspath. */
+	size_t			device_count;
+	struct snap_glob*	globs;
+	int			have_usb;
+	struct snap_usb*	usb;
+	size_t			usb_count;
+#ifdef HAVE_LIBUDEV_H
+	struct udev*		udev;
+	struct udev_monitor*	monitor;
+#endif
+} snapshot;
+
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 void glob_t_init(glob_t* glob)
 {
@@ -71,10 +138,161 @@ void drv_enum_free(glob_t* glob)
 	free(glob->gl_pathv);
 }
 
+
+/** Free the snapshot parts, holding snapshot_lock. */
+static void snapshot_clear(void)
+{
+	struct snap_glob* g;
+	size_t i;
+
+	for (i = 0; i < snapshot.device_count; i++) {
+		free(snapshot.devices[i].syspath);
+		free(snapshot.devices[i].devnode);
+		free(snapshot.devices[i].info);
+		free(snapshot.devices[i].subsystem);
+		free(snapshot.devices[i].vendor);
+		free(snapshot.devices[i].product);
+		free(snapshot.devices[i].line);
+		drv_enum_free(&snapshot.devices[i].links);
+	}
+	free(snapshot.devices);
+	snapshot.devices = NULL;
+	snapshot.device_count = 0;
+	snapshot.have_devices = 0;
+	while (snapshot.globs != NULL) {
+		g = snapshot.globs;
+		snapshot.globs = g->next;
+		if (g->result == 0)
+			globfree(&g->paths);
+		free(g->pattern);
+		free(g);
+	}
+	for (i = 0; i < snapshot.usb_count; i++)
+		free(snapshot.usb[i].path);
+	free(snapshot.usb);
+	snapshot.usb = NULL;
+	snapshot.usb_count = 0;
+	snapshot.have_usb = 0;
+	snapshot.valid = 0;
+}
+
+
+void drv_enum_clear_cache(void)
+{
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_clear();
+	pthread_mutex_unlock(&snapshot_lock);
+}
+
+
+#ifdef HAVE_LIBUDEV_H
+
+/** Return true if the monitor has seen a uevent since the last call. */
+static bool snapshot_changed(void)
+{
+	struct pollfd pfd;
+	struct udev_device* device;
+	bool changed = false;
+
+	if (snapshot.monitor == NULL)
+		return false;
+	pfd.fd = udev_monitor_get_fd(snapshot.monitor);
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 0) > 0) {
+		device = udev_monitor_receive_device(snapshot.monitor);
+		if (device == NULL)
+			break;
+		udev_device_unref(device);
+		changed = true;
+	}
+	return changed;
+}
+
+
+/** Create the udev context and monitor, if not done. */
+static bool snapshot_open_udev(void)
+{
+	if (snapshot.udev != NULL)
+		return true;
+	snapshot.udev = udev_new();
+	if (snapshot.udev == NULL) {
+		log_error("Cannot run udev_new()");
+		return false;
+	}
+	/* Before scanning, not to miss changes during the scan. */
+	snapshot.monitor =
+		udev_monitor_new_from_netlink(snapshot.udev, "udev");
+	if (snapshot.monitor != NULL
+	    && udev_monitor_enable_receiving(snapshot.monitor) < 0) {
+		udev_monitor_unref(snapshot.monitor);
+		snapshot.monitor = NULL;
+	}
+	if (snapshot.monitor == NULL)
+		log_debug("drv_enum: No udev monitor, snapshot expires");
+	return true;
+}
+
+#else
+
+static bool snapshot_changed(void)
+{
+	return false;
+}
+
+#endif  // HAVE_LIBUDEV_H
+
+
+/** Drop the snapshot if outdated, holding snapshot_lock. */
+static void snapshot_check(void)
+{
+	struct timespec now;
+	bool expires = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#ifdef HAVE_LIBUDEV_H
+	expires = snapshot.monitor == NULL;
+#endif
+	if (snapshot_changed()
+	    || (snapshot.valid && expires
+		&& now.tv_sec - snapshot.built.tv_sec >= SNAPSHOT_MAX_AGE))
+		snapshot_clear();
+	if (!snapshot.valid) {
+		snapshot.built = now;
+		snapshot.valid = 1;
+	}
+}
+
+
+/** Return the glob(3) result for pattern, from the snapshot. */
+static const struct snap_glob* snapshot_glob(const char* pattern)
+{
+	struct snap_glob* g;
+
+	for (g = snapshot.globs; g != NULL; g = g->next)
+		if (strcmp(g->pattern, pattern) == 0)
+			return g;
+	g = (struct snap_glob*)calloc(1, sizeof(*g));
+	if (g == NULL)
+		return NULL;
+	g->pattern = strdup(pattern);
+	if (g->pattern == NULL) {
+		free(g);
+		return NULL;
+	}
+	g->result = glob(pattern, 0, NULL, &g->paths);
+	g->next = snapshot.globs;
+	snapshot.globs = g;
+	return g;
+}
+
+
 #ifdef HAVE_LIBUDEV_H
 
 static const char* get_sysattr(struct udev_device* device, const char* attr);
 
+static const struct snap_device* snapshot_find_devnum(dev_t devnum,
+						      int is_block);
+
 
 /** Return struct udev_device or null for given /dev/X path. */
 static struct udev_device* udev_from_dev_path(struct udev* udev,
@@ -125,46 +343,72 @@ static struct udev_device* get_some_info(struct udev_device* device,
 }
 
 
+/** Format the info of path, from the snapshot if possible. */
+static void format_udev_info(struct udev*	udev,
+			     const char*	path,
+			     const char*	entry,
+			     glob_t*		glob)
+{
+	const struct snap_device* snap;
+	struct udev_device* udev_device;
+	struct stat statbuf;
+	const char* idVendor;
+	const char* idProduct;
+	char line[256];
+
+	if (stat(path, &statbuf) == 0 && S_ISCHR(statbuf.st_mode)) {
+		pthread_mutex_lock(&snapshot_lock);
+		snap = snapshot_find_devnum(statbuf.st_rdev, 0);
+		if (snap != NULL) {
+			if (snap->has_ids)
+				snprintf(line, sizeof(line), "%s %s",
+					 path, snap->info);
+			pthread_mutex_unlock(&snapshot_lock);
+			glob_t_add_path(glob, snap->has_ids ? line : entry);
+			return;
+		}
+		pthread_mutex_unlock(&snapshot_lock);
+	}
+	udev_device = udev_from_dev_path(udev, path);
+	if (udev_device == NULL) {
+		glob_t_add_path(glob, entry);
+		return;
+	}
+	udev_device = get_some_info(udev_device, &idVendor, &idProduct);
+	snprintf(line, sizeof(line),
+		 "%s [%s:%s] %s %s version: %s serial: %s",
+		 path,
+		 idVendor,
+		 idProduct,
+		 get_sysattr(udev_device, "manufacturer"),
+		 get_sysattr(udev_device, "product"),
+		 get_sysattr(udev_device, "version"),
+		 get_sysattr(udev_device, "serial")
+	);
+	if (idVendor == NULL && idProduct == NULL)
+		glob_t_add_path(glob, entry);
+	else
+		glob_t_add_path(glob, line);
+}
+
+
 /** Try to add udev info to existing device-only entries i globbuf. */
 void drv_enum_add_udev_info(glob_t* oldbuf)
 {
 	glob_t newbuf;
 	int i;
-	char line[256];
 	char* device_path;
 	struct udev* udev = udev_new();
-	const char* idVendor;
-	const char* idProduct;
 
 	glob_t_init(&newbuf);
 	for (i = 0; i < oldbuf->gl_pathc; i += 1) {
 		device_path = strdup(oldbuf->gl_pathv[i]);
 		device_path = strtok(device_path, "\n \t");
-		struct udev_device* udev_device =
-			udev_from_dev_path(udev, device_path);
-		if (udev_device == NULL) {
-			glob_t_add_path(&newbuf, oldbuf->gl_pathv[i]);
-		} else {
-			udev_device = get_some_info(udev_device,
-						    &idVendor,
-						    &idProduct);
-			snprintf(line, sizeof(line),
-				 "%s [%s:%s] %s %s version: %s serial: %s",
-				 device_path,
-				 idVendor,
-				 idProduct,
-				 get_sysattr(udev_device, "manufacturer"),
-				 get_sysattr(udev_device, "product"),
-				 get_sysattr(udev_device, "version"),
-				 get_sysattr(udev_device, "serial")
-			);
-			if (idVendor == NULL && idProduct == NULL)
-				glob_t_add_path(&newbuf, oldbuf->gl_pathv[i]);
-			else
-				glob_t_add_path(&newbuf, line);
-		}
+		format_udev_info(udev, device_path, oldbuf->gl_pathv[i],
+				 &newbuf);
 		free(device_path);
 	}
+	udev_unref(udev);
 	drv_enum_free(oldbuf);
 	memcpy(oldbuf, &newbuf, sizeof(glob_t));
 }
@@ -178,32 +422,26 @@ void drv_enum_add_udev_info(glob_t* oldbuf) {}
 
 int drv_enum_globs(glob_t* globbuf, const char* const* patterns)
 {
-	glob_t buff;
+	const struct snap_glob* g;
 	int i;
-	int flags;
-	int r;
 
 	if (!patterns)
 		return DRV_ERR_BAD_VALUE;
-	buff.gl_offs = 0;
-	buff.gl_pathc = 0;
-	buff.gl_pathv = NULL;
 	glob_t_init(globbuf);
-
-	for (flags = 0; *patterns; patterns++) {
-		r = glob(*patterns, flags, NULL, &buff);
-		if (r == GLOB_NOMATCH)
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_check();
+	for (; *patterns; patterns++) {
+		g = snapshot_glob(*patterns);
+		if (g != NULL && g->result == GLOB_NOMATCH)
 			continue;
-		if (r != 0) {
-			globfree(&buff);
+		if (g == NULL || g->result != 0) {
+			pthread_mutex_unlock(&snapshot_lock);
 			return DRV_ERR_BAD_STATE;
 		}
-		flags = GLOB_APPEND;
+		for (i = 0; i < g->paths.gl_pathc; i += 1)
+			glob_t_add_path(globbuf, g->paths.gl_pathv[i]);
 	}
-	for (i = 0; i < buff.gl_pathc; i += 1) {
-		glob_t_add_path(globbuf, buff.gl_pathv[i]);
-	}
-	globfree(&buff);
+	pthread_mutex_unlock(&snapshot_lock);
 	drv_enum_add_udev_info(globbuf);
 	return globbuf->gl_pathc == 0 ? DRV_ERR_ENUM_EMPTY : 0;
 }
@@ -219,30 +457,61 @@ int drv_enum_glob(glob_t* globbuf, const char* const pattern)
 
 #ifdef HAVE_USB_H
 
-int drv_enum_usb(glob_t* glob,
-		 int (*is_device_ok)(uint16_t vendor, uint16_t product))
+/** Scan the usb busses into the snapshot, holding snapshot_lock. */
+static void snapshot_scan_usb(void)
 {
 	struct usb_bus* usb_bus;
 	struct usb_device* dev;
+	struct snap_usb* p;
 	char device_path[2 * MAXPATHLEN + 32];
 
+	snapshot.have_usb = 1;
 	usb_init();
 	usb_find_busses();
 	usb_find_devices();
-	glob_t_init(glob);
 	for (usb_bus = usb_busses; usb_bus; usb_bus = usb_bus->next) {
 		for (dev = usb_bus->devices; dev; dev = dev->next) {
-			if (!is_device_ok(dev->descriptor.idVendor,
-					  dev->descriptor.idProduct))
-				continue;
+			p = (struct snap_usb*)realloc(snapshot.usb,
+				(snapshot.usb_count + 1) * sizeof(*p));
+			if (p == NULL)
+				return;
+			snapshot.usb = p;
 			snprintf(device_path, sizeof(device_path),
-				 "/dev/bus/usb/%s/%s     %04x:%04x",
-				 dev->bus->dirname, dev->filename,
-				 dev->descriptor.idVendor,
-				 dev->descriptor.idProduct);
-			glob_t_add_path(glob, device_path);
+				 "/dev/bus/usb/%s/%s",
+				 dev->bus->dirname, dev->filename);
+			p += snapshot.usb_count;
+			p->vendor = dev->descriptor.idVendor;
+			p->product = dev->descriptor.idProduct;
+			p->path = strdup(device_path);
+			if (p->path != NULL)
+				snapshot.usb_count++;
 		}
 	}
+}
+
+
+int drv_enum_usb(glob_t* glob,
+		 int (*is_device_ok)(uint16_t vendor, uint16_t product))
+{
+	const struct snap_usb* dev;
+	char device_path[2 * MAXPATHLEN + 32];
+	size_t i;
+
+	glob_t_init(glob);
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_check();
+	if (!snapshot.have_usb)
+		snapshot_scan_usb();
+	for (i = 0; i < snapshot.usb_count; i++) {
+		dev = &snapshot.usb[i];
+		if (!is_device_ok(dev->vendor, dev->product))
+			continue;
+		snprintf(device_path, sizeof(device_path),
+			 "%s     %04x:%04x",
+			 dev->path, dev->vendor, dev->product);
+		glob_t_add_path(glob, device_path);
+	}
+	pthread_mutex_unlock(&snapshot_lock);
 	drv_enum_add_udev_info(glob);
 	return 0;
 }
@@ -268,60 +537,168 @@ static const char* get_sysattr(struct udev_device* device, const char* attr)
 }
 
 
-/** Format a printable string from given list entry. */
-static bool format_udev_entry(struct udev* udev,
-			      struct udev_list_entry* device,
-			      char* buff,
-			      size_t size)
+/** Add the device links of device to globbuf. */
+static void add_links(glob_t* globbuf, struct udev_device* device)
+{
+	char buff[128];
+	char path[128];
+	ssize_t pathlen;
+	struct udev_list_entry* links =
+		udev_device_get_devlinks_list_entry(device);
+
+	while (links != NULL) {
+		pathlen = readlink(udev_list_entry_get_name(links),
+				   path,
+				   sizeof(path) - 1);
+		path[pathlen < 0 ? 0 : pathlen] = '\0';
+		snprintf(buff, sizeof(buff), "%s -> %s",
+			 udev_list_entry_get_name(links), path);
+		links = udev_list_entry_get_next(links);
+		glob_t_add_path(globbuf, buff);
+	}
+}
+
+
+static char* strdup_or_null(const char* s)
 {
-	const char* const syspath = udev_list_entry_get_name(device);
-	struct udev_device* udev_device =
-		udev_device_new_from_syspath(udev, syspath);
-	const char* const devnode = udev_device_get_devnode(udev_device);
+	return s != NULL ? strdup(s) : NULL;
+}
+
+
+/** Fill snap from the udev device at syspath, false if it has no node. */
+static bool snapshot_add_device(struct snap_device*	snap,
+				const char*		syspath)
+{
+	struct udev_device* device;
+	struct udev_device* info_device;
+	const char* devnode;
 	const char* idVendor;
 	const char* idProduct;
+	char info[256];
+	char line[128];
 
-	if (!devnode)
+	device = udev_device_new_from_syspath(snapshot.udev, syspath);
+	if (device == NULL)
 		return false;
-	udev_device = get_some_info(udev_device, &idVendor, &idProduct);
-	snprintf(buff, size, "%s [%s:%s] %s %s version: %s serial: %s",
-		 devnode,
+	devnode = udev_device_get_devnode(device);
+	if (devnode == NULL) {
+		udev_device_unref(device);
+		return false;
+	}
+	memset(snap, 0, sizeof(*snap));
+	snap->syspath = strdup(syspath);
+	snap->subsystem = strdup_or_null(udev_device_get_subsystem(device));
+	snap->vendor = strdup_or_null(
+		udev_device_get_sysattr_value(device, "idVendor"));
+	snap->product = strdup_or_null(
+		udev_device_get_sysattr_value(device, "idProduct"));
+	snap->devnum = udev_device_get_devnum(device);
+	snap->is_block = snap->subsystem != NULL
+			 && strcmp(snap->subsystem, "block") == 0;
+	snap->has_rc_parent =
+		udev_device_get_parent_with_subsystem_devtype(device,
+							      "rc",
+							      NULL) != NULL;
+	glob_t_init(&snap->links);
+	add_links(&snap->links, device);
+
+	/* get_some_info() returns a parent, owned by device. */
+	info_device = get_some_info(device, &idVendor, &idProduct);
+	snap->has_ids = idVendor != NULL || idProduct != NULL;
+	snprintf(info, sizeof(info), "[%s:%s] %s %s version: %s serial: %s",
 		 idVendor,
 		 idProduct,
-		 get_sysattr(udev_device, "manufacturer"),
-		 get_sysattr(udev_device, "product"),
-		 get_sysattr(udev_device, "version"),
-		 get_sysattr(udev_device, "serial")
+		 get_sysattr(info_device, "manufacturer"),
+		 get_sysattr(info_device, "product"),
+		 get_sysattr(info_device, "version"),
+		 get_sysattr(info_device, "serial")
 	);
+	/* As listed, truncated like drv_enum_udev() always did. */
+	snprintf(line, sizeof(line), "%s %s", devnode, info);
+	snap->devnode = strdup(devnode);
+	snap->info = strdup(info);
+	snap->line = strdup(line);
+	udev_device_unref(device);
+	if (snap->syspath == NULL || snap->devnode == NULL
+	    || snap->info == NULL || snap->line == NULL) {
+		free(snap->syspath);
+		free(snap->devnode);
+		free(snap->info);
+		free(snap->subsystem);
+		free(snap->vendor);
+		free(snap->product);
+		free(snap->line);
+		drv_enum_free(&snap->links);
+		return false;
+	}
 	return true;
 }
 
 
-/** Add all device links for given list entry to globbuf. */
-static void add_links(glob_t* globbuf,
-		      struct udev* udev,
-		      struct udev_list_entry* target_entry)
+/** Scan all devices with a node into the snapshot, holding the lock. */
+static int snapshot_scan_devices(void)
 {
-	char buff[128];
-	char path[128];
-	size_t pathlen;
+	struct udev_enumerate* enumerate;
+	struct udev_list_entry* devices;
+	struct udev_list_entry* device;
+	struct snap_device* p;
+	size_t size = 0;
 
-	const char* const syspath = udev_list_entry_get_name(target_entry);
-	struct udev_device* target_device =
-		udev_device_new_from_syspath(udev, syspath);
-	struct udev_list_entry* links =
-		udev_device_get_devlinks_list_entry(target_device);
+	if (!snapshot_open_udev())
+		return DRV_ERR_BAD_STATE;
+	enumerate = udev_enumerate_new(snapshot.udev);
+	if (enumerate == NULL)
+		return DRV_ERR_BAD_STATE;
+	udev_enumerate_scan_devices(enumerate);
+	devices = udev_enumerate_get_list_entry(enumerate);
+	udev_list_entry_foreach(device, devices) {
+		if (snapshot.device_count == size) {
+			size = size > 0 ? 2 * size : GLOB_CHUNK_SIZE;
+			p = (struct snap_device*)realloc(snapshot.devices,
+							 size * sizeof(*p));
+			if (p == NULL)
+				break;
+			snapshot.devices = p;
+		}
+		if (snapshot_add_device(&snapshot.devices[snapshot.device_count],
+					udev_list_entry_get_name(device)))
+			snapshot.device_count++;
+	}
+	udev_enumerate_unref(enumerate);
+	snapshot.have_devices = 1;
+	log_debug("drv_enum: Snapshot of %zu devices",
+		  snapshot.device_count);
+	return 0;
+}
 
-	while (links != NULL) {
-		pathlen = readlink(udev_list_entry_get_name(links),
-				   path,
-				   sizeof(path) - 1);
-		path[pathlen] = '\0';
-		snprintf(buff, sizeof(buff), "%s -> %s",
-			 udev_list_entry_get_name(links), path);
-		links = udev_list_entry_get_next(links);
-		glob_t_add_path(globbuf, buff);
+
+/**
+ * Return the device with given number in the snapshot, built if needed,
+ * or NULL. Called holding snapshot_lock.
+ */
+static const struct snap_device* snapshot_find_devnum(dev_t devnum,
+						      int is_block)
+{
+	size_t i;
+
+	snapshot_check();
+	if (!snapshot.have_devices && snapshot_scan_devices() != 0)
+		return NULL;
+	for (i = 0; i < snapshot.device_count; i++) {
+		if (snapshot.devices[i].devnum == devnum
+		    && snapshot.devices[i].is_block == is_block)
+			return &snapshot.devices[i];
 	}
+	return NULL;
+}
+
+
+/** Return true if value is set and matches pattern, as udev does. */
+static bool match_attr(const char* pattern, const char* value)
+{
+	if (pattern == NULL)
+		return true;
+	return value != NULL && fnmatch(pattern, value, 0) == 0;
 }
 
 
@@ -338,22 +715,18 @@ static bool is_dup(glob_t* globbuf, const char* buff)
 }
 
 
-/** Check if what->parent_subsys test passes.  */
-static bool check_parent_subsys(const struct drv_enum_udev_what* what,
-				struct udev* udev,
-				struct udev_list_entry* device_entry)
+/** Check if snap passes all tests in what. */
+static bool is_match(const struct drv_enum_udev_what*	what,
+		     const struct snap_device*		snap)
 {
-	if (!what->parent_subsys)
-		return true;
-	const char* const syspath = udev_list_entry_get_name(device_entry);
-	struct udev_device* device =
-		udev_device_new_from_syspath(udev, syspath);
-	struct udev_device* parent =
-	    udev_device_get_parent_with_subsystem_devtype(device,
-							  "rc",
-							  NULL);
-
-	return parent != NULL;
+	if (!match_attr(what->idVendor, snap->vendor))
+		return false;
+	if (!match_attr(what->idProduct, snap->product))
+		return false;
+	if (!match_attr(what->subsystem, snap->subsystem))
+		return false;
+	/* Any parent_subsys has always meant an "rc" parent. */
+	return what->parent_subsys == NULL || snap->has_rc_parent;
 }
 
 
@@ -362,48 +735,34 @@ int drv_enum_udev(glob_t* globbuf,
 		  const struct drv_enum_udev_what* what)
 {
 	const struct drv_enum_udev_what SENTINEL = {0};
-	struct udev* udev;
-	struct udev_enumerate* enumerate;
-	struct udev_list_entry* devices;
-	struct udev_list_entry* device;
-	char buff[128];
+	const struct snap_device* snap;
+	size_t i;
+	int j;
 
 	glob_t_init(globbuf);
-	udev = udev_new();
-	if (udev == NULL) {
-		log_error("Cannot run udev_new()");
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_check();
+	if (!snapshot.have_devices && snapshot_scan_devices() != 0) {
+		pthread_mutex_unlock(&snapshot_lock);
 		return DRV_ERR_BAD_STATE;
 	}
 	while (memcmp(what,
 		      &SENTINEL,
 		      sizeof(struct drv_enum_udev_what)) != 0) {
-		enumerate = udev_enumerate_new(udev);
-		if (what->idVendor != NULL)
-			udev_enumerate_add_match_sysattr(
-				enumerate, "idVendor", what->idVendor);
-		if (what->idProduct != NULL)
-			udev_enumerate_add_match_sysattr(
-				enumerate, "idProduct", what->idProduct);
-		if (what->subsystem != NULL)
-			udev_enumerate_add_match_subsystem(enumerate,
-							   what->subsystem);
-		udev_enumerate_scan_devices(enumerate);
-		devices = udev_enumerate_get_list_entry(enumerate);
-		udev_list_entry_foreach(device, devices) {
-			if (!check_parent_subsys(what, udev, device))
+		for (i = 0; i < snapshot.device_count; i++) {
+			snap = &snapshot.devices[i];
+			if (!is_match(what, snap))
 				continue;
-			if (!format_udev_entry(udev, device,
-					       buff, sizeof(buff)))
+			if (is_dup(globbuf, snap->line))
 				continue;
-			if (is_dup(globbuf, buff))
-				continue;
-			glob_t_add_path(globbuf, (const char*)buff);
-			add_links(globbuf, udev, device);
+			glob_t_add_path(globbuf, snap->line);
+			for (j = 0; j < snap->links.gl_pathc; j++)
+				glob_t_add_path(globbuf,
+						snap->links.gl_pathv[j]);
 		}
-		udev_enumerate_unref(enumerate);
 		what++;
 	}
-	udev_unref(udev);
+	pthread_mutex_unlock(&snapshot_lock);
 	return 0;
 }
 
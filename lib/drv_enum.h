@@ -18,6 +18,12 @@
  *  on device, usable in user interfaces.
  *
  *  Return codes are DRV_ERR_ constants as of driver.h, or 0 for no errors.
+ *
+ *  The functions match against a process wide snapshot of the udev
+ *  devices, glob(3) results and libusb devices, built on first use, so
+ *  a tool probing all plugins scans the system once. The snapshot is
+ *  dropped when udev reports a device change or, if it cannot be
+ *  monitored, after a few seconds. The functions are thread safe.
  */
 
 #include <stdint.h>
@@ -65,6 +71,9 @@ int drv_enum_udev(glob_t* globbuf,
 int drv_enum_usb(glob_t* glob,
 		 int (*is_device_ok)(uint16_t vendor,  uint16_t product));
 
+/** Drop the device snapshot, the next call rescans the system. */
+void drv_enum_clear_cache(void);
+
 
 #ifdef __cplusplus
 }
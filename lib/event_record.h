@@ -0,0 +1,139 @@
+/****************************************************************************
+** event_record.h **********************************************************
+****************************************************************************
+*/
+
+/**
+ * @file event_record.h
+ * @brief Binary records written on the lircd socket after BINARY.
+ * @ingroup lirc_client
+ *
+ * A client sending the BINARY command gets fixed size records instead
+ * of the text lines described in lircd(8). Button and remote names are
+ * interned: each name has a numeric id, announced in a NAME record
+ * before the first event using it. A RESET record drops all ids, and is
+ * followed by NAME records for all names in the new configuration. It
+ * is sent when BINARY is accepted and after a SIGHUP.
+ *
+ * Anything else, like command replies and the SIGHUP packet, is sent
+ * as TEXT records, the concatenated payloads being the text otherwise
+ * written on the socket.
+ *
+ * Records are little endian whatever the host, as clients of --listen
+ * may run on another one: lirc_record_put() and lirc_record_get()
+ * convert. The code of a RESET record is LIRC_RECORD_MAGIC, making a
+ * mismatch detectable.
+ */
+
+#ifndef EVENT_RECORD_H
+#define EVENT_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Code of the RESET record, "lirc". */
+#define LIRC_RECORD_MAGIC	0x6c697263ULL
+
+/** Largest id, and the largest payload. */
+#define LIRC_RECORD_MAX		0xffff
+
+/** The type of a struct lirc_record. */
+enum lirc_record_type {
+	LIRC_RECORD_EVENT = 1,  /**< A decoded button, no payload. */
+	LIRC_RECORD_NAME = 2,   /**< The payload is the name of id remote. */
+	LIRC_RECORD_RESET = 3,  /**< All ids are gone, no payload. */
+	LIRC_RECORD_TEXT = 4,   /**< The payload is text. */
+};
+
+/** A record, followed by size bytes of payload. */
+struct lirc_record {
+	uint16_t	type;           /**< A lirc_record_type. */
+	uint16_t	size;           /**< Of payload, not NUL-terminated. */
+	uint16_t	remote;         /**< Id of remote name, NAME: new id. */
+	uint16_t	button;         /**< Id of button name. */
+	uint32_t	reps;           /**< Repeat count, 0 on first press. */
+	uint32_t	reserved;       /**< Always 0. */
+	uint64_t	code;           /**< Scancode. */
+	uint64_t	timestamp;      /**< Broadcast time, CLOCK_MONOTONIC ns. */
+};
+
+
+/** Store the bytes low bytes of value at data, least significant first. */
+static inline void lirc_record_put_le(char* data, uint64_t value,
+				      size_t bytes)
+{
+	size_t i;
+
+	for (i = 0; i < bytes; i++, value >>= 8)
+		data[i] = (char)(value & 0xff);
+}
+
+
+/** Return the little endian value of bytes bytes at data. */
+static inline uint64_t lirc_record_get_le(const char* data, size_t bytes)
+{
+	uint64_t value = 0;
+
+	while (bytes-- > 0)
+		value = (value << 8) | (unsigned char)data[bytes];
+	return value;
+}
+
+
+/**
+ * Store record at data as sent on the socket.
+ *
+ * @param data Room for sizeof(struct lirc_record) bytes.
+ * @param record In host byte order.
+ */
+static inline void lirc_record_put(char* data,
+				   const struct lirc_record* record)
+{
+	lirc_record_put_le(data, record->type, 2);
+	lirc_record_put_le(data + 2, record->size, 2);
+	lirc_record_put_le(data + 4, record->remote, 2);
+	lirc_record_put_le(data + 6, record->button, 2);
+	lirc_record_put_le(data + 8, record->reps, 4);
+	lirc_record_put_le(data + 12, record->reserved, 4);
+	lirc_record_put_le(data + 16, record->code, 8);
+	lirc_record_put_le(data + 24, record->timestamp, 8);
+}
+
+
+/**
+ * Check for a complete record at the start of data.
+ *
+ * @param data Received bytes.
+ * @param size Of data.
+ * @param[out] record The record in host byte order if complete, its
+ *     payload starts sizeof(struct lirc_record) bytes into data.
+ * @return Size of record and payload, 0 if incomplete.
+ */
+static inline size_t lirc_record_get(const char* data, size_t size,
+				     struct lirc_record* record)
+{
+	if (size < sizeof(struct lirc_record))
+		return 0;
+	record->type = lirc_record_get_le(data, 2);
+	record->size = lirc_record_get_le(data + 2, 2);
+	record->remote = lirc_record_get_le(data + 4, 2);
+	record->button = lirc_record_get_le(data + 6, 2);
+	record->reps = lirc_record_get_le(data + 8, 4);
+	record->reserved = lirc_record_get_le(data + 12, 4);
+	record->code = lirc_record_get_le(data + 16, 8);
+	record->timestamp = lirc_record_get_le(data + 24, 8);
+	if (size < sizeof(struct lirc_record) + record->size)
+		return 0;
+	return sizeof(struct lirc_record) + record->size;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_RECORD_H */
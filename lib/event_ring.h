@@ -0,0 +1,90 @@
+/****************************************************************************
+** event_ring.h ************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file event_ring.h
+ * @brief Shared memory ring of decoded events, see lircd --event-ring.
+ * @ingroup private_api
+ *
+ * lircd writes each decoded event once into a ring in a file next to
+ * its socket, which local clients map read-only. Each client keeps its
+ * own read index, so the cost of an event does not grow with the number
+ * of clients. A client asks for the ring with the EVENT_RING command,
+ * after which lircd no longer writes events to its socket.
+ *
+ * There is a single writer. It clears the seq of a slot, fills it and
+ * then sets seq to the slot's index + 1, followed by head. A reader
+ * copies a slot and checks seq is unchanged; if not, the writer has
+ * lapped it and the events in between are lost. After each event the
+ * writer bumps the futex word and wakes all waiters.
+ */
+
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The magic of a valid ring header, written last. */
+#define LIRC_RING_MAGIC		0x6c697265
+
+/** Set in flags when lircd has stopped, the ring is not updated. */
+#define LIRC_RING_CLOSED	0x1
+
+/** Size of the names of a slot, fits any lircd code line. */
+#define LIRC_RING_NAMES_SIZE	288
+
+/** Largest number of slots. */
+#define LIRC_RING_MAX_SLOTS	65536
+
+struct lirc_ring_header {
+	uint32_t	magic;          /**< LIRC_RING_MAGIC when ready. */
+	uint32_t	slots;          /**< Number of slots, a power of two. */
+	uint32_t	slot_size;      /**< sizeof(struct lirc_ring_slot). */
+	uint32_t	futex;          /**< Low 32 bits of head. */
+	uint64_t	head;           /**< Number of events written. */
+	uint32_t	flags;          /**< LIRC_RING_CLOSED. */
+	uint8_t		reserved[36];   /**< The header is 64 bytes. */
+};
+
+struct lirc_ring_slot {
+	uint64_t	seq;            /**< Index + 1 when complete, else 0. */
+	uint64_t	code;           /**< Scancode. */
+	uint64_t	timestamp;      /**< Broadcast time, CLOCK_MONOTONIC ns. */
+	uint32_t	reps;           /**< Repeat count, 0 on first press. */
+	uint16_t	button_len;
+	uint16_t	remote_len;
+	/** Button and remote name, each NUL-terminated. */
+	char		names[LIRC_RING_NAMES_SIZE];
+};
+
+
+/** Return the slot of event index in the ring starting with header. */
+static inline struct lirc_ring_slot*
+lirc_ring_slot(const struct lirc_ring_header* header, uint64_t index)
+{
+	char* slots = (char*)header + sizeof(struct lirc_ring_header);
+
+	return (struct lirc_ring_slot*)(slots + (index & (header->slots - 1))
+					* sizeof(struct lirc_ring_slot));
+}
+
+
+/** Return the size of a ring with slots slots. */
+static inline size_t lirc_ring_size(uint32_t slots)
+{
+	return sizeof(struct lirc_ring_header)
+	       + (size_t)slots * sizeof(struct lirc_ring_slot);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_RING_H */
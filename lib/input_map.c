@@ -14,6 +14,7 @@
  */
 
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,15 +35,79 @@ struct {
 	}
 };
 
+/** Number of entries in input_map, without the terminating NULL. */
+static const int input_map_size = sizeof(input_map) / sizeof(input_map[0]) - 1;
+
+
+/**
+ * Compare names ignoring case like LC_ALL=C sort -f, by which
+ * lirc-make-devinput sorts input_map.inc. strcasecmp() folds to lower
+ * case and thus sorts '_' differently.
+ */
+static int name_cmp(const char* a, const char* b)
+{
+	int ca;
+	int cb;
+
+	do {
+		ca = toupper((unsigned char)*a++);
+		cb = toupper((unsigned char)*b++);
+	} while (ca == cb && ca != '\0');
+	return ca - cb;
+}
+
+
+/**
+ * Return 1 if input_map is sorted, which input_map.inc files made by
+ * older versions of lirc-make-devinput aren't.
+ */
+static int is_sorted(void)
+{
+	static int sorted = -1;
+	int i;
+
+	if (sorted == -1) {
+		sorted = 1;
+		for (i = 1; i < input_map_size; i++) {
+			if (name_cmp(input_map[i - 1].name,
+				     input_map[i].name) >= 0) {
+				sorted = 0;
+				break;
+			}
+		}
+	}
+	return sorted;
+}
+
+
 int get_input_code(const char* name, linux_input_code* code)
 {
+	int low = 0;
+	int high = input_map_size - 1;
+	int mid;
+	int r;
 	int i;
 
-	for (i = 0; input_map[i].name != NULL; i++) {
-		if (strcasecmp(name, input_map[i].name) == 0) {
-			*code = input_map[i].code;
-			return i;
+	if (!is_sorted()) {
+		for (i = 0; input_map[i].name != NULL; i++) {
+			if (strcasecmp(name, input_map[i].name) == 0) {
+				*code = input_map[i].code;
+				return i;
+			}
+		}
+		return -1;
+	}
+	while (low <= high) {
+		mid = (low + high) / 2;
+		r = name_cmp(name, input_map[mid].name);
+		if (r == 0) {
+			*code = input_map[mid].code;
+			return mid;
 		}
+		if (r < 0)
+			high = mid - 1;
+		else
+			low = mid + 1;
 	}
 	return -1;
 }
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
 #include <fcntl.h>
 #include <limits.h>
 
@@ -36,10 +37,13 @@
 #include "media/lirc.h"
 #endif
 
+#include "lirc/atom.h"
 #include "lirc/ir_remote.h"
 #include "lirc/driver.h"
 #include "lirc/release.h"
+#include "lirc/receive.h"
 #include "lirc/lirc_log.h"
+#include "lirc/metrics.h"
 
 static const logchannel_t logchannel = LOG_LIB;
 
@@ -52,11 +56,11 @@ static struct ir_ncode NCODE_EOF = {
 static const char* const PACKET_EOF = "0000000008000000 00 __EOF lirc\n";
 
 /** Const dummy remote used for lirc internal decoding. */
-static struct ir_remote lirc_internal_remote = { "lirc" };
+static struct ir_remote lirc_internal_remote = { .name = "lirc" };
 
-struct ir_remote* decoding = NULL;
+LIRC_THREAD_LOCAL struct ir_remote* decoding = NULL;
 
-struct ir_remote* last_remote = NULL;
+LIRC_THREAD_LOCAL struct ir_remote* last_remote = NULL;
 
 struct ir_remote* repeat_remote = NULL;
 
@@ -147,6 +151,276 @@ static int match_ir_code(struct ir_remote* remote, ir_code a, ir_code b)
 }
 
 
+/**
+ * Open addressing hash table mapping the complete code of each button,
+ * or'ed with ignore_mask, to its first position in remote->codes. The
+ * remote data used to compute the keys is saved to detect changes.
+ */
+struct ir_code_index {
+	const struct ir_ncode*	codes;
+	ir_code			pre_data;
+	ir_code			post_data;
+	ir_code			ignore_mask;
+	int			bits;
+	int			pre_data_bits;
+	int			post_data_bits;
+	int			flags;
+	size_t			mask;           /**< Table size - 1. */
+	struct {
+		ir_code		key;
+		int		pos;            /**< -1: empty slot. */
+	} slots[];
+};
+
+
+static size_t code_hash(ir_code key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (size_t)key;
+}
+
+
+void ir_remote_free_index(struct ir_remote* remote)
+{
+	free(remote->code_index);
+	remote->code_index = NULL;
+}
+
+
+/**
+ * Return the part of mask, covering all bits of remote, for the bits
+ * wide word following the first done bits.
+ */
+static ir_code split_mask(const struct ir_remote*	remote,
+			  ir_code			mask,
+			  int				bits,
+			  int				done)
+{
+	int shift = bit_count(remote) - done - bits;
+
+	if (bits <= 0 || shift < 0 || shift >= (int)(8 * sizeof(ir_code)))
+		return 0;
+	return (mask >> shift) & gen_mask(bits);
+}
+
+
+static void split_word_masks(const struct ir_remote*	remote,
+			     ir_code			mask,
+			     struct ir_split_mask*	split)
+{
+	split->all = mask;
+	split->pre = split_mask(remote, mask, remote->pre_data_bits, 0);
+	split->code = split_mask(remote, mask, remote->bits,
+				 remote->pre_data_bits);
+	split->post = split_mask(remote, mask, remote->post_data_bits,
+				 remote->pre_data_bits + remote->bits);
+}
+
+
+/** Split the masks applied by get_code() for the pre, code and post words. */
+static void calc_split_masks(struct ir_remote* remote)
+{
+	struct ir_limits* limits = &remote->limits;
+
+	limits->pre_data_bits = remote->pre_data_bits;
+	limits->bits = remote->bits;
+	limits->post_data_bits = remote->post_data_bits;
+	split_word_masks(remote, remote->toggle_mask, &limits->toggle);
+	split_word_masks(remote,
+			 remote->toggle_bit_mask | remote->ignore_mask,
+			 &limits->ignore);
+}
+
+
+static void check_split_masks(struct ir_remote* remote)
+{
+	const struct ir_limits* limits = &remote->limits;
+
+	if (limits->pre_data_bits != remote->pre_data_bits
+	    || limits->bits != remote->bits
+	    || limits->post_data_bits != remote->post_data_bits
+	    || limits->toggle.all != remote->toggle_mask
+	    || limits->ignore.all !=
+			(remote->toggle_bit_mask | remote->ignore_mask))
+		calc_split_masks(remote);
+}
+
+
+void ir_remote_calc_limits(struct ir_remote* remote)
+{
+	struct ir_limits* limits = &remote->limits;
+
+	limits->resolution = curr_driver->resolution;
+	limits->eps = remote->eps;
+	limits->aeps = remote->aeps;
+	limits->flags = remote->flags;
+	limits->rc6_mask = remote->rc6_mask;
+	if (is_rcmm(remote))
+		limits->bit_decoder = BITS_RCMM;
+	else if (is_grundig(remote))
+		limits->bit_decoder = BITS_GRUNDIG;
+	else if (is_serial(remote))
+		limits->bit_decoder = BITS_SERIAL;
+	else if (is_bo(remote))
+		limits->bit_decoder = BITS_BO;
+	else if (is_xmp(remote))
+		limits->bit_decoder = BITS_XMP;
+	else if (is_biphase(remote))
+		limits->bit_decoder = BITS_BIPHASE;
+	else if (is_space_first(remote))
+		limits->bit_decoder = BITS_SPACE_FIRST;
+	else
+		limits->bit_decoder = BITS_PULSE_FIRST;
+	limits->plain_bits = is_space_enc(remote) && remote->ptrail > 0
+			     && remote->pone > 0 && remote->sone > 0;
+	set_limit(remote, &limits->phead, remote->phead);
+	set_limit(remote, &limits->ptrail, remote->ptrail);
+	set_limit(remote, &limits->pfoot, remote->pfoot);
+	set_limit(remote, &limits->sfoot, remote->sfoot);
+	set_limit(remote, &limits->pone, remote->pone);
+	set_limit(remote, &limits->sone, remote->sone);
+	set_limit(remote, &limits->pzero, remote->pzero);
+	set_limit(remote, &limits->szero, remote->szero);
+	set_limit(remote, &limits->sone2, 2 * remote->sone);
+	set_limit(remote, &limits->pzero2, 2 * remote->pzero);
+	set_limit(remote, &limits->prepeat, remote->prepeat);
+	set_limit(remote, &limits->srepeat, remote->srepeat);
+	set_limit(remote, &limits->pre_p, remote->pre_p);
+	set_limit(remote, &limits->post_p, remote->post_p);
+	calc_split_masks(remote);
+}
+
+
+void ir_remote_check_limits(struct ir_remote* remote)
+{
+	const struct ir_limits* limits = &remote->limits;
+
+	if (limits->resolution != curr_driver->resolution
+	    || limits->eps != remote->eps
+	    || limits->aeps != remote->aeps
+	    || limits->flags != remote->flags
+	    || limits->rc6_mask != remote->rc6_mask
+	    || limits->phead.value != remote->phead
+	    || limits->ptrail.value != remote->ptrail
+	    || limits->pfoot.value != remote->pfoot
+	    || limits->sfoot.value != remote->sfoot
+	    || limits->pone.value != remote->pone
+	    || limits->sone.value != remote->sone
+	    || limits->pzero.value != remote->pzero
+	    || limits->szero.value != remote->szero
+	    || limits->sone2.value != 2 * remote->sone
+	    || limits->pzero2.value != 2 * remote->pzero
+	    || limits->prepeat.value != remote->prepeat
+	    || limits->srepeat.value != remote->srepeat
+	    || limits->pre_p.value != remote->pre_p
+	    || limits->post_p.value != remote->post_p)
+		ir_remote_calc_limits(remote);
+}
+
+
+void ir_remote_index_codes(struct ir_remote* remote)
+{
+	struct ir_code_index* index;
+	const struct ir_ncode* code;
+	size_t count;
+	size_t size;
+	size_t i;
+	ir_code key;
+
+	ir_remote_free_index(remote);
+	if (remote->codes == NULL)
+		return;
+	for (count = 0; remote->codes[count].name != NULL; count++)
+		if (remote->codes[count].next != NULL)
+			return;         /* find_longest_match() needed */
+	for (size = 8; size < 2 * count; size *= 2)
+		;
+	index = (struct ir_code_index*)malloc(sizeof(*index)
+					      + size * sizeof(index->slots[0]));
+	if (index == NULL)
+		return;
+	index->codes = remote->codes;
+	index->pre_data = remote->pre_data;
+	index->post_data = remote->post_data;
+	index->ignore_mask = remote->ignore_mask;
+	index->bits = remote->bits;
+	index->pre_data_bits = remote->pre_data_bits;
+	index->post_data_bits = remote->post_data_bits;
+	index->flags = remote->flags;
+	index->mask = size - 1;
+	for (i = 0; i < size; i++)
+		index->slots[i].pos = -1;
+	for (code = remote->codes; code->name != NULL; code++) {
+		key = remote->ignore_mask | gen_ir_code(remote,
+							remote->pre_data,
+							code->code,
+							remote->post_data);
+		i = code_hash(key) & index->mask;
+		while (index->slots[i].pos != -1 && index->slots[i].key != key)
+			i = (i + 1) & index->mask;
+		if (index->slots[i].pos == -1) {
+			/* Only the first of duplicates is ever found. */
+			index->slots[i].key = key;
+			index->slots[i].pos = code - remote->codes;
+		}
+	}
+	remote->code_index = index;
+}
+
+
+/** Return index for remote if it's still valid, else NULL. */
+static const struct ir_code_index* get_index(const struct ir_remote* remote)
+{
+	const struct ir_code_index* index = remote->code_index;
+
+	if (index == NULL
+	    || index->codes != remote->codes
+	    || index->pre_data != remote->pre_data
+	    || index->post_data != remote->post_data
+	    || index->ignore_mask != remote->ignore_mask
+	    || index->bits != remote->bits
+	    || index->pre_data_bits != remote->pre_data_bits
+	    || index->post_data_bits != remote->post_data_bits
+	    || index->flags != remote->flags)
+		return NULL;
+	return index;
+}
+
+
+/** Position of first code in index with given key, or INT_MAX. */
+static int index_lookup(const struct ir_code_index* index, ir_code key)
+{
+	size_t i = code_hash(key) & index->mask;
+
+	while (index->slots[i].pos != -1) {
+		if (index->slots[i].key == key)
+			return index->slots[i].pos;
+		i = (i + 1) & index->mask;
+	}
+	return INT_MAX;
+}
+
+
+/** Like match_ir_code() on all codes, returning the first match. */
+static struct ir_ncode* find_indexed_code(struct ir_remote* remote,
+					  const struct ir_code_index* index,
+					  ir_code all)
+{
+	ir_code ignore = remote->ignore_mask;
+	int pos;
+	int pos2;
+
+	pos = index_lookup(index, ignore | all);
+	pos2 = index_lookup(index,
+			    ignore | (all ^ remote->toggle_bit_mask));
+	if (pos2 < pos)
+		pos = pos2;
+	return pos == INT_MAX ? NULL : &remote->codes[pos];
+}
+
+
 /**
  *
  * @param remotes
@@ -252,13 +526,16 @@ struct ir_remote* get_ir_remote(const struct ir_remote* remotes,
 				const char*		name)
 {
 	const struct ir_remote* all;
+	lirc_atom_t atom;
 
 	/* use remotes carefully, it may be changed on SIGHUP */
 	all = remotes;
 	if (strcmp(name, "lirc") == 0)
 		return &lirc_internal_remote;
+	atom = lirc_atom_find(name);
 	while (all) {
-		if (strcasecmp(all->name, name) == 0)
+		if (all->atom != 0 ? all->atom == atom
+		    : strcasecmp(all->name, name) == 0)
 			return (struct ir_remote*)all;
 		all = all->next;
 	}
@@ -398,14 +675,18 @@ struct ir_ncode* get_code_by_name(const struct ir_remote*	remote,
 				  const char*			name)
 {
 	const struct ir_ncode* all;
+	lirc_atom_t atom;
 
 	all = remote->codes;
 	if (all == NULL)
 		return NULL;
 	if (strcmp(remote->name, "lirc") == 0)
 		return strcmp(name, "__EOF") == 0 ? &NCODE_EOF : 0;
+	/* Interned names are compared by atom, 0 if name is unknown. */
+	atom = lirc_atom_find(name);
 	while (all->name != NULL) {
-		if (strcasecmp(all->name, name) == 0)
+		if (all->atom != 0 ? all->atom == atom
+		    : strcasecmp(all->name, name) == 0)
 			return (struct ir_ncode*)all;
 		all++;
 	}
@@ -475,47 +756,19 @@ static struct ir_ncode* get_code(struct ir_remote*	remote,
 				 int*			repeat_flag,
 				 ir_code*		toggle_bit_mask_statep)
 {
-	ir_code pre_mask, code_mask, post_mask, toggle_bit_mask_state, all;
+	ir_code pre_mask, post_mask, toggle_bit_mask_state, all;
 	int found_code, have_code;
 	struct ir_ncode* codes;
 	struct ir_ncode* found;
+	const struct ir_code_index* index;
 
-	pre_mask = code_mask = post_mask = 0;
-
-	if (has_toggle_bit_mask(remote)) {
-		pre_mask = remote->toggle_bit_mask >>
-			   (remote->bits + remote->post_data_bits);
-		post_mask = remote->toggle_bit_mask & gen_mask(
-			remote->post_data_bits);
-	}
-	if (has_ignore_mask(remote)) {
-		pre_mask |= remote->ignore_mask >>
-			    (remote->bits + remote->post_data_bits);
-		post_mask |= remote->ignore_mask & gen_mask(
-			remote->post_data_bits);
-	}
+	check_split_masks(remote);
+	pre_mask = remote->limits.ignore.pre;
+	post_mask = remote->limits.ignore.post;
 	if (has_toggle_mask(remote) && remote->toggle_mask_state % 2) {
-		ir_code* affected;
-		ir_code mask;
-		ir_code mask_bit;
-		int bit, current_bit;
-
-		affected = &post;
-		mask = remote->toggle_mask;
-		for (bit = current_bit = 0; bit < bit_count(remote);
-		     bit++, current_bit++) {
-			if (bit == remote->post_data_bits) {
-				affected = &code;
-				current_bit = 0;
-			}
-			if (bit == remote->post_data_bits + remote->bits) {
-				affected = &pre;
-				current_bit = 0;
-			}
-			mask_bit = mask & 1;
-			(*affected) ^= (mask_bit << current_bit);
-			mask >>= 1;
-		}
+		pre ^= remote->limits.toggle.pre;
+		code ^= remote->limits.toggle.code;
+		post ^= remote->limits.toggle.post;
 	}
 	if (has_pre(remote)) {
 		if ((pre | pre_mask) != (remote->pre_data | pre_mask)) {
@@ -546,7 +799,18 @@ static struct ir_ncode* get_code(struct ir_remote*	remote,
 	found_code = 0;
 	have_code = 0;
 	codes = remote->codes;
-	if (codes != NULL) {
+	index = get_index(remote);
+	if (codes != NULL && index != NULL) {
+		/* Single code buttons only, no state to update. */
+		found = find_indexed_code(remote, index, all);
+		if (*repeat_flag && has_repeat_mask(remote)) {
+			codes = find_indexed_code(remote, index,
+						  all ^ remote->repeat_mask);
+			if (codes != NULL && (found == NULL || codes < found))
+				found = codes;
+		}
+		found_code = found != NULL;
+	} else if (codes != NULL) {
 		while (codes->name != NULL) {
 			ir_code next_all;
 
@@ -612,20 +876,34 @@ static struct ir_ncode* get_code(struct ir_remote*	remote,
 }
 
 
+void get_monotonic_time(struct timeval* tv)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+#else
+	gettimeofday(tv, NULL);
+#endif
+}
+
+
 static uint64_t set_code(struct ir_remote*		remote,
 		      struct ir_ncode*		found,
 		      ir_code			toggle_bit_mask_state,
 		      struct decode_ctx_t*	ctx)
 {
-	struct timeval current;
-	static struct ir_remote* last_decoded = NULL;
+	struct timeval current = ctx->time;
 
 	log_trace("found: %s", found->name);
 
-	gettimeofday(&current, NULL);
-	log_trace("%lx %lx %lx %d %d %d %d %d %d %d",
-		  remote, last_remote, last_decoded,
-		  remote == last_decoded,
+	/* Drivers with their own decode_func don't stamp ctx. */
+	if (!timerisset(&current))
+		rec_get_time(&current);
+	log_trace("%lx %lx %d %d %d %d %d %d",
+		  remote, last_remote,
 		  found == remote->last_code, found->next != NULL,
 		  found->current != NULL, ctx->repeat_flag,
 		  time_elapsed(&remote->last_send,
@@ -643,8 +921,8 @@ static uint64_t set_code(struct ir_remote*		remote,
 
 		ctx->repeat_flag = 0;
 	}
-	if (remote == last_decoded &&
-	    (found == remote->last_code
+	/* Repeats are per remote: others may be decoded in between. */
+	if ((found == remote->last_code
 	     || (found->next != NULL && found->current != NULL))
 	    && ctx->repeat_flag
 	    && time_elapsed(&remote->last_send, &current) < 1000000
@@ -672,7 +950,6 @@ static uint64_t set_code(struct ir_remote*		remote,
 			remote->toggle_bit_mask_state = toggle_bit_mask_state;
 	}
 	last_remote = remote;
-	last_decoded = remote;
 	if (found->current == NULL)
 		remote->last_code = found;
 	remote->last_send = current;
@@ -730,122 +1007,548 @@ int write_message(char*		buffer,
 }
 
 
-char* decode_all(struct ir_remote* remotes)
+/**
+ * Try to decode the signal as a code of remote.
+ *
+ * @param message Buffer of PACKET_SIZE + 1 for the result.
+ * @param[out] result The formatted code, or NULL if suppressed.
+ * @return 1 if remote matched, else 0.
+ */
+static int decode_remote(struct ir_remote* remote, char* message,
+			 char** result)
 {
-	struct ir_remote* remote;
-	static char message[PACKET_SIZE + 1];
 	struct ir_ncode* ncode;
 	ir_code toggle_bit_mask_state;
-	struct ir_remote* scan;
 	struct ir_ncode* scan_ncode;
 	struct decode_ctx_t ctx;
+	int len;
+	int reps;
 
-	/* use remotes carefully, it may be changed on SIGHUP */
-	decoding = remote = remotes;
-	while (remote) {
-		log_trace("trying \"%s\" remote", remote->name);
-		if (curr_driver->decode_func(remote, &ctx)) {
-			ncode = get_code(remote,
-					 ctx.pre, ctx.code, ctx.post,
-					 &ctx.repeat_flag,
-					 &toggle_bit_mask_state);
-			if (ncode) {
-				int len;
-				int reps;
-
-				if (ncode == &NCODE_EOF) {
-					log_debug("decode all: returning EOF");
-					strncpy(message,
-						PACKET_EOF, sizeof(message));
-					return message;
-				}
-				ctx.code = set_code(remote,
-						    ncode,
-						    toggle_bit_mask_state,
-						    &ctx);
-				if ((has_toggle_mask(remote)
-				     && remote->toggle_mask_state % 2)
-				    || ncode->current != NULL) {
-					decoding = NULL;
-					return NULL;
-				}
+	log_trace("trying \"%s\" remote", remote->name);
+	metrics_add(&remote->stats.attempts, 1);
+	timerclear(&ctx.time);
+	if (!curr_driver->decode_func(remote, &ctx)) {
+		remote->toggle_mask_state = 0;
+		return 0;
+	}
+	ncode = get_code(remote,
+			 ctx.pre, ctx.code, ctx.post,
+			 &ctx.repeat_flag,
+			 &toggle_bit_mask_state);
+	if (ncode == NULL) {
+		log_trace("failed \"%s\" remote", remote->name);
+		remote->toggle_mask_state = 0;
+		return 0;
+	}
+	*result = NULL;
+	if (ncode == &NCODE_EOF) {
+		log_debug("decode all: returning EOF");
+		strncpy(message, PACKET_EOF, PACKET_SIZE + 1);
+		*result = message;
+		return 1;
+	}
+	rec_buffer_remember(decoding, remote);
+	ctx.code = set_code(remote, ncode, toggle_bit_mask_state, &ctx);
+	if ((has_toggle_mask(remote) && remote->toggle_mask_state % 2)
+	    || ncode->current != NULL)
+		return 1;
+
+	/*
+	 * End the sequences of this remote. Other remotes keep theirs, a
+	 * stale one is reset by its next mismatch. Indexed remotes have no
+	 * sequences.
+	 */
+	if (get_index(remote) == NULL)
+		for (scan_ncode = remote->codes;
+		     scan_ncode->name != NULL;
+		     scan_ncode++)
+			scan_ncode->current = NULL;
+	if (is_xmp(remote))
+		remote->last_code->current = remote->last_code->next;
+	reps = remote->reps - (ncode->next ? 1 : 0);
+	if (reps > 0) {
+		if (reps <= remote->suppress_repeat)
+			return 1;
+		reps -= remote->suppress_repeat;
+	}
+	register_button_press(remote, remote->last_code, ctx.code, reps);
+	len = write_message(message, PACKET_SIZE + 1,
+			    remote->name, remote->last_code->name, "",
+			    ctx.code, reps);
+	if (len >= PACKET_SIZE + 1) {
+		log_error("message buffer overflow");
+		return 1;
+	}
+	metrics_add(&remote->stats.decoded, 1);
+	metrics_inc(METRIC_DECODED);
+	*result = message;
+	return 1;
+}
 
-				for (scan = decoding;
-				     scan != NULL;
-				     scan = scan->next)
-					for (scan_ncode = scan->codes;
-					     scan_ncode->name != NULL;
-					     scan_ncode++)
-						scan_ncode->current = NULL;
-				if (is_xmp(remote))
-					remote->last_code->current =
-						remote->last_code->next;
-				reps = remote->reps - (ncode->next ? 1 : 0);
-				if (reps > 0) {
-					if (reps <= remote->suppress_repeat) {
-						decoding = NULL;
-						return NULL;
-					}
-					reps -= remote->suppress_repeat;
-				}
-				register_button_press(remote,
-						      remote->last_code,
-						      ctx.code,
-						      reps);
-				len = write_message(message, PACKET_SIZE + 1,
-						    remote->name,
-						    remote->last_code->name,
-						    "",
-						    ctx.code,
-						    reps);
+
+/** Decoded codes between the reorderings of a struct ir_remote_order. */
+#define ORDER_PERIOD 64
+
+/** An adaptive decode order, see ir_remote_set_adaptive_order(). */
+struct ir_remote_order {
+	int		manual;         /**< Some remote has manual_sort. */
+	int		count;
+	int		decoded;        /**< Since last reordering. */
+	struct {
+		struct ir_remote*	remote;
+		unsigned int		hits;   /**< Halved when reordering. */
+	} entries[];
+};
+
+static int adaptive_order = 0;
+
+
+void ir_remote_set_adaptive_order(int enabled)
+{
+	adaptive_order = enabled;
+}
+
+
+void ir_remote_free_order(struct ir_remote* remote)
+{
+	free(remote->order);
+	remote->order = NULL;
+}
+
+
+/** Return the order of the list headed by remotes, created if needed. */
+static struct ir_remote_order* get_order(struct ir_remote* remotes)
+{
+	struct ir_remote_order* order;
+	struct ir_remote* remote;
+	int count = 0;
+
+	if (remotes->order != NULL)
+		return remotes->order;
+	for (remote = remotes; remote != NULL; remote = remote->next)
+		count++;
+	order = (struct ir_remote_order*)
+		calloc(1, sizeof(*order) + count * sizeof(order->entries[0]));
+	if (order == NULL) {
+		log_error("Out of memory for decode order");
+		return NULL;
+	}
+	order->count = count;
+	count = 0;
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		if (remote->manual_sort)
+			order->manual = 1;
+		order->entries[count++].remote = remote;
+	}
+	remotes->order = order;
+	return order;
+}
+
+
+/** Count a hit of entry i, reorder by decreasing hits when due. */
+static void order_hit(struct ir_remote_order* order, int i)
+{
+	int j;
+
+	order->entries[i].hits++;
+	if (++order->decoded < ORDER_PERIOD)
+		return;
+	order->decoded = 0;
+	/* Stable, ties keep the order of the list. */
+	for (i = 1; i < order->count; i++) {
+		for (j = i; j > 0
+		     && order->entries[j - 1].hits < order->entries[j].hits;
+		     j--) {
+			struct ir_remote* remote = order->entries[j].remote;
+			unsigned int hits = order->entries[j].hits;
+
+			order->entries[j] = order->entries[j - 1];
+			order->entries[j - 1].remote = remote;
+			order->entries[j - 1].hits = hits;
+		}
+	}
+	for (i = 0; i < order->count; i++)
+		order->entries[i].hits /= 2;
+}
+
+
+/** Largest number of remotes tried through the scancode index. */
+#define SCANCODE_HITS 16
+
+/** A remote and its position in the list. */
+struct scancode_entry {
+	struct ir_remote*	remote;
+	int			pos;
+};
+
+/**
+ * Index of the codes of all remotes in a list, used when the driver
+ * decodes (LIRCCODE, SCANCODE). The complete code of each button of
+ * the plain remotes maps to the remotes using it; a plain remote has no
+ * masks, toggles or multi-code buttons, so it can only match these. The
+ * other remotes are always tried.
+ */
+struct ir_scancode_index {
+	const struct driver*	driver;
+	int			code_length;
+	int			count;          /**< Of fallback. */
+	struct scancode_entry*	fallback;       /**< In list order. */
+	size_t			mask;           /**< Table size - 1. */
+	struct {
+		ir_code			key;
+		struct scancode_entry	entry;  /**< remote NULL: empty. */
+	} slots[];
+};
+
+
+size_t ir_remote_index_memory(const struct ir_remote* remote)
+{
+	const struct ir_code_index* index = remote->code_index;
+	const struct ir_remote_order* order = remote->order;
+	const struct ir_scancode_index* scancodes = remote->scancode_index;
+	size_t size = 0;
+
+	if (index != NULL)
+		size += sizeof(*index)
+			+ (index->mask + 1) * sizeof(index->slots[0]);
+	if (order != NULL)
+		size += sizeof(*order)
+			+ order->count * sizeof(order->entries[0]);
+	if (scancodes != NULL)
+		size += sizeof(*scancodes)
+			+ (scancodes->mask + 1) * sizeof(scancodes->slots[0])
+			+ (scancodes->count + 1)
+			  * sizeof(scancodes->fallback[0]);
+	return size;
+}
+
+
+static int use_scancode_index = 0;
+
+
+void ir_remote_set_scancode_index(int enabled)
+{
+	use_scancode_index = enabled;
+}
+
+
+void ir_remote_free_scancode_index(struct ir_remote* remote)
+{
+	if (remote->scancode_index != NULL)
+		free(remote->scancode_index->fallback);
+	free(remote->scancode_index);
+	remote->scancode_index = NULL;
+}
+
+
+/** Return true if remote matches a code only by its value. */
+static int is_plain(struct ir_remote* remote)
+{
+	const struct ir_ncode* code;
+
+	if (has_toggle_mask(remote) || has_repeat_mask(remote)
+	    || remote->ignore_mask != 0 || remote->toggle_bit_mask != 0)
+		return 0;
+	for (code = remote->codes; code && code->name != NULL; code++)
+		if (code->next != NULL)
+			return 0;
+	return 1;
+}
+
+
+/** Add pos, remote to index unless it has the key already. */
+static void scancode_insert(struct ir_scancode_index* index, ir_code key,
+			    struct ir_remote* remote, int pos)
+{
+	size_t i = code_hash(key) & index->mask;
+
+	/* Duplicates follow each other in list order. */
+	while (index->slots[i].entry.remote != NULL) {
+		if (index->slots[i].key == key
+		    && index->slots[i].entry.remote == remote)
+			return;
+		i = (i + 1) & index->mask;
+	}
+	index->slots[i].key = key;
+	index->slots[i].entry.remote = remote;
+	index->slots[i].entry.pos = pos;
+}
+
+
+/** Return the index of the list headed by remotes, created if needed. */
+static struct ir_scancode_index* get_scancode_index(struct ir_remote* remotes)
+{
+	struct ir_scancode_index* index = remotes->scancode_index;
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	size_t codes = 0;
+	size_t size;
+	int count = 0;
+	int pos;
+
+	if (index != NULL && index->driver == curr_driver
+	    && index->code_length == curr_driver->code_length)
+		return index;
+	ir_remote_free_scancode_index(remotes);
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		if (!is_plain(remote))
+			count++;
+		for (code = remote->codes; code && code->name; code++)
+			codes++;
+	}
+	for (size = 8; size < 2 * codes; size *= 2)
+		;
+	index = (struct ir_scancode_index*)
+		calloc(1, sizeof(*index) + size * sizeof(index->slots[0]));
+	if (index == NULL) {
+		log_error("Out of memory for scancode index");
+		return NULL;
+	}
+	index->fallback = (struct scancode_entry*)
+		malloc((count + 1) * sizeof(index->fallback[0]));
+	if (index->fallback == NULL) {
+		free(index);
+		log_error("Out of memory for scancode index");
+		return NULL;
+	}
+	index->driver = curr_driver;
+	index->code_length = curr_driver->code_length;
+	index->mask = size - 1;
+	pos = 0;
+	for (remote = remotes; remote != NULL; remote = remote->next, pos++) {
+		if (!is_plain(remote)) {
+			index->fallback[index->count].remote = remote;
+			index->fallback[index->count++].pos = pos;
+			continue;
+		}
+		/* Others are rejected by receive_decode(). */
+		if (is_raw(remote) || bit_count(remote) != index->code_length)
+			continue;
+		for (code = remote->codes; code && code->name; code++)
+			scancode_insert(index,
+					gen_ir_code(remote, remote->pre_data,
+						    code->code,
+						    remote->post_data),
+					remote, pos);
+	}
+	remotes->scancode_index = index;
+	return index;
+}
+
+
+/**
+ * Find the remotes of index which may decode key, in list order.
+ *
+ * @return Number of remotes in hits, -1 if there are too many.
+ */
+static int scancode_lookup(const struct ir_scancode_index*	index,
+			   ir_code				key,
+			   struct scancode_entry*		hits)
+{
+	size_t i = code_hash(key) & index->mask;
+	const struct scancode_entry* fallback = index->fallback;
+	const struct scancode_entry* end = fallback + index->count;
+	int count = 0;
+
+	for (; index->slots[i].entry.remote != NULL;
+	     i = (i + 1) & index->mask) {
+		if (index->slots[i].key != key)
+			continue;
+		while (fallback < end
+		       && fallback->pos < index->slots[i].entry.pos) {
+			if (count == SCANCODE_HITS)
+				return -1;
+			hits[count++] = *fallback++;
+		}
+		if (count == SCANCODE_HITS)
+			return -1;
+		hits[count++] = index->slots[i].entry;
+	}
+	while (fallback < end) {
+		if (count == SCANCODE_HITS)
+			return -1;
+		hits[count++] = *fallback++;
+	}
+	return count;
+}
+
+
+/** Try the remotes in hits, as decode_remote. */
+static int decode_hits(const struct scancode_entry* hits, int count,
+		       char* message, char** result)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (decode_remote(hits[i].remote, message, result))
+			return 1;
+	return 0;
+}
+
+
+/**
+ * Look up the code to decode in the scancode index of remotes.
+ *
+ * @return Number of remotes to try in hits, -1 if all must be tried.
+ */
+static int find_scancode_hits(struct ir_remote*		remotes,
+			      struct scancode_entry*	hits)
+{
+	struct ir_scancode_index* index;
+	ir_code code;
+
+	if (!use_scancode_index || remotes == NULL || dyncodes
+	    || curr_driver->decode_func != receive_decode
+	    || !rec_buffer_get_code(&code))
+		return -1;
+	/* Bits above code_length: compare as get_code() would. */
+	if ((code & ~gen_mask(curr_driver->code_length)) != 0)
+		return -1;
+	index = get_scancode_index(remotes);
+	if (index == NULL)
+		return -1;
+	return scancode_lookup(index, code, hits);
+}
+
+
+/** Return true if remote is in hits, or count is -1. */
+static int is_hit(const struct scancode_entry* hits, int count,
+		  const struct ir_remote* remote)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (hits[i].remote == remote)
+			return 1;
+	return count == -1;
+}
+
+
+/**
+ * Try the remotes of order which are in hits, last_remote first, return
+ * as decode_remote. A count of -1 tries all.
+ */
+static int decode_ordered(struct ir_remote_order*	order,
+			  const struct scancode_entry*	hits,
+			  int				count,
+			  char*				message,
+			  char**			result)
+{
+	struct ir_remote* remote;
+	int first = -1;
+	int i;
+
+	for (i = 0; last_remote != NULL && i < order->count; i++) {
+		if (order->entries[i].remote == last_remote) {
+			first = i;
+			break;
+		}
+	}
+	if (first != -1 && is_hit(hits, count, last_remote)
+	    && decode_remote(last_remote, message, result)) {
+		order_hit(order, first);
+		return 1;
+	}
+	for (i = 0; i < order->count; i++) {
+		remote = order->entries[i].remote;
+		if (i != first && is_hit(hits, count, remote)
+		    && decode_remote(remote, message, result)) {
+			order_hit(order, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static char* decode_remotes(struct ir_remote* remotes)
+{
+	struct scancode_entry hits[SCANCODE_HITS];
+	struct ir_remote_order* order = NULL;
+	struct ir_remote* remote;
+	static LIRC_THREAD_LOCAL char message[PACKET_SIZE + 1];
+	char* result;
+	int count;
+
+	/* use remotes carefully, it may be changed on SIGHUP */
+	decoding = remotes;
+	remote = rec_buffer_recall(remotes);
+	if (remote != NULL && decode_remote(remote, message, &result)) {
+		decoding = NULL;
+		return result;
+	}
+	if (adaptive_order && remotes != NULL)
+		order = get_order(remotes);
+	count = find_scancode_hits(remotes, hits);
+	if (order != NULL && !order->manual) {
+		if (decode_ordered(order, hits, count, message, &result)) {
+			decoding = NULL;
+			return result;
+		}
+	} else if (count >= 0) {
+		if (decode_hits(hits, count, message, &result)) {
+			decoding = NULL;
+			return result;
+		}
+	} else {
+		for (remote = remotes; remote; remote = remote->next) {
+			if (decode_remote(remote, message, &result)) {
 				decoding = NULL;
-				if (len >= PACKET_SIZE + 1) {
-					log_error("message buffer overflow");
-					return NULL;
-				} else {
-					return message;
-				}
-			} else {
-				log_trace("failed \"%s\" remote",
-					  remote->name);
+				return result;
 			}
 		}
-		remote->toggle_mask_state = 0;
-		remote = remote->next;
 	}
 	decoding = NULL;
 	last_remote = NULL;
 	log_trace("decoding failed for all remotes");
+	metrics_inc(METRIC_DECODE_FAILED);
 	return NULL;
 }
 
 
+char* decode_all(struct ir_remote* remotes)
+{
+	uint64_t start = metrics_now();
+	char* message;
+
+	message = decode_remotes(remotes);
+	metrics_observe(METRIC_DECODE_TIME, metrics_now() - start);
+	return message;
+}
+
+
+unsigned long send_ir_ncode_gap(struct ir_remote* remote,
+				struct ir_ncode* code)
+{
+	struct timeval current;
+
+	if (remote->last_code == NULL)
+		return 0;
+	/* Repeats are timed by the caller. */
+	if (repeat_remote != NULL && remote == repeat_remote
+	    && remote->last_code == code)
+		return 0;
+	get_monotonic_time(&current);
+	return time_left(&current, &remote->last_send,
+			 remote->min_remaining_gap * 2);
+}
+
+
 int send_ir_ncode(struct ir_remote* remote, struct ir_ncode* code, int delay)
 {
+	unsigned long usecs;
 	int ret;
 
 	if (delay) {
 		/* insert pause when needed: */
-		if (remote->last_code != NULL) {
-			struct timeval current;
-			unsigned long usecs;
-
-			gettimeofday(&current, NULL);
-			usecs = time_left(&current,
-					  &remote->last_send,
-					  remote->min_remaining_gap * 2);
-			if (usecs > 0) {
-				if (repeat_remote == NULL || remote !=
-				    repeat_remote
-				    || remote->last_code != code)
-					usleep(usecs);
-			}
-		}
+		usecs = send_ir_ncode_gap(remote, code);
+		if (usecs > 0)
+			usleep(usecs);
 	}
 	ret = curr_driver->send_func(remote, code);
 
 	if (ret) {
-		gettimeofday(&remote->last_send, NULL);
+		get_monotonic_time(&remote->last_send);
 		remote->last_code = code;
 	}
 	return ret;
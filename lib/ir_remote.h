@@ -45,9 +45,21 @@ void ncode_free(struct ir_ncode* ncode);
 
 
 /**
- * TODO
+ * Storage class for per-thread decoder state. initial-exec avoids a
+ * __tls_get_addr() call for each access in the decoding hot paths;
+ * liblirc is linked, not dlopen()'ed, by its users.
  */
-extern struct ir_remote* last_remote;
+#if defined(__GNUC__) || defined(__clang__)
+#define LIRC_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#else
+#define LIRC_THREAD_LOCAL
+#endif
+
+/**
+ * The remote which decoded the last signal in the calling thread.
+ * Saved and restored by rec_context_select().
+ */
+extern LIRC_THREAD_LOCAL struct ir_remote* last_remote;
 
 
 /**
@@ -369,6 +381,28 @@ static inline int expect_at_most(const struct ir_remote*	remote,
 	return 0;
 }
 
+/** Set limit to value and the range accepted by expect(). */
+static inline void set_limit(const struct ir_remote*	remote,
+			     struct ir_limit*		limit,
+			     lirc_t			value)
+{
+	int aeps = curr_driver->resolution > remote->aeps ?
+		   curr_driver->resolution : remote->aeps;
+	lirc_t tolerance = value * remote->eps / 100;
+
+	if (tolerance < aeps)
+		tolerance = aeps;
+	limit->value = value;
+	limit->min = value - tolerance;
+	limit->max = value + tolerance;
+}
+
+/** Same as expect(remote, delta, limit->value), given set_limit(). */
+static inline int in_limit(const struct ir_limit* limit, lirc_t delta)
+{
+	return delta >= limit->min && delta <= limit->max;
+}
+
 static inline lirc_t upper_limit(const struct ir_remote* remote, lirc_t val)
 {
 	int aeps = curr_driver->resolution > remote->aeps ?
@@ -394,6 +428,13 @@ static inline lirc_t lower_limit(const struct ir_remote* remote, lirc_t val)
 	return eps_val < aeps_val ? eps_val : aeps_val;
 }
 
+/**
+ * Store the current CLOCK_MONOTONIC time in tv. All times compared
+ * against last_send or the release time must come from here so that
+ * wall clock steps don't break repeat and release detection.
+ */
+void get_monotonic_time(struct timeval* tv);
+
 /* only works if last <= current */
 static inline unsigned long time_elapsed(const struct timeval*	last,
 					 const struct timeval*	current)
@@ -409,15 +450,11 @@ static inline unsigned long time_elapsed(const struct timeval*	last,
 
 static inline ir_code gen_mask(int bits)
 {
-	int i;
-	ir_code mask;
-
-	mask = 0;
-	for (i = 0; i < bits; i++) {
-		mask <<= 1;
-		mask |= 1;
-	}
-	return mask;
+	if (bits <= 0)
+		return 0;
+	if (bits >= (int)(8 * sizeof(ir_code)))
+		return ~(ir_code)0;
+	return (((ir_code)1) << bits) - 1;
 }
 
 static inline ir_code gen_ir_code(const struct ir_remote*	remote,
@@ -514,6 +551,67 @@ char* decode_all(struct ir_remote* remotes);
  */
 int send_ir_ncode(struct ir_remote* remote, struct ir_ncode* code, int delay);
 
+/**
+ * Return the pause send_ir_ncode() with delay set would insert before
+ * sending code, letting callers wait for it without blocking.
+ * @param remote Remote of code, keeps the time of the last send.
+ * @param code IR code to be transmitted.
+ * @return Time left until code may be sent, us, 0 if none.
+ */
+unsigned long send_ir_ncode_gap(struct ir_remote* remote,
+				struct ir_ncode* code);
+
+/**
+ * Build the hash index used when decoding codes of remote. Remotes with
+ * multi-code buttons are not indexed. The index must be rebuilt if the
+ * codes or the pre/post data are changed.
+ */
+void ir_remote_index_codes(struct ir_remote* remote);
+
+/** Dispose the index built by ir_remote_index_codes(), if any. */
+void ir_remote_free_index(struct ir_remote* remote);
+
+/**
+ * Make decode_all() try the remotes which decode most often first,
+ * rather than in list order. The remote of the last decoded code is
+ * always tried first, the others are reordered by their recent hits
+ * every few decoded codes. Lists where any remote has manual_sort set
+ * are always tried in list order.
+ */
+void ir_remote_set_adaptive_order(int enabled);
+
+/** Dispose the decode order of a list headed by remote, if any. */
+void ir_remote_free_order(struct ir_remote* remote);
+
+/**
+ * Make decode_all() look up codes decoded by LIRCCODE and SCANCODE
+ * drivers in an index of all buttons of the remotes, trying only the
+ * remotes having the code and those with masks, toggles or multi-code
+ * buttons. The index is built on first use for each list; the remotes
+ * must not be changed while enabled, except by reloading them.
+ */
+void ir_remote_set_scancode_index(int enabled);
+
+/** Dispose the scancode index of a list headed by remote, if any. */
+void ir_remote_free_scancode_index(struct ir_remote* remote);
+
+/** Return the size of the decode indexes and order held by remote. */
+size_t ir_remote_index_memory(const struct ir_remote* remote);
+
+/**
+ * Compute remote->limits from the timing and flags of remote, eps,
+ * aeps and the resolution of the current driver.
+ */
+void ir_remote_calc_limits(struct ir_remote* remote);
+
+/**
+ * Recompute remote->limits if the values they were computed from
+ * have changed since, e. g. by irrecord or a new driver. The split
+ * masks are checked by get_code(), as not all drivers decode using
+ * receive_decode().
+ */
+void ir_remote_check_limits(struct ir_remote* remote);
+
 #ifdef __cplusplus
 }
 #endif
@@ -87,6 +87,13 @@ struct ir_ncode {
 
 	/** Next code in recorded buttons list. */
 	struct ir_ncode*	next_ncode;
+
+	/** (private) Config file offset of lazy loaded signals or 0,
+	 *  see load_raw_signals(). */
+	long			raw_offset;
+
+	/** (private) Atom of name, see atom.h, or 0 if not interned. */
+	uint32_t		atom;
 };
 
 /*
@@ -145,18 +152,91 @@ struct decode_ctx_t {
 	int	repeat_flag;            /**< True if code is a repeated one. */
 	lirc_t	max_remaining_gap;      /**< Estimated max time of trailing gap.*/
 	lirc_t	min_remaining_gap;      /**< Estimated min time of trailing gap.*/
+	struct timeval time;            /**< When the signal was read. */
+};
+
+
+struct ir_code_index;
+struct ir_scancode_index;
+struct config_arena;
+struct raw_source;
+
+/** How the data bits of a remote are decoded, see struct ir_limits. */
+enum bit_decoder {
+	BITS_PULSE_FIRST = 0,   /**< Pulse + space, e. g. SPACE_ENC. */
+	BITS_SPACE_FIRST,
+	BITS_BIPHASE,           /**< RC5, RC6. */
+	BITS_RCMM,
+	BITS_GRUNDIG,
+	BITS_SERIAL,
+	BITS_BO,
+	BITS_XMP
+};
+
+/** A mask of all code bits split up for the pre_data, code and post_data. */
+struct ir_split_mask {
+	ir_code	all;    /**< The mask split. */
+	ir_code	pre;
+	ir_code	code;
+	ir_code	post;
+};
+
+/** A duration and the range expect() accepts for it. */
+struct ir_limit {
+	lirc_t	value;
+	lirc_t	min;
+	lirc_t	max;
 };
 
+/**
+ * Decoding setup derived from the timing and flags of a remote: the
+ * expect() ranges of the durations checked for each decoded bit or
+ * signal and the data bits decoder, see ir_remote_calc_limits().
+ */
+struct ir_limits {
+	unsigned int	resolution;     /**< The driver's, when computed. */
+	int		eps;
+	unsigned int	aeps;
+	uint32_t	flags;
+	ir_code		rc6_mask;
+	enum bit_decoder bit_decoder;
+	int		plain_bits;     /**< Bits are pulse + space pairs. */
+	struct ir_limit	phead, ptrail, pfoot, sfoot;
+	struct ir_limit	pone, sone, pzero, szero;
+	struct ir_limit	sone2, pzero2;  /**< Doubled, RC6 trailer bit. */
+	struct ir_limit	prepeat, srepeat;
+	struct ir_limit	pre_p, post_p;
+	int		pre_data_bits;  /**< Word sizes of the split masks. */
+	int		bits;
+	int		post_data_bits;
+	struct ir_split_mask toggle;    /**< toggle_mask */
+	struct ir_split_mask ignore;    /**< toggle_bit_mask | ignore_mask */
+};
+
+/** Decoding counters of a remote, see metrics.h. */
+struct ir_remote_stats {
+	uint64_t	attempts;       /**< Signals tried on this remote. */
+	uint64_t	decoded;        /**< Codes decoded. */
+};
 
 /**
  * One remote as represented in the configuration file.
+ *
+ * The members are ordered by use: the timing and the decoder state read
+ * for each signal tried come first, so decode_all() walking the remotes
+ * touches a few adjacent cache lines of each, while names, transmit and
+ * configuration data follow. The timing block, from rc6_mask to
+ * stop_bits, is compared as a whole by the receive code: keep it free of
+ * padding and of members not describing the signal.
  */
 struct ir_remote {
-	const char*		name;   /**< name of remote control */
-	const char*		driver; /**< Name of driver for LIRCCODE cases. */
-	struct ir_ncode*	codes;
-	int			bits;   /**< bits (length of code) */
+	/* timing */
+
+	ir_code			rc6_mask;       /**< RC-6 doubles signal length of some bits */
+	ir_code			toggle_mask;    /**< Sharp (?) error detection scheme */
+	ir_code			toggle_bit_mask;        /**< previously only one bit called toggle_bit */
 	int			flags;  /**< flags */
+	int			bits;   /**< bits (length of code) */
 	int			eps;    /**< eps (_relative_ tolerance) */
 	unsigned int            aeps;   /**< detecting _very short_ pulses is
 					 * difficult with relative tolerance
@@ -164,9 +244,6 @@ struct ir_remote {
 					 * this is an _absolute_ tolerance
 					 * to solve this problem
 					 * usually you can say 0 here. */
-	char*		dyncodes_name;  /**< name for unknown buttons */
-	int		dyncode;        /**< last received code */
-	struct ir_ncode dyncodes[2];    /**< helper structs for unknown buttons */
 
 	/* pulse and space lengths of: */
 
@@ -181,21 +258,22 @@ struct ir_remote {
 	lirc_t		prepeat, srepeat;       /**< indicate repeating */
 
 	int		pre_data_bits;          /**< length of pre_data */
-	ir_code		pre_data;               /**< data which the remote sends before actual keycode */
 	int		post_data_bits;         /**< length of post_data */
-	ir_code		post_data;              /**< data which the remote sends after actual keycode */
 	lirc_t		pre_p, pre_s;           /**< signal between pre_data and keycode */
 	lirc_t		post_p, post_s;         /**< signal between keycode and post_code */
 
 	uint32_t	gap;                    /**< time between signals in usecs */
 	uint32_t	gap2;                   /**< time between signals in usecs */
 	uint32_t	repeat_gap;             /**< time between two repeat codes if different from gap */
-	int		toggle_bit;             /**< obsolete */
-	ir_code		toggle_bit_mask;        /**< previously only one bit called toggle_bit */
-	int		suppress_repeat;        /**< suppress unwanted repeats */
-	/** code is repeated at least x times
-	 * code sent once -> min_repeat=0 */
-	int		min_repeat;
+
+	/* serial protocols */
+	unsigned int		baud;           /**< can be overridden by [p|s]zero, [p|s]one */
+	unsigned int		bits_in_byte;   /**< default: 8 */
+	unsigned int		parity;         /**< currently unsupported */
+	unsigned int		stop_bits;      /**< mapping: 1->2 1.5->3 2->4 */
+
+	/* end of timing */
+
 	/**
 	 * meaningful only if remote sends
 	 *				   a repeat code: in this case
@@ -204,32 +282,46 @@ struct ir_remote {
 	 *				   before the repeat code is being
 	 *				   sent */
 	unsigned int		min_code_repeat;
-	unsigned int		freq;           /**< modulation frequency */
-	unsigned int		duty_cycle;     /**< 0<duty cycle<=100 default: 50 */
-	ir_code			toggle_mask;    /**< Sharp (?) error detection scheme */
-	ir_code			rc6_mask;       /**< RC-6 doubles signal length of some bits */
-
-	/* serial protocols */
-	unsigned int		baud;           /**< can be overridden by [p|s]zero, [p|s]one */
-	unsigned int		bits_in_byte;   /**< default: 8 */
-	unsigned int		parity;         /**< currently unsupported */
-	unsigned int		stop_bits;      /**< mapping: 1->2 1.5->3 2->4 */
-
+	int			reps;
+	ir_code			pre_data;               /**< data which the remote sends before actual keycode */
+	ir_code			post_data;              /**< data which the remote sends after actual keycode */
 	/** mask defines which bits can be
 	 * ignored when matching a code */
 	ir_code			ignore_mask;
 	ir_code			repeat_mask; /**< mask defines which bits are inverted for repeats */
-	/* end of user editable values */
+
+	/* decoder state */
 
 	ir_code			toggle_bit_mask_state;
 	int			toggle_mask_state;
 	int			repeat_countdown;
 	struct ir_ncode*	last_code;                      /**< code received or sent last */
 	struct ir_ncode*	toggle_code;                    /**< toggle code received or sent last */
-	int			reps;
 	struct timeval		last_send;                      /**< time last_code was received or sent */
 	lirc_t			min_remaining_gap;              /**< remember gap for CONST_LENGTH remotes */
 	lirc_t			max_remaining_gap;              /**< gap range */
+	struct ir_ncode*	codes;
+	struct ir_code_index*	code_index;     /**< (private) codes hash index. */
+	struct ir_remote*	next;
+	struct ir_remote_stats	stats;          /**< (private) metrics. */
+	struct ir_limits	limits;         /**< (private) expect() ranges. */
+
+	/* end of decoding data, what follows is cold */
+
+	const char*		name;   /**< name of remote control */
+	const char*		driver; /**< Name of driver for LIRCCODE cases. */
+	char*		dyncodes_name;  /**< name for unknown buttons */
+	int		dyncode;        /**< last received code */
+	struct ir_ncode dyncodes[2];    /**< helper structs for unknown buttons */
+
+	int		toggle_bit;             /**< obsolete */
+	int		suppress_repeat;        /**< suppress unwanted repeats */
+	/** code is repeated at least x times
+	 * code sent once -> min_repeat=0 */
+	int		min_repeat;
+	unsigned int		freq;           /**< modulation frequency */
+	unsigned int		duty_cycle;     /**< 0<duty cycle<=100 default: 50 */
+	/* end of user editable values */
 
 	lirc_t			min_total_signal_length;        /**< how long is the shortest signal including gap */
 	lirc_t			max_total_signal_length;        /**< how long is the longest signal including gap */
@@ -239,7 +331,12 @@ struct ir_remote {
 	lirc_t			min_space_length, max_space_length;
 	int			release_detected;       /**< set by release generator */
 	int			manual_sort;            /**< If set in any remote, disables automatic sorting. */
-	struct ir_remote*	next;
+	struct config_arena*	arena;          /**< (private) storage, if any. */
+	struct raw_source*	raw_source;     /**< (private) lazy raw codes file. */
+	struct ir_remote_order*	order;  /**< (private) decode order, in head. */
+	struct ir_scancode_index* scancode_index;
+				/**< (private) LIRCCODE index, in head. */
+	uint32_t		atom;   /**< (private) of name, see atom.h. */
 };
 
 #ifdef __cplusplus
@@ -37,6 +37,7 @@ static lirc_t emulation_readdata(lirc_t timeout);
 static const struct driver hw_emulation = {
 	.name		= "emulation",
 	.device		= "/dev/null",
+	.fd		= -1,
 	.features	= LIRC_CAN_REC_MODE2,
 	.send_mode	= 0,
 	.rec_mode	= LIRC_MODE_MODE2,
@@ -85,6 +86,59 @@ static struct lengths* first_trail = NULL;
 static struct lengths* first_repeatp = NULL;
 static struct lengths* first_repeats = NULL;
 
+/** Bucket width of the length histograms, as in add_length(). */
+#define HIST_RESOLUTION 100
+
+/** Buckets in a histogram, longer lengths go straight to the list. */
+#define HIST_BUCKETS    512
+
+/** Lengths within one histogram bucket. */
+struct hist_bucket {
+	uint32_t	count;
+	uint32_t	sum;
+	lirc_t		min;
+	lirc_t		max;
+};
+
+/**
+ * Lengths seen in each received signal. These are counted in fixed
+ * buckets, and only clustered into the lists once, when enough signals
+ * are seen. Lengths beyond the last bucket are added to the list.
+ */
+struct length_hist {
+	struct lengths**	first;
+	struct hist_bucket	bucket[HIST_BUCKETS];
+};
+
+enum hist_id {
+	HIST_SPACE,
+	HIST_PULSE,
+	HIST_REPEAT_GAP,
+	HIST_SIGNAL_LENGTH,
+	HIST_HEADERP,
+	HIST_HEADERS,
+	HIST_1LEAD,
+	HIST_3LEAD,
+	HIST_TRAIL,
+	HIST_REPEATP,
+	HIST_REPEATS,
+	HIST_COUNT
+};
+
+static struct length_hist hists[HIST_COUNT] = {
+	[HIST_SPACE]		= { &first_space },
+	[HIST_PULSE]		= { &first_pulse },
+	[HIST_REPEAT_GAP]	= { &first_repeat_gap },
+	[HIST_SIGNAL_LENGTH]	= { &first_signal_length },
+	[HIST_HEADERP]		= { &first_headerp },
+	[HIST_HEADERS]		= { &first_headers },
+	[HIST_1LEAD]		= { &first_1lead },
+	[HIST_3LEAD]		= { &first_3lead },
+	[HIST_TRAIL]		= { &first_trail },
+	[HIST_REPEATP]		= { &first_repeatp },
+	[HIST_REPEATS]		= { &first_repeats },
+};
+
 static uint32_t lengths[MAX_SIGNALS];
 static uint32_t first_length, first_lengths, second_lengths;
 static unsigned int count, count_spaces, count_signals;
@@ -505,10 +559,19 @@ static int mywaitfordata(uint32_t maxusec)
 	int ret;
 	struct pollfd pfd  = {
 		.fd = curr_driver->fd, .events = POLLIN, .revents = 0};
+#ifdef HAVE_PPOLL
+	struct timespec ts = {
+		.tv_sec = maxusec / 1000000,
+		.tv_nsec = (maxusec % 1000000) * 1000 };
 
 	do {
-		ret = curl_poll(&pfd, 1, maxusec / 1000);
+		ret = ppoll(&pfd, 1, &ts, NULL);
+	} while (ret == -1 && errno == EINTR);
+#else
+	do {
+		ret = curl_poll(&pfd, 1, (maxusec + 999) / 1000);
 	} while (ret == -1 && errno == EINTR);
+#endif
 
 	if (ret == -1 && errno != EINTR)
 		log_perror_err("mywaitfordata: curl_poll() failed");
@@ -663,6 +726,8 @@ void free_lengths(struct lengths** firstp)
 
 void free_all_lengths(void)
 {
+	int i;
+
 	free_lengths(&first_space);
 	free_lengths(&first_pulse);
 	free_lengths(&first_sum);
@@ -676,6 +741,46 @@ void free_all_lengths(void)
 	free_lengths(&first_trail);
 	free_lengths(&first_repeatp);
 	free_lengths(&first_repeats);
+	for (i = 0; i < HIST_COUNT; i++)
+		memset(hists[i].bucket, 0, sizeof(hists[i].bucket));
+}
+
+
+/** True if a and b are the same length within eps/aeps. */
+static int same_length(lirc_t a, lirc_t b)
+{
+	lirc_t delta = a > b ? a - b : b - a;
+
+	return delta <= aeps || delta <= b * eps / 100;
+}
+
+
+/** True if a and b together are within eps/aeps of their average. */
+static int can_merge(const struct lengths* a, const struct lengths* b)
+{
+	uint32_t new_sum = a->sum + b->sum;
+	int new_count = a->count + b->count;
+
+	return (a->max <= new_sum / new_count + aeps
+		&& a->min + aeps >= new_sum / new_count
+		&& b->max <= new_sum / new_count + aeps
+		&& b->min + aeps >= new_sum / new_count)
+	       || (a->max <= new_sum / new_count * (100 + eps)
+		   && a->min >= new_sum / new_count * (100 - eps)
+		   && b->max <= new_sum / new_count * (100 + eps)
+		   && b->min >= new_sum / new_count * (100 - eps));
+}
+
+
+/** Add the lengths in b to a. */
+static void merge_length(struct lengths* a, const struct lengths* b)
+{
+	a->sum += b->sum;
+	a->count += b->count;
+	a->upper_bound = max(a->upper_bound, b->upper_bound);
+	a->lower_bound = min(a->lower_bound, b->lower_bound);
+	a->min = min(a->min, b->min);
+	a->max = max(a->max, b->max);
 }
 
 
@@ -684,36 +789,14 @@ static void merge_lengths(struct lengths* first)
 	struct lengths* l;
 	struct lengths* inner;
 	struct lengths* last;
-	uint32_t new_sum;
-	int new_count;
 
 	l = first;
 	while (l != NULL) {
 		last = l;
 		inner = l->next;
 		while (inner != NULL) {
-			new_sum = l->sum + inner->sum;
-			new_count = l->count + inner->count;
-
-			if ((l->max <= new_sum / new_count + aeps
-			     && l->min + aeps >= new_sum / new_count
-			     && inner->max <= new_sum / new_count + aeps
-			     && inner->min + aeps >= new_sum / new_count)
-			    || (l->max <= new_sum / new_count * (100 + eps)
-				&& l->min >= new_sum / new_count * (100 - eps)
-				&& inner->max <= new_sum / new_count *
-				(100 + eps)
-				&& inner->min >= new_sum / new_count *
-				(100 - eps))) {
-				l->sum = new_sum;
-				l->count = new_count;
-				l->upper_bound = max(l->upper_bound,
-						     inner->upper_bound);
-				l->lower_bound = min(l->lower_bound,
-						     inner->lower_bound);
-				l->min = min(l->min, inner->min);
-				l->max = max(l->max, inner->max);
-
+			if (can_merge(l, inner)) {
+				merge_length(l, inner);
 				last->next = inner->next;
 				free(inner);
 				inner = last;
@@ -731,6 +814,110 @@ static void merge_lengths(struct lengths* first)
 }
 
 
+/** Count length in the histogram id. */
+static void hist_add(enum hist_id id, lirc_t length)
+{
+	struct length_hist* hist = &hists[id];
+	struct hist_bucket* bucket;
+	unsigned int i = length / HIST_RESOLUTION;
+
+	if (i >= HIST_BUCKETS) {
+		add_length(hist->first, length);
+		return;
+	}
+	bucket = &hist->bucket[i];
+	if (bucket->count == 0 || length < bucket->min)
+		bucket->min = length;
+	if (bucket->count == 0 || length > bucket->max)
+		bucket->max = length;
+	bucket->count++;
+	bucket->sum += length;
+}
+
+
+/**
+ * Cluster the buckets of a histogram into a new list ending with
+ * overflow. The buckets are swept in order of length, each one joining
+ * the current cluster if the result is still within eps/aeps, else
+ * starting the next. A final merge_lengths() on the few clusters
+ * catches what the sweep can't, like lengths beyond the buckets.
+ */
+static struct lengths* hist_clusters(const struct length_hist* hist,
+				     struct lengths* overflow)
+{
+	struct lengths* first = NULL;
+	struct lengths** tail = &first;
+	struct lengths* cluster = NULL;
+	struct lengths b;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (hist->bucket[i].count == 0)
+			continue;
+		b.count = hist->bucket[i].count;
+		b.sum = hist->bucket[i].sum;
+		b.min = hist->bucket[i].min;
+		b.max = hist->bucket[i].max;
+		b.lower_bound = i * HIST_RESOLUTION;
+		b.upper_bound = b.lower_bound + HIST_RESOLUTION - 1;
+		b.next = NULL;
+		if (cluster != NULL && can_merge(cluster, &b)) {
+			merge_length(cluster, &b);
+			continue;
+		}
+		cluster = malloc(sizeof(struct lengths));
+		if (cluster == NULL) {
+			log_error("hist_cluster: out of memory");
+			break;
+		}
+		*cluster = b;
+		*tail = cluster;
+		tail = &cluster->next;
+	}
+	*tail = overflow;
+	merge_lengths(first);
+	return first;
+}
+
+
+/** Build the list of a histogram, when all signals are counted. */
+static void hist_cluster(struct length_hist* hist)
+{
+	*hist->first = hist_clusters(hist, *hist->first);
+	memset(hist->bucket, 0, sizeof(hist->bucket));
+}
+
+
+/** Return a copy of the list first, NULL if out of memory. */
+static struct lengths* copy_lengths(const struct lengths* first)
+{
+	struct lengths* copy = NULL;
+	struct lengths** tail = &copy;
+
+	for (; first != NULL; first = first->next) {
+		*tail = malloc(sizeof(struct lengths));
+		if (*tail == NULL) {
+			log_error("copy_lengths: out of memory");
+			break;
+		}
+		**tail = *first;
+		(*tail)->next = NULL;
+		tail = &(*tail)->next;
+	}
+	return copy;
+}
+
+
+/** Cluster all histograms, when all signals are counted. */
+static void cluster_all_lengths(void)
+{
+	int i;
+
+	for (i = 0; i < HIST_COUNT; i++)
+		hist_cluster(&hists[i]);
+}
+
+
 /**
  *  Scan the list first for the item with highest count value.
  *  Returns pointer to highest item. Also updates *sump
@@ -896,10 +1083,10 @@ int get_repeat_length(struct ir_remote* remote, int interactive)
 	struct lengths* max_plength;
 	struct lengths* max_slength;
 
-	if (!((count_3repeats > SAMPLES / 2 ?  1 : 0) ^
-	      (count_5repeats > SAMPLES / 2 ? 1 : 0))) {
-		if (count_3repeats > SAMPLES / 2
-		    || count_5repeats > SAMPLES / 2) {
+	if (!((count_3repeats > count_signals / 2 ?  1 : 0) ^
+	      (count_5repeats > count_signals / 2 ? 1 : 0))) {
+		if (count_3repeats > count_signals / 2
+		    || count_5repeats > count_signals / 2) {
 			log_warn("Repeat inconsistency.");
 			return 0;
 		}
@@ -1204,29 +1391,58 @@ int get_data_length(struct ir_remote* remote, int interactive)
 }
 
 
+/**
+ * Return true if scan->count lengths in a list of sum lengths is the
+ * gap: more than SAMPLES, or if incremental SAMPLES / 2 and TH_GAP
+ * percent of all.
+ */
+static int is_gap(const struct lengths* scan, unsigned int sum,
+		  int incremental)
+{
+	if (scan->count > SAMPLES)
+		return 1;
+	return incremental && scan->count > SAMPLES / 2
+	       && scan->count >= sum * TH_GAP / 100;
+}
+
+
+/** Return sum of all counts in the list first. */
+static unsigned int count_lengths(const struct lengths* first)
+{
+	unsigned int sum = 0;
+
+	for (; first != NULL; first = first->next)
+		sum += first->count;
+	return sum;
+}
+
+
 enum get_gap_status get_gap_length(struct gap_state*	state,
 				   struct ir_remote*	remote)
 {
+	unsigned int sum;
+
 	while (availabledata())
 		curr_driver->rec_func(NULL);
 	if (!mywaitfordata(10000000)) {
 		free_lengths(&(state->gaps));
 		return STS_GAP_TIMEOUT;
 	}
-	gettimeofday(&(state->start), NULL);
+	get_monotonic_time(&(state->start));
 	while (availabledata())
 		curr_driver->rec_func(NULL);
-	gettimeofday(&(state->end), NULL);
+	get_monotonic_time(&(state->end));
 	if (state->flag) {
 		state->gap = time_elapsed(&(state->last), &(state->start));
 		add_length(&(state->gaps), state->gap);
 		merge_lengths(state->gaps);
 		state->maxcount = 0;
 		state->scan = state->gaps;
+		sum = count_lengths(state->gaps);
 		while (state->scan) {
 			state->maxcount = max(state->maxcount,
 					      state->scan->count);
-			if (state->scan->count > SAMPLES) {
+			if (is_gap(state->scan, sum, state->incremental)) {
 				remote->gap = calc_signal(state->scan);
 				free_lengths(&(state->gaps));
 				return STS_GAP_FOUND;
@@ -1266,35 +1482,119 @@ int needs_toggle_mask(struct ir_remote* remote)
 }
 
 
+/** Find remote's scheme and lengths from the lists, returns ok/fail. */
+static int analyse_lengths(struct ir_remote* remote, int interactive)
+{
+	get_scheme(remote, interactive);
+	return get_header_length(remote, interactive)
+	       && get_trail_length(remote, interactive)
+	       && get_lead_length(remote, interactive)
+	       && get_repeat_length(remote, interactive)
+	       && get_data_length(remote, interactive);
+}
+
+
+/** True if the analyses a and b found the same scheme and lengths. */
+static int same_analysis(const struct ir_remote* a,
+			 const struct ir_remote* b)
+{
+	return a->flags == b->flags
+	       && a->bits == b->bits
+	       && same_length(a->phead, b->phead)
+	       && same_length(a->shead, b->shead)
+	       && same_length(a->pone, b->pone)
+	       && same_length(a->sone, b->sone)
+	       && same_length(a->pzero, b->pzero)
+	       && same_length(a->szero, b->szero)
+	       && same_length(a->plead, b->plead)
+	       && same_length(a->ptrail, b->ptrail)
+	       && same_length(a->prepeat, b->prepeat)
+	       && same_length(a->srepeat, b->srepeat)
+	       && same_length(a->repeat_gap, b->repeat_gap);
+}
+
+
+/**
+ * Analyse the signals counted so far into *trial, leaving the
+ * histograms as they are. Not being the final word, the analysis logs
+ * errors only unless debugging. Returns ok/fail.
+ */
+static int analyse_trial(struct ir_remote* trial)
+{
+	struct lengths* overflow[HIST_COUNT];
+	loglevel_t level = loglevel;
+	int ok;
+	int i;
+
+	if (level < LIRC_DEBUG)
+		lirc_log_setlevel(min(level, LIRC_ERROR));
+	for (i = 0; i < HIST_COUNT; i++) {
+		overflow[i] = *hists[i].first;
+		*hists[i].first = hist_clusters(&hists[i],
+						copy_lengths(overflow[i]));
+	}
+	ok = analyse_lengths(trial, 0);
+	for (i = 0; i < HIST_COUNT; i++) {
+		free_lengths(hists[i].first);
+		*hists[i].first = overflow[i];
+	}
+	lirc_log_setlevel(level);
+	return ok;
+}
+
+
+/**
+ * In incremental mode, analyse the signals every TRIAL_STEP signals.
+ * Return true when TRIAL_AGREE trials in a row found the same result
+ * i. e., there is no need to wait for more signals.
+ */
+static int lengths_stable(struct lengths_state* state,
+			  const struct ir_remote* remote)
+{
+	struct ir_remote trial;
+
+	if (!state->incremental || count_signals < TRIAL_MIN
+	    || count_signals == state->trial_signals
+	    || (count_signals - TRIAL_MIN) % TRIAL_STEP != 0)
+		return 0;
+	state->trial_signals = count_signals;
+	trial = *remote;
+	if (!analyse_trial(&trial)) {
+		log_debug("Trial analysis failed at %u signals",
+			  count_signals);
+		state->trials_agreed = 0;
+		return 0;
+	}
+	if (state->trials_agreed > 0 && same_analysis(&trial, &state->trial))
+		state->trials_agreed++;
+	else
+		state->trials_agreed = 1;
+	state->trial = trial;
+	log_debug("Trial analysis at %u signals, %d agreeing",
+		  count_signals, state->trials_agreed);
+	return state->trials_agreed >= TRIAL_AGREE;
+}
+
+
 /* Compute lengths from four recorded signals. */
 static void compute_lengths_4_signals(void)
 {
-	add_length(&first_repeatp, signals[0]);
-	merge_lengths(first_repeatp);
-	add_length(&first_repeats, signals[1]);
-	merge_lengths(first_repeats);
-	add_length(&first_trail, signals[2]);
-	merge_lengths(first_trail);
-	add_length(&first_repeat_gap, signals[3]);
-	merge_lengths(first_repeat_gap);
+	hist_add(HIST_REPEATP, signals[0]);
+	hist_add(HIST_REPEATS, signals[1]);
+	hist_add(HIST_TRAIL, signals[2]);
+	hist_add(HIST_REPEAT_GAP, signals[3]);
 }
 
 
 /* Compute lengths from six recorded signals. */
 static void compute_lengths_6_signals(void)
 {
-	add_length(&first_headerp, signals[0]);
-	merge_lengths(first_headerp);
-	add_length(&first_headers, signals[1]);
-	merge_lengths(first_headers);
-	add_length(&first_repeatp, signals[2]);
-	merge_lengths(first_repeatp);
-	add_length(&first_repeats, signals[3]);
-	merge_lengths(first_repeats);
-	add_length(&first_trail, signals[4]);
-	merge_lengths(first_trail);
-	add_length(&first_repeat_gap, signals[5]);
-	merge_lengths(first_repeat_gap);
+	hist_add(HIST_HEADERP, signals[0]);
+	hist_add(HIST_HEADERS, signals[1]);
+	hist_add(HIST_REPEATP, signals[2]);
+	hist_add(HIST_REPEATS, signals[3]);
+	hist_add(HIST_TRAIL, signals[4]);
+	hist_add(HIST_REPEAT_GAP, signals[5]);
 }
 
 /* Compute lengths from more than six recorded signals. */
@@ -1302,31 +1602,22 @@ static void compute_lengths_many_signals(struct lengths_state* state)
 {
 	int i;
 
-	add_length(&first_1lead, signals[0]);
-	merge_lengths(first_1lead);
+	hist_add(HIST_1LEAD, signals[0]);
 	for (i = 2; i < state->count - 2; i++) {
-		if (i % 2) {
-			add_length(&first_space, signals[i]);
-			merge_lengths(first_space);
-		} else {
-			add_length(&first_pulse, signals[i]);
-			merge_lengths(first_pulse);
-		}
+		if (i % 2)
+			hist_add(HIST_SPACE, signals[i]);
+		else
+			hist_add(HIST_PULSE, signals[i]);
 	}
-	add_length(&first_trail, signals[state->count - 2]);
-	merge_lengths(first_trail);
+	hist_add(HIST_TRAIL, signals[state->count - 2]);
 	lengths[state->count - 2]++;
-	add_length(&first_signal_length, state->sum - state->data);
-	merge_lengths(first_signal_length);
+	hist_add(HIST_SIGNAL_LENGTH, state->sum - state->data);
 	if (state->first_signal == 1
 	    || (first_length > 2
 		&& first_length - 2 != state->count - 2)) {
-		add_length(&first_3lead, signals[2]);
-		merge_lengths(first_3lead);
-		add_length(&first_headerp, signals[0]);
-		merge_lengths(first_headerp);
-		add_length(&first_headers, signals[1]);
-		merge_lengths(first_headers);
+		hist_add(HIST_3LEAD, signals[2]);
+		hist_add(HIST_HEADERP, signals[0]);
+		hist_add(HIST_HEADERS, signals[1]);
 	}
 	if (state->first_signal == 1) {
 		first_lengths++;
@@ -1347,10 +1638,11 @@ static struct lengths* scan_gap1(struct lengths_state*	state,
 				 enum lengths_status*	again)
 {
 	struct lengths* scan;
+	unsigned int sum = count_lengths(first_sum);
 
 	for (scan = first_sum; scan; scan = scan->next) {
 		*maxcount = max(*maxcount, scan->count);
-		if (scan->count > SAMPLES) {
+		if (is_gap(scan, sum, state->incremental)) {
 			remote->gap = calc_signal(scan);
 			remote->flags |= CONST_LENGTH;
 			state->mode = MODE_HAVE_GAP;
@@ -1369,10 +1661,11 @@ static struct lengths* scan_gap2(struct lengths_state*	state,
 				 enum lengths_status*	again)
 {
 	struct lengths* scan;
+	unsigned int sum = count_lengths(first_gap);
 
 	for (scan = first_gap; scan; scan = scan->next) {
 		*maxcount = max(*maxcount, scan->count);
-		if (scan->count > SAMPLES) {
+		if (is_gap(scan, sum, state->incremental)) {
 			remote->gap = calc_signal(scan);
 			state->mode = MODE_HAVE_GAP;
 			log_debug("Found gap: %u", remote->gap);
@@ -1515,13 +1808,10 @@ enum lengths_status get_lengths(struct lengths_state* state,
 				return STS_LEN_NO_GAP_FOUND;
 			}
 
-			if (count_signals >= SAMPLES) {
-				get_scheme(remote, interactive);
-				if (!get_header_length(remote, interactive)
-				    || !get_trail_length(remote, interactive)
-				    || !get_lead_length(remote, interactive)
-				    || !get_repeat_length(remote, interactive)
-				    || !get_data_length(remote, interactive))
+			if (count_signals >= SAMPLES
+			    || lengths_stable(state, remote)) {
+				cluster_all_lengths();
+				if (!analyse_lengths(remote, interactive))
 					state->retval = 0;
 				return state->retval ==
 				       0 ? STS_LEN_FAIL : STS_LEN_OK;
@@ -1664,7 +1954,8 @@ int analyse_get_lengths(struct lengths_state* lengths_state)
 
 
 /** Implement the analyse task, return 1 for ok, 0 for errors. */
-int analyse_remote(struct ir_remote* raw_data, const struct opts* opts)
+int analyse_remote(struct ir_remote* raw_data, const struct opts* opts,
+		   FILE* fout)
 {
 	struct ir_ncode* codes;
 	struct decode_ctx_t decode_ctx;
@@ -1765,7 +2056,7 @@ int analyse_remote(struct ir_remote* raw_data, const struct opts* opts)
 	}
 	new_codes[new_index].name = NULL;
 	remote.codes = new_codes;
-	fprint_remotes(stdout, &remote, opts->commandline);
+	fprint_remotes(fout, &remote, opts->commandline);
 	remote.codes = NULL;
 	free(new_codes);
 	return 1;
@@ -1795,12 +2086,162 @@ int do_analyse(const struct opts* opts, struct main_state* state)
 				  r->name);
 			continue;
 		}
-		analyse_remote(r, opts);
+		analyse_remote(r, opts, stdout);
+	}
+	return 1;
+}
+
+
+/**
+ * Add the signal in data to codes, unless it repeats an earlier one.
+ * Returns 0 when out of memory.
+ */
+static int add_capture_code(struct ir_ncode** codes, int* size, int* n,
+			    const lirc_t* data, int length)
+{
+	struct ir_ncode* code;
+	int i;
+	int j;
+
+	for (i = 0; i < *n; i++) {
+		if ((*codes)[i].length != length)
+			continue;
+		for (j = 0; j < length; j++)
+			if (!same_length(data[j], (*codes)[i].signals[j]))
+				break;
+		if (j == length)
+			return 1;
+	}
+	if (*n + 1 >= *size) {
+		code = realloc(*codes, *size * 2 * sizeof(**codes));
+		if (code == NULL)
+			return 0;
+		memset(code + *size, 0, *size * sizeof(**codes));
+		*codes = code;
+		*size *= 2;
+	}
+	code = &(*codes)[*n];
+	code->name = malloc(24);
+	code->signals = malloc(length * sizeof(lirc_t));
+	if (code->name == NULL || code->signals == NULL) {
+		free(code->name);
+		free(code->signals);
+		code->name = NULL;
+		code->signals = NULL;
+		return 0;
 	}
+	snprintf(code->name, 24, "frame_%d", *n + 1);
+	memcpy(code->signals, data, length * sizeof(lirc_t));
+	code->length = length;
+	*n += 1;
 	return 1;
 }
 
 
+struct ir_remote* read_mode2_capture(FILE* f, const char* name)
+{
+	char line[128];
+	char what[16];
+	lirc_t data[MAX_SIGNALS];
+	struct ir_remote* raw;
+	struct ir_ncode* codes;
+	int size = 64;
+	int n = 0;
+	int length = 0;
+	int too_long = 0;
+	int pulse;
+	int value;
+	lirc_t gap = 0;
+
+	raw = calloc(1, sizeof(struct ir_remote));
+	codes = calloc(size, sizeof(struct ir_ncode));
+	if (raw == NULL || codes == NULL)
+		goto nomem;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%15s %d", what, &value) != 2 || value < 0)
+			continue;
+		if (strcmp(what, "pulse") == 0)
+			pulse = 1;
+		else if (strcmp(what, "space") == 0 ||
+			 strcmp(what, "timeout") == 0)
+			pulse = 0;
+		else
+			continue;
+		if (length == 0 && !pulse)
+			continue;
+		if (!pulse && (value >= MIN_GAP || what[0] == 't')) {
+			/* End of signal, which must end with a pulse. */
+			if (what[0] == 's' && (gap == 0 || value < gap))
+				gap = value;
+			if (length % 2 == 0)
+				length--;
+			if (length >= 3 && !too_long
+			    && !add_capture_code(&codes, &size, &n,
+						 data, length))
+				goto nomem;
+			length = 0;
+			too_long = 0;
+			continue;
+		}
+		if (length % 2 == pulse) {
+			/* Same kind as the last one: join them. */
+			data[length - 1] += value;
+		} else if (length < MAX_SIGNALS) {
+			data[length++] = value;
+		} else {
+			too_long = 1;
+		}
+	}
+	if (length >= 3 && length % 2 == 1 && !too_long
+	    && !add_capture_code(&codes, &size, &n, data, length))
+		goto nomem;
+	raw->name = strdup(name);
+	if (raw->name == NULL)
+		goto nomem;
+	raw->flags = RAW_CODES;
+	raw->eps = eps;
+	raw->aeps = aeps;
+	raw->gap = gap != 0 ? gap : 5 * MIN_GAP;
+	raw->codes = codes;
+	if (n == 0) {
+		log_error("%s: no signals found", name);
+		free_config(raw);
+		return NULL;
+	}
+	return raw;
+
+nomem:
+	log_error("Out of memory");
+	if (raw != NULL)
+		raw->codes = codes;
+	free_config(raw);
+	return NULL;
+}
+
+
+int analyse_capture(const char* path, const char* name,
+		    const struct opts* opts, FILE* fout)
+{
+	FILE* f;
+	struct ir_remote* r;
+	int ok;
+
+	memcpy((void*)curr_driver, &hw_emulation, sizeof(struct driver));
+	f = fopen(path, "r");
+	if (f == NULL) {
+		log_perror_err("Cannot open %s", path);
+		return 0;
+	}
+	r = read_mode2_capture(f, name);
+	fclose(f);
+	if (r == NULL)
+		return 0;
+	ok = analyse_remote(r, opts, fout);
+	free_config(r);
+	return ok;
+}
+
+
 ssize_t raw_read(void* buffer, size_t size, unsigned int timeout_us)
 {
 	if (!mywaitfordata(timeout_us))
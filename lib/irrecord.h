@@ -74,6 +74,12 @@ extern "C" {
 
 #define SAMPLES        80
 
+/* incremental analysis, see lengths_state.incremental */
+#define TRIAL_MIN      24       /* Signals before the first trial. */
+#define TRIAL_STEP      8       /* Signals between trials. */
+#define TRIAL_AGREE     2       /* Agreeing trials to stop. */
+#define TH_GAP         75       /* Gap share to accept SAMPLES / 2 gaps. */
+
 // forwards
 
 struct ir_remote;
@@ -153,6 +159,10 @@ struct lengths {
 struct opts {
 	int		dynamic_codes;
 	int		analyse;
+	int		batch;
+	int		jobs;           /**< --batch processes, 0: cpus. */
+	char* const*	captures;       /**< --batch input files. */
+	int		capture_count;
 	int		force;
 	int		disable_namespace;
 	const char*	device;
@@ -181,8 +191,10 @@ struct main_state {
 };
 
 
-/** Private state in get_gap_length(). */
+/** Private state in get_gap_length(), besides commented. */
 struct gap_state {
+			/** Accept a dominating gap early, set by caller. */
+	int		incremental;
 	struct lengths* scan;
 	struct lengths* gaps;
 	struct timeval	start;
@@ -213,6 +225,19 @@ struct lengths_state {
 	lirc_t			header;
 	int			first_signal;
 	enum analyse_mode	mode;
+				/**
+				 * Set by caller: analyse the signals seen
+				 * so far every TRIAL_STEP signals, and stop
+				 * when TRIAL_AGREE trials in a row agree
+				 * instead of waiting for SAMPLES signals.
+				 * Also accept a gap found in TH_GAP percent
+				 * of SAMPLES / 2 signals.
+				 */
+	int			incremental;
+				/** Agreeing trials so far. */
+	int			trials_agreed;
+	unsigned int		trial_signals;
+	struct ir_remote	trial;
 };
 
 
@@ -303,6 +328,27 @@ get_toggle_bit_mask(struct toggle_state* state, struct ir_remote* remote);
 /** The --analyse wrapper, returns boolean ok/fail. */
 int do_analyse(const struct opts* opts, struct main_state* state);
 
+/**
+ * Read a mode2 capture as printed by mode2(1) or logged using
+ * rec_buffer_set_logfile() into a raw remote called name. Each signal
+ * ended by a space longer than MIN_GAP or a timeout becomes a code;
+ * signals repeating an earlier one are dropped. The gap is the
+ * shortest space found between signals.
+ *
+ * @return New remote to be released with free_config(), NULL if no
+ *     signals are found or on errors.
+ */
+struct ir_remote* read_mode2_capture(FILE* f, const char* name);
+
+/**
+ * Analyse the mode2 capture in path like --analyse does for a raw
+ * config, printing the resulting config for remote name to fout.
+ * Replaces the current driver with the emulation driver.
+ * Returns boolean ok/fail.
+ */
+int analyse_capture(const char* path, const char* name,
+		    const struct opts* opts, FILE* fout);
+
 /** Try to record one button, returning button_status. */
 enum button_status record_buttons(struct button_state* btn_state,
 				  enum button_status last_status,
@@ -21,29 +21,49 @@
 
 bool LineBuffer::has_lines()
 {
-	return buff.find('\n') != std::string::npos;
+	return buff.find('\n', head) != std::string::npos;
 }
 
 
 void LineBuffer::append(const char* input, size_t size)
 {
+	/* Compact once per append, not for each line read. */
+	if (head > 0) {
+		buff.erase(0, head);
+		head = 0;
+	}
 	buff.append(input, size);
 }
 
 
 const char* LineBuffer::c_str()
 {
-	return buff.c_str();
+	return buff.c_str() + head;
 }
 
 
-std::string LineBuffer::get_next_line()
+char* LineBuffer::next_line(size_t* size)
 {
-	size_t nl = buff.find('\n');
+	size_t nl = buff.find('\n', head);
+	char* line;
+
 	if (nl == std::string::npos)
+		return NULL;
+	line = &buff[head];
+	*size = nl + 1 - head;
+	head = nl + 1;
+	return line;
+}
+
+
+std::string LineBuffer::get_next_line()
+{
+	size_t size;
+	const char* next = next_line(&size);
+
+	if (next == NULL)
 		return "";
-	std::string line(buff.substr(0, nl + 1));
-	buff.erase(0, nl + 1);
+	std::string line(next, size);
 
 	/* remove DOS line endings */
 	size_t pos = line.rfind("\r");
@@ -53,7 +73,14 @@ std::string LineBuffer::get_next_line()
 }
 
 
+size_t LineBuffer::capacity()
+{
+	return buff.capacity();
+}
+
+
 LineBuffer::LineBuffer()
 {
 	buff = "";
+	head = 0;
 }
@@ -23,6 +23,7 @@
 class LineBuffer {
 	private:
 		std::string buff;
+		size_t head;    /**< Start of unread data in buff. */
 
 	public:
 		/** Insert data in buffer. */
@@ -37,6 +38,17 @@ class LineBuffer {
 		/** Return and remove first line in buffer, possibly "". */
 		std::string get_next_line();
 
+		/**
+		 * Remove first line in buffer and return it in place,
+		 * including the newline but not NUL-terminated, or NULL if
+		 * there is none. The caller may modify the line, which is
+		 * valid until next append().
+		 */
+		char* next_line(size_t* size);
+
+		/** Return the allocated size of the buffer. */
+		size_t capacity();
+
 		LineBuffer();
 };
 
@@ -84,9 +84,9 @@ void drop_root_cli(int (*set_some_uid)(uid_t))
 
 	new_user = drop_sudo_root(set_some_uid);
 	if (strcmp("root", new_user) == 0)
-		puts("Warning: Running as root.");
+		fputs("Warning: Running as root.\n", stderr);
 	else if (strlen(new_user) == 0)
-		puts("Warning: Cannot change uid.");
+		fputs("Warning: Cannot change uid.\n", stderr);
 	else
-		printf("Running as regular user %s\n", new_user);
+		fprintf(stderr, "Running as regular user %s\n", new_user);
 }
@@ -20,26 +20,41 @@
 # include <config.h>
 #endif
 
+#include <arpa/inet.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <limits.h>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #include "lirc_client.h"
+#include "code_line.h"
+#include "event_record.h"
+#include "event_ring.h"
 
 #ifndef MAXPATHLEN
 #define MAXPATHLEN 4096
@@ -62,6 +77,8 @@ static const struct timeval CMD_TIMEOUT = { .tv_sec = 1, .tv_usec = 0 };
 #define LIRC_PACKET_SIZE 255
 /* three seconds */
 #define LIRC_TIMEOUT 3
+/* max number of commands lirc_command_run_batch() sends at once */
+#define LIRC_COMMAND_WINDOW 32
 
 /* internal data structures */
 struct filestack_t {
@@ -72,6 +89,50 @@ struct filestack_t {
 };
 
 
+/** Entries with the same remote and button, in lircrc order. */
+struct lirc_index_bucket {
+	char*				remote;   /**< Case folded. */
+	char*				button;   /**< Case folded. */
+	unsigned int			hash;
+	unsigned int*			ordinals; /**< Entry positions. */
+	unsigned int			count;
+	unsigned int			size;
+	struct lirc_index_bucket*	next;
+};
+
+/** A button sequence without LIRC_ALL, compiled for KMP matching. */
+struct lirc_sequence {
+	struct lirc_code**		codes;  /**< The sequence, in order. */
+	unsigned int			length;
+	/** fail[q]: Longest proper suffix of codes[0..q-1] also a prefix. */
+	unsigned int*			fail;
+};
+
+/**
+ * Index of the lircrc entries used by lirc_code2char(). Entries are
+ * found by hashing their first remote and button. Entries using LIRC_ALL
+ * or toggle_reset have state updated by all codes and are always
+ * checked, and so are compiled sequences with a partial match.
+ */
+struct lirc_config_index {
+	struct lirc_config_entry**	entries;  /**< All entries + NULL. */
+	unsigned int			count;
+	struct lirc_index_bucket**	buckets;
+	unsigned int			bucket_mask;
+	unsigned int*			fallback; /**< Always checked. */
+	unsigned int			fallback_count;
+	/** Compiled sequences by entry position, NULL if none. */
+	struct lirc_sequence**		sequences;
+	/** Sorted positions of sequences with a partial match. */
+	unsigned int*			active;
+	unsigned int			active_count;
+	/** Copy of active used while dispatching. */
+	unsigned int*			active_copy;
+	/** Position of lirc_config.next, count if NULL. */
+	unsigned int			resume;
+};
+
+
 /** protocol state. */
 enum packet_state {
 	P_BEGIN,
@@ -95,6 +156,27 @@ static int lirc_lircd = -1;
 static int lirc_verbose = 0;
 static char* lirc_prog = NULL;
 static char* lirc_buffer = NULL;
+static size_t lirc_buffer_size = PACKET_SIZE;
+static size_t lirc_buffer_len = 0;
+
+/** Set by lirc_set_binary(): lirc_buffer holds event_record.h records. */
+static int lirc_binary = 0;
+/** Names announced in NAME records, by id. */
+static char** lirc_names = NULL;
+static size_t lirc_names_count = 0;
+
+/** Set by lirc_use_ring(): the mapped lircd --event-ring, else NULL. */
+static const struct lirc_ring_header* lirc_ring = NULL;
+static size_t lirc_ring_len;
+static uint64_t lirc_ring_index;        /**< Of the next event to read. */
+
+/** Set by lirc_init_multicast(): lirc_lircd is a multicast UDP socket. */
+static int lirc_multicast = 0;
+static uint64_t lirc_multicast_seq;     /**< Last one received, 0: none. */
+static unsigned long lirc_multicast_gaps;
+
+/** Free space lirc_nextevents() reads into, several codes worth. */
+#define LIRC_BATCH_SIZE (16 * PACKET_SIZE)
 
 char* prog;
 
@@ -150,6 +232,7 @@ static int fill_string(int fd, lirc_cmd_ctx* cmd)
 		return errno;
 	}
 	cmd->head += n;
+	cmd->buffer[cmd->head] = '\0';
 	return 0;
 }
 
@@ -187,32 +270,19 @@ static int read_string(lirc_cmd_ctx* cmd, int fd, const char** string)
 }
 
 
-int lirc_command_run(lirc_cmd_ctx* ctx, int fd)
+/**
+ * Read and parse the reply to the packet sent for ctx. Each data line
+ * replaces the previous one in ctx->reply, unless all_lines is set.
+ */
+static int lirc_command_reply(lirc_cmd_ctx* ctx, int fd, int all_lines)
 {
-	int done, todo;
 	const char* string = NULL;
-	const char* data;
 	char* endptr;
 	enum packet_state state;
 	int status, n, r;
+	size_t len;
 	uint32_t data_n = 0;
 
-	todo = strlen(ctx->packet);
-	data = ctx->packet;
-	logprintf(LIRC_DEBUG, "lirc_command_run: Sending: %s", data);
-	while (todo > 0) {
-		done = write(fd, (void*)data, todo);
-		if (done < 0) {
-			logprintf(LIRC_WARNING,
-				  "%s: could not send packet\n", prog);
-			perror(prog);
-			return done;
-		}
-		data += done;
-		todo -= done;
-	}
-
-	/* get response */
 	status = 0;
 	n = 0;
 	state = P_BEGIN;
@@ -293,10 +363,16 @@ int lirc_command_run(lirc_cmd_ctx* ctx, int fd)
 				chk_write(STDOUT_FILENO, string, strlen(string),
 					  "reply (1)");
 				chk_write(STDOUT_FILENO, "\n", 1, "reply (2)");
-			} else {
+			} else if (n == 0 || !all_lines) {
 				strncpy(ctx->reply,
 					string,
 					PACKET_SIZE - strlen(ctx->reply));
+			} else {
+				/* Lines after the first are newline separated. */
+				len = strlen(ctx->reply);
+				snprintf(ctx->reply + len,
+					 sizeof(ctx->reply) - len,
+					 "\n%s", string);
 			}
 			n++;
 			if (n == data_n)
@@ -319,6 +395,136 @@ bad_packet:
 }
 
 
+/** Send the packet of ctx, then read the reply. */
+static int lirc_command_send(lirc_cmd_ctx* ctx, int fd, int all_lines)
+{
+	int done, todo;
+	const char* data;
+
+	todo = strlen(ctx->packet);
+	data = ctx->packet;
+	logprintf(LIRC_DEBUG, "lirc_command_run: Sending: %s", data);
+	while (todo > 0) {
+		done = write(fd, (void*)data, todo);
+		if (done < 0) {
+			logprintf(LIRC_WARNING,
+				  "%s: could not send packet\n", prog);
+			perror(prog);
+			return done;
+		}
+		data += done;
+		todo -= done;
+	}
+	return lirc_command_reply(ctx, fd, all_lines);
+}
+
+
+int lirc_command_run(lirc_cmd_ctx* ctx, int fd)
+{
+	return lirc_command_send(ctx, fd, 0);
+}
+
+
+int lirc_command_run_lines(lirc_cmd_ctx* ctx, int fd)
+{
+	return lirc_command_send(ctx, fd, 1);
+}
+
+
+/** writev() all of iov, return 0 or an errno code. */
+static int lirc_writev_all(int fd, struct iovec* iov, int count)
+{
+	ssize_t done;
+
+	while (count > 0) {
+		done = writev(fd, iov, count);
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		while (count > 0 && (size_t)done >= iov->iov_len) {
+			done -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char*)iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+	return 0;
+}
+
+
+/** Move reply data already read by from into to, for the next reply. */
+static void lirc_command_handover(lirc_cmd_ctx* from, lirc_cmd_ctx* to)
+{
+	int len;
+
+	if (from->next == NULL)
+		return;
+	len = from->head - (from->next - from->buffer);
+	if (len <= 0)
+		return;
+	memcpy(to->buffer, from->next, len);
+	to->buffer[len] = '\0';
+	to->head = len;
+	to->next = to->buffer;
+}
+
+
+int lirc_command_run_batch(lirc_cmd_ctx* ctx, int count, int* results, int fd)
+{
+	return lirc_command_run_notify(ctx, count, results, fd, NULL, NULL);
+}
+
+
+int lirc_command_run_notify(lirc_cmd_ctx* ctx, int count, int* results,
+			    int fd, lirc_command_done done, void* arg)
+{
+	struct iovec iov[LIRC_COMMAND_WINDOW];
+	lirc_cmd_ctx* prev = NULL;
+	int first_error = 0;
+	int i, j, n, r, w;
+
+	for (i = 0; i < count; i += n) {
+		/* Bounded, or lircd might block on replies nobody reads. */
+		n = count - i < LIRC_COMMAND_WINDOW ? count - i
+						    : LIRC_COMMAND_WINDOW;
+		for (j = 0; j < n; j++) {
+			logprintf(LIRC_DEBUG, "lirc_command_run_batch: "
+				  "Sending: %s", ctx[i + j].packet);
+			iov[j].iov_base = ctx[i + j].packet;
+			iov[j].iov_len = strlen(ctx[i + j].packet);
+		}
+		w = lirc_writev_all(fd, iov, n);
+		if (w != 0) {
+			logprintf(LIRC_WARNING,
+				  "%s: could not send packet\n", prog);
+			n = count - i;
+		}
+		for (j = 0; j < n; j++) {
+			if (w != 0) {
+				r = w;
+			} else {
+				if (prev != NULL)
+					lirc_command_handover(prev, &ctx[i + j]);
+				r = lirc_command_reply(&ctx[i + j], fd, 0);
+				prev = &ctx[i + j];
+			}
+			if (results != NULL)
+				results[i + j] = r;
+			if (done != NULL)
+				done(&ctx[i + j], i + j, r, arg);
+			if (r != 0 && first_error == 0)
+				first_error = r;
+		}
+	}
+	return first_error;
+}
+
+
 static void lirc_printf(const char* format_str, ...)
 {
 	va_list ap;
@@ -362,6 +568,76 @@ int lirc_init(const char* prog, int verbose)
 }
 
 
+int lirc_init_multicast(const char* prog, const char* group, int port,
+			int verbose)
+{
+	struct sockaddr_in addr;
+	struct ip_mreq mreq;
+	int enable = 1;
+	int fd;
+
+	if (prog == NULL || group == NULL || lirc_prog != NULL)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port > 0 ? port : LIRC_INET_PORT);
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1) {
+		lirc_printf("%s: bad multicast group %s\n", prog, group);
+		return -1;
+	}
+	/* Bind to the group, not getting other datagrams to the port. */
+	addr.sin_addr = mreq.imr_multiaddr;
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		lirc_printf("%s: could not open socket: %s\n",
+			    prog, strerror(errno));
+		return -1;
+	}
+	(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+			 &enable, sizeof(enable));
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1
+	    || setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+			  &mreq, sizeof(mreq)) == -1) {
+		lirc_printf("%s: could not join %s: %s\n",
+			    prog, group, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	lirc_prog = strdup(prog);
+	if (lirc_prog == NULL) {
+		lirc_printf("%s: out of memory\n", prog);
+		close(fd);
+		return -1;
+	}
+	lirc_verbose = verbose;
+	lirc_lircd = fd;
+	lirc_multicast = 1;
+	lirc_multicast_seq = 0;
+	lirc_multicast_gaps = 0;
+	return fd;
+}
+
+
+unsigned long lirc_multicast_lost(void)
+{
+	return lirc_multicast_gaps;
+}
+
+
+static void lirc_names_clear(void)
+{
+	size_t i;
+
+	for (i = 0; i < lirc_names_count; i++)
+		free(lirc_names[i]);
+	free(lirc_names);
+	lirc_names = NULL;
+	lirc_names_count = 0;
+}
+
+
 int lirc_deinit(void)
 {
 	int r = 0;
@@ -373,6 +649,14 @@ int lirc_deinit(void)
 	if (lirc_buffer != NULL) {
 		free(lirc_buffer);
 		lirc_buffer = NULL;
+		lirc_buffer_len = 0;
+	}
+	lirc_names_clear();
+	lirc_binary = 0;
+	lirc_multicast = 0;
+	if (lirc_ring != NULL) {
+		munmap((void*)lirc_ring, lirc_ring_len);
+		lirc_ring = NULL;
 	}
 	if (lirc_lircd != -1) {
 		r = close(lirc_lircd);
@@ -1045,6 +1329,314 @@ static void lirc_freeconfigentries(struct lirc_config_entry* first)
 }
 
 
+/** Return position of first item >= value in the sorted array. */
+static unsigned int lirc_lower_bound(const unsigned int* array,
+				     unsigned int count,
+				     unsigned int value)
+{
+	unsigned int low = 0;
+	unsigned int high = count;
+	unsigned int mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (array[mid] < value)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+
+/** Case insensitive hash of s, matching strcasecmp(). */
+static unsigned int lirc_index_hash(const char* s)
+{
+	unsigned int hash = 2166136261u;
+
+	for (; *s != '\0'; s++) {
+		hash ^= (unsigned char)tolower((unsigned char)*s);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+static unsigned int lirc_bucket_hash(const char* remote, const char* button)
+{
+	return lirc_index_hash(remote) * 31 + lirc_index_hash(button);
+}
+
+
+static char* lirc_strdup_folded(const char* s)
+{
+	char* folded = strdup(s);
+	char* p;
+
+	if (folded != NULL)
+		for (p = folded; *p != '\0'; p++)
+			*p = tolower((unsigned char)*p);
+	return folded;
+}
+
+
+static struct lirc_index_bucket*
+lirc_index_find(const struct lirc_config_index* index,
+		const char* remote, const char* button, unsigned int hash)
+{
+	struct lirc_index_bucket* bucket;
+
+	bucket = index->buckets[hash & index->bucket_mask];
+	for (; bucket != NULL; bucket = bucket->next)
+		if (bucket->hash == hash
+		    && strcasecmp(bucket->button, button) == 0
+		    && strcasecmp(bucket->remote, remote) == 0)
+			return bucket;
+	return NULL;
+}
+
+
+static int lirc_index_add(struct lirc_config_index* index,
+			  const struct lirc_code* code,
+			  unsigned int ordinal)
+{
+	struct lirc_index_bucket* bucket;
+	unsigned int* ordinals;
+	unsigned int hash;
+
+	hash = lirc_bucket_hash(code->remote, code->button);
+	bucket = lirc_index_find(index, code->remote, code->button, hash);
+	if (bucket == NULL) {
+		bucket = (struct lirc_index_bucket*)
+			 calloc(1, sizeof(struct lirc_index_bucket));
+		if (bucket == NULL)
+			return 0;
+		bucket->next = index->buckets[hash & index->bucket_mask];
+		index->buckets[hash & index->bucket_mask] = bucket;
+		bucket->hash = hash;
+		bucket->remote = lirc_strdup_folded(code->remote);
+		bucket->button = lirc_strdup_folded(code->button);
+		if (bucket->remote == NULL || bucket->button == NULL)
+			return 0;
+	}
+	if (bucket->count == bucket->size) {
+		bucket->size = bucket->size ? 2 * bucket->size : 2;
+		ordinals = (unsigned int*)
+			   realloc(bucket->ordinals,
+				   bucket->size * sizeof(unsigned int));
+		if (ordinals == NULL)
+			return 0;
+		bucket->ordinals = ordinals;
+	}
+	bucket->ordinals[bucket->count++] = ordinal;
+	return 1;
+}
+
+
+static void lirc_index_free(struct lirc_config_index* index)
+{
+	struct lirc_index_bucket* bucket;
+	struct lirc_index_bucket* next;
+	unsigned int i;
+
+	if (index == NULL)
+		return;
+	if (index->buckets != NULL) {
+		for (i = 0; i <= index->bucket_mask; i++) {
+			for (bucket = index->buckets[i];
+			     bucket != NULL;
+			     bucket = next) {
+				next = bucket->next;
+				free(bucket->remote);
+				free(bucket->button);
+				free(bucket->ordinals);
+				free(bucket);
+			}
+		}
+	}
+	if (index->sequences != NULL) {
+		for (i = 0; i < index->count; i++) {
+			if (index->sequences[i] == NULL)
+				continue;
+			free(index->sequences[i]->codes);
+			free(index->sequences[i]->fail);
+			free(index->sequences[i]);
+		}
+	}
+	free(index->buckets);
+	free(index->entries);
+	free(index->fallback);
+	free(index->sequences);
+	free(index->active);
+	free(index->active_copy);
+	free(index);
+}
+
+
+static int lirc_is_wildcard(const struct lirc_code* code)
+{
+	return code->remote == NULL || code->remote == LIRC_ALL
+	       || code->button == NULL || code->button == LIRC_ALL;
+}
+
+
+static int lirc_code_equal(const struct lirc_code* c1,
+			   const struct lirc_code* c2)
+{
+	return strcasecmp(c1->remote, c2->remote) == 0
+	       && strcasecmp(c1->button, c2->button) == 0;
+}
+
+
+/** Compile a sequence without LIRC_ALL, return NULL if not possible. */
+static struct lirc_sequence* lirc_sequence_build(struct lirc_code* first)
+{
+	struct lirc_sequence* seq;
+	struct lirc_code* code;
+	unsigned int length = 0;
+	unsigned int q;
+	unsigned int k;
+
+	for (code = first; code != NULL; code = code->next) {
+		if (lirc_is_wildcard(code))
+			return NULL;
+		length++;
+	}
+	seq = (struct lirc_sequence*)calloc(1, sizeof(struct lirc_sequence));
+	if (seq == NULL)
+		return NULL;
+	seq->length = length;
+	seq->codes = (struct lirc_code**)
+		     calloc(length, sizeof(struct lirc_code*));
+	seq->fail = (unsigned int*)calloc(length, sizeof(unsigned int));
+	if (seq->codes == NULL || seq->fail == NULL) {
+		free(seq->codes);
+		free(seq->fail);
+		free(seq);
+		return NULL;
+	}
+	for (code = first, q = 0; code != NULL; code = code->next, q++)
+		seq->codes[q] = code;
+	k = 0;
+	for (q = 1; q + 1 < length; q++) {
+		while (k > 0 && !lirc_code_equal(seq->codes[q], seq->codes[k]))
+			k = seq->fail[k];
+		if (lirc_code_equal(seq->codes[q], seq->codes[k]))
+			k++;
+		seq->fail[q + 1] = k;
+	}
+	return seq;
+}
+
+
+/** Return 1 if the entry must be checked for all codes. */
+static int lirc_index_is_fallback(const struct lirc_config_index* index,
+				  unsigned int ordinal)
+{
+	const struct lirc_config_entry* entry = index->entries[ordinal];
+
+	if (entry->code == NULL || (entry->flags & toggle_reset))
+		return 1;
+	if (entry->code->next != NULL)
+		return index->sequences[ordinal] == NULL;
+	return lirc_is_wildcard(entry->code);
+}
+
+
+/** Update the active list after the sequence at ordinal was checked. */
+static void lirc_index_update_active(struct lirc_config_index* index,
+				     unsigned int ordinal)
+{
+	const struct lirc_config_entry* entry = index->entries[ordinal];
+	unsigned int pos;
+	int active;
+	int listed;
+
+	pos = lirc_lower_bound(index->active, index->active_count, ordinal);
+	listed = pos < index->active_count && index->active[pos] == ordinal;
+	active = entry->next_code != entry->code;
+	if (active && !listed) {
+		memmove(index->active + pos + 1, index->active + pos,
+			(index->active_count - pos) * sizeof(unsigned int));
+		index->active[pos] = ordinal;
+		index->active_count++;
+	} else if (!active && listed) {
+		index->active_count--;
+		memmove(index->active + pos, index->active + pos + 1,
+			(index->active_count - pos) * sizeof(unsigned int));
+	}
+}
+
+
+/** Rebuild the active list, after the entries were checked unindexed. */
+static void lirc_index_sync_active(struct lirc_config_index* index)
+{
+	unsigned int i;
+
+	for (i = 0; i < index->count; i++)
+		if (index->sequences[i] != NULL
+		    && !lirc_index_is_fallback(index, i))
+			lirc_index_update_active(index, i);
+}
+
+
+/** Build the dispatch index of first, return NULL on errors. */
+static struct lirc_config_index*
+lirc_index_build(struct lirc_config_entry* first)
+{
+	struct lirc_config_index* index;
+	struct lirc_config_entry* entry;
+	unsigned int size;
+	unsigned int i;
+
+	index = (struct lirc_config_index*)
+		calloc(1, sizeof(struct lirc_config_index));
+	if (index == NULL)
+		return NULL;
+	for (entry = first; entry != NULL; entry = entry->next)
+		index->count++;
+	for (size = 16; size < index->count; size *= 2)
+		;
+	index->bucket_mask = size - 1;
+	index->buckets = (struct lirc_index_bucket**)
+			 calloc(size, sizeof(struct lirc_index_bucket*));
+	index->entries = (struct lirc_config_entry**)
+			 calloc(index->count + 1,
+				sizeof(struct lirc_config_entry*));
+	index->fallback = (unsigned int*)
+			  calloc(index->count + 1, sizeof(unsigned int));
+	index->sequences = (struct lirc_sequence**)
+			   calloc(index->count + 1,
+				  sizeof(struct lirc_sequence*));
+	index->active = (unsigned int*)
+			calloc(index->count + 1, sizeof(unsigned int));
+	index->active_copy = (unsigned int*)
+			     calloc(index->count + 1, sizeof(unsigned int));
+	if (index->buckets == NULL
+	    || index->entries == NULL
+	    || index->fallback == NULL
+	    || index->sequences == NULL
+	    || index->active == NULL
+	    || index->active_copy == NULL) {
+		lirc_index_free(index);
+		return NULL;
+	}
+	for (entry = first, i = 0; entry != NULL; entry = entry->next, i++) {
+		index->entries[i] = entry;
+		if (entry->code != NULL && entry->code->next != NULL)
+			index->sequences[i] = lirc_sequence_build(entry->code);
+		if (lirc_index_is_fallback(index, i)) {
+			index->fallback[index->fallback_count++] = i;
+		} else if (!lirc_index_add(index, entry->code, i)) {
+			lirc_index_free(index);
+			return NULL;
+		}
+	}
+	index->resume = 0;
+	return index;
+}
+
+
 static void
 parse_shebang(char* line, int depth, const char* path, char* buff, size_t size)
 {
@@ -1070,39 +1662,598 @@ parse_shebang(char* line, int depth, const char* path, char* buff, size_t size)
 }
 
 
-static int lirc_readconfig_only_internal(const char*		file,
-					 struct lirc_config**	config,
-					 int			(check)(char* s),
-					 char**			full_name)
-{
-	const char* const INCLUDED_LIRCRC_CLASS =
-		"Warning: lirc_class in included file (ignored)";
-	char* string;
-	char* eq;
-	char* token;
-	char* token2;
-	char* token3;
-	struct filestack_t* filestack;
-	struct filestack_t* stack_tmp;
-	int open_files;
-	char lircrc_class[128] = { '\0' };
-	struct lirc_config_entry* new_entry;
-	struct lirc_config_entry* first;
-	struct lirc_config_entry* last;
-	char* mode;
-	char* remote;
-	int ret = 0;
-	int firstline = 1;
-	char* save_full_name = NULL;
+/*
+ * Compiled lircrc cache, used only if $LIRCRC_CACHE_DIR is set. After a
+ * successful parse the entries are written to a file in that directory,
+ * named after a hash of the main lircrc path. Later lirc_readconfig()
+ * calls map it and rebuild the entries from it, provided the same lirc
+ * version wrote it and none of the files read, the main one and
+ * includes, have changed. All records are aligned to 8 bytes in host
+ * byte order:
+ *
+ *   header
+ *   u32 source count, sources: struct rc_cache_source, path
+ *   lircrc_class, main file path
+ *   u32 entry count, entries: struct rc_cache_entry, prog, change_mode,
+ *       mode, remote and button * code_count, string * config_count.
+ *
+ * Strings are stored as an i32 length followed by the bytes and a nul,
+ * the length is -1 for NULL and -2 for LIRC_ALL.
+ */
 
-	filestack = stack_push(NULL);
-	if (filestack == NULL)
-		return -1;
-	filestack->file = lirc_open(file, NULL, &(filestack->name));
-	if (filestack->file == NULL) {
-		stack_free(filestack);
-		return -1;
-	}
+#define RC_CACHE_MAGIC  "LIRCRC"
+#define RC_CACHE_FORMAT 1
+#define RC_CACHE_NULL   -1
+#define RC_CACHE_ALL    -2
+
+struct rc_cache_header {
+	char		magic[8];
+	char		version[24];    /**< lirc VERSION which wrote it. */
+	uint32_t	format;
+	uint32_t	pad;
+	uint64_t	payload_size;   /**< Bytes following the header. */
+	uint64_t	hash;           /**< FNV-1a of the payload. */
+};
+
+struct rc_cache_source {
+	uint32_t	path_size;      /**< Bytes of path including nul. */
+	uint32_t	pad;
+	int64_t		size;
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	uint64_t	dev;
+	uint64_t	ino;
+};
+
+struct rc_cache_entry {
+	uint32_t	rep_delay;
+	uint32_t	ign_first_events;
+	uint32_t	rep;
+	uint32_t	flags;
+	uint32_t	code_count;
+	uint32_t	config_count;
+};
+
+/** Growing output buffer, or bounded input cursor. */
+struct rc_cache_buf {
+	char*	data;
+	size_t	len;
+	size_t	size;
+	int	failed;
+};
+
+/* While parsing: where the files read are recorded, if caching. */
+static struct rc_cache_buf* rc_cache_sources = NULL;
+static uint32_t rc_cache_source_count;
+
+
+static uint64_t rc_cache_hash(const char* data, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+static void rc_cache_put(struct rc_cache_buf* buf, const void* data, size_t len)
+{
+	size_t padded = (len + 7) & ~(size_t)7;
+	size_t size;
+	char* p;
+
+	if (buf->failed)
+		return;
+	if (buf->len + padded > buf->size) {
+		size = buf->size ? buf->size : 4096;
+		while (size < buf->len + padded)
+			size *= 2;
+		p = (char*)realloc(buf->data, size);
+		if (p == NULL) {
+			buf->failed = 1;
+			return;
+		}
+		buf->data = p;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	memset(buf->data + buf->len + len, 0, padded - len);
+	buf->len += padded;
+}
+
+
+static void rc_cache_put_u32(struct rc_cache_buf* buf, uint32_t value)
+{
+	rc_cache_put(buf, &value, sizeof(value));
+}
+
+
+static void rc_cache_put_string(struct rc_cache_buf* buf, const char* s)
+{
+	int32_t len;
+
+	if (s == NULL)
+		len = RC_CACHE_NULL;
+	else if (s == LIRC_ALL)
+		len = RC_CACHE_ALL;
+	else
+		len = (int32_t)strlen(s);
+	rc_cache_put(buf, &len, sizeof(len));
+	if (len >= 0)
+		rc_cache_put(buf, s, len + 1);
+}
+
+
+/** Point at the next len bytes of buf, NULL if truncated. */
+static const void* rc_cache_get(struct rc_cache_buf* buf, size_t len)
+{
+	size_t padded = (len + 7) & ~(size_t)7;
+	const char* p;
+
+	if (buf->failed || padded < len || buf->size - buf->len < padded) {
+		buf->failed = 1;
+		return NULL;
+	}
+	p = buf->data + buf->len;
+	buf->len += padded;
+	return p;
+}
+
+
+static uint32_t rc_cache_get_u32(struct rc_cache_buf* buf)
+{
+	const uint32_t* p = (const uint32_t*)rc_cache_get(buf, sizeof(*p));
+
+	return p == NULL ? 0 : *p;
+}
+
+
+/** Return a malloc'ed copy of the next string, NULL or LIRC_ALL. */
+static char* rc_cache_get_string(struct rc_cache_buf* buf)
+{
+	const int32_t* len = (const int32_t*)rc_cache_get(buf, sizeof(*len));
+	const char* s;
+	char* copy;
+
+	if (len == NULL || *len == RC_CACHE_NULL)
+		return NULL;
+	if (*len == RC_CACHE_ALL)
+		return LIRC_ALL;
+	s = (const char*)rc_cache_get(buf, (size_t)*len + 1);
+	if (*len < 0 || s == NULL || s[*len] != '\0') {
+		buf->failed = 1;
+		return NULL;
+	}
+	copy = strdup(s);
+	if (copy == NULL)
+		buf->failed = 1;
+	return copy;
+}
+
+
+/** Record a lircrc file opened while parsing. */
+static void rc_cache_record(const char* path, FILE* f)
+{
+	struct rc_cache_source src;
+	struct stat st;
+
+	if (rc_cache_sources == NULL)
+		return;
+	if (path == NULL || fstat(fileno(f), &st) != 0) {
+		rc_cache_sources->failed = 1;
+		return;
+	}
+	memset(&src, 0, sizeof(src));
+	src.path_size = strlen(path) + 1;
+	src.size = st.st_size;
+	src.mtime_sec = st.st_mtim.tv_sec;
+	src.mtime_nsec = st.st_mtim.tv_nsec;
+	src.dev = st.st_dev;
+	src.ino = st.st_ino;
+	rc_cache_put(rc_cache_sources, &src, sizeof(src));
+	rc_cache_put(rc_cache_sources, path, src.path_size);
+	rc_cache_source_count += 1;
+}
+
+
+static int rc_cache_source_is_valid(const struct rc_cache_source* src,
+				    const char* path)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+		return 0;
+	return (int64_t)st.st_size == src->size
+	       && (int64_t)st.st_mtim.tv_sec == src->mtime_sec
+	       && (int64_t)st.st_mtim.tv_nsec == src->mtime_nsec
+	       && (uint64_t)st.st_dev == src->dev
+	       && (uint64_t)st.st_ino == src->ino;
+}
+
+
+/**
+ * Get the cache file path for the lircrc file, which must exist, in
+ * $LIRCRC_CACHE_DIR. Return 0 if no cache should be used, also when
+ * $LIRCRC_CACHE_DIR is unset or empty.
+ */
+static int rc_cache_path(const char* file, char* buff, size_t size)
+{
+	char dir[MAXPATHLEN - 32];
+	char real[PATH_MAX];
+	char* path;
+	const char* env;
+	uint64_t hash;
+
+	env = getenv("LIRCRC_CACHE_DIR");
+	if (env == NULL || *env == '\0')
+		return 0;
+	snprintf(dir, sizeof(dir), "%s", env);
+	if (access(dir, W_OK) != 0 && mkdir(dir, 0700) != 0)
+		return 0;
+	/* Only use the cache for the file it's named after, no fallbacks. */
+	path = lirc_getfilename(file, NULL);
+	if (path == NULL)
+		return 0;
+	if (access(path, R_OK) != 0 || realpath(path, real) == NULL) {
+		free(path);
+		return 0;
+	}
+	free(path);
+	hash = rc_cache_hash(real, strlen(real));
+	snprintf(buff, size, "%s/lircrc-%016llx.cache",
+		 dir, (unsigned long long)hash);
+	return strlen(buff) < size - 1;
+}
+
+
+static void rc_cache_put_entries(struct rc_cache_buf* buf,
+				 const struct lirc_config_entry* first)
+{
+	const struct lirc_config_entry* entry;
+	const struct lirc_code* code;
+	const struct lirc_list* list;
+	struct rc_cache_entry rec;
+	uint32_t count = 0;
+
+	for (entry = first; entry != NULL; entry = entry->next)
+		count++;
+	rc_cache_put_u32(buf, count);
+	for (entry = first; entry != NULL; entry = entry->next) {
+		memset(&rec, 0, sizeof(rec));
+		rec.rep_delay = entry->rep_delay;
+		rec.ign_first_events = entry->ign_first_events;
+		rec.rep = entry->rep;
+		rec.flags = entry->flags;
+		for (code = entry->code; code != NULL; code = code->next)
+			rec.code_count++;
+		for (list = entry->config; list != NULL; list = list->next)
+			rec.config_count++;
+		rc_cache_put(buf, &rec, sizeof(rec));
+		rc_cache_put_string(buf, entry->prog);
+		rc_cache_put_string(buf, entry->change_mode);
+		rc_cache_put_string(buf, entry->mode);
+		for (code = entry->code; code != NULL; code = code->next) {
+			rc_cache_put_string(buf, code->remote);
+			rc_cache_put_string(buf, code->button);
+		}
+		for (list = entry->config; list != NULL; list = list->next)
+			rc_cache_put_string(buf, list->string);
+	}
+}
+
+
+/** Rebuild the stored entries, NULL and buf->failed set on errors. */
+static struct lirc_config_entry* rc_cache_get_entries(struct rc_cache_buf* buf)
+{
+	struct lirc_config_entry* first = NULL;
+	struct lirc_config_entry** tail = &first;
+	struct lirc_config_entry* entry;
+	const struct rc_cache_entry* rec;
+	struct lirc_code** code_tail;
+	struct lirc_code* code;
+	struct lirc_list** list_tail;
+	struct lirc_list* list;
+	uint32_t count;
+	uint32_t i;
+	uint32_t j;
+
+	count = rc_cache_get_u32(buf);
+	for (i = 0; i < count && !buf->failed; i++) {
+		rec = (const struct rc_cache_entry*)
+		      rc_cache_get(buf, sizeof(*rec));
+		entry = (struct lirc_config_entry*)calloc(1, sizeof(*entry));
+		if (rec == NULL || entry == NULL) {
+			free(entry);
+			buf->failed = 1;
+			break;
+		}
+		*tail = entry;
+		tail = &entry->next;
+		entry->rep_delay = rec->rep_delay;
+		entry->ign_first_events = rec->ign_first_events;
+		entry->rep = rec->rep;
+		entry->flags = rec->flags;
+		entry->prog = rc_cache_get_string(buf);
+		entry->change_mode = rc_cache_get_string(buf);
+		entry->mode = rc_cache_get_string(buf);
+		code_tail = &entry->code;
+		for (j = 0; j < rec->code_count && !buf->failed; j++) {
+			code = (struct lirc_code*)calloc(1, sizeof(*code));
+			if (code == NULL) {
+				buf->failed = 1;
+				break;
+			}
+			*code_tail = code;
+			code_tail = &code->next;
+			code->remote = rc_cache_get_string(buf);
+			code->button = rc_cache_get_string(buf);
+		}
+		list_tail = &entry->config;
+		for (j = 0; j < rec->config_count && !buf->failed; j++) {
+			list = (struct lirc_list*)calloc(1, sizeof(*list));
+			if (list == NULL) {
+				buf->failed = 1;
+				break;
+			}
+			*list_tail = list;
+			list_tail = &list->next;
+			list->string = rc_cache_get_string(buf);
+		}
+		entry->next_code = entry->code;
+		entry->next_config = entry->config;
+	}
+	if (buf->failed) {
+		lirc_freeconfigentries(first);
+		return NULL;
+	}
+	return first;
+}
+
+
+/** Write the cache for a successful parse, errors are ignored. */
+static void rc_cache_write(const char*			path,
+			   struct rc_cache_buf*		sources,
+			   const char*			lircrc_class,
+			   const char*			full_name,
+			   const struct lirc_config_entry*	first)
+{
+	struct rc_cache_header header;
+	struct rc_cache_buf payload = { NULL, 0, 0, 0 };
+	char tmp[MAXPATHLEN];
+	FILE* f;
+	int ok;
+
+	rc_cache_put_u32(&payload, rc_cache_source_count);
+	rc_cache_put(&payload, sources->data, sources->len);
+	rc_cache_put_string(&payload, lircrc_class);
+	rc_cache_put_string(&payload, full_name);
+	rc_cache_put_entries(&payload, first);
+	if (payload.failed || sources->failed) {
+		free(payload.data);
+		return;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RC_CACHE_MAGIC, sizeof(RC_CACHE_MAGIC));
+	strncpy(header.version, VERSION, sizeof(header.version) - 1);
+	header.format = RC_CACHE_FORMAT;
+	header.payload_size = payload.len;
+	header.hash = rc_cache_hash(payload.data, payload.len);
+
+	/* Write a private temp file, then atomically replace the cache. */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(payload.data);
+		return;
+	}
+	fchmod(fileno(f), 0600);
+	ok = fwrite(&header, sizeof(header), 1, f) == 1
+	     && fwrite(payload.data, 1, payload.len, f) == payload.len;
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp, path) != 0)
+		unlink(tmp);
+	free(payload.data);
+}
+
+
+/**
+ * Load the entries written by rc_cache_write() if still valid.
+ * @return 0 if loaded, else -1.
+ */
+static int rc_cache_load(const char*			path,
+			 struct lirc_config_entry**	first,
+			 char*				lircrc_class,
+			 size_t				class_size,
+			 char**				full_name)
+{
+	const struct rc_cache_header* header;
+	const struct rc_cache_source* src;
+	struct rc_cache_buf buf;
+	struct stat st;
+	const char* source_path;
+	char* lircclass;
+	char* name;
+	void* map;
+	uint32_t count;
+	uint32_t i;
+	int fd;
+	int ok = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	/* Config strings are executed by e. g., irexec: trust own files. */
+	if (fstat(fd, &st) != 0
+	    || st.st_uid != geteuid()
+	    || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0
+	    || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	header = (const struct rc_cache_header*)map;
+	buf.data = (char*)map + sizeof(*header);
+	buf.len = 0;
+	buf.size = st.st_size - sizeof(*header);
+	buf.failed = 0;
+	if (memcmp(header->magic, RC_CACHE_MAGIC, sizeof(RC_CACHE_MAGIC)) != 0
+	    || strncmp(header->version, VERSION, sizeof(header->version)) != 0
+	    || header->format != RC_CACHE_FORMAT
+	    || header->payload_size != buf.size
+	    || header->hash != rc_cache_hash(buf.data, buf.size))
+		goto done;
+	count = rc_cache_get_u32(&buf);
+	for (i = 0; i < count && !buf.failed; i++) {
+		src = (const struct rc_cache_source*)
+		      rc_cache_get(&buf, sizeof(*src));
+		if (src == NULL)
+			goto done;
+		source_path = (const char*)rc_cache_get(&buf, src->path_size);
+		if (source_path == NULL
+		    || src->path_size == 0
+		    || source_path[src->path_size - 1] != '\0'
+		    || !rc_cache_source_is_valid(src, source_path))
+			goto done;
+	}
+	lircclass = rc_cache_get_string(&buf);
+	name = rc_cache_get_string(&buf);
+	*first = rc_cache_get_entries(&buf);
+	if (!buf.failed && name != NULL && name != LIRC_ALL
+	    && lircclass != LIRC_ALL) {
+		snprintf(lircrc_class, class_size, "%s",
+			 lircclass != NULL ? lircclass : "");
+		*full_name = name;
+		name = NULL;
+		ok = 1;
+	} else if (!buf.failed) {
+		lirc_freeconfigentries(*first);
+		*first = NULL;
+	}
+	if (lircclass != LIRC_ALL)
+		free(lircclass);
+	if (name != LIRC_ALL)
+		free(name);
+done:
+	munmap(map, st.st_size);
+	return ok ? 0 : -1;
+}
+
+
+/** Run the check callback like lirc_mode() does while parsing. */
+static int rc_cache_check(struct lirc_config_entry* first,
+			  int (check)(char* s))
+{
+	struct lirc_config_entry* entry;
+	struct lirc_list* list;
+
+	if (check == NULL)
+		return 0;
+	for (entry = first; entry != NULL; entry = entry->next) {
+		if (entry->prog == NULL || strcasecmp(entry->prog, lirc_prog) != 0)
+			continue;
+		for (list = entry->config; list != NULL; list = list->next)
+			if (check(list->string) == -1)
+				return -1;
+	}
+	return 0;
+}
+
+
+
+/** Create the lirc_config for the parsed entries, NULL on errors. */
+static struct lirc_config* lirc_config_create(struct lirc_config_entry* first,
+					      const char* lircrc_class)
+{
+	struct lirc_config* config;
+	char* startupmode;
+
+	config = (struct lirc_config*)malloc(sizeof(struct lirc_config));
+	if (config == NULL) {
+		lirc_printf("%s: out of memory\n", lirc_prog);
+		return NULL;
+	}
+	config->first = first;
+	config->next = first;
+	startupmode = lirc_startupmode(config->first);
+	config->current_mode = startupmode ? strdup(startupmode) : NULL;
+	if (lircrc_class[0] != '\0')
+		config->lircrc_class = strdup(lircrc_class);
+	else
+		config->lircrc_class = NULL;
+	config->sockfd = -1;
+	config->index = lirc_index_build(first);
+	return config;
+}
+
+
+static int lirc_readconfig_only_internal(const char*		file,
+					 struct lirc_config**	config,
+					 int			(check)(char* s),
+					 char**			full_name)
+{
+	const char* const INCLUDED_LIRCRC_CLASS =
+		"Warning: lirc_class in included file (ignored)";
+	char* string;
+	char* eq;
+	char* token;
+	char* token2;
+	char* token3;
+	struct filestack_t* filestack;
+	struct filestack_t* stack_tmp;
+	int open_files;
+	char lircrc_class[128] = { '\0' };
+	struct lirc_config_entry* new_entry;
+	struct lirc_config_entry* first;
+	struct lirc_config_entry* last;
+	char* mode;
+	char* remote;
+	int ret = 0;
+	int firstline = 1;
+	char* save_full_name = NULL;
+	char cache_path[MAXPATHLEN];
+	struct rc_cache_buf sources = { NULL, 0, 0, 0 };
+	int use_cache;
+
+	use_cache = rc_cache_path(file, cache_path, sizeof(cache_path));
+	if (use_cache && rc_cache_load(cache_path, &first, lircrc_class,
+				       sizeof(lircrc_class),
+				       &save_full_name) == 0) {
+		*config = NULL;
+		if (rc_cache_check(first, check) == 0)
+			*config = lirc_config_create(first, lircrc_class);
+		if (*config == NULL) {
+			lirc_freeconfigentries(first);
+			free(save_full_name);
+			return -1;
+		}
+		if (full_name != NULL)
+			*full_name = save_full_name;
+		else
+			free(save_full_name);
+		return 0;
+	}
+	if (use_cache) {
+		rc_cache_sources = &sources;
+		rc_cache_source_count = 0;
+	}
+
+	filestack = stack_push(NULL);
+	if (filestack == NULL)
+		return -1;
+	filestack->file = lirc_open(file, NULL, &(filestack->name));
+	if (filestack->file == NULL) {
+		stack_free(filestack);
+		rc_cache_sources = NULL;
+		return -1;
+	}
+	rc_cache_record(filestack->name, filestack->file);
 	filestack->line = 0;
 	open_files = 1;
 
@@ -1113,7 +2264,7 @@ static int lirc_readconfig_only_internal(const char*		file,
 		ret = lirc_readline(&string, filestack->file);
 		if (ret == -1 || string == NULL) {
 			fclose(filestack->file);
-			if (open_files == 1 && full_name != NULL) {
+			if (open_files == 1) {
 				save_full_name = filestack->name;
 				filestack->name = NULL;
 			}
@@ -1176,6 +2327,9 @@ static int lirc_readconfig_only_internal(const char*		file,
 								    name));
 						stack_tmp->line = 0;
 						if (stack_tmp->file) {
+							rc_cache_record(
+								stack_tmp->name,
+								stack_tmp->file);
 							open_files++;
 							filestack = stack_tmp;
 						} else {
@@ -1392,26 +2546,19 @@ static int lirc_readconfig_only_internal(const char*		file,
 				mode);
 		free(mode);
 	}
+	rc_cache_sources = NULL;
+	if (ret == 0 && use_cache && save_full_name != NULL)
+		/* Before lirc_startupmode() updates the entries. */
+		rc_cache_write(cache_path, &sources, lircrc_class,
+			       save_full_name, first);
+	free(sources.data);
 	if (ret == 0) {
-		char* startupmode;
-
-		*config = (struct lirc_config*)
-			  malloc(sizeof(struct lirc_config));
+		*config = lirc_config_create(first, lircrc_class);
 		if (*config == NULL) {
-			lirc_printf("%s: out of memory\n", lirc_prog);
 			lirc_freeconfigentries(first);
+			free(save_full_name);
 			return -1;
 		}
-		(*config)->first = first;
-		(*config)->next = first;
-		startupmode = lirc_startupmode((*config)->first);
-		(*config)->current_mode =
-			startupmode ? strdup(startupmode) : NULL;
-		if (lircrc_class[0] != '\0')
-			(*config)->lircrc_class = strdup(lircrc_class);
-		else
-			(*config)->lircrc_class = NULL;
-		(*config)->sockfd = -1;
 		if (full_name != NULL) {
 			*full_name = save_full_name;
 			save_full_name = NULL;
@@ -1541,6 +2688,7 @@ void lirc_freeconfig(struct lirc_config* config)
 		if (config->lircrc_class != NULL)
 			free(config->lircrc_class);
 		lirc_freeconfigentries(config->first);
+		lirc_index_free(config->index);
 		free(config->current_mode);
 		free(config);
 	}
@@ -1634,9 +2782,42 @@ static int rep_filter(struct lirc_config_entry* scan, int rep)
 	return 0;
 }
 
+/**
+ * Find the new state of a compiled sequence after a code not matching
+ * at the current state, like the loop in lirc_iscode() does.
+ */
+static void lirc_sequence_rebase(struct lirc_config_entry*	scan,
+				 const struct lirc_sequence*	seq,
+				 const char*			remote,
+				 const char*			button)
+{
+	unsigned int q;
+	unsigned int b;
+
+	for (q = 0; q < seq->length; q++)
+		if (seq->codes[q] == scan->next_code)
+			break;
+	scan->next_code = scan->code;
+	if (q == 0 || q == seq->length)
+		return;
+	b = seq->fail[q];
+	for (;;) {
+		if (strcasecmp(seq->codes[b]->remote, remote) == 0
+		    && strcasecmp(seq->codes[b]->button, button) == 0) {
+			scan->next_code = seq->codes[b]->next;
+			return;
+		}
+		if (b == 0)
+			return;
+		b = seq->fail[b];
+	}
+}
+
+
 static int lirc_iscode(struct lirc_config_entry*	scan,
-		       char*				remote,
-		       char*				button,
+		       const struct lirc_sequence*	seq,
+		       const char*			remote,
+		       const char*			button,
 		       int				rep)
 {
 	struct lirc_code* codes;
@@ -1678,6 +2859,10 @@ static int lirc_iscode(struct lirc_config_entry*	scan,
 	codes = scan->code;
 	if (codes == scan->next_code)
 		return 0;
+	if (seq != NULL) {
+		lirc_sequence_rebase(scan, seq, remote, button);
+		return 0;
+	}
 	codes = codes->next;
 	/* rebase code sequence */
 	while (codes != scan->next_code->next) {
@@ -1739,107 +2924,424 @@ char* lirc_ir2char(struct lirc_config* config, char* code)
 }
 
 
-static int lirc_code2char_internal(struct lirc_config*	config,
-				   char*		code,
-				   char**		string,
-				   char**		prog)
+/** lirc_check_entry() results. */
+enum check_result {
+	CHECK_NEXT,     /**< Go on with next entry. */
+	CHECK_QUIT,     /**< Entry with quit flag matched, go on. */
+	CHECK_DONE      /**< Entry matched with a string, stop. */
+};
+
+
+/** Check and execute scan for a decoded code, like lircrc says. */
+static enum check_result lirc_check_entry(struct lirc_config*		config,
+					  struct lirc_config_entry*	scan,
+					  const struct lirc_sequence*	seq,
+					  const char*			remote,
+					  const char*			button,
+					  int				rep,
+					  char**			prog,
+					  char**			s,
+					  int*				quit_happened)
 {
-	int rep;
-	char* backup;
-	char* remote;
-	char* button;
-	char* s = NULL;
-	struct lirc_config_entry* scan;
 	int exec_level;
-	int quit_happened;
 
-	*string = NULL;
-	if (sscanf(code, "%*x %x %*s %*s\n", &rep) == 1) {
-		backup = strdup(code);
-		if (backup == NULL)
-			return -1;
+	exec_level = lirc_iscode(scan, seq, remote, button, rep);
+	if (exec_level > 0 &&
+	    (scan->mode == NULL ||
+	     (scan->mode != NULL &&
+	      config->current_mode != NULL &&
+	      strcasecmp(scan->mode, config->current_mode) == 0)) &&
+	    *quit_happened == 0) {
+		if (exec_level > 1) {
+			*s = lirc_execute(config, scan);
+			if (*s != NULL && prog != NULL)
+				*prog = scan->prog;
+		} else {
+			*s = NULL;
+		}
+		if (scan->flags & quit) {
+			*quit_happened = 1;
+			return CHECK_QUIT;
+		} else if (*s != NULL) {
+			return CHECK_DONE;
+		}
+	}
+	return CHECK_NEXT;
+}
 
-		strtok(backup, " ");
-		strtok(NULL, " ");
-		button = strtok(NULL, " ");
-		remote = strtok(NULL, "\n");
 
-		if (button == NULL || remote == NULL) {
-			free(backup);
-			return 0;
-		}
+/** A sorted list of entry positions, and the next one to check. */
+struct ordinal_cursor {
+	const unsigned int*	ordinals;
+	unsigned int		count;
+	unsigned int		pos;
+};
 
-		scan = config->next;
-		quit_happened = 0;
-		while (scan != NULL) {
-			exec_level = lirc_iscode(scan, remote, button, rep);
-			if (exec_level > 0 &&
-			    (scan->mode == NULL ||
-			     (scan->mode != NULL &&
-			      config->current_mode != NULL &&
-			      strcasecmp(scan->mode,
-					 config->current_mode) == 0)) &&
-			    quit_happened == 0) {
-				if (exec_level > 1) {
-					s = lirc_execute(config, scan);
-					if (s != NULL && prog != NULL)
-						*prog = scan->prog;
-				} else {
-					s = NULL;
-				}
-				if (scan->flags & quit) {
-					quit_happened = 1;
-					config->next = NULL;
-					scan = scan->next;
-					continue;
-				} else if (s != NULL) {
-					config->next = scan->next;
-					break;
-				}
-			}
-			scan = scan->next;
+
+/**
+ * Check the entries indexed under remote and button, the sequences with
+ * a partial match and the entries always checked, in lircrc order from
+ * config->next. Returns the string to use, NULL if none.
+ */
+static char* lirc_dispatch_indexed(struct lirc_config*	config,
+				   const char*		remote,
+				   const char*		button,
+				   int			rep,
+				   char**		prog)
+{
+	struct lirc_config_index* index = config->index;
+	const struct lirc_index_bucket* bucket;
+	struct ordinal_cursor cursors[3];
+	struct ordinal_cursor* c;
+	const struct lirc_sequence* seq;
+	unsigned int ordinal;
+	enum check_result result;
+	int quit_happened = 0;
+	char* s = NULL;
+	int i;
+
+	memset(cursors, 0, sizeof(cursors));
+	bucket = lirc_index_find(index, remote, button,
+				 lirc_bucket_hash(remote, button));
+	if (bucket != NULL) {
+		cursors[0].ordinals = bucket->ordinals;
+		cursors[0].count = bucket->count;
+	}
+	cursors[1].ordinals = index->fallback;
+	cursors[1].count = index->fallback_count;
+	/* Checking the sequences updates the active list. */
+	memcpy(index->active_copy, index->active,
+	       index->active_count * sizeof(unsigned int));
+	cursors[2].ordinals = index->active_copy;
+	cursors[2].count = index->active_count;
+	for (i = 0; i < 3; i++) {
+		c = &cursors[i];
+		c->pos = lirc_lower_bound(c->ordinals, c->count,
+					  index->resume);
+	}
+	for (;;) {
+		ordinal = index->count;
+		for (i = 0; i < 3; i++) {
+			c = &cursors[i];
+			if (c->pos < c->count && c->ordinals[c->pos] < ordinal)
+				ordinal = c->ordinals[c->pos];
 		}
-		free(backup);
-		if (s != NULL) {
-			*string = s;
-			return 0;
+		if (ordinal == index->count)
+			break;
+		for (i = 0; i < 3; i++) {
+			c = &cursors[i];
+			if (c->pos < c->count && c->ordinals[c->pos] == ordinal)
+				c->pos++;
+		}
+		seq = index->sequences[ordinal];
+		result = lirc_check_entry(config, index->entries[ordinal], seq,
+					  remote, button, rep, prog,
+					  &s, &quit_happened);
+		if (seq != NULL && !lirc_index_is_fallback(index, ordinal))
+			lirc_index_update_active(index, ordinal);
+		if (result == CHECK_QUIT) {
+			config->next = NULL;
+			index->resume = index->count;
+		} else if (result == CHECK_DONE) {
+			index->resume = ordinal + 1;
+			config->next = index->entries[index->resume];
+			break;
 		}
 	}
-	config->next = config->first;
-	return 0;
+	return s;
 }
 
 
-int lirc_code2char(struct lirc_config* config, char* code, char** string)
+/**
+ * Parse a code line from lircd into event, without the heap.
+ * @return -1 if there is no repeat count, 0 if button or remote is
+ *     missing, else 1.
+ */
+static int lirc_event_parse(const char* code, struct lirc_event* event)
+{
+	struct code_line parsed;
+	char* s;
+	int r;
+
+	strncpy(event->line, code, sizeof(event->line) - 1);
+	event->line[sizeof(event->line) - 1] = '\0';
+	s = strrchr(event->line, '\n');
+	if (s != NULL)
+		*s = '\0';
+	event->button = NULL;
+	event->remote = NULL;
+	r = code_line_parse(event->line, strlen(event->line), &parsed);
+	if (r == -1)
+		return -1;
+	event->code = parsed.code;
+	event->reps = parsed.reps;
+	if (r == 0)
+		return 0;
+	/* Both fit: they are shorter than the line, with blanks between. */
+	s = event->names;
+	memcpy(s, parsed.button, parsed.button_len);
+	s[parsed.button_len] = '\0';
+	event->button = s;
+	s += parsed.button_len + 1;
+	memcpy(s, parsed.remote, parsed.remote_len);
+	s[parsed.remote_len] = '\0';
+	event->remote = s;
+	return 1;
+}
+
+
+static int lirc_dispatch(struct lirc_config*		config,
+			 const struct lirc_event*	event,
+			 char**				string,
+			 char**				prog)
+{
+	const char* remote = event->remote;
+	const char* button = event->button;
+	int rep = event->reps;
+	char* s = NULL;
+	struct lirc_config_entry* scan;
+	enum check_result result;
+	int quit_happened;
+	struct lirc_config_index* index = config->index;
+
+	*string = NULL;
+	if (index != NULL && index->entries[index->resume] == config->next) {
+		s = lirc_dispatch_indexed(config, remote, button, rep, prog);
+		if (s != NULL) {
+			*string = s;
+			return 0;
+		}
+		config->next = config->first;
+		index->resume = 0;
+		return 0;
+	}
+	scan = config->next;
+	quit_happened = 0;
+	while (scan != NULL) {
+		result = lirc_check_entry(config, scan, NULL,
+					  remote, button, rep, prog,
+					  &s, &quit_happened);
+		if (result == CHECK_QUIT) {
+			config->next = NULL;
+		} else if (result == CHECK_DONE) {
+			config->next = scan->next;
+			break;
+		}
+		scan = scan->next;
+	}
+	if (index != NULL)
+		lirc_index_sync_active(index);
+	if (s != NULL) {
+		*string = s;
+		return 0;
+	}
+	config->next = config->first;
+	if (index != NULL)
+		index->resume = 0;
+	return 0;
+}
+
+
+static int lirc_code2char_internal(struct lirc_config*	config,
+				   char*		code,
+				   char**		string,
+				   char**		prog)
+{
+	struct lirc_event event;
+
+	*string = NULL;
+	switch (lirc_event_parse(code, &event)) {
+	case 1:
+		return lirc_dispatch(config, &event, string, prog);
+	case 0:
+		return 0;
+	default:
+		break;
+	}
+	config->next = config->first;
+	if (config->index != NULL)
+		config->index->resume = 0;
+	return 0;
+}
+
+
+/*
+ * lircrcd replies to CODES with all strings for a code, the first line
+ * being the number of strings which didn't fit and are left for CODE.
+ * They are returned from lircrcd_strings without further round trips.
+ */
+
+/** State of the lircrcd translation of lircrcd_code. */
+enum lircrcd_state {
+	LIRCRCD_IDLE,           /**< Nothing pending, next call is a new code. */
+	LIRCRCD_CACHED,         /**< Strings left in lircrcd_strings. */
+	LIRCRCD_DRAINING        /**< Remaining strings are fetched with CODE. */
+};
+
+static enum lircrcd_state lircrcd_state = LIRCRCD_IDLE;
+static char lircrcd_code[PACKET_SIZE + 1];
+static char lircrcd_strings[PACKET_SIZE + 1];
+static char* lircrcd_next = NULL;
+static int lircrcd_more = 0;
+/** Cleared if lircrcd doesn't understand CODES. */
+static int lircrcd_has_codes = 1;
+
+
+/** Run a translation command on lircrcd, 0 on success. */
+static int lircrcd_command(struct lirc_config*	config,
+			   lirc_cmd_ctx*	cmd,
+			   const char*		directive,
+			   const char*		code,
+			   int			code_len)
+{
+	int ret;
+
+	ret = lirc_command_init(cmd, "%s %.*s\n", directive, code_len, code);
+	if (ret != 0)
+		return ret;
+	do
+		ret = lirc_command_run_lines(cmd, config->sockfd);
+	while (ret == EAGAIN || ret == EWOULDBLOCK);
+	return ret;
+}
+
+
+/** Return next string in lircrcd_strings or NULL, update state. */
+static char* lircrcd_pop(void)
+{
+	char* s = lircrcd_next;
+	char* end;
+
+	if (s == NULL || *s == '\0') {
+		lircrcd_state = lircrcd_more ? LIRCRCD_DRAINING : LIRCRCD_IDLE;
+		return NULL;
+	}
+	end = strchr(s, '\n');
+	if (end != NULL) {
+		*end = '\0';
+		lircrcd_next = end + 1;
+	} else {
+		lircrcd_next = s + strlen(s);
+	}
+	return s;
+}
+
+
+/** Fetch all strings for code with CODES, return 0 or -1 on errors. */
+static int lircrcd_fetch(struct lirc_config*	config,
+			 const char*		code,
+			 int			code_len)
+{
+	lirc_cmd_ctx cmd;
+	char* end;
+	int ret;
+
+	ret = lircrcd_command(config, &cmd, "CODES", code, code_len);
+	if (ret != 0) {
+		if (strncmp(cmd.reply, "unknown directive", 17) == 0) {
+			lircrcd_has_codes = 0;
+			return 1;
+		}
+		return -1;
+	}
+	lircrcd_more = (int)strtol(cmd.reply, &end, 10);
+	if (end == cmd.reply)
+		return -1;
+	snprintf(lircrcd_strings, sizeof(lircrcd_strings), "%s",
+		 *end == '\n' ? end + 1 : end);
+	lircrcd_next = lircrcd_strings;
+	lircrcd_state = LIRCRCD_CACHED;
+	return 0;
+}
+
+
+/** Translate code, code_len chars, on lircrcd. */
+static int lirc_code2char_lircrcd(struct lirc_config*	config,
+				  const char*		code,
+				  int			code_len,
+				  char**		string)
 {
 	lirc_cmd_ctx cmd;
 	static char static_buff[PACKET_SIZE];
 	int ret;
-	char* my_code;
-	char* pos;
-
-	my_code = strdup(code);
-	pos = rindex(my_code, '\n');
-	if (pos != NULL)
-		*pos = '\0';
-	ret = lirc_command_init(&cmd, "CODE %s\n", my_code);
-	free(my_code);
+
+	/* A new code drops whatever is left from the previous one. */
+	if (lircrcd_state != LIRCRCD_IDLE
+	    && ((int)strlen(lircrcd_code) != code_len
+		|| strncmp(lircrcd_code, code, code_len) != 0))
+		lircrcd_state = LIRCRCD_IDLE;
+	if (lircrcd_state == LIRCRCD_IDLE && lircrcd_has_codes) {
+		snprintf(lircrcd_code, sizeof(lircrcd_code), "%.*s",
+			 code_len, code);
+		ret = lircrcd_fetch(config, code, code_len);
+		if (ret == -1)
+			return -1;
+		if (ret == 0) {
+			*string = lircrcd_pop();
+			return 0;
+		}
+	}
+	if (lircrcd_state == LIRCRCD_CACHED) {
+		*string = lircrcd_pop();
+		if (*string != NULL || lircrcd_state == LIRCRCD_IDLE)
+			return 0;
+	}
+	ret = lircrcd_command(config, &cmd, "CODE", code, code_len);
 	if (ret != 0)
 		return -1;
+	if (cmd.reply[0] == '\0') {
+		/* SUCCESS without data: no more strings. */
+		lircrcd_state = LIRCRCD_IDLE;
+		*string = NULL;
+		return 0;
+	}
+	strncpy(static_buff, cmd.reply, PACKET_SIZE);
+	*string = static_buff;
+	return 0;
+}
+
+
+int lirc_code2char(struct lirc_config* config, char* code, char** string)
+{
+	const char* pos;
+
 	if (config->sockfd != -1) {
-		do
-			ret = lirc_command_run(&cmd, config->sockfd);
-		while (ret == EAGAIN || ret == EWOULDBLOCK);
-		if (ret == 0) {
-			strncpy(static_buff, cmd.reply, PACKET_SIZE);
-			*string = static_buff;
-		}
-		return ret == 0 ? 0 : -1;
+		pos = strrchr(code, '\n');
+		return lirc_code2char_lircrcd(config, code,
+					      pos ? pos - code : strlen(code),
+					      string);
 	}
 	return lirc_code2char_internal(config, code, string, NULL);
 }
 
 
+int lirc_event2char(struct lirc_config*		config,
+		    const struct lirc_event*	event,
+		    char**			string)
+{
+	char line[sizeof(event->line)];
+	int len;
+
+	if (config->sockfd != -1 && event->line[0] == '\0') {
+		/* From a binary record, lircrcd wants the text. */
+		len = snprintf(line, sizeof(line), "%016llx %02x %s %s",
+			       event->code, event->reps,
+			       event->button, event->remote);
+		if (len >= (int)sizeof(line))
+			len = sizeof(line) - 1;
+		return lirc_code2char_lircrcd(config, line, len, string);
+	}
+	if (config->sockfd != -1)
+		return lirc_code2char_lircrcd(config, event->line,
+					      strlen(event->line), string);
+	if (event->button == NULL || event->remote == NULL) {
+		*string = NULL;
+		return 0;
+	}
+	return lirc_dispatch(config, event, string, NULL);
+}
+
+
 int lirc_code2charprog(struct lirc_config*	config,
 		       char*			code,
 		       char**			string,
@@ -1876,64 +3378,669 @@ char* lirc_nextir(void)
 }
 
 
-int lirc_nextcode(char** code)
+/** Allocate lirc_buffer on first use, return 0 if out of memory. */
+static int lirc_buffer_alloc(void)
+{
+	if (lirc_buffer != NULL)
+		return 1;
+	lirc_buffer = (char*)malloc(lirc_buffer_size + 1);
+	if (lirc_buffer == NULL) {
+		lirc_printf("%s: out of memory\n", lirc_prog);
+		return 0;
+	}
+	lirc_buffer[0] = 0;
+	lirc_buffer_len = 0;
+	return 1;
+}
+
+
+/**
+ * Remove the sequence number from the multicast datagram of len bytes
+ * in data, counting the datagrams lost before it.
+ * @return Length of the message left in data, 0 to ignore it.
+ */
+static ssize_t lirc_multicast_strip(char* data, ssize_t len)
 {
-	static int packet_size = PACKET_SIZE;
-	static int end_len = 0;
-	ssize_t len = 0;
+	unsigned long long seq;
 	char* end;
-	char c;
 
-	*code = NULL;
-	if (lirc_buffer == NULL) {
-		lirc_buffer = (char*)malloc(packet_size + 1);
-		if (lirc_buffer == NULL) {
-			lirc_printf("%s: out of memory\n", lirc_prog);
+	data[len] = '\0';
+	seq = strtoull(data, &end, 10);
+	if (end == data || *end != ' ') {
+		lirc_printf("%s: bad multicast datagram, ignored\n", lirc_prog);
+		return 0;
+	}
+	/* A lower number is a restarted lircd, and no loss. */
+	if (lirc_multicast_seq != 0 && seq > lirc_multicast_seq + 1)
+		lirc_multicast_gaps += seq - lirc_multicast_seq - 1;
+	else if (seq == lirc_multicast_seq)
+		return 0;       /* Duplicate. */
+	lirc_multicast_seq = seq;
+	end++;
+	len -= end - data;
+	memmove(data, end, len + 1);
+	return len;
+}
+
+
+/**
+ * Do one read() from lircd, making room for at least space bytes.
+ * @return -1 on errors, 0 if nothing was available, else 1.
+ */
+static int lirc_buffer_read(size_t space)
+{
+	ssize_t len;
+
+	if (lirc_multicast && space < 2 * PACKET_SIZE + 32)
+		space = 2 * PACKET_SIZE + 32;   /* A datagram is read whole. */
+	if (lirc_buffer_len + space > lirc_buffer_size) {
+		char* new_buffer;
+		size_t size;
+
+		size = lirc_buffer_size;
+		while (lirc_buffer_len + space > size)
+			size += PACKET_SIZE;
+		new_buffer = (char*)realloc(lirc_buffer, size + 1);
+		if (new_buffer == NULL)
+			return -1;
+		lirc_buffer_size = size;
+		lirc_buffer = new_buffer;
+	}
+	len = read(lirc_lircd, lirc_buffer + lirc_buffer_len,
+		   lirc_buffer_size - lirc_buffer_len);
+	if (len <= 0) {
+		if (len == -1 && errno == EAGAIN)
+			return 0;
+		else
 			return -1;
+	}
+	if (lirc_multicast) {
+		len = lirc_multicast_strip(lirc_buffer + lirc_buffer_len, len);
+		if (len == 0)
+			return 0;
+	}
+	lirc_buffer_len += len;
+	lirc_buffer[lirc_buffer_len] = 0;
+	return 1;
+}
+
+
+/**
+ * Read from lircd until lirc_buffer holds a complete line.
+ * @return -1 on errors, 0 if no complete line is available, else 1
+ *     with *end pointing to the first newline in lirc_buffer.
+ */
+static int lirc_buffer_line(char** end)
+{
+	int r;
+
+	if (!lirc_buffer_alloc())
+		return -1;
+	while ((*end = strchr(lirc_buffer, '\n')) == NULL) {
+		r = lirc_buffer_read(1);
+		if (r <= 0)
+			return r;
+		/* return if next code not yet available completely */
+		*end = strchr(lirc_buffer, '\n');
+		if (*end == NULL)
+			return 0;
+	}
+	return 1;
+}
+
+
+/** Remove the line ending at end from lirc_buffer. */
+static void lirc_buffer_consume(char* end)
+{
+	end++;
+	lirc_buffer_len = strlen(end);
+	memmove(lirc_buffer, end, lirc_buffer_len + 1);
+}
+
+
+/** Remove the first n bytes from lirc_buffer. */
+static void lirc_buffer_drop(size_t n)
+{
+	lirc_buffer_len -= n;
+	memmove(lirc_buffer, lirc_buffer + n, lirc_buffer_len + 1);
+}
+
+
+/** Handle a NAME or RESET record, 0 on errors. */
+static int lirc_record_names(const struct lirc_record* rec,
+			     const char* payload)
+{
+	char** names;
+	size_t i;
+
+	if (rec->type == LIRC_RECORD_RESET) {
+		if (rec->code != LIRC_RECORD_MAGIC) {
+			lirc_printf("%s: bad binary reset record\n",
+				    lirc_prog);
+			return 0;
 		}
-		lirc_buffer[0] = 0;
+		lirc_names_clear();
+		return 1;
 	}
-	while ((end = strchr(lirc_buffer, '\n')) == NULL) {
-		if (end_len >= packet_size) {
-			char* new_buffer;
+	if (rec->remote >= lirc_names_count) {
+		names = (char**)realloc(lirc_names,
+					(rec->remote + 1) * sizeof(char*));
+		if (names == NULL)
+			return 0;
+		for (i = lirc_names_count; i <= rec->remote; i++)
+			names[i] = NULL;
+		lirc_names = names;
+		lirc_names_count = rec->remote + 1;
+	}
+	free(lirc_names[rec->remote]);
+	lirc_names[rec->remote] = strndup(payload, rec->size);
+	return lirc_names[rec->remote] != NULL;
+}
+
+
+/** Fill event from an EVENT record, 0 if the names are unknown. */
+static int lirc_record2event(const struct lirc_record* rec,
+			     struct lirc_event* event)
+{
+	const char* button;
+	const char* remote;
+	size_t button_len;
+	size_t remote_len;
 
-			packet_size += PACKET_SIZE;
-			new_buffer =
-				(char*)realloc(lirc_buffer, packet_size + 1);
-			if (new_buffer == NULL)
+	if (rec->button >= lirc_names_count || rec->remote >= lirc_names_count)
+		return 0;
+	button = lirc_names[rec->button];
+	remote = lirc_names[rec->remote];
+	if (button == NULL || remote == NULL)
+		return 0;
+	button_len = strlen(button);
+	remote_len = strlen(remote);
+	if (button_len + remote_len + 2 > sizeof(event->names))
+		return 0;
+	event->line[0] = '\0';
+	event->code = rec->code;
+	event->reps = rec->reps;
+	memcpy(event->names, button, button_len + 1);
+	memcpy(event->names + button_len + 1, remote, remote_len + 1);
+	event->button = event->names;
+	event->remote = event->names + button_len + 1;
+	return 1;
+}
+
+
+/**
+ * Handle the complete records in lirc_buffer until an event.
+ * @return -1 on errors, 0 if there was none, else 1.
+ */
+static int lirc_record_next(struct lirc_event* event)
+{
+	struct lirc_record rec;
+	const char* payload;
+	size_t offset = 0;
+	size_t size;
+	int r = 0;
+
+	while (r == 0) {
+		size = lirc_record_get(lirc_buffer + offset,
+				       lirc_buffer_len - offset, &rec);
+		if (size == 0)
+			break;
+		payload = lirc_buffer + offset + sizeof(rec);
+		offset += size;
+		switch (rec.type) {
+		case LIRC_RECORD_EVENT:
+			r = lirc_record2event(&rec, event);
+			break;
+		case LIRC_RECORD_NAME:
+		case LIRC_RECORD_RESET:
+			if (!lirc_record_names(&rec, payload))
+				r = -1;
+			break;
+		default:
+			break;  /* TEXT: replies are not read here. */
+		}
+	}
+	lirc_buffer_drop(offset);
+	return r;
+}
+
+
+/** lirc_nextevent() for binary records. */
+static int lirc_record_read(struct lirc_event* event)
+{
+	int r;
+
+	if (!lirc_buffer_alloc())
+		return -1;
+	while ((r = lirc_record_next(event)) == 0) {
+		r = lirc_buffer_read(LIRC_BATCH_SIZE);
+		if (r <= 0)
+			return r;
+	}
+	return r;
+}
+
+
+/**
+ * Move the payloads of the complete TEXT records in lirc_buffer to the
+ * end of text, holding *text_len bytes. Other records stay in
+ * lirc_buffer for lirc_record_next().
+ * @return 0 if text is full, else 1.
+ */
+static int lirc_record_text(char* text, size_t size, size_t* text_len)
+{
+	struct lirc_record rec;
+	size_t offset = 0;
+	size_t n;
+
+	while (1) {
+		n = lirc_record_get(lirc_buffer + offset,
+				    lirc_buffer_len - offset, &rec);
+		if (n == 0)
+			return 1;
+		if (rec.type != LIRC_RECORD_TEXT) {
+			offset += n;
+			continue;
+		}
+		if (*text_len + rec.size >= size)
+			return 0;
+		memcpy(text + *text_len, lirc_buffer + offset + sizeof(rec),
+		       rec.size);
+		*text_len += rec.size;
+		text[*text_len] = '\0';
+		lirc_buffer_len -= n;
+		memmove(lirc_buffer + offset, lirc_buffer + offset + n,
+			lirc_buffer_len - offset + 1);
+	}
+}
+
+
+/**
+ * Send command to lircd and read its reply, skipping codes before it.
+ * The first data line, if any, is copied to data. After BINARY, the
+ * reply is read from the TEXT records, other records are kept.
+ * @return -1 on errors, 0 if lircd replied ERROR, else 1.
+ */
+static int lirc_lircd_command(const char* command, char* data, size_t size)
+{
+	enum { IDLE, BEGIN, COMMAND, STATUS, DATA, DATA_LINES } state = IDLE;
+	struct pollfd pfd = { lirc_lircd, POLLIN, 0 };
+	size_t command_len = strcspn(command, "\n");
+	char text[PACKET_SIZE + 1];
+	size_t text_len = 0;
+	char* buffer;
+	size_t len;
+	int failed = 0;
+	int done = 0;
+	int lines = 0;
+	char* line;
+	char* end;
+
+	if (lirc_lircd == -1 || !lirc_buffer_alloc())
+		return -1;
+	if (data != NULL && size > 0)
+		data[0] = '\0';
+	if (write(lirc_lircd, command, strlen(command)) == -1)
+		return -1;
+	while (1) {
+		if (lirc_binary) {
+			if (!lirc_record_text(text, sizeof(text), &text_len))
 				return -1;
-			lirc_buffer = new_buffer;
+			buffer = text;
+			len = text_len;
+		} else {
+			buffer = lirc_buffer;
+			len = lirc_buffer_len;
 		}
-		len = read(lirc_lircd, lirc_buffer + end_len,
-			   packet_size - end_len);
-		if (len <= 0) {
-			if (len == -1 && errno == EAGAIN)
-				return 0;
-			else
+		end = (char*)memchr(buffer, '\n', len);
+		if (end == NULL) {
+			if (curl_poll(&pfd, 1, 1000) <= 0)
 				return -1;
+			if (lirc_buffer_read(PACKET_SIZE) < 0)
+				return -1;
+			continue;
 		}
-		end_len += len;
-		lirc_buffer[end_len] = 0;
-		/* return if next code not yet available completely */
-		end = strchr(lirc_buffer, '\n');
-		if (end == NULL)
+		*end = '\0';
+		line = buffer;
+		if (strcasecmp(line, "BEGIN") == 0 && state == IDLE) {
+			state = BEGIN;
+		} else if (state == BEGIN) {
+			state = strlen(line) == command_len
+				&& strncasecmp(line, command, command_len) == 0
+				? COMMAND : IDLE;
+		} else if (state == COMMAND) {
+			failed = strcasecmp(line, "SUCCESS") != 0;
+			state = STATUS;
+		} else if (state == STATUS && strcasecmp(line, "DATA") == 0) {
+			state = DATA;
+		} else if (state == DATA) {
+			lines = atoi(line);
+			state = DATA_LINES;
+		} else if (state == DATA_LINES && lines > 0) {
+			if (data != NULL && size > 0 && data[0] == '\0')
+				snprintf(data, size, "%s", line);
+			lines--;
+		} else if (state >= STATUS && strcasecmp(line, "END") == 0) {
+			done = 1;
+		}
+		if (lirc_binary) {
+			text_len -= end + 1 - text;
+			memmove(text, end + 1, text_len + 1);
+		} else {
+			lirc_buffer_drop(end + 1 - lirc_buffer);
+		}
+		if (done)
+			break;
+	}
+	return failed ? 0 : 1;
+}
+
+
+int lirc_set_binary(void)
+{
+	if (lirc_binary)
+		return 0;
+	/* What follows the reply is binary. */
+	if (lirc_lircd_command("BINARY\n", NULL, 0) != 1)
+		return -1;
+	lirc_binary = 1;
+	return 0;
+}
+
+
+#ifdef HAVE_LINUX_FUTEX_H
+
+int lirc_use_ring(void)
+{
+	const struct lirc_ring_header* header;
+	char path[MAXPATHLEN];
+	struct stat s;
+	void* addr;
+	int fd;
+
+	if (lirc_ring != NULL)
+		return 0;
+	if (lirc_lircd_command("EVENT_RING\n", path, sizeof(path)) != 1)
+		return -1;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		lirc_perror(path);
+		return -1;
+	}
+	if (fstat(fd, &s) == -1
+	    || s.st_size < (off_t)sizeof(struct lirc_ring_header)) {
+		close(fd);
+		return -1;
+	}
+	addr = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		lirc_perror(path);
+		return -1;
+	}
+	header = (const struct lirc_ring_header*)addr;
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != LIRC_RING_MAGIC
+	    || header->slot_size != sizeof(struct lirc_ring_slot)
+	    || header->slots == 0 || (header->slots & (header->slots - 1))
+	    || (size_t)s.st_size < lirc_ring_size(header->slots)) {
+		lirc_printf("%s: bad event ring %s\n", lirc_prog, path);
+		munmap(addr, s.st_size);
+		return -1;
+	}
+	lirc_ring = header;
+	lirc_ring_len = s.st_size;
+	lirc_ring_index = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+
+/**
+ * Copy the next event in the ring to event.
+ * @return -1 if lircd has closed the ring, 0 if there was none, else 1.
+ */
+static int lirc_ring_next(struct lirc_event* event)
+{
+	const struct lirc_ring_slot* slot;
+	struct lirc_ring_slot copy;
+	uint64_t head;
+	size_t len;
+
+	while (1) {
+		head = __atomic_load_n(&lirc_ring->head, __ATOMIC_ACQUIRE);
+		if (lirc_ring_index == head) {
+			if (__atomic_load_n(&lirc_ring->flags, __ATOMIC_ACQUIRE)
+			    & LIRC_RING_CLOSED)
+				return -1;
 			return 0;
+		}
+		if (head - lirc_ring_index > lirc_ring->slots)
+			lirc_ring_index = head - lirc_ring->slots;
+		slot = lirc_ring_slot(lirc_ring, lirc_ring_index);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+		    != lirc_ring_index + 1) {
+			lirc_ring_index++;      /* Being overwritten, lost. */
+			continue;
+		}
+		memcpy(&copy, slot, sizeof(copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED)
+		    != lirc_ring_index + 1) {
+			lirc_ring_index++;
+			continue;
+		}
+		lirc_ring_index++;
+		len = copy.button_len + copy.remote_len + 2;
+		if (len > sizeof(copy.names) || len > sizeof(event->names))
+			continue;
+		event->line[0] = '\0';
+		event->code = copy.code;
+		event->reps = copy.reps;
+		memcpy(event->names, copy.names, len);
+		event->names[copy.button_len] = '\0';
+		event->names[len - 1] = '\0';
+		event->button = event->names;
+		event->remote = event->names + copy.button_len + 1;
+		return 1;
+	}
+}
+
+
+/**
+ * Wait for the ring writer if the lircd socket is blocking, dropping
+ * anything lircd sends on it meanwhile.
+ * @return -1 if lircd is gone, 0 if not waiting, else 1.
+ */
+static int lirc_ring_wait(void)
+{
+	const struct timespec timeout = { 1, 0 };
+	struct pollfd pfd = { lirc_lircd, POLLIN, 0 };
+	uint32_t futex;
+	int flags;
+
+	flags = fcntl(lirc_lircd, F_GETFL);
+	if (flags == -1)
+		return -1;
+	if (flags & O_NONBLOCK)
+		return 0;
+	while (1) {
+		futex = __atomic_load_n(&lirc_ring->futex, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&lirc_ring->head, __ATOMIC_ACQUIRE)
+		    != lirc_ring_index
+		    || (__atomic_load_n(&lirc_ring->flags, __ATOMIC_ACQUIRE)
+			& LIRC_RING_CLOSED))
+			return 1;
+		syscall(SYS_futex, &lirc_ring->futex, FUTEX_WAIT, futex,
+			&timeout, NULL, 0);
+		if (curl_poll(&pfd, 1, 0) > 0) {
+			if (lirc_buffer_read(PACKET_SIZE) < 0)
+				return -1;
+			lirc_buffer_len = 0;
+			lirc_buffer[0] = '\0';
+		}
+	}
+}
+
+
+/** lirc_nextevents() for the ring. */
+static int lirc_ring_read(struct lirc_event* events, int count)
+{
+	int n = 0;
+	int r;
+
+	if (!lirc_buffer_alloc())
+		return -1;
+	while (n < count) {
+		r = lirc_ring_next(&events[n]);
+		if (r == -1)
+			return n > 0 ? n : -1;
+		if (r == 1) {
+			n++;
+			continue;
+		}
+		if (n > 0)
+			break;
+		r = lirc_ring_wait();
+		if (r <= 0)
+			return r;
 	}
+	return n;
+}
+
+#else /* HAVE_LINUX_FUTEX_H */
+
+int lirc_use_ring(void)
+{
+	return -1;
+}
+
+static int lirc_ring_read(struct lirc_event* events, int count)
+{
+	return -1;
+}
+
+#endif /* HAVE_LINUX_FUTEX_H */
+
+
+int lirc_nextcode(char** code)
+{
+	struct lirc_event event;
+	char* end;
+	char c;
+	int r;
+
+	*code = NULL;
+	if (lirc_ring != NULL || lirc_binary) {
+		r = lirc_ring != NULL ? lirc_ring_read(&event, 1)
+		    : lirc_record_read(&event);
+		if (r <= 0)
+			return r;
+		*code = (char*)malloc(PACKET_SIZE + 1);
+		if (*code == NULL)
+			return -1;
+		snprintf(*code, PACKET_SIZE + 1, "%016llx %02x %s %s\n",
+			 event.code, event.reps, event.button, event.remote);
+		return 0;
+	}
+	r = lirc_buffer_line(&end);
+	if (r <= 0)
+		return r;
 	/* copy first line to buffer (code) and move remaining chars to
 	 * lirc_buffers start */
-	end++;
-	end_len = strlen(end);
-	c = end[0];
-	end[0] = 0;
+	c = end[1];
+	end[1] = 0;
 	*code = strdup(lirc_buffer);
-	end[0] = c;
-	memmove(lirc_buffer, end, end_len + 1);
+	end[1] = c;
+	lirc_buffer_consume(end);
 	if (*code == NULL)
 		return -1;
 	return 0;
 }
 
 
+/**
+ * Parse the line from line to the newline at end into event.
+ * @return 1 if event holds a code, else 0.
+ */
+static int lirc_line2event(char* line, char* end, struct lirc_event* event)
+{
+	if (end - line >= (ptrdiff_t)sizeof(event->line)) {
+		lirc_printf("%s: code too long, ignored\n", lirc_prog);
+		return 0;
+	}
+	*end = '\0';
+	if (lirc_event_parse(line, event) <= 0) {
+		lirc_printf("%s: bad code, ignored\n", lirc_prog);
+		return 0;
+	}
+	return 1;
+}
+
+
+int lirc_nextevent(struct lirc_event* event)
+{
+	char* end;
+	int r;
+
+	if (lirc_ring != NULL)
+		return lirc_ring_read(event, 1);
+	if (lirc_binary)
+		return lirc_record_read(event);
+	r = lirc_buffer_line(&end);
+	if (r <= 0)
+		return r;
+	r = lirc_line2event(lirc_buffer, end, event);
+	lirc_buffer_consume(end);
+	return r;
+}
+
+
+int lirc_nextevents(struct lirc_event* events, int count)
+{
+	int has_read = 0;
+	char* line;
+	char* end;
+	int n = 0;
+	int r;
+
+	if (!lirc_buffer_alloc())
+		return -1;
+	if (lirc_ring != NULL)
+		return lirc_ring_read(events, count);
+	if (lirc_binary) {
+		while (n < count) {
+			r = lirc_record_next(&events[n]);
+			if (r == -1)
+				return -1;
+			if (r == 1) {
+				n++;
+				continue;
+			}
+			if (has_read)
+				break;
+			r = lirc_buffer_read(LIRC_BATCH_SIZE);
+			if (r <= 0)
+				return r == 0 ? n : r;
+			has_read = 1;
+		}
+		return n;
+	}
+	if (strchr(lirc_buffer, '\n') == NULL) {
+		r = lirc_buffer_read(LIRC_BATCH_SIZE);
+		if (r <= 0)
+			return r;
+	}
+	/* Consume the parsed lines with a single move. */
+	line = lirc_buffer;
+	while (n < count && (end = strchr(line, '\n')) != NULL) {
+		n += lirc_line2event(line, end, &events[n]);
+		line = end + 1;
+	}
+	lirc_buffer_len -= line - lirc_buffer;
+	memmove(lirc_buffer, line, lirc_buffer_len + 1);
+	return n;
+}
+
+
 size_t lirc_getsocketname(const char* id, char* buf, size_t size)
 {
 	id = id != NULL ? id : "default";
@@ -69,6 +69,13 @@
  *         application specific string as defined in the licrrc file. Since
  *         more than one string can be returned  lirc_code2char() should be
  *         called until it returns a NULL string.
+ *       - lirc_nextevent() and lirc_event2char() do the same as
+ *         lirc_nextcode() and lirc_code2char() using a caller provided
+ *         struct lirc_event, without any heap allocations.
+ *         lirc_nextevents() drains all available codes into an array.
+ *         After lirc_set_binary() lircd sends binary records instead of
+ *         text lines, still read by these functions. After
+ *         lirc_use_ring() they read a shared memory ring instead.
  *       - The complete source for this example is in @ref irexec.cpp
  *
  * Sending (blasting) is done according to following:
@@ -153,6 +160,18 @@ struct lirc_code {
 	struct lirc_code*	next;
 };
 
+struct lirc_config_index;
+
+/** A button event from lircd, see lirc_nextevent(). */
+struct lirc_event {
+	char			line[PACKET_SIZE + 1]; /**< Code, no newline. */
+	unsigned long long	code;   /**< Scancode. */
+	int			reps;   /**< Repeat count, 0 on first press. */
+	const char*		button; /**< Button name, points into names. */
+	const char*		remote; /**< Remote name, points into names. */
+	char			names[PACKET_SIZE + 1]; /**< Private. */
+};
+
 struct lirc_config {
 	char*				lircrc_class; /**< The lircrc instance used, if any. */
 	char*				current_mode;
@@ -160,6 +179,8 @@ struct lirc_config {
 	struct lirc_config_entry*	first;
 
 	int				sockfd;
+	/** Entries by remote and button, private. NULL: linear search. */
+	struct lirc_config_index*	index;
 };
 
 struct lirc_config_entry {
@@ -203,6 +224,28 @@ typedef struct {
  */
 int lirc_init(const char* prog, int verbose);
 
+/**
+ * Initial setup for receiving the events lircd --multicast sends to a
+ * group: join it instead of connecting to lircd. lirc_nextcode(),
+ * lirc_nextevent() and lirc_nextevents() then read the datagrams. There
+ * is no connection, so commands cannot be sent and lost datagrams are
+ * not resent; they are counted by lirc_multicast_lost().
+ *
+ * @param prog Name of client in logging contexts.
+ * @param group IPv4 multicast group e. g., 239.255.76.67.
+ * @param port UDP port. If <= 0 uses hardcoded default LIRC_INET_PORT.
+ * @param verbose Amount of debug info on stdout.
+ * @return positive file descriptor or -1 on errors.
+ */
+int lirc_init_multicast(const char* prog, const char* group, int port,
+			int verbose);
+
+/**
+ * Return the number of datagrams lost since lirc_init_multicast(),
+ * found by gaps in their sequence numbers.
+ */
+unsigned long lirc_multicast_lost(void);
+
 /** Dynamically change the verbose level defined by lirc_init(). */
 void lirc_set_verbose(int verbose);
 
@@ -263,6 +306,71 @@ int lirc_nextcode(char** code);
  */
 int lirc_code2char(struct lirc_config* config, char* code, char** string);
 
+/**
+ * Get next available code from the lircd daemon, parsed into a caller
+ * provided event. Unlike lirc_nextcode() nothing is allocated. Codes
+ * which cannot be parsed are skipped.
+ *
+ * @param event Undefined on enter. On exit filled in if 1 is returned.
+ *     The button and remote pointers are only valid in this event.
+ * @return -1 on errors, 0 if no complete code was available, else 1.
+ */
+int lirc_nextevent(struct lirc_event* event);
+
+/**
+ * Get all codes available from lircd using at most one read(), like
+ * lirc_nextevent() does for a single code. Codes not fitting into
+ * events are kept for the next call.
+ *
+ * @param events Array of count events, undefined on enter. On exit the
+ *     first events, as many as returned, are filled in.
+ * @param count Size of events.
+ * @return -1 on errors, else the number of events filled in.
+ */
+int lirc_nextevents(struct lirc_event* events, int count);
+
+/**
+ * Switch the connection from lirc_init() to the binary records in
+ * event_record.h, see BINARY in lircd(8). lirc_nextcode(),
+ * lirc_nextevent() and lirc_nextevents() then work as before, without
+ * lircd formatting and the client parsing text. Codes received before
+ * the reply are dropped, so call it before reading any.
+ *
+ * @return -1 on errors, including a lircd without BINARY, else 0.
+ */
+int lirc_set_binary(void);
+
+/**
+ * Read events from the shared memory ring of lircd --event-ring instead
+ * of the connection from lirc_init(), see EVENT_RING in lircd(8). Each
+ * event is then written once by lircd, whatever the number of clients.
+ * lirc_nextcode(), lirc_nextevent() and lirc_nextevents() read the ring
+ * and block in a futex wait on it, unless the connection is non-blocking.
+ * They return -1 when lircd exits. The connection stays open, and is
+ * drained meanwhile. Events overwritten before being read are lost.
+ * It may be called before or after lirc_set_binary(). Only on Linux,
+ * for lircd on the same host.
+ *
+ * @return -1 on errors, including a lircd without a ring, else 0. If
+ *     lircd accepted the command but the ring is unusable, no events
+ *     are received any more.
+ */
+int lirc_use_ring(void);
+
+/**
+ * Translate an event from lirc_nextevent() to an application string
+ * like lirc_code2char(), without parsing the code again.
+ *
+ * @param config Parsed lircrc data from e. g. lirc_readconfig().
+ * @param event Event from lirc_nextevent().
+ * @param string On successfull exit points to a static application
+ *     string, NULL if no more translations are available.
+ * @return -1 on errors, else 0.
+ */
+int lirc_event2char(struct lirc_config*		config,
+		    const struct lirc_event*	event,
+		    char**			string);
+
 
 /* new interface for client daemon */
 /**
@@ -344,6 +452,49 @@ int lirc_command_init(lirc_cmd_ctx* ctx, const char* fmt, ...);
  */
 int lirc_command_run(lirc_cmd_ctx* ctx, int fd);
 
+/**
+ * Like lirc_command_run(), but keep all data lines of the reply in
+ * ctx->reply, newline separated, instead of only the last one.
+ *
+ * @param ctx Initiated data on enter, reply payload in ctx->reply
+ *     on exit, truncated to PACKET_SIZE.
+ * @param fd Open file connected to a lircd output socket.
+ * @return  0 on OK, else a kernel error code (possibly EAGAIN).
+ */
+int lirc_command_run_lines(lirc_cmd_ctx* ctx, int fd);
+
+/**
+ * Run several commands pipelined: the packets are written using writev()
+ * without waiting for replies, which are then matched in order.
+ *
+ * @param ctx Array of count initiated commands, replies are stored as by
+ *     lirc_command_run().
+ * @param count Number of commands.
+ * @param results If not NULL, an array of count filled with the
+ *     lirc_command_run() result for each command.
+ * @param fd Open file connected to a lircd output socket.
+ * @return  0 if all commands succeeded, else the first error code.
+ */
+int lirc_command_run_batch(lirc_cmd_ctx* ctx, int count, int* results, int fd);
+
+/**
+ * Called by lirc_command_run_notify() as soon as the reply to a
+ * command, the one at index in the array, is read or has failed.
+ */
+typedef void (*lirc_command_done)(lirc_cmd_ctx* ctx, int index,
+				  int result, void* arg);
+
+/**
+ * Like lirc_command_run_batch(), also calling done after each reply,
+ * e. g. to report or time each command while the rest are in flight.
+ *
+ * @param done Called with the command, its index, its result and arg,
+ *     may be NULL.
+ * @param arg Passed to done.
+ */
+int lirc_command_run_notify(lirc_cmd_ctx* ctx, int count, int* results,
+			    int fd, lirc_command_done done, void* arg);
+
 /**
  * Set command_ctx write_to_stdout flag. When set, the reply payload is
  * written to stdout instead of the default behavior to store it in
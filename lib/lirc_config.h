@@ -80,6 +80,9 @@
 /** Default for --repeat-max option. */
 #define DEFAULT_REPEAT_MAX      "600"
 
+/** Default for --async-log option without argument (bytes per thread). */
+#define DEFAULT_ASYNC_LOG       "65536"
+
 /** IR transmission packet size. */
 #define PACKET_SIZE             (256)
 
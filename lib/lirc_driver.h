@@ -18,7 +18,9 @@
 #include "lirc/lirc_log.h"
 #include "lirc/driver.h"
 #include "lirc/ir_remote.h"
+#include "lirc/mode2_file.h"
 #include "lirc/receive.h"
+#include "lirc/sample_ring.h"
 #include "lirc/transmit.h"
 
 extern const struct driver* hardwares[];
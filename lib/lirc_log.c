@@ -19,7 +19,11 @@
 
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -58,6 +62,53 @@ static int nodaemon = 0;
 
 static const int PRIO_LEN = 16; /**< Longest priority label, some margin. */
 
+/** Longest record in the async rings, longer messages are truncated. */
+#define LOG_RECORD_MAX 1024
+
+/** Bytes before each record: length (2) and priority (1). */
+#define LOG_RECORD_HDR 3
+
+/** Max time (ms) async records wait before being written. */
+#define LOG_FLUSH_MS 100
+
+/**
+ * Per thread ring of formatted records, written by the owning thread
+ * and read by the log thread. head and tail run freely, masked on use.
+ */
+struct log_ring {
+	char*			buf;
+	uint32_t		size;           /**< Power of two. */
+	uint32_t		head;           /**< Written by owner. */
+	uint32_t		tail;           /**< Written by log thread. */
+	unsigned long		dropped;        /**< Written by owner. */
+	unsigned long		reported;       /**< Written by log thread. */
+	int			orphan;         /**< Owner has exited. */
+	struct log_ring*	next;
+};
+
+/** Async logging state, see lirc_log_set_async(). */
+static struct {
+	int			on;
+	uint32_t		ring_size;
+	int			running;        /**< Log thread started. */
+	pthread_t		thread;
+	int			wake_fd[2];
+	int			wake_pending;
+	struct log_ring*	rings;
+	unsigned long		dropped;        /**< Total reported. */
+	int			key_created;
+	pthread_key_t		key;
+} async = { 0, 0, 0, 0, { -1, -1 }, 0, NULL, 0, 0, 0 };
+
+/** Protects async.rings and async.running. */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Held while the log thread writes, so lf can be reopened. */
+static pthread_mutex_t lf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Ring of calling thread, created on first async message. */
+static __thread struct log_ring* my_ring = NULL;
+
 
 static const char* prio2text(int prio)
 {
@@ -75,6 +126,24 @@ static const char* prio2text(int prio)
 }
 
 
+/**
+ * Return "Mmm dd hh:mm:ss" for tv, formatted by ctime_r() once a second
+ * in each thread.
+ */
+static const char* format_time(const struct timeval* tv)
+{
+	static __thread time_t cached_sec = -1;
+	static __thread char cached[32];
+
+	if (tv->tv_sec != cached_sec) {
+		ctime_r(&tv->tv_sec, cached);
+		cached[19] = '\0';
+		cached_sec = tv->tv_sec;
+	}
+	return cached + 4;
+}
+
+
 int lirc_log_use_syslog(void)
 {
 	return use_syslog;
@@ -130,12 +199,16 @@ int lirc_log_open(const char* _progname, int _nodaemon, loglevel_t level)
 		logprintf(level, "%s:  Opening log, level: %s",
 			  _progname, prio2text(level));
 	}
+	if (level > LIRC_MAX_COMPILED_LEVEL)
+		logprintf(LIRC_NOTICE,
+			  "Trace messages are disabled in this build");
 	return 0;
 }
 
 
 int lirc_log_close(void)
 {
+	lirc_log_set_async(0);
 	if (use_syslog) {
 		closelog();
 		return 0;
@@ -156,12 +229,15 @@ int lirc_log_reopen(void)
 		return 0;
 
 	log_info("closing logfile");
+	pthread_mutex_lock(&lf_lock);
 	if (-1 == fstat(fileno(lf), &s)) {
+		pthread_mutex_unlock(&lf_lock);
 		perror("Invalid logfile!");
 		return -1;
 	}
 	fclose(lf);
 	lf = fopen(logfile, "a");
+	pthread_mutex_unlock(&lf_lock);
 	if (lf == NULL) {
 		/* can't print any error messagees */
 		perror("Can't open logfile");
@@ -263,6 +339,341 @@ void perrorf(const char* format, ...)
 }
 
 
+/** Wake the log thread unless already done. */
+static void async_wake(void)
+{
+	if (__atomic_exchange_n(&async.wake_pending, 1, __ATOMIC_ACQ_REL))
+		return;
+	if (write(async.wake_fd[1], "", 1) == -1)
+		;       /* Full pipe, it's awake anyway. */
+}
+
+
+/** pthread_key destructor: the thread owning ring has exited. */
+static void ring_release(void* arg)
+{
+	struct log_ring* ring = (struct log_ring*)arg;
+	struct log_ring** p;
+
+	pthread_mutex_lock(&rings_lock);
+	if (async.running) {
+		ring->orphan = 1;       /* Freed by the log thread when empty. */
+		pthread_mutex_unlock(&rings_lock);
+		return;
+	}
+	for (p = &async.rings; *p != NULL; p = &(*p)->next) {
+		if (*p == ring) {
+			*p = ring->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&rings_lock);
+	free(ring->buf);
+	free(ring);
+}
+
+
+/** Return the ring of calling thread, creating it if required. */
+static struct log_ring* get_ring(void)
+{
+	struct log_ring* ring;
+
+	if (my_ring != NULL)
+		return my_ring;
+	ring = (struct log_ring*)calloc(1, sizeof(struct log_ring));
+	if (ring == NULL)
+		return NULL;
+	ring->size = async.ring_size;
+	ring->buf = (char*)malloc(ring->size);
+	if (ring->buf == NULL) {
+		free(ring);
+		return NULL;
+	}
+	pthread_mutex_lock(&rings_lock);
+	ring->next = async.rings;
+	async.rings = ring;
+	pthread_mutex_unlock(&rings_lock);
+	pthread_setspecific(async.key, ring);
+	my_ring = ring;
+	return ring;
+}
+
+
+/** Copy len bytes to ring at free running position pos. */
+static void ring_write(struct log_ring* ring, uint32_t pos,
+		       const void* data, uint32_t len)
+{
+	uint32_t offset = pos & (ring->size - 1);
+	uint32_t first = min(len, ring->size - offset);
+
+	memcpy(ring->buf + offset, data, first);
+	memcpy(ring->buf, (const char*)data + first, len - first);
+}
+
+
+/** Copy len bytes from ring at free running position pos. */
+static void ring_read(const struct log_ring* ring, uint32_t pos,
+		      void* data, uint32_t len)
+{
+	uint32_t offset = pos & (ring->size - 1);
+	uint32_t first = min(len, ring->size - offset);
+
+	memcpy(data, ring->buf + offset, first);
+	memcpy((char*)data + first, ring->buf, len - first);
+}
+
+
+/** Format a record into the ring of calling thread, never blocking. */
+static void async_vlog(loglevel_t prio, const char* format_str, va_list ap)
+{
+	char record[LOG_RECORD_HDR + LOG_RECORD_MAX];
+	char* text = record + LOG_RECORD_HDR;
+	struct log_ring* ring;
+	struct timeval tv;
+	uint32_t head;
+	uint32_t tail;
+	int len = 0;
+	int r;
+
+	ring = get_ring();
+	if (ring == NULL)
+		return;
+	if (!use_syslog) {
+		gettimeofday(&tv, NULL);
+		len = snprintf(text, LOG_RECORD_MAX, "%s.%06ld %s %s: ",
+			       format_time(&tv), (long) tv.tv_usec,
+			       hostname, progname);
+	}
+	len += snprintf(text + len, LOG_RECORD_MAX - len,
+			"%s: ", prio2text(prio));
+	r = vsnprintf(text + len, LOG_RECORD_MAX - len, format_str, ap);
+	len = r < 0 ? len : min(len + r, LOG_RECORD_MAX - 2);
+	text[len++] = '\n';
+	record[0] = len & 0xff;
+	record[1] = len >> 8;
+	record[2] = (char)prio;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (ring->size - (head - tail) < (uint32_t)len + LOG_RECORD_HDR) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1,
+				 __ATOMIC_RELAXED);
+		async_wake();
+		return;
+	}
+	ring_write(ring, head, record, len + LOG_RECORD_HDR);
+	__atomic_store_n(&ring->head, head + len + LOG_RECORD_HDR,
+			 __ATOMIC_RELEASE);
+	if (prio <= LIRC_WARNING || head - tail > ring->size / 2)
+		async_wake();
+}
+
+
+/** Write a record from the log thread. */
+static void write_record(int prio, const char* text, int len)
+{
+	if (use_syslog)
+		syslog(min(7, prio), "%.*s", len - 1, text);
+	else if (lf)
+		fwrite(text, 1, len, lf);
+}
+
+
+/** Write all records in ring, report drops. Called with both locks. */
+static void drain_ring(struct log_ring* ring)
+{
+	char text[LOG_RECORD_MAX];
+	unsigned char hdr[LOG_RECORD_HDR];
+	unsigned long dropped;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t len;
+	int n;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	tail = ring->tail;
+	while (tail != head) {
+		ring_read(ring, tail, hdr, LOG_RECORD_HDR);
+		len = hdr[0] | hdr[1] << 8;
+		ring_read(ring, tail + LOG_RECORD_HDR, text, len);
+		write_record(hdr[2], text, len);
+		tail += LOG_RECORD_HDR + len;
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	if (dropped != ring->reported) {
+		n = 0;
+		if (!use_syslog) {
+			struct timeval tv;
+
+			gettimeofday(&tv, NULL);
+			n = snprintf(text, sizeof(text), "%s.%06ld %s %s: ",
+				     format_time(&tv), (long) tv.tv_usec,
+				     hostname, progname);
+		}
+		n += snprintf(text + n, sizeof(text) - n,
+			      "%s: lirc_log: %lu messages dropped\n",
+			      prio2text(LIRC_WARNING),
+			      dropped - ring->reported);
+		write_record(LIRC_WARNING, text, n);
+		async.dropped += dropped - ring->reported;
+		ring->reported = dropped;
+	}
+}
+
+
+/** Write all pending records, free rings of exited threads. */
+static void drain_rings(void)
+{
+	struct log_ring** p;
+	struct log_ring* ring;
+
+	pthread_mutex_lock(&rings_lock);
+	pthread_mutex_lock(&lf_lock);
+	p = &async.rings;
+	while (*p != NULL) {
+		ring = *p;
+		drain_ring(ring);
+		if (ring->orphan) {
+			*p = ring->next;
+			free(ring->buf);
+			free(ring);
+		} else {
+			p = &ring->next;
+		}
+	}
+	if (lf)
+		fflush(lf);
+	pthread_mutex_unlock(&lf_lock);
+	pthread_mutex_unlock(&rings_lock);
+}
+
+
+/** The log thread: write records when woken or every LOG_FLUSH_MS. */
+static void* log_thread(void* arg)
+{
+	struct pollfd pfd;
+	char buff[64];
+	int on;
+
+	pfd.fd = async.wake_fd[0];
+	pfd.events = POLLIN;
+	do {
+		if (poll(&pfd, 1, LOG_FLUSH_MS) > 0) {
+			while (read(async.wake_fd[0], buff, sizeof(buff)) > 0)
+				;
+			__atomic_store_n(&async.wake_pending, 0,
+					 __ATOMIC_RELEASE);
+		}
+		on = __atomic_load_n(&async.on, __ATOMIC_ACQUIRE);
+		drain_rings();
+	} while (on);
+	return NULL;
+}
+
+
+static void atfork_prepare(void)
+{
+	pthread_mutex_lock(&rings_lock);
+	pthread_mutex_lock(&lf_lock);
+}
+
+
+static void atfork_parent(void)
+{
+	pthread_mutex_unlock(&lf_lock);
+	pthread_mutex_unlock(&rings_lock);
+}
+
+
+/** There is no log thread in the child, log synchronously. */
+static void atfork_child(void)
+{
+	pthread_mutex_unlock(&lf_lock);
+	pthread_mutex_unlock(&rings_lock);
+	if (async.running) {
+		async.on = 0;
+		async.running = 0;
+		close(async.wake_fd[0]);
+		close(async.wake_fd[1]);
+	}
+}
+
+
+size_t lirc_log_memory(void)
+{
+	const struct log_ring* ring;
+	size_t size = 0;
+
+	pthread_mutex_lock(&rings_lock);
+	for (ring = async.rings; ring != NULL; ring = ring->next)
+		size += sizeof(*ring) + ring->size;
+	pthread_mutex_unlock(&rings_lock);
+	return size;
+}
+
+
+int lirc_log_set_async(size_t ring_size)
+{
+	static int atfork_done = 0;
+	uint32_t size = 256;
+
+	if (async.running) {
+		__atomic_store_n(&async.on, 0, __ATOMIC_RELEASE);
+		async_wake();
+		pthread_join(async.thread, NULL);
+		pthread_mutex_lock(&rings_lock);
+		async.running = 0;
+		pthread_mutex_unlock(&rings_lock);
+		close(async.wake_fd[0]);
+		close(async.wake_fd[1]);
+		if (async.dropped > 0)
+			log_notice("lirc_log: %lu messages dropped in total",
+				   async.dropped);
+	}
+	if (ring_size == 0)
+		return 1;
+	if (!use_syslog && lf == NULL)
+		return 0;
+	while (size < ring_size && size < (1U << 30))
+		size <<= 1;
+	if (async.ring_size != 0 && async.ring_size != size) {
+		log_warn("lirc_log: Cannot change ring size, using %u",
+			 async.ring_size);
+		size = async.ring_size;
+	}
+	if (!async.key_created) {
+		if (pthread_key_create(&async.key, ring_release) != 0)
+			return 0;
+		async.key_created = 1;
+	}
+	if (!atfork_done) {
+		pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+		atfork_done = 1;
+	}
+	if (pipe(async.wake_fd) == -1) {
+		log_perror_warn("lirc_log: Cannot create pipe");
+		return 0;
+	}
+	fcntl(async.wake_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(async.wake_fd[1], F_SETFL, O_NONBLOCK);
+	async.ring_size = size;
+	async.wake_pending = 0;
+	async.on = 1;
+	if (pthread_create(&async.thread, NULL, log_thread, NULL) != 0) {
+		async.on = 0;
+		close(async.wake_fd[0]);
+		close(async.wake_fd[1]);
+		log_warn("lirc_log: Cannot start log thread");
+		return 0;
+	}
+	pthread_mutex_lock(&rings_lock);
+	async.running = 1;
+	pthread_mutex_unlock(&rings_lock);
+	return 1;
+}
+
+
 /**
  * Write a message to the log.
  * Caller should use the log_ macros and not call this directly.
@@ -276,23 +687,23 @@ void logprintf(loglevel_t prio, const char* format_str, ...)
 	va_list ap;
 	char buff[PRIO_LEN + strlen(format_str)];
 
-	if (use_syslog) {
+	if (__atomic_load_n(&async.on, __ATOMIC_ACQUIRE)) {
+		va_start(ap, format_str);
+		async_vlog(prio, format_str, ap);
+		va_end(ap);
+	} else if (use_syslog) {
 		snprintf(buff, sizeof(buff),
 			 "%s: %s", prio2text(prio), format_str);
 		va_start(ap, format_str);
 		vsyslog(min(7, prio), buff, ap);
 		va_end(ap);
 	} else if (lf) {
-		char* currents;
 		struct timeval tv;
-		struct timezone tz;
-
-		gettimeofday(&tv, &tz);
-		currents = ctime(&tv.tv_sec);
 
-		fprintf(lf, "%15.15s.%06ld %s %s: ",
-			currents + 4, (long) tv.tv_usec, hostname, progname);
-		fprintf(lf, "%s: ", prio2text(prio));
+		gettimeofday(&tv, NULL);
+		fprintf(lf, "%s.%06ld %s %s: %s: ",
+			format_time(&tv), (long) tv.tv_usec,
+			hostname, progname, prio2text(prio));
 		va_start(ap, format_str);
 		vfprintf(lf, format_str, ap);
 		va_end(ap);
@@ -315,7 +726,7 @@ void logperror(loglevel_t prio, const char* fmt, ...)
 	va_start(ap, fmt);
 	vsnprintf(s, sizeof(s), fmt, ap);
 	va_end(ap);
-	if (use_syslog) {
+	if (use_syslog && !__atomic_load_n(&async.on, __ATOMIC_ACQUIRE)) {
 		if (*s != '\0')
 			syslog(min(7, prio), "%s: %m\n", s);
 		else
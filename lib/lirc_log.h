@@ -85,61 +85,103 @@ extern char progname[128];
 #define logmax(l) (l > LIRC_DEBUG ? LIRC_DEBUG : l)
 #endif
 
+/**
+ * Branch hint for the log macros: messages are usually filtered out,
+ * enabled debug/trace logging is the exception.
+ */
+#ifdef __GNUC__
+#define lirc_log_unlikely(x) __builtin_expect(!!(x), 0)
+#else
+#define lirc_log_unlikely(x) (x)
+#endif
+
+/** True if messages of given level could be logged. */
+#define lirc_log_wants(level) \
+	lirc_log_unlikely((logchannel & logged_channels) && level <= loglevel)
+
+/**
+ * Highest level compiled in. With LIRC_NO_TRACE_LOG defined, as by
+ * configure --disable-trace-log, the log_trace*() macros expand to dead
+ * code: their arguments are type checked but never evaluated.
+ */
+#ifdef LIRC_NO_TRACE_LOG
+#define LIRC_MAX_COMPILED_LEVEL LIRC_DEBUG
+#else
+#define LIRC_MAX_COMPILED_LEVEL LIRC_TRACE2
+#endif
+
 /** perror wrapper logging with level LIRC_ERROR. */
 #define log_perror_err(fmt, ...) \
-	{ if ((logchannel & logged_channels) && LIRC_ERROR <= loglevel) \
+	{ if (lirc_log_wants(LIRC_ERROR)) \
 		{ logperror(LIRC_ERROR, fmt, ##__VA_ARGS__); } }
 
 /** perror wrapper logging with level LIRC_WARNING. */
 #define log_perror_warn(fmt, ...) \
-	{ if ((logchannel & logged_channels) && LIRC_WARNING <= loglevel) \
+	{ if (lirc_log_wants(LIRC_WARNING)) \
 		{ logperror(LIRC_WARNING, fmt, ##__VA_ARGS__); } }
 
 /** perror wrapper logging with level LIRC_DEBUG. */
 #define log_perror_debug(fmt, ...) \
-	{ if ((logchannel & logged_channels) && LIRC_DEBUG <= loglevel) \
+	{ if (lirc_log_wants(LIRC_DEBUG)) \
 		{ logperror(LIRC_WARNING, fmt, ##__VA_ARGS__); } }
 
 /** Log an error message. */
 #define log_error(fmt, ...) \
-	{ if ((logchannel & logged_channels) && LIRC_ERROR <= loglevel) \
+	{ if (lirc_log_wants(LIRC_ERROR)) \
 		{ logprintf(LIRC_ERROR, fmt, ##__VA_ARGS__); } }
 
 /** Log a warning message. */
 #define log_warn(fmt, ...)  \
-	{ if ((logchannel & logged_channels) && LIRC_WARNING <= loglevel) \
+	{ if (lirc_log_wants(LIRC_WARNING)) \
 		{ logprintf(LIRC_WARNING, fmt, ##__VA_ARGS__); } }
 
 /** Log an info message. */
 #define log_info(fmt, ...)  \
-	{ if ((logchannel & logged_channels) && LIRC_INFO <= loglevel) \
+	{ if (lirc_log_wants(LIRC_INFO)) \
 		{ logprintf(LIRC_INFO, fmt, ##__VA_ARGS__); } }
 
 /** Log a notice message. */
 #define log_notice(fmt, ...)  \
-	{ if ((logchannel & logged_channels) && LIRC_NOTICE <= loglevel) \
+	{ if (lirc_log_wants(LIRC_NOTICE)) \
 		{ logprintf(LIRC_NOTICE, fmt, ##__VA_ARGS__); } }
 
 /** Log a debug message. */
 #define log_debug(fmt, ...)  \
-	{ if ((logchannel & logged_channels) && LIRC_DEBUG <= loglevel) \
+	{ if (lirc_log_wants(LIRC_DEBUG)) \
 		{ logprintf(LIRC_DEBUG, fmt, ##__VA_ARGS__); } }
 
+#ifdef LIRC_NO_TRACE_LOG
+
+/* Never logged, logchannel is referenced to keep it used. */
+#define log_trace(fmt, ...)  \
+	{ if (0 && logchannel) \
+		{ logprintf(LIRC_TRACE, fmt, ##__VA_ARGS__); } }
+#define log_trace1(fmt, ...)  \
+	{ if (0 && logchannel) \
+		{ logprintf(LIRC_TRACE1, fmt, ##__VA_ARGS__); } }
+#define log_trace2(fmt, ...)  \
+	{ if (0 && logchannel) \
+		{ logprintf(LIRC_TRACE2, fmt, ##__VA_ARGS__); } }
+
+#else
+
 /** Log a trace message. */
 #define log_trace(fmt, ...)  \
-	{ if ((logchannel & logged_channels) && LIRC_TRACE <= loglevel) \
+	{ if (lirc_log_wants(LIRC_TRACE)) \
 		{ logprintf(LIRC_TRACE, fmt, ##__VA_ARGS__); } }
 
 /** Log a trace1 message. */
 #define log_trace1(fmt, ...)  \
-	{ if ((logchannel & logged_channels) && LIRC_TRACE1 <= loglevel) \
+	{ if (lirc_log_wants(LIRC_TRACE1)) \
 		{ logprintf(LIRC_TRACE1, fmt, ##__VA_ARGS__); } }
 
 /** Log a trace2 message. */
 #define log_trace2(fmt, ...)  \
-	{ if ((logchannel & logged_channels) && LIRC_TRACE2 <= loglevel) \
+	{ if (lirc_log_wants(LIRC_TRACE2)) \
 		{ logprintf(LIRC_TRACE2, fmt, ##__VA_ARGS__); } }
 
+#endif
+
 
 /**
  * Convert a string, either a number or 'info', 'trace1', error etc.
@@ -154,7 +196,8 @@ int lirc_log_setlevel(loglevel_t level);
 loglevel_t lirc_log_defaultlevel(void);
 
 /** Check if a given, standard loglevel should be printed.  */
-#define lirc_log_is_enabled_for(level) (level <= loglevel)
+#define lirc_log_is_enabled_for(level) \
+	(level <= LIRC_MAX_COMPILED_LEVEL && level <= loglevel)
 
 /** Check if log is set up to use syslog or not. */
 int lirc_log_use_syslog(void);
@@ -186,6 +229,28 @@ int lirc_log_open(const char* progname, int _nodaemon, loglevel_t level);
 /** Close the log previosly opened with lirc_log_open(). */
 int lirc_log_close(void);
 
+/**
+ * Write the log from a background thread, or stop doing so. Each thread
+ * formats its messages into a ring of its own which the log thread
+ * empties when woken by a warning or a half full ring, else every 100
+ * ms. When a ring is full messages are dropped and counted in the log,
+ * logging never blocks. Messages from different threads may be written
+ * out of order, and messages not yet written are lost on a crash.
+ *
+ * Must be called after lirc_log_open() and after daemonizing. Forked
+ * children log synchronously. The ring size cannot be changed once
+ * set.
+ *
+ * @param ring_size Size of the ring of each thread in bytes, rounded up
+ *     to a power of two. 0 writes pending messages and reverts to
+ *     synchronous logging.
+ * @return 1 if OK, 0 on errors in which case logging is synchronous.
+ */
+int lirc_log_set_async(size_t ring_size);
+
+/** Return the bytes allocated for the rings of async logging. */
+size_t lirc_log_memory(void);
+
 /**
  * Set logfile. Either a regular path or the string 'syslog'; the latter
  * does indeed use syslog(1) instead. Must be called before lirc_log_open().
@@ -30,6 +30,9 @@ static const logchannel_t logchannel = LOG_LIB;
 
 dictionary* lirc_options = NULL;
 
+/* Starts at 1, so zeroed struct lirc_option:s are refreshed. */
+unsigned int options_generation = 1;
+
 /* Environment variable which if set enables some debug output. */
 static const char* const LIRC_DEBUG_OPTIONS = "LIRC_DEBUG_OPTIONS";
 
@@ -51,10 +54,20 @@ loglevel_t options_set_loglevel(const char* optarg)
 }
 
 
+/** Invalidate all cached struct lirc_option values. */
+static void options_changed(void)
+{
+	options_generation += 1;
+	if (options_generation == 0)
+		options_generation = 1;
+}
+
+
 void options_set_opt(const char* key, const char* value)
 {
 	if (dictionary_set(lirc_options, key, value) != 0)
 		log_warn("Cannot set option %s to %s\n", key, value);
+	options_changed();
 }
 
 
@@ -76,6 +89,17 @@ int  options_getboolean(const char* const key)
 }
 
 
+void option_refresh(struct lirc_option* opt)
+{
+	const char* s = options_getstring(opt->key);
+
+	opt->string = s;
+	opt->integer = s != NULL ? (int)strtol(s, NULL, 10) : 0;
+	opt->boolean = options_getboolean(opt->key);
+	opt->generation = options_generation;
+}
+
+
 static char* parse_O_arg(int argc, char** argv)
 {
 	char* path = NULL;
@@ -135,6 +159,7 @@ void options_load(int argc, char** const argv,
 		snprintf(buff, sizeof(buff), "%s/%s", buff2, path);
 		path = buff;
 	}
+	options_changed();
 	if (access(path, R_OK) == 0) {
 		lirc_options = ciniparser_load(path);
 		if (lirc_options == NULL) {
@@ -202,6 +227,7 @@ void options_unload(void)
 {
 	depth = 0;
 	options_debug = -1;
+	options_changed();
 	if (lirc_options != NULL) {
 		dictionary_del(lirc_options);
 		lirc_options = NULL;
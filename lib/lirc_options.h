@@ -42,6 +42,53 @@ const char* options_getstring(const char* const key);
 int options_getint(const char* const key);
 int options_getboolean(const char* const key);
 
+/**
+ * An option looked up once and cached in parsed form, to be read
+ * repeatedly with option_string(), option_int() or option_boolean().
+ * Typically a static variable initialized with LIRC_OPTION(key); the
+ * cache is refreshed on first use and after the options have changed.
+ */
+struct lirc_option {
+	const char*	key;
+	unsigned int	generation;     /**< options_generation when read. */
+	const char*	string;         /**< As options_getstring(). */
+	int		integer;        /**< As options_getint(). */
+	int		boolean;        /**< As options_getboolean(). */
+};
+
+/** Initializer for a struct lirc_option reading key. */
+#define LIRC_OPTION(key) { key, 0, NULL, 0, 0 }
+
+/** Changed whenever any option is set or the options are reloaded. */
+extern unsigned int options_generation;
+
+/** Look up and parse opt->key again, used by the accessors below. */
+void option_refresh(struct lirc_option* opt);
+
+/** Return the value of opt as options_getstring(). */
+static inline const char* option_string(struct lirc_option* opt)
+{
+	if (opt->generation != options_generation)
+		option_refresh(opt);
+	return opt->string;
+}
+
+/** Return the value of opt as options_getint(). */
+static inline int option_int(struct lirc_option* opt)
+{
+	if (opt->generation != options_generation)
+		option_refresh(opt);
+	return opt->integer;
+}
+
+/** Return the value of opt as options_getboolean(). */
+static inline int option_boolean(struct lirc_option* opt)
+{
+	if (opt->generation != options_generation)
+		option_refresh(opt);
+	return opt->boolean;
+}
+
 
 /*
  * Set unset options using values in defaults list.
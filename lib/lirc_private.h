@@ -19,14 +19,19 @@
 #include "media/lirc.h"
 #endif
 
+#include "atom.h"
 #include "ir_remote_types.h"
 #include "lirc_log.h"
 #include "lirc_options.h"
 #include "lirc-utils.h"
+#include "mode2_file.h"
+#include "code_line.h"
 #include "curl_poll.h"
 #include "config_file.h"
+#include "decode_trace.h"
 #include "dump_config.h"
 #include "input_map.h"
+#include "metrics.h"
 #include "driver.h"
 #include "ir_remote_types.h"
 #include "drv_admin.h"
@@ -0,0 +1,202 @@
+/****************************************************************************
+** metrics.c ***************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file metrics.c
+ * @brief Implements metrics.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ir_remote_types.h"
+#include "metrics.h"
+
+uint64_t metrics_counters[METRIC_COUNTER_COUNT];
+struct metrics_histogram_data metrics_histograms[METRIC_HISTOGRAM_COUNT];
+
+static const struct {
+	const char* name;
+	const char* help;
+} counters[] = {
+	[METRIC_DECODED] = {
+		"lirc_decoded_total", "Codes decoded."
+	},
+	[METRIC_DECODE_FAILED] = {
+		"lirc_decode_failed_total", "Signals not matching any remote."
+	},
+	[METRIC_DECODE_RECALLED] = {
+		"lirc_decode_recalled_total",
+		"Signals decoded from a remembered burst."
+	},
+	[METRIC_REC_OVERFLOW] = {
+		"lirc_rec_overflow_total", "Receive buffer full without match."
+	},
+	[METRIC_SENT] = {
+		"lirc_sent_total", "Codes transmitted."
+	},
+	[METRIC_SEND_FAILED] = {
+		"lirc_send_failed_total", "Failed transmissions."
+	},
+	[METRIC_QUEUE_DROPPED] = {
+		"lirc_queue_dropped_total", "Client messages dropped."
+	},
+	[METRIC_CLIENT_DROPPED] = {
+		"lirc_client_dropped_total", "Clients dropped on full queue."
+	},
+	[METRIC_REPEATS_COALESCED] = {
+		"lirc_repeats_coalesced_total",
+		"Queued repeats replaced by a newer one."
+	},
+};
+
+static const struct {
+	const char* name;
+	const char* help;
+} histograms[] = {
+	[METRIC_DECODE_TIME] = {
+		"lirc_decode_seconds",
+		"Time in decode_all(), including reading the signal."
+	},
+	[METRIC_SEND_TIME] = {
+		"lirc_send_seconds", "Time spent transmitting a code."
+	},
+	[METRIC_WAKEUP_LATENCY] = {
+		"lirc_wakeup_latency_seconds",
+		"Delay of timed out waits past their deadline."
+	},
+};
+
+
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static uint64_t get(const uint64_t* counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+/** Largest value in us of bucket i, which is not the last one. */
+static uint32_t bucket_max(int i)
+{
+	int shift;
+
+	if (i < 4)
+		return i;
+	shift = (i - 4) / 4;
+	return ((5 + (i - 4) % 4) << shift) - 1;
+}
+
+
+static int write_histogram(FILE* f, int i)
+{
+	const struct metrics_histogram_data* h = &metrics_histograms[i];
+	const char* name = histograms[i].name;
+	uint64_t count = 0;
+	int lines = 0;
+	int b;
+
+	if (fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n",
+		    name, histograms[i].help, name) < 0)
+		return -1;
+	for (b = 0; b < METRICS_BUCKETS - 1; b++) {
+		count += get(&h->buckets[b]);
+		if (fprintf(f, "%s_bucket{le=\"%g\"} %llu\n", name,
+			    bucket_max(b) / 1000000.0,
+			    (unsigned long long)count) < 0)
+			return -1;
+		lines++;
+	}
+	count += get(&h->buckets[METRICS_BUCKETS - 1]);
+	if (fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n"
+		    "%s_sum %g\n%s_count %llu\n",
+		    name, (unsigned long long)count,
+		    name, get(&h->sum) / 1000000.0,
+		    name, (unsigned long long)count) < 0)
+		return -1;
+	return lines + 5;
+}
+
+
+/** Write s as a label value, escaping quotes and backslashes. */
+static int write_label(FILE* f, const char* s)
+{
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			if (fputc('\\', f) == EOF)
+				return -1;
+		}
+		if (fputc(*s == '\n' ? ' ' : *s, f) == EOF)
+			return -1;
+	}
+	return 0;
+}
+
+
+static int write_remotes(FILE* f, const struct ir_remote* remotes,
+			 const char* name, const char* help, int decoded)
+{
+	const struct ir_remote* remote;
+	int lines = 2;
+
+	if (fprintf(f, "# HELP %s %s\n# TYPE %s counter\n",
+		    name, help, name) < 0)
+		return -1;
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		if (fprintf(f, "%s{remote=\"", name) < 0
+		    || write_label(f, remote->name) < 0
+		    || fprintf(f, "\"} %llu\n", (unsigned long long)
+			       get(decoded ? &remote->stats.decoded
+					   : &remote->stats.attempts)) < 0)
+			return -1;
+		lines++;
+	}
+	return lines;
+}
+
+
+int metrics_write(FILE* f, const struct ir_remote* remotes)
+{
+	int lines = 0;
+	int r;
+	int i;
+
+	for (i = 0; i < METRIC_COUNTER_COUNT; i++) {
+		if (fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+			    counters[i].name, counters[i].help,
+			    counters[i].name, counters[i].name,
+			    (unsigned long long)get(&metrics_counters[i])) < 0)
+			return -1;
+		lines += 3;
+	}
+	for (i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+		r = write_histogram(f, i);
+		if (r < 0)
+			return -1;
+		lines += r;
+	}
+	r = write_remotes(f, remotes, "lirc_remote_attempts_total",
+			  "Signals tried on a remote.", 0);
+	if (r < 0)
+		return -1;
+	lines += r;
+	r = write_remotes(f, remotes, "lirc_remote_decoded_total",
+			  "Codes decoded by a remote.", 1);
+	if (r < 0)
+		return -1;
+	return lines + r;
+}
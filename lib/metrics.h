@@ -0,0 +1,113 @@
+/****************************************************************************
+** metrics.h ***************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file metrics.h
+ * @brief Counters and latency histograms of the receive and send paths.
+ * @ingroup private_api
+ *
+ * Counting is a relaxed atomic add, so it's done unconditionally from
+ * whatever thread decodes or sends. Latencies are kept in log-linear
+ * histograms: four buckets for each power of two microseconds, up to
+ * about 16 s. metrics_write() formats everything in the Prometheus
+ * text format, see the lircd METRICS command.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ir_remote_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Counters in metrics_counters[]. */
+enum metrics_counter {
+	METRIC_DECODED = 0,             /**< Codes decoded. */
+	METRIC_DECODE_FAILED,           /**< Signals matching no remote. */
+	METRIC_DECODE_RECALLED,         /**< Decoded by rec_buffer_recall(). */
+	METRIC_REC_OVERFLOW,            /**< rec_buffer full, no match. */
+	METRIC_SENT,                    /**< Codes transmitted. */
+	METRIC_SEND_FAILED,             /**< Failed transmissions. */
+	METRIC_QUEUE_DROPPED,           /**< Client messages dropped. */
+	METRIC_CLIENT_DROPPED,          /**< Clients dropped, queue full. */
+	METRIC_REPEATS_COALESCED,       /**< Queued repeats replaced. */
+	METRIC_COUNTER_COUNT
+};
+
+/** Histograms in metrics_histograms[]. */
+enum metrics_histogram {
+	METRIC_DECODE_TIME = 0,         /**< decode_all() duration. */
+	METRIC_SEND_TIME,               /**< Driver transmission. */
+	METRIC_WAKEUP_LATENCY,          /**< Timed wait overrun. */
+	METRIC_HISTOGRAM_COUNT
+};
+
+/** Values 0..3 us, 4 per octave up to 2^24 us, then overflow. */
+#define METRICS_BUCKETS (4 + 22 * 4 + 1)
+
+struct metrics_histogram_data {
+	uint64_t	buckets[METRICS_BUCKETS];
+	uint64_t	sum;            /**< Of all values, us. */
+};
+
+extern uint64_t metrics_counters[METRIC_COUNTER_COUNT];
+extern struct metrics_histogram_data metrics_histograms[METRIC_HISTOGRAM_COUNT];
+
+/** Add n to a counter, e. g. metrics_counters[METRIC_SENT]. */
+static inline void metrics_add(uint64_t* counter, uint64_t n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/** Increment a counter in metrics_counters[]. */
+static inline void metrics_inc(enum metrics_counter counter)
+{
+	metrics_add(&metrics_counters[counter], 1);
+}
+
+/** Return the bucket of a value in us. */
+static inline int metrics_bucket(uint32_t usecs)
+{
+	int msb;
+
+	if (usecs < 4)
+		return usecs;
+	msb = 31 - __builtin_clz(usecs);
+	if (msb >= 24)
+		return METRICS_BUCKETS - 1;
+	return 4 + (msb - 2) * 4 + ((usecs >> (msb - 2)) & 3);
+}
+
+/** Record a duration in us in a histogram. */
+static inline void metrics_observe(enum metrics_histogram histogram,
+				   uint32_t usecs)
+{
+	struct metrics_histogram_data* h = &metrics_histograms[histogram];
+
+	metrics_add(&h->buckets[metrics_bucket(usecs)], 1);
+	metrics_add(&h->sum, usecs);
+}
+
+/** Return the monotonic time in us, for metrics_observe(). */
+uint64_t metrics_now(void);
+
+/**
+ * Write all counters, histograms and the per remote decoding counters
+ * of remotes on f in the Prometheus text format.
+ *
+ * @return Number of lines written, -1 on write errors.
+ */
+int metrics_write(FILE* f, const struct ir_remote* remotes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
@@ -0,0 +1,145 @@
+/****************************************************************************
+** mode2_file.c ************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file mode2_file.c
+ * @brief Implements mode2_file.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "mode2_file.h"
+
+/** Size of a version 1 header, just the magic. */
+#define V1_HEADER_SIZE  MODE2_FILE_MAGIC_SIZE
+
+/** Bytes of the magic shared by all versions. */
+#define MAGIC_PREFIX_SIZE  (MODE2_FILE_MAGIC_SIZE - 1)
+
+
+void mode2_file_header_init(struct mode2_file_header* header,
+			    const char* driver, unsigned int resolution)
+{
+	struct timeval now;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, MODE2_FILE_MAGIC, MODE2_FILE_MAGIC_SIZE);
+	header->header_size = sizeof(*header);
+	header->resolution = resolution;
+	gettimeofday(&now, NULL);
+	header->start_sec = now.tv_sec;
+	header->start_usec = now.tv_usec;
+	if (driver != NULL)
+		strncpy(header->driver, driver, sizeof(header->driver) - 1);
+}
+
+
+int mode2_file_write_header(FILE* f,
+			    const char* driver, unsigned int resolution)
+{
+	struct mode2_file_header header;
+
+	mode2_file_header_init(&header, driver, resolution);
+	return fwrite(&header, sizeof(header), 1, f) == 1;
+}
+
+
+/**
+ * Check magic and header_size in the first bytes of buf, return the
+ * header size or -1. For version 2, size must cover header_size.
+ */
+static long check_header(const char* buf, size_t size)
+{
+	uint32_t header_size;
+
+	if (size < V1_HEADER_SIZE
+	    || memcmp(buf, MODE2_FILE_MAGIC, MAGIC_PREFIX_SIZE) != 0)
+		return -1;
+	switch (buf[MAGIC_PREFIX_SIZE]) {
+	case 1:
+		return V1_HEADER_SIZE;
+	case 2:
+		if (size < V1_HEADER_SIZE + sizeof(header_size))
+			return -1;
+		memcpy(&header_size, buf + V1_HEADER_SIZE,
+		       sizeof(header_size));
+		if (header_size < V1_HEADER_SIZE + sizeof(header_size)
+		    || header_size % sizeof(uint32_t) != 0)
+			return -1;
+		return header_size;
+	default:
+		return -1;
+	}
+}
+
+
+/** Copy the known part of a header_size bytes header at buf. */
+static void copy_header(struct mode2_file_header* header,
+			const char* buf, long header_size)
+{
+	size_t size = (size_t)header_size;
+
+	memset(header, 0, sizeof(*header));
+	if (size > sizeof(*header))
+		size = sizeof(*header);
+	memcpy(header, buf, size);
+	header->header_size = header_size;
+	header->driver[sizeof(header->driver) - 1] = '\0';
+}
+
+
+long mode2_file_parse_header(const void* buf, size_t size,
+			     struct mode2_file_header* header)
+{
+	long header_size;
+
+	header_size = check_header((const char*)buf, size);
+	if (header_size < 0 || (size_t)header_size > size)
+		return -1;
+	if (header != NULL)
+		copy_header(header, (const char*)buf, header_size);
+	return header_size;
+}
+
+
+int mode2_file_read_header(FILE* f, struct mode2_file_header* header)
+{
+	char buf[sizeof(struct mode2_file_header)];
+	size_t size = V1_HEADER_SIZE + sizeof(uint32_t);
+	long header_size;
+
+	if (fread(buf, 1, V1_HEADER_SIZE, f) != V1_HEADER_SIZE)
+		return 0;
+	if (buf[MAGIC_PREFIX_SIZE] == 1)
+		size = V1_HEADER_SIZE;
+	else if (fread(buf + V1_HEADER_SIZE, 1, sizeof(uint32_t), f)
+		 != sizeof(uint32_t))
+		return 0;
+	header_size = check_header(buf, size);
+	if (header_size < 0)
+		return 0;
+	if ((size_t)header_size > sizeof(buf)) {
+		/* A later, longer header: read what we know, skip the rest. */
+		if (fread(buf + size, 1, sizeof(buf) - size, f)
+		    != sizeof(buf) - size)
+			return 0;
+		for (size = sizeof(buf); size < (size_t)header_size; size++)
+			if (getc(f) == EOF)
+				return 0;
+	} else if (fread(buf + size, 1, header_size - size, f)
+		   != (size_t)header_size - size) {
+		return 0;
+	}
+	if (header != NULL)
+		copy_header(header, buf, header_size);
+	return 1;
+}
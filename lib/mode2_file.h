@@ -0,0 +1,95 @@
+/****************************************************************************
+** mode2_file.h ************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file mode2_file.h
+ * @brief The binary mode2 duration files read by the file driver.
+ * @ingroup driver_api
+ *
+ * Besides the "pulse 850" text lines printed by mode2(1), the file
+ * driver reads a compact binary form as written by irsimsend -o,
+ * mode2 -b and the lircd SET_INPUTLOG command. A file starts with a
+ * struct mode2_file_header, followed by the durations as lirc_t in host
+ * byte order, exactly as returned by readdata(), i. e. with PULSE_BIT
+ * set on pulses. The magic starts with a NUL, which never starts a text
+ * file, so readers can tell the two apart by the first byte.
+ *
+ * Version 1 files have no header besides the magic. Readers should
+ * skip header_size bytes, so fields can be appended to the header
+ * without changing the version.
+ */
+
+#ifndef MODE2_FILE_H
+#define MODE2_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** First bytes of a binary mode2 file, the last one is the version. */
+#define MODE2_FILE_MAGIC        "\0LIRCM2\2"
+
+/** Size of MODE2_FILE_MAGIC. */
+#define MODE2_FILE_MAGIC_SIZE   8
+
+/** Header of a version 2 file, all fields in host byte order. */
+struct mode2_file_header {
+	char		magic[MODE2_FILE_MAGIC_SIZE];
+	uint32_t	header_size;    /**< Offset of the first lirc_t. */
+	uint32_t	resolution;     /**< Driver resolution (us), 0 if unknown. */
+	int64_t		start_sec;      /**< Wall clock time when written, */
+	uint32_t	start_usec;     /**< ...seconds and microseconds. */
+	uint32_t	flags;          /**< Reserved, 0. */
+	char		driver[32];     /**< Writer's driver, NUL-terminated. */
+};
+
+/**
+ * Fill in a header for a new file, stamped with the current time.
+ *
+ * @param header Header to initialize.
+ * @param driver Name of the driver providing the data, or the writing
+ *     program. Truncated to fit, NULL is an empty name.
+ * @param resolution Driver resolution in microseconds, 0 if unknown.
+ */
+void mode2_file_header_init(struct mode2_file_header* header,
+			    const char* driver, unsigned int resolution);
+
+/**
+ * Write a new header to f as by mode2_file_header_init().
+ * @return 1 on success, 0 on write errors.
+ */
+int mode2_file_write_header(FILE* f,
+			    const char* driver, unsigned int resolution);
+
+/**
+ * Parse the header at the start of a mapped file.
+ *
+ * @param buf Start of file.
+ * @param size Size of buf.
+ * @param header If not NULL, set to the header; zeroed for version 1
+ *     files besides magic and header_size.
+ * @return Offset of the first lirc_t, or -1 if buf does not start with
+ *     a valid header.
+ */
+long mode2_file_parse_header(const void* buf, size_t size,
+			     struct mode2_file_header* header);
+
+/**
+ * Read the header from a stream positioned at its start, leaving it
+ * at the first lirc_t. Like mode2_file_parse_header(), but for pipes
+ * which cannot be mapped.
+ *
+ * @return 1 on success, 0 on a bad or truncated header.
+ */
+int mode2_file_read_header(FILE* f, struct mode2_file_header* header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODE2_FILE_H */
@@ -14,6 +14,8 @@
  * @brief Implements receive.h
  */
 
+#define _GNU_SOURCE
+
 #ifdef HAVE_CONFIG_H
 # include <config.h>
 #endif
@@ -21,7 +23,11 @@
 #include <errno.h>
 #include <limits.h>
 #include <poll.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #ifdef HAVE_KERNEL_LIRC_H
 #include <linux/lirc.h>
@@ -29,22 +35,35 @@
 #include "media/lirc.h"
 #endif
 
+#include "lirc/config_file.h"
+#include "lirc/decode_trace.h"
 #include "lirc/driver.h"
 #include "lirc/lirc_log.h"
+#include "lirc/metrics.h"
+#include "lirc/mode2_file.h"
 #include "lirc/receive.h"
 #include "lirc/ir_remote.h"
 
+/** Default and minimum rec_buffer capacity, see rec_buffer_set_size(). */
 #define RBUF_SIZE 512
+#define RBUF_SIZE_MIN 64
 
 #define REC_SYNC 8
 
+/** Binary input logs are flushed after spaces at least this long (us). */
+#define LOG_FLUSH_GAP 20000
+
 static const logchannel_t logchannel = LOG_LIB;
 
 /**
- * Structure for the receiving buffer.
+ * Structure for the receiving buffer. data is a ring of size slots
+ * where index 0 (as seen by rptr and wptr) lives at data[start], so
+ * dropping already decoded edges does not move the rest.
  */
 struct rbuf {
-	lirc_t		data[RBUF_SIZE];
+	lirc_t*		data;
+	int		size;
+	int		start;
 	ir_code		decoded;
 	int		rptr;
 	int		wptr;
@@ -53,17 +72,259 @@ struct rbuf {
 	lirc_t		pendingp;
 	lirc_t		pendings;
 	lirc_t		sum;
-	struct timeval	last_signal_time;
+	struct timeval	read_time;      /**< Monotonic time of last read. */
 	int		at_eof;
+	int		timed_out;      /**< A read timed out since rewind. */
+	int		end_report;     /**< Only a timeout report was read. */
+	unsigned int	generation;     /**< Changes when data is replaced. */
+	int		repeat;         /**< LIRC_MODE_SCANCODE repeat flag. */
 	FILE*		input_log;
+	int		input_log_binary;
+};
+
+/** The timing block at the start of struct ir_remote, see same_timing(). */
+#define TIMING_BEGIN offsetof(struct ir_remote, rc6_mask)
+#define TIMING_SIZE \
+	(offsetof(struct ir_remote, stop_bits) + sizeof(unsigned int) \
+	 - TIMING_BEGIN)
+
+/**
+ * Where a successful decode_pulses() walk reached the trailing gap,
+ * recorded for rec_buffer_remember().
+ */
+struct walk_mark {
+	struct ir_remote*	remote;         /**< NULL if not rememberable. */
+	unsigned int		generation;     /**< rec_buffer generation. */
+	int			rptr;           /**< Edges read, sync included. */
+	lirc_t			sum;
+	lirc_t			sync;
+	ir_code			pre;
+	ir_code			code;
+	ir_code			post;
+};
+
+/** rec_buffer read state, restored when reusing a decode_memo. */
+struct rbuf_state {
+	int		rptr;
+	int		too_long;
+	int		is_biphase;
+	lirc_t		pendingp;
+	lirc_t		pendings;
+	lirc_t		sum;
+	int		at_eof;
+};
+
+/**
+ * Remotes with the same timing walk rec_buffer in exactly the same way,
+ * the codes themselves are only matched later by get_code(). The result
+ * of the walk is thus remembered for each timing seen while decoding the
+ * current buffer, and reused for the following remotes instead of parsing
+ * the same pulses and spaces once again.
+ */
+struct decode_memo {
+	char			timing[TIMING_SIZE]; /**< Of the first remote. */
+	struct walk_mark	mark;           /**< Of the first remote. */
+	const struct ir_remote*	last_remote;    /**< Used by the sync. */
+	unsigned int		generation;     /**< rec_buffer generation. */
+	int			result;         /**< decode_pulses() result */
+	lirc_t			sync;
+	ir_code			pre;
+	ir_code			code;
+	ir_code			post;
+	struct rbuf_state	state;          /**< After the walk. */
+};
+
+#define MEMO_SIZE 8
+
+/** Bursts remembered across buffers by a context. */
+#define RECALL_SIZE 16
+
+/** Largest number of edges of a remembered burst, sync included. */
+#define RECALL_EDGES 128
+
+/**
+ * The durations of the edges read while decoding a buffer for which all
+ * checks made on them give the same results, recorded until a remote
+ * matches. A buffer with the same edge count and each edge within the
+ * range of this one is decoded in exactly the same way, by the same
+ * remote.
+ */
+struct rbuf_envelope {
+	int			active;         /**< Recording. */
+	const struct ir_remote*	remotes;        /**< Decoded list. */
+	const struct ir_remote*	last_remote;    /**< When recorded. */
+	unsigned int		generation;     /**< rec_buffer generation. */
+	int			count;          /**< Edges read, from index 0. */
+	lirc_t			min[RECALL_EDGES]; /**< PULSE_BIT included. */
+	lirc_t			max[RECALL_EDGES];
+};
+
+/** A burst decoded earlier with its envelope, see rec_buffer_recall(). */
+struct recall {
+	const struct ir_remote*	remotes;        /**< Head of list, NULL: free. */
+	const struct ir_remote*	last_remote;
+	struct ir_remote*	remote;
+	unsigned int		epoch;          /**< recall_epoch when made. */
+	uint32_t		key;            /**< Hash of quantized edges. */
+	unsigned int		used;           /**< LRU stamp. */
+	int			count;
+	int			rptr;           /**< After the walk of remote. */
+	lirc_t			sum_delta;      /**< sum less the edges' sum. */
+	ir_code			pre;
+	ir_code			code;
+	ir_code			post;
+	lirc_t			min[RECALL_EDGES];
+	lirc_t			max[RECALL_EDGES];
+};
+
+/** A verified struct recall, used by the next decode of its remote. */
+struct recall_hit {
+	struct ir_remote*	remote;         /**< NULL if none. */
+	unsigned int		generation;     /**< rec_buffer generation. */
+	int			rptr;
+	lirc_t			sum;
+	lirc_t			sync;
+	ir_code			pre;
+	ir_code			code;
+	ir_code			post;
+};
+
+/** Items fetched by one readdata_bulk() call. */
+#define READAHEAD_SIZE 256
+
+/**
+ * The sync gap found in the current buffer, the same for all remotes but
+ * RC-MM ones. Remotes with a header whose first pulse does not match the
+ * pulse following the sync are rejected without decoding.
+ */
+struct burst_info {
+	const struct ir_remote*	last_remote;    /**< Used by the sync. */
+	unsigned int		generation;     /**< rec_buffer generation. */
+	lirc_t			sync;           /**< 0: no sync found. */
+	struct rbuf_state	state;          /**< After the sync. */
 };
 
 
+/** Data read by the driver's readdata_bulk() but not yet by readdata(). */
+struct readahead_buf {
+	lirc_t	data[READAHEAD_SIZE];
+	int	rptr;
+	int	count;
+};
+
+/** Durations queued by rec_buffer_inject(), read before the driver's. */
+struct inject_buf {
+	lirc_t*	data;
+	int	rptr;
+	int	count;
+	int	size;
+	int	draining;       /**< No driver input while decoding it. */
+};
+
 /**
- * Global receiver buffer.
+ * All state of a receiver. Each concurrently decoded input needs its
+ * own, see rec_context_select().
  */
-static struct rbuf rec_buffer;
-static int update_mode = 0;
+struct rec_context {
+	struct rbuf		rbuf;
+	int			update_mode;
+	struct decode_memo	memos[MEMO_SIZE];
+	int			memo_next;
+	struct walk_mark	walk;
+	struct rbuf_envelope	envelope;
+	struct recall		recalls[RECALL_SIZE];
+	unsigned int		recall_clock;
+	struct recall_hit	recalled;
+	struct burst_info	burst;
+	struct readahead_buf	readahead;
+	struct inject_buf	injected;
+	struct ir_remote*	last_remote;    /**< While not selected. */
+};
+
+
+/** Storage for rec_buffer until rec_buffer_set_size() is used. */
+static lirc_t rbuf_default_data[RBUF_SIZE];
+
+/** Used by threads until they select another context. */
+static struct rec_context default_context = {
+	.rbuf = { .data = rbuf_default_data, .size = RBUF_SIZE }
+};
+
+/** The context used by the calling thread. */
+static LIRC_THREAD_LOCAL struct rec_context* rec_ctx = &default_context;
+
+/* Shorthands for the members of the current context. */
+#define rec_buffer	(rec_ctx->rbuf)
+#define update_mode	(rec_ctx->update_mode)
+#define memos		(rec_ctx->memos)
+#define memo_next	(rec_ctx->memo_next)
+#define walk		(rec_ctx->walk)
+#define envelope	(rec_ctx->envelope)
+#define recalls		(rec_ctx->recalls)
+#define recall_clock	(rec_ctx->recall_clock)
+#define recalled	(rec_ctx->recalled)
+#define burst		(rec_ctx->burst)
+#define readahead	(rec_ctx->readahead)
+#define inject		(rec_ctx->injected)
+
+/** If set, read_time is the sum of the durations read in each context. */
+static int virtual_clock = 0;
+
+/** If set, a frame is complete when its last edge is read, see get_end(). */
+static int low_latency = 0;
+
+/** If set, bursts are remembered, see rec_buffer_recall(). */
+static int recall_enabled = 0;
+
+/** Bumped when remotes are freed, voiding all struct recall. */
+static unsigned int recall_epoch = 0;
+
+
+struct rec_context* rec_context_new(void)
+{
+	struct rec_context* ctx;
+
+	ctx = (struct rec_context*)calloc(1, sizeof(struct rec_context));
+	if (ctx == NULL) {
+		log_error("Out of memory for rec_context");
+		return NULL;
+	}
+	ctx->rbuf.data = (lirc_t*)calloc(RBUF_SIZE, sizeof(lirc_t));
+	if (ctx->rbuf.data == NULL) {
+		log_error("Out of memory for rec_context");
+		free(ctx);
+		return NULL;
+	}
+	ctx->rbuf.size = RBUF_SIZE;
+	return ctx;
+}
+
+
+void rec_context_free(struct rec_context* ctx)
+{
+	if (ctx == NULL || ctx == &default_context)
+		return;
+	if (ctx == rec_ctx)
+		rec_context_select(NULL);
+	if (ctx->rbuf.input_log != NULL)
+		fclose(ctx->rbuf.input_log);
+	free(ctx->rbuf.data);
+	free(ctx->injected.data);
+	free(ctx);
+}
+
+
+struct rec_context* rec_context_select(struct rec_context* ctx)
+{
+	struct rec_context* old = rec_ctx;
+
+	if (ctx == NULL)
+		ctx = &default_context;
+	old->last_remote = last_remote;
+	rec_ctx = ctx;
+	last_remote = ctx->last_remote;
+	return old == &default_context ? NULL : old;
+}
 
 
 void rec_set_update_mode(int mode)
@@ -74,11 +335,113 @@ void rec_set_update_mode(int mode)
 int (*lircd_waitfordata)(uint32_t timeout) = NULL;
 
 
+static int has_readdata_bulk(void)
+{
+	return curr_driver->api_version >= 4
+	       && curr_driver->readdata_bulk != NULL;
+}
+
+
+/** Advance the virtual clock by a duration. */
+static void virtual_clock_add(lirc_t usec)
+{
+	if (!timerisset(&rec_buffer.read_time))
+		get_monotonic_time(&rec_buffer.read_time);
+	rec_buffer.read_time.tv_sec += usec / 1000000;
+	rec_buffer.read_time.tv_usec += usec % 1000000;
+	if (rec_buffer.read_time.tv_usec >= 1000000) {
+		rec_buffer.read_time.tv_sec += 1;
+		rec_buffer.read_time.tv_usec -= 1000000;
+	}
+}
+
+
+void rec_set_virtual_clock(int enabled)
+{
+	if (enabled && !virtual_clock)
+		get_monotonic_time(&rec_buffer.read_time);
+	virtual_clock = enabled ? 1 : 0;
+}
+
+
+int rec_get_virtual_clock(void)
+{
+	return virtual_clock;
+}
+
+
+void rec_set_low_latency(int enabled)
+{
+	low_latency = enabled ? 1 : 0;
+}
+
+
+int rec_get_low_latency(void)
+{
+	return low_latency;
+}
+
+
+void rec_set_recall(int enabled)
+{
+	recall_enabled = enabled ? 1 : 0;
+}
+
+
+void rec_buffer_forget_remotes(void)
+{
+	__atomic_add_fetch(&recall_epoch, 1, __ATOMIC_RELEASE);
+}
+
+
+void rec_get_time(struct timeval* tv)
+{
+	if (virtual_clock)
+		*tv = rec_buffer.read_time;
+	else
+		get_monotonic_time(tv);
+}
+
+
 static lirc_t readdata(lirc_t timeout)
 {
 	lirc_t data;
+	int fresh = 0;
 
-	data = curr_driver->readdata(timeout);
+	if (inject.draining) {
+		if (inject.rptr == inject.count)
+			return 0;
+		data = inject.data[inject.rptr++];
+		fresh = 1;
+	} else if (readahead.rptr < readahead.count) {
+		data = readahead.data[readahead.rptr++];
+	} else if (has_readdata_bulk()) {
+		readahead.rptr = 0;
+		readahead.count = curr_driver->readdata_bulk(readahead.data,
+							     READAHEAD_SIZE,
+							     timeout);
+		if (readahead.count <= 0) {
+			readahead.count = 0;
+			decode_trace_add(DT_TIMEOUT, 0, timeout, 0);
+			if (virtual_clock)
+				virtual_clock_add(timeout);
+			return 0;
+		}
+		fresh = 1;
+		data = readahead.data[readahead.rptr++];
+	} else {
+		data = curr_driver->readdata(timeout);
+		fresh = data != 0;
+	}
+	if (data)
+		decode_trace_add(DT_SAMPLE, 0, data, 0);
+	else
+		decode_trace_add(DT_TIMEOUT, 0, timeout, 0);
+	if (virtual_clock)
+		/* The sample ends when it is read, a timeout after waiting. */
+		virtual_clock_add(data ? data & PULSE_MASK : timeout);
+	else if (fresh)
+		get_monotonic_time(&rec_buffer.read_time);
 	rec_buffer.at_eof = data & LIRC_EOF ? 1 : 0;
 	if (rec_buffer.at_eof)
 		log_debug("receive: Got EOF");
@@ -106,34 +469,169 @@ static void set_pending_space(lirc_t deltas)
 
 static void log_input(lirc_t data)
 {
+	if (rec_buffer.input_log_binary) {
+		fwrite(&data, sizeof(data), 1, rec_buffer.input_log);
+		/* Flushed at the end of each signal rather than per sample. */
+		if (!(data & PULSE_BIT) && (data & PULSE_MASK) >= LOG_FLUSH_GAP)
+			fflush(rec_buffer.input_log);
+		return;
+	}
 	fprintf(rec_buffer.input_log, "%s %u\n",
 		data & PULSE_BIT ? "pulse" : "space", data & PULSE_MASK);
 	fflush(rec_buffer.input_log);
 }
 
 
+/** Return the slot in the rec_buffer ring holding index i. */
+static inline lirc_t* rbuf_slot(int i)
+{
+	i += rec_buffer.start;
+	if (i >= rec_buffer.size)
+		i -= rec_buffer.size;
+	return &rec_buffer.data[i];
+}
+
+
+/**
+ * Add the edges up to index to the envelope being recorded, if any.
+ * @return True if the edge at index is recorded.
+ */
+static int envelope_touch(int index)
+{
+	lirc_t bit;
+
+	if (!envelope.active)
+		return 0;
+	if (envelope.generation != rec_buffer.generation
+	    || index >= RECALL_EDGES) {
+		envelope.active = 0;
+		return 0;
+	}
+	while (envelope.count <= index) {
+		bit = *rbuf_slot(envelope.count) & PULSE_BIT;
+		envelope.min[envelope.count] = bit;
+		envelope.max[envelope.count] = bit | PULSE_MASK;
+		envelope.count++;
+	}
+	return 1;
+}
+
+
+/** envelope_check() while recording. */
+static void envelope_narrow(int index, lirc_t min, lirc_t max)
+{
+	lirc_t data;
+	lirc_t bit;
+
+	if (!envelope_touch(index))
+		return;
+	data = *rbuf_slot(index);
+	bit = data & PULSE_BIT;
+	data &= PULSE_MASK;
+	min = min < 0 ? 0 : min;
+	max = max > PULSE_MASK ? PULSE_MASK : max;
+	if (data < min) {
+		if (envelope.max[index] > (bit | (min - 1)))
+			envelope.max[index] = bit | (min - 1);
+	} else if (data > max) {
+		if (envelope.min[index] < (bit | (max + 1)))
+			envelope.min[index] = bit | (max + 1);
+	} else {
+		if (envelope.min[index] < (bit | min))
+			envelope.min[index] = bit | min;
+		if (envelope.max[index] > (bit | max))
+			envelope.max[index] = bit | max;
+	}
+}
+
+
+/**
+ * Record that the result of checking the duration of the edge at index
+ * against the range min..max decides how the buffer is decoded: narrow
+ * the envelope of the edge to the durations giving the same result.
+ */
+static inline void envelope_check(int index, lirc_t min, lirc_t max)
+{
+	if (envelope.active)
+		envelope_narrow(index, min, max);
+}
+
+
+/** Least delta passing expect_at_least(remote, delta, exdelta). */
+static lirc_t at_least_limit(const struct ir_remote* remote, lirc_t exdelta)
+{
+	int aeps = curr_driver->resolution > remote->aeps ?
+		   curr_driver->resolution : remote->aeps;
+	lirc_t tolerance = exdelta * remote->eps / 100;
+
+	return exdelta - (tolerance > aeps ? tolerance : aeps);
+}
+
+
+/**
+ * envelope_check() for expect(remote, delta, exdelta) where the edge at
+ * index is exdelta. The exdelta passing it are a range around delta.
+ */
+static void envelope_check_reversed(const struct ir_remote*	remote,
+				    int				index,
+				    lirc_t			delta)
+{
+	lirc_t lo = 0;
+	lirc_t hi = delta;
+	lirc_t mid;
+	lirc_t min;
+
+	if (!envelope.active)
+		return;
+	while (lo < hi) {       /* Least passing exdelta. */
+		mid = lo + (hi - lo) / 2;
+		if (expect(remote, delta, mid))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	min = lo;
+	hi = PULSE_MASK;
+	while (lo < hi) {       /* Largest passing exdelta. */
+		mid = lo + (hi - lo + 1) / 2;
+		if (expect(remote, delta, mid))
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	envelope_check(index, min, lo);
+}
+
+
+/** Largest delta passing expect_at_most(remote, delta, exdelta). */
+static lirc_t at_most_limit(const struct ir_remote* remote, lirc_t exdelta)
+{
+	int aeps = curr_driver->resolution > remote->aeps ?
+		   curr_driver->resolution : remote->aeps;
+	lirc_t tolerance = exdelta * remote->eps / 100;
+
+	return exdelta + (tolerance > aeps ? tolerance : aeps);
+}
+
+
 static lirc_t get_next_rec_buffer_internal(lirc_t maxusec)
 {
+	lirc_t* slot;
+
 	if (rec_buffer.rptr < rec_buffer.wptr) {
-		log_trace2("<%c%lu", rec_buffer.data[rec_buffer.rptr] & PULSE_BIT ? 'p' : 's', (uint32_t)
-			  rec_buffer.data[rec_buffer.rptr] & (PULSE_MASK));
-		rec_buffer.sum += rec_buffer.data[rec_buffer.rptr] & (PULSE_MASK);
-		return rec_buffer.data[rec_buffer.rptr++];
+		slot = rbuf_slot(rec_buffer.rptr++);
+		log_trace2("<%c%lu", *slot & PULSE_BIT ? 'p' : 's', (uint32_t)
+			  *slot & (PULSE_MASK));
+		rec_buffer.sum += *slot & (PULSE_MASK);
+		return *slot;
 	}
-	if (rec_buffer.wptr < RBUF_SIZE) {
-		lirc_t data = 0;
-		unsigned long elapsed = 0;
-
-		if (timerisset(&rec_buffer.last_signal_time)) {
-			struct timeval current;
+	if (rec_buffer.wptr < rec_buffer.size) {
+		lirc_t data;
 
-			gettimeofday(&current, NULL);
-			elapsed = time_elapsed(&rec_buffer.last_signal_time, &current);
-		}
-		if (elapsed < maxusec)
-			data = readdata(maxusec - elapsed);
+		data = readdata(maxusec);
 		if (!data) {
 			log_trace2("timeout: %u", maxusec);
+			rec_buffer.timed_out = 1;
 			return 0;
 		}
 		if (data & LIRC_EOF) {
@@ -144,23 +642,25 @@ static lirc_t get_next_rec_buffer_internal(lirc_t maxusec)
 			log_trace("timeout received: %lu", (uint32_t)LIRC_VALUE(data));
 			if (LIRC_VALUE(data) < maxusec)
 				return get_next_rec_buffer_internal(maxusec - LIRC_VALUE(data));
+			rec_buffer.timed_out = 1;
 			return 0;
 		}
 
-		rec_buffer.data[rec_buffer.wptr] = data;
+		slot = rbuf_slot(rec_buffer.wptr);
+		*slot = data;
 		if (rec_buffer.input_log != NULL)
 			log_input(data);
-		if (rec_buffer.data[rec_buffer.wptr] == 0)
+		if (*slot == 0)
 			return 0;
-		rec_buffer.sum += rec_buffer.data[rec_buffer.rptr]
-				  & (PULSE_MASK);
+		rec_buffer.sum += *slot & (PULSE_MASK);
 		rec_buffer.wptr++;
 		rec_buffer.rptr++;
-		log_trace2("+%c%lu", rec_buffer.data[rec_buffer.rptr - 1] & PULSE_BIT ? 'p' : 's', (uint32_t)
-			  rec_buffer.data[rec_buffer.rptr - 1]
-			  & (PULSE_MASK));
-		return rec_buffer.data[rec_buffer.rptr - 1];
+		log_trace2("+%c%lu", *slot & PULSE_BIT ? 'p' : 's', (uint32_t)
+			  *slot & (PULSE_MASK));
+		return *slot;
 	}
+	if (!rec_buffer.too_long)
+		metrics_inc(METRIC_REC_OVERFLOW);
 	rec_buffer.too_long = 1;
 	return 0;
 }
@@ -177,6 +677,11 @@ int waitfordata(uint32_t maxusec)
 	int ret;
 	struct pollfd pfd = {
 		.fd = curr_driver->fd, .events = POLLIN, .revents = 0 };
+#ifdef HAVE_PPOLL
+	struct timespec ts = {
+		.tv_sec = maxusec / 1000000,
+		.tv_nsec = (maxusec % 1000000) * 1000 };
+#endif
 
 	if (lircd_waitfordata != NULL)
 		return lircd_waitfordata(maxusec);
@@ -184,7 +689,13 @@ int waitfordata(uint32_t maxusec)
 	while (1) {
 		do {
 			do {
-				ret = curl_poll(&pfd, 1, (maxusec > 0) ? (maxusec / 1000) : -1);
+#ifdef HAVE_PPOLL
+				/* Sub-ms timeouts would be 0 ms for poll(). */
+				ret = ppoll(&pfd, 1, maxusec > 0 ? &ts : NULL, NULL);
+#else
+				ret = curl_poll(&pfd, 1, (maxusec > 0) ?
+						(maxusec + 999) / 1000 : -1);
+#endif
 				if (maxusec > 0 && ret == 0)
 					return 0;
 			} while (ret == -1 && errno == EINTR);
@@ -206,17 +717,133 @@ void rec_buffer_set_logfile(FILE* f)
 	if (rec_buffer.input_log != NULL)
 		fclose(rec_buffer.input_log);
 	rec_buffer.input_log = f;
+	rec_buffer.input_log_binary = 0;
+}
+
+
+int rec_buffer_set_binary_logfile(FILE* f)
+{
+	rec_buffer_set_logfile(NULL);
+	if (f == NULL)
+		return 1;
+	if (!mode2_file_write_header(f, curr_driver->name,
+				     curr_driver->resolution)) {
+		fclose(f);
+		return 0;
+	}
+	fflush(f);
+	rec_buffer.input_log = f;
+	rec_buffer.input_log_binary = 1;
+	return 1;
 }
 
 
 static lirc_t get_next_rec_buffer(lirc_t maxusec)
 {
-	return get_next_rec_buffer_internal(receive_timeout(maxusec));
+	lirc_t data;
+
+	data = get_next_rec_buffer_internal(receive_timeout(maxusec));
+	if (envelope.active) {
+		/* Timeouts and EOF are not in the edges. */
+		if (data == 0 || data & LIRC_EOF)
+			envelope.active = 0;
+		else
+			envelope_touch(rec_buffer.rptr - 1);
+	}
+	return data;
 }
 
 void rec_buffer_init(void)
 {
+	unsigned int generation = rec_buffer.generation;
+	lirc_t* data = rec_buffer.data;
+	int size = rec_buffer.size;
+
 	memset(&rec_buffer, 0, sizeof(rec_buffer));
+	readahead.rptr = readahead.count = 0;
+	rec_buffer.data = data;
+	rec_buffer.size = size;
+	rec_buffer.generation = generation + 1;
+}
+
+int rec_buffer_pending(void)
+{
+	if (readahead.count > readahead.rptr)
+		return readahead.count - readahead.rptr;
+	if (curr_driver->api_version >= 4
+	    && curr_driver->rec_pending != NULL
+	    && curr_driver->rec_pending())
+		return 1;
+	return 0;
+}
+
+int rec_buffer_inject(const lirc_t* data, int count)
+{
+	lirc_t* buf;
+	int size;
+
+	if (inject.rptr == inject.count)
+		inject.rptr = inject.count = 0;
+	if (inject.count + count > inject.size) {
+		size = inject.size > 0 ? inject.size : 256;
+		while (size < inject.count + count)
+			size *= 2;
+		buf = (lirc_t*)realloc(inject.data, size * sizeof(lirc_t));
+		if (buf == NULL) {
+			log_error("Out of memory for injected input");
+			return 0;
+		}
+		inject.data = buf;
+		inject.size = size;
+	}
+	memcpy(inject.data + inject.count, data, count * sizeof(lirc_t));
+	inject.count += count;
+	return 1;
+}
+
+char* rec_buffer_decode_injected(struct ir_remote* remotes)
+{
+	char* message = NULL;
+	int rptr;
+
+	inject.draining = 1;
+	while (message == NULL) {
+		/* The decoder may have read ahead beyond the last code. */
+		rptr = inject.rptr;
+		if (rptr == inject.count && rec_buffer.rptr == rec_buffer.wptr)
+			break;
+		if (!rec_buffer_clear())
+			break;
+		message = decode_all(remotes);
+		if (message == NULL && inject.rptr == rptr)
+			break;
+	}
+	inject.draining = 0;
+	return message;
+}
+
+int rec_buffer_set_size(int size)
+{
+	lirc_t* data;
+
+	if (size < RBUF_SIZE_MIN) {
+		log_error("rec_buffer size %d is less than %d",
+			  size, RBUF_SIZE_MIN);
+		return 0;
+	}
+	if (size == rec_buffer.size)
+		return 1;
+	data = (lirc_t*)calloc(size, sizeof(lirc_t));
+	if (data == NULL) {
+		log_error("Out of memory for rec_buffer");
+		return 0;
+	}
+	if (rec_buffer.data != rbuf_default_data)
+		free(rec_buffer.data);
+	rec_buffer.data = data;
+	rec_buffer.size = size;
+	rec_buffer_init();
+	return 1;
 }
 
 void rec_buffer_rewind(void)
@@ -232,13 +859,36 @@ void rec_buffer_rewind(void)
 void rec_buffer_reset_wptr(void)
 {
 	rec_buffer.wptr = 0;
+	rec_buffer.generation++;
+}
+
+/**
+ * Return the index of the longest space in the buffer, 0 if there
+ * is none after index 0.
+ */
+static int longest_space(void)
+{
+	lirc_t data;
+	lirc_t longest = 0;
+	int found = 0;
+	int i;
+
+	for (i = 1; i < rec_buffer.wptr; i++) {
+		data = *rbuf_slot(i);
+		if (!is_space(data))
+			continue;
+		if ((data & PULSE_MASK) > longest) {
+			longest = data & PULSE_MASK;
+			found = i;
+		}
+	}
+	return found;
 }
 
 int rec_buffer_clear(void)
 {
 	int move, i;
 
-	timerclear(&rec_buffer.last_signal_time);
 	if (curr_driver->rec_mode == LIRC_MODE_LIRCCODE) {
 		unsigned char buffer[curr_driver->code_length/CHAR_BIT + 1];
 		size_t count;
@@ -251,41 +901,70 @@ int rec_buffer_clear(void)
 			log_error("reading in mode LIRC_MODE_LIRCCODE failed");
 			return 0;
 		}
+		get_monotonic_time(&rec_buffer.read_time);
 		for (i = 0, rec_buffer.decoded = 0; i < count; i++)
 			rec_buffer.decoded = (rec_buffer.decoded << CHAR_BIT) + ((ir_code)buffer[i]);
 	} else {
 		lirc_t data;
 
 		move = rec_buffer.wptr - rec_buffer.rptr;
+		if (move == 0 && rec_buffer.too_long) {
+			/* Overflowed without a match: keep the edges from
+			 * the longest gap, the best guess for the next
+			 * sync, rather than dropping them all. */
+			move = rec_buffer.wptr - longest_space();
+			rec_buffer.rptr = rec_buffer.wptr - move;
+		}
 		if (move > 0 && rec_buffer.rptr > 0) {
-			memmove(&rec_buffer.data[0], &rec_buffer.data[rec_buffer.rptr],
-				sizeof(rec_buffer.data[0]) * move);
+			rec_buffer.start += rec_buffer.rptr;
+			if (rec_buffer.start >= rec_buffer.size)
+				rec_buffer.start -= rec_buffer.size;
 			rec_buffer.wptr -= rec_buffer.rptr;
 		} else {
+			rec_buffer.start = 0;
 			rec_buffer.wptr = 0;
 			data = readdata(0);
 
 			log_trace2("c%lu", (uint32_t)data & (PULSE_MASK));
 
-			rec_buffer.data[rec_buffer.wptr] = data;
-			rec_buffer.wptr++;
+			if (LIRC_IS_TIMEOUT(data)) {
+				/* End of a signal already decoded without
+				 * waiting for it, nothing to decode. The
+				 * gap itself follows as a space. */
+				rec_buffer.end_report = 1;
+			} else {
+				rec_buffer.end_report = 0;
+				*rbuf_slot(rec_buffer.wptr) = data;
+				rec_buffer.wptr++;
+			}
 		}
 	}
 
 	rec_buffer_rewind();
 	rec_buffer.is_biphase = 0;
+	rec_buffer.generation++;
 
 	return 1;
 }
 
+void rec_buffer_set_code(ir_code code, const struct timeval* time,
+			 int repeat)
+{
+	rec_buffer.decoded = code;
+	rec_buffer.read_time = *time;
+	rec_buffer.repeat = repeat;
+	rec_buffer_rewind();
+	rec_buffer.generation++;
+}
+
 static void unget_rec_buffer(int count)
 {
 	log_trace2("unget: %d", count);
 	if (count == 1 || count == 2) {
 		rec_buffer.rptr -= count;
-		rec_buffer.sum -= rec_buffer.data[rec_buffer.rptr] & (PULSE_MASK);
+		rec_buffer.sum -= *rbuf_slot(rec_buffer.rptr) & (PULSE_MASK);
 		if (count == 2)
-			rec_buffer.sum -= rec_buffer.data[rec_buffer.rptr + 1]
+			rec_buffer.sum -= *rbuf_slot(rec_buffer.rptr + 1)
 					  & (PULSE_MASK);
 	}
 }
@@ -294,7 +973,9 @@ static void unget_rec_buffer_delta(lirc_t delta)
 {
 	rec_buffer.rptr--;
 	rec_buffer.sum -= delta & (PULSE_MASK);
-	rec_buffer.data[rec_buffer.rptr] = delta;
+	*rbuf_slot(rec_buffer.rptr) = delta;
+	/* Data is modified, earlier decode results are void. */
+	rec_buffer.generation++;
 }
 
 static lirc_t get_next_pulse(lirc_t maxusec)
@@ -328,11 +1009,14 @@ static lirc_t get_next_space(lirc_t maxusec)
 static int sync_pending_pulse(struct ir_remote* remote)
 {
 	if (rec_buffer.pendingp > 0) {
+		struct ir_limit limit;
 		lirc_t deltap;
 
 		deltap = get_next_pulse(rec_buffer.pendingp);
 		if (deltap == 0)
 			return 0;
+		set_limit(remote, &limit, rec_buffer.pendingp);
+		envelope_check(rec_buffer.rptr - 1, limit.min, limit.max);
 		if (!expect(remote, deltap, rec_buffer.pendingp))
 			return 0;
 		set_pending_pulse(0);
@@ -343,11 +1027,14 @@ static int sync_pending_pulse(struct ir_remote* remote)
 static int sync_pending_space(struct ir_remote* remote)
 {
 	if (rec_buffer.pendings > 0) {
+		struct ir_limit limit;
 		lirc_t deltas;
 
 		deltas = get_next_space(rec_buffer.pendings);
 		if (deltas == 0)
 			return 0;
+		set_limit(remote, &limit, rec_buffer.pendings);
+		envelope_check(rec_buffer.rptr - 1, limit.min, limit.max);
 		if (!expect(remote, deltas, rec_buffer.pendings))
 			return 0;
 		set_pending_space(0);
@@ -355,144 +1042,202 @@ static int sync_pending_space(struct ir_remote* remote)
 	return 1;
 }
 
-static int expectpulse(struct ir_remote* remote, int exdelta)
+/** expectpulse() using a range from remote->limits. */
+static int expectpulse_limit(struct ir_remote*		remote,
+			     const struct ir_limit*	limit)
 {
 	lirc_t deltap;
 	int retval;
 
-	log_trace2("expecting pulse: %lu", exdelta);
+	log_trace2("expecting pulse: %lu", limit->value);
 	if (!sync_pending_space(remote))
 		return 0;
 
-	deltap = get_next_pulse(rec_buffer.pendingp + exdelta);
+	deltap = get_next_pulse(rec_buffer.pendingp + limit->value);
 	if (deltap == 0)
-		return 0;
+		goto fail;
+	envelope_check(rec_buffer.rptr - 1,
+		       rec_buffer.pendingp + (limit->min > 0 ? limit->min : 0),
+		       rec_buffer.pendingp + limit->max);
 	if (rec_buffer.pendingp > 0) {
 		if (rec_buffer.pendingp > deltap)
-			return 0;
-		retval = expect(remote, deltap - rec_buffer.pendingp, exdelta);
+			goto fail;
+		retval = in_limit(limit, deltap - rec_buffer.pendingp);
 		if (!retval)
-			return 0;
+			goto fail;
 		set_pending_pulse(0);
 	} else {
-		retval = expect(remote, deltap, exdelta);
+		retval = in_limit(limit, deltap);
+		if (!retval)
+			goto fail;
 	}
 	return retval;
+fail:
+	decode_trace_add(DT_EXPECT_PULSE, 0,
+			 rec_buffer.pendingp + limit->value, deltap);
+	return 0;
 }
 
-static int expectspace(struct ir_remote* remote, int exdelta)
+/** expectspace() using a range from remote->limits. */
+static int expectspace_limit(struct ir_remote*		remote,
+			     const struct ir_limit*	limit)
 {
 	lirc_t deltas;
 	int retval;
 
-	log_trace2("expecting space: %lu", exdelta);
+	log_trace2("expecting space: %lu", limit->value);
 	if (!sync_pending_pulse(remote))
 		return 0;
 
-	deltas = get_next_space(rec_buffer.pendings + exdelta);
+	deltas = get_next_space(rec_buffer.pendings + limit->value);
 	if (deltas == 0)
-		return 0;
+		goto fail;
+	envelope_check(rec_buffer.rptr - 1,
+		       rec_buffer.pendings + (limit->min > 0 ? limit->min : 0),
+		       rec_buffer.pendings + limit->max);
 	if (rec_buffer.pendings > 0) {
 		if (rec_buffer.pendings > deltas)
-			return 0;
-		retval = expect(remote, deltas - rec_buffer.pendings, exdelta);
+			goto fail;
+		retval = in_limit(limit, deltas - rec_buffer.pendings);
 		if (!retval)
-			return 0;
+			goto fail;
 		set_pending_space(0);
 	} else {
-		retval = expect(remote, deltas, exdelta);
+		retval = in_limit(limit, deltas);
+		if (!retval)
+			goto fail;
 	}
 	return retval;
+fail:
+	decode_trace_add(DT_EXPECT_SPACE, 0,
+			 rec_buffer.pendings + limit->value, deltas);
+	return 0;
 }
 
-static int expectone(struct ir_remote* remote, int bit)
+static int expectpulse(struct ir_remote* remote, int exdelta)
 {
-	if (is_biphase(remote)) {
-		int all_bits = bit_count(remote);
-		ir_code mask;
+	struct ir_limit limit;
 
-		mask = ((ir_code)1) << (all_bits - 1 - bit);
-		if (mask & remote->rc6_mask) {
-			if (remote->sone > 0 && !expectspace(remote, 2 * remote->sone)) {
-				unget_rec_buffer(1);
-				return 0;
-			}
-			set_pending_pulse(2 * remote->pone);
-		} else {
-			if (remote->sone > 0 && !expectspace(remote, remote->sone)) {
-				unget_rec_buffer(1);
-				return 0;
-			}
-			set_pending_pulse(remote->pone);
-		}
-	} else if (is_space_first(remote)) {
-		if (remote->sone > 0 && !expectspace(remote, remote->sone)) {
+	set_limit(remote, &limit, exdelta);
+	return expectpulse_limit(remote, &limit);
+}
+
+static int expectspace(struct ir_remote* remote, int exdelta)
+{
+	struct ir_limit limit;
+
+	set_limit(remote, &limit, exdelta);
+	return expectspace_limit(remote, &limit);
+}
+
+static int expectone_biphase(struct ir_remote* remote, int bit)
+{
+	int all_bits = bit_count(remote);
+	ir_code mask;
+
+	mask = ((ir_code)1) << (all_bits - 1 - bit);
+	if (mask & remote->rc6_mask) {
+		if (remote->sone > 0
+		    && !expectspace_limit(remote, &remote->limits.sone2)) {
 			unget_rec_buffer(1);
 			return 0;
 		}
-		if (remote->pone > 0 && !expectpulse(remote, remote->pone)) {
-			unget_rec_buffer(2);
-			return 0;
-		}
+		set_pending_pulse(2 * remote->pone);
 	} else {
-		if (remote->pone > 0 && !expectpulse(remote, remote->pone)) {
+		if (remote->sone > 0
+		    && !expectspace_limit(remote, &remote->limits.sone)) {
 			unget_rec_buffer(1);
 			return 0;
 		}
-		if (remote->ptrail > 0) {
-			if (remote->sone > 0 && !expectspace(remote, remote->sone)) {
-				unget_rec_buffer(2);
-				return 0;
-			}
-		} else {
-			set_pending_space(remote->sone);
-		}
+		set_pending_pulse(remote->pone);
 	}
 	return 1;
 }
 
-static int expectzero(struct ir_remote* remote, int bit)
+static int expectzero_biphase(struct ir_remote* remote, int bit)
 {
-	if (is_biphase(remote)) {
-		int all_bits = bit_count(remote);
-		ir_code mask;
+	int all_bits = bit_count(remote);
+	ir_code mask;
 
-		mask = ((ir_code)1) << (all_bits - 1 - bit);
-		if (mask & remote->rc6_mask) {
-			if (!expectpulse(remote, 2 * remote->pzero)) {
-				unget_rec_buffer(1);
-				return 0;
-			}
-			set_pending_space(2 * remote->szero);
-		} else {
-			if (!expectpulse(remote, remote->pzero)) {
-				unget_rec_buffer(1);
-				return 0;
-			}
-			set_pending_space(remote->szero);
+	mask = ((ir_code)1) << (all_bits - 1 - bit);
+	if (mask & remote->rc6_mask) {
+		if (!expectpulse_limit(remote, &remote->limits.pzero2)) {
+			unget_rec_buffer(1);
+			return 0;
 		}
-	} else if (is_space_first(remote)) {
-		if (remote->szero > 0 && !expectspace(remote, remote->szero)) {
+		set_pending_space(2 * remote->szero);
+	} else {
+		if (!expectpulse_limit(remote, &remote->limits.pzero)) {
 			unget_rec_buffer(1);
 			return 0;
 		}
-		if (remote->pzero > 0 && !expectpulse(remote, remote->pzero)) {
+		set_pending_space(remote->szero);
+	}
+	return 1;
+}
+
+static int expectone_space_first(struct ir_remote* remote)
+{
+	if (remote->sone > 0
+	    && !expectspace_limit(remote, &remote->limits.sone)) {
+		unget_rec_buffer(1);
+		return 0;
+	}
+	if (remote->pone > 0
+	    && !expectpulse_limit(remote, &remote->limits.pone)) {
+		unget_rec_buffer(2);
+		return 0;
+	}
+	return 1;
+}
+
+static int expectzero_space_first(struct ir_remote* remote)
+{
+	if (remote->szero > 0
+	    && !expectspace_limit(remote, &remote->limits.szero)) {
+		unget_rec_buffer(1);
+		return 0;
+	}
+	if (remote->pzero > 0
+	    && !expectpulse_limit(remote, &remote->limits.pzero)) {
+		unget_rec_buffer(2);
+		return 0;
+	}
+	return 1;
+}
+
+static int expectone_pulse_first(struct ir_remote* remote)
+{
+	if (remote->pone > 0
+	    && !expectpulse_limit(remote, &remote->limits.pone)) {
+		unget_rec_buffer(1);
+		return 0;
+	}
+	if (remote->ptrail > 0) {
+		if (remote->sone > 0
+		    && !expectspace_limit(remote, &remote->limits.sone)) {
 			unget_rec_buffer(2);
 			return 0;
 		}
 	} else {
-		if (!expectpulse(remote, remote->pzero)) {
-			unget_rec_buffer(1);
+		set_pending_space(remote->sone);
+	}
+	return 1;
+}
+
+static int expectzero_pulse_first(struct ir_remote* remote)
+{
+	if (!expectpulse_limit(remote, &remote->limits.pzero)) {
+		unget_rec_buffer(1);
+		return 0;
+	}
+	if (remote->ptrail > 0) {
+		if (!expectspace_limit(remote, &remote->limits.szero)) {
+			unget_rec_buffer(2);
 			return 0;
 		}
-		if (remote->ptrail > 0) {
-			if (!expectspace(remote, remote->szero)) {
-				unget_rec_buffer(2);
-				return 0;
-			}
-		} else {
-			set_pending_space(remote->szero);
-		}
+	} else {
+		set_pending_space(remote->szero);
 	}
 	return 1;
 }
@@ -501,6 +1246,7 @@ static lirc_t sync_rec_buffer(struct ir_remote* remote)
 {
 	int count;
 	lirc_t deltas, deltap;
+	lirc_t gap;
 
 	count = 0;
 	deltas = get_next_space(1000000);
@@ -508,6 +1254,9 @@ static lirc_t sync_rec_buffer(struct ir_remote* remote)
 		return 0;
 
 	if (last_remote != NULL && !is_rcmm(remote)) {
+		gap = at_least_limit(last_remote,
+				     last_remote->min_remaining_gap);
+		envelope_check(rec_buffer.rptr - 1, gap, PULSE_MASK);
 		while (!expect_at_least(last_remote, deltas, last_remote->min_remaining_gap)) {
 			deltap = get_next_pulse(1000000);
 			if (deltap == 0)
@@ -515,6 +1264,7 @@ static lirc_t sync_rec_buffer(struct ir_remote* remote)
 			deltas = get_next_space(1000000);
 			if (deltas == 0)
 				return 0;
+			envelope_check(rec_buffer.rptr - 1, gap, PULSE_MASK);
 			count++;
 			if (count > REC_SYNC)   /* no sync found,
 						 * let's try a diffrent remote */
@@ -564,7 +1314,7 @@ static int get_header(struct ir_remote* remote)
 		set_pending_pulse(remote->phead);
 		return 1;
 	}
-	if (!expectpulse(remote, remote->phead)) {
+	if (!expectpulse_limit(remote, &remote->limits.phead)) {
 		unget_rec_buffer(1);
 		return 0;
 	}
@@ -575,6 +1325,8 @@ static int get_header(struct ir_remote* remote)
 
 		deltas = get_next_space(remote->shead);
 		if (deltas != 0) {
+			envelope_check_reversed(remote, rec_buffer.rptr - 1,
+						remote->shead);
 			if (expect(remote, remote->shead, deltas))
 				return 1;
 			unget_rec_buffer(2);
@@ -588,9 +1340,9 @@ static int get_header(struct ir_remote* remote)
 
 static int get_foot(struct ir_remote* remote)
 {
-	if (!expectspace(remote, remote->sfoot))
+	if (!expectspace_limit(remote, &remote->limits.sfoot))
 		return 0;
-	if (!expectpulse(remote, remote->pfoot))
+	if (!expectpulse_limit(remote, &remote->limits.pfoot))
 		return 0;
 	return 1;
 }
@@ -608,7 +1360,7 @@ static int get_lead(struct ir_remote* remote)
 static int get_trail(struct ir_remote* remote)
 {
 	if (remote->ptrail != 0)
-		if (!expectpulse(remote, remote->ptrail))
+		if (!expectpulse_limit(remote, &remote->limits.ptrail))
 			return 0;
 	if (rec_buffer.pendingp > 0)
 		if (!sync_pending_pulse(remote))
@@ -619,16 +1371,30 @@ static int get_trail(struct ir_remote* remote)
 static int get_gap(struct ir_remote* remote, lirc_t gap)
 {
 	lirc_t data;
+	int active;
 
 	log_trace1("sum: %d", rec_buffer.sum);
+	/* Timing out is finding the gap, not a check of the edges. */
+	active = envelope.active;
+	envelope.active = 0;
 	data = get_next_rec_buffer(gap - gap * remote->eps / 100);
+	envelope.active = active;
 	if (data == 0)
 		return 1;
+	if (data & LIRC_EOF)
+		envelope.active = 0;
+	envelope_touch(rec_buffer.rptr - 1);
 	if (!is_space(data)) {
 		log_trace1("space expected");
 		return 0;
 	}
 	unget_rec_buffer(1);
+	/* The gap of constant length remotes depends on the sum. */
+	if (!is_const(remote))
+		envelope_check(rec_buffer.rptr, at_least_limit(remote, gap),
+			       PULSE_MASK);
+	else if (!expect_at_least(remote, data, gap))
+		envelope.active = 0;
 	if (!expect_at_least(remote, data, gap)) {
 		log_trace("end of signal not found");
 		return 0;
@@ -636,17 +1402,48 @@ static int get_gap(struct ir_remote* remote, lirc_t gap)
 	return 1;
 }
 
+/** Return true if reading more input would have to wait for the driver. */
+static int rec_buffer_drained(void)
+{
+	struct pollfd pfd = {
+		.fd = curr_driver->fd, .events = POLLIN, .revents = 0 };
+
+	if (rec_buffer.rptr < rec_buffer.wptr || rec_buffer_pending())
+		return 0;
+	if (rec_buffer.at_eof || curr_driver->fd < 0)
+		return 0;
+	return curl_poll(&pfd, 1, 0) == 0;
+}
+
+
+/**
+ * get_gap() at the end of a complete frame. In low latency mode, the
+ * frame is accepted as soon as all edges are read if no more input is
+ * available, rather than waiting up to a gap for the trailing space or
+ * the driver's timeout report. The gap is then read as the sync of the
+ * following signal, where it decides about repeats as usual.
+ */
+static int get_end(struct ir_remote* remote, lirc_t gap)
+{
+	if (low_latency && rec_buffer_drained()) {
+		log_trace("frame complete, not waiting for gap");
+		return 1;
+	}
+	return get_gap(remote, gap);
+}
+
+
 static int get_repeat(struct ir_remote* remote)
 {
 	if (!get_lead(remote))
 		return 0;
 	if (is_biphase(remote)) {
-		if (!expectspace(remote, remote->srepeat))
+		if (!expectspace_limit(remote, &remote->limits.srepeat))
 			return 0;
-		if (!expectpulse(remote, remote->prepeat))
+		if (!expectpulse_limit(remote, &remote->limits.prepeat))
 			return 0;
 	} else {
-		if (!expectpulse(remote, remote->prepeat))
+		if (!expectpulse_limit(remote, &remote->limits.prepeat))
 			return 0;
 		set_pending_space(remote->srepeat);
 	}
@@ -663,317 +1460,473 @@ static int get_repeat(struct ir_remote* remote)
 	return 1;
 }
 
-static ir_code get_data(struct ir_remote* remote, int bits, int done)
+/**
+ * Move plain pulses/spaces from the read-ahead buffer into rec_buffer
+ * until count are unread, as get_next_rec_buffer() would when reading
+ * them. Return true if count unread items are available.
+ */
+static int prefetch_rec_buffer(int count)
 {
-	ir_code code;
+	lirc_t data;
+
+	while (rec_buffer.wptr - rec_buffer.rptr < count) {
+		if (rec_buffer.wptr >= rec_buffer.size
+		    || readahead.rptr >= readahead.count)
+			return 0;
+		data = readahead.data[readahead.rptr];
+		if (data == 0 || data & LIRC_EOF || LIRC_IS_TIMEOUT(data))
+			return 0;       /* left to get_next_rec_buffer() */
+		readahead.rptr++;
+		rec_buffer.at_eof = 0;
+		*rbuf_slot(rec_buffer.wptr++) = data;
+		if (rec_buffer.input_log != NULL)
+			log_input(data);
+	}
+	return 1;
+}
+
+/**
+ * get_data() for remotes with limits.plain_bits when no pulse or space
+ * is pending and all bits are buffered: classify each pulse/space pair
+ * directly against the one and zero limits.
+ *
+ * @return Number of bits decoded into code, less than bits if a bad
+ *     one was found, leaving rec_buffer before it. -1 if not buffered.
+ */
+static int get_buffered_bits(const struct ir_remote* remote,
+			     int bits, ir_code* code)
+{
+	const struct ir_limits* limits = &remote->limits;
+	lirc_t pulse, space;
+	lirc_t sum = 0;
+	int one, zero;
+	int index;
 	int i;
 
-	code = 0;
+	if (!prefetch_rec_buffer(2 * bits))
+		return -1;
+	for (i = 0; i < bits; i++) {
+		index = rec_buffer.rptr + 2 * i;
+		pulse = *rbuf_slot(index);
+		space = *rbuf_slot(index + 1);
+		envelope_touch(index + 1);
+		if (!is_pulse(pulse) || !is_space(space))
+			break;
+		envelope_check(index, 1, PULSE_MASK);
+		pulse &= PULSE_MASK;
+		if (pulse == 0)
+			break;
+		envelope_check(index, limits->pone.min, limits->pone.max);
+		envelope_check(index, limits->pzero.min, limits->pzero.max);
+		envelope_check(index + 1, limits->sone.min, limits->sone.max);
+		envelope_check(index + 1, limits->szero.min, limits->szero.max);
+		one = in_limit(&limits->pone, pulse)
+		      & in_limit(&limits->sone, space);
+		zero = in_limit(&limits->pzero, pulse)
+		       & in_limit(&limits->szero, space);
+		if (!(one | zero))
+			break;
+		*code = (*code << 1) | one;
+		sum += pulse + space;
+	}
+	rec_buffer.rptr += 2 * i;
+	rec_buffer.sum += sum;
+	return i;
+}
 
-	if (is_rcmm(remote)) {
-		lirc_t deltap, deltas, sum;
+/** get_data() for RC-MM: two bits per pulse/space pair. */
+static ir_code get_data_rcmm(struct ir_remote* remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	lirc_t deltap, deltas, sum;
 
-		if (bits % 2 || done % 2) {
-			log_error("invalid bit number.");
+	if (bits % 2 || done % 2) {
+		log_error("invalid bit number.");
+		return (ir_code) -1;
+	}
+	if (!sync_pending_space(remote))
+		return 0;
+	for (i = 0; i < bits; i += 2) {
+		code <<= 2;
+		deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
+		deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
+		if (deltap == 0 || deltas == 0) {
+			log_error("failed on bit %d", done + i + 1);
 			return (ir_code) -1;
 		}
-		if (!sync_pending_space(remote))
-			return 0;
-		for (i = 0; i < bits; i += 2) {
-			code <<= 2;
-			deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
-			deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
-			if (deltap == 0 || deltas == 0) {
-				log_error("failed on bit %d", done + i + 1);
-				return (ir_code) -1;
-			}
-			sum = deltap + deltas;
-			log_trace2("rcmm: sum %ld", (uint32_t)sum);
-			if (expect(remote, sum, remote->pzero + remote->szero)) {
-				code |= 0;
-				log_trace1("00");
-			} else if (expect(remote, sum, remote->pone + remote->sone)) {
-				code |= 1;
-				log_trace1("01");
-			} else if (expect(remote, sum, remote->ptwo + remote->stwo)) {
-				code |= 2;
-				log_trace1("10");
-			} else if (expect(remote, sum, remote->pthree + remote->sthree)) {
-				code |= 3;
-				log_trace1("11");
-			} else {
-				log_trace1("no match for %d+%d=%d", deltap, deltas, sum);
-				return (ir_code) -1;
-			}
+		sum = deltap + deltas;
+		log_trace2("rcmm: sum %ld", (uint32_t)sum);
+		if (expect(remote, sum, remote->pzero + remote->szero)) {
+			code |= 0;
+			log_trace1("00");
+		} else if (expect(remote, sum, remote->pone + remote->sone)) {
+			code |= 1;
+			log_trace1("01");
+		} else if (expect(remote, sum, remote->ptwo + remote->stwo)) {
+			code |= 2;
+			log_trace1("10");
+		} else if (expect(remote, sum, remote->pthree + remote->sthree)) {
+			code |= 3;
+			log_trace1("11");
+		} else {
+			log_trace1("no match for %d+%d=%d", deltap, deltas, sum);
+			return (ir_code) -1;
 		}
-		return code;
-	} else if (is_grundig(remote)) {
-		lirc_t deltap, deltas, sum;
-		int state, laststate;
+	}
+	return code;
+}
+
+/** get_data() for Grundig: two bits per pair of space/pulse sums. */
+static ir_code get_data_grundig(struct ir_remote* remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	lirc_t deltap, deltas, sum;
+	int state, laststate;
 
-		if (bits % 2 || done % 2) {
-			log_error("invalid bit number.");
+	if (bits % 2 || done % 2) {
+		log_error("invalid bit number.");
+		return (ir_code) -1;
+	}
+	if (!sync_pending_pulse(remote))
+		return (ir_code) -1;
+	for (laststate = state = -1, i = 0; i < bits; ) {
+		deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
+		deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
+		if (deltas == 0 || deltap == 0) {
+			log_error("failed on bit %d", done + i + 1);
 			return (ir_code) -1;
 		}
-		if (!sync_pending_pulse(remote))
+		sum = deltas + deltap;
+		log_trace2("grundig: sum %ld", (uint32_t)sum);
+		if (expect(remote, sum, remote->szero + remote->pzero)) {
+			state = 0;
+			log_trace1("2T");
+		} else if (expect(remote, sum, remote->sone + remote->pone)) {
+			state = 1;
+			log_trace1("3T");
+		} else if (expect(remote, sum, remote->stwo + remote->ptwo)) {
+			state = 2;
+			log_trace1("4T");
+		} else if (expect(remote, sum, remote->sthree + remote->pthree)) {
+			state = 3;
+			log_trace2("6T");
+		} else {
+			log_trace1("no match for %d+%d=%d", deltas, deltap, sum);
 			return (ir_code) -1;
-		for (laststate = state = -1, i = 0; i < bits; ) {
-			deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
-			deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
-			if (deltas == 0 || deltap == 0) {
-				log_error("failed on bit %d", done + i + 1);
-				return (ir_code) -1;
-			}
-			sum = deltas + deltap;
-			log_trace2("grundig: sum %ld", (uint32_t)sum);
-			if (expect(remote, sum, remote->szero + remote->pzero)) {
-				state = 0;
-				log_trace1("2T");
-			} else if (expect(remote, sum, remote->sone + remote->pone)) {
-				state = 1;
-				log_trace1("3T");
-			} else if (expect(remote, sum, remote->stwo + remote->ptwo)) {
-				state = 2;
-				log_trace1("4T");
-			} else if (expect(remote, sum, remote->sthree + remote->pthree)) {
-				state = 3;
-				log_trace2("6T");
-			} else {
-				log_trace1("no match for %d+%d=%d", deltas, deltap, sum);
-				return (ir_code) -1;
-			}
-			if (state == 3) {       /* 6T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 0;
-			} else if (laststate == 2 && state == 0) {      /* 4T2T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 1;
-			} else if (laststate == 1 && state == 1) {      /* 3T3T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 2;
-			} else if (laststate == 0 && state == 2) {      /* 2T4T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 3;
-			} else if (laststate == -1) {
-				/* 1st bit */
-			} else {
-				log_error("invalid state %d:%d", laststate, state);
-				return (ir_code) -1;
-			}
-			laststate = state;
 		}
-		return code;
-	} else if (is_serial(remote)) {
-		int received;
-		int space, stop_bit, parity_bit;
-		int parity;
-		lirc_t delta, origdelta, pending, expecting, gap_delta;
-		lirc_t base, stop;
-		lirc_t max_space, max_pulse;
-
-		base = 1000000 / remote->baud;
-
-		/* start bit */
-		set_pending_pulse(base);
-
-		received = 0;
-		space = (rec_buffer.pendingp == 0);     /* expecting space ? */
-		stop_bit = 0;
-		parity_bit = 0;
-		delta = origdelta = 0;
-		stop = base * remote->stop_bits / 2;
-		parity = 0;
-		gap_delta = 0;
-
-		max_space = remote->sone * remote->bits_in_byte + stop;
-		max_pulse = remote->pzero * (1 + remote->bits_in_byte);
-		if (remote->parity != IR_PARITY_NONE) {
-			parity_bit = 1;
-			max_space += remote->sone;
-			max_pulse += remote->pzero;
-			bits += bits / remote->bits_in_byte;
+		if (state == 3) {       /* 6T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 0;
+		} else if (laststate == 2 && state == 0) {      /* 4T2T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 1;
+		} else if (laststate == 1 && state == 1) {      /* 3T3T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 2;
+		} else if (laststate == 0 && state == 2) {      /* 2T4T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 3;
+		} else if (laststate == -1) {
+			/* 1st bit */
+		} else {
+			log_error("invalid state %d:%d", laststate, state);
+			return (ir_code) -1;
 		}
+		laststate = state;
+	}
+	return code;
+}
 
-		while (received < bits || stop_bit) {
-			if (delta == 0) {
-				delta = space ? get_next_space(max_space) : get_next_pulse(max_pulse);
-				if (delta == 0 && space && received + remote->bits_in_byte + parity_bit >= bits)
-					/* open end */
-					delta = max_space;
-				origdelta = delta;
-			}
-			if (delta == 0) {
-				log_trace("failed before bit %d", received + 1);
-				return (ir_code) -1;
-			}
-			pending = (space ? rec_buffer.pendings : rec_buffer.pendingp);
-			if (expect(remote, delta, pending)) {
+/** get_data() for Serial: start, data, parity and stop bits at a fixed baud rate. */
+static ir_code get_data_serial(struct ir_remote* remote, int bits, int done)
+{
+	ir_code code = 0;
+	int received;
+	int space, stop_bit, parity_bit;
+	int parity;
+	lirc_t delta, origdelta, pending, expecting, gap_delta;
+	lirc_t base, stop;
+	lirc_t max_space, max_pulse;
+
+	base = 1000000 / remote->baud;
+
+	/* start bit */
+	set_pending_pulse(base);
+
+	received = 0;
+	space = (rec_buffer.pendingp == 0);     /* expecting space ? */
+	stop_bit = 0;
+	parity_bit = 0;
+	delta = origdelta = 0;
+	stop = base * remote->stop_bits / 2;
+	parity = 0;
+	gap_delta = 0;
+
+	max_space = remote->sone * remote->bits_in_byte + stop;
+	max_pulse = remote->pzero * (1 + remote->bits_in_byte);
+	if (remote->parity != IR_PARITY_NONE) {
+		parity_bit = 1;
+		max_space += remote->sone;
+		max_pulse += remote->pzero;
+		bits += bits / remote->bits_in_byte;
+	}
+
+	while (received < bits || stop_bit) {
+		if (delta == 0) {
+			delta = space ? get_next_space(max_space) : get_next_pulse(max_pulse);
+			if (delta == 0 && space && received + remote->bits_in_byte + parity_bit >= bits)
+				/* open end */
+				delta = max_space;
+			origdelta = delta;
+		}
+		if (delta == 0) {
+			log_trace("failed before bit %d", received + 1);
+			return (ir_code) -1;
+		}
+		pending = (space ? rec_buffer.pendings : rec_buffer.pendingp);
+		if (expect(remote, delta, pending)) {
+			delta = 0;
+		} else if (delta > pending) {
+			delta -= pending;
+		} else {
+			log_trace("failed before bit %d", received + 1);
+			return (ir_code) -1;
+		}
+		if (pending > 0) {
+			if (stop_bit) {
+				log_trace2("delta: %lu", delta);
+				gap_delta = delta;
 				delta = 0;
-			} else if (delta > pending) {
-				delta -= pending;
+				set_pending_pulse(base);
+				set_pending_space(0);
+				stop_bit = 0;
+				space = 0;
+				log_trace2("stop bit found");
 			} else {
-				log_trace("failed before bit %d", received + 1);
-				return (ir_code) -1;
+				log_trace2("pending bit found");
+				set_pending_pulse(0);
+				set_pending_space(0);
+				if (delta == 0)
+					space = (space ? 0 : 1);
 			}
-			if (pending > 0) {
-				if (stop_bit) {
-					log_trace2("delta: %lu", delta);
-					gap_delta = delta;
-					delta = 0;
-					set_pending_pulse(base);
-					set_pending_space(0);
-					stop_bit = 0;
-					space = 0;
-					log_trace2("stop bit found");
-				} else {
-					log_trace2("pending bit found");
-					set_pending_pulse(0);
-					set_pending_space(0);
-					if (delta == 0)
-						space = (space ? 0 : 1);
-				}
-				continue;
-			}
-			expecting = (space ? remote->sone : remote->pzero);
-			if (delta > expecting || expect(remote, delta, expecting)) {
-				delta -= (expecting > delta ? delta : expecting);
-				received++;
-				code <<= 1;
-				code |= space;
-				parity ^= space;
-				log_trace1("adding %d", space);
-				if (received % (remote->bits_in_byte + parity_bit) == 0) {
-					ir_code temp;
-
-					if ((remote->parity == IR_PARITY_EVEN && parity)
-					    || (remote->parity == IR_PARITY_ODD && !parity)) {
-						log_trace("parity error after %d bits", received + 1);
-						return (ir_code) -1;
-					}
-					parity = 0;
-
-					/* parity bit is filtered out */
-					temp = code >> (remote->bits_in_byte + parity_bit);
-					code =
-						temp << remote->bits_in_byte | reverse(code >> parity_bit,
-										       remote->bits_in_byte);
-
-					if (space && delta == 0) {
-						log_trace("failed at stop bit after %d bits", received + 1);
-						return (ir_code) -1;
-					}
-					log_trace2("awaiting stop bit");
-					set_pending_space(stop);
-					stop_bit = 1;
+			continue;
+		}
+		expecting = (space ? remote->sone : remote->pzero);
+		if (delta > expecting || expect(remote, delta, expecting)) {
+			delta -= (expecting > delta ? delta : expecting);
+			received++;
+			code <<= 1;
+			code |= space;
+			parity ^= space;
+			log_trace1("adding %d", space);
+			if (received % (remote->bits_in_byte + parity_bit) == 0) {
+				ir_code temp;
+
+				if ((remote->parity == IR_PARITY_EVEN && parity)
+				    || (remote->parity == IR_PARITY_ODD && !parity)) {
+					log_trace("parity error after %d bits", received + 1);
+					return (ir_code) -1;
 				}
-			} else {
-				if (delta == origdelta) {
-					log_trace("framing error after %d bits", received + 1);
+				parity = 0;
+
+				/* parity bit is filtered out */
+				temp = code >> (remote->bits_in_byte + parity_bit);
+				code =
+					temp << remote->bits_in_byte | reverse(code >> parity_bit,
+									       remote->bits_in_byte);
+
+				if (space && delta == 0) {
+					log_trace("failed at stop bit after %d bits", received + 1);
 					return (ir_code) -1;
 				}
-				delta = 0;
+				log_trace2("awaiting stop bit");
+				set_pending_space(stop);
+				stop_bit = 1;
 			}
-			if (delta == 0)
-				space = (space ? 0 : 1);
-		}
-		if (gap_delta)
-			unget_rec_buffer_delta(gap_delta);
-		set_pending_pulse(0);
-		set_pending_space(0);
-		return code;
-	} else if (is_bo(remote)) {
-		int lastbit = 1;
-		lirc_t deltap, deltas;
-		lirc_t pzero, szero;
-		lirc_t pone, sone;
-
-		for (i = 0; i < bits; i++) {
-			code <<= 1;
-			deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
-			deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
-			if (deltap == 0 || deltas == 0) {
-				log_error("failed on bit %d", done + i + 1);
+		} else {
+			if (delta == origdelta) {
+				log_trace("framing error after %d bits", received + 1);
 				return (ir_code) -1;
 			}
-			if (lastbit == 1) {
-				pzero = remote->pone;
-				szero = remote->sone;
-				pone = remote->ptwo;
-				sone = remote->stwo;
-			} else {
-				pzero = remote->ptwo;
-				szero = remote->stwo;
-				pone = remote->pthree;
-				sone = remote->sthree;
-			}
-			log_trace2("%lu %lu %lu %lu", pzero, szero, pone, sone);
-			if (expect(remote, deltap, pzero)) {
-				if (expect(remote, deltas, szero)) {
-					code |= 0;
-					lastbit = 0;
-					log_trace1("0");
-					continue;
-				}
+			delta = 0;
+		}
+		if (delta == 0)
+			space = (space ? 0 : 1);
+	}
+	if (gap_delta)
+		unget_rec_buffer_delta(gap_delta);
+	set_pending_pulse(0);
+	set_pending_space(0);
+	return code;
+}
+
+/** get_data() for Bang & Olufsen: the pair encoding depends on the previous bit. */
+static ir_code get_data_bo(struct ir_remote* remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	int lastbit = 1;
+	lirc_t deltap, deltas;
+	lirc_t pzero, szero;
+	lirc_t pone, sone;
+
+	for (i = 0; i < bits; i++) {
+		code <<= 1;
+		deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
+		deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
+		if (deltap == 0 || deltas == 0) {
+			log_error("failed on bit %d", done + i + 1);
+			return (ir_code) -1;
+		}
+		if (lastbit == 1) {
+			pzero = remote->pone;
+			szero = remote->sone;
+			pone = remote->ptwo;
+			sone = remote->stwo;
+		} else {
+			pzero = remote->ptwo;
+			szero = remote->stwo;
+			pone = remote->pthree;
+			sone = remote->sthree;
+		}
+		log_trace2("%lu %lu %lu %lu", pzero, szero, pone, sone);
+		if (expect(remote, deltap, pzero)) {
+			if (expect(remote, deltas, szero)) {
+				code |= 0;
+				lastbit = 0;
+				log_trace1("0");
+				continue;
 			}
+		}
 
-			if (expect(remote, deltap, pone)) {
-				if (expect(remote, deltas, sone)) {
-					code |= 1;
-					lastbit = 1;
-					log_trace1("1");
-					continue;
-				}
+		if (expect(remote, deltap, pone)) {
+			if (expect(remote, deltas, sone)) {
+				code |= 1;
+				lastbit = 1;
+				log_trace1("1");
+				continue;
 			}
+		}
+		log_error("failed on bit %d", done + i + 1);
+		return (ir_code) -1;
+	}
+	return code;
+}
+
+/** get_data() for XMP: a nibble per pulse/space pair. */
+static ir_code get_data_xmp(struct ir_remote* remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	lirc_t deltap, deltas, sum;
+	ir_code n;
+
+	if (bits % 4 || done % 4) {
+		log_error("invalid bit number.");
+		return (ir_code) -1;
+	}
+	if (!sync_pending_space(remote))
+		return 0;
+	for (i = 0; i < bits; i += 4) {
+		code <<= 4;
+		deltap = get_next_pulse(remote->pzero);
+		deltas = get_next_space(remote->szero + 16 * remote->sone);
+		if (deltap == 0 || deltas == 0) {
 			log_error("failed on bit %d", done + i + 1);
 			return (ir_code) -1;
 		}
-		return code;
-	} else if (is_xmp(remote)) {
-		lirc_t deltap, deltas, sum;
-		ir_code n;
+		sum = deltap + deltas;
 
-		if (bits % 4 || done % 4) {
-			log_error("invalid bit number.");
+		sum -= remote->pzero + remote->szero;
+		n = (sum + remote->sone / 2) / remote->sone;
+		if (n >= 16) {
+			log_error("failed on bit %d", done + i + 1);
 			return (ir_code) -1;
 		}
-		if (!sync_pending_space(remote))
-			return 0;
-		for (i = 0; i < bits; i += 4) {
-			code <<= 4;
-			deltap = get_next_pulse(remote->pzero);
-			deltas = get_next_space(remote->szero + 16 * remote->sone);
-			if (deltap == 0 || deltas == 0) {
-				log_error("failed on bit %d", done + i + 1);
-				return (ir_code) -1;
-			}
-			sum = deltap + deltas;
+		log_trace("%d: %lx", i, n);
+		code |= n;
+	}
+	return code;
+}
 
-			sum -= remote->pzero + remote->szero;
-			n = (sum + remote->sone / 2) / remote->sone;
-			if (n >= 16) {
-				log_error("failed on bit %d", done + i + 1);
-				return (ir_code) -1;
-			}
-			log_trace("%d: %lx", i, n);
-			code |= n;
+/** get_data() for RC5 and RC6, the trailer bits of RC6 are doubled. */
+static ir_code get_data_biphase(struct ir_remote* remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+
+	for (i = 0; i < bits; i++) {
+		code = code << 1;
+		if (expectone_biphase(remote, done + i)) {
+			log_trace1("1");
+			code |= 1;
+		} else if (expectzero_biphase(remote, done + i)) {
+			log_trace1("0");
+			code |= 0;
+		} else {
+			log_trace("failed on bit %d", done + i + 1);
+			return (ir_code) -1;
+		}
+	}
+	return code;
+}
+
+/** get_data() for bits encoded as space + pulse. */
+static ir_code get_data_space_first(struct ir_remote* remote, int bits,
+				    int done)
+{
+	ir_code code = 0;
+	int i;
+
+	for (i = 0; i < bits; i++) {
+		code = code << 1;
+		if (expectone_space_first(remote)) {
+			log_trace1("1");
+			code |= 1;
+		} else if (expectzero_space_first(remote)) {
+			log_trace1("0");
+			code |= 0;
+		} else {
+			log_trace("failed on bit %d", done + i + 1);
+			return (ir_code) -1;
 		}
-		return code;
 	}
+	return code;
+}
+
+/** get_data() for bits encoded as pulse + space, e. g. space encoded. */
+static ir_code get_data_pulse_first(struct ir_remote* remote, int bits,
+				    int done)
+{
+	ir_code code = 0;
+	int i, n;
 
 	for (i = 0; i < bits; i++) {
+		if (remote->limits.plain_bits
+		    && rec_buffer.pendingp == 0 && rec_buffer.pendings == 0) {
+			n = get_buffered_bits(remote, bits - i, &code);
+			if (n == bits - i)
+				return code;
+			if (n >= 0) {
+				log_trace("failed on bit %d", done + i + n + 1);
+				return (ir_code) -1;
+			}
+		}
 		code = code << 1;
-		if (expectone(remote, done + i)) {
+		if (expectone_pulse_first(remote)) {
 			log_trace1("1");
 			code |= 1;
-		} else if (expectzero(remote, done + i)) {
+		} else if (expectzero_pulse_first(remote)) {
 			log_trace1("0");
 			code |= 0;
 		} else {
@@ -984,6 +1937,28 @@ static ir_code get_data(struct ir_remote* remote, int bits, int done)
 	return code;
 }
 
+/** get_data() variants by remote->limits.bit_decoder. */
+static ir_code (*const get_data_funcs[])(struct ir_remote* remote,
+					 int bits, int done) = {
+	[BITS_PULSE_FIRST]	= get_data_pulse_first,
+	[BITS_SPACE_FIRST]	= get_data_space_first,
+	[BITS_BIPHASE]		= get_data_biphase,
+	[BITS_RCMM]		= get_data_rcmm,
+	[BITS_GRUNDIG]		= get_data_grundig,
+	[BITS_SERIAL]		= get_data_serial,
+	[BITS_BO]		= get_data_bo,
+	[BITS_XMP]		= get_data_xmp
+};
+
+/**
+ * Decode bits data bits, done bits into the complete signal. The
+ * protocol specific variant is bound by ir_remote_calc_limits().
+ */
+static ir_code get_data(struct ir_remote* remote, int bits, int done)
+{
+	return get_data_funcs[remote->limits.bit_decoder](remote, bits, done);
+}
+
 static ir_code get_pre(struct ir_remote* remote)
 {
 	ir_code pre;
@@ -1013,7 +1988,7 @@ static ir_code get_pre(struct ir_remote* remote)
 		}
 	}
 	if (remote->pre_p > 0 && remote->pre_s > 0) {
-		if (!expectpulse(remote, remote->pre_p))
+		if (!expectpulse_limit(remote, &remote->limits.pre_p))
 			return (ir_code) -1;
 		set_pending_space(remote->pre_s);
 	}
@@ -1025,7 +2000,7 @@ static ir_code get_post(struct ir_remote* remote)
 	ir_code post;
 
 	if (remote->post_p > 0 && remote->post_s > 0) {
-		if (!expectpulse(remote, remote->post_p))
+		if (!expectpulse_limit(remote, &remote->limits.post_p))
 			return (ir_code) -1;
 		set_pending_space(remote->post_s);
 	}
@@ -1039,34 +2014,247 @@ static ir_code get_post(struct ir_remote* remote)
 	return post;
 }
 
-int receive_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
+/** True if a and b are decoded from the same pulses in the same way. */
+/**
+ * Return true if the timing block of remote equals timing: all members
+ * affecting how rec_buffer is walked, but not the codes matched.
+ */
+static int same_timing(const char* timing, const struct ir_remote* remote)
+{
+	return memcmp(timing, (const char*)remote + TIMING_BEGIN,
+		      TIMING_SIZE) == 0;
+}
+
+
+/**
+ * Return true if the walk for remote only depends on its timing. Other
+ * modes than mode2 don't start from the beginning of the buffer. Raw
+ * codes are matched while walking, toggle_mask remotes and repeat codes
+ * depend on decoder state, serial remotes modify the buffer.
+ */
+static int can_memoize(const struct ir_remote* remote)
+{
+	return !update_mode
+	       && (curr_driver->rec_mode == LIRC_MODE_MODE2
+		   || curr_driver->rec_mode == LIRC_MODE_PULSE
+		   || curr_driver->rec_mode == LIRC_MODE_RAW)
+	       && remote != last_remote
+	       && !is_raw(remote)
+	       && !is_serial(remote)
+	       && !has_toggle_mask(remote);
+}
+
+
+static void save_state(struct rbuf_state* state)
+{
+	state->rptr = rec_buffer.rptr;
+	state->too_long = rec_buffer.too_long;
+	state->is_biphase = rec_buffer.is_biphase;
+	state->pendingp = rec_buffer.pendingp;
+	state->pendings = rec_buffer.pendings;
+	state->sum = rec_buffer.sum;
+	state->at_eof = rec_buffer.at_eof;
+}
+
+
+static void restore_state(const struct rbuf_state* state)
+{
+	rec_buffer.rptr = state->rptr;
+	rec_buffer.too_long = state->too_long;
+	rec_buffer.is_biphase = state->is_biphase;
+	rec_buffer.pendingp = state->pendingp;
+	rec_buffer.pendings = state->pendings;
+	rec_buffer.sum = state->sum;
+	rec_buffer.at_eof = state->at_eof;
+}
+
+
+/** Remember the sync of a mode2 decoding, see struct burst_info. */
+static void save_burst(const struct ir_remote* remote, lirc_t sync)
+{
+	if (is_rcmm(remote) || rec_buffer.timed_out)
+		return;
+	burst.last_remote = last_remote;
+	burst.generation = rec_buffer.generation;
+	burst.sync = sync;
+	save_state(&burst.state);
+}
+
+
+/**
+ * Return true if remote cannot match the current buffer since the sync
+ * or the header pulse doesn't, leaving rec_buffer as decode_pulses()
+ * would have done.
+ */
+static int reject_by_header(const struct ir_remote* remote)
+{
+	struct ir_limit limit;
+	lirc_t data;
+
+	if (burst.generation != rec_buffer.generation
+	    || burst.last_remote != last_remote
+	    || update_mode
+	    || (has_repeat(remote) && remote == last_remote)
+	    || is_rcmm(remote)
+	    || has_toggle_mask(remote))
+		return 0;
+	if (burst.sync != 0) {
+		if (!has_header(remote) || is_bo(remote)
+		    || remote->flags & NO_HEAD_REP
+		    || burst.state.rptr >= rec_buffer.wptr)
+			return 0;
+		data = *rbuf_slot(burst.state.rptr);
+		set_limit(remote, &limit, remote->phead);
+		envelope_check(burst.state.rptr, limit.min, limit.max);
+		if (is_pulse(data)
+		    && expect(remote, data & PULSE_MASK, remote->phead))
+			return 0;
+	}
+	restore_state(&burst.state);
+	rec_buffer.is_biphase = is_biphase(remote) ? 1 : 0;
+	log_trace("failed on %s", burst.sync ? "header" : "sync");
+	return 1;
+}
+
+
+static struct decode_memo* find_memo(const struct ir_remote* remote)
+{
+	int i;
+
+	for (i = 0; i < MEMO_SIZE; i++) {
+		if (memos[i].generation == rec_buffer.generation
+		    && memos[i].last_remote == last_remote
+		    && same_timing(memos[i].timing, remote))
+			return &memos[i];
+	}
+	return NULL;
+}
+
+
+/**
+ * Decode the pulses and spaces in rec_buffer, i. e., everything but
+ * LIRCCODE. Return 0 on failure, 1 when data is decoded and 2 for a
+ * repeat code, ctx then also has the remaining gaps.
+ */
+/** Record why decoding failed in the decode trace, return 0. */
+static int decode_reject(enum decode_trace_reason reason)
+{
+	decode_trace_add(DT_REJECT, reason, 0, 0);
+	return 0;
+}
+
+
+/**
+ * Return true if remote is only decoded by the expect() checks of
+ * decode_pulses(), never depending on decoder state or modifying the
+ * buffer, so a walk of it can be remembered, see struct recall.
+ */
+static int can_recall(const struct ir_remote* remote)
+{
+	enum bit_decoder decoder = remote->limits.bit_decoder;
+
+	return recall_enabled
+	       && !update_mode
+	       && (curr_driver->rec_mode == LIRC_MODE_MODE2
+		   || curr_driver->rec_mode == LIRC_MODE_PULSE
+		   || curr_driver->rec_mode == LIRC_MODE_RAW)
+	       && !is_raw(remote)
+	       && !has_toggle_mask(remote)
+	       && (decoder == BITS_PULSE_FIRST
+		   || decoder == BITS_SPACE_FIRST
+		   || decoder == BITS_BIPHASE);
+}
+
+
+/**
+ * Return true if the checks decode_pulses() makes for remote are all
+ * recorded in the envelope, so that it can be tried before the remote
+ * matching a remembered burst.
+ */
+static int can_track(const struct ir_remote* remote)
+{
+	return is_raw(remote) ? !has_toggle_mask(remote) : can_recall(remote);
+}
+
+
+/**
+ * Record the walk of decode_pulses() for remote up to the trailing gap, if
+ * it is plain: the sync is the first edge, nothing is pending and the
+ * buffer holds all edges.
+ */
+static void mark_walk(struct ir_remote*		remote,
+		      const struct decode_ctx_t*	ctx,
+		      lirc_t				sync,
+		      int				sync_end)
+{
+	if (sync_end != 1 || !can_recall(remote)
+	    || rec_buffer.pendingp != 0 || rec_buffer.pendings != 0
+	    || rec_buffer.too_long || rec_buffer.timed_out
+	    || rec_buffer.rptr < 2 || rec_buffer.rptr - 1 > RECALL_EDGES)
+		return;
+	walk.remote = remote;
+	walk.generation = rec_buffer.generation;
+	walk.rptr = rec_buffer.rptr;
+	walk.sum = rec_buffer.sum;
+	walk.sync = sync;
+	walk.pre = ctx->pre;
+	walk.code = ctx->code;
+	walk.post = ctx->post;
+}
+
+
+/** The end of decode_pulses(), after the last edge of the signal. */
+static int get_frame_end(struct ir_remote* remote)
+{
+	if (is_rcmm(remote)) {
+		if (!get_end(remote, 1000))
+			return decode_reject(DT_FAIL_GAP);
+	} else if (is_const(remote)) {
+		if (!get_end(remote, min_gap(remote) > rec_buffer.sum ?
+			     min_gap(remote) - rec_buffer.sum :
+			     0))
+			return decode_reject(DT_FAIL_GAP);
+	} else {
+		if (!get_end(remote, min_gap(remote)))
+			return decode_reject(DT_FAIL_GAP);
+	}
+	return 1;
+}
+
+
+static int decode_pulses(struct ir_remote* remote,
+			 struct decode_ctx_t* ctx,
+			 lirc_t* sync_ptr)
 {
 	lirc_t sync;
 	int header;
-	struct timeval current;
+	int sync_end = 0;
+	unsigned int generation = rec_buffer.generation;
 
 	sync = 0;               /* make compiler happy */
-	memset(ctx, 0, sizeof(struct decode_ctx_t));
-	ctx->code = ctx->pre = ctx->post = 0;
 	header = 0;
+	rec_buffer.timed_out = 0;
+	walk.remote = NULL;
 
-	if (rec_buffer.at_eof && rec_buffer.wptr - rec_buffer.rptr <= 1) {
-		log_debug("Decode: found EOF");
-		ctx->code = LIRC_EOF;
-		rec_buffer.at_eof = 0;
-		return 1;
-	}
 	if (curr_driver->rec_mode == LIRC_MODE_MODE2 ||
 	    curr_driver->rec_mode == LIRC_MODE_PULSE ||
 	    curr_driver->rec_mode == LIRC_MODE_RAW) {
+		ir_remote_check_limits(remote);
+		if (rec_buffer.end_report)
+			return decode_reject(DT_FAIL_SYNC);
+		if (reject_by_header(remote))
+			return decode_reject(DT_FAIL_HEADER_MISMATCH);
 		rec_buffer_rewind();
 		rec_buffer.is_biphase = is_biphase(remote) ? 1 : 0;
 
 		/* we should get a long space first */
 		sync = sync_rec_buffer(remote);
+		sync_end = rec_buffer.rptr;
+		save_burst(remote, sync);
+		decode_trace_add(DT_SYNC, 0, sync, 0);
 		if (!sync) {
 			log_trace("failed on sync");
-			return 0;
+			return decode_reject(DT_FAIL_SYNC);
 		}
 		log_trace("sync");
 
@@ -1074,14 +2262,15 @@ int receive_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
 			if (remote->flags & REPEAT_HEADER && has_header(remote)) {
 				if (!get_header(remote)) {
 					log_trace("failed on repeat header");
-					return 0;
+					return decode_reject(DT_FAIL_REPEAT_HEADER);
 				}
 				log_trace("repeat header");
 			}
 			if (get_repeat(remote)) {
 				if (remote->last_code == NULL) {
+					envelope.active = 0;
 					log_notice("repeat code without last_code received");
-					return 0;
+					return decode_reject(DT_FAIL_LAST_CODE);
 				}
 
 				ctx->pre = remote->pre_data;
@@ -1099,37 +2288,44 @@ int receive_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
 							    rec_buffer.sum ? max_gap(remote) -
 							    rec_buffer.sum : 0) : (has_repeat_gap(remote) ? remote->
 										   repeat_gap : max_gap(remote));
-				return 1;
+				return 2;
 			}
 			log_trace("no repeat");
 			rec_buffer_rewind();
 			sync_rec_buffer(remote);
+			sync_end = rec_buffer.rptr;
 		}
 
 		if (has_header(remote)) {
 			header = 1;
 			if (!get_header(remote)) {
 				header = 0;
+				if (remote->flags & NO_HEAD_REP)
+					envelope_check(sync_end - 1, 0,
+						       at_most_limit(remote,
+							max_gap(remote)));
 				if (!(remote->flags & NO_HEAD_REP && expect_at_most(remote, sync, max_gap(remote)))) {
 					log_trace("failed on header");
-					return 0;
+					return decode_reject(DT_FAIL_HEADER);
 				}
 			}
 			log_trace("header");
 		}
 	}
+	*sync_ptr = sync;
 
 	if (is_raw(remote)) {
 		struct ir_ncode* codes;
 		struct ir_ncode* found;
 		int i;
 
-		if (curr_driver->rec_mode == LIRC_MODE_LIRCCODE)
-			return 0;
-
 		codes = remote->codes;
 		found = NULL;
 		while (codes->name != NULL && found == NULL) {
+			if (!load_raw_signals(remote, codes)) {
+				codes++;
+				continue;
+			}
 			found = codes;
 			for (i = 0; i < codes->length; ) {
 				if (!expectpulse(remote, codes->signals[i++])) {
@@ -1147,7 +2343,7 @@ int receive_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
 			}
 			codes++;
 			if (found != NULL) {
-				if (!get_gap
+				if (!get_end
 					    (remote, is_const(remote) ?
 					    min_gap(remote) - rec_buffer.sum :
 					    min_gap(remote)))
@@ -1155,88 +2351,373 @@ int receive_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
 			}
 		}
 		if (found == NULL)
-			return 0;
+			return decode_reject(DT_FAIL_RAW);
 		ctx->code = found->code;
-	} else {
-		if (curr_driver->rec_mode == LIRC_MODE_LIRCCODE) {
-			lirc_t sum;
-			ir_code decoded = rec_buffer.decoded;
+		return 1;
+	}
 
-			log_trace("decoded: %llx", decoded);
-			if (curr_driver->rec_mode == LIRC_MODE_LIRCCODE
-			    && curr_driver->code_length != bit_count(remote))
-				return 0;
+	if (!get_lead(remote)) {
+		log_trace("failed on leading pulse");
+		return decode_reject(DT_FAIL_LEAD);
+	}
 
-			ctx->post = decoded & gen_mask(remote->post_data_bits);
-			decoded >>= remote->post_data_bits;
-			ctx->code = decoded & gen_mask(remote->bits);
-			ctx->pre = decoded >> remote->bits;
+	if (has_pre(remote)) {
+		ctx->pre = get_pre(remote);
+		if (ctx->pre == (ir_code) -1) {
+			log_trace("failed on pre");
+			return decode_reject(DT_FAIL_PRE);
+		}
+		log_trace("pre: %llx", ctx->pre);
+	}
 
-			gettimeofday(&current, NULL);
-			sum = remote->phead + remote->shead +
-			      lirc_t_max(remote->pone + remote->sone,
-					 remote->pzero + remote->szero) * bit_count(remote) + remote->plead +
-			      remote->ptrail + remote->pfoot + remote->sfoot + remote->pre_p + remote->pre_s +
-			      remote->post_p + remote->post_s;
+	ctx->code = get_data(remote, remote->bits, remote->pre_data_bits);
+	if (ctx->code == (ir_code) -1) {
+		log_trace("failed on code");
+		return decode_reject(DT_FAIL_CODE);
+	}
+	log_trace("code: %llx", ctx->code);
 
-			rec_buffer.sum = sum >= remote->gap ? remote->gap - 1 : sum;
-			sync = time_elapsed(&remote->last_send, &current) - rec_buffer.sum;
+	if (has_post(remote)) {
+		ctx->post = get_post(remote);
+		if (ctx->post == (ir_code) -1) {
+			log_trace("failed on post");
+			return decode_reject(DT_FAIL_POST);
+		}
+		log_trace("post: %llx", ctx->post);
+	}
+	if (!get_trail(remote)) {
+		log_trace("failed on trailing pulse");
+		return decode_reject(DT_FAIL_TRAIL);
+	}
+	if (has_foot(remote)) {
+		if (!get_foot(remote)) {
+			log_trace("failed on foot");
+			return decode_reject(DT_FAIL_FOOT);
+		}
+	}
+	if (header == 1 && is_const(remote) && (remote->flags & NO_HEAD_REP))
+		rec_buffer.sum -= remote->phead + remote->shead;
+	if (generation == rec_buffer.generation)
+		mark_walk(remote, ctx, sync, sync_end);
+	return get_frame_end(remote);
+}
+
+
+/** decode_pulses() for the remote of rec_buffer_recall(). */
+static int decode_recalled(struct ir_remote*	remote,
+			   struct decode_ctx_t*	ctx,
+			   lirc_t*		sync)
+{
+	log_trace("using remembered decoding");
+	decode_trace_add(DT_RECALL, 0, recalled.rptr - 1, 0);
+	recalled.remote = NULL;
+	walk.remote = NULL;
+	ir_remote_check_limits(remote);
+	rec_buffer.rptr = recalled.rptr;
+	rec_buffer.sum = recalled.sum;
+	rec_buffer.is_biphase = is_biphase(remote) ? 1 : 0;
+	rec_buffer.too_long = 0;
+	rec_buffer.timed_out = 0;
+	set_pending_pulse(0);
+	set_pending_space(0);
+	*sync = recalled.sync;
+	ctx->pre = recalled.pre;
+	ctx->code = recalled.code;
+	ctx->post = recalled.post;
+	metrics_inc(METRIC_DECODE_RECALLED);
+	return get_frame_end(remote);
+}
+
+
+/** decode_pulses(), reusing the result for a remote with the same timing. */
+static int decode_pulses_memo(struct ir_remote* remote,
+			      struct decode_ctx_t* ctx,
+			      lirc_t* sync)
+{
+	struct decode_memo* memo;
+	unsigned int generation;
+	int result;
+
+	if (recalled.remote == remote
+	    && recalled.generation == rec_buffer.generation)
+		return decode_recalled(remote, ctx, sync);
+	/* Other decoders depend on more than the envelope. */
+	if (envelope.active && !can_track(remote))
+		envelope.active = 0;
+	if (!can_memoize(remote))
+		return decode_pulses(remote, ctx, sync);
+	memo = find_memo(remote);
+	if (memo != NULL) {
+		log_trace("using decoding of remote with same timing");
+		decode_trace_add(DT_MEMO, 0, memo->result, 0);
+		restore_state(&memo->state);
+		*sync = memo->sync;
+		ctx->pre = memo->pre;
+		ctx->code = memo->code;
+		ctx->post = memo->post;
+		walk = memo->mark;
+		if (walk.remote != NULL)
+			walk.remote = remote;
+		return memo->result;
+	}
+	generation = rec_buffer.generation;
+	result = decode_pulses(remote, ctx, sync);
+	/* More data might arrive if we wait once again. */
+	if (rec_buffer.timed_out || rec_buffer.generation != generation)
+		return result;
+	memo = &memos[memo_next];
+	memo_next = (memo_next + 1) % MEMO_SIZE;
+	memcpy(memo->timing, (const char*)remote + TIMING_BEGIN, TIMING_SIZE);
+	memo->last_remote = last_remote;
+	memo->generation = generation;
+	memo->result = result;
+	memo->sync = result ? *sync : 0;
+	memo->pre = ctx->pre;
+	memo->code = ctx->code;
+	memo->post = ctx->post;
+	memo->mark = walk;
+	save_state(&memo->state);
+	return result;
+}
+
+
+/** Hash of the first count edges, quantized by the tolerance of remote. */
+static uint32_t recall_key(const struct ir_remote* remote, int count)
+{
+	lirc_t quantum = 2 * (curr_driver->resolution > remote->aeps ?
+			      curr_driver->resolution : remote->aeps);
+	uint32_t h = 2166136261u;       /* FNV-1a */
+	lirc_t data;
+	int i;
+
+	if (quantum < 100)
+		quantum = 100;
+	for (i = 0; i < count; i++) {
+		data = *rbuf_slot(i);
+		h = (h ^ (data & PULSE_BIT ? 1 : 0)) * 16777619u;
+		h = (h ^ ((data & PULSE_MASK) + quantum / 2) / quantum)
+		    * 16777619u;
+	}
+	return h;
+}
+
+
+/**
+ * Return the entry to use for remote and key: the one it has already,
+ * else a free or the least recently used one.
+ */
+static struct recall* recall_slot(const struct ir_remote* remote,
+				  uint32_t key, unsigned int epoch)
+{
+	struct recall* oldest = &recalls[0];
+	struct recall* r;
+
+	for (r = recalls; r < recalls + RECALL_SIZE; r++) {
+		if (r->remotes == envelope.remotes && r->epoch == epoch
+		    && r->last_remote == envelope.last_remote
+		    && r->remote == remote && r->key == key)
+			return r;
+		if (r->remotes == NULL || r->epoch != epoch)
+			r->used = 0;
+		if (r->used < oldest->used)
+			oldest = r;
+	}
+	return oldest;
+}
+
+
+void rec_buffer_remember(const struct ir_remote* remotes,
+			 struct ir_remote* remote)
+{
+	unsigned int epoch = __atomic_load_n(&recall_epoch, __ATOMIC_ACQUIRE);
+	struct recall* r;
+	lirc_t sum = 0;
+	uint32_t key;
+	int i;
+
+	if (!envelope.active || envelope.remotes != remotes
+	    || envelope.generation != rec_buffer.generation
+	    || walk.remote != remote
+	    || walk.generation != rec_buffer.generation)
+		return;
+	envelope.active = 0;
+	walk.remote = NULL;
+	key = recall_key(remote, envelope.count);
+	r = recall_slot(remote, key, epoch);
+	for (i = 1; i < walk.rptr; i++)
+		sum += *rbuf_slot(i) & PULSE_MASK;
+	r->remotes = remotes;
+	r->last_remote = envelope.last_remote;
+	r->remote = remote;
+	r->epoch = epoch;
+	r->key = key;
+	r->used = ++recall_clock;
+	r->count = envelope.count;
+	r->rptr = walk.rptr;
+	r->sum_delta = walk.sum - sum;
+	r->pre = walk.pre;
+	r->code = walk.code;
+	r->post = walk.post;
+	memcpy(r->min, envelope.min, r->count * sizeof(*r->min));
+	memcpy(r->max, envelope.max, r->count * sizeof(*r->max));
+}
+
+
+/**
+ * Return true if the edges in the buffer are within the envelope of r,
+ * setting up recalled if so. Edges not yet buffered are read as
+ * decode_pulses() would, the others are compared in place.
+ */
+static int recall_matches(const struct recall* r)
+{
+	lirc_t sum = 0;
+	lirc_t data;
+	int i;
+
+	for (i = 0; i < r->count; i++) {
+		if (i < rec_buffer.wptr) {
+			data = *rbuf_slot(i);
 		} else {
-			if (!get_lead(remote)) {
-				log_trace("failed on leading pulse");
-				return 0;
-			}
+			rec_buffer.rptr = i;
+			data = get_next_rec_buffer(r->max[i] & PULSE_MASK);
+		}
+		if (data < r->min[i] || data > r->max[i])
+			return 0;
+	}
+	for (i = 1; i < r->rptr; i++)
+		sum += *rbuf_slot(i) & PULSE_MASK;
+	recalled.remote = r->remote;
+	recalled.generation = rec_buffer.generation;
+	recalled.rptr = r->rptr;
+	recalled.sum = sum + r->sum_delta;
+	recalled.sync = *rbuf_slot(0) & PULSE_MASK;
+	recalled.pre = r->pre;
+	recalled.code = r->code;
+	recalled.post = r->post;
+	return 1;
+}
 
-			if (has_pre(remote)) {
-				ctx->pre = get_pre(remote);
-				if (ctx->pre == (ir_code) -1) {
-					log_trace("failed on pre");
-					return 0;
-				}
-				log_trace("pre: %llx", ctx->pre);
-			}
 
-			ctx->code = get_data(remote, remote->bits, remote->pre_data_bits);
-			if (ctx->code == (ir_code) -1) {
-				log_trace("failed on code");
-				return 0;
-			}
-			log_trace("code: %llx", ctx->code);
+struct ir_remote* rec_buffer_recall(const struct ir_remote* remotes)
+{
+	unsigned int epoch = __atomic_load_n(&recall_epoch, __ATOMIC_ACQUIRE);
+	struct rbuf_state state;
+	unsigned int tried = 0;
+	struct recall* best;
+	int i;
 
-			if (has_post(remote)) {
-				ctx->post = get_post(remote);
-				if (ctx->post == (ir_code) -1) {
-					log_trace("failed on post");
-					return 0;
-				}
-				log_trace("post: %llx", ctx->post);
-			}
-			if (!get_trail(remote)) {
-				log_trace("failed on trailing pulse");
-				return 0;
-			}
-			if (has_foot(remote)) {
-				if (!get_foot(remote)) {
-					log_trace("failed on foot");
-					return 0;
-				}
-			}
-			if (header == 1 && is_const(remote) && (remote->flags & NO_HEAD_REP))
-				rec_buffer.sum -= remote->phead + remote->shead;
-			if (is_rcmm(remote)) {
-				if (!get_gap(remote, 1000))
-					return 0;
-			} else if (is_const(remote)) {
-				if (!get_gap(remote, min_gap(remote) > rec_buffer.sum ?
-					     min_gap(remote) - rec_buffer.sum :
-					     0))
-					return 0;
-			} else {
-				if (!get_gap(remote, min_gap(remote)))
-					return 0;
-			}
-		}               /* end of mode specific code */
+	recalled.remote = NULL;
+	envelope.active = 0;
+	if (!recall_enabled || remotes == NULL || update_mode
+	    || rec_buffer.end_report || rec_buffer.at_eof
+	    || (curr_driver->rec_mode != LIRC_MODE_MODE2
+		&& curr_driver->rec_mode != LIRC_MODE_PULSE
+		&& curr_driver->rec_mode != LIRC_MODE_RAW))
+		return NULL;
+	save_state(&state);
+	/* Most recently used first. */
+	while (1) {
+		best = NULL;
+		for (i = 0; i < RECALL_SIZE; i++) {
+			if (tried & (1u << i) || recalls[i].remotes != remotes
+			    || recalls[i].epoch != epoch
+			    || recalls[i].last_remote != last_remote)
+				continue;
+			if (best == NULL || recalls[i].used > best->used)
+				best = &recalls[i];
+		}
+		if (best == NULL)
+			break;
+		tried |= 1u << (best - recalls);
+		if (recall_matches(best)) {
+			best->used = ++recall_clock;
+			return best->remote;
+		}
+		restore_state(&state);
+	}
+	/* Record the envelope of this buffer while the remotes try it. */
+	envelope.active = 1;
+	envelope.remotes = remotes;
+	envelope.last_remote = last_remote;
+	envelope.generation = rec_buffer.generation;
+	envelope.count = 0;
+	/* Reusing decodings made before would miss their checks. */
+	for (i = 0; i < MEMO_SIZE; i++)
+		if (memos[i].generation == rec_buffer.generation)
+			memos[i].generation--;
+	if (burst.generation == rec_buffer.generation)
+		burst.generation--;
+	return NULL;
+}
+
+
+int rec_buffer_get_code(ir_code* code)
+{
+	if (curr_driver->rec_mode != LIRC_MODE_LIRCCODE
+	    && curr_driver->rec_mode != LIRC_MODE_SCANCODE)
+		return 0;
+	if (rec_buffer.at_eof)
+		return 0;
+	*code = rec_buffer.decoded;
+	return 1;
+}
+
+
+int receive_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
+{
+	lirc_t sync;
+	int ret;
+	struct timeval current;
+
+	sync = 0;               /* make compiler happy */
+	memset(ctx, 0, sizeof(struct decode_ctx_t));
+	current = rec_buffer.read_time;
+	ctx->time = current;
+	ctx->code = ctx->pre = ctx->post = 0;
+
+	if (rec_buffer.at_eof && rec_buffer.wptr - rec_buffer.rptr <= 1) {
+		log_debug("Decode: found EOF");
+		ctx->code = LIRC_EOF;
+		rec_buffer.at_eof = 0;
+		return 1;
+	}
+	decode_trace_attempt(remote);
+	if (curr_driver->rec_mode == LIRC_MODE_LIRCCODE
+	    || curr_driver->rec_mode == LIRC_MODE_SCANCODE) {
+		lirc_t sum;
+		ir_code decoded = rec_buffer.decoded;
+
+		if (is_raw(remote))
+			return decode_reject(DT_FAIL_RAW);
+		log_trace("decoded: %llx", decoded);
+		if (curr_driver->code_length != bit_count(remote))
+			return decode_reject(DT_FAIL_LENGTH);
+
+		ctx->post = decoded & gen_mask(remote->post_data_bits);
+		decoded >>= remote->post_data_bits;
+		ctx->code = decoded & gen_mask(remote->bits);
+		ctx->pre = decoded >> remote->bits;
+
+		sum = remote->phead + remote->shead +
+		      lirc_t_max(remote->pone + remote->sone,
+				 remote->pzero + remote->szero) * bit_count(remote) + remote->plead +
+		      remote->ptrail + remote->pfoot + remote->sfoot + remote->pre_p + remote->pre_s +
+		      remote->post_p + remote->post_s;
+
+		rec_buffer.sum = sum >= remote->gap ? remote->gap - 1 : sum;
+		sync = time_elapsed(&remote->last_send, &current) - rec_buffer.sum;
+	} else {
+		ret = decode_pulses_memo(remote, ctx, &sync);
+		if (ret == 0)
+			return 0;
+		if (ret == 2) {
+			decode_trace_add(DT_DECODED, 0, (uint32_t)ctx->code,
+					 (uint32_t)(ctx->code >> 32));
+			return 1;       /* repeat code, ctx is complete */
+		}
 	}
+	decode_trace_add(DT_DECODED, 0, (uint32_t)ctx->code,
+			 (uint32_t)(ctx->code >> 32));
 	if ((!has_repeat(remote) || remote->reps < remote->min_code_repeat)
 	    && expect_at_most(remote, sync, remote->max_remaining_gap))
 		ctx->repeat_flag = 1;
@@ -1249,6 +2730,9 @@ int receive_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
 		if (time_elapsed(&remote->last_send, &current) < 325000)
 			ctx->repeat_flag = 1;
 	}
+	if (curr_driver->rec_mode == LIRC_MODE_SCANCODE)
+		/* The driver knows better, from the protocol. */
+		ctx->repeat_flag = rec_buffer.repeat;
 	if (is_const(remote)) {
 		ctx->min_remaining_gap = min_gap(remote) > rec_buffer.sum ? min_gap(remote) - rec_buffer.sum : 0;
 		ctx->max_remaining_gap = max_gap(remote) > rec_buffer.sum ? max_gap(remote) - rec_buffer.sum : 0;
@@ -46,6 +46,79 @@ void rec_set_update_mode(int mode);
  */
 void rec_buffer_set_logfile(FILE* f);
 
+/**
+ * Like rec_buffer_set_logfile(), but log in the binary format described
+ * in mode2_file.h, with a header written right away.
+ * @param f Open file to write on or NULL to disable logging.
+ * @return 1 on success, 0 if the header cannot be written, in which
+ *     case f is closed and logging is disabled.
+ */
+int rec_buffer_set_binary_logfile(FILE* f);
+
+/**
+ * Enable or disable the virtual receive clock. When enabled, the time
+ * stamps used when decoding (repeats, gaps, release timeouts) are the
+ * sum of the received durations rather than the monotonic clock, and
+ * a timed out read advances it by the timeout. Replaying a recording
+ * then decodes the same way regardless of how fast it is read. The
+ * clock starts at the current monotonic time.
+ */
+void rec_set_virtual_clock(int enabled);
+
+/** Return true if the virtual receive clock is enabled. */
+int rec_get_virtual_clock(void);
+
+/**
+ * Enable or disable low latency decoding. When enabled, a signal is
+ * decoded as soon as the last edge of a frame is read if no more input
+ * is available, instead of waiting for the trailing gap to be long
+ * enough, which delays each keypress by about one gap. The gap is still
+ * read before the next signal and decides if it is a repeat. Codes which
+ * are a prefix of a longer code of another remote may be mistaken for
+ * it. Disabled by default.
+ */
+void rec_set_low_latency(int enabled);
+
+/** Return true if low latency decoding is enabled. */
+int rec_get_low_latency(void);
+
+/**
+ * Enable or disable remembering decoded bursts. When enabled, the edges
+ * of each signal decoded into a code are remembered along with the
+ * range of durations decoding the same way for the remote, and a new
+ * burst within the ranges of a remembered one is decoded without trying
+ * the remotes one by one. Disabled by default.
+ */
+void rec_set_recall(int enabled);
+
+/**
+ * Return the remote of a remembered burst matching the buffer, set up
+ * so that its next receive_decode() returns the remembered result
+ * without decoding again, NULL if none. Rewinds the buffer.
+ * @param remotes The list of remotes decoded.
+ */
+struct ir_remote* rec_buffer_recall(const struct ir_remote* remotes);
+
+/**
+ * Remember the burst just decoded for remote, if receive_decode() found
+ * it to be plain enough, see rec_set_recall().
+ * @param remotes The list of remotes decoded.
+ */
+void rec_buffer_remember(const struct ir_remote* remotes,
+			 struct ir_remote* remote);
+
+/**
+ * Forget all remembered bursts, must be called when remotes are freed.
+ * Thread safe.
+ */
+void rec_buffer_forget_remotes(void);
+
+/**
+ * Current receive time: the virtual clock if enabled, else the
+ * monotonic clock as of get_monotonic_time().
+ */
+void rec_get_time(struct timeval* tv);
+
 /** Return actual timeout to use given MIN_RECEIVE_TIMEOUT limitation. */
 static inline lirc_t receive_timeout(lirc_t usec)
 {
@@ -69,15 +142,98 @@ int waitfordata(uint32_t maxusec);
 void set_waitfordata_func(int (*func)(uint32_t maxusec));
 
 
+/**
+ * Receiver state: the internal fifo, decoding caches and last_remote.
+ * All receive functions and decode_all() use the context selected by
+ * the calling thread, by default one shared by all threads.
+ */
+struct rec_context;
+
+/** Return a new receiver context, NULL on errors. */
+struct rec_context* rec_context_new(void);
+
+/** Dispose a context from rec_context_new(), deselecting it if used. */
+void rec_context_free(struct rec_context* ctx);
+
+/**
+ * Make ctx the context used by the calling thread. A context must
+ * not be selected by more than one thread at a time.
+ *
+ * @param ctx Context from rec_context_new(), NULL for the default one.
+ * @return The previously selected context, NULL for the default one.
+ */
+struct rec_context* rec_context_select(struct rec_context* ctx);
+
 /** Clear internal buffer to pristine state. */
 void rec_buffer_init(void);
 
+/**
+ * Set the number of edges the internal fifo can hold, by default 512.
+ * Resets the fifo. Must not be used while decoding.
+ *
+ * @param size New capacity, at least 64.
+ * @return 1 on success, 0 on errors.
+ */
+int rec_buffer_set_size(int size);
+
+/**
+ * Return the number of pulses/spaces read from a driver using
+ * readdata_bulk() which are not yet in the internal fifo, or 1 if
+ * the driver's rec_pending() reports buffered input. Callers
+ * waiting on the driver fd before decoding should not block while
+ * this is non-zero.
+ */
+int rec_buffer_pending(void);
+
+/**
+ * Queue pulses and spaces to be decoded by rec_buffer_decode_injected()
+ * as if the driver had returned them, e. g. to test decoding. Only for
+ * LIRC_MODE_MODE2 drivers.
+ *
+ * @param data Durations, PULSE_BIT set for pulses.
+ * @param count Number of durations.
+ * @return 0 if out of memory, else 1.
+ */
+int rec_buffer_inject(const lirc_t* data, int count);
+
+/**
+ * Decode queued rec_buffer_inject() input, up to the next decoded code.
+ * The driver is not read, the end of the queue is a timeout.
+ *
+ * @return Decoded code as for decode_all(), NULL when the queue is empty.
+ */
+char* rec_buffer_decode_injected(struct ir_remote* remotes);
+
 /**
  * Flush the internal fifo and store a single code read
- * from the driver in it.
+ * from the driver in it. If the last decoding overflowed the fifo
+ * the edges since the longest gap are kept and decoded again.
  */
 int rec_buffer_clear(void);
 
+/**
+ * Store a code decoded by the hardware, for drivers in
+ * LIRC_MODE_SCANCODE and for LIRC_MODE_LIRCCODE drivers which do not
+ * provide the code through drv.fd. Used instead of rec_buffer_clear();
+ * the code is matched like a drv.code_length bits LIRCCODE code.
+ *
+ * @param code Code as received, protocol ids included.
+ * @param time Monotonic time when the code was decoded.
+ * @param repeat Non-zero if the hardware reports a repeated code,
+ *     only used in LIRC_MODE_SCANCODE.
+ */
+void rec_buffer_set_code(ir_code code, const struct timeval* time,
+			 int repeat);
+
+/**
+ * Return the code waiting to be decoded in LIRC_MODE_LIRCCODE and
+ * LIRC_MODE_SCANCODE.
+ *
+ * @param[out] code The code, as in rec_buffer_set_code().
+ * @return 1 if *code was set, 0 in other modes or at end of file.
+ */
+int rec_buffer_get_code(ir_code* code);
+
 /**
  * Decode data from remote
  *
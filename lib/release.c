@@ -34,46 +34,55 @@
 
 static const logchannel_t logchannel = LOG_LIB;
 
-static struct timeval release_time;
-static struct ir_remote* release_remote;
-static struct ir_ncode* release_ncode;
-static ir_code release_code;
-static int release_reps;
-static lirc_t release_gap;
-
-static struct ir_remote* release_remote2;
-static struct ir_ncode* release_ncode2;
-static ir_code release_code2;
-
-static void register_input(void)
-{
-	struct timeval gap;
+/** Max number of remotes with a pending release. */
+#define MAX_RELEASES 8
 
-	if (release_remote == NULL)
-		return;
+/** The last press of a remote, see register_button_press(). */
+struct release_state {
+	struct ir_remote*	remote;
+	struct ir_ncode*	ncode;
+	ir_code			code;
+	int			reps;
+	struct timeval		time;   /**< Release is expected then. */
+};
 
-	timerclear(&gap);
-	gap.tv_usec = release_gap;
+/* One entry per remote, so concurrent remotes don't overwrite. */
+static struct release_state releases[MAX_RELEASES];
+static struct release_state* last_release = NULL;
 
-	gettimeofday(&release_time, NULL);
-	timeradd(&release_time, &gap, &release_time);
+
+/** Return the entry of remote, else an unused or the oldest one. */
+static struct release_state* get_release_state(struct ir_remote* remote)
+{
+	struct release_state* found = &releases[0];
+	int i;
+
+	for (i = 0; i < MAX_RELEASES; i++) {
+		if (releases[i].remote == remote)
+			return &releases[i];
+		if (found->remote == NULL)
+			continue;
+		if (releases[i].remote == NULL
+		    || timercmp(&releases[i].time, &found->time, <))
+			found = &releases[i];
+	}
+	return found;
 }
 
+
 void register_button_press(struct ir_remote* remote,
 			   struct ir_ncode*  ncode,
 			   ir_code           code,
 			   int               reps)
 {
-	if (reps == 0 && release_remote != NULL) {
-		release_remote2 = release_remote;
-		release_ncode2 = release_ncode;
-		release_code2 = release_code;
-	}
+	struct release_state* state = get_release_state(remote);
+	struct timeval gap;
+	lirc_t release_gap;
 
-	release_remote = remote;
-	release_ncode = ncode;
-	release_code = code;
-	release_reps = reps;
+	state->remote = remote;
+	state->ncode = ncode;
+	state->code = code;
+	state->reps = reps;
 	/* some additional safety margin */
 	release_gap = upper_limit(remote,
 				  remote->max_total_signal_length
@@ -82,17 +91,21 @@ void register_button_press(struct ir_remote* remote,
 						    remote->min_gap_length))
 		      + 10000;
 	log_trace("release_gap: %lu", release_gap);
-	register_input();
+	timerclear(&gap);
+	gap.tv_usec = release_gap;
+	rec_get_time(&state->time);
+	timeradd(&state->time, &gap, &state->time);
+	last_release = state;
 }
 
 void get_release_data(const char** remote_name,
 		      const char** button_name,
 		      int*         reps)
 {
-	if (release_remote != NULL) {
-		*remote_name = release_remote->name;
-		*button_name = release_ncode->name;
-		*reps = release_reps;
+	if (last_release != NULL) {
+		*remote_name = last_release->remote->name;
+		*button_name = last_release->ncode->name;
+		*reps = last_release->reps;
 	} else {
 		*remote_name = *button_name = "(NULL)";
 		*reps = 0;
@@ -102,5 +115,16 @@ void get_release_data(const char** remote_name,
 
 void get_release_time(struct timeval* tv)
 {
-	*tv = release_time;
+	struct timeval now;
+	int i;
+
+	rec_get_time(&now);
+	timerclear(tv);
+	for (i = 0; i < MAX_RELEASES; i++) {
+		if (releases[i].remote == NULL
+		    || timercmp(&releases[i].time, &now, <))
+			continue;
+		if (!timerisset(tv) || timercmp(&releases[i].time, tv, <))
+			*tv = releases[i].time;
+	}
 }
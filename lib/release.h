@@ -23,6 +23,8 @@ extern "C" {
 /**
  * Set up pending events for given button, including the
  * release_gap. Data is saved to be retrieved using get_release_data().
+ * Each remote has its own pending release, so presses on another
+ * remote don't cancel it.
  */
 void register_button_press(struct ir_remote* remote,
 			   struct ir_ncode*  ncode,
@@ -36,7 +38,8 @@ void get_release_data(const char** remote_name,
 		      int*         reps);
 
 /**
- *  Get time for last call to register_button_press() if defined, else a noop.
+ * Get the time of the first pending release of all remotes, cleared if
+ * there is none.
  */
 void get_release_time(struct timeval* tv);
 
@@ -0,0 +1,233 @@
+/****************************************************************************
+** sample_ring.c ***********************************************************
+****************************************************************************
+*/
+
+/**
+ * @file sample_ring.c
+ * @brief Implements sample_ring.h.
+ *
+ * The producer only writes head, the consumer only writes tail; both
+ * are free running counters. The doorbell fd is cleared by the
+ * consumer when it finds the ring empty, just before it sets armed.
+ * Whoever takes armed back rings the doorbell, so there is at most one
+ * syscall for each time the consumer went idle, and the fd stays
+ * readable as long as the ring isn't empty.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "lirc_log.h"
+#include "receive.h"
+#include "sample_ring.h"
+
+static const logchannel_t logchannel = LOG_LIB;
+
+/** The part of a ring shared by producer and consumer. */
+struct ring_shared {
+	/** Samples put, written by the producer. */
+	uint32_t	head __attribute__((aligned(64)));
+	/** Samples got, written by the consumer. */
+	uint32_t	tail __attribute__((aligned(64)));
+	/** Set by the consumer while waiting on the doorbell. */
+	int		armed;
+	/** Samples not stored on a full ring, written by the producer. */
+	unsigned long	dropped;
+	lirc_t		data[] __attribute__((aligned(64)));
+};
+
+struct sample_ring {
+	struct ring_shared*	shared;
+	size_t			map_size;
+	uint32_t		mask;
+	int			fd[2];  /**< Doorbell, read and write end. */
+};
+
+
+static int doorbell_open(int fd[2])
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return fd[0] != -1;
+#else
+	int i;
+
+	if (pipe(fd) == -1)
+		return 0;
+	for (i = 0; i < 2; i++) {
+		fcntl(fd[i], F_SETFL, fcntl(fd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+	}
+	return 1;
+#endif
+}
+
+
+static void doorbell_ring(struct sample_ring* ring)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	uint64_t value = 1;
+#else
+	char value = 1;
+#endif
+
+	/* The doorbell never fills up: it's cleared before armed is set. */
+	if (write(ring->fd[1], &value, sizeof(value)) != sizeof(value))
+		log_perror_debug("sample_ring: doorbell");
+}
+
+
+static void doorbell_clear(struct sample_ring* ring)
+{
+	char buff[64];
+
+	while (read(ring->fd[0], buff, sizeof(buff)) > 0)
+		;
+}
+
+
+struct sample_ring* sample_ring_new(int size)
+{
+	struct sample_ring* ring;
+	uint32_t capacity;
+
+	for (capacity = 64; capacity < (uint32_t)size; capacity *= 2)
+		;
+	ring = (struct sample_ring*)calloc(1, sizeof(struct sample_ring));
+	if (ring == NULL)
+		return NULL;
+	ring->mask = capacity - 1;
+	ring->map_size = sizeof(struct ring_shared) + capacity * sizeof(lirc_t);
+	ring->shared = (struct ring_shared*)mmap(NULL, ring->map_size,
+						 PROT_READ | PROT_WRITE,
+						 MAP_SHARED | MAP_ANONYMOUS,
+						 -1, 0);
+	if (ring->shared == MAP_FAILED) {
+		log_perror_err("sample_ring: mmap");
+		free(ring);
+		return NULL;
+	}
+	if (!doorbell_open(ring->fd)) {
+		log_perror_err("sample_ring: doorbell");
+		munmap(ring->shared, ring->map_size);
+		free(ring);
+		return NULL;
+	}
+	/* Empty, with a clear doorbell: the first put must ring. */
+	ring->shared->armed = 1;
+	return ring;
+}
+
+
+void sample_ring_free(struct sample_ring* ring)
+{
+	if (ring == NULL)
+		return;
+	close(ring->fd[0]);
+	if (ring->fd[1] != ring->fd[0])
+		close(ring->fd[1]);
+	munmap(ring->shared, ring->map_size);
+	free(ring);
+}
+
+
+int sample_ring_fd(const struct sample_ring* ring)
+{
+	return ring->fd[0];
+}
+
+
+int sample_ring_put(struct sample_ring* ring, const lirc_t* data, int count)
+{
+	struct ring_shared* shared = ring->shared;
+	uint32_t head = shared->head;
+	uint32_t tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+	uint32_t space = ring->mask + 1 - (head - tail);
+	uint32_t pos = head & ring->mask;
+	uint32_t n;
+
+	if ((uint32_t)count > space) {
+		__atomic_store_n(&shared->dropped,
+				 shared->dropped + count - space,
+				 __ATOMIC_RELAXED);
+		count = space;
+	}
+	if (count <= 0)
+		return 0;
+	n = ring->mask + 1 - pos;
+	if (n > (uint32_t)count)
+		n = count;
+	memcpy(shared->data + pos, data, n * sizeof(lirc_t));
+	memcpy(shared->data, data + n, (count - n) * sizeof(lirc_t));
+	/* Orders head before armed, pairs with sample_ring_get(). */
+	__atomic_store_n(&shared->head, head + count, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shared->armed, __ATOMIC_SEQ_CST)
+	    && __atomic_exchange_n(&shared->armed, 0, __ATOMIC_SEQ_CST))
+		doorbell_ring(ring);
+	return count;
+}
+
+
+int sample_ring_get(struct sample_ring* ring, lirc_t* data, int count)
+{
+	struct ring_shared* shared = ring->shared;
+	uint32_t tail = shared->tail;
+	uint32_t head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+	uint32_t pos;
+	uint32_t n;
+
+	if (head == tail) {
+		doorbell_clear(ring);
+		__atomic_store_n(&shared->armed, 1, __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&shared->head, __ATOMIC_SEQ_CST);
+		if (head == tail)
+			return 0;
+		/* Raced with a put: make sure the doorbell is rung. */
+		if (__atomic_exchange_n(&shared->armed, 0, __ATOMIC_SEQ_CST))
+			doorbell_ring(ring);
+	}
+	if ((uint32_t)count > head - tail)
+		count = head - tail;
+	if (count <= 0)
+		return 0;
+	pos = tail & ring->mask;
+	n = ring->mask + 1 - pos;
+	if (n > (uint32_t)count)
+		n = count;
+	memcpy(data, shared->data + pos, n * sizeof(lirc_t));
+	memcpy(data + n, shared->data, (count - n) * sizeof(lirc_t));
+	__atomic_store_n(&shared->tail, tail + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+
+unsigned long sample_ring_dropped(const struct sample_ring* ring)
+{
+	return __atomic_load_n(&ring->shared->dropped, __ATOMIC_RELAXED);
+}
+
+
+lirc_t sample_ring_readdata(struct sample_ring* ring, lirc_t timeout)
+{
+	lirc_t data;
+
+	if (sample_ring_get(ring, &data, 1) == 1)
+		return data;
+	if (!waitfordata(timeout))
+		return 0;
+	return sample_ring_get(ring, &data, 1) == 1 ? data : 0;
+}
@@ -0,0 +1,79 @@
+/****************************************************************************
+** sample_ring.h ***********************************************************
+****************************************************************************
+*/
+
+/**
+ * @file sample_ring.h
+ * @brief Single producer, single consumer queue of pulses/spaces.
+ * @ingroup driver_api
+ *
+ * A ring of lirc_t in shared memory, for drivers which collect data in a
+ * forked child process or a callback thread. Samples are passed without
+ * any syscall while the consumer is busy; a file descriptor usable as
+ * drv.fd becomes readable when samples are available.
+ *
+ * A ring must be created before forking. Afterwards one process or
+ * thread may only put samples in it and one other only get them.
+ */
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ir_remote_types.h"
+
+struct sample_ring;
+
+/**
+ * Create a new ring.
+ *
+ * @param size Capacity in samples, rounded up to a power of two.
+ * @return New ring, NULL on errors.
+ */
+struct sample_ring* sample_ring_new(int size);
+
+/** Dispose a ring created by sample_ring_new(), NULL is a no-op. */
+void sample_ring_free(struct sample_ring* ring);
+
+/**
+ * Return a fd which is readable while the ring is not empty, to be
+ * polled by the consumer. It is never read by callers.
+ */
+int sample_ring_fd(const struct sample_ring* ring);
+
+/**
+ * Add samples to the ring, producer side. Never blocks.
+ *
+ * @return Number of samples stored, less than count if the ring
+ *     is full.
+ */
+int sample_ring_put(struct sample_ring* ring, const lirc_t* data, int count);
+
+/**
+ * Remove samples from the ring, consumer side. Never blocks.
+ *
+ * @return Number of samples stored in data, 0 if the ring is empty.
+ */
+int sample_ring_get(struct sample_ring* ring, lirc_t* data, int count);
+
+/** Return the number of samples sample_ring_put() could not store. */
+unsigned long sample_ring_dropped(const struct sample_ring* ring);
+
+/**
+ * Implement a driver's readdata() using a ring. drv.fd must be
+ * sample_ring_fd(ring).
+ *
+ * @param timeout Max time to wait for a sample (us).
+ * @return Next sample, 0 on timeout.
+ */
+lirc_t sample_ring_readdata(struct sample_ring* ring, lirc_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_RING_H */
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -536,24 +537,218 @@ int tty_clear(int fd, int rts, int dtr)
 	return 1;
 }
 
-int tty_write(int fd, char byte)
+/** Nominal speeds for the Bxxx constants, used by tty_char_time_us(). */
+static const struct {
+	speed_t speed;
+	unsigned int baud;
+} speeds[] = {
+	{ B300, 300 }, { B1200, 1200 }, { B2400, 2400 },
+	{ B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+	{ B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 },
+#ifdef B230400
+	{ B230400, 230400 },
+#endif
+#ifdef B460800
+	{ B460800, 460800 },
+#endif
+#ifdef B921600
+	{ B921600, 921600 },
+#endif
+	{ B0, 0 }
+};
+
+unsigned int tty_char_time_us(int fd)
 {
-	if (write(fd, &byte, 1) != 1) {
-		log_trace("tty_write(): write() failed");
-		log_perror_debug("tty_write()");
-		return -1;
+	struct termios options;
+	speed_t speed;
+	unsigned int baud = 9600;
+	int i;
+
+	if (tcgetattr(fd, &options) == 0) {
+		speed = cfgetospeed(&options);
+		for (i = 0; speeds[i].baud != 0; i += 1) {
+			if (speeds[i].speed == speed) {
+				baud = speeds[i].baud;
+				break;
+			}
+		}
 	}
-	/* wait until the stop bit of Control Byte is sent
-	 * (for 9600 baud rate, it takes about 100 msec */
-	usleep(100 * 1000);
+	/* Start bit, 8 data bits, parity or stop bit and a stop bit. */
+	return 11 * 1000000 / baud + 1;
+}
 
-	/* we don't wait because tcdrain() does this for us */
-	/* tcdrain(fd); */
-	/* FIXME! but unfortunately this does not seem to be
-	 * implemented in 2.0.x kernels ... */
+int tty_drain(int fd, size_t count)
+{
+	int r;
+
+	do
+		r = tcdrain(fd);
+	while (r == -1 && errno == EINTR);
+	if (r == 0)
+		return 1;
+	/* Not a tty, or a driver which cannot tell: assume the worst. */
+	log_trace("tty_drain(): tcdrain() failed, sleeping");
+	usleep(count * tty_char_time_us(fd));
 	return 1;
 }
 
+int tty_write_buf(int fd, const void* buf, size_t count)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLOUT, .revents = 0};
+	const char* p = (const char*)buf;
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < count) {
+		r = write(fd, p + done, count - done);
+		if (r > 0) {
+			done += r;
+			continue;
+		}
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r == -1 && errno == EAGAIN) {
+			/* Non-blocking fd with a full output buffer. */
+			if (curl_poll(&pfd, 1, 1000) == 1)
+				continue;
+			log_error("tty_write_buf(): output timeout");
+			return -1;
+		}
+		log_trace("tty_write_buf(): write() failed");
+		log_perror_debug("tty_write_buf()");
+		return -1;
+	}
+	tty_drain(fd, count);
+	return count;
+}
+
+int tty_read_buf(int fd, void* buf, size_t count, int timeout_ms)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+	struct timespec now;
+	struct timespec deadline;
+	char* p = (char*)buf;
+	size_t done = 0;
+	long left;
+	ssize_t r;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	while (done < count) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = (deadline.tv_sec - now.tv_sec) * 1000
+		       + (deadline.tv_nsec - now.tv_nsec) / 1000000L;
+		if (left < 0)
+			left = 0;
+		ret = curl_poll(&pfd, 1, left);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1) {
+			log_perror_debug("tty_read_buf(): curl_poll() failed");
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		r = read(fd, p + done, count - done);
+		if (r > 0)
+			done += r;
+		else if (r == 0 || (errno != EAGAIN && errno != EINTR))
+			break;
+	}
+	return done;
+}
+
+int tty_write_expect(int fd, const void* buf, size_t count,
+		     const char* expect, int timeout_ms)
+{
+	char reply[64];
+	size_t len = strlen(expect);
+	int r;
+
+	if (len > sizeof(reply))
+		len = sizeof(reply);
+	if (tty_write_buf(fd, buf, count) == -1)
+		return -1;
+	r = tty_read_buf(fd, reply, len, timeout_ms);
+	if (r == -1)
+		return -1;
+	if ((size_t)r < len) {
+		log_debug("tty_write_expect(): got %d of %d bytes",
+			  r, (int)len);
+		return 0;
+	}
+	return memcmp(reply, expect, len) == 0;
+}
+
+/** Bytes queued by tty_write_async(), written by tty_flush_async(). */
+static struct {
+	int	fd;
+	size_t	len;
+	char	buf[256];
+} outq = { -1, 0, { 0 } };
+
+size_t tty_async_pending(int fd)
+{
+	return outq.fd == fd ? outq.len : 0;
+}
+
+int tty_flush_async(int fd)
+{
+	ssize_t r;
+	int flags;
+
+	if (outq.fd != fd || outq.len == 0)
+		return 0;
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1)
+		goto err;
+	if (!(flags & O_NONBLOCK))
+		(void)fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	r = write(fd, outq.buf, outq.len);
+	if (!(flags & O_NONBLOCK))
+		(void)fcntl(fd, F_SETFL, flags);
+	if (r == -1 && (errno == EAGAIN || errno == EINTR))
+		return outq.len;
+	if (r <= 0)
+		goto err;
+	memmove(outq.buf, outq.buf + r, outq.len - r);
+	outq.len -= r;
+	return outq.len;
+err:
+	log_perror_debug("tty_flush_async()");
+	outq.len = 0;
+	return -1;
+}
+
+int tty_write_async(int fd, const void* buf, size_t count)
+{
+	if (outq.len > 0 && outq.fd != fd) {
+		log_error("tty_write_async(): output pending on another fd");
+		return -1;
+	}
+	if (count > sizeof(outq.buf) - outq.len) {
+		log_error("tty_write_async(): output queue full");
+		return -1;
+	}
+	outq.fd = fd;
+	memcpy(outq.buf + outq.len, buf, count);
+	outq.len += count;
+	return tty_flush_async(fd) == -1 ? -1 : 0;
+}
+
+int tty_write(int fd, char byte)
+{
+	/* Returns when the stop bit is sent, rather than after a fixed
+	 * 100 ms which only fits 9600 baud. */
+	return tty_write_buf(fd, &byte, 1) == -1 ? -1 : 1;
+}
+
 int tty_read(int fd, char* byte)
 {
 	struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
@@ -27,6 +27,8 @@
 #ifndef _SERIAL_H
 #define _SERIAL_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -111,7 +113,89 @@ int tty_set(int fd, int rts, int dtr);
 int tty_clear(int fd, int rts, int dtr);
 
 /**
- * Write a single byte to serial device.
+ * Return the time to send one character at the current output speed,
+ * assuming 9600 baud if unknown.
+ *
+ * @param fd File opened on a serial device.
+ * @return Microseconds per character.
+ */
+unsigned int tty_char_time_us(int fd);
+
+/**
+ * Wait until all output written to fd is sent using tcdrain(). If the
+ * device can't tell, sleep for the time count characters would take.
+ *
+ * @param fd File opened on a serial device.
+ * @param count Number of characters recently written.
+ * @return 1.
+ */
+int tty_drain(int fd, size_t count);
+
+/**
+ * Write a buffer to serial device and wait until it is sent. Handles
+ * short writes and non-blocking fds.
+ *
+ * @param fd File opened on a serial device.
+ * @param buf Data to write.
+ * @param count Size of buf.
+ * @return -1 on errors, else count.
+ */
+int tty_write_buf(int fd, const void* buf, size_t count);
+
+/**
+ * Read count bytes from serial device, returning as soon as they are
+ * available or when timeout_ms has passed.
+ *
+ * @param fd File opened on a serial device.
+ * @param buf Where to store data.
+ * @param count Number of bytes wanted.
+ * @param timeout_ms Max time to wait for all of them.
+ * @return -1 on errors, else the number of bytes read, possibly less
+ *     than count on timeout.
+ */
+int tty_read_buf(int fd, void* buf, size_t count, int timeout_ms);
+
+/**
+ * Write a command and check that the device replies with expect,
+ * typically an acknowledge like "OK".
+ *
+ * @param fd File opened on a serial device.
+ * @param buf Command to write.
+ * @param count Size of buf.
+ * @param expect Expected reply, at most 64 bytes are checked.
+ * @param timeout_ms Max time to wait for the reply.
+ * @return 1 if reply matches, 0 on mismatch or timeout, -1 on errors.
+ */
+int tty_write_expect(int fd, const void* buf, size_t count,
+		     const char* expect, int timeout_ms);
+
+/**
+ * Queue data to be written to serial device without blocking. What
+ * can be written at once is written, the remainder is written by
+ * tty_flush_async(). lircd does this when the driver fd is writable,
+ * so drivers can use this from their rec_func() and send_func().
+ * Only one fd can have queued output.
+ *
+ * @param fd File opened on a serial device.
+ * @param buf Data to write.
+ * @param count Size of buf, the queue holds 256 bytes.
+ * @return -1 on errors or if queue is full, else 0.
+ */
+int tty_write_async(int fd, const void* buf, size_t count);
+
+/**
+ * Write data queued by tty_write_async() without blocking.
+ *
+ * @param fd File opened on a serial device.
+ * @return -1 on errors, else the number of bytes still queued.
+ */
+int tty_flush_async(int fd);
+
+/** Return the number of bytes queued by tty_write_async() for fd. */
+size_t tty_async_pending(int fd);
+
+/**
+ * Write a single byte to serial device and wait until it is sent.
  *
  * @param fd File opened on a serial device.
  * @param byte Item to write.
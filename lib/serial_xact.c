@@ -0,0 +1,441 @@
+/****************************************************************************
+** serial_xact.c ***********************************************************
+****************************************************************************
+*/
+
+/**
+ * @file serial_xact.c
+ * @brief Implements serial_xact.h.
+ *
+ * The device fd and a timerfd for the reply timeout are added to an
+ * epoll set, the epoll fd is what the driver polls. The device is
+ * polled for writing only while a command is partially written.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#define HAVE_SERIAL_XACT 1
+#endif
+
+#include "lirc_log.h"
+#include "serial_xact.h"
+
+static const logchannel_t logchannel = LOG_LIB;
+
+struct xact_entry {
+	char*			cmd;
+	size_t			size;
+	size_t			written;
+	int			timeout;        /**< ms, once written. */
+	serial_xact_match	match;
+	serial_xact_done	done;
+	void*			arg;
+	struct xact_entry*	next;
+};
+
+struct serial_xact {
+	int			fd;
+	int			epfd;
+	int			timerfd;
+	serial_xact_input	input;
+	void*			arg;
+	struct xact_entry*	head;           /**< In flight when written. */
+	struct xact_entry*	tail;
+	int			count;
+	uint64_t		deadline;       /**< Of head, us, 0 if none. */
+	int			polling_out;    /**< EPOLLOUT is set. */
+	int			failed;
+	size_t			length;         /**< Of data in buf. */
+	char			buf[SERIAL_XACT_BUFSIZE];
+};
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+int serial_xact_match_line(const char* data, size_t size, void* arg)
+{
+	const char* eol = (const char*)memchr(data, '\n', size);
+
+	return eol == NULL ? 0 : eol - data + 1;
+}
+
+
+#ifdef HAVE_SERIAL_XACT
+
+static void set_polling_out(struct serial_xact* xact, int on)
+{
+	struct epoll_event ev;
+
+	if (xact->polling_out == on)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+	ev.data.fd = xact->fd;
+	if (epoll_ctl(xact->epfd, EPOLL_CTL_MOD, xact->fd, &ev) == -1)
+		log_perror_warn("serial_xact: cannot poll fd %d", xact->fd);
+	xact->polling_out = on;
+}
+
+
+static void arm_timer(struct serial_xact* xact)
+{
+	struct itimerspec its;
+	uint64_t now;
+	uint64_t left;
+
+	memset(&its, 0, sizeof(its));
+	if (xact->deadline != 0) {
+		now = now_us();
+		left = xact->deadline > now ? xact->deadline - now : 1;
+		its.it_value.tv_sec = left / 1000000;
+		its.it_value.tv_nsec = (left % 1000000) * 1000;
+	}
+	timerfd_settime(xact->timerfd, 0, &its, NULL);
+}
+
+
+/** Remove head and run its callback. */
+static void complete(struct serial_xact* xact,
+		     enum serial_xact_status status,
+		     const char* reply, size_t size)
+{
+	struct xact_entry* entry = xact->head;
+
+	xact->head = entry->next;
+	if (xact->head == NULL)
+		xact->tail = NULL;
+	xact->count--;
+	xact->deadline = 0;
+	if (entry->done != NULL)
+		entry->done(status, reply, size, entry->arg);
+	free(entry->cmd);
+	free(entry);
+}
+
+
+/** Write as much of the head command as possible, start next ones. */
+static void start_head(struct serial_xact* xact)
+{
+	struct xact_entry* entry;
+	ssize_t r;
+
+	while ((entry = xact->head) != NULL) {
+		if (entry->written == entry->size) {
+			if (entry->match != NULL)
+				break;          /* Waiting for reply. */
+			complete(xact, SERIAL_XACT_OK, NULL, 0);
+			continue;
+		}
+		r = write(xact->fd, entry->cmd + entry->written,
+			  entry->size - entry->written);
+		if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
+			set_polling_out(xact, 1);
+			return;
+		}
+		if (r <= 0) {
+			log_perror_err("serial_xact: write");
+			xact->failed = 1;
+			complete(xact, SERIAL_XACT_ERROR, NULL, 0);
+			continue;
+		}
+		entry->written += r;
+		if (entry->written == entry->size && entry->match != NULL) {
+			xact->deadline = now_us() + entry->timeout * 1000ULL;
+			break;
+		}
+	}
+	set_polling_out(xact, 0);
+	arm_timer(xact);
+}
+
+
+/** Match buffered input against the reply or pass it as input. */
+static void process_input(struct serial_xact* xact)
+{
+	struct xact_entry* entry;
+	size_t used;
+	int r;
+
+	while (xact->length > 0) {
+		entry = xact->head;
+		r = -1;
+		if (entry != NULL && entry->written == entry->size
+		    && entry->match != NULL)
+			r = entry->match(xact->buf, xact->length, entry->arg);
+		if (r > 0) {
+			used = r;
+			complete(xact, SERIAL_XACT_OK, xact->buf, used);
+			start_head(xact);
+		} else if (r == 0) {
+			break;
+		} else if (xact->input != NULL) {
+			used = xact->input(xact->buf, xact->length, xact->arg);
+			if (used == 0)
+				break;
+		} else {
+			used = xact->length;
+		}
+		if (used > xact->length)
+			used = xact->length;
+		memmove(xact->buf, xact->buf + used, xact->length - used);
+		xact->length -= used;
+	}
+	if (xact->length == sizeof(xact->buf)) {
+		log_warn("serial_xact: input buffer full, dropped");
+		xact->length = 0;
+	}
+}
+
+
+struct serial_xact* serial_xact_new(int fd, serial_xact_input input,
+				    void* arg)
+{
+	struct serial_xact* xact;
+	struct epoll_event ev;
+	int flags;
+
+	xact = (struct serial_xact*)calloc(1, sizeof(struct serial_xact));
+	if (xact == NULL) {
+		log_error("serial_xact: out of memory");
+		return NULL;
+	}
+	xact->fd = fd;
+	xact->input = input;
+	xact->arg = arg;
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		log_perror_err("serial_xact: cannot make fd non-blocking");
+		free(xact);
+		return NULL;
+	}
+	xact->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (xact->epfd == -1) {
+		log_perror_err("serial_xact: epoll_create1");
+		free(xact);
+		return NULL;
+	}
+	xact->timerfd = timerfd_create(CLOCK_MONOTONIC,
+				       TFD_NONBLOCK | TFD_CLOEXEC);
+	if (xact->timerfd == -1) {
+		log_perror_err("serial_xact: timerfd_create");
+		close(xact->epfd);
+		free(xact);
+		return NULL;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(xact->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		log_perror_err("serial_xact: cannot poll fd %d", fd);
+		serial_xact_free(xact);
+		return NULL;
+	}
+	ev.data.fd = xact->timerfd;
+	if (epoll_ctl(xact->epfd, EPOLL_CTL_ADD, xact->timerfd, &ev) == -1) {
+		log_perror_err("serial_xact: cannot poll timer");
+		serial_xact_free(xact);
+		return NULL;
+	}
+	return xact;
+}
+
+
+void serial_xact_free(struct serial_xact* xact)
+{
+	if (xact == NULL)
+		return;
+	while (xact->head != NULL)
+		complete(xact, SERIAL_XACT_ERROR, NULL, 0);
+	close(xact->timerfd);
+	close(xact->epfd);
+	free(xact);
+}
+
+
+int serial_xact_fd(const struct serial_xact* xact)
+{
+	return xact->epfd;
+}
+
+
+int serial_xact_submit(struct serial_xact* xact,
+		       const void* cmd, size_t size, int timeout,
+		       serial_xact_match match, serial_xact_done done,
+		       void* arg)
+{
+	struct xact_entry* entry;
+
+	entry = (struct xact_entry*)calloc(1, sizeof(struct xact_entry));
+	if (entry != NULL)
+		entry->cmd = (char*)malloc(size > 0 ? size : 1);
+	if (entry == NULL || entry->cmd == NULL) {
+		log_error("serial_xact: out of memory");
+		free(entry);
+		return 0;
+	}
+	memcpy(entry->cmd, cmd, size);
+	entry->size = size;
+	entry->timeout = timeout;
+	entry->match = match;
+	entry->done = done;
+	entry->arg = arg;
+	if (xact->tail != NULL) {
+		xact->tail->next = entry;
+		xact->tail = entry;
+		xact->count++;
+		return 1;
+	}
+	xact->head = entry;
+	xact->tail = entry;
+	xact->count++;
+	start_head(xact);
+	return 1;
+}
+
+
+int serial_xact_pending(const struct serial_xact* xact)
+{
+	return xact->count;
+}
+
+
+int serial_xact_handle_events(struct serial_xact* xact)
+{
+	uint64_t expirations;
+	ssize_t r;
+
+	while (read(xact->timerfd, &expirations, sizeof(expirations)) > 0)
+		;
+	if (xact->polling_out)
+		start_head(xact);
+	while (1) {
+		r = read(xact->fd, xact->buf + xact->length,
+			 sizeof(xact->buf) - xact->length);
+		if (r > 0) {
+			xact->length += r;
+			process_input(xact);
+			continue;
+		}
+		if (r == 0) {
+			log_error("serial_xact: device closed");
+			xact->failed = 1;
+		} else if (errno != EAGAIN && errno != EINTR) {
+			log_perror_err("serial_xact: read");
+			xact->failed = 1;
+		}
+		break;
+	}
+	if (xact->deadline != 0 && now_us() >= xact->deadline) {
+		log_debug("serial_xact: timeout waiting for reply");
+		complete(xact, SERIAL_XACT_TIMEOUT, NULL, 0);
+		start_head(xact);
+		process_input(xact);
+	}
+	return !xact->failed;
+}
+
+
+void serial_xact_flush(struct serial_xact* xact)
+{
+	char buf[256];
+
+	xact->length = 0;
+	while (read(xact->fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+#else /* HAVE_SERIAL_XACT */
+
+struct serial_xact* serial_xact_new(int fd, serial_xact_input input,
+				    void* arg)
+{
+	log_error("serial_xact: not supported without epoll and timerfd");
+	return NULL;
+}
+
+void serial_xact_free(struct serial_xact* xact)
+{
+}
+
+int serial_xact_fd(const struct serial_xact* xact)
+{
+	return -1;
+}
+
+int serial_xact_submit(struct serial_xact* xact,
+		       const void* cmd, size_t size, int timeout,
+		       serial_xact_match match, serial_xact_done done,
+		       void* arg)
+{
+	return 0;
+}
+
+int serial_xact_pending(const struct serial_xact* xact)
+{
+	return 0;
+}
+
+int serial_xact_handle_events(struct serial_xact* xact)
+{
+	return 0;
+}
+
+void serial_xact_flush(struct serial_xact* xact)
+{
+}
+
+#endif /* HAVE_SERIAL_XACT */
+
+
+int serial_xact_poll(struct serial_xact* xact, int timeout)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = serial_xact_fd(xact);
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	do
+		r = poll(&pfd, 1, timeout);
+	while (r == -1 && errno == EINTR);
+	if (r <= 0)
+		return r;
+	return serial_xact_handle_events(xact) ? 1 : -1;
+}
+
+
+int serial_xact_wait(struct serial_xact* xact, int timeout)
+{
+	uint64_t end = now_us() + timeout * 1000ULL;
+	uint64_t now;
+
+	while (serial_xact_pending(xact) > 0) {
+		now = now_us();
+		if (now >= end)
+			return 0;
+		if (serial_xact_poll(xact, (end - now + 999) / 1000) < 0)
+			return 0;
+	}
+	return 1;
+}
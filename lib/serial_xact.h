@@ -0,0 +1,148 @@
+/****************************************************************************
+** serial_xact.h ***********************************************************
+****************************************************************************
+*/
+
+/**
+ * @file serial_xact.h
+ * @brief Queued command/reply transactions on serial type devices.
+ * @ingroup driver_api
+ *
+ * Many transceivers are driven by writing a command and waiting for a
+ * reply. Doing so by blocking reads freezes lircd for the duration of
+ * the exchange. Here, commands are queued instead and written one at a
+ * time without blocking. The reply to the command in flight is found by
+ * a matcher function, and is passed to a completion callback, as is a
+ * timeout. Input which is not a reply, like received IR signals, goes to
+ * an input callback.
+ *
+ * Everything is driven by serial_xact_handle_events(), called when the
+ * fd from serial_xact_fd() is readable. That fd is meant to be used as
+ * drv.fd, and the driver's rec_func() then handles the events. Blocking
+ * waits for code running outside the main loop, like init_func(), are
+ * available as serial_xact_wait() and serial_xact_poll().
+ *
+ * Only available on systems with epoll and timerfd.
+ */
+
+#ifndef SERIAL_XACT_H
+#define SERIAL_XACT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of the input buffer, the longest possible reply. */
+#define SERIAL_XACT_BUFSIZE 4096
+
+/** Status passed to a serial_xact_done callback. */
+enum serial_xact_status {
+	SERIAL_XACT_OK = 0,     /**< Reply matched, or no reply expected. */
+	SERIAL_XACT_TIMEOUT,    /**< No reply within the timeout. */
+	SERIAL_XACT_ERROR,      /**< Write error, or queue disposed. */
+};
+
+struct serial_xact;
+
+/**
+ * Look for the reply to the command in flight at the start of data.
+ *
+ * @return Length of the reply, 0 if more data is needed, -1 if data is
+ *     not a reply.
+ */
+typedef int (*serial_xact_match)(const char* data, size_t size, void* arg);
+
+/**
+ * Called when a transaction is done. reply is only valid during the
+ * call, and is NULL unless status is SERIAL_XACT_OK and the transaction
+ * had a matcher. New transactions may be submitted from the callback.
+ */
+typedef void (*serial_xact_done)(enum serial_xact_status status,
+				 const char* reply, size_t size, void* arg);
+
+/**
+ * Handle input which is not a reply.
+ *
+ * @return Number of bytes used, 0 if more data is needed.
+ */
+typedef size_t (*serial_xact_input)(const char* data, size_t size,
+				    void* arg);
+
+/**
+ * Create a transaction queue for an open device, which is made
+ * non-blocking. The fd is not closed by serial_xact_free().
+ *
+ * @param fd Open serial device or socket.
+ * @param input Called for input which is not a reply, may be NULL.
+ * @param arg Passed to input.
+ * @return New queue, NULL on errors.
+ */
+struct serial_xact* serial_xact_new(int fd, serial_xact_input input,
+				    void* arg);
+
+/**
+ * Complete all pending transactions with SERIAL_XACT_ERROR and dispose
+ * the queue. NULL is a no-op.
+ */
+void serial_xact_free(struct serial_xact* xact);
+
+/** Return a fd which is readable when there are events to handle. */
+int serial_xact_fd(const struct serial_xact* xact);
+
+/**
+ * Queue a command. It is written when all transactions before it are
+ * done, and the timeout starts when it has been written.
+ *
+ * @param cmd Command to write, copied.
+ * @param size Length of cmd.
+ * @param timeout Time to wait for a reply, in ms.
+ * @param match Finds the reply. If NULL, no reply is expected and the
+ *     transaction is done when the command is written.
+ * @param done Called when done, may be NULL.
+ * @param arg Passed to match and done.
+ * @return 1 if queued, 0 on errors.
+ */
+int serial_xact_submit(struct serial_xact* xact,
+		       const void* cmd, size_t size, int timeout,
+		       serial_xact_match match, serial_xact_done done,
+		       void* arg);
+
+/** Return the number of queued transactions, including the one in flight. */
+int serial_xact_pending(const struct serial_xact* xact);
+
+/**
+ * Handle all events without blocking: write queued commands, read
+ * input, match replies and expire timeouts.
+ *
+ * @return 0 if the device is gone or failed, else 1.
+ */
+int serial_xact_handle_events(struct serial_xact* xact);
+
+/**
+ * Wait for events at most timeout ms, and handle them.
+ *
+ * @param timeout In ms, negative waits forever.
+ * @return 1 if events were handled, 0 on timeout, -1 on errors.
+ */
+int serial_xact_poll(struct serial_xact* xact, int timeout);
+
+/**
+ * Handle events until no transaction is pending, at most timeout ms.
+ *
+ * @return 1 if all transactions are done, 0 on timeout or errors.
+ */
+int serial_xact_wait(struct serial_xact* xact, int timeout);
+
+/** Drop all buffered and currently available input. */
+void serial_xact_flush(struct serial_xact* xact);
+
+/** A serial_xact_match for a reply being a line ending in "\n". */
+int serial_xact_match_line(const char* data, size_t size, void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERIAL_XACT_H */
@@ -22,15 +22,25 @@
  * signals and send the signal chain at a single blow */
 #define LIRCD_EXACT_GAP_THRESHOLD 10000
 
+/* upper limit for the growing send buffer, in items */
+#define WBUF_SIZE_MAX 65536
+
 #ifdef HAVE_KERNEL_LIRC_H
 #include <linux/lirc.h>
 #else
 #include "media/lirc.h"
 #endif
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #include "lirc/lirc_log.h"
+#include "lirc/config_file.h"
 #include "lirc/transmit.h"
 
+/* Number of encoded signals kept, see tx_cache_slot(). */
+#define TX_CACHE_SIZE 64
+
 static const logchannel_t logchannel = LOG_LIB;
 
 /**
@@ -39,7 +49,8 @@ static const logchannel_t logchannel = LOG_LIB;
 static struct sbuf {
 	lirc_t* data;
 
-	lirc_t	_data[WBUF_SIZE]; /**< Actual sending data. */
+	lirc_t* _data;          /**< Actual sending data, kept between sends. */
+	int	size;           /**< Allocated items in _data. */
 	int	wptr;
 	int	too_long;
 	int	is_biphase;
@@ -49,6 +60,41 @@ static struct sbuf {
 } send_buffer;
 
 
+/**
+ * The encoded first pass of a code: the send_buffer contents after
+ * sync_send_buffer() for a given code, toggle state and repeat flag.
+ */
+struct tx_cache_entry {
+	const struct ir_remote*	remote;
+	const struct ir_ncode*	ncode;
+	ir_code			code;
+	ir_code			toggle_bit_mask_state;
+	int			toggle_mask_state;
+	int			repeat;
+	int			length;         /**< 0 for an unused entry. */
+	lirc_t			sum;
+	lirc_t			pendings;
+	lirc_t			data[WBUF_SIZE];
+};
+
+/** Direct mapped cache of encoded signals, allocated on first use. */
+static struct tx_cache_entry* tx_cache = NULL;
+
+/** Requested repeats with shorter gaps are sent in the same buffer. */
+static lirc_t concat_gap = LIRCD_EXACT_GAP_THRESHOLD;
+
+/** Repeats wanted by the next new code, see send_buffer_set_repeats(). */
+static int requested_repeats = 0;
+
+/*
+ * What a send by init_send_or_sim() puts: a repeat if repeat_remote is
+ * set, else a new code. Or either of them regardless.
+ */
+#define PUT_AUTO	0
+#define PUT_REPEAT	1
+#define PUT_NEW		2
+
+
 static void send_signals(lirc_t* signals, int n);
 static int init_send_or_sim(struct ir_remote* remote, struct ir_ncode* code, int sim, int repeat_preset);
 
@@ -61,7 +107,48 @@ static int init_send_or_sim(struct ir_remote* remote, struct ir_ncode* code, int
  */
 void send_buffer_init(void)
 {
+	lirc_t* data = send_buffer._data;
+	int size = send_buffer.size;
+
 	memset(&send_buffer, 0, sizeof(send_buffer));
+	send_buffer._data = data;
+	send_buffer.size = size;
+}
+
+void send_buffer_set_concat_gap(lirc_t gap)
+{
+	concat_gap = gap;
+}
+
+void send_buffer_set_repeats(int reps)
+{
+	requested_repeats = reps;
+}
+
+/**
+ * Make room for one more item in _data, doubling it as needed. The
+ * buffer is never shrunk so steady state sends don't allocate.
+ */
+static int grow_send_buffer(void)
+{
+	lirc_t* data;
+	int size;
+
+	if (send_buffer.wptr < send_buffer.size)
+		return 1;
+	size = send_buffer.size > 0 ? 2 * send_buffer.size : WBUF_SIZE;
+	if (size > WBUF_SIZE_MAX)
+		return 0;
+	data = realloc(send_buffer._data, size * sizeof(lirc_t));
+	if (data == NULL) {
+		log_error("out of memory for transmit buffer");
+		return 0;
+	}
+	if (send_buffer.data == send_buffer._data)
+		send_buffer.data = data;
+	send_buffer._data = data;
+	send_buffer.size = size;
+	return 1;
 }
 
 static void clear_send_buffer(void)
@@ -77,7 +164,7 @@ static void clear_send_buffer(void)
 
 static void add_send_buffer(lirc_t data)
 {
-	if (send_buffer.wptr < WBUF_SIZE) {
+	if (grow_send_buffer()) {
 		log_trace2("adding to transmit buffer: %u", data);
 		send_buffer.sum += data;
 		send_buffer._data[send_buffer.wptr] = data;
@@ -121,7 +208,7 @@ static int bad_send_buffer(void)
 {
 	if (send_buffer.too_long != 0)
 		return 1;
-	if (send_buffer.wptr == WBUF_SIZE && send_buffer.pendingp > 0)
+	if (send_buffer.wptr == send_buffer.size && send_buffer.pendingp > 0)
 		return 1;
 	return 0;
 }
@@ -344,6 +431,80 @@ static void send_code(struct ir_remote* remote, ir_code code, int repeat)
 		send_buffer.sum -= remote->phead + remote->shead;
 }
 
+void send_buffer_cache_clear(void)
+{
+	if (tx_cache != NULL)
+		memset(tx_cache, 0, TX_CACHE_SIZE * sizeof(*tx_cache));
+}
+
+/** Return the cache entry for given code, NULL if there is no cache. */
+static struct tx_cache_entry* tx_cache_slot(const struct ir_ncode*	ncode,
+					    ir_code			code,
+					    int				repeat)
+{
+	uintptr_t hash;
+
+	if (tx_cache == NULL) {
+		tx_cache = calloc(TX_CACHE_SIZE, sizeof(*tx_cache));
+		if (tx_cache == NULL)
+			return NULL;
+	}
+	hash = (uintptr_t)ncode / sizeof(*ncode) + code * 2 + repeat;
+	return &tx_cache[hash % TX_CACHE_SIZE];
+}
+
+static int tx_cache_match(const struct tx_cache_entry*	entry,
+			  const struct ir_remote*	remote,
+			  const struct ir_ncode*	ncode,
+			  ir_code			code,
+			  int				repeat)
+{
+	return entry->length > 0
+	       && entry->remote == remote
+	       && entry->ncode == ncode
+	       && entry->code == code
+	       && entry->repeat == repeat
+	       && entry->toggle_bit_mask_state == remote->toggle_bit_mask_state
+	       && entry->toggle_mask_state == remote->toggle_mask_state;
+}
+
+/** Restore a cached first pass into the empty send_buffer. */
+static void tx_cache_get(const struct tx_cache_entry* entry)
+{
+	memcpy(send_buffer._data, entry->data, entry->length * sizeof(lirc_t));
+	send_buffer.wptr = entry->length;
+	send_buffer.sum = entry->sum;
+	send_buffer.pendingp = 0;
+	send_buffer.pendings = entry->pendings;
+}
+
+/**
+ * Store the first pass in the synced send_buffer. Key data is the
+ * state before send_code(), which may update toggle_mask_state.
+ */
+static void tx_cache_put(struct tx_cache_entry*	entry,
+			 const struct ir_remote*	remote,
+			 const struct ir_ncode*	ncode,
+			 ir_code			code,
+			 int				repeat,
+			 int				toggle_mask_state)
+{
+	if (send_buffer.wptr > WBUF_SIZE) {
+		entry->length = 0;
+		return;
+	}
+	entry->remote = remote;
+	entry->ncode = ncode;
+	entry->code = code;
+	entry->repeat = repeat;
+	entry->toggle_bit_mask_state = remote->toggle_bit_mask_state;
+	entry->toggle_mask_state = toggle_mask_state;
+	entry->length = send_buffer.wptr;
+	entry->sum = send_buffer.sum;
+	entry->pendings = send_buffer.pendings;
+	memcpy(entry->data, send_buffer._data, entry->length * sizeof(lirc_t));
+}
+
 static void send_signals(lirc_t* signals, int n)
 {
 	int i;
@@ -354,7 +515,91 @@ static void send_signals(lirc_t* signals, int n)
 
 int send_buffer_put(struct ir_remote* remote, struct ir_ncode* code)
 {
-	return init_send_or_sim(remote, code, 0, 0);
+	return init_send_or_sim(remote, code, 0, PUT_AUTO);
+}
+
+
+void send_frames_init(struct send_frames* frames)
+{
+	memset(frames, 0, sizeof(*frames));
+}
+
+
+void send_frames_free(struct send_frames* frames)
+{
+	int i;
+
+	for (i = 0; i < frames->count; i++)
+		free((lirc_t*)frames->frames[i].data);
+	free(frames->frames);
+	send_frames_init(frames);
+}
+
+
+/** Append a copy of the send buffer, followed by the remote's gap. */
+static int send_frames_push(struct send_frames* frames,
+			    const struct ir_remote* remote)
+{
+	struct send_frame* frame;
+	lirc_t* data;
+	int size;
+
+	if (frames->count == frames->size) {
+		size = frames->size > 0 ? 2 * frames->size : 8;
+		frame = (struct send_frame*)realloc(frames->frames,
+						    size * sizeof(*frame));
+		if (frame == NULL)
+			return 0;
+		frames->frames = frame;
+		frames->size = size;
+	}
+	data = (lirc_t*)malloc(send_buffer.wptr * sizeof(lirc_t));
+	if (data == NULL)
+		return 0;
+	memcpy(data, send_buffer.data, send_buffer.wptr * sizeof(lirc_t));
+	frame = &frames->frames[frames->count++];
+	frame->data = data;
+	frame->length = send_buffer.wptr;
+	frame->gap = remote->min_remaining_gap;
+	frame->freq = remote->freq;
+	frame->duty_cycle = get_duty_cycle(remote);
+	return 1;
+}
+
+
+/*
+ * The sends mirror lircd's repeat timer: a new code, then repeats
+ * until the countdown is done. Where it counts down, at the last item
+ * of a sequence, is taken from dosigalrm().
+ */
+int send_frames_add(struct send_frames* frames,
+		    struct ir_remote*	remote,
+		    struct ir_ncode*	code,
+		    int			reps)
+{
+	send_buffer_set_repeats(reps);
+	if (!init_send_or_sim(remote, code, 0, PUT_NEW)
+	    || !send_frames_push(frames, remote))
+		return 0;
+	if (remote->repeat_countdown <= 0 && code->next == NULL)
+		return 1;
+	do {
+		if (code->next == NULL
+		    || (code->transmit_state != NULL
+			&& code->transmit_state->next == NULL))
+			remote->repeat_countdown--;
+		if (!init_send_or_sim(remote, code, 0, PUT_REPEAT)
+		    || !send_frames_push(frames, remote))
+			return 0;
+	} while (remote->repeat_countdown > 0);
+	return 1;
+}
+
+
+int send_frames_supported(void)
+{
+	return curr_driver->api_version >= 5
+	       && curr_driver->send_frames_func != NULL;
 }
 
 /**
@@ -388,7 +633,12 @@ lirc_t send_buffer_sum(void)
 
 static int init_send_or_sim(struct ir_remote* remote, struct ir_ncode* code, int sim, int repeat_preset)
 {
-	int i, repeat = repeat_preset;
+	int i, repeat = sim ? repeat_preset : 0;
+	struct tx_cache_entry* cached = NULL;
+	ir_code cached_code = 0;
+	int cached_repeat = 0;
+	int toggle_mask_state = 0;
+	int sequence = 0;
 
 	if (is_grundig(remote) || is_serial(remote) || is_bo(remote)) {
 		if (!sim)
@@ -397,18 +647,23 @@ static int init_send_or_sim(struct ir_remote* remote, struct ir_ncode* code, int
 	}
 	clear_send_buffer();
 	if (strcmp(remote->name, "lirc") == 0) {
-		send_buffer.data[send_buffer.wptr] = LIRC_EOF | 1;
-		send_buffer.wptr += 1;
+		add_send_buffer(LIRC_EOF | 1);
+		send_buffer.data = send_buffer._data;
 		goto final_check;
 	}
 
 	if (is_biphase(remote))
 		send_buffer.is_biphase = 1;
 	if (!sim) {
-		if (repeat_remote == NULL)
-			remote->repeat_countdown = remote->min_repeat;
-		else
+		if (repeat_preset == PUT_NEW
+		    || (repeat_preset == PUT_AUTO && repeat_remote == NULL)) {
+			sequence = requested_repeats;
+			remote->repeat_countdown =
+				sequence > remote->min_repeat ?
+				sequence : remote->min_repeat;
+		} else
 			repeat = 1;
+		requested_repeats = 0;
 	}
 
 init_send_loop:
@@ -428,7 +683,21 @@ init_send_loop:
 			if (repeat && has_repeat_mask(remote))
 				next_code ^= remote->repeat_mask;
 
-			send_code(remote, next_code, repeat);
+			if (!sim && send_buffer.wptr == 0) {
+				cached = tx_cache_slot(code, next_code, repeat);
+				cached_code = next_code;
+				cached_repeat = repeat;
+				toggle_mask_state = remote->toggle_mask_state;
+			}
+			if (cached != NULL && tx_cache_match(cached, remote,
+							     code, next_code,
+							     repeat)) {
+				log_trace2("using cached transmit buffer");
+				tx_cache_get(cached);
+				cached = NULL;
+			} else {
+				send_code(remote, next_code, repeat);
+			}
 			if (!sim && has_toggle_mask(remote)) {
 				remote->toggle_mask_state++;
 				if (remote->toggle_mask_state == 4)
@@ -436,7 +705,7 @@ init_send_loop:
 			}
 			send_buffer.data = send_buffer._data;
 		} else {
-			if (code->signals == NULL) {
+			if (!load_raw_signals(remote, code)) {
 				if (!sim)
 					log_error("no signals for raw send");
 				return 0;
@@ -457,6 +726,11 @@ init_send_loop:
 			log_error("buffer too small");
 		return 0;
 	}
+	if (cached != NULL) {
+		tx_cache_put(cached, remote, code,
+			     cached_code, cached_repeat, toggle_mask_state);
+		cached = NULL;
+	}
 	if (sim)
 		goto final_check;
 
@@ -488,7 +762,8 @@ init_send_loop:
 		}
 	}
 	if ((remote->repeat_countdown > 0 || code->transmit_state != NULL)
-	    && remote->min_remaining_gap < LIRCD_EXACT_GAP_THRESHOLD) {
+	    && (remote->min_remaining_gap < LIRCD_EXACT_GAP_THRESHOLD
+		|| (sequence-- > 0 && remote->min_remaining_gap < concat_gap))) {
 		if (send_buffer.data != send_buffer._data) {
 			lirc_t* signals;
 			int n;
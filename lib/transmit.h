@@ -15,6 +15,10 @@
  * which representing a pulse width in microseconds. The first item represents
  * a pulse and the last thus a space.
  *
+ * The buffer starts at WBUF_SIZE items and grows as needed. Repeated
+ * frames separated by short gaps are put in the same buffer, so a
+ * driver can send a complete repeat sequence in one go.
+ *
  * Copyright (C) 1999 Christoph Bartelmus <lirc@bartelmus.de>
  *
  * @addtogroup driver_api
@@ -32,6 +36,7 @@
 extern "C" {
 #endif
 
+/** Initial size of the send buffer, in items. */
 #define WBUF_SIZE 256
 
 /** Clear and re-initiate the buffer. */
@@ -61,6 +66,58 @@ const lirc_t* send_buffer_data(void);
 /** @return Total length of send buffer in microseconds. */
 lirc_t send_buffer_sum(void);
 
+/**
+ * Set the longest gap between the repeats requested by
+ * send_buffer_set_repeats() which is sent in the same buffer as the
+ * frames around it. Longer gaps are left to the caller, for lircd the
+ * repeat timer. Default is 10 ms, gaps below that are always sent in
+ * the same buffer.
+ */
+void send_buffer_set_concat_gap(lirc_t gap);
+
+/**
+ * Make the next send_buffer_put() of a new code, not a repeat, count
+ * down at least reps repeats instead of the remote's min_repeat. Those
+ * separated by short gaps are then included in the buffer, the rest
+ * are left in ir_remote::repeat_countdown. Cleared by each put.
+ */
+void send_buffer_set_repeats(int reps);
+
+/** A growing list of frames for send_frames_func(). */
+struct send_frames {
+	struct send_frame*	frames;         /**< count frames. */
+	int			count;
+	int			size;           /**< Allocated frames. */
+};
+
+/** Initiate an empty frame list. */
+void send_frames_init(struct send_frames* frames);
+
+/** Free the frames and their data, leaving an empty list. */
+void send_frames_free(struct send_frames* frames);
+
+/**
+ * Append code followed by reps repeats to frames, encoded like lircd
+ * sends them with SEND_ONCE: each call of send_buffer_put() adds a
+ * frame with the signals of the send buffer, which is clobbered, and
+ * the remaining gap of remote. Sets the remote's transmit state like
+ * sending would, the caller initiates the toggle bits.
+ * @return 0 on errors, else 1.
+ */
+int send_frames_add(struct send_frames* frames,
+		    struct ir_remote*	remote,
+		    struct ir_ncode*	code,
+		    int			reps);
+
+/** @return Non-zero if the driver implements send_frames_func(). */
+int send_frames_supported(void);
+
+/**
+ * Drop all signals cached by send_buffer_put(). Must be called when
+ * the remotes sent from are freed or their timing is changed.
+ */
+void send_buffer_cache_clear(void);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -0,0 +1,308 @@
+/****************************************************************************
+** usb_async.c *************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file usb_async.c
+ * @brief Implements usb_async.h.
+ *
+ * The libusb pollfds are added to an epoll set, and the epoll fd is
+ * what the driver polls. libusb tells about fds added or removed
+ * later through the pollfd notifiers. Transfers are submitted without
+ * timeout, so libusb never needs to be woken up for timeouts only.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if defined(HAVE_LIBUSB_1_0_LIBUSB_H) || defined(HAVE_LIBUSB_H)
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#include "lirc_log.h"
+#include "usb_async.h"
+
+static const logchannel_t logchannel = LOG_LIB;
+
+struct usb_async {
+	libusb_context*		ctx;
+	usb_async_func		func;
+	void*			arg;
+	int			epfd;
+	int			active;         /**< Submitted transfers. */
+	int			stopping;       /**< Don't resubmit. */
+	int			failed;         /**< A transfer failed. */
+	int			count;
+	struct libusb_transfer*	transfers[];
+};
+
+
+libusb_device_handle* usb_async_open(libusb_context* ctx,
+				     int (*is_device_ok)(uint16_t vendor,
+							 uint16_t product),
+				     char* path, size_t size)
+{
+	struct libusb_device_descriptor desc;
+	libusb_device_handle* handle = NULL;
+	libusb_device** list;
+	ssize_t count;
+	ssize_t i;
+	int r;
+
+	count = libusb_get_device_list(ctx, &list);
+	if (count < 0) {
+		log_error("usb_async: cannot list devices: %s",
+			  libusb_error_name(count));
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		if (libusb_get_device_descriptor(list[i], &desc) != 0)
+			continue;
+		if (!is_device_ok(desc.idVendor, desc.idProduct))
+			continue;
+		r = libusb_open(list[i], &handle);
+		if (r != 0) {
+			log_error("usb_async: cannot open %04x:%04x: %s",
+				  desc.idVendor, desc.idProduct,
+				  libusb_error_name(r));
+			handle = NULL;
+			break;
+		}
+		if (path != NULL)
+			snprintf(path, size, "/dev/bus/usb/%03d/%03d",
+				 libusb_get_bus_number(list[i]),
+				 libusb_get_device_address(list[i]));
+		break;
+	}
+	libusb_free_device_list(list, 1);
+	return handle;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static void pollfd_added(int fd, short events, void* user_data)
+{
+	struct usb_async* async = (struct usb_async*)user_data;
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	if (events & POLLIN)
+		ev.events |= EPOLLIN;
+	if (events & POLLOUT)
+		ev.events |= EPOLLOUT;
+	ev.data.fd = fd;
+	if (epoll_ctl(async->epfd, EPOLL_CTL_ADD, fd, &ev) == -1
+	    && errno != EEXIST)
+		log_perror_warn("usb_async: cannot poll fd %d", fd);
+}
+
+
+static void pollfd_removed(int fd, void* user_data)
+{
+	struct usb_async* async = (struct usb_async*)user_data;
+
+	epoll_ctl(async->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+
+static int add_pollfds(struct usb_async* async)
+{
+	const struct libusb_pollfd** fds;
+	int i;
+
+	async->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (async->epfd == -1) {
+		log_perror_err("usb_async: epoll_create1");
+		return 0;
+	}
+	fds = libusb_get_pollfds(async->ctx);
+	if (fds == NULL) {
+		log_error("usb_async: cannot get libusb fds");
+		close(async->epfd);
+		return 0;
+	}
+	for (i = 0; fds[i] != NULL; i++)
+		pollfd_added(fds[i]->fd, fds[i]->events, async);
+#if LIBUSB_API_VERSION >= 0x01000104
+	libusb_free_pollfds(fds);
+#else
+	free(fds);
+#endif
+	libusb_set_pollfd_notifiers(async->ctx,
+				    pollfd_added, pollfd_removed, async);
+	return 1;
+}
+
+#else
+
+static int add_pollfds(struct usb_async* async)
+{
+	log_error("usb_async: not supported without epoll");
+	return 0;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+
+static void transfer_done(struct libusb_transfer* transfer)
+{
+	struct usb_async* async = (struct usb_async*)transfer->user_data;
+	int r;
+
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		if (transfer->actual_length > 0)
+			async->func(transfer->buffer,
+				    transfer->actual_length, async->arg);
+		/* fall through */
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		if (async->stopping)
+			break;
+		r = libusb_submit_transfer(transfer);
+		if (r == 0)
+			return;
+		log_error("usb_async: cannot resubmit transfer: %s",
+			  libusb_error_name(r));
+		async->failed = 1;
+		break;
+	case LIBUSB_TRANSFER_CANCELLED:
+		break;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		log_error("usb_async: device is gone");
+		async->failed = 1;
+		break;
+	default:
+		log_error("usb_async: transfer failed, status %d",
+			  transfer->status);
+		async->failed = 1;
+		break;
+	}
+	async->active--;
+}
+
+
+struct usb_async* usb_async_new(libusb_context* ctx,
+				libusb_device_handle* handle,
+				unsigned char endpoint,
+				unsigned char type,
+				int size,
+				int count,
+				usb_async_func func,
+				void* arg)
+{
+	struct usb_async* async;
+	struct libusb_transfer* transfer;
+	unsigned char* buffer;
+	int i;
+	int r;
+
+	async = (struct usb_async*)calloc(1, sizeof(struct usb_async)
+					  + count * sizeof(transfer));
+	if (async == NULL) {
+		log_error("usb_async: out of memory");
+		return NULL;
+	}
+	async->ctx = ctx;
+	async->func = func;
+	async->arg = arg;
+	async->epfd = -1;
+	if (!add_pollfds(async)) {
+		free(async);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		transfer = libusb_alloc_transfer(0);
+		buffer = (unsigned char*)malloc(size);
+		if (transfer == NULL || buffer == NULL) {
+			log_error("usb_async: out of memory");
+			libusb_free_transfer(transfer);
+			free(buffer);
+			goto fail;
+		}
+		libusb_fill_bulk_transfer(transfer, handle, endpoint,
+					  buffer, size, transfer_done,
+					  async, 0);
+		transfer->type = type;
+		async->transfers[async->count++] = transfer;
+		r = libusb_submit_transfer(transfer);
+		if (r != 0) {
+			log_error("usb_async: cannot submit transfer: %s",
+				  libusb_error_name(r));
+			goto fail;
+		}
+		async->active++;
+	}
+	return async;
+
+fail:
+	usb_async_free(async);
+	return NULL;
+}
+
+
+void usb_async_free(struct usb_async* async)
+{
+	struct timeval tv;
+	int tries;
+	int i;
+
+	if (async == NULL)
+		return;
+	async->stopping = 1;
+	for (i = 0; i < async->count; i++)
+		libusb_cancel_transfer(async->transfers[i]);
+	for (tries = 0; async->active > 0 && tries < 100; tries++) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		libusb_handle_events_timeout_completed(async->ctx, &tv, NULL);
+	}
+	if (async->active > 0) {
+		/* Still owned by libusb, leak rather than crash. */
+		log_warn("usb_async: %d transfers not cancelled",
+			 async->active);
+	} else {
+		for (i = 0; i < async->count; i++) {
+			free(async->transfers[i]->buffer);
+			libusb_free_transfer(async->transfers[i]);
+		}
+	}
+	libusb_set_pollfd_notifiers(async->ctx, NULL, NULL, NULL);
+	close(async->epfd);
+	if (async->active == 0)
+		free(async);
+}
+
+
+int usb_async_fd(const struct usb_async* async)
+{
+	return async->epfd;
+}
+
+
+int usb_async_handle_events(struct usb_async* async)
+{
+	struct timeval tv = { 0, 0 };
+	int r;
+
+	r = libusb_handle_events_timeout_completed(async->ctx, &tv, NULL);
+	if (r != 0 && r != LIBUSB_ERROR_TIMEOUT) {
+		log_error("usb_async: cannot handle events: %s",
+			  libusb_error_name(r));
+		return 0;
+	}
+	return !async->failed;
+}
+
+#endif /* HAVE_LIBUSB_1_0_LIBUSB_H || HAVE_LIBUSB_H */
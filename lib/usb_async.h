@@ -0,0 +1,108 @@
+/****************************************************************************
+** usb_async.h *************************************************************
+****************************************************************************
+*/
+
+/**
+ * @file usb_async.h
+ * @brief Queued libusb-1.0 input transfers, polled using drv.fd.
+ * @ingroup driver_api
+ *
+ * Keeps several IN transfers submitted on an endpoint, so the device
+ * never waits for the host to ask for the next packet, without any
+ * reader process or thread. The libusb file descriptors are collected
+ * in one pollable fd to be used as drv.fd. Completed transfers are
+ * passed to a callback from usb_async_handle_events(), typically
+ * called from the driver's rec_func().
+ *
+ * Only available when lirc is built with libusb-1.0.
+ */
+
+#ifndef USB_ASYNC_H
+#define USB_ASYNC_H
+
+#if defined(HAVE_LIBUSB_1_0_LIBUSB_H)
+#include <libusb-1.0/libusb.h>
+#elif defined(HAVE_LIBUSB_H)
+#include <libusb.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(HAVE_LIBUSB_1_0_LIBUSB_H) || defined(HAVE_LIBUSB_H)
+
+struct usb_async;
+
+/**
+ * Handle a completed transfer. data is only valid during the call.
+ * Called from usb_async_handle_events().
+ */
+typedef void (*usb_async_func)(const unsigned char* data, int length,
+			       void* arg);
+
+/**
+ * Open the first device matching is_device_ok().
+ *
+ * @param ctx libusb context.
+ * @param is_device_ok Returns non-zero for usable vendor/product ids,
+ *     the same filter as used by drv_enum_usb().
+ * @param path If not NULL, set to the /dev/bus/usb path of the device.
+ * @param size Size of path.
+ * @return Open handle, NULL if not found or on errors.
+ */
+libusb_device_handle* usb_async_open(libusb_context* ctx,
+				     int (*is_device_ok)(uint16_t vendor,
+							 uint16_t product),
+				     char* path, size_t size);
+
+/**
+ * Start reading an endpoint.
+ *
+ * @param ctx libusb context of handle.
+ * @param handle Open device, with its interface claimed.
+ * @param endpoint IN endpoint address.
+ * @param type LIBUSB_TRANSFER_TYPE_INTERRUPT or _BULK.
+ * @param size Transfer size, usually the endpoint's wMaxPacketSize.
+ * @param count Number of transfers kept submitted.
+ * @param func Called for each completed transfer.
+ * @param arg Passed to func.
+ * @return New reader, NULL on errors.
+ */
+struct usb_async* usb_async_new(libusb_context* ctx,
+				libusb_device_handle* handle,
+				unsigned char endpoint,
+				unsigned char type,
+				int size,
+				int count,
+				usb_async_func func,
+				void* arg);
+
+/**
+ * Cancel all transfers, wait for them to complete and dispose the
+ * reader. The device handle is not closed. NULL is a no-op.
+ */
+void usb_async_free(struct usb_async* async);
+
+/** Return a fd which is readable when there are events to handle. */
+int usb_async_fd(const struct usb_async* async);
+
+/**
+ * Handle completed transfers without blocking, calling func for
+ * each of them and submitting them again.
+ *
+ * @return 0 if the device is gone or a transfer failed, else 1.
+ */
+int usb_async_handle_events(struct usb_async* async);
+
+#endif /* HAVE_LIBUSB_1_0_LIBUSB_H || HAVE_LIBUSB_H */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USB_ASYNC_H */
@@ -25,24 +25,27 @@
 
 #include <errno.h>
 #include <glob.h>
-#include <signal.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
-#include <usb.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 
 #include "lirc_driver.h"
+#include "lirc/usb_async.h"
 
 #define CODE_BYTES 5
-#define USB_TIMEOUT (1000 * 60)
+
+/** Transfers queued on the interrupt endpoint. */
+#define USB_TRANSFERS 4
+
+/** Codes received but not yet decoded. */
+#define CODE_QUEUE 16
 
 static int ati_init(void);
 static int ati_deinit(void);
 static char* ati_rec(struct ir_remote* remotes);
-static void usb_read_loop(int fd);
-static struct usb_device* find_usb_device(void);
-static int find_device_endpoints(struct usb_device* dev);
+static int ati_rec_pending(void);
+static int find_device_endpoints(libusb_device* dev);
 static char device_path[10000] = {0};
 static int drvctl_func(unsigned int cmd, void* arg);
 
@@ -65,10 +68,11 @@ const struct driver hw_atilibusb = {
 	.decode_func	= receive_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "See file://" PLUGINDOCS "/atilibusb.html",
 	.device_hint    = "auto",
+	.rec_pending	= ati_rec_pending,
 };
 
 const struct driver* hardwares[] = { &hw_atilibusb, (const struct driver*)NULL };
@@ -97,14 +101,25 @@ static usb_device_id usb_remote_id_table[] = {
 	{ 0,	  0	 }      /* Terminating entry */
 };
 
-static struct usb_dev_handle* dev_handle = NULL;
-struct usb_endpoint_descriptor* dev_ep_in = NULL;
-struct usb_endpoint_descriptor* dev_ep_out = NULL;
-static pid_t child = -1;
+static libusb_context* usb_ctx = NULL;
+static libusb_device_handle* dev_handle = NULL;
+static struct usb_async* usb_reader = NULL;
+static const struct libusb_endpoint_descriptor* dev_ep_in = NULL;
+static const struct libusb_endpoint_descriptor* dev_ep_out = NULL;
+static struct libusb_config_descriptor* dev_config = NULL;
+
+/** Codes read by the USB transfers, waiting for ati_rec(). */
+static struct {
+	unsigned char	code[CODE_BYTES];
+	struct timeval	time;
+} codes[CODE_QUEUE];
+static unsigned int codes_head = 0;
+static unsigned int codes_tail = 0;
+static int inited = 0;
 
 /* init strings -- from lirc_atiusb */
-static char init1[] = { 0x80, 0x01, 0x00, 0x20, 0x14 };
-static char init2[] = { 0x80, 0x01, 0x00, 0x20, 0x14, 0x20, 0x20, 0x20 };
+static unsigned char init1[] = { 0x80, 0x01, 0x00, 0x20, 0x14 };
+static unsigned char init2[] = { 0x80, 0x01, 0x00, 0x20, 0x14, 0x20, 0x20, 0x20 };
 
 /****/
 
@@ -121,12 +136,6 @@ static int is_device_ok(uint16_t vendor,  uint16_t product)
 }
 
 
-static int is_usb_device_ok(struct usb_device* d)
-{
-	return is_device_ok(d->descriptor.idVendor, d->descriptor.idProduct);
-}
-
-
 static int drvctl_func(unsigned int cmd, void* arg)
 {
 	switch (cmd) {
@@ -141,244 +150,188 @@ static int drvctl_func(unsigned int cmd, void* arg)
 }
 
 
+/* queue a code read from the USB receiver, called by usb_async. */
+static void got_code(const unsigned char* data, int length, void* arg)
+{
+	unsigned char* code;
+
+	/* sometimes the remote sends one byte on startup; ignore it */
+	if (!inited) {
+		inited = 1;
+		if (length == 1)
+			return;
+	}
+	if (codes_head - codes_tail == CODE_QUEUE) {
+		log_warn("atilibusb: code queue full, dropping code");
+		return;
+	}
+	if (length > CODE_BYTES)
+		length = CODE_BYTES;
+	code = codes[codes_head % CODE_QUEUE].code;
+	memcpy(code, data, length);
+	/* pad the code with zeros (if shorter than CODE_BYTES) */
+	memset(code + length, 0, CODE_BYTES - length);
+	/* erase the channel code -- TODO: make this optional */
+	code[length - 1] &= 0x0F;
+	get_monotonic_time(&codes[codes_head % CODE_QUEUE].time);
+	codes_head++;
+}
+
+
 /* initialize driver -- returns 1 on success, 0 on error */
 static int ati_init(void)
 {
-	struct usb_device* usb_dev;
-	int pipe_fd[2] = { -1, -1 };
+	int transferred;
+	int r;
 
 	log_trace("initializing USB receiver");
 
 	rec_buffer_init();
-
-	/* A separate process will be forked to read data from the USB
-	 * receiver and write it to a pipe. drv.fd is set to the readable
-	 * end of this pipe. */
-	if (pipe(pipe_fd) != 0) {
-		log_perror_err("couldn't open pipe");
+	codes_head = codes_tail = 0;
+	inited = 0;
+
+	r = libusb_init(&usb_ctx);
+	if (r != 0) {
+		log_error("couldn't initialize libusb: %s",
+			  libusb_error_name(r));
+		usb_ctx = NULL;
 		return 0;
 	}
-	drv.fd = pipe_fd[0];
-
-	usb_dev = find_usb_device();
-	if (!usb_dev || !usb_dev->bus || !usb_dev->filename) {
+	dev_handle = usb_async_open(usb_ctx, is_device_ok,
+				    device_path, sizeof(device_path));
+	if (dev_handle == NULL) {
 		log_error("couldn't find a compatible USB device");
-		return 0;
+		goto fail;
 	}
-	snprintf(device_path, sizeof(device_path),
-		 "/dev/bus/usb/%s/%s",
-		 usb_dev->bus->dirname, usb_dev->filename);
 	drv.device = device_path;
-	if (usb_dev == NULL) {
-		log_error("couldn't find a compatible USB device");
-		return 0;
-	}
 
-	if (!find_device_endpoints(usb_dev)) {
+	if (!find_device_endpoints(libusb_get_device(dev_handle))) {
 		log_error("couldn't find device endpoints");
-		return 0;
-	}
-
-	dev_handle = usb_open(usb_dev);
-	if (dev_handle == NULL) {
-		log_perror_err("couldn't open USB receiver");
 		goto fail;
 	}
 
-	if (usb_claim_interface(dev_handle, 0) != 0) {
-		log_perror_err("couldn't claim USB interface");
+	r = libusb_claim_interface(dev_handle, 0);
+	if (r != 0) {
+		log_error("couldn't claim USB interface: %s",
+			  libusb_error_name(r));
 		goto fail;
 	}
 
-	errno = 0;
-	if ((usb_interrupt_write(dev_handle, dev_ep_out->bEndpointAddress, init1, sizeof(init1), 100) != sizeof(init1))
-	    || (usb_interrupt_write(dev_handle, dev_ep_out->bEndpointAddress, init2, sizeof(init2), 100) !=
-		sizeof(init2))) {
-		log_error("couldn't initialize USB receiver: %s", errno ? strerror(errno) : "short write");
+	r = libusb_interrupt_transfer(dev_handle, dev_ep_out->bEndpointAddress,
+				      init1, sizeof(init1), &transferred, 100);
+	if (r == 0 && transferred == sizeof(init1))
+		r = libusb_interrupt_transfer(dev_handle,
+					      dev_ep_out->bEndpointAddress,
+					      init2, sizeof(init2),
+					      &transferred, 100);
+	if (r != 0 || transferred != sizeof(init2)) {
+		log_error("couldn't initialize USB receiver: %s",
+			  r != 0 ? libusb_error_name(r) : "short write");
 		goto fail;
 	}
 
-	snprintf(device_path, sizeof(device_path),
-		 "/dev/bus/usb/%s/%s",
-		 usb_dev->bus->dirname, usb_dev->filename);
-	drv.device = device_path;
-	log_debug("atilibusb: using device: %s", device_path);
-	child = fork();
-	if (child == -1) {
-		log_perror_err("couldn't fork child process");
+	usb_reader = usb_async_new(usb_ctx, dev_handle,
+				   dev_ep_in->bEndpointAddress,
+				   LIBUSB_TRANSFER_TYPE_INTERRUPT,
+				   dev_ep_in->wMaxPacketSize, USB_TRANSFERS,
+				   got_code, NULL);
+	if (usb_reader == NULL)
 		goto fail;
-	} else if (child == 0) {
-		usb_read_loop(pipe_fd[1]);
-	}
+	drv.fd = usb_async_fd(usb_reader);
+	log_debug("atilibusb: using device: %s", device_path);
 	return 1;
 
 fail:
-	if (dev_handle) {
-		usb_close(dev_handle);
-		dev_handle = NULL;
-	}
-	if (pipe_fd[0] >= 0)
-		close(pipe_fd[0]);
-	if (pipe_fd[1] >= 0)
-		close(pipe_fd[1]);
+	ati_deinit();
 	return 0;
 }
 
 /* deinitialize driver -- returns 1 on success, 0 on error */
 static int ati_deinit(void)
 {
-	int err = 0;
-
+	usb_async_free(usb_reader);
+	usb_reader = NULL;
+	drv.fd = -1;
 	if (dev_handle) {
-		if (usb_close(dev_handle) < 0)
-			err = 1;
+		libusb_release_interface(dev_handle, 0);
+		libusb_close(dev_handle);
 		dev_handle = NULL;
 	}
-
-	if (drv.fd >= 0) {
-		if (close(drv.fd) < 0)
-			err = 1;
-		drv.fd = -1;
+	if (dev_config) {
+		libusb_free_config_descriptor(dev_config);
+		dev_config = NULL;
 	}
-
-	if (child > 1) {
-		if ((kill(child, SIGTERM) == -1)
-		    || (waitpid(child, NULL, 0) == 0))
-			err = 1;
+	if (usb_ctx) {
+		libusb_exit(usb_ctx);
+		usb_ctx = NULL;
 	}
-
-	return !err;
+	return 1;
 }
 
-static char* ati_rec(struct ir_remote* remotes)
+static int ati_rec_pending(void)
 {
-	if (!rec_buffer_clear()) {
-		ati_deinit();
-		return NULL;
-	}
-	return decode_all(remotes);
+	return codes_head != codes_tail;
 }
 
-/* find a compatible USB receiver and return a usb_device,
- * or NULL on failure. */
-static struct usb_device* find_usb_device(void)
+static char* ati_rec(struct ir_remote* remotes)
 {
-	struct usb_bus* usb_bus;
-	struct usb_device* dev;
-
-	usb_init();
-	usb_find_busses();
-	usb_find_devices();
+	ir_code code = 0;
+	int i;
 
-	for (usb_bus = usb_busses; usb_bus; usb_bus = usb_bus->next) {
-		for (dev = usb_bus->devices; dev; dev = dev->next)
-			if (is_usb_device_ok(dev))
-				return dev;
+	if (codes_head == codes_tail) {
+		if (!usb_async_handle_events(usb_reader)) {
+			ati_deinit();
+			return NULL;
+		}
+		if (codes_head == codes_tail)
+			return NULL;
 	}
-	return NULL;            /* no suitable device found */
+	for (i = 0; i < CODE_BYTES; i++)
+		code = (code << CHAR_BIT) | codes[codes_tail % CODE_QUEUE].code[i];
+	rec_buffer_set_code(code, &codes[codes_tail % CODE_QUEUE].time, 0);
+	codes_tail++;
+	return decode_all(remotes);
 }
 
-
-
-
 /* set dev_ep_in and dev_ep_out to the in/out endpoints of the given
  * device. returns 1 on success, 0 on failure. */
-static int find_device_endpoints(struct usb_device* dev)
+static int find_device_endpoints(libusb_device* dev)
 {
-	struct usb_interface_descriptor* idesc;
+	struct libusb_device_descriptor desc;
+	const struct libusb_interface_descriptor* idesc;
 
-	if (dev->descriptor.bNumConfigurations != 1)
+	if (libusb_get_device_descriptor(dev, &desc) != 0)
+		return 0;
+	if (desc.bNumConfigurations != 1)
+		return 0;
+	if (libusb_get_config_descriptor(dev, 0, &dev_config) != 0) {
+		dev_config = NULL;
 		return 0;
-	if (dev->config[0].bNumInterfaces != 1)
+	}
+	if (dev_config->bNumInterfaces != 1)
 		return 0;
-	if (dev->config[0].interface[0].num_altsetting != 1)
+	if (dev_config->interface[0].num_altsetting != 1)
 		return 0;
 
-	idesc = &dev->config[0].interface[0].altsetting[0];
+	idesc = &dev_config->interface[0].altsetting[0];
 	if (idesc->bNumEndpoints != 2)
 		return 0;
 
 	dev_ep_in = &idesc->endpoint[0];
-	if ((dev_ep_in->bEndpointAddress & USB_ENDPOINT_DIR_MASK)
-	    != USB_ENDPOINT_IN)
+	if ((dev_ep_in->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+	    != LIBUSB_ENDPOINT_IN)
 		return 0;
-	if ((dev_ep_in->bmAttributes & USB_ENDPOINT_TYPE_MASK)
-	    != USB_ENDPOINT_TYPE_INTERRUPT)
+	if ((dev_ep_in->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+	    != LIBUSB_TRANSFER_TYPE_INTERRUPT)
 		return 0;
 
 	dev_ep_out = &idesc->endpoint[1];
-	if ((dev_ep_out->bEndpointAddress & USB_ENDPOINT_DIR_MASK)
-	    != USB_ENDPOINT_OUT)
+	if ((dev_ep_out->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+	    != LIBUSB_ENDPOINT_OUT)
 		return 0;
-	if ((dev_ep_out->bmAttributes & USB_ENDPOINT_TYPE_MASK)
-	    != USB_ENDPOINT_TYPE_INTERRUPT)
+	if ((dev_ep_out->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+	    != LIBUSB_TRANSFER_TYPE_INTERRUPT)
 		return 0;
 
 	return 1;
 }
-
-/* this function is run in a forked process to read data from the USB
- * receiver and write it to the given fd. it calls exit() with result
- * code 0 on success, or 1 on failure. */
-static void usb_read_loop(int fd)
-{
-	int inited = 0;
-	int err = 0;
-
-	alarm(0);
-	signal(SIGTERM, SIG_DFL);
-	signal(SIGPIPE, SIG_DFL);
-	signal(SIGINT, SIG_DFL);
-	signal(SIGHUP, SIG_IGN);
-	signal(SIGALRM, SIG_IGN);
-
-	for (;; ) {
-		char buf[CODE_BYTES];
-		int bytes_r, bytes_w, pos;
-		/* TODO: accept codes only for a specific channel */
-		// int channel;
-
-		/* read from the USB device */
-		bytes_r =
-			usb_interrupt_read(dev_handle, dev_ep_in->bEndpointAddress, &buf[0], sizeof(buf), USB_TIMEOUT);
-		if (bytes_r < 0) {
-			if (errno == EAGAIN || errno == ETIMEDOUT)
-				continue;
-
-			log_perror_err("can't read from USB device");
-			err = 1;
-			goto done;
-		}
-
-		/* sometimes the remote sends one byte on startup; ignore it */
-		if (!inited) {
-			inited = 1;
-			if (bytes_r == 1)
-				continue;
-		}
-
-		// channel = (buf[bytes_r - 1] >> 4) & 0x0F;
-
-		/* pad the code with zeros (if shorter than CODE_BYTES) */
-		memset(buf + bytes_r, 0, sizeof(buf) - bytes_r);
-		/* erase the channel code -- TODO: make this optional */
-		buf[bytes_r - 1] &= 0x0F;
-
-		/* write to the pipe */
-		bytes_r = sizeof(buf);
-		for (pos = 0; pos < bytes_r; pos += bytes_w) {
-			bytes_w = write(fd, buf + pos, bytes_r - pos);
-			if (bytes_w < 0) {
-				log_perror_err("can't write to pipe");
-				err = 1;
-				goto done;
-			}
-		}
-	}
-
-done:
-	close(fd);
-	if (!usb_close(dev_handle))
-		err = 1;
-	_exit(err);
-}
@@ -27,19 +27,11 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <termios.h>
-
-#ifdef HAVE_UTIL_H
-#include <util.h>
-#endif
-
-#ifdef HAVE_PTY_H
-#include <pty.h>
-#endif
 
 #include "lirc_driver.h"
 
-static int ptyfd;               /* the pty */
+static struct sample_ring* rx_ring;     /* from the callback to lircd */
+#define RX_RING_SIZE 16384
 
 /* PortAudio Includes */
 #include <portaudio.h>
@@ -76,19 +68,22 @@ static const logchannel_t logchannel = LOG_DRIVER;
 static PaStream* stream;
 
 
-static char ptyName[256];
-static int master;
 static int sendPipe[2];         /* signals are written from audio_send
 				 * and read from the callback */
 static int completedPipe[2];    /* a byte is written here when the
 				 * callback has processed all signals */
 static int outputLatency;
+
+/* Bumped by the callback, logged and reported by the main thread. */
+static unsigned long input_overflows;
+static unsigned long output_underflows;
+static struct drv_stats logged_stats;
 static int inDevicesPrinted = 0;
 static int outDevicesPrinted = 0;
 
 static void addCode(lirc_t data)
 {
-	chk_write(master, &data, sizeof(lirc_t));
+	sample_ring_put(rx_ring, &data, 1);
 }
 
 /* This routine will be called by the PortAudio engine when audio is needed.
@@ -111,14 +106,18 @@ static int recordCallback(const void* inputBuffer, void* outputBuffer, unsigned
 	int out;
 	double currentSignal = data->remainingSignal;
 	lirc_t signal;
+	int send_empty = 0;
 
 	/* Prevent unused variable warnings. */
 	(void)outTime;
 
+	/* No logging here, see log_stats(). */
 	if (status & paOutputUnderflow)
-		log_warn("Output underflow %s", drv.device);
+		__atomic_store_n(&output_underflows, output_underflows + 1,
+				 __ATOMIC_RELAXED);
 	if (status & paInputOverflow)
-		log_warn("Input overflow %s", drv.device);
+		__atomic_store_n(&input_overflows, input_overflows + 1,
+				 __ATOMIC_RELAXED);
 
 	for (i = 0; i < framesPerBuffer; i++, myPtr++) {
 		/* check if we have to ignore this sample */
@@ -181,8 +180,10 @@ static int recordCallback(const void* inputBuffer, void* outputBuffer, unsigned
 	/* generate output */
 	for (i = 0; i < framesPerBuffer; i++) {
 		if (currentSignal <= 0.0) {     /* last signal we sent went out */
-			/* try to read a new signal, non blocking */
-			if (read(sendPipe[0], &signal, sizeof(signal)) > 0) {
+			/* try to read a new signal, non blocking, once
+			 * per buffer when there is none */
+			if (!send_empty
+			    && read(sendPipe[0], &signal, sizeof(signal)) > 0) {
 				if (data->signaledDone) {
 					/* first one sent is the
 					 * carrier frequency */
@@ -200,6 +201,7 @@ static int recordCallback(const void* inputBuffer, void* outputBuffer, unsigned
 				 * samples for one second */
 				data->samplesToIgnore = data->samplerate;
 			} else {
+				send_empty = 1;
 				/* no more signals, reset phase */
 				data->signalPhase = 0;
 				/* signal that we have written all
@@ -259,19 +261,7 @@ static int recordCallback(const void* inputBuffer, void* outputBuffer, unsigned
 
 lirc_t audio_readdata(lirc_t timeout)
 {
-	lirc_t data;
-	int ret;
-
-	if (!waitfordata((long)timeout))
-		return 0;
-
-	ret = read(drv.fd, &data, sizeof(data));
-	if (ret != sizeof(data)) {
-		log_perror_debug("error reading from lirc");
-		raise(SIGTERM);
-		return 0;
-	}
-	return data;
+	return sample_ring_readdata(rx_ring, timeout);
 }
 
 int audio_send(struct ir_remote* remote, struct ir_ncode* code)
@@ -448,7 +438,6 @@ int audio_init(void)
 	PaStreamParameters outputParameters;
 	PaError err;
 	int flags;
-	struct termios t;
 	char api[1024];
 	char device[1024];
 	double latency;
@@ -473,6 +462,9 @@ int audio_init(void)
 	data.signaledDone = 1;
 	data.samplesToIgnore = 0;
 	data.carrierFreq = DEFAULT_FREQ;
+	input_overflows = 0;
+	output_underflows = 0;
+	memset(&logged_stats, 0, sizeof(logged_stats));
 
 	err = Pa_Initialize();
 	if (err != paNoError)
@@ -510,34 +502,14 @@ int audio_init(void)
 	if (err != paNoError)
 		goto error;
 
-	/* open pty */
-	if (openpty(&master, &ptyfd, ptyName, 0, 0) == -1) {
-		log_error("openpty failed");
-		log_perror_err("openpty()");
+	/* ring for passing samples from the callback */
+	rx_ring = sample_ring_new(RX_RING_SIZE);
+	if (rx_ring == NULL) {
+		log_error("cannot create sample ring");
 		goto error;
 	}
 
-	/* regular device file */
-	if (tcgetattr(master, &t) < 0) {
-		log_error("tcgetattr failed");
-		log_perror_err("tcgetattr()");
-	}
-
-	cfmakeraw(&t);
-
-	/* apply file descriptor options */
-	if (tcsetattr(master, TCSANOW, &t) < 0) {
-		log_error("tcsetattr failed");
-		log_perror_err("tcsetattr()");
-	}
-
-	flags = fcntl(ptyfd, F_GETFL, 0);
-	if (flags != -1)
-		fcntl(ptyfd, F_SETFL, flags | O_NONBLOCK);
-
-	log_trace("PTY name: %s", ptyName);
-
-	drv.fd = ptyfd;
+	drv.fd = sample_ring_fd(rx_ring);
 
 	/* make a pipe for sending signals to the callback */
 	/* make a pipe for signaling from the callback that everything
@@ -598,9 +570,9 @@ int audio_deinit(void)
 	/* wait for terminaton */
 	usleep(20000);
 
-	/* close pty */
-	close(master);
-	close(ptyfd);
+	sample_ring_free(rx_ring);
+	rx_ring = NULL;
+	drv.fd = -1;
 
 	close(sendPipe[0]);
 	close(sendPipe[1]);
@@ -617,8 +589,35 @@ error:
 	return 0;
 }
 
+static void get_stats(struct drv_stats* stats)
+{
+	stats->dropped = rx_ring ? sample_ring_dropped(rx_ring) : 0;
+	stats->overflows = __atomic_load_n(&input_overflows, __ATOMIC_RELAXED);
+	stats->underflows = __atomic_load_n(&output_underflows,
+					    __ATOMIC_RELAXED);
+}
+
+/** Log what the callback counted since last time. */
+static void log_stats(void)
+{
+	struct drv_stats stats;
+
+	get_stats(&stats);
+	if (stats.overflows != logged_stats.overflows)
+		log_warn("Input overflow %s (%lu times)",
+			 drv.device, stats.overflows - logged_stats.overflows);
+	if (stats.underflows != logged_stats.underflows)
+		log_warn("Output underflow %s (%lu times)",
+			 drv.device, stats.underflows - logged_stats.underflows);
+	if (stats.dropped != logged_stats.dropped)
+		log_warn("Sample ring full %s, %lu samples dropped",
+			 drv.device, stats.dropped - logged_stats.dropped);
+	logged_stats = stats;
+}
+
 char* audio_rec(struct ir_remote* remotes)
 {
+	log_stats();
 	if (!rec_buffer_clear())
 		return NULL;
 	return decode_all(remotes);
@@ -673,6 +672,9 @@ static int drvctl_func(unsigned int cmd, void* arg)
 	case DRVCTL_FREE_DEVICES:
 		drv_enum_free((glob_t*) arg);
 		return 0;
+	case DRVCTL_GET_STATS:
+		get_stats((struct drv_stats*)arg);
+		return 0;
 	default:
 		return DRV_ERR_NOT_IMPLEMENTED;
 	}
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -43,14 +44,10 @@
  * desired the level of input signal to be relatively strong (without
  * clipping although it does not hurt).
  *
- * This driver works as following: it creates a named pipe (called usually
- * /dev/lirc) and opens it. The handle is handed then to the receive.c module
- * which reads or writes data from it. The client HAS to use non-blocking
- * I/O otherwise we don't get a chance to run ever (this could be fixed
- * by creating a secondary thread and doing all audio stuff there).
- * If one day this driver will support sending commands, we'll have to use
- * asyncronous I/O (O_ASYNC and a signal handler) so that we get control
- * right after client writes to the pipe.
+ * This driver works as following: a capture thread waits for each period
+ * of samples, finds the edges in it and puts them in a sample ring, whose
+ * fd is drv.fd. The period is read in place using mmap access where the
+ * device supports it, else it is copied by snd_pcm_readi().
  *
  * For usage documentation see audio-alsa.html.
  */
@@ -65,10 +62,10 @@ static struct {
 	snd_pcm_format_t	format;
 	/* The audio buffer size in microseconds */
 	unsigned		buffer_time;
-	/* The FIFO handle for reading and writing */
-	int			fd;
-	/* The asynchronous I/O signal handler object */
-	snd_async_handler_t*	sighandler;
+	/* The period size in microseconds, 0 for buffer_time / 4 */
+	unsigned		period_time;
+	/* Non-zero if the buffer is read in place, else copied */
+	int			mmap;
 	/* Value indicating number of channels for capture */
 	unsigned char		num_channels;
 	/* Value indicating which channel to look for signal 0=right 1=left */
@@ -84,15 +81,26 @@ static struct {
 	 * and record.c thinks there is a time gap between data (and drops
 	 * the repeat count).
 	 */
-	100000,	-1, NULL, 1, 0 /*Use left channel by default */
+	100000, 0, 0, 1, 0 /*Use left channel by default */
 };
 
+/* Edges, from the capture thread to lircd */
+static struct sample_ring* rx_ring = NULL;
+#define RX_RING_SIZE    16384
+
+static pthread_t capture_thread;
+static int capture_running = 0;
+static int capture_stop = 0;            /* atomic */
+static unsigned long xruns = 0;         /* atomic */
+static unsigned long logged_xruns = 0;
+static unsigned long logged_dropped = 0;
+
 /* Return the absolute difference between two unsigned 8-bit samples */
 #define U8_ABSDIFF(s1, s2) (((s1) >= (s2)) ? ((s1) - (s2)) : ((s2) - (s1)))
 
 /* Forward declarations */
 static int audio_alsa_deinit(void);
-static void alsa_sig_io(snd_async_handler_t* h);
+static void* alsa_capture(void* arg);
 
 static const logchannel_t logchannel = LOG_DRIVER;
 
@@ -126,14 +134,19 @@ static int alsa_set_hwparams(void)
 			  snd_pcm_hw_params_set_channels(alsa_hw.handle, hwp, alsa_hw.num_channels))
 	    || alsa_error("hw_params_set_rate_near",
 			  snd_pcm_hw_params_set_rate_near(alsa_hw.handle, hwp, &alsa_hw.rate, &dir))
-	    || alsa_error("hw_params_set_access",
-			  snd_pcm_hw_params_set_access(alsa_hw.handle, hwp, SND_PCM_ACCESS_RW_INTERLEAVED))
 	    || alsa_error("hw_params_set_buffer_time_near",
 			  snd_pcm_hw_params_set_buffer_time_near(alsa_hw.handle, hwp, &alsa_hw.buffer_time, 0)))
 		return -1;
 
-	/* How often to call our SIGIO handler (~40Hz) */
-	period_time = alsa_hw.buffer_time / 4;
+	alsa_hw.mmap = snd_pcm_hw_params_set_access(alsa_hw.handle, hwp,
+						    SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+	if (!alsa_hw.mmap
+	    && alsa_error("hw_params_set_access",
+			  snd_pcm_hw_params_set_access(alsa_hw.handle, hwp, SND_PCM_ACCESS_RW_INTERLEAVED)))
+		return -1;
+
+	/* How often the capture thread wakes up (~40Hz by default) */
+	period_time = alsa_hw.period_time ? alsa_hw.period_time : alsa_hw.buffer_time / 4;
 	if (alsa_error
 		    ("hw_params_set_period_time_near",
 		    snd_pcm_hw_params_set_period_time_near(alsa_hw.handle, hwp, &period_time, &dir))
@@ -141,6 +154,9 @@ static int alsa_set_hwparams(void)
 	    || alsa_error("hw_params_get_period_size", snd_pcm_hw_params_get_period_size(hwp, &period_size, 0))
 	    || alsa_error("hw_params", snd_pcm_hw_params(alsa_hw.handle, hwp)))
 		return -1;
+	log_debug("audio_alsa: %s access, buffer %lu, period %lu frames",
+		  alsa_hw.mmap ? "mmap" : "read", (unsigned long)buffer_size,
+		  (unsigned long)period_size);
 
 	snd_pcm_sw_params_current(alsa_hw.handle, swp);
 	if (alsa_error("sw_params_set_start_threshold",
@@ -160,46 +176,18 @@ static int alsa_set_hwparams(void)
 
 int audio_alsa_init(void)
 {
-	int fd, err;
+	int err;
 	char* pcm_rate;
 	char tmp_name[20];
 
 	rec_buffer_init();
 
-	/* Create a temporary filename for our FIFO,
-	 * Use mkstemp() instead of mktemp() although we need a FIFO not a
-	 * regular file. We do this since glibc barfs at mktemp() and this
-	 * scares the users :-)
-	 */
-	strcpy(tmp_name, "/tmp/lircXXXXXX");
-	fd = mkstemp(tmp_name);
-	close(fd);
-
-	/* Start the race! */
-	unlink(tmp_name);
-	if (mknod(tmp_name, S_IFIFO | S_IRUSR | S_IWUSR, 0)) {
-		log_error("could not create FIFO %s", tmp_name);
-		log_perror_err("audio_alsa_init ()");
-		return 0;
-	}
-	/* Phew, we won the race ... */
-
-	/* Open the pipe and hand it to LIRC ... */
-	drv.fd = open(tmp_name, O_RDWR);
-	if (drv.fd < 0) {
-		log_error("could not open pipe %s", tmp_name);
-		log_perror_err("audio_alsa_init ()");
-error:          unlink(tmp_name);
-		audio_alsa_deinit();
+	rx_ring = sample_ring_new(RX_RING_SIZE);
+	if (rx_ring == NULL) {
+		log_error("could not create sample ring");
 		return 0;
 	}
-
-	/* Open the other end of the pipe and hand it to ALSA code.
-	 * We're opening it in non-blocking mode to avoid lockups.
-	 */
-	alsa_hw.fd = open(tmp_name, O_RDWR | O_NONBLOCK);
-	/* Ok, we don't need the FIFO visible in the filesystem anymore ... */
-	unlink(tmp_name);
+	drv.fd = sample_ring_fd(rx_ring);
 
 	/* Examine the device name, if it contains a sample rate */
 	strncpy(tmp_name, drv.device, sizeof(tmp_name) - 1);
@@ -246,13 +234,6 @@ error:          unlink(tmp_name);
 		goto error;
 	}
 
-	/* Set up the I/O signal handler */
-	if (alsa_error("async_add_handler",
-			 snd_async_add_pcm_handler(&alsa_hw.sighandler,
-						   alsa_hw.handle,
-						   alsa_sig_io, NULL)))
-		goto error;
-
 	/* Set sampling parameters */
 	if (alsa_set_hwparams())
 		goto error;
@@ -263,32 +244,39 @@ error:          unlink(tmp_name);
 	if (alsa_error("start", snd_pcm_start(alsa_hw.handle)))
 		goto error;
 
+	__atomic_store_n(&capture_stop, 0, __ATOMIC_RELAXED);
+	err = pthread_create(&capture_thread, NULL, alsa_capture, NULL);
+	if (err != 0) {
+		log_error("could not start capture thread: %s", strerror(err));
+		goto error;
+	}
+	capture_running = 1;
 	return 1;
+
+error:
+	audio_alsa_deinit();
+	return 0;
 }
 
 int audio_alsa_deinit(void)
 {
-	if (alsa_hw.sighandler) {
-		snd_async_del_handler(alsa_hw.sighandler);
-		alsa_hw.sighandler = NULL;
+	if (capture_running) {
+		__atomic_store_n(&capture_stop, 1, __ATOMIC_RELAXED);
+		pthread_join(capture_thread, NULL);
+		capture_running = 0;
 	}
 	if (alsa_hw.handle) {
 		snd_pcm_close(alsa_hw.handle);
 		alsa_hw.handle = NULL;
 	}
-	if (alsa_hw.fd != -1) {
-		close(alsa_hw.fd);
-		alsa_hw.fd = -1;
-	}
-	if (drv.fd != -1) {
-		close(drv.fd);
-		drv.fd = -1;
-	}
+	sample_ring_free(rx_ring);
+	rx_ring = NULL;
+	drv.fd = -1;
 	return 1;
 }
 
 /*
- * ALSA calls this callback when some data is available for reading.
+ * The capture thread calls detect_edges() for each period read.
  * The detection algorithm is somewhat sophisticated but it should give
  * good practical results. The algorithm works as follows:
  *
@@ -314,28 +302,54 @@ int audio_alsa_deinit(void)
 
 #define READ_BUFFER_SIZE (2 * 4096)
 
-static void alsa_sig_io(snd_async_handler_t* h)
-{
+/* Largest number of edges put in the ring at once */
+#define EDGE_BATCH 256
+
+/* State of the edge detector, kept between periods */
+static struct {
 	/* Previous sample */
-	static unsigned char ps = 0x80;
+	unsigned char	ps;
 	/* Count samples with similar level (to detect pule/space
 	 * length), 24.8 fp */
-	static unsigned sample_count = 0;
+	unsigned	sample_count;
 	/* Current signal level (dynamically changes) */
-	static unsigned signal_level = 0;
+	unsigned	signal_level;
 	/* Current state (pulse or space) */
-	static unsigned signal_state = 0;
+	unsigned	signal_state;
 	/* Signal maximum and minimum (used for "zero" detection) */
-	static unsigned char signal_max = 0x80, signal_min = 0x80;
+	unsigned char	signal_max, signal_min;
 	/* Non-zero if we're in zero crossing waiting state */
-	static char waiting_zerox = 0;
-	/* Store sample size, as our sample buffer will represent
-	 * shorts or chars */
-	unsigned char bytes_per_sample = (alsa_hw.format == SND_PCM_FORMAT_S16_LE ? 2 : 1);
+	char		waiting_zerox;
+} det = { 0x80, 0, 0, 0, 0x80, 0x80, 0 };
 
-	int i, err;
-	char buff[READ_BUFFER_SIZE];
-	snd_pcm_sframes_t count;
+static void detect_reset(void)
+{
+	det.sample_count = 0;
+	det.waiting_zerox = 0;
+	det.signal_level = 0;
+	det.signal_state = 0;
+	det.signal_max = det.signal_min = 0x80;
+}
+
+/*
+ * Find the edges in count frames of the capture channel starting at data,
+ * stride bytes apart, and put them in rx_ring once all are found. The
+ * state lives in locals while looping, det is updated at the end.
+ */
+static void detect_edges(const unsigned char* data, int stride, int count)
+{
+	unsigned char ps = det.ps;
+	unsigned sample_count = det.sample_count;
+	unsigned signal_level = det.signal_level;
+	unsigned signal_state = det.signal_state;
+	unsigned char signal_max = det.signal_max;
+	unsigned char signal_min = det.signal_min;
+	char waiting_zerox = det.waiting_zerox;
+	int s16 = alsa_hw.format == SND_PCM_FORMAT_S16_LE;
+	int s8 = alsa_hw.format == SND_PCM_FORMAT_S8;
+	lirc_t edges[EDGE_BATCH];
+	int edge_count = 0;
+	int i;
 
 	/* The value to multiply with number of samples to get microseconds
 	 * (fixed-point 24.8 bits).
@@ -344,182 +358,253 @@ static void alsa_sig_io(snd_async_handler_t* h)
 	/* Maximal number of samples that can be multiplied by mulconst */
 	unsigned maxcount = (((PULSE_MASK << 8) | 0xff) / mulconst) << 8;
 
-	/* First of all, check for underrun. This happens, for example, when
-	 * the X11 server starts. If we won't, recording will stop forever.
-	 */
-	snd_pcm_state_t state = snd_pcm_state(alsa_hw.handle);
-
-	switch (state) {
-	case SND_PCM_STATE_SUSPENDED:
-		while ((err = snd_pcm_resume(alsa_hw.handle)) == -EAGAIN)
-			/* wait until the suspend flag is released */
-			sleep(1);
-		if (err >= 0)
-			goto var_reset;
-	/* Fallthrough */
-	case SND_PCM_STATE_XRUN:
-		alsa_error("prepare", snd_pcm_prepare(alsa_hw.handle));
-		alsa_error("start", snd_pcm_start(alsa_hw.handle));
-var_reset:                      /* Reset variables */
-		sample_count = 0;
-		waiting_zerox = 0;
-		signal_level = 0;
-		signal_state = 0;
-		signal_max = signal_min = 0x80;
-		break;
-	default:
-		/* Stream is okay */
-		break;
-	}
+	for (i = 0; i < count; i++, data += stride) {
+		/* cs == current sample */
+		unsigned char cs, as, sl, sz, xz;
+		unsigned short stmp;
+
+		if (s16) {
+			memcpy(&stmp, data, sizeof(stmp));
+			cs = stmp >> 8;
+			cs ^= 0x80;
+		} else {
+			cs = *data;
 
-	/* Read all available data */
-	count = snd_pcm_avail_update(alsa_hw.handle);
-	if (count > 0) {
-		if (count > (READ_BUFFER_SIZE / (bytes_per_sample * alsa_hw.num_channels)))
-			count = READ_BUFFER_SIZE / (bytes_per_sample * alsa_hw.num_channels);
-		count = snd_pcm_readi(alsa_hw.handle, buff, count);
-
-		/*Loop around samples, if stereo we are
-		 * only interested in one channel*/
-		for (i = 0; i < count; i++) {
-			/* cs == current sample */
-			unsigned char cs, as, sl, sz, xz;
-			unsigned short stmp;
-
-			if (bytes_per_sample == 2) {
-				int ix = i * bytes_per_sample * alsa_hw.num_channels +
-					     bytes_per_sample * alsa_hw.channel;
-				memcpy(&stmp, &buff[ix], sizeof(stmp));
-				cs = stmp >> 8;
+			/* Convert signed samples to unsigned */
+			if (s8)
 				cs ^= 0x80;
-			} else {
-				cs = buff[i];
+		}
 
-				/* Convert signed samples to unsigned */
-				if (alsa_hw.format == SND_PCM_FORMAT_S8)
-					cs ^= 0x80;
-			}
+		/* Track signal middle value (it could differ from 0x80) */
+		sz = (signal_min + signal_max) / 2;
+		if (cs <= sz)
+			signal_min = (signal_min * 7 + cs) / 8;
+		if (cs >= sz)
+			signal_max = (signal_max * 7 + cs) / 8;
 
-			/* Track signal middle value (it could differ from 0x80) */
-			sz = (signal_min + signal_max) / 2;
-			if (cs <= sz)
-				signal_min = (signal_min * 7 + cs) / 8;
-			if (cs >= sz)
-				signal_max = (signal_max * 7 + cs) / 8;
-
-			/* Compute the absolute signal deviation from middle */
-			as = U8_ABSDIFF(cs, sz);
-
-			/* Integrate incoming signal (auto level adjustment) */
-			signal_level = (signal_level * 7 + as) / 8;
-
-			/* Don't let too low signal levels as it makes us sensible to noise */
-			sl = signal_level;
-			if (sl < 16)
-				sl = 16;
-
-			/* Detect crossing current "zero" level */
-			xz = ((cs - sz) ^ (ps - sz)) & 0x80;
-
-			/* Don't wait for zero crossing for too long */
-			if (waiting_zerox && !xz)
-				waiting_zerox--;
-
-			/* Detect significant signal level changes */
-			if ((abs(cs - ps) > sl / 2) && xz)
-				waiting_zerox = 2;
-
-			/* If we have crossed zero with a substantial level change, go */
-			if (waiting_zerox && xz) {
-				lirc_t x;
-
-				waiting_zerox = 0;
-
-				if (sample_count >= maxcount) {
-					x = PULSE_MASK;
-					sample_count = 0;
-				} else {
-					/**
-					 * Try to interpolate the samples and determine where exactly
-					 * the zero crossing point was. This is required as the
-					 * remote signal frequency is relatively close to our sampling
-					 * frequency thus a sampling error of 1 sample can lead to
-					 * substantial time differences.
-					 *
-					 *     slope = (x2 - x1) / (y2 - y1)
-					 *     x = x1 + (y - y1) * slope
-					 *
-					 * where x1=-1, x2=0, y1=ps, y2=cs, y=sz, thus:
-					 *
-					 *     x = -1 + (y - y1) / (y2 - y1), or
-					 * ==> x = (y - y2) / (y2 - y1)
-					 *
-					 * y2 (cs) cannot be equal to y1 (ps), otherwise we wouldn't
-					 * get here.
-					 */
-					int delta = (((int)sz - (int)cs) << 8) / ((int)cs - (int)ps);
-					/* This expression can easily overflow the 'long' value since it
-					 * multiplies two 24.8 values (and we get a 24.16 instead).
-					 * To avoid this we cast the intermediate value to "long long".
-					 */
-					x = (((long long)sample_count + delta) * mulconst) >> 16;
-					/* The rest of the quantum is on behalf of next pulse. Note that
-					 * sample_count can easily be assigned here a negative value (in
-					 * the case zero crossing occurs during the next quantum).
-					 */
-					sample_count = -delta;
-				}
-
-				/* Consider impossible pulses with length greater than
-				 * 0.02 seconds, thus it is a space (desynchronization).
-				 */
-				if ((x > 20000) && signal_state) {
-					signal_state = 0;
-					log_trace("Pulse/space desynchronization fixed - len %u", x);
-				}
+		/* Compute the absolute signal deviation from middle */
+		as = U8_ABSDIFF(cs, sz);
 
-				x |= signal_state;
+		/* Integrate incoming signal (auto level adjustment) */
+		signal_level = (signal_level * 7 + as) / 8;
 
-				/* Write the LIRC code to the FIFO */
-				chk_write(alsa_hw.fd, &x, sizeof(x));
+		/* Don't let too low signal levels as it makes us sensible to noise */
+		sl = signal_level;
+		if (sl < 16)
+			sl = 16;
 
-				signal_state ^= PULSE_BIT;
-			}
+		/* Detect crossing current "zero" level */
+		xz = ((cs - sz) ^ (ps - sz)) & 0x80;
+
+		/* Don't wait for zero crossing for too long */
+		if (waiting_zerox && !xz)
+			waiting_zerox--;
+
+		/* Detect significant signal level changes */
+		if ((abs(cs - ps) > sl / 2) && xz)
+			waiting_zerox = 2;
 
-			/* Remember previous sample */
-			ps = cs;
+		/* If we have crossed zero with a substantial level change, go */
+		if (waiting_zerox && xz) {
+			lirc_t x;
 
-			/* Count number of samples with the same level.
-			 * sample_count can be less than zero at the start of pulse
-			 * (due to interpolation) so we have to consider them.
+			waiting_zerox = 0;
+
+			if (sample_count >= maxcount) {
+				x = PULSE_MASK;
+				sample_count = 0;
+			} else {
+				/**
+				 * Try to interpolate the samples and determine where exactly
+				 * the zero crossing point was. This is required as the
+				 * remote signal frequency is relatively close to our sampling
+				 * frequency thus a sampling error of 1 sample can lead to
+				 * substantial time differences.
+				 *
+				 *     slope = (x2 - x1) / (y2 - y1)
+				 *     x = x1 + (y - y1) * slope
+				 *
+				 * where x1=-1, x2=0, y1=ps, y2=cs, y=sz, thus:
+				 *
+				 *     x = -1 + (y - y1) / (y2 - y1), or
+				 * ==> x = (y - y2) / (y2 - y1)
+				 *
+				 * y2 (cs) cannot be equal to y1 (ps), otherwise we wouldn't
+				 * get here.
+				 */
+				int delta = (((int)sz - (int)cs) << 8) / ((int)cs - (int)ps);
+				/* This expression can easily overflow the 'long' value since it
+				 * multiplies two 24.8 values (and we get a 24.16 instead).
+				 * To avoid this we cast the intermediate value to "long long".
+				 */
+				x = (((long long)sample_count + delta) * mulconst) >> 16;
+				/* The rest of the quantum is on behalf of next pulse. Note that
+				 * sample_count can easily be assigned here a negative value (in
+				 * the case zero crossing occurs during the next quantum).
+				 */
+				sample_count = -delta;
+			}
+
+			/* Consider impossible pulses with length greater than
+			 * 0.02 seconds, thus it is a space (desynchronization).
 			 */
-			if ((sample_count < UINT_MAX - 0x400)
-			    || (sample_count > UINT_MAX - 0x200))
-				sample_count += 0x100;
+			if ((x > 20000) && signal_state) {
+				signal_state = 0;
+				log_trace("Pulse/space desynchronization fixed - len %u", x);
+			}
+
+			edges[edge_count++] = x | signal_state;
+			if (edge_count == EDGE_BATCH) {
+				sample_ring_put(rx_ring, edges, edge_count);
+				edge_count = 0;
+			}
+
+			signal_state ^= PULSE_BIT;
 		}
+
+		/* Remember previous sample */
+		ps = cs;
+
+		/* Count number of samples with the same level.
+		 * sample_count can be less than zero at the start of pulse
+		 * (due to interpolation) so we have to consider them.
+		 */
+		if ((sample_count < UINT_MAX - 0x400)
+		    || (sample_count > UINT_MAX - 0x200))
+			sample_count += 0x100;
 	}
+	if (edge_count > 0)
+		sample_ring_put(rx_ring, edges, edge_count);
+
+	det.ps = ps;
+	det.sample_count = sample_count;
+	det.signal_level = signal_level;
+	det.signal_state = signal_state;
+	det.signal_max = signal_max;
+	det.signal_min = signal_min;
+	det.waiting_zerox = waiting_zerox;
 }
 
-lirc_t audio_alsa_readdata(lirc_t timeout)
+/*
+ * Restart capture after an error, like an overrun which happens e. g.
+ * when the X11 server starts. If we won't, recording will stop forever.
+ */
+static int alsa_recover(int err)
 {
-	lirc_t data;
-	int ret;
+	if (err == -EPIPE)
+		__atomic_add_fetch(&xruns, 1, __ATOMIC_RELAXED);
+	err = snd_pcm_recover(alsa_hw.handle, err, 1);
+	if (err < 0)
+		return alsa_error("recover", err);
+	detect_reset();
+	return alsa_error("start", snd_pcm_start(alsa_hw.handle));
+}
 
-	if (!waitfordata((long)timeout))
-		return 0;
+/* Read and analyse all available frames in place, return error code */
+static int capture_mmap(void)
+{
+	const snd_pcm_channel_area_t* areas;
+	const snd_pcm_channel_area_t* area;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t frames;
+	snd_pcm_sframes_t avail;
+	snd_pcm_sframes_t committed;
+	int err;
+
+	avail = snd_pcm_avail_update(alsa_hw.handle);
+	if (avail < 0)
+		return avail;
+	while (avail > 0) {
+		frames = avail;
+		err = snd_pcm_mmap_begin(alsa_hw.handle, &areas, &offset, &frames);
+		if (err < 0)
+			return err;
+		area = &areas[alsa_hw.num_channels == 2 ? alsa_hw.channel : 0];
+		detect_edges((const unsigned char*)area->addr
+			     + (area->first + offset * area->step) / 8,
+			     area->step / 8, frames);
+		committed = snd_pcm_mmap_commit(alsa_hw.handle, offset, frames);
+		if (committed < 0)
+			return committed;
+		if ((snd_pcm_uframes_t)committed != frames)
+			return -EPIPE;
+		avail -= frames;
+	}
+	return 0;
+}
 
-	ret = read(drv.fd, &data, sizeof(data));
+/* Copy and analyse all available frames, return error code */
+static int capture_read(void)
+{
+	unsigned char bytes_per_sample = (alsa_hw.format == SND_PCM_FORMAT_S16_LE ? 2 : 1);
+	int stride = bytes_per_sample * alsa_hw.num_channels;
+	unsigned char buff[READ_BUFFER_SIZE];
+	snd_pcm_sframes_t count;
 
-	if (ret != sizeof(data)) {
-		log_perror_err("Error reading from lirc device");
-		raise(SIGTERM);
-		return 0;
+	while (1) {
+		count = snd_pcm_readi(alsa_hw.handle, buff, READ_BUFFER_SIZE / stride);
+		if (count == -EAGAIN)
+			return 0;
+		if (count <= 0)
+			return count;
+		/*If stereo we are only interested in one channel*/
+		detect_edges(buff + (alsa_hw.num_channels == 2 ? bytes_per_sample * alsa_hw.channel : 0),
+			     stride, count);
 	}
-	return data;
+}
+
+/* The capture thread: wait for each period and find its edges */
+static void* alsa_capture(void* arg)
+{
+	int err;
+
+	detect_reset();
+	while (!__atomic_load_n(&capture_stop, __ATOMIC_RELAXED)) {
+		/* Bounded wait, so that a stop request is seen */
+		err = snd_pcm_wait(alsa_hw.handle, 100);
+		if (err == 0)
+			continue;
+		if (err > 0)
+			err = alsa_hw.mmap ? capture_mmap() : capture_read();
+		if (err < 0 && alsa_recover(err) < 0) {
+			log_error("audio_alsa: capture stopped");
+			break;
+		}
+	}
+	return NULL;
+}
+
+lirc_t audio_alsa_readdata(lirc_t timeout)
+{
+	return sample_ring_readdata(rx_ring, timeout);
+}
+
+static void get_stats(struct drv_stats* stats)
+{
+	stats->dropped = rx_ring ? sample_ring_dropped(rx_ring) : 0;
+	stats->overflows = __atomic_load_n(&xruns, __ATOMIC_RELAXED);
+	stats->underflows = 0;
+}
+
+/** Log what the capture thread counted since last time. */
+static void log_stats(void)
+{
+	struct drv_stats stats;
+
+	get_stats(&stats);
+	if (stats.overflows != logged_xruns)
+		log_warn("Capture overrun %s (%lu times)",
+			 drv.device, stats.overflows - logged_xruns);
+	if (stats.dropped != logged_dropped)
+		log_warn("Sample ring full %s, %lu samples dropped",
+			 drv.device, stats.dropped - logged_dropped);
+	logged_xruns = stats.overflows;
+	logged_dropped = stats.dropped;
 }
 
 char* audio_alsa_rec(struct ir_remote* remotes)
 {
+	log_stats();
 	if (!rec_buffer_clear())
 		return NULL;
 	return decode_all(remotes);
@@ -556,9 +641,42 @@ static void list_devices(glob_t* glob)
 }
 
 
+/* Parse a time option in us, 0 if invalid */
+static unsigned parse_time(const struct option_t* opt)
+{
+	char* end;
+	long value;
+
+	value = strtol(opt->value, &end, 10);
+	if (*end != '\0' || value < 1000 || value > 2000000) {
+		log_error("audio_alsa: invalid %s: %s", opt->key, opt->value);
+		return 0;
+	}
+	return value;
+}
+
 static int drvctl_func(unsigned int cmd, void* arg)
 {
+	struct option_t* opt;
+
 	switch (cmd) {
+	case DRVCTL_SET_OPTION:
+		opt = (struct option_t*)arg;
+		if (strcmp(opt->key, "buffer-time") == 0) {
+			alsa_hw.buffer_time = parse_time(opt);
+			if (alsa_hw.buffer_time == 0) {
+				alsa_hw.buffer_time = 100000;
+				return DRV_ERR_BAD_VALUE;
+			}
+			return 0;
+		} else if (strcmp(opt->key, "period-time") == 0) {
+			alsa_hw.period_time = parse_time(opt);
+			return alsa_hw.period_time ? 0 : DRV_ERR_BAD_VALUE;
+		}
+		return DRV_ERR_BAD_OPTION;
+	case DRVCTL_GET_STATS:
+		get_stats((struct drv_stats*)arg);
+		return 0;
 	case DRVCTL_GET_DEVICES:
 		list_devices((glob_t*) arg);
 		return 0;
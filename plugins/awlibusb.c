@@ -33,42 +33,33 @@
 #endif
 
 #include <errno.h>
-#include <signal.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
-#include <usb.h>
 #include <sys/types.h>
-#include <sys/wait.h>
-#include <time.h>
 
 #include "lirc_driver.h"
-
-#define AW_MODE_LIRCCODE 1
+#include "lirc/usb_async.h"
 
 #define AWUSB_RECEIVE_BYTES 5
-#define USB_TIMEOUT (1000 * 60)
 #define AW_VENDOR_THOMSON 0x069b
 #define AW_DEVICE_THOMSON 0x1111
 
-#define AW_KEY_GAP 0            /* Original value=200000. Made it 0 to handle it in userspace */
+/** Transfers queued on the interrupt endpoint. */
+#define USB_TRANSFERS 4
+
+/** Codes received but not yet decoded. */
+#define CODE_QUEUE 16
 
-#if !defined(AW_MODE_LIRCCODE)
-static ir_code code;
-static ir_code code_last;
-static struct timeval time_current = { 0 };
-static struct timeval time_last = { 0 };
-#endif
 static char device_path[10000] = {0};
 
 static int awlibusb_init(void);
 static int awlibusb_deinit(void);
 static char* awlibusb_rec(struct ir_remote* remotes);
-static void usb_read_loop(int fd);
-static struct usb_device* find_usb_device(void);
-static int find_device_endpoints(struct usb_device* dev);
+static int awlibusb_rec_pending(void);
+static int find_device_endpoints(libusb_device* dev);
 static int drvctl_func(unsigned int cmd, void* arg);
 
-#ifdef AW_MODE_LIRCCODE
 const struct driver hw_awlibusb = {
 	.name		= "awlibusb",
 	.device		= NULL,
@@ -85,32 +76,12 @@ const struct driver hw_awlibusb = {
 	.decode_func	= receive_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available.",
 	.device_hint    = "drvctl",
+	.rec_pending	= awlibusb_rec_pending,
 };
-#else
-const struct driver hw_awlibusb = {
-	.name		= "awlibusb",
-	.device		= NULL,
-	.features	= LIRC_CAN_REC_CODE,
-	.send_mode	= 0,
-	.rec_mode	= LIRC_MODE_CODE,
-	.code_length	= CHAR_BIT,
-	.init_func	= awlibusb_init,
-	.deinit_func	= awlibusb_deinit,
-	.open_func	= default_open,
-	.close_func	= default_close,
-	.send_func	= NULL,
-	.rec_func	= awlibusb_rec,
-	.decode_func	= receive_decode,
-	.drvctl_func	= drvctl_func,
-	.readdata	= NULL,
-	.info		= "No info available.",
-	.device_hint    = "drvctl",
-};
-#endif
 
 const struct driver* hardwares[] = { &hw_awlibusb, (const struct driver*)NULL };
 
@@ -129,9 +100,20 @@ static usb_device_id usb_remote_id_table[] = {
 	{}
 };
 
-static struct usb_dev_handle* dev_handle = NULL;
-static struct usb_endpoint_descriptor* dev_ep_in = NULL;
-static pid_t child = -1;
+static libusb_context* usb_ctx = NULL;
+static libusb_device_handle* dev_handle = NULL;
+static struct usb_async* usb_reader = NULL;
+static const struct libusb_endpoint_descriptor* dev_ep_in = NULL;
+static struct libusb_config_descriptor* dev_config = NULL;
+
+/** Codes read by the USB transfers, waiting for awlibusb_rec(). */
+static struct {
+	unsigned char	code[AWUSB_RECEIVE_BYTES - 1];
+	struct timeval	time;
+} codes[CODE_QUEUE];
+static unsigned int codes_head = 0;
+static unsigned int codes_tail = 0;
+static int inited = 0;
 
 /****/
 
@@ -149,248 +131,184 @@ static int drvctl_func(unsigned int cmd, void* arg)
 }
 
 
+/* returns 1 if the given device should be used, 0 otherwise */
+static int is_device_ok(uint16_t vendor, uint16_t product)
+{
+	/* TODO: allow exact device to be specified */
+
+	/* check if the device ID is in usb_remote_id_table */
+	usb_device_id* dev_id;
+
+	for (dev_id = usb_remote_id_table; dev_id->vendor; dev_id++)
+		if (vendor == dev_id->vendor && product == dev_id->product)
+			return 1;
+
+	return 0;
+}
+
+
+/* queue a code read from the USB receiver, called by usb_async. */
+static void got_code(const unsigned char* data, int length, void* arg)
+{
+	unsigned char* code;
+
+	/* sometimes the remote sends one byte on startup; ignore it */
+	if (!inited) {
+		inited = 1;
+		if (length == 1)
+			return;
+	}
+	if (codes_head - codes_tail == CODE_QUEUE) {
+		log_warn("awlibusb: code queue full, dropping code");
+		return;
+	}
+	if (length > AWUSB_RECEIVE_BYTES)
+		length = AWUSB_RECEIVE_BYTES;
+	code = codes[codes_head % CODE_QUEUE].code;
+	/* ignore first byte */
+	memset(code, 0, AWUSB_RECEIVE_BYTES - 1);
+	memcpy(code, data + 1, length - 1);
+	get_monotonic_time(&codes[codes_head % CODE_QUEUE].time);
+	codes_head++;
+}
+
+
 /* initialize driver -- returns 1 on success, 0 on error */
 static int awlibusb_init(void)
 {
-	struct usb_device* usb_dev;
-	int pipe_fd[2] = { -1, -1 };
+	int r;
 
 	log_trace("initializing USB receiver");
 
 	rec_buffer_init();
-
-	/* A separate process will be forked to read data from the USB
-	 * receiver and write it to a pipe. drv.fd is set to the readable
-	 * end of this pipe. */
-	if (pipe(pipe_fd) != 0) {
-		log_perror_err("couldn't open pipe");
+	codes_head = codes_tail = 0;
+	inited = 0;
+
+	r = libusb_init(&usb_ctx);
+	if (r != 0) {
+		log_error("couldn't initialize libusb: %s",
+			  libusb_error_name(r));
+		usb_ctx = NULL;
 		return 0;
 	}
-	drv.fd = pipe_fd[0];
-
-	usb_dev = find_usb_device();
-	if (usb_dev == NULL) {
+	dev_handle = usb_async_open(usb_ctx, is_device_ok,
+				    device_path, sizeof(device_path));
+	if (dev_handle == NULL) {
 		log_error("couldn't find a compatible USB device");
 		goto fail;
 	}
+	drv.device = device_path;
 
-	if (!find_device_endpoints(usb_dev)) {
+	if (!find_device_endpoints(libusb_get_device(dev_handle))) {
 		log_error("couldn't find device endpoints");
 		goto fail;
 	}
 
-	dev_handle = usb_open(usb_dev);
-	if (dev_handle == NULL) {
-		log_perror_err("couldn't open USB receiver");
-		goto fail;
-	}
-
-	if (usb_claim_interface(dev_handle, 0) != 0) {
-		log_perror_err("couldn't claim USB interface");
+	r = libusb_claim_interface(dev_handle, 0);
+	if (r != 0) {
+		log_error("couldn't claim USB interface: %s",
+			  libusb_error_name(r));
 		goto fail;
 	}
 
-	snprintf(device_path, sizeof(device_path),
-		 "/dev/bus/usb/%s/%s",
-		 usb_dev->bus->dirname, usb_dev->filename);
-	drv.device = device_path;
-	log_debug("atilibusb: using device: %s", device_path);
-
-	child = fork();
-	if (child == -1) {
-		log_perror_err("couldn't fork child process");
+	usb_reader = usb_async_new(usb_ctx, dev_handle,
+				   dev_ep_in->bEndpointAddress,
+				   LIBUSB_TRANSFER_TYPE_INTERRUPT,
+				   dev_ep_in->wMaxPacketSize, USB_TRANSFERS,
+				   got_code, NULL);
+	if (usb_reader == NULL)
 		goto fail;
-	} else if (child == 0) {
-		usb_read_loop(pipe_fd[1]);
-	}
+	drv.fd = usb_async_fd(usb_reader);
+	log_debug("awlibusb: using device: %s", device_path);
 
 	log_trace("USB receiver initialized");
 	return 1;
 
 fail:
-	if (dev_handle) {
-		usb_close(dev_handle);
-		dev_handle = NULL;
-	}
-	if (pipe_fd[0] >= 0)
-		close(pipe_fd[0]);
-	if (pipe_fd[1] >= 0)
-		close(pipe_fd[1]);
+	awlibusb_deinit();
 	return 0;
 }
 
 /* deinitialize driver -- returns 1 on success, 0 on error */
 static int awlibusb_deinit(void)
 {
-	int err = 0;
-
+	usb_async_free(usb_reader);
+	usb_reader = NULL;
+	drv.fd = -1;
 	if (dev_handle) {
-		if (usb_close(dev_handle) < 0)
-			err = 1;
+		libusb_release_interface(dev_handle, 0);
+		libusb_close(dev_handle);
 		dev_handle = NULL;
 	}
-
-	if (drv.fd >= 0) {
-		if (close(drv.fd) < 0)
-			err = 1;
-		drv.fd = -1;
+	if (dev_config) {
+		libusb_free_config_descriptor(dev_config);
+		dev_config = NULL;
 	}
-
-	if (child > 1) {
-		if ((kill(child, SIGTERM) == -1)
-		    || (waitpid(child, NULL, 0) == 0))
-			err = 1;
+	if (usb_ctx) {
+		libusb_exit(usb_ctx);
+		usb_ctx = NULL;
 	}
-
-	return !err;
-}
-
-static char* awlibusb_rec(struct ir_remote* remotes)
-{
-	if (!rec_buffer_clear())
-		return NULL;
-	return decode_all(remotes);
+	return 1;
 }
 
-/* returns 1 if the given device should be used, 0 otherwise */
-static int is_device_ok(struct usb_device* dev)
+static int awlibusb_rec_pending(void)
 {
-	/* TODO: allow exact device to be specified */
-
-	/* check if the device ID is in usb_remote_id_table */
-	usb_device_id* dev_id;
-
-	for (dev_id = usb_remote_id_table; dev_id->vendor; dev_id++)
-		if ((dev->descriptor.idVendor == dev_id->vendor) && (dev->descriptor.idProduct == dev_id->product))
-			return 1;
-
-	return 0;
+	return codes_head != codes_tail;
 }
 
-/* find a compatible USB receiver and return a usb_device,
- * or NULL on failure. */
-static struct usb_device* find_usb_device(void)
+static char* awlibusb_rec(struct ir_remote* remotes)
 {
-	struct usb_bus* usb_bus;
-	struct usb_device* dev;
-
-	usb_init();
-	usb_find_busses();
-	usb_find_devices();
+	ir_code code = 0;
+	int i;
 
-	for (usb_bus = usb_busses; usb_bus; usb_bus = usb_bus->next) {
-		for (dev = usb_bus->devices; dev; dev = dev->next)
-			if (is_device_ok(dev))
-				return dev;
+	if (codes_head == codes_tail) {
+		if (!usb_async_handle_events(usb_reader)) {
+			awlibusb_deinit();
+			return NULL;
+		}
+		if (codes_head == codes_tail)
+			return NULL;
 	}
-	return NULL;            /* no suitable device found */
+	for (i = 0; i < AWUSB_RECEIVE_BYTES - 1; i++)
+		code = (code << CHAR_BIT) | codes[codes_tail % CODE_QUEUE].code[i];
+	rec_buffer_set_code(code, &codes[codes_tail % CODE_QUEUE].time, 0);
+	codes_tail++;
+	return decode_all(remotes);
 }
 
-/* set dev_ep_in and dev_ep_out to the in/out endpoints of the given
- * device. returns 1 on success, 0 on failure. */
-static int find_device_endpoints(struct usb_device* dev)
+/* set dev_ep_in to the in endpoint of the given device. returns 1 on
+ * success, 0 on failure. */
+static int find_device_endpoints(libusb_device* dev)
 {
-	struct usb_interface_descriptor* idesc;
+	struct libusb_device_descriptor desc;
+	const struct libusb_interface_descriptor* idesc;
 
-	if (dev->descriptor.bNumConfigurations != 1)
+	if (libusb_get_device_descriptor(dev, &desc) != 0)
+		return 0;
+	if (desc.bNumConfigurations != 1)
 		return 0;
 
-	if (dev->config[0].bNumInterfaces != 1)
+	if (libusb_get_config_descriptor(dev, 0, &dev_config) != 0) {
+		dev_config = NULL;
+		return 0;
+	}
+	if (dev_config->bNumInterfaces != 1)
 		return 0;
 
-	if (dev->config[0].interface[0].num_altsetting != 1)
+	if (dev_config->interface[0].num_altsetting != 1)
 		return 0;
 
-	idesc = &dev->config[0].interface[0].altsetting[0];
+	idesc = &dev_config->interface[0].altsetting[0];
 //      if (idesc->bNumEndpoints != 2) return 0;
 
 	dev_ep_in = &idesc->endpoint[0];
-	if ((dev_ep_in->bEndpointAddress & USB_ENDPOINT_DIR_MASK)
-	    != USB_ENDPOINT_IN)
+	if ((dev_ep_in->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+	    != LIBUSB_ENDPOINT_IN)
 		return 0;
 
-	if ((dev_ep_in->bmAttributes & USB_ENDPOINT_TYPE_MASK)
-	    != USB_ENDPOINT_TYPE_INTERRUPT)
+	if ((dev_ep_in->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+	    != LIBUSB_TRANSFER_TYPE_INTERRUPT)
 		return 0;
 
 	return 1;
 }
-
-/* this function is run in a forked process to read data from the USB
- * receiver and write it to the given fd. it calls exit() with result
- * code 0 on success, or 1 on failure. */
-static void usb_read_loop(int fd)
-{
-	int inited = 0;
-	int err = 0;
-
-#if !defined(AW_MODE_LIRCCODE)
-	long elapsed_seconds = 0;       /* diff between seconds counter */
-	long elapsed_useconds = 0;      /* diff between microseconds counter */
-	long time_diff = 0;
-#endif
-
-	alarm(0);
-	signal(SIGTERM, SIG_DFL);
-	signal(SIGPIPE, SIG_DFL);
-	signal(SIGINT, SIG_DFL);
-	signal(SIGHUP, SIG_IGN);
-	signal(SIGALRM, SIG_IGN);
-
-	for (;; ) {
-		char buf[AWUSB_RECEIVE_BYTES];
-		int bytes_r, bytes_w;
-
-		/* read from the USB device */
-		bytes_r =
-			usb_interrupt_read(dev_handle, dev_ep_in->bEndpointAddress, &buf[0], sizeof(buf), USB_TIMEOUT);
-		if (bytes_r < 0) {
-			if (errno == EAGAIN || errno == ETIMEDOUT)
-				continue;
-			log_perror_err("can't read from USB device");
-			err = 1;
-			goto done;
-		}
-
-		/* sometimes the remote sends one byte on startup; ignore it */
-		if (!inited) {
-			inited = 1;
-			if (bytes_r == 1)
-				continue;
-		}
-#ifdef AW_MODE_LIRCCODE
-		bytes_w = write(fd, &(buf[1]), (AWUSB_RECEIVE_BYTES - 1));
-		/* ignore first byte */
-		if (bytes_w < 0) {
-			log_perror_err("can't write to pipe");
-			err = 1;
-			goto done;
-		}
-#else
-		code = buf[AWUSB_RECEIVE_BYTES - 2];
-
-		/* calculate time diff */
-		gettimeofday(&time_current, NULL);
-		elapsed_seconds = time_current.tv_sec - time_last.tv_sec;
-		elapsed_useconds = time_current.tv_usec - time_last.tv_usec;
-		time_diff = (elapsed_seconds) * 1000000 + elapsed_useconds;
-		//printf("time_diff = %d usec\n", time_diff);
-
-		if (!((code == code_last) && (time_diff < AW_KEY_GAP))) {
-			bytes_w = write(fd, &code, 1);
-			if (bytes_w < 0) {
-				log_perror_err("can't write to pipe");
-				err = 1;
-				goto done;
-			}
-			code_last = code;
-			memcpy(&time_last, &time_current, sizeof(struct timeval));
-		}
-#endif
-	}
-
-done:
-	if (!usb_close(dev_handle))
-		err = 1;
-	_exit(err);
-}
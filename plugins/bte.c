@@ -44,7 +44,11 @@
 #include <termios.h>
 #include <limits.h>
 #include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <errno.h>
 
@@ -60,6 +64,7 @@ static int bte_decode(struct ir_remote* remote, struct decode_ctx_t* ctx);
 static int bte_init(void);
 static int bte_deinit(void);
 static char* bte_rec(struct ir_remote* remotes);
+static int bte_rec_pending(void);
 
 
 #define BTE_CAN_SEND 0
@@ -89,10 +94,11 @@ const struct driver hw_bte = {
 	.decode_func	= bte_decode,
 	.drvctl_func	= NULL,
 	.readdata	= NULL,
-	.api_version	= 3,
-	.driver_version = "0.9.3",
+	.api_version	= 4,
+	.driver_version = "0.9.4",
 	.info		= "No info available.",
 	.device_hint    = "/dev/btty*",
+	.rec_pending	= bte_rec_pending,
 };
 
 const struct driver* hardwares[] = { &hw_bte, (const struct driver*)NULL };
@@ -102,6 +108,15 @@ enum bte_state {
 	BTE_START_EVENTS, BTE_STOP_EVENTS, BTE_CREATE_DIALOG, BTE_JUMP_ASIDE
 };
 
+/** Delay before reopening the device after a failure [s]. */
+#define BTE_RETRY_DELAY 1
+
+/** The device is released this long when the menu is left [s]. */
+#define BTE_ASIDE_DELAY 30
+
+/** Max time to wait for the reply to a command [s]. */
+#define BTE_REPLY_TIMEOUT 5
+
 static const logchannel_t logchannel = LOG_DRIVER;
 
 static int pending = 0;
@@ -110,23 +125,65 @@ static int filter_cancel = 0;
 static char prev_cmd[PACKET_SIZE + 1];
 static int io_failed = 0;
 
+/*
+ * drv.fd is an epoll fd polling the device and a timer, so lircd wakes
+ * up for both and never waits here. The timer runs while waiting for a
+ * reply, and while the device is closed until it is opened again.
+ */
+static int dev_fd = -1;
+static int timer_fd = -1;
+
+/** Read from dev_fd but not yet handled. */
+static char input[256];
+static size_t input_len = 0;
+
 static int bte_connect(void);
 
+
+/** Let the timer expire after secs seconds, 0 stops it. */
+static void bte_set_timer(int secs)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = secs;
+	if (timerfd_settime(timer_fd, 0, &its, NULL) == -1)
+		log_perror_warn("bte: timerfd_settime");
+}
+
+
+/** Close the device and try to open it again after delay seconds. */
+static void bte_disconnect(int delay)
+{
+	if (dev_fd != -1) {
+		epoll_ctl(drv.fd, EPOLL_CTL_DEL, dev_fd, NULL);
+		close(dev_fd);
+		dev_fd = -1;
+	}
+	io_failed = 1;
+	pending = 0;
+	input_len = 0;
+	bte_set_timer(delay);
+}
+
 int bte_sendcmd(char* str, int next_state)
 {
-	if (io_failed && !bte_connect())        /* try to reestablish connection */
+	ssize_t len;
+
+	if (dev_fd == -1)               /* reopened when the timer expires */
 		return 0;
 
 	pending = next_state;
 	sprintf(prev_cmd, "AT%s\r", str);
 
 	log_trace("bte_sendcmd: \"%s\"", str);
-	if (write(drv.fd, prev_cmd, strlen(prev_cmd)) <= 0) {
-		io_failed = 1;
-		pending = 0;
+	len = strlen(prev_cmd);
+	if (write(dev_fd, prev_cmd, len) != len) {
 		log_error("bte_sendcmd: write failed  - %d: %s", errno, strerror(errno));
+		bte_disconnect(BTE_RETRY_DELAY);
 		return 0;
 	}
+	bte_set_timer(BTE_REPLY_TIMEOUT);
 	log_trace("bte_sendcmd: done");
 	return 1;
 }
@@ -134,117 +191,177 @@ int bte_sendcmd(char* str, int next_state)
 int bte_connect(void)
 {
 	struct termios tattr;
+	struct epoll_event ev;
 
 	log_trace2("bte_connect called");
 
-	if (drv.fd >= 0)
-		close(drv.fd);
-
+	bte_disconnect(0);
 	do {                    //try block
 		errno = 0;
-		drv.fd = open(drv.device, O_RDWR | O_NOCTTY);
-		if (drv.fd == -1) {
+		/* Don't wait for the RFCOMM link, the first reply tells. */
+		dev_fd = open(drv.device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (dev_fd == -1) {
 			log_trace("could not open %s", drv.device);
 			log_perror_warn("bte_connect");
 			break;
 		}
-		if (tcgetattr(drv.fd, &tattr) == -1) {
+		if (tcgetattr(dev_fd, &tattr) == -1) {
 			log_trace("bte_connect: tcgetattr() failed");
 			log_perror_warn("bte_connect");
 			break;
 		}
 		log_trace("opened %s", drv.device);
-		log_perror_warn("bte_connect");
 		cfmakeraw(&tattr);
 		tattr.c_cc[VMIN] = 1;
 		tattr.c_cc[VTIME] = 0;
-		if (tcsetattr(drv.fd, TCSAFLUSH, &tattr) == -1) {
+		if (tcsetattr(dev_fd, TCSAFLUSH, &tattr) == -1) {
 			log_trace("bte_connect: tcsetattr() failed");
 			log_perror_warn("bte_connect");
 			break;
 		}
-		if (!tty_setbaud(drv.fd, 115200)) {
+		if (!tty_setbaud(dev_fd, 115200)) {
 			log_trace("bte_connect: could not set baud rate %s", drv.device);
 			log_perror_warn("bte_connect");
 			break;
 		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = dev_fd;
+		if (epoll_ctl(drv.fd, EPOLL_CTL_ADD, dev_fd, &ev) == -1) {
+			log_perror_warn("bte_connect: epoll_ctl");
+			break;
+		}
 		log_error("bte_connect: connection established");
 		io_failed = 0;
 
 		if (bte_sendcmd("E?", BTE_INIT))  /* Ask for echo state just to syncronise */
 			return 1;
 		log_trace("bte_connect: device did not respond");
+		return 0;
 	} while (0);
 
 	//try block failed
-	io_failed = 1;
-	if (drv.fd >= 0)
-		close(drv.fd);
-	drv.fd = open("/dev/zero", O_RDONLY);
-	if (drv.fd == -1) {
-		log_error("could not open /dev/zero/");
-		log_perror_err("bte_init()");
-	}
-	sleep(1);
+	bte_disconnect(BTE_RETRY_DELAY);
 	return 0;
 }
 
 int bte_init(void)
 {
+	struct epoll_event ev;
+
 	log_trace2("bte_init called, device %s", drv.device);
 
 	if (!tty_create_lock(drv.device)) {
 		log_error("bte_init: could not create lock file");
 		return 0;
 	}
+	drv.fd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = timer_fd;
+	if (drv.fd == -1 || timer_fd == -1
+	    || epoll_ctl(drv.fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1) {
+		log_perror_err("bte_init");
+		bte_deinit();
+		return 0;
+	}
 	if (!bte_connect()) {
-		// return 0;
+		// retried from bte_rec() when the timer expires
 	}
 	return 1;
 }
 
 int bte_deinit(void)
 {
-	// stop events forwarding
-	bte_sendcmd("+CMER=0,0,0,0,0", 0);
-	close(drv.fd);
+	if (dev_fd != -1) {
+		// stop events forwarding
+		bte_sendcmd("+CMER=0,0,0,0,0", 0);
+		bte_disconnect(0);
+	}
+	if (timer_fd != -1) {
+		close(timer_fd);
+		timer_fd = -1;
+	}
+	if (drv.fd != -1) {
+		close(drv.fd);
+		drv.fd = -1;
+	}
 	tty_delete_lock();
 	log_trace("bte_deinit: OK");
 	return 1;
 }
 
+/** Read what the device has without blocking. 0 if it has failed. */
+static int bte_read_input(void)
+{
+	ssize_t r;
+
+	if (input_len == sizeof(input))
+		return 1;
+	r = read(dev_fd, input + input_len, sizeof(input) - input_len);
+	if (r == -1 && (errno == EAGAIN || errno == EINTR))
+		return 1;
+	if (r <= 0) {
+		log_error("bte_readline: read failed - %d: %s", errno, strerror(errno));
+		bte_disconnect(BTE_RETRY_DELAY);
+		return 0;
+	}
+	input_len += r;
+	return 1;
+}
+
+/** Return the next line in input, NULL if there is none. */
 char* bte_readline(void)
 {
 	static char msg[PACKET_SIZE + 1];
-	char c;
 	static int n = 0;
-	int ok = 1;
+	size_t used = 0;
+	char* line = NULL;
+	char c;
 
 	log_trace2("bte_readline called");
 
-	if (io_failed && !bte_connect())   /* try to reestablish connection */
-		return NULL;
-
-	ok = read(drv.fd, &c, 1);
-	if (ok <= 0) {
-		io_failed = 1;
-		log_error("bte_readline: read failed - %d: %s", errno, strerror(errno));
-		return NULL;
+	while (line == NULL && used < input_len) {
+		c = input[used++];
+		if (c == '\r')
+			continue;
+		if (c == '\n') {
+			if (n == 0)
+				continue;
+			msg[n] = 0;
+			n = 0;
+			log_trace2("bte_readline: %s", msg);
+			line = msg;
+			break;
+		}
+		msg[n++] = c;
+		if (n >= PACKET_SIZE - 1)
+			msg[--n] = '!';
 	}
-	if (ok == 0 || c == '\r')
-		return NULL;
-	if (c == '\n') {
-		if (n == 0)
-			return NULL;
-		msg[n] = 0;
-		n = 0;
-		log_trace2("bte_readline: %s", msg);
-		return msg;
+	memmove(input, input + used, input_len - used);
+	input_len -= used;
+	return line;
+}
+
+static int bte_rec_pending(void)
+{
+	return memchr(input, '\n', input_len) != NULL;
+}
+
+/** Handle an expired timer: reconnect, or give up waiting for a reply. */
+static void bte_timeout(void)
+{
+	uint64_t expirations;
+
+	if (read(timer_fd, &expirations, sizeof(expirations)) <= 0)
+		return;
+	if (dev_fd == -1) {
+		bte_connect();
+		return;
 	}
-	msg[n++] = c;
-	if (n >= PACKET_SIZE - 1)
-		msg[--n] = '!';
-	return NULL;
+	log_error("bte: no reply to %s", prev_cmd);
+	bte_disconnect(BTE_RETRY_DELAY);
 }
 
 char* bte_automaton(void)
@@ -261,7 +378,7 @@ char* bte_automaton(void)
 
 	while (1) {
 		msg = bte_readline();
-		if (msg == NULL)      /* Read failed. */
+		if (msg == NULL)      /* No complete line yet. */
 			return NULL;
 		if (pending != BTE_INIT)
 			break;
@@ -271,9 +388,11 @@ char* bte_automaton(void)
 	}
 	if (strcmp(msg, "ERROR") == 0) {  /* "ERROR" received */
 		pending = 0;
+		bte_set_timer(0);
 		log_error("bte_automaton: 'ERROR' received! Previous command: %s", prev_cmd);
 		return NULL;
 	} else if (strcmp(msg, "OK") == 0) {    /* Check for next cmd to send */
+		bte_set_timer(0);
 		switch (pending) {
 		case BTE_SET_ECHO:
 			bte_sendcmd("E1", BTE_CHARSET);
@@ -293,10 +412,10 @@ char* bte_automaton(void)
 		case BTE_JUMP_ASIDE:
 			// release device temporarily; chance for a
 			// user to switch off mobile's bluetooth (t630)
-			close(drv.fd);
-			log_trace2("bte_automaton: device closed; sleeping");
-			sleep(30);
-			break;
+			bte_disconnect(BTE_ASIDE_DELAY);
+			log_trace2("bte_automaton: device closed; reopened in %d s",
+				   BTE_ASIDE_DELAY);
+			return NULL;
 		}
 	} else if (strcmp(msg, "*EAAI") == 0) { /* Accessory menu activated */
 		// send empty command, trigger creating input dialog
@@ -364,6 +483,9 @@ char* bte_rec(struct ir_remote* remotes)
 {
 	log_trace2("bte_rec called");
 
+	bte_timeout();
+	if (dev_fd != -1 && !bte_rec_pending() && !bte_read_input())
+		return NULL;
 	if (bte_automaton())
 		return decode_all(remotes);
 	else
@@ -8,11 +8,17 @@
 # include <config.h>
 #endif
 
+#include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdint.h>
 #include <sys/wait.h>
 
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
 #include "lirc_driver.h"
 #include "lirc/lirc_driver.h"
 
@@ -96,6 +102,9 @@
 #define MAX_WAIT_BETWEEN_READS_US 5000000
 #define MIN_WAIT_BETWEEN_READS_US 5000
 
+/** Device nodes, watched for hotplug. */
+#define USB_DEVFS_DIR   "/dev/bus/usb"
+
 #define USB_MAX_BUSES   8
 #define USB_MAX_BUSDEV  127
 
@@ -296,6 +305,9 @@ static void software_disconnects(void);
 static void set_detected(unsigned int bus_num, int devnum);
 static void commandir_read_loop(void);
 static void shutdown_usb(int);
+static void hotplug_init(void);
+static int hotplug_changed(void);
+static void wait_for_work(int usecs);
 
 /*** Processing Functions ***/
 static void add_to_tx_pipeline(unsigned char* buffer, int bytes, unsigned int frequency);
@@ -414,15 +426,15 @@ struct detected_commandir {
 
 static const logchannel_t logchannel = LOG_DRIVER;
 
-static int child_pipe_write = 0;
 static char haveInited = 0;
 
 // 'commandir' event signal values
 static unsigned int signal_base[2][2] = { { 100 | PULSE_BIT,  200 },
 					  { 1000 | PULSE_BIT, 200 } };
 
-// Pipes to and from the child/parent
-static int pipe_fd[2] = { -1, -1 };
+// Samples from the child, pipes to the child
+static struct sample_ring* rx_ring = NULL;
+#define RX_RING_SIZE 16384
 
 static pid_t child_pid = -1;
 static int pipe_tochild[2] = { -1, -1 };
@@ -464,14 +476,15 @@ static int commandir_init(void)
 	send_buffer_init();     // LIRC's send
 
 	/* A separate process will be forked to read data from the USB
-	 * receiver and write it to a pipe. drv.fd is set to the readable
-	 * end of this pipe. */
-	if (pipe(pipe_fd) != 0) {
-		log_error("couldn't open pipe 1");
+	 * receiver and put it in a shared ring. drv.fd is set to the
+	 * ring's fd. */
+	rx_ring = sample_ring_new(RX_RING_SIZE);
+	if (rx_ring == NULL) {
+		log_error("couldn't create rx ring");
 		return 0;
 	}
 
-	drv.fd = pipe_fd[0];    // the READ end of the Pipe
+	drv.fd = sample_ring_fd(rx_ring);
 
 	if (pipe(pipe_tochild) != 0) {
 		log_error("couldn't open pipe 1");
@@ -493,7 +506,6 @@ static int commandir_init(void)
 		log_error("couldn't fork child process");
 		return 0;
 	} else if (child_pid == 0) {
-		child_pipe_write = pipe_fd[1];
 		commandir_child_init();
 		commandir_read_loop();
 		return 0;
@@ -533,11 +545,9 @@ static int commandir_deinit(void)
 			}
 		}
 
-		if (drv.fd >= 0) {
-			if (close(drv.fd) < 0)
-				log_error("Error closing pipe");
-			drv.fd = -1;
-		}
+		sample_ring_free(rx_ring);
+		rx_ring = NULL;
+		drv.fd = -1;
 
 		log_error("commandir_deinit()");
 	}
@@ -639,20 +649,12 @@ static lirc_t commandir_readdata(lirc_t timeout)
 	if (!waitfordata(timeout / 2))
 		return 0;
 
-	/* if we failed to get data return 0 */
 	/* Keep trying if we are mode2, but return immediately if we are the others */
 	if (strncmp(progname, "mode2", 5) == 0) {
-		while (code == 0) {
-			if (read(drv.fd, &code, sizeof(lirc_t)) <= 0) {
-				commandir_deinit();
-				return -1;
-			}
-		}
+		while (code == 0)
+			code = sample_ring_readdata(rx_ring, 0);
 	} else {
-		if (read(drv.fd, &code, sizeof(lirc_t)) <= 0) {
-			commandir_deinit();
-			return -1;
-		}
+		sample_ring_get(rx_ring, &code, 1);
 	}
 	return code;
 }
@@ -668,6 +670,7 @@ static struct commandir_device* rx_device = NULL;
 static int rx_hold = 0;
 static int shutdown_pending = 0;
 static int read_delay = WAIT_BETWEEN_READS_US;
+static int hotplug_fd = -1;     // inotify on USB_DEVFS_DIR, else -1
 static int insert_fast_zeros = 0;       // changed from 2, Aug 4/2010
 
 // Interface Functions:
@@ -692,6 +695,7 @@ static void commandir_child_init(void)
 	signal(SIGALRM, SIG_IGN);
 
 	usb_init();
+	hotplug_init();
 	hardware_scan();
 
 	commandir_read_loop();
@@ -1327,15 +1331,108 @@ static void commandir_read_loop(void)
 			// Don't remove this loop, need to call commandir_read()
 		}
 		if (repeats > 0) {
-			// once in a while, but never while we're receiving a signal
-			if (++periodic_checks > 100) {
+			// Without hotplug events, scan once in a while, but
+			// never while we're receiving a signal
+			if (hotplug_fd == -1 && ++periodic_checks > 100) {
 				hardware_scan();
 				periodic_checks = 0;
 			} else {
-				usleep(read_delay);
+				wait_for_work(read_delay);
+			}
+		}
+	}
+}
+
+
+/*** Hotplug: rescan when device nodes come and go ***/
+#ifdef HAVE_SYS_INOTIFY_H
+
+static const uint32_t hotplug_mask = IN_CREATE | IN_DELETE | IN_ATTRIB;
+
+static void hotplug_init(void)
+{
+	char path[sizeof(USB_DEVFS_DIR) + 256];
+	struct dirent* ent;
+	DIR* dir;
+
+	hotplug_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (hotplug_fd == -1)
+		return;
+	if (inotify_add_watch(hotplug_fd, USB_DEVFS_DIR, hotplug_mask) == -1) {
+		log_debug("Cannot watch " USB_DEVFS_DIR ", polling for devices");
+		close(hotplug_fd);
+		hotplug_fd = -1;
+		return;
+	}
+	dir = opendir(USB_DEVFS_DIR);
+	if (dir == NULL)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), USB_DEVFS_DIR "/%s", ent->d_name);
+		inotify_add_watch(hotplug_fd, path, hotplug_mask);
+	}
+	closedir(dir);
+}
+
+/** Drain hotplug events, watch new bus dirs, return 1 if any. */
+static int hotplug_changed(void)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char path[sizeof(USB_DEVFS_DIR) + 256];
+	const struct inotify_event* ev;
+	ssize_t len;
+	char* p;
+	int changed = 0;
+
+	while ((len = read(hotplug_fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event*)p;
+			if ((ev->mask & IN_ISDIR) && (ev->mask & IN_CREATE)
+			    && ev->len > 0) {
+				snprintf(path, sizeof(path),
+					 USB_DEVFS_DIR "/%s", ev->name);
+				inotify_add_watch(hotplug_fd, path, hotplug_mask);
 			}
+			changed = 1;
 		}
 	}
+	return changed;
+}
+
+#else
+
+static void hotplug_init(void)
+{
+}
+
+static int hotplug_changed(void)
+{
+	return 0;
+}
+
+#endif
+
+/** Sleep usecs, but handle commands from lircd and hotplug as they come. */
+static void wait_for_work(int usecs)
+{
+	struct pollfd pfd[2];
+	int n = 1;
+
+	pfd[0].fd = tochild_read;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	if (hotplug_fd != -1) {
+		pfd[1].fd = hotplug_fd;
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+		n = 2;
+	}
+	if (poll(pfd, n, (usecs + 999) / 1000) <= 0)
+		return;
+	if (n == 2 && (pfd[1].revents & POLLIN) && hotplug_changed())
+		hardware_scan();
 }
 
 /*** New Add_to_tx_pipeline ***/
@@ -1620,13 +1717,20 @@ static int check_irsend_commandir(unsigned char* command)
 
 /*** CommandIR RX Functions ***/
 
-static void lirc_pipe_write(lirc_t* one_item)
+/** Put samples in rx_ring, return the number of bytes stored. */
+static int lirc_ring_put(const lirc_t* data, int count)
 {
-	int bytes_w;            // Pipe write
+	int n;
 
-	bytes_w = write(child_pipe_write, one_item, sizeof(lirc_t));
-	if (bytes_w < 0)
-		log_error("Can't write to LIRC pipe! %d", child_pipe_write);
+	n = sample_ring_put(rx_ring, data, count);
+	if (n < count)
+		log_error("LIRC ring full, %d samples dropped", count - n);
+	return n * sizeof(lirc_t);
+}
+
+static void lirc_pipe_write(lirc_t* one_item)
+{
+	lirc_ring_put(one_item, 1);
 }
 
 static int commandir_read(void)
@@ -1723,10 +1827,8 @@ static int commandir_read(void)
 				if (zeroterminated > 1001) {
 					if (insert_fast_zeros > 0) {
 						//tmp4 = write(...)
-						chk_write(child_pipe_write,
-							  lirc_zero_buffer,
-							  sizeof(lirc_t)
-							  * insert_fast_zeros);
+						lirc_ring_put(lirc_zero_buffer,
+							      insert_fast_zeros);
 					}
 					zeroterminated = 0;
 				} else {
@@ -2135,14 +2237,7 @@ static int cmdir_convert_RX(unsigned char* orig_rxbuffer)
 	}
 	last_mc_time = asint1;
 
-	bytes_w = write(child_pipe_write, lirc_data_buffer, sizeof(lirc_t) * num_data_values);
-
-	if (bytes_w < 0) {
-		log_error("Can't write to LIRC pipe! %d", child_pipe_write);
-		goto done;
-	}
-
-done:
+	bytes_w = lirc_ring_put(lirc_data_buffer, num_data_values);
 	return bytes_w;
 }
 
@@ -2210,10 +2305,8 @@ static void commandir3_convert_RX(unsigned char* rxBuffer, int numNewValues)
 				break;
 			case USB_NO_DATA_BYTE:
 				//read_num = write(..)
-				chk_write(child_pipe_write,
-					  lirc_zero_buffer,
-					  sizeof(lirc_t)
-					  * insert_fast_zeros);
+				lirc_ring_put(lirc_zero_buffer,
+					      insert_fast_zeros);
 				mySize = 0;
 				break;
 			default:
@@ -2341,12 +2434,7 @@ static int commandir2_convert_RX(unsigned short* bufferrx, unsigned char numvalu
 			break;
 	}
 
-	bytes_w = write(child_pipe_write, lirc_data_buffer, sizeof(lirc_t) * i);
-
-	if (bytes_w < 0) {
-		log_error("Can't write to LIRC pipe! %d", child_pipe_write);
-		return 0;
-	}
+	bytes_w = lirc_ring_put(lirc_data_buffer, i);
 	return bytes_w;
 }
 
@@ -2433,7 +2521,7 @@ static void set_all_next_tx_mask(int* ar_new_tx_mask_list, int new_tx_len, uint3
 static void raise_event(unsigned int eventid)
 {
 	static lirc_t event_data[18] = { LIRCCODE_GAP, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	int i, bytes_w;
+	int i;
 
 	// Only for CommandIR II, and never for irrecord or mode2
 	if (strncmp(progname, "mode2", 5) == 0 || strncmp(progname, "irrecord", 8) == 0)
@@ -2452,8 +2540,5 @@ static void raise_event(unsigned int eventid)
 
 	event_data[16] = LIRCCODE_GAP * 4;
 
-	bytes_w = write(child_pipe_write, event_data, sizeof(lirc_t) * 17);
-
-	if (bytes_w < 0)
-		log_error("Can't write to LIRC pipe! %d", child_pipe_write);
+	lirc_ring_put(event_data, 17);
 }
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -51,6 +52,9 @@ static uint32_t supported_send_modes[] = {
 	0
 };
 
+/** Set by the scancode option, use LIRC_MODE_SCANCODE if possible. */
+static int use_scancode = 0;
+
 static uint32_t supported_rec_modes[] = {
 	LIRC_CAN_REC_LIRCCODE,
 	LIRC_CAN_REC_MODE2,
@@ -59,13 +63,31 @@ static uint32_t supported_rec_modes[] = {
 	0
 };
 
+/** Largest write() the kernel accepts, in samples (LIRCBUF_SIZE). */
+#define MAX_WRITE_SAMPLES 1024
+
+/**
+ * Transmit parameters last applied to the open device, so unchanged
+ * ones are not set again for each frame. Cleared when it is opened.
+ */
+static struct {
+	unsigned int	carrier;
+	unsigned int	duty_cycle;
+	uint32_t	tx_mask;
+	unsigned int	have_carrier : 1;
+	unsigned int	have_duty_cycle : 1;
+	unsigned int	have_tx_mask : 1;
+} tx_state;
+
 //Forwards:
 static int default_init(void);
 static int default_deinit(void);
 static int default_send(struct ir_remote* remote, struct ir_ncode* code);
+static int default_send_frames(const struct send_frame* frames, int count);
 static char* default_rec(struct ir_remote* remotes);
 static int default_ioctl(unsigned int cmd, void* arg);
 static lirc_t default_readdata(lirc_t timeout);
+static int default_readdata_bulk(lirc_t* data, int count, lirc_t timeout);
 static int my_open(const char* path);
 static int drvctl(unsigned int cmd, void* arg);
 
@@ -87,10 +109,12 @@ static const struct driver hw_default = {
 	.decode_func	= receive_decode,
 	.drvctl_func	= drvctl,
 	.readdata	= default_readdata,
-	.api_version	= 3,
-	.driver_version = "0.9.4",
+	.api_version	= 5,
+	.driver_version = "0.9.5",
 	.info		= "See file://" PLUGINDOCS "/default.html",
 	.device_hint    = "drvctl",
+	.readdata_bulk	= default_readdata_bulk,
+	.send_frames_func = default_send_frames,
 };
 
 
@@ -103,7 +127,7 @@ const struct driver* hardwares[] = { &hw_default, (const struct driver*)NULL };
 *
 **********************************************************************/
 
-static int write_send_buffer(int lirc);
+static int write_signals(int lirc, const lirc_t* data, int length);
 
 /***************************************************
 *
@@ -268,10 +292,126 @@ int my_open(const char* path)
 * decode stuff
 *
 **********************************************************************/
+/** Last item returned, used to work around #172. */
+static lirc_t last_space = (lirc_t) 0;
+
+
+/** Replace invalid 0 values from the device, warning once. */
+static lirc_t check_data(lirc_t data)
+{
+	static int data_warning = 1;
+
+	if (data != 0)
+		return data;
+	if (data_warning) {
+		log_warn("read invalid data from device %s", drv.device);
+		data_warning = 0;
+	}
+	return 1;
+}
+
+
+#ifdef LIRC_SCANCODE_FLAG_REPEAT
+
+/** Codes are the rc_proto in bits 32-47 and the scancode in bits 0-31. */
+#define SCANCODE_BITS		48
+
+/** Max time between two frames of a held button (ns). */
+#define SCANCODE_REPEAT_NS	200000000ULL
+
+/** Return 1 for protocols the kernel flags repeats for. */
+static int has_repeat_flag(uint16_t rc_proto)
+{
+	switch (rc_proto) {
+	case RC_PROTO_NEC:
+	case RC_PROTO_NECX:
+	case RC_PROTO_NEC32:
+	case RC_PROTO_SANYO:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+
+/**
+ * Tell if sc is the same button press as the last scancode: flagged
+ * by the kernel, else the same code with the same toggle bit shortly
+ * after.
+ */
+static int is_repeat(const struct lirc_scancode* sc)
+{
+	static struct lirc_scancode last;
+	int repeat;
+
+	if (sc->flags & LIRC_SCANCODE_FLAG_REPEAT)
+		repeat = 1;
+	else if (sc->scancode != last.scancode
+		 || sc->rc_proto != last.rc_proto
+		 || has_repeat_flag(sc->rc_proto)
+		 || sc->timestamp - last.timestamp > SCANCODE_REPEAT_NS)
+		repeat = 0;
+	else
+		repeat = ((sc->flags ^ last.flags)
+			  & LIRC_SCANCODE_FLAG_TOGGLE) == 0;
+	last = *sc;
+	return repeat;
+}
+
+
+/**
+ * Read a frame decoded by the kernel and map it to the remotes' codes
+ * without touching the pulse decoder.
+ */
+static char* scancode_rec(struct ir_remote* remotes)
+{
+	struct lirc_scancode sc;
+	struct timeval tv;
+	ir_code code;
+	int ret;
+
+	ret = read(drv.fd, &sc, sizeof(sc));
+	if (ret != sizeof(sc)) {
+		log_perror_err("error reading from %s (ret %d, expected %d)",
+			       drv.device, ret, sizeof(sc));
+		default_deinit();
+		return NULL;
+	}
+	log_trace("scancode: %llx, protocol: %u, flags: %u",
+		  (unsigned long long)sc.scancode, sc.rc_proto, sc.flags);
+	tv.tv_sec = sc.timestamp / 1000000000;
+	tv.tv_usec = (sc.timestamp % 1000000000) / 1000;
+	code = ((ir_code)sc.rc_proto << 32) | (sc.scancode & 0xffffffff);
+	rec_buffer_set_code(code, &tv, is_repeat(&sc));
+	return decode_all(remotes);
+}
+
+
+/** Switch the device to LIRC_MODE_SCANCODE if it can, else keep mode2. */
+static void set_scancode_mode(void)
+{
+	uint32_t mode = LIRC_MODE_SCANCODE;
+
+	if (!(drv.features & LIRC_CAN_REC_SCANCODE)) {
+		log_notice("%s cannot decode scancodes, using mode2",
+			   drv.device);
+		return;
+	}
+	if (default_ioctl(LIRC_SET_REC_MODE, &mode) == -1) {
+		log_perror_warn("cannot set scancode mode on %s", drv.device);
+		return;
+	}
+	drv.rec_mode = LIRC_MODE_SCANCODE;
+	*(uint32_t*)&drv.code_length = SCANCODE_BITS;
+	log_info("using kernel scancodes from %s", drv.device);
+}
+
+#endif /* LIRC_SCANCODE_FLAG_REPEAT */
+
+
 int default_readdata(lirc_t timeout)
 {
 	int data, ret;
-	static int last_space = (lirc_t) 0;
 
 	if (!waitfordata((long)timeout))
 		return 0;
@@ -298,20 +438,47 @@ int default_readdata(lirc_t timeout)
 			return 0;
 		}
 	}
-	if (data == 0) {
-		static int data_warning = 1;
-
-		if (data_warning) {
-			log_warn("read invalid data from device %s",
-				  drv.device);
-			data_warning = 0;
-		}
-		data = 1;
-	}
+	data = check_data(data);
 	last_space = data;
 	return data;
 }
 
+
+/**
+ * Read all items queued by the kernel in one read(), with the same
+ * processing as default_readdata().
+ */
+static int default_readdata_bulk(lirc_t* data, int count, lirc_t timeout)
+{
+	int ret, i, n;
+	int skipped = 0;
+
+	do {
+		if (!waitfordata((long)timeout))
+			return 0;
+		ret = read(drv.fd, data, count * sizeof(lirc_t));
+		if (ret <= 0 || ret % sizeof(lirc_t) != 0) {
+			log_perror_err("error reading from %s (ret %d)",
+				       drv.device, ret);
+			default_deinit();
+			return 0;
+		}
+		for (i = 0, n = 0; i < ret / (int)sizeof(lirc_t); i++) {
+			if (!skipped
+			    && last_space == LIRC_SPACE(LIRC_VALUE_MASK)
+			    && LIRC_IS_SPACE(data[i])) {
+				/* Work around #172. */
+				skipped = 1;
+				continue;
+			}
+			skipped = 0;
+			last_space = check_data(data[i]);
+			data[n++] = last_space;
+		}
+	} while (n == 0);
+	return n;
+}
+
 /*
  * interface functions
  */
@@ -323,8 +490,10 @@ int default_init(void)
 	/* FIXME: other modules might need this, too */
 	rec_buffer_init();
 	send_buffer_init();
+	memset(&tx_state, 0, sizeof(tx_state));
 
-	if (set_rc_protocol(drv.device) != 0)
+	/* The kernel decoders are needed in scancode mode. */
+	if (!use_scancode && set_rc_protocol(drv.device) != 0)
 		log_info("Cannot configure the rc device for %s",
 			  drv.device);
 
@@ -417,7 +586,7 @@ int default_init(void)
 	drv.rec_mode = 0;
 	if (LIRC_CAN_REC(drv.features)) {
 		for (i = 0; supported_rec_modes[i] != 0; i++) {
-			if (LIRC_CAN_REC(drv.features) == supported_rec_modes[i]) {
+			if (LIRC_CAN_REC(drv.features) & supported_rec_modes[i]) {
 				drv.rec_mode = LIRC_REC2MODE(supported_rec_modes[i]);
 				break;
 			}
@@ -425,6 +594,10 @@ int default_init(void)
 		if (supported_rec_modes[i] == 0)
 			log_notice("the receive method of the driver is not yet supported by lircd");
 	}
+#ifdef LIRC_SCANCODE_FLAG_REPEAT
+	if (use_scancode && drv.rec_mode == LIRC_MODE_MODE2)
+		set_scancode_mode();
+#endif
 	if (drv.rec_mode == LIRC_MODE_MODE2) {
 		/* get resolution */
 		drv.resolution = 0;
@@ -458,47 +631,88 @@ int default_deinit(void)
 		close(drv.fd);
 		drv.fd = -1;
 	}
+	memset(&tx_state, 0, sizeof(tx_state));
 	return 1;
 }
 
-static int write_send_buffer(int lirc)
+/**
+ * Write signals, like the send buffer which may hold several frames.
+ * A buffer longer than the kernel takes is split before a space, which
+ * is waited for here: the write of the first part returns when it has
+ * been transmitted.
+ */
+static int write_signals(int lirc, const lirc_t* data, int length)
 {
-	if (send_buffer_length() == 0) {
+	int count;
+
+	if (length == 0) {
 		log_trace("nothing to send");
 		return 0;
 	}
-	return write(lirc, send_buffer_data(), send_buffer_length() * sizeof(lirc_t));
+	while (length > MAX_WRITE_SAMPLES) {
+		/* Even counts end with a pulse, data[count] is a space. */
+		count = MAX_WRITE_SAMPLES - 1;
+		if (write(lirc, data, count * sizeof(lirc_t)) == -1)
+			return -1;
+		usleep(data[count]);
+		data += count + 1;
+		length -= count + 1;
+	}
+	return write(lirc, data, length * sizeof(lirc_t));
 }
 
-int default_send(struct ir_remote* remote, struct ir_ncode* code)
+
+/** Set a transmit parameter unless it is known to be value already. */
+static int set_tx_param(unsigned int cmd, unsigned int value,
+			unsigned int* applied, int have)
 {
-	/* things are easy, because we only support one mode */
-	if (drv.send_mode != LIRC_MODE_PULSE)
+	if (have && *applied == value)
+		return 1;
+	if (default_ioctl(cmd, &value) == -1)
 		return 0;
+	*applied = value;
+	return 1;
+}
 
+/** Set the carrier, unless the device has no such settings. */
+static int set_carrier(unsigned int freq, unsigned int duty_cycle)
+{
 	if (drv.features & LIRC_CAN_SET_SEND_CARRIER) {
-		unsigned int freq;
-
-		freq = remote->freq;
-		if (default_ioctl(LIRC_SET_SEND_CARRIER, &freq) == -1) {
+		if (!set_tx_param(LIRC_SET_SEND_CARRIER, freq,
+				  &tx_state.carrier, tx_state.have_carrier)) {
 			log_error("could not set modulation frequency");
 			log_perror_err(NULL);
+			tx_state.have_carrier = 0;
 			return 0;
 		}
+		tx_state.have_carrier = 1;
 	}
 	if (drv.features & LIRC_CAN_SET_SEND_DUTY_CYCLE) {
-		unsigned int duty_cycle;
-
-		duty_cycle = get_duty_cycle(remote);
-		if (default_ioctl(LIRC_SET_SEND_DUTY_CYCLE, &duty_cycle) == -1) {
+		if (!set_tx_param(LIRC_SET_SEND_DUTY_CYCLE, duty_cycle,
+				  &tx_state.duty_cycle,
+				  tx_state.have_duty_cycle)) {
 			log_error("could not set duty cycle");
 			log_perror_err(NULL);
+			tx_state.have_duty_cycle = 0;
 			return 0;
 		}
+		tx_state.have_duty_cycle = 1;
 	}
+	return 1;
+}
+
+int default_send(struct ir_remote* remote, struct ir_ncode* code)
+{
+	/* things are easy, because we only support one mode */
+	if (drv.send_mode != LIRC_MODE_PULSE)
+		return 0;
+
+	if (!set_carrier(remote->freq, get_duty_cycle(remote)))
+		return 0;
 	if (!send_buffer_put(remote, code))
 		return 0;
-	if (write_send_buffer(drv.fd) == -1) {
+	if (write_signals(drv.fd, send_buffer_data(),
+			  send_buffer_length()) == -1) {
 		log_error("write failed");
 		log_perror_err(NULL);
 		return 0;
@@ -506,8 +720,75 @@ int default_send(struct ir_remote* remote, struct ir_ncode* code)
 	return 1;
 }
 
+/**
+ * Frames with the same carrier are written as one buffer with their
+ * gaps as spaces, so the kernel times them. Only the gap before a
+ * carrier change is waited for here.
+ */
+int default_send_frames(const struct send_frame* frames, int count)
+{
+	static lirc_t* buf = NULL;
+	static int size = 0;
+	const struct send_frame* frame;
+	lirc_t* p;
+	int first;
+	int length;
+	int i;
+	int j;
+
+	if (drv.send_mode != LIRC_MODE_PULSE)
+		return 0;
+	for (first = 0; first < count; first = i) {
+		length = 0;
+		for (i = first; i < count; i++) {
+			if (frames[i].freq != frames[first].freq
+			    || frames[i].duty_cycle != frames[first].duty_cycle)
+				break;
+			length += frames[i].length + 1;
+		}
+		if (length > size) {
+			p = (lirc_t*)realloc(buf, length * sizeof(lirc_t));
+			if (p == NULL) {
+				log_error("out of memory");
+				return 0;
+			}
+			buf = p;
+			size = length;
+		}
+		length = 0;
+		for (j = first; j < i; j++) {
+			frame = &frames[j];
+			memcpy(buf + length, frame->data,
+			       frame->length * sizeof(lirc_t));
+			length += frame->length;
+			if (j == i - 1 || length == 0)
+				continue;
+			if (length % 2 == 0)
+				/* Ends with a space, make it the gap. */
+				buf[length - 1] += frame->gap;
+			else
+				buf[length++] = frame->gap;
+		}
+		if (!set_carrier(frames[first].freq,
+				 frames[first].duty_cycle))
+			return 0;
+		if (write_signals(drv.fd, buf, length) == -1) {
+			log_error("write failed");
+			log_perror_err(NULL);
+			return 0;
+		}
+		if (i < count)
+			usleep(frames[i - 1].gap);
+	}
+	return 1;
+}
+
 char* default_rec(struct ir_remote* remotes)
 {
+#ifdef LIRC_SCANCODE_FLAG_REPEAT
+	if (drv.rec_mode == LIRC_MODE_SCANCODE)
+		return scancode_rec(remotes);
+#endif
 	if (!rec_buffer_clear()) {
 		default_deinit();
 		return NULL;
@@ -533,6 +814,11 @@ static int list_devices(glob_t* glob)
 
 static int drvctl(unsigned int cmd, void* arg)
 {
+	int r;
+#ifdef LIRC_SCANCODE_FLAG_REPEAT
+	struct option_t* opt;
+#endif
+
 	switch (cmd) {
 	case DRVCTL_GET_DEVICES:
 		return list_devices((glob_t*) arg);
@@ -540,7 +826,26 @@ static int drvctl(unsigned int cmd, void* arg)
 		drv_enum_free((glob_t*) arg);
 		return 0;
 	case LIRC_SET_TRANSMITTER_MASK:
-		return default_ioctl(LIRC_SET_TRANSMITTER_MASK, arg);
+		if (tx_state.have_tx_mask
+		    && tx_state.tx_mask == *(uint32_t*)arg)
+			return 0;
+		tx_state.have_tx_mask = 0;
+		/* A positive result is the number of transmitters. */
+		r = default_ioctl(LIRC_SET_TRANSMITTER_MASK, arg);
+		if (r != 0)
+			return r;
+		tx_state.tx_mask = *(uint32_t*)arg;
+		tx_state.have_tx_mask = 1;
+		return 0;
+#ifdef LIRC_SCANCODE_FLAG_REPEAT
+	case DRVCTL_SET_OPTION:
+		opt = (struct option_t*)arg;
+		if (strcmp(opt->key, "scancode") == 0) {
+			use_scancode = strtol(opt->value, NULL, 10) != 0;
+			return 0;
+		}
+		return DRV_ERR_BAD_OPTION;
+#endif
 	default:
 		return DRV_ERR_NOT_IMPLEMENTED;
 	}
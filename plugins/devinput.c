@@ -59,6 +59,7 @@ static int devinput_init_fwd(void);
 static int devinput_deinit(void);
 static int devinput_decode(struct ir_remote* remote, struct decode_ctx_t* ctx);
 static char* devinput_rec(struct ir_remote* remotes);
+static int devinput_rec_pending(void);
 static int drvctl(unsigned int fd, void* arg);
 
 enum locate_type {
@@ -80,6 +81,7 @@ const struct driver hw_devinput = {
 	.close_func	= default_close,
 	.send_func	= NULL,
 	.rec_func	= devinput_rec,
+	.rec_pending	= devinput_rec_pending,
 	.decode_func	= devinput_decode,
 	.drvctl_func	= drvctl,
 	.readdata	= NULL,
@@ -104,6 +106,14 @@ static int exclusive = 0;
 static int uinputfd = -1;
 static struct timeval start, end, last;
 
+/** Max number of events fetched by one read(). */
+#define EVENT_BATCH 64
+
+/** Events read from drv.fd, handled one by one by devinput_rec(). */
+static struct input_event events[EVENT_BATCH];
+static int event_pos = 0;
+static int event_count = 0;
+
 enum {
 	RPT_UNKNOWN = -1,
 	RPT_NO = 0,
@@ -403,6 +413,7 @@ int devinput_deinit(void)
 	}
 	close(drv.fd);
 	drv.fd = -1;
+	event_pos = event_count = 0;
 	return 1;
 }
 
@@ -439,71 +450,120 @@ int devinput_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
 	return 1;
 }
 
-char* devinput_rec(struct ir_remote* remotes)
+/** Fill events with what's available in drv.fd, return 0 on errors. */
+static int read_events(void)
 {
-	struct input_event event;
 	int rd;
-	ir_code value;
-
-	log_trace("devinput_rec");
 
-	last = end;
-	gettimeofday(&start, NULL);
-
-	rd = read(drv.fd, &event, sizeof(event));
-	if (rd != sizeof(event)) {
+	event_pos = event_count = 0;
+	rd = read(drv.fd, events, sizeof(events));
+	if (rd < (int)sizeof(events[0]) || rd % sizeof(events[0]) != 0) {
 		log_error("error reading '%s'", drv.device);
 		if (rd <= 0 && errno != EINTR)
 			devinput_deinit();
 		return 0;
 	}
+	event_count = rd / sizeof(events[0]);
+	return 1;
+}
 
-	log_trace("time %ld.%06ld  type %d  code %d  value %d", event.time.tv_sec, event.time.tv_usec, event.type,
-		  event.code, event.value);
 
-	value = (unsigned)event.value;
+static int is_forwarded(const struct input_event* event)
+{
+	return event->type == EV_REL
+	       || event->type == EV_ABS
+	       || (event->type == EV_KEY
+		   && event->code >= BTN_MISC
+		   && event->code <= BTN_GEAR_UP)
+	       || event->type == EV_SYN;
+}
+
+
+/** Write the run of forwarded events at event_pos to uinput. */
+static int forward_events(void)
+{
+	int n;
+
+	for (n = 0; event_pos + n < event_count; n++)
+		if (!is_forwarded(&events[event_pos + n]))
+			break;
+	if (n == 0)
+		return 0;
+	log_trace("forwarding %d events", n);
+	if (write(uinputfd, &events[event_pos], n * sizeof(events[0]))
+	    != (ssize_t)(n * sizeof(events[0])))
+		log_perror_err("writing to uinput failed");
+	event_pos += n;
+	return n;
+}
+
+
+int devinput_rec_pending(void)
+{
+	return event_pos < event_count;
+}
+
+
+char* devinput_rec(struct ir_remote* remotes)
+{
+	const struct input_event* event;
+	ir_code value;
+
+	log_trace("devinput_rec");
+
+	if (event_pos >= event_count && !read_events())
+		return 0;
+	while (event_pos < event_count) {
+		if (uinputfd != -1 && forward_events() > 0)
+			continue;
+		event = &events[event_pos++];
+
+		log_trace("time %ld.%06ld  type %d  code %d  value %d",
+			  event->time.tv_sec, event->time.tv_usec,
+			  event->type, event->code, event->value);
+
+		/* ignore EV_SYN */
+		if (event->type == EV_SYN)
+			continue;
+
+		value = (unsigned)event->value;
 #ifdef EV_SW
-	if (value == 2 && (event.type == EV_KEY || event.type == EV_SW))
-		value = 1;
-	code_compat = ((event.type == EV_KEY || event.type == EV_SW) && event.value != 0) ? 0x80000000 : 0;
+		if (value == 2
+		    && (event->type == EV_KEY || event->type == EV_SW))
+			value = 1;
+		code_compat = ((event->type == EV_KEY || event->type == EV_SW)
+			       && event->value != 0) ? 0x80000000 : 0;
 #else
-	if (value == 2 && event.type == EV_KEY)
-		value = 1;
-	code_compat = ((event.type == EV_KEY) && event.value != 0) ? 0x80000000 : 0;
+		if (value == 2 && event->type == EV_KEY)
+			value = 1;
+		code_compat = ((event->type == EV_KEY) && event->value != 0)
+			      ? 0x80000000 : 0;
 #endif
-	code_compat |= ((event.type & 0x7fff) << 16);
-	code_compat |= event.code;
-
-	if (event.type == EV_KEY) {
-		if (event.value == 2)
-			repeat_state = RPT_YES;
-		else
-			repeat_state = RPT_NO;
-	} else {
-		repeat_state = RPT_UNKNOWN;
-	}
+		code_compat |= ((event->type & 0x7fff) << 16);
+		code_compat |= event->code;
+
+		if (event->type == EV_KEY) {
+			if (event->value == 2)
+				repeat_state = RPT_YES;
+			else
+				repeat_state = RPT_NO;
+		} else {
+			repeat_state = RPT_UNKNOWN;
+		}
 
-	code = ((ir_code)(unsigned)event.type) << 48 | ((ir_code)(unsigned)event.code) << 32 | value;
+		code = ((ir_code)(unsigned)event->type) << 48
+		       | ((ir_code)(unsigned)event->code) << 32 | value;
 
-	log_trace("code %.16llx", code);
+		log_trace("code %.16llx", code);
 
-	if (uinputfd != -1) {
-		if (event.type == EV_REL || event.type == EV_ABS
-		    || (event.type == EV_KEY && event.code >= BTN_MISC && event.code <= BTN_GEAR_UP)
-		    || event.type == EV_SYN) {
-			log_trace("forwarding: %04x %04x", event.type, event.code);
-			if (write(uinputfd, &event, sizeof(event)) != sizeof(event))
-				log_perror_err("writing to uinput failed");
-			return NULL;
-		}
+		/* The kernel timestamp replaces timing the read(). */
+		last = end;
+		start.tv_sec = event->time.tv_sec;
+		start.tv_usec = event->time.tv_usec;
+		end = start;
+		return decode_all(remotes);
 	}
-
-	/* ignore EV_SYN */
-	if (event.type == EV_SYN)
-		return NULL;
-
-	gettimeofday(&end, NULL);
-	return decode_all(remotes);
+	return NULL;
 }
 
 
@@ -7,7 +7,8 @@
 *
 *  Also, it supports the following drvctl options:
 *    - 'set-input <path>' which makes is read data  from disk file and
-*       deliver it as pulses from the remote.
+*       deliver it as pulses from the remote. The file is either text
+*       like mode2(1) prints, or binary as described in mode2_file.h.
 *    - 'send-space <useconds>' which indeed sends a (typically long) space.
 *
 *  The exported file descriptor drv.fd reflects the input file, not the
@@ -42,6 +43,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -60,6 +62,7 @@ static int close_func(void);
 static int decode_func(struct ir_remote* remote, struct decode_ctx_t* ctx);
 static lirc_t readdata(lirc_t timeout);
 static int drvctl_func(unsigned int cmd, void* arg);
+static void close_infile(void);
 
 
 const struct driver drv_test = {
@@ -95,6 +98,15 @@ static FILE* infile = NULL;
 static int outfile_fd = -1;
 static int lineno = 1;
 static int at_eof = 0;
+static int binary = 0;          /* infile is a binary mode2 file. */
+
+/* A regular binary infile is mapped instead of read through infile. */
+static const lirc_t* map_data = NULL;
+static size_t map_count = 0;    /* Durations in map_data. */
+static size_t map_pos = 0;      /* Next duration to return. */
+static void* map_base = NULL;
+static size_t map_size = 0;
+static int map_fd = -1;
 
 static int decode_func(struct ir_remote* remote, struct decode_ctx_t* ctx)
 {
@@ -107,39 +119,61 @@ static int decode_func(struct ir_remote* remote, struct decode_ctx_t* ctx)
 }
 
 
-static lirc_t readdata(lirc_t timeout)
+/** Read next duration from infile into *data, return 0 at EOF. */
+static int read_value(lirc_t* data)
 {
 	char line[64];
 	char what[16];
-	int count;
-	int data;
-	const char* const close_msg =
-		"# Closing infile file after %d lines (data still pending...)\n";
+	int value;
 
-	if (infile == NULL || fgets(line, sizeof(line), infile) == NULL) {
-		log_trace("No more input, timeout: %d", timeout);
-		if (timeout > 0)
-			usleep(timeout);
-		if (infile != NULL) {
-			fclose(infile);
-			infile = NULL;
-		}
-		snprintf(line, sizeof(line), close_msg, lineno);
-		chk_write(outfile_fd, line, strlen(line));
-		drv.fd = -1;
-		at_eof = 1;
-		log_debug("Closing infile after  %d lines", lineno);
-		lineno = 0;
-		return LIRC_EOF | LIRC_MODE2_TIMEOUT | timeout;
+	if (map_data != NULL) {
+		if (map_pos >= map_count)
+			return 0;
+		*data = map_data[map_pos++];
+		return 1;
 	}
-	count = sscanf(line, "%15s %d", what, &data);
-	if (count != 2)
+	if (infile == NULL)
 		return 0;
-	data &= PULSE_MASK;
+	if (binary)
+		return fread(data, sizeof(lirc_t), 1, infile) == 1;
+	if (fgets(line, sizeof(line), infile) == NULL)
+		return 0;
+	if (sscanf(line, "%15s %d", what, &value) != 2) {
+		*data = 0;
+		return 1;
+	}
+	value &= PULSE_MASK;
 	if (strstr(what, "pulse") != NULL)
-		data |= PULSE_BIT;
-	lineno += 1;
-	return data;
+		value |= PULSE_BIT;
+	*data = value;
+	return 1;
+}
+
+
+static lirc_t readdata(lirc_t timeout)
+{
+	char line[64];
+	lirc_t data;
+	const char* const close_msg =
+		"# Closing infile file after %d lines (data still pending...)\n";
+
+	if (read_value(&data)) {
+		if (data != 0)
+			lineno += 1;
+		return data;
+	}
+	log_trace("No more input, timeout: %d", timeout);
+	/* The virtual clock accounts for the timeout without waiting. */
+	if (timeout > 0 && !rec_get_virtual_clock())
+		usleep(timeout);
+	close_infile();
+	snprintf(line, sizeof(line), close_msg, lineno);
+	chk_write(outfile_fd, line, strlen(line));
+	drv.fd = -1;
+	at_eof = 1;
+	log_debug("Closing infile after  %d lines", lineno);
+	lineno = 0;
+	return LIRC_EOF | LIRC_MODE2_TIMEOUT | timeout;
 };
 
 
@@ -166,6 +200,11 @@ static int close_func(void)
 {
 	if (drv.fd == -1)
 		return 1;
+	if (map_base != NULL || infile != NULL) {
+		close_infile();
+		drv.fd = -1;
+		return 1;
+	}
 	if (close(drv.fd) == -1) {
 		log_perror_warn("deinit: Cannot close");
 		return 0;
@@ -237,11 +276,122 @@ static int send_func(struct ir_remote* remote, struct ir_ncode* code)
 }
 
 
+static void close_infile(void)
+{
+	if (map_base != NULL) {
+		munmap(map_base, map_size);
+		close(map_fd);
+		map_base = NULL;
+		map_data = NULL;
+		map_fd = -1;
+	}
+	if (infile != NULL) {
+		fclose(infile);
+		infile = NULL;
+	}
+	binary = 0;
+}
+
+
+/**
+ * Map a regular binary file, return 1 if mapped, 0 if fd should be
+ * read as a stream instead and -1 for a bad header. fd is owned by the
+ * mapping when mapped.
+ */
+static int map_infile(int fd)
+{
+	struct stat st;
+	void* base;
+	long offset;
+	char c;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return 0;
+	if (pread(fd, &c, 1, 0) != 1 || c != '\0')
+		return 0;
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		return 0;
+	offset = mode2_file_parse_header(base, st.st_size, NULL);
+	if (offset < 0) {
+		log_error("file: bad binary mode2 file header");
+		munmap(base, st.st_size);
+		return -1;
+	}
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+	map_base = base;
+	map_size = st.st_size;
+	map_data = (const lirc_t*)((const char*)base + offset);
+	map_count = (st.st_size - offset) / sizeof(lirc_t);
+	map_pos = 0;
+	map_fd = fd;
+	binary = 1;
+	return 1;
+}
+
+
+/**
+ * Check for the binary header and skip it, return 1 if found, 0 for a
+ * text file and -1 for a bad header. A text file is left as is, its
+ * first byte is never the magic's leading NUL.
+ */
+static int is_binary(FILE* f)
+{
+	int c;
+
+	c = getc(f);
+	if (c != EOF)
+		ungetc(c, f);
+	if (c != '\0')
+		return 0;
+	if (!mode2_file_read_header(f, NULL)) {
+		log_error("file: bad binary mode2 file header");
+		return -1;
+	}
+	return 1;
+}
+
+
+/** Open path as input, mapped if possible. Return 0 or DRV_ERR_*. */
+static int open_infile(const char* path)
+{
+	int fd;
+	int r;
+
+	close_infile();
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return DRV_ERR_BAD_OPTION;
+	r = map_infile(fd);
+	if (r == 1) {
+		drv.fd = fd;
+		return 0;
+	}
+	if (r == -1) {
+		close(fd);
+		return DRV_ERR_BAD_OPTION;
+	}
+	infile = fdopen(fd, "r");
+	if (infile == NULL) {
+		close(fd);
+		return DRV_ERR_BAD_OPTION;
+	}
+	binary = is_binary(infile);
+	if (binary == -1) {
+		close_infile();
+		return DRV_ERR_BAD_OPTION;
+	}
+	drv.fd = fd;
+	return 0;
+}
+
+
 static int drvctl_func(unsigned int cmd, void* arg)
 {
 	struct option_t* opt;
 	long value;
 	char buff[256];
+	int r;
 	const char* const open_msg = "# Reading from %s\n";
 
 	switch (cmd) {
@@ -258,10 +408,9 @@ static int drvctl_func(unsigned int cmd, void* arg)
 		} else if (strcmp(opt->key, "set-infile") == 0) {
 			if (outfile_fd < 0)
 				return DRV_ERR_BAD_STATE;
-			infile = fopen(opt->value, "r");
-			if (infile == NULL)
-				return DRV_ERR_BAD_OPTION;
-			drv.fd = fileno(infile);
+			r = open_infile(opt->value);
+			if (r != 0)
+				return r;
 			lineno = 1;
 			snprintf(buff, sizeof(buff), open_msg, opt->value);
 			chk_write(outfile_fd, buff, strlen(buff));
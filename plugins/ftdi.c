@@ -44,6 +44,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -52,6 +53,7 @@
 #include <netinet/in.h>
 #include <errno.h>
 #include <glob.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -76,7 +78,9 @@ static const logchannel_t logchannel = LOG_DRIVER;
 static pid_t child_pid = -1;
 
 #define RXBUFSZ         2048
-#define TXBUFSZ         65536
+
+/* Samples per USB write while transmitting, two writes are in flight */
+#define TX_CHUNK        4096
 
 static char* device_config = NULL;
 static int tx_baud_rate = 65536;
@@ -93,6 +97,12 @@ static int rx_baud_mult = 64;
 
 static int laststate = -1;
 static uint32_t rxctr = 0;
+static uint64_t rx_scale;       /* us per sample, 32.32 fixed point */
+static uint32_t rx_max_ctr;     /* samples clamped to PULSE_MASK us */
+
+/* Received samples, from the child to lircd */
+static struct sample_ring* rx_ring = NULL;
+#define RX_RING_SIZE    16384
 
 static int pipe_main2tx[2] = { -1, -1 };
 static int pipe_tx2main[2] = { -1, -1 };
@@ -112,9 +122,30 @@ static lirc_t time_left(struct timeval* current, struct timeval* last, lirc_t ga
 }
 #endif
 
-static int modulate_pulses(unsigned char* buf, size_t size,
-	const int* pulseptr, int n_pulses, uint32_t f_sample, uint32_t f_carrier,
-	unsigned int duty_cycle);
+/* A code to transmit, from lircd to the child, followed by n_pulses
+ * lirc_t */
+struct tx_request {
+	uint32_t	f_carrier;
+	uint32_t	duty_cycle;
+	uint32_t	n_pulses;
+};
+
+/* Carrier generator state, kept between two chunks of samples */
+struct modulator {
+	const lirc_t*	pulses;
+	uint32_t	n_pulses;
+	uint32_t	f_sample;
+	uint32_t	f_carrier;
+	uint32_t	duty;           /* carrier on time, in samples */
+	uint32_t	div_carrier;
+	uint32_t	pulsewidth;     /* samples left of current pulse */
+	int		sendpulse;
+	int		done;           /* final 0 generated */
+};
+
+static int stream_pulses(struct ftdi_context* ctx,
+	const lirc_t* pulses, int n_pulses, uint32_t f_sample,
+	uint32_t f_carrier, unsigned int duty_cycle);
 
 static void list_devices(glob_t *buff)
 {
@@ -159,46 +190,151 @@ static void list_devices(glob_t *buff)
 	drv_enum_add_udev_info(buff);
 }
 
-static void parsesamples(unsigned char* buf, int n, int pipe_rxir_w)
+/**
+ * Set rx_scale and rx_max_ctr from rx_baud_rate and rx_baud_mult.
+ *
+ * The datasheet indicates that the sample rate in bitbang mode is
+ * 16 times the baud rate but 32 seems to be correct.
+ */
+static void set_rx_scale(void)
 {
-	int i;
-	lirc_t usecs;
+	uint64_t rate = (uint64_t)rx_baud_rate * rx_baud_mult;
+
+	rx_scale = ((1000000ULL << 32) + rate - 1) / rate;
+	rx_max_ctr = (uint64_t)(PULSE_MASK + 1) * rate / 1000000;
+}
 
-	for (i = 0; i < n; i++) {
-		int curstate = (buf[i] & (1 << input_pin)) != 0;
+/** Convert number of samples to us (+-1), clamped to PULSE_MASK. */
+static lirc_t samples2usecs(uint32_t samples)
+{
+	uint64_t usecs;
+
+	if (samples > rx_max_ctr)
+		return PULSE_MASK;
+	usecs = (samples * rx_scale) >> 32;
+	return usecs > PULSE_MASK ? PULSE_MASK : (lirc_t)usecs;
+}
 
+/**
+ * Put the edges in the n samples of buf in rx_ring, all at once.
+ * Runs of unchanged samples are skipped eight at a time.
+ */
+static void parsesamples(unsigned char* buf, int n)
+{
+	const uint64_t pinmask = 0x0101010101010101ULL << input_pin;
+	lirc_t edges[RXBUFSZ];
+	uint64_t idle;
+	uint64_t word;
+	int curstate;
+	int count = 0;
+	int i = 0;
+
+	while (i < n) {
+		if (laststate >= 0) {
+			idle = laststate ? pinmask : 0;
+			for (; i + 8 <= n; i += 8) {
+				memcpy(&word, buf + i, sizeof(word));
+				if ((word & pinmask) != idle)
+					break;
+				rxctr += 8;
+			}
+			if (i >= n)
+				break;
+		}
+		curstate = (buf[i++] & (1 << input_pin)) != 0;
 		rxctr++;
 		if (curstate == laststate)
 			continue;
 
-		/* Convert number of samples to us.
-		 *
-		 * The datasheet indicates that the sample rate in
-		 * bitbang mode is 16 times the baud rate but 32 seems
-		 * to be correct. */
-		usecs = (rxctr * 1000000LL) / (rx_baud_rate * rx_baud_mult);
-
-		/* Clamp */
-		if (usecs > PULSE_MASK)
-			usecs = PULSE_MASK;
+		edges[count] = samples2usecs(rxctr);
 
 		/* Indicate pulse or bit */
 		if (curstate)
-			usecs |= PULSE_BIT;
-
-		/* Send the sample */
-		chk_write(pipe_rxir_w, &usecs, sizeof(usecs));
+			edges[count] |= PULSE_BIT;
+		if (++count == RXBUFSZ) {
+			sample_ring_put(rx_ring, edges, count);
+			count = 0;
+		}
 
 		/* Remember last state */
 		laststate = curstate;
 		rxctr = 0;
 	}
+	if (count > 0)
+		sample_ring_put(rx_ring, edges, count);
+}
+
+/* Read count bytes from the non-blocking fd, 0 on EOF or errors */
+static int read_full(int fd, void* buf, size_t count)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	ssize_t ret;
+
+	while (count > 0) {
+		ret = read(fd, buf, count);
+		if (ret == -1 && errno == EAGAIN) {
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		if (ret <= 0)
+			return 0;
+		buf = (char*)buf + ret;
+		count -= ret;
+	}
+	return 1;
+}
+
+/* Write count bytes to fd, 0 on errors */
+static int write_full(int fd, const void* buf, size_t count)
+{
+	ssize_t ret;
+
+	while (count > 0) {
+		ret = write(fd, buf, count);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return 0;
+		buf = (const char*)buf + ret;
+		count -= ret;
+	}
+	return 1;
+}
+
+/* Read a tx_request and its pulses into *pulses, growing it as needed.
+ * Returns 1 if read, -1 if nothing is pending and 0 on EOF or errors. */
+static int read_request(int fd, struct tx_request* req,
+			lirc_t** pulses, uint32_t* size)
+{
+	lirc_t* p;
+	ssize_t ret;
+
+	ret = read(fd, req, sizeof(*req));
+	if (ret == -1 && errno == EAGAIN)
+		return -1;
+	if (ret <= 0)
+		return 0;
+	if (!read_full(fd, (char*)req + ret, sizeof(*req) - ret))
+		return 0;
+	if (req->n_pulses > *size) {
+		p = (lirc_t*)realloc(*pulses, req->n_pulses * sizeof(lirc_t));
+		if (p == NULL) {
+			log_error("ftdi: out of memory reading code");
+			return 0;
+		}
+		*pulses = p;
+		*size = req->n_pulses;
+	}
+	return read_full(fd, *pulses, req->n_pulses * sizeof(lirc_t));
 }
 
-static void child_process(int fd_rx2main, int fd_main2tx, int fd_tx2main)
+static void child_process(int fd_main2tx, int fd_tx2main)
 {
 	int ret = 0;
 	struct ftdi_context ftdic;
+	struct tx_request req;
+	lirc_t* pulses = NULL;
+	uint32_t pulses_size = 0;
 
 	alarm(0);
 	signal(SIGTERM, SIG_DFL);
@@ -208,6 +344,7 @@ static void child_process(int fd_rx2main, int fd_main2tx, int fd_tx2main)
 	signal(SIGALRM, SIG_IGN);
 
 	ftdi_init(&ftdic);
+	set_rx_scale();
 
 	/* indicate we're started: */
 	ret = write(fd_tx2main, &ret, 1);
@@ -235,10 +372,11 @@ static void child_process(int fd_rx2main, int fd_main2tx, int fd_tx2main)
 		log_debug("opened FTDI device '%s' OK", drv.device);
 
 		while (1) {
-			unsigned char buf[RXBUFSZ > TXBUFSZ ? RXBUFSZ : TXBUFSZ];
+			unsigned char buf[RXBUFSZ];
 
 			/* transmit IR */
-			ret = read(fd_main2tx, buf, sizeof(buf));
+			ret = read_request(fd_main2tx, &req,
+					   &pulses, &pulses_size);
 			if (ret > 0) {
 				/* select correct transmit baudrate */
 				if (ftdi_set_baudrate(&ftdic, tx_baud_rate) < 0) {
@@ -246,7 +384,10 @@ static void child_process(int fd_rx2main, int fd_main2tx, int fd_tx2main)
 						  ftdi_get_error_string(&ftdic));
 					goto retry;
 				}
-				if (ftdi_write_data(&ftdic, buf, ret) < 0)
+				if (stream_pulses(&ftdic, pulses, req.n_pulses,
+						  tx_baud_rate * tx_baud_mult,
+						  req.f_carrier,
+						  req.duty_cycle) < 0)
 					log_error("enable to write ftdi buffer (%s)",
 						  ftdi_get_error_string(&ftdic));
 				if (ftdi_usb_purge_tx_buffer(&ftdic) < 0)
@@ -277,7 +418,7 @@ static void child_process(int fd_rx2main, int fd_main2tx, int fd_tx2main)
 			/* receive IR */
 			ret = ftdi_read_data(&ftdic, buf, RXBUFSZ);
 			if (ret > 0) {
-				parsesamples(buf, ret, fd_rx2main);
+				parsesamples(buf, ret);
 			} else if (ret < 0) {
 				log_error("ftdi: error reading data from device: %s",
 					  ftdi_get_error_string(&ftdic));
@@ -322,7 +463,6 @@ static int drvctl_func(unsigned int cmd, void* arg)
 static int hwftdi_init(void)
 {
 	int flags;
-	int pipe_rx2main[2] = { -1, -1 };
 	unsigned char buf[1];
 
 	char* p;
@@ -394,9 +534,10 @@ next:
 
 	rec_buffer_init();
 
-	/* Allocate a pipe for lircd to read from */
-	if (pipe(pipe_rx2main) == -1) {
-		log_error("unable to create pipe_rx2main");
+	/* Allocate a ring for lircd to read from */
+	rx_ring = sample_ring_new(RX_RING_SIZE);
+	if (rx_ring == NULL) {
+		log_error("unable to create rx_ring");
 		goto fail_start;
 	}
 	if (pipe(pipe_main2tx) == -1) {
@@ -408,15 +549,7 @@ next:
 		goto fail_tx2main;
 	}
 
-	drv.fd = pipe_rx2main[0];
-
-	flags = fcntl(drv.fd, F_GETFL);
-
-	/* make the read end of the pipe non-blocking: */
-	if (fcntl(drv.fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-		log_error("unable to make pipe read end non-blocking");
-		goto fail;
-	}
+	drv.fd = sample_ring_fd(rx_ring);
 
 	/* Make the read end of the send pipe non-blocking */
 	flags = fcntl(pipe_main2tx[0], F_GETFL);
@@ -432,14 +565,12 @@ next:
 		goto fail;
 	} else if (child_pid == 0) {
 		/* we're the child: */
-		close(pipe_rx2main[0]);
 		close(pipe_main2tx[1]);
 		close(pipe_tx2main[0]);
-		child_process(pipe_rx2main[1], pipe_main2tx[0], pipe_tx2main[1]);
+		child_process(pipe_main2tx[0], pipe_tx2main[1]);
 	}
 
 	/* we're the parent: */
-	close(pipe_rx2main[1]);
 	close(pipe_main2tx[0]);
 	pipe_main2tx[0] = -1;
 	close(pipe_tx2main[1]);
@@ -465,8 +596,8 @@ fail_tx2main:
 	pipe_main2tx[1] = -1;
 
 fail_main2tx:
-	close(pipe_rx2main[0]);
-	close(pipe_rx2main[1]);
+	sample_ring_free(rx_ring);
+	rx_ring = NULL;
 
 fail_start:
 	if (device_config != NULL) {
@@ -488,7 +619,8 @@ static int hwftdi_close(void)
 		child_pid = -1;
 	}
 
-	close(drv.fd);
+	sample_ring_free(rx_ring);
+	rx_ring = NULL;
 	drv.fd = -1;
 
 	close(pipe_main2tx[1]);
@@ -511,118 +643,129 @@ static char* hwftdi_rec(struct ir_remote* remotes)
 
 static lirc_t hwftdi_readdata(lirc_t timeout)
 {
-	int n;
-	lirc_t res = 0;
-
-	if (!waitfordata((long)timeout))
-		return 0;
-
-	n = read(drv.fd, &res, sizeof(res));
-	if (n != sizeof(res))
-		res = 0;
-
-	return res;
+	return sample_ring_readdata(rx_ring, timeout);
 }
 
-static ssize_t write_pulse(unsigned char* buf, size_t size,
-	struct ir_remote* remote, struct ir_ncode* code)
+static void modulator_init(struct modulator* m,
+	const lirc_t* pulses, int n_pulses, uint32_t f_sample,
+	uint32_t f_carrier, unsigned int duty_cycle)
 {
-	uint32_t f_sample = tx_baud_rate * tx_baud_mult;
-	uint32_t f_carrier = remote->freq == 0 ? DEFAULT_FREQ : remote->freq;
-	const lirc_t* pulseptr;
-	int n_pulses;
-
-	log_debug("hwftdi_send() carrier=%dHz f_sample=%dHz ", f_carrier, f_sample);
-
-	/* initialize decoded buffer: */
-	if (!send_buffer_put(remote, code))
-		return -1;
+	memset(m, 0, sizeof(*m));
+	m->pulses = pulses;
+	m->n_pulses = n_pulses;
+	m->f_sample = f_sample;
+	m->f_carrier = f_carrier;
 
-	/* init vars: */
-	n_pulses = send_buffer_length();
-	pulseptr = send_buffer_data();
-
-	return modulate_pulses(buf, size, pulseptr, n_pulses, f_sample, f_carrier,
-	    get_duty_cycle(remote));
+	/* Calculate the carrier on time (in # samples) */
+	m->duty = f_sample * duty_cycle / 100;  /* duty_cycle is 1-100 */
+	if (m->duty <= 1)
+		m->duty = 1;
+	else if (m->duty >= f_sample)
+		m->duty = f_sample - 1;
 }
 
-static int modulate_pulses(unsigned char* buf, size_t size,
-	const int* pulseptr, int n_pulses, uint32_t f_sample, uint32_t f_carrier,
-	unsigned int duty_cycle)
+/* Generate the next samples in buf, returns the number of samples
+ * stored, 0 when the code is complete. */
+static size_t modulator_fill(struct modulator* m,
+			     unsigned char* buf, size_t size)
 {
-	uint32_t div_carrier;
-	uint32_t duty;
-	lirc_t pulse;
-	int pulsewidth;
-	int val_carrier;
-	int bufidx;
-	int sendpulse;
-
-	bufidx = 0;
-	div_carrier = 0;
-	val_carrier = 0;
-	sendpulse = 0;
-
-	/* Calculate the carrier on time (in # samples) */
-	duty = f_sample * duty_cycle / 100;  /* duty_cycle is 1-100 */
-	if (duty <= 1)
-		duty = 1;
-	else if (duty >= f_sample)
-		duty = f_sample - 1;
-
-	while (n_pulses--) {
-		/* take pulse from buffer */
-		pulse = *pulseptr++;
-
-		/* compute the pulsewidth (in # samples) */
-		pulsewidth =
-		    ((uint64_t)f_sample) * ((uint32_t)(pulse & PULSE_MASK))
-			/ 1000000ul;
-
-		/* toggle pulse / space */
-		sendpulse = sendpulse ? 0 : 1;
-
-		while (pulsewidth--) {
-			/* carrier generator (generates a carrier
-			 * continously, will be modulated by the
-			 * requested signal): */
-			div_carrier += f_carrier;
-			if (div_carrier >= f_sample) {
-				div_carrier -= f_sample;
-			}
-			val_carrier = div_carrier < duty ? 255 : 0;
-
-			/* send carrier or send space ? */
-			if (sendpulse)
-				buf[bufidx++] = val_carrier;
-			else
-				buf[bufidx++] = 0;
-
-			/* flush txbuffer? */
-			/* note: be sure to have room for last '0' */
-			if (bufidx >= (size - 1)) {
-				log_error("buffer overflow while generating IR pattern");
-				return -1;
+	size_t n = 0;
+
+	while (n < size) {
+		if (m->pulsewidth == 0) {
+			if (m->n_pulses == 0) {
+				/* always end with 0 to turn off transmitter: */
+				if (!m->done)
+					buf[n++] = 0;
+				m->done = 1;
+				break;
 			}
+			/* compute the pulsewidth (in # samples) */
+			m->pulsewidth = ((uint64_t)m->f_sample)
+				* ((uint32_t)(*m->pulses++ & PULSE_MASK))
+				/ 1000000ul;
+			m->n_pulses--;
+
+			/* toggle pulse / space */
+			m->sendpulse = m->sendpulse ? 0 : 1;
+			continue;
 		}
+		m->pulsewidth--;
+
+		/* carrier generator (generates a carrier continously,
+		 * will be modulated by the requested signal): */
+		m->div_carrier += m->f_carrier;
+		if (m->div_carrier >= m->f_sample)
+			m->div_carrier -= m->f_sample;
+
+		/* send carrier or send space ? */
+		if (m->sendpulse && m->div_carrier < m->duty)
+			buf[n++] = 255;
+		else
+			buf[n++] = 0;
 	}
+	return n;
+}
 
-	/* always end with 0 to turn off transmitter: */
-	buf[bufidx++] = 0;
-	return bufidx;
+/* Modulate the pulses and write them to the device, generating each
+ * chunk while the previous one is being sent. Returns 0 on success,
+ * -1 on errors. */
+static int stream_pulses(struct ftdi_context* ctx,
+	const lirc_t* pulses, int n_pulses, uint32_t f_sample,
+	uint32_t f_carrier, unsigned int duty_cycle)
+{
+	unsigned char buf[2][TX_CHUNK];
+	struct ftdi_transfer_control* tc[2] = { NULL, NULL };
+	struct modulator mod;
+	size_t len;
+	int result = 0;
+	int i;
+
+	modulator_init(&mod, pulses, n_pulses, f_sample, f_carrier,
+		       duty_cycle);
+	for (i = 0; ; i = !i) {
+		/* buf[i] can be reused once its last write is done */
+		if (tc[i] != NULL && ftdi_transfer_data_done(tc[i]) < 0)
+			result = -1;
+		tc[i] = NULL;
+		if (result < 0)
+			break;
+		len = modulator_fill(&mod, buf[i], TX_CHUNK);
+		if (len == 0)
+			break;
+		tc[i] = ftdi_write_data_submit(ctx, buf[i], len);
+		if (tc[i] == NULL) {
+			result = -1;
+			break;
+		}
+	}
+	if (tc[!i] != NULL && ftdi_transfer_data_done(tc[!i]) < 0)
+		result = -1;
+	return result;
 }
 
 static int hwftdi_send(struct ir_remote* remote, struct ir_ncode* code)
 {
-	unsigned char buf[TXBUFSZ];
-	ssize_t pulse_len;
+	struct tx_request req;
+	unsigned char buf[1];
 
-	pulse_len = write_pulse(buf, sizeof(buf), remote, code);
-	if (pulse_len == -1)
+	req.f_carrier = remote->freq == 0 ? DEFAULT_FREQ : remote->freq;
+	req.duty_cycle = get_duty_cycle(remote);
+	log_debug("hwftdi_send() carrier=%dHz f_sample=%dHz ",
+		  req.f_carrier, tx_baud_rate * tx_baud_mult);
+
+	/* initialize decoded buffer: */
+	if (!send_buffer_put(remote, code))
 		return 0;
+	req.n_pulses = send_buffer_length();
 
-	/* let the child process transmit the pattern */
-	chk_write(pipe_main2tx[1], buf, pulse_len);
+	/* let the child process modulate and transmit the pattern */
+	if (!write_full(pipe_main2tx[1], &req, sizeof(req))
+	    || !write_full(pipe_main2tx[1], send_buffer_data(),
+			   req.n_pulses * sizeof(lirc_t))) {
+		log_perror_err("hwftdi_send: cannot write to child");
+		return 0;
+	}
 
 	/* wait for child process to be ready with it */
 	chk_read(pipe_tx2main[0], buf, 1);
@@ -849,8 +992,6 @@ static void hwftdix_clear_config(struct ftdix_config* config)
 static int hwftdix_send(struct ir_remote* remote, struct ir_ncode* code)
 {
 	int success = 1;
-	unsigned char buf[TXBUFSZ];
-	ssize_t buf_len;
 	int orig_scheduler;
 	uint32_t f_carrier = remote->freq == 0 ? DEFAULT_FREQ : remote->freq;
 
@@ -873,9 +1014,6 @@ static int hwftdix_send(struct ir_remote* remote, struct ir_ncode* code)
 	n_pulses = send_buffer_length();
 	pulseptr = send_buffer_data();
 
-	buf_len = modulate_pulses(buf, sizeof(buf), pulseptr, n_pulses, f_sample,
-				  f_carrier, 50);
-
 	/* select correct transmit baudrate */
 	if (ftdi_set_baudrate(&ftdic, tx_baud) < 0) {
 		log_error("unable to set required baud rate for transmission "
@@ -888,10 +1026,11 @@ static int hwftdix_send(struct ir_remote* remote, struct ir_ncode* code)
 	   if possible: */
 	sched_enable_realtime(&orig_scheduler);
 
-	if (ftdi_write_data(&ftdic, buf, buf_len) < buf_len) {
+	if (stream_pulses(&ftdic, pulseptr, n_pulses, f_sample,
+			  f_carrier, 50) < 0) {
 		log_error("enable to write ftdi buffer (%s)",
 			  ftdi_get_error_string(&ftdic));
-		return 1;
+		success = 0;
 	}
 
 	sched_restore(&orig_scheduler);
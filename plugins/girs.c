@@ -46,6 +46,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <termios.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <lirc/lirc_config.h>
@@ -53,6 +54,7 @@
 #include "lirc_driver.h"
 #include "lirc/serial.h"
 #include "lirc/curl_poll.h"
+#include "lirc/serial_xact.h"
 
 
 #define DRIVER_NAME "girs"
@@ -124,10 +126,18 @@ typedef struct {
 	int transmitters;// Implements the transmitter modle
 	int parameters; // Implements the parameters module
 	unsigned int ending_timeout; // the last timeout value sent to the hardware
-	int initialized;
+	int initialized; // The initial silly gap is delivered
 	unsigned int transmitter_mask;
 	char version[LONG_LINE_SIZE]; // Use to indicate valid device
 	char driver_version[LONG_LINE_SIZE];
+	struct serial_xact* xact; // Commands and replies, owns the input
+	int got_line; // line holds a line which is not a reply
+	char line[LONG_LINE_SIZE];
+	int answer_status; // 1: answer holds reply, 0: error, -1: timeout
+	char answer[LONG_LINE_SIZE];
+	lirc_t data[MAXDATA]; // Received durations, not yet delivered
+	unsigned int data_ptr;
+	unsigned int data_length;
 } girs_t;
 
 static girs_t dev = {
@@ -144,7 +154,11 @@ static girs_t dev = {
 	.initialized = 0,
 	.transmitter_mask = 0,
 	.version = "",
-	.driver_version = ""
+	.driver_version = "",
+	.xact = NULL,
+	.got_line = 0,
+	.data_ptr = 0,
+	.data_length = 0
 };
 
 static int init(void);
@@ -217,10 +231,16 @@ static int min(int x, int y)
 static int girs_close(void)
 {
 	log_debug(DRIVER_NAME ": girs_close called");
+	serial_xact_free(dev.xact);
+	dev.xact = NULL;
 	if (dev.fd >= 0)
 		close(dev.fd);
 
 	dev.fd = -1;
+	dev.read_pending = 0;
+	dev.send_pending = 0;
+	dev.data_ptr = 0;
+	dev.data_length = 0;
 	dev.version[0] = '\0';
 	if (dev.connection == serial)
 		tty_delete_lock();
@@ -317,162 +337,248 @@ static int drvctl(unsigned int cmd, void* arg)
 }
 
 /**
- *
- * @param buf
- * @param count
- * @param timeout in milliseconds; 0 means infinite timeout.
- * @return number or characters read, or -1 if error
+ * Return length of the line at the start of data, including the line
+ * ending, or 0 if there is no complete line.
  */
-static ssize_t read_with_timeout(char* buf, size_t count, int timeout)
+static size_t next_line(const char* data, size_t size)
 {
-	ssize_t rc;
-	size_t numread = 0;
-	struct pollfd pfd = {.fd = dev.fd, .events = POLLIN, .revents = 0};
-
-	rc = curl_poll(&pfd, 1, timeout ? timeout : -1);
-	if (rc == 0)
-		return -1;
-	rc = read(dev.fd, buf, count);
-
-	if (rc > 0)
-		numread += rc;
+	const char* eol = memchr(data, '\n', size);
+#ifndef CRLF_FROM_DEVICE
+	const char* cr = memchr(data, '\r', eol ? eol - data : size);
 
-	while ((rc == -1 && errno == EAGAIN) || (rc >= 0 && numread < count)) {
+	if (cr != NULL)
+		eol = cr;
+#endif
+	return eol == NULL ? 0 : eol - data + 1;
+}
 
-		rc = curl_poll(&pfd, 1, timeout ? timeout : -1);
+/**
+ * Copy a line without line ending and carriage returns to buf, dropping
+ * what does not fit.
+ * @return Number of characters in the line.
+ */
+static unsigned int copy_line(char* buf, size_t size,
+			      const char* from, size_t count)
+{
+	unsigned int noread = 0;
+	size_t i;
 
-		if (rc == 0)
-			/* timeout */
-			break;
-		else if (rc == -1)
-			/* continue for EAGAIN case */
+	for (i = 0; i + 1 < count; i++) {
+#ifdef CRLF_FROM_DEVICE
+		if (from[i] == '\r')
 			continue;
+#endif
+		if (noread < size - 1) {
+			buf[noread] = from[i];
+		} else if (noread == size - 1) {
+			buf[noread] = '\0';
+			log_warn(DRIVER_NAME
+				": readline buffer full: \"%s\"",
+				buf);
+		}
+		noread++;
+	}
+	buf[min(noread, size - 1)] = '\0';
+	return noread;
+}
 
-		rc = read(dev.fd, ((char*)buf) + numread, count - numread);
+/**
+ * serial_xact_match for the first non-empty line, as the reply to most
+ * commands.
+ */
+static int match_line(const char* data, size_t size, void* arg)
+{
+	size_t skipped = 0;
+
+	while (1) {
+		size_t length = next_line(data + skipped, size - skipped);
+		size_t i;
 
-		if (rc > 0)
-			numread += rc;
+		if (length == 0)
+			return 0;
+		for (i = 0; i + 1 < length; i++)
+			if (data[skipped + i] != '\r')
+				return skipped + length;
+		skipped += length;
 	}
-	return (numread == 0) ? -1 : (ssize_t) numread;
 }
 
-static int readline(char* buf, size_t size, int timeout)
+/** Store the reply of a command for sendcommand_answer(). */
+static void answer_done(enum serial_xact_status status,
+			const char* reply, size_t size, void* arg)
 {
-	ssize_t rc = 0;
+	if (status != SERIAL_XACT_OK) {
+		dev.answer[0] = '\0';
+		dev.answer_status = status == SERIAL_XACT_TIMEOUT ? -1 : 0;
+		return;
+	}
+	copy_line(dev.answer, sizeof(dev.answer), reply, size);
+	dev.answer_status = 1;
+	log_trace(DRIVER_NAME ": readline returned \"%s\"", dev.answer);
+}
 
-	buf[0] = '\0';
-	unsigned int noread = 0;
+/**
+ * Parse a received line like "+889 -889 +1778 ..." into data in one pass,
+ * clamping the durations and marking every other one as a pulse.
+ * @return Number of durations, -1 on parse errors.
+ */
+static int parse_durations(const char* buf, lirc_t* data, int max)
+{
+	const char* p = buf;
+	int i = 0;
 
 	while (1) {
-		char c;
-
-		rc = read_with_timeout(&c, 1, timeout);
-		if (rc == -1) {
-			// timeout
-			if (noread) {
-				if (timeout == 0)
-					continue;
-				else {
-					log_warn(DRIVER_NAME
-						": timeout with partially read string \"%s\", discarded",
-						 buf);
-					buf[0] = '\0';
-					break;
-				}
-			} else {
-				log_debug(DRIVER_NAME ": timeout in readline");
-				break;
-			}
+		while (*p == ' ' || *p == '+' || *p == '-')
+			p++;
+		if (*p == '\0')
+			return i;
+		if (*p < '0' || *p > '9') {
+			log_error(DRIVER_NAME
+				": Could not parse %s as unsigned", p);
+			return -1;
 		}
+		if (i >= max) {
+			log_warn(DRIVER_NAME
+				": Signal had more than %d entries, ignoring the excess",
+				MAXDATA);
+			return i;
+		}
+		unsigned long x = 0;
 
-		if (rc == 1 && ((c == '\n')
-#ifndef CRLF_FROM_DEVICE
-			|| (c == '\r')
-#endif
-			)) {
-			if (noread == 0)
-				continue;
-			else {
-				buf[min(noread, size - 1)] = '\0';
-				log_trace(DRIVER_NAME
-					": readline returned \"%s\"",
-					buf);
-				break;
-			}
+		while (*p >= '0' && *p <= '9') {
+			// Fix if too large (> 16.7 seconds)
+			if (x <= LIRC_VALUE_MASK)
+				x = x * 10 + (*p - '0');
+			p++;
 		}
-#ifdef CRLF_FROM_DEVICE
-		if (c == '\r') {
-			continue;
+		if (*p != '\0' && *p != ' ' && *p != '+' && *p != '-') {
+			log_error(DRIVER_NAME
+				": Could not parse %s as unsigned", p);
+			return -1;
 		}
-#endif
-		if (rc == 1) {
-			if (noread < size - 1) {
-				buf[noread] = c;
-			} else if (noread == size - 1) {
-				buf[noread] = '\0';
-				log_warn(DRIVER_NAME
-					": readline buffer full: \"%s\"",
-					buf);
-				// but we keep on looking for an end-of-line
-			} else {
-			}
+		if (x > LIRC_VALUE_MASK)
+			x = LIRC_VALUE_MASK;
+		// Mark as PULSE if appropriate (otherwise it is SPACE)
+		data[i] = (i & 1) == 0 ? (lirc_t)x | PULSE_BIT : (lirc_t)x;
+		i++;
+	}
+}
+
+static int enable_receive(void);
+
+/**
+ * serial_xact_input: lines which are no replies. While receiving, that's
+ * a signal or a timeout, else it's kept for wait_line().
+ */
+static size_t girs_input(const char* data, size_t size, void* arg)
+{
+	size_t length = next_line(data, size);
+	char buf[SERIAL_XACT_BUFSIZE];
+
+	if (length == 0)
+		return 0;
+	if (copy_line(buf, sizeof(buf), data, length) == 0)
+		return length;
+	if (!dev.read_pending) {
+		log_trace(DRIVER_NAME ": got line \"%s\"", buf);
+		copy_line(dev.line, sizeof(dev.line), data, length);
+		dev.got_line = 1;
+		return length;
+	}
+	dev.read_pending = 0;
+	if (strncmp(buf, TIMEOUT_RESPONSE, strlen(TIMEOUT_RESPONSE)) == 0) {
+		log_debug(DRIVER_NAME ": readdata timeout from hardware, continuing");
+		dev.initialized = 0;
+	} else {
+		if (dev.data_ptr == dev.data_length) {
+			dev.data_ptr = 0;
+			dev.data_length = 0;
+		}
+		int n = parse_durations(buf, dev.data + dev.data_length,
+					MAXDATA - dev.data_length);
+
+		if (n > 0)
+			dev.data_length += n;
+	}
+	// Keep going...
+	if (serial_xact_pending(dev.xact) == 0)
+		enable_receive();
+	return length;
+}
 
-			noread++;
+/**
+ * Wait for a line which is not a reply, like the greeting.
+ * @param timeout in milliseconds.
+ */
+static int wait_line(char* buf, size_t size, int timeout)
+{
+	dev.got_line = 0;
+	buf[0] = '\0';
+	while (!dev.got_line) {
+		if (serial_xact_poll(dev.xact, timeout) <= 0) {
+			log_debug(DRIVER_NAME ": timeout in readline");
+			return 0;
 		}
 	}
-	return rc > 0;
+	snprintf(buf, size, "%s", dev.line);
+	return 1;
 }
 
 static void readflush(void)
 {
-	char c;
-
 	log_trace(DRIVER_NAME ": flushing the input");
-	while (read_with_timeout(&c, 1, TIMEOUT_FLUSH) == 1)
-		log_trace1(DRIVER_NAME ": flushing \"%c\"", c);
+	serial_xact_flush(dev.xact);
+	dev.got_line = 0;
+	dev.data_ptr = 0;
+	dev.data_length = 0;
 }
 
-static int sendcommand(const char *command)
+static int sendcommand(const char *command, int timeout,
+		       serial_xact_match match, serial_xact_done done)
 {
-	if (command[0] != '\0') {
-		ssize_t nbytes = write(dev.fd, command, strlen(command)); // FIXME
+	int success = serial_xact_submit(dev.xact, command, strlen(command),
+					 timeout, match, done, NULL);
 
-		if (nbytes != (ssize_t) strlen(command)) {
-			log_error(DRIVER_NAME
-				": could not write command \"%s\"",
-				command);
-			return 0;
-		}
-		log_trace1(DRIVER_NAME ": written command \"%s\"", command);
+	if (!success) {
+		log_error(DRIVER_NAME
+			": could not write command \"%s\"",
+			command);
+		return 0;
 	}
+	log_trace1(DRIVER_NAME ": queued command \"%s\"", command);
 	return 1;
 }
 
-static int sendcommandln(const char *command)
+static int sendcommandln(const char *command, int timeout,
+			 serial_xact_match match, serial_xact_done done)
 {
 	char buf[strlen(command) + strlen(EOL) + 1];
 
 	strncpy(buf, command, strlen(command)+1);
 	strncat(buf, EOL, strlen(EOL));
-	int success = sendcommand(buf);
-
-	if (!success)
-		return 0;
-
-	if (dev.connection == serial)
-		tcdrain(dev.fd);
-	return 1;
+	return sendcommand(buf, timeout, match, done);
 }
 
+/** Send command, wait for the reply. Blocks; not used while receiving. */
 static int sendcommand_answer(const char *command, char *buf, int len)
 {
-	int status = sendcommandln(command);
+	dev.answer_status = 0;
+	int status = sendcommandln(command, TIMEOUT_COMMAND,
+				   match_line, answer_done);
 
 	if (!status) {
 		buf[0] = '\0';
 		return 0;
 	}
-	return readline(buf, len, TIMEOUT_COMMAND);
+	// The transaction times out by itself, wait a bit longer.
+	serial_xact_wait(dev.xact, 2 * TIMEOUT_COMMAND);
+	if (dev.answer_status != 1) {
+		log_debug(DRIVER_NAME ": timeout in readline");
+		buf[0] = '\0';
+		return 0;
+	}
+	snprintf(buf, len, "%s", dev.answer);
+	return 1;
 }
 
 /**
@@ -523,17 +629,23 @@ static int syncronize(void)
 	return 0;
 }
 
+static void receive_started(enum serial_xact_status status,
+			    const char* reply, size_t size, void* arg)
+{
+	if (status == SERIAL_XACT_OK)
+		dev.read_pending = 1;
+	else
+		log_error(DRIVER_NAME ": sending " RECEIVE_COMMAND " failed");
+}
+
+/** Queue the receive command, the signal is then handled by girs_input(). */
 static int enable_receive(void)
 {
-	//synchronize();
-	int success = sendcommandln(RECEIVE_COMMAND);
+	int success = sendcommandln(RECEIVE_COMMAND, 0, NULL,
+				    receive_started);
 
-	if (success) {
-		readflush();
-		dev.read_pending = 1;
-	} else {
+	if (!success)
 		log_error(DRIVER_NAME ": sending " RECEIVE_COMMAND " failed");
-	}
 	return success;
 }
 
@@ -546,23 +658,46 @@ static void drop_dtr(void)
 	tty_setdtr(drv.fd, 1);
 }
 
+/**
+ * Handle events until there are durations to deliver.
+ * @param timeout in microseconds; 0 means infinite timeout.
+ */
+static int wait_for_data(lirc_t timeout)
+{
+	struct timespec start;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (dev.data_ptr == dev.data_length) {
+		int left = -1;
+
+		if (timeout > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long elapsed = (now.tv_sec - start.tv_sec) * 1000000
+				+ (now.tv_nsec - start.tv_nsec) / 1000;
+
+			if (elapsed >= timeout)
+				return 0;
+			left = (timeout - elapsed + 999) / 1000;
+		}
+		if (serial_xact_poll(dev.xact, left) < 0)
+			return 0;
+	}
+	return 1;
+}
+
 // Public function through hw_girs
 static lirc_t readdata(lirc_t timeout)
 {
-	static unsigned int data[MAXDATA];
-	static unsigned int data_ptr = 0;
-	static unsigned int data_length = 0;
-	static int initialized = 0;
-
 	if (!dev.receive) {
 		log_error(DRIVER_NAME ": internal error");
 		return 0;
 	}
 
 	log_trace2(DRIVER_NAME ": readdata, timeout = %d", timeout);
-	if (data_length == data_ptr/* && timeout > 0*/) {
+	if (dev.data_length == dev.data_ptr/* && timeout > 0*/) {
 		// Nothing to deliver, try to read some new data
-		if (!dev.read_pending) {
+		if (!dev.read_pending && serial_xact_pending(dev.xact) == 0) {
 			int success = enable_receive();
 
 			if (!success) {
@@ -571,88 +706,28 @@ static lirc_t readdata(lirc_t timeout)
 			}
 
 		}
-		char buf[LONG_LINE_SIZE];
-
-		while (1) {
-			int success = readline(buf, LONG_LINE_SIZE, timeout);
-
-			if (!success) {
-				log_debug(DRIVER_NAME ": readdata 0 (timeout)");
-				// no need to restart receive
-				return 0;
-			}
-			dev.read_pending = 0;
-			if (strncmp(buf, TIMEOUT_RESPONSE,
-				strlen(TIMEOUT_RESPONSE)) != 0)
-				// Got something that is not timeout; go on
-				break;
-
-			log_debug(DRIVER_NAME ": readdata timeout from hardware, continuing");
-			enable_receive();
-			initialized = 0;
-			// Keep going...
-		}
-		int i = 0;
-		const char* token;
-
-		for (token = strtok(buf, " +-");
-			token != NULL;
-			token = strtok(NULL, " +-")) {
-			if (i < MAXDATA) {
-				errno = 0;
-				unsigned int x;
-				int status = sscanf(token, "%u", &x);
-
-				if (status != 1 || errno) {
-					log_error(DRIVER_NAME
-						": Could not parse %s as unsigned",
-						  token);
-					enable_receive();
-					return 0;
-				}
-				data[i] = x;
-				i++;
-			} else {
-				log_warn(DRIVER_NAME
-					": Signal had more than %d entries, ignoring the excess",
-					MAXDATA);
-				break;
-			}
+		if (!wait_for_data(timeout)) {
+			log_debug(DRIVER_NAME ": readdata 0 (timeout)");
+			// no need to restart receive
+			return 0;
 		}
-		data_ptr = 0;
-		data_length = i;
-
-		enable_receive();
 	}
 
-	unsigned int x;
+	lirc_t x;
 
-	if (!initialized) {
+	if (!dev.initialized) {
 		// The Lirc decoder expects every signal to start with a
 		// gap to be thrown away!!!
 		log_debug(DRIVER_NAME ": initial silly gap");
-		initialized = 1;
+		dev.initialized = 1;
 		x = SILLY_INITIAL_GAP;
 	} else {
-		if (data_ptr >= MAXDATA)
-			return 0;
-
-		x = data[data_ptr];
-
-		// Fix if too large (> 16.7 seconds)
-		if (x > LIRC_VALUE_MASK)
-			x = LIRC_VALUE_MASK;
-
-		// Mark as PULSE if appropriate (otherwise it is SPACE)
-		if ((data_ptr & 1) == 0)
-			x |= PULSE_BIT;
-
-		data_ptr++;
+		x = dev.data[dev.data_ptr++];
 	}
 
 	log_trace(DRIVER_NAME ": readdata %d %d", (x & LIRC_MODE2_MASK) >> 24,
 		x & PULSE_MASK);
-	return (lirc_t) x;
+	return x;
 }
 
 static void decode_modules(char* buf)
@@ -821,10 +896,15 @@ static int initialize(void)
 		return success;
 
 	dev.fd = drv.fd;
+	dev.xact = serial_xact_new(dev.fd, girs_input, NULL);
+	if (dev.xact == NULL) {
+		girs_close();
+		return 0;
+	}
 	char buf[LONG_LINE_SIZE];
 
 	//if (dev.connection == serial) // quirk in Arduino ethernet library
-	success = readline(buf, LONG_LINE_SIZE,
+	success = wait_line(buf, LONG_LINE_SIZE,
 		dev.connection == serial ? TIMEOUT_INITIAL_SERIAL
 		: TIMEOUT_INITIAL_TCP);
 
@@ -840,9 +920,8 @@ static int initialize(void)
 		success = sendcommand_answer("version", dev.version,
 			LONG_LINE_SIZE);
 		if (success) {
-			strncpy(dev.driver_version, hw_girs.driver_version, LONG_LINE_SIZE-1);
-			strncat(dev.driver_version, "/", 1);
-			strncat(dev.driver_version, dev.version, strlen(dev.version));
+			snprintf(dev.driver_version, LONG_LINE_SIZE, "%.20s/%.900s",
+				 hw_girs.driver_version, dev.version);
 		} else {
 			log_error(DRIVER_NAME ": cannot get version");
 		}
@@ -868,6 +947,7 @@ static int initialize(void)
 		return 0;
 	}
 	log_info(DRIVER_NAME ": Found firmware version \"%s\"", dev.version);
+	drv.fd = serial_xact_fd(dev.xact);
 	return 1;
 }
 
@@ -876,7 +956,7 @@ static int init(void)
 {
 	log_trace1(DRIVER_NAME ": init");
 	if (is_valid())
-		drv.fd = dev.fd;
+		drv.fd = serial_xact_fd(dev.xact);
 	else {
 		int status = initialize();
 
@@ -931,13 +1011,32 @@ static char* receive(struct ir_remote* remotes)
 	}
 
 	log_debug(DRIVER_NAME ": receive");
+	if (!serial_xact_handle_events(dev.xact)) {
+		log_error(DRIVER_NAME ": device failed");
+		return NULL;
+	}
+	if (dev.data_ptr == dev.data_length) {
+		// Just replies or timeouts
+		if (!dev.read_pending && serial_xact_pending(dev.xact) == 0)
+			enable_receive();
+		return NULL;
+	}
 	if (!rec_buffer_clear())
 		return NULL;
 	return decode_all(remotes);
 }
 
+static void send_done(enum serial_xact_status status,
+		      const char* reply, size_t size, void* arg)
+{
+	dev.send_pending = 0;
+	if (status != SERIAL_XACT_OK)
+		log_error(DRIVER_NAME ": no answer to " TRANSMIT_COMMAND);
+}
+
 // NOTE: In the Lirc model, lircd takes care of the timing between intro and
 // repeat etc., NOT the driver. The timing is therefore critical.
+// Sending is queued, the answer is handled later from receive().
 
 // Public function through hw_girs
 // Previously called send, rename due to name clash with socket.h
@@ -956,11 +1055,6 @@ static int send_ir(struct ir_remote* remote, struct ir_ncode* code)
 
 	char buf[LONG_LINE_SIZE];
 
-	if (dev.read_pending)
-		syncronize(); // kill possible ongoing receive
-
-	dev.send_pending = 1;
-
 	int freq = remote->freq;
 
 	if (freq == 0)
@@ -976,6 +1070,10 @@ static int send_ir(struct ir_remote* remote, struct ir_ncode* code)
 		char b[SMALLSTRINGSIZE];
 
 		snprintf(b, SMALLSTRINGSIZE - 1, " %d", (unsigned int) signals[i]);
+		if (strlen(buf) + strlen(b) + sizeof(" 1") > LONG_LINE_SIZE) {
+			log_error(DRIVER_NAME ": signal too long to send");
+			return 0;
+		}
 		strncat(buf, b, SMALLSTRINGSIZE - 1);
 	}
 
@@ -983,8 +1081,13 @@ static int send_ir(struct ir_remote* remote, struct ir_ncode* code)
 	// differently. Just add a 1 microsecond space.
 	strncat(buf, " 1", 2);
 
-	sendcommandln(buf);
-	int success = readline(buf, LONG_LINE_SIZE, TIMEOUT_SEND);
+	if (dev.read_pending) {
+		// kill possible ongoing receive, any answer will do
+		dev.read_pending = 0;
+		sendcommandln("", TIMEOUT_COMMAND, match_line, NULL);
+	}
+	dev.send_pending = 1;
+	int success = sendcommandln(buf, TIMEOUT_SEND, match_line, send_done);
 	int enable_receive_success = dev.receive ? enable_receive() : 1;
 
 	return success && enable_receive_success;
@@ -20,6 +20,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/fcntl.h>
 #include <sys/ioctl.h>
 
@@ -34,6 +35,7 @@ static int hiddev_init(void);
 static int hiddev_deinit(void);
 static int hiddev_decode(struct ir_remote* remote, struct decode_ctx_t* ctx);
 static char* hiddev_rec(struct ir_remote* remotes);
+static int hiddev_rec_pending(void);
 static int sb0540_init(void);
 static char* sb0540_rec(struct ir_remote* remotes);
 static char* macmini_rec(struct ir_remote* remotes);
@@ -55,10 +57,11 @@ const struct driver hw_dvico = {
 	.close_func	= default_close,
 	.send_func	= NULL,
 	.rec_func	= hiddev_rec,
+	.rec_pending	= hiddev_rec_pending,
 	.decode_func	= hiddev_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "drvctl"
@@ -68,6 +71,15 @@ static const logchannel_t logchannel = LOG_DRIVER;
 
 static int dvico_repeat_mask = 0x8000;
 
+/*
+ * A read() of the hiddev device returns as many queued events, or
+ * usage refs in UREF mode, as fit. The events of a report are read
+ * ahead at once and handed out by read_record().
+ */
+static unsigned char readahead[64 * sizeof(struct hiddev_usage_ref)];
+static size_t readahead_len = 0;
+static size_t readahead_pos = 0;
+
 static int pre_code_length = 32;
 static int main_code_length = 32;
 
@@ -96,10 +108,11 @@ const struct driver hw_bw6130 = {
 	.deinit_func	= hiddev_deinit,
 	.send_func	= NULL,
 	.rec_func	= hiddev_rec,
+	.rec_pending	= hiddev_rec_pending,
 	.decode_func	= hiddev_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "drvctl",
@@ -118,10 +131,11 @@ const struct driver hw_asusdh = {
 	.close_func	= default_close,
 	.send_func	= NULL,
 	.rec_func	= hiddev_rec,
+	.rec_pending	= hiddev_rec_pending,
 	.decode_func	= hiddev_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "drvctl",
@@ -142,10 +156,11 @@ const struct driver hw_sb0540 = {
 	.close_func	= default_close,
 	.send_func	= NULL,
 	.rec_func	= sb0540_rec,
+	.rec_pending	= hiddev_rec_pending,
 	.decode_func	= hiddev_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "drvctl",
@@ -166,10 +181,11 @@ const struct driver hw_macmini = {
 	.close_func	= default_close,
 	.send_func	= NULL,
 	.rec_func	= macmini_rec,
+	.rec_pending	= hiddev_rec_pending,
 	.decode_func	= hiddev_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "drvctl",
@@ -190,10 +206,11 @@ const struct driver hw_samsung = {
 	.close_func	= default_close,
 	.send_func	= NULL,
 	.rec_func	= samsung_rec,
+	.rec_pending	= hiddev_rec_pending,
 	.decode_func	= hiddev_decode,
 	.drvctl_func	= NULL,
 	.drvctl_func	= drvctl_func,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "drvctl",
@@ -245,10 +262,46 @@ int hiddev_init(void)
 		log_error("unable to open '%s'", drv.device);
 		return 0;
 	}
+	readahead_len = 0;
+	readahead_pos = 0;
 
 	return 1;
 }
 
+
+/**
+ * Get the next record of size bytes, a struct hiddev_event or a struct
+ * hiddev_usage_ref, reading all queued ones if none is buffered.
+ *
+ * @param wait If non-zero, wait at most TIMEOUT for new data.
+ * @return 1 on success, 0 on timeout, -1 on read errors.
+ */
+static int read_record(void* record, size_t size, int wait)
+{
+	ssize_t rd;
+
+	if (readahead_pos + size > readahead_len) {
+		readahead_len = 0;
+		readahead_pos = 0;
+		if (wait && !waitfordata(TIMEOUT))
+			return 0;
+		rd = read(drv.fd, readahead,
+			  sizeof(readahead) - sizeof(readahead) % size);
+		if (rd < (ssize_t)size)
+			return -1;
+		readahead_len = rd - rd % size;
+	}
+	memcpy(record, readahead + readahead_pos, size);
+	readahead_pos += size;
+	return 1;
+}
+
+
+int hiddev_rec_pending(void)
+{
+	return readahead_pos < readahead_len;
+}
+
 static int drvctl_func(unsigned int cmd, void* arg)
 {
 	switch (cmd) {
@@ -317,8 +370,7 @@ char* hiddev_rec(struct ir_remote* remotes)
 
 	last = end;
 	gettimeofday(&start, NULL);
-	rd = read(drv.fd, &event, sizeof(event));
-	if (rd != sizeof(event)) {
+	if (read_record(&event, sizeof(event), 0) != 1) {
 		log_error("error reading '%s'", drv.device);
 		log_perror_err(NULL);
 		hiddev_deinit();
@@ -348,12 +400,12 @@ char* hiddev_rec(struct ir_remote* remotes)
 		 */
 
 		log_trace("This is another type Dvico - sends two codes");
-		if (!waitfordata(TIMEOUT)) {
+		rd = read_record(&event, sizeof(event), 1);
+		if (rd == 0) {
 			log_error("timeout reading next event");
 			return NULL;
 		}
-		rd = read(drv.fd, &event, sizeof(event));
-		if (rd != sizeof(event)) {
+		if (rd != 1) {
 			log_error("error reading '%s'", drv.device);
 			return 0;
 		}
@@ -411,12 +463,12 @@ char* hiddev_rec(struct ir_remote* remotes)
 		log_trace("This is an asus P5 DH remote, we read the other events");
 		asus_events[0] = event;
 		for (i = 1; i < 8; i++) {
-			if (!waitfordata(TIMEOUT)) {
+			rd = read_record(&asus_events[i], sizeof(event), 1);
+			if (rd == 0) {
 				log_error("timeout reading byte %d", i);
 				return NULL;
 			}
-			rd = read(drv.fd, &asus_events[i], sizeof(event));
-			if (rd != sizeof(event)) {
+			if (rd != 1) {
 				log_error("error reading '%s'", drv.device);
 				return 0;
 			}
@@ -490,6 +542,23 @@ char* hiddev_rec(struct ir_remote* remotes)
  */
 
 #ifdef HAVE_LINUX_HIDDEV_FLAG_UREF
+/*
+ * Get the next usage ref, skipping the per-usage ones buffered after the
+ * report ref: a report is decoded once, using the ioctls below.
+ *
+ * @return 1 if uref is a report ref, 0 if not, -1 on read errors.
+ */
+static int read_usage_report(struct hiddev_usage_ref* uref)
+{
+	do {
+		if (read_record(uref, sizeof(*uref), 0) != 1)
+			return -1;
+	} while (uref->field_index != HID_FIELD_INDEX_NONE
+		 && hiddev_rec_pending());
+	return uref->field_index == HID_FIELD_INDEX_NONE;
+}
+
+
 int sb0540_init(void)
 {
 	int rv = hiddev_init();
@@ -514,7 +583,6 @@ char* sb0540_rec(struct ir_remote* remotes)
 	 */
 
 	ir_code code;
-	ssize_t rd;
 	struct hiddev_usage_ref uref;
 
 	log_trace("sb0540_rec");
@@ -527,8 +595,7 @@ char* sb0540_rec(struct ir_remote* remotes)
 	last = end;
 	gettimeofday(&start, NULL);
 
-	rd = read(drv.fd, &uref, sizeof(uref));
-	if (rd < 0) {
+	if (read_usage_report(&uref) == -1) {
 		log_error("error reading '%s'", drv.device);
 		log_perror_err(NULL);
 		hiddev_deinit();
@@ -552,9 +619,7 @@ char* sb0540_rec(struct ir_remote* remotes)
 		 * and checking which ones are changing ;) */
 		uref.usage_index = 3;   /* which usage entry of field */
 
-		/* fetch the usage code for given indexes */
-		ioctl(drv.fd, HIDIOCGUCODE, &uref, sizeof(uref));
-		/* fetch the value from report */
+		/* fetch the value from report, the usage code is unused */
 		ioctl(drv.fd, HIDIOCGUSAGE, &uref, sizeof(uref));
 		/* now we have the key */
 
@@ -592,12 +657,12 @@ char* macmini_rec(struct ir_remote* remotes)
 	last = end;
 	gettimeofday(&start, NULL);
 	for (i = 0; i < 4; i++) {
-		if (i > 0 && !waitfordata(TIMEOUT)) {
+		rd = read_record(&ev[i], sizeof(ev[i]), i > 0);
+		if (rd == 0) {
 			log_error("timeout reading byte %d", i);
 			return NULL;
 		}
-		rd = read(drv.fd, &ev[i], sizeof(ev[i]));
-		if (rd != sizeof(ev[i])) {
+		if (rd != 1) {
 			log_error("error reading '%s'", drv.device);
 			hiddev_deinit();
 			return 0;
@@ -636,10 +701,29 @@ char* macmini_rec(struct ir_remote* remotes)
  */
 
 #ifdef HAVE_LINUX_HIDDEV_FLAG_UREF
+/* Usage codes by report id, fixed by the report descriptor. */
+static __u32 samsung_usage_codes[5];
+
+/** Return the usage code of the usage in uref, cached per report id. */
+static __u32 samsung_usage_code(struct hiddev_usage_ref* uref)
+{
+	int id = uref->report_id;
+
+	if (id >= 0 && id < 5 && samsung_usage_codes[id] != 0)
+		return samsung_usage_codes[id];
+	ioctl(drv.fd, HIDIOCGUCODE, uref);
+	if (id >= 0 && id < 5)
+		samsung_usage_codes[id] = uref->usage_code;
+	return uref->usage_code;
+}
+
+
 int samsung_init(void)
 {
 	int rv = hiddev_init();
 
+	memset(samsung_usage_codes, 0, sizeof(samsung_usage_codes));
+
 	if (rv == 1) {
 		/* we want to get info on each report received from device */
 		int flags = HIDDEV_FLAG_UREF | HIDDEV_FLAG_REPORT;
@@ -659,7 +743,6 @@ char* samsung_rec(struct ir_remote* remotes)
 	 *
 	 */
 
-	ssize_t rd;
 	struct hiddev_usage_ref uref;
 
 	log_trace("samsung_rec");
@@ -671,8 +754,7 @@ char* samsung_rec(struct ir_remote* remotes)
 
 	last = end;
 	gettimeofday(&start, NULL);
-	rd = read(drv.fd, &uref, sizeof(uref));
-	if (rd < 0) {
+	if (read_usage_report(&uref) == -1) {
 		log_error("error reading '%s'", drv.device);
 		log_perror_err(NULL);
 		hiddev_deinit();
@@ -704,13 +786,12 @@ char* samsung_rec(struct ir_remote* remotes)
 			uref.usage_index = 0;
 
 			/* fetch the usage code for given indexes */
-			ioctl(drv.fd, HIDIOCGUCODE, &uref, sizeof(uref));
+			main_code = samsung_usage_code(&uref) & 0xffff0000;
 			/* fetch the value from report */
 			ioctl(drv.fd, HIDIOCGUSAGE, &uref, sizeof(uref));
 			/* now we have the key */
 
-			main_code = (uref.usage_code & 0xffff0000)
-				    | uref.value;
+			main_code |= uref.value;
 
 			log_trace2("Main code: %x\n", main_code);
 			return decode_all(remotes);
@@ -729,13 +810,12 @@ char* samsung_rec(struct ir_remote* remotes)
 			uref.usage_index = 1;           /* or 7 */
 
 			/* fetch the usage code for given indexes */
-			ioctl(drv.fd, HIDIOCGUCODE, &uref, sizeof(uref));
+			main_code = samsung_usage_code(&uref) & 0xffff0000;
 			/* fetch the value from report */
 			ioctl(drv.fd, HIDIOCGUSAGE, &uref, sizeof(uref));
 			/* now we have the key */
 
-			main_code = (uref.usage_code & 0xffff0000)
-				    | uref.value;
+			main_code |= uref.value;
 
 			log_trace2("Main code: %x\n", main_code);
 			return decode_all(remotes);
@@ -750,6 +830,7 @@ char* samsung_rec(struct ir_remote* remotes)
 			 * This is why we need to implement all of
 			 * this hiddev stuff here.
 			 */
+			struct hiddev_usage_ref_multi multi;
 			int maxbit, i;
 
 			log_trace2("Samsung usage (proprietary)\n");
@@ -763,27 +844,26 @@ char* samsung_rec(struct ir_remote* remotes)
 			 * Therefore, we use the (highest) set bit
 			 * as final key value.
 			 *
-			 * Now fetch each usage and
+			 * Now fetch all usages in one go and
 			 * combine to single value.
 			 */
+			memset(&multi, 0, sizeof(multi));
+			multi.uref = uref;
+			multi.uref.field_index = 0;
+			multi.uref.usage_index = 0;
+			multi.num_values = 6;
+			if (ioctl(drv.fd, HIDIOCGUSAGES, &multi) == -1) {
+				log_perror_err("cannot read usages");
+				return 0;
+			}
+			/* fetch usage code from first usage
+			 * (should be 0xffcc)
+			 */
+			main_code = samsung_usage_code(&multi.uref)
+				    & 0xffff0000;
 			for (i = 0, maxbit = 1; i < 6; i++, maxbit += 8) {
-				unsigned int tmpval = 0;
-
-				uref.field_index = 0;
-				uref.usage_index = i;
-
-				/* fetch the usage code for given indexes */
-				ioctl(drv.fd, HIDIOCGUCODE, &uref, sizeof(uref));
-				/* fetch the value from report */
-				ioctl(drv.fd, HIDIOCGUSAGE, &uref, sizeof(uref));
 				/* now we have the key byte */
-				tmpval = uref.value & 0xff;             /* 8 bit */
-
-				if (i == 0)
-					/* fetch usage code from first usage
-					 * (should be 0xffcc)
-					 */
-					main_code = (uref.usage_code & 0xffff0000);
+				unsigned int tmpval = multi.values[i] & 0xff;
 
 				/* find index of highest bit with binary search */
 				if (tmpval > 0) {
@@ -33,6 +33,22 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+/*
+ * Driver options:
+ *
+ * gpio_chip, gpio_line
+ *	If the receiver's interrupt output is wired to a GPIO, the line
+ *	offset on the gpiochip character device (default /dev/gpiochip0).
+ *	The I2C device is then only read after an interrupt, and while
+ *	keys are pressed.
+ * gpio_edge
+ *	Edge signalling data: falling (default), rising or both.
+ * poll_active, poll_idle
+ *	Polling intervals in ms while keys are pressed (default 10) and
+ *	when idle (default 100). Without a GPIO, the device is polled at
+ *	poll_idle until a code is read, then at poll_active for a while.
+ */
+
 #ifdef HAVE_CONFIG_H
 # include <config.h>
 #endif
@@ -50,10 +66,14 @@
 #include <dirent.h>
 #include <time.h>
 #include <signal.h>
+#include <poll.h>
 #include <linux/i2c-dev.h>
 #ifndef I2C_SLAVE               /* hack */
 #include <linux/i2c.h>
 #endif
+#ifdef HAVE_LINUX_GPIO_H
+#include <linux/gpio.h>
+#endif
 
 #include "lirc_driver.h"
 
@@ -67,12 +87,16 @@
 /* The time that a key must be held down before it repeats (in seconds). */
 #define REPEAT_TIME 0.3
 
+/* Time after the last code read during which polling is fast (in seconds). */
+#define ACTIVE_TIME 2.0
+
 static const logchannel_t logchannel = LOG_DRIVER;
 
 static int i2cuser_init(void);
 static int i2cuser_deinit(void);
 static void i2cuser_read_loop(int fd);
 static char* i2cuser_rec(struct ir_remote* remotes);
+static int i2cuser_drvctl(unsigned int cmd, void* arg);
 
 const struct driver hw_i2cuser = {
 	.name		= "i2cuser",
@@ -88,7 +112,7 @@ const struct driver hw_i2cuser = {
 	.send_func	= NULL,
 	.rec_func	= i2cuser_rec,
 	.decode_func	= receive_decode,
-	.drvctl_func	= NULL,
+	.drvctl_func	= i2cuser_drvctl,
 	.readdata	= NULL,
 	.api_version	= 3,
 	.driver_version = "0.9.3",
@@ -108,6 +132,141 @@ char device_name[256];
 /* PID of the child process. */
 static pid_t child = -1;
 
+/* Driver options, see i2cuser_drvctl(). */
+static char gpio_chip[64] = "/dev/gpiochip0";
+static int gpio_line = -1;
+static int gpio_edge = 1;       /* 1: falling, 2: rising, 3: both. */
+static int poll_active = 10;
+static int poll_idle = 100;
+/* Line event fd of the interrupt GPIO, -1 when polling. */
+static int gpio_fd = -1;
+
+
+static int i2cuser_drvctl(unsigned int cmd, void* arg)
+{
+	struct option_t* opt = (struct option_t*)arg;
+	long value;
+
+	if (cmd != DRVCTL_SET_OPTION)
+		return DRV_ERR_NOT_IMPLEMENTED;
+	value = strtol(opt->value, NULL, 10);
+	if (strcmp(opt->key, "gpio_chip") == 0) {
+		snprintf(gpio_chip, sizeof(gpio_chip), "%s", opt->value);
+	} else if (strcmp(opt->key, "gpio_line") == 0) {
+		if (value < 0)
+			return DRV_ERR_BAD_VALUE;
+		gpio_line = value;
+	} else if (strcmp(opt->key, "gpio_edge") == 0) {
+		if (strcmp(opt->value, "falling") == 0)
+			gpio_edge = 1;
+		else if (strcmp(opt->value, "rising") == 0)
+			gpio_edge = 2;
+		else if (strcmp(opt->value, "both") == 0)
+			gpio_edge = 3;
+		else
+			return DRV_ERR_BAD_VALUE;
+	} else if (strcmp(opt->key, "poll_active") == 0) {
+		if (value <= 0)
+			return DRV_ERR_BAD_VALUE;
+		poll_active = value;
+	} else if (strcmp(opt->key, "poll_idle") == 0) {
+		if (value <= 0)
+			return DRV_ERR_BAD_VALUE;
+		poll_idle = value;
+	} else {
+		log_error("i2cuser: unknown option \"%s\"", opt->key);
+		return DRV_ERR_BAD_OPTION;
+	}
+	return 0;
+}
+
+
+/* Request edge events on the interrupt line, return the event fd or -1. */
+static int open_gpio_line(void)
+{
+#if defined(GPIO_V2_GET_LINE_IOCTL) || defined(GPIO_GET_LINEEVENT_IOCTL)
+	int chip_fd;
+	int r;
+
+	chip_fd = open(gpio_chip, O_RDONLY | O_CLOEXEC);
+	if (chip_fd == -1) {
+		log_error("Cannot open %s: %s", gpio_chip, strerror(errno));
+		return -1;
+	}
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	struct gpio_v2_line_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = gpio_line;
+	req.num_lines = 1;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT
+		| (gpio_edge & 1 ? GPIO_V2_LINE_FLAG_EDGE_FALLING : 0)
+		| (gpio_edge & 2 ? GPIO_V2_LINE_FLAG_EDGE_RISING : 0);
+	strncpy(req.consumer, "lirc-i2cuser", sizeof(req.consumer) - 1);
+	r = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+#else
+	struct gpioevent_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = gpio_line;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	req.eventflags = (gpio_edge & 1 ? GPIOEVENT_REQUEST_FALLING_EDGE : 0)
+		| (gpio_edge & 2 ? GPIOEVENT_REQUEST_RISING_EDGE : 0);
+	strncpy(req.consumer_label, "lirc-i2cuser",
+		sizeof(req.consumer_label) - 1);
+	r = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+#endif
+	close(chip_fd);
+	if (r == -1) {
+		log_error("Cannot get events of %s line %d: %s",
+			  gpio_chip, gpio_line, strerror(errno));
+		return -1;
+	}
+	log_info("Using interrupts from %s line %d", gpio_chip, gpio_line);
+	return req.fd;
+#else
+	log_error("GPIO interrupts not supported in this build");
+	return -1;
+#endif
+}
+
+
+/*
+ * Wait until the I2C device should be read: for an interrupt, or the
+ * polling interval. Polling is fast for ACTIVE_TIME after a code was
+ * read, to catch repeats quickly.
+ */
+static int wait_for_data(double last_active)
+{
+	struct pollfd pfd = { gpio_fd, POLLIN, 0 };
+	struct timeval tv;
+	char events[256];
+	int timeout;
+	int active;
+
+	gettimeofday(&tv, NULL);
+	active = tv.tv_sec + 0.000001 * tv.tv_usec - last_active < ACTIVE_TIME;
+	timeout = active ? poll_active : poll_idle;
+	if (gpio_fd == -1) {
+		poll(NULL, 0, timeout);
+		return 1;
+	}
+	if (poll(&pfd, 1, active ? timeout : -1) == -1 && errno != EINTR) {
+		log_error("Error polling GPIO: %s", strerror(errno));
+		return 0;
+	}
+	if (pfd.revents & POLLIN) {
+		/* Just a wakeup, the events themselves don't matter. */
+		if (read(gpio_fd, events, sizeof(events)) == -1
+		    && errno != EAGAIN) {
+			log_error("Error reading GPIO events: %s",
+				  strerror(errno));
+			return 0;
+		}
+	}
+	return 1;
+}
+
 /* Hunt for the appropriate i2c device and open it. */
 static int open_i2c_device(void)
 {
@@ -198,6 +357,12 @@ static int i2cuser_init(void)
 		goto fail;
 	}
 
+	if (gpio_line >= 0) {
+		gpio_fd = open_gpio_line();
+		if (gpio_fd == -1)
+			log_warn("i2cuser: falling back to polling");
+	}
+
 	child = fork();
 	if (child == -1) {
 		log_error("Cannot fork child process: %s", strerror(errno));
@@ -207,6 +372,11 @@ static int i2cuser_init(void)
 		i2cuser_read_loop(pipe_fd[1]);
 	}
 	close(pipe_fd[1]);
+	if (gpio_fd != -1) {
+		/* Only used by the child. */
+		close(gpio_fd);
+		gpio_fd = -1;
+	}
 
 	log_info("i2cuser driver: i2c device found and ready to go");
 	return 1;
@@ -214,6 +384,10 @@ static int i2cuser_init(void)
 fail:
 	if (i2c_fd != -1)
 		close(i2c_fd);
+	if (gpio_fd != -1) {
+		close(gpio_fd);
+		gpio_fd = -1;
+	}
 	if (pipe_fd[0] != -1)
 		close(pipe_fd[0]);
 	if (pipe_fd[1] != -1)
@@ -240,6 +414,7 @@ static void i2cuser_read_loop(int out_fd)
 {
 	ir_code last_code = 0;
 	double last_time = 0.0;
+	double last_active = 0.0;
 
 	alarm(0);
 	signal(SIGTERM, SIG_DFL);
@@ -256,10 +431,8 @@ static void i2cuser_read_loop(int out_fd)
 		double new_time;
 
 		do {
-			/* Poll 20 times per second. */
-			struct timespec ts = { 0, 50000000 };
-
-			nanosleep(&ts, NULL);
+			if (!wait_for_data(last_active))
+				goto fail;
 			rc = read(i2c_fd, &buf, sizeof(buf));
 			if (rc < 0 && errno != EREMOTEIO) {
 				log_error("Error reading from i2c device: %s", strerror(errno));
@@ -271,6 +444,7 @@ static void i2cuser_read_loop(int out_fd)
 
 		gettimeofday(&tv, NULL);
 		new_time = tv.tv_sec + (0.000001L * tv.tv_usec);
+		last_active = new_time;
 
 		new_code = ((buf[0] & 0x7f) << 6) | (buf[1] >> 2);
 		if (new_code == last_code) {
@@ -99,7 +99,8 @@ static const logchannel_t logchannel = LOG_DRIVER;
 
 static irtoy_t* dev = NULL;
 
-static unsigned char rawSB[WBUF_SIZE * 2 + 2];
+static unsigned char* rawSB = NULL;
+static int rawSB_size = 0;
 
 /* exported functions  */
 static int init(void);
@@ -578,14 +579,24 @@ static char* receive(struct ir_remote* remotes)
 }
 
 
+/*
+ * With the handshake enabled by IRTOY_COMMAND_TXSTART, the device sends
+ * a byte with the number of bytes it can take whenever it has room for
+ * more. These grants form a window: data is written as soon as there is
+ * room for it, and handshakes are read whenever they arrive rather than
+ * waiting for one after each chunk. Once done, the device sends
+ * IRTOY_LEN_XMITRES bytes starting with IRTOY_REPLY_XMITCOUNT, a value
+ * larger than any handshake.
+ */
 static int irtoy_send_double_buffered(unsigned char* signals, int length)
 {
-	int numToXmit = length;
+	struct pollfd pfd;
+	unsigned char reply[16];
+	int written = 0;
+	int window = 0;
+	int replied = 0;
 	int numThisTime;
 	int res;
-	unsigned char irToyBufLen;
-	unsigned char* txPtr;
-	unsigned char reply[16];
 	int irtoyXmit;
 
 	res = write(dev->fd, IRTOY_COMMAND_TXSTART, sizeof(IRTOY_COMMAND_TXSTART));
@@ -595,46 +606,49 @@ static int irtoy_send_double_buffered(unsigned char* signals, int length)
 		return 0;
 	}
 
-	res = read_with_timeout(dev->fd, &irToyBufLen, 1, IRTOY_TIMEOUT_READYFORDATA);
-
-	if (res != 1) {
-		log_error("irtoy_send: couldn't read command result");
-		return -1;
-	}
-
-	log_trace("irtoy ready for %d bytes", irToyBufLen);
-
-	txPtr = signals;
-
-	while (numToXmit) {
-		numThisTime = (numToXmit < irToyBufLen) ? numToXmit : irToyBufLen;
-		res = write(dev->fd, txPtr, numThisTime);
-
-		if (res != numThisTime) {
-			log_error("irtoy_send: couldn't write command");
-			return 0;
+	while (replied < IRTOY_LEN_XMITRES) {
+		if (written < length && window > 0) {
+			numThisTime = length - written;
+			if (numThisTime > window)
+				numThisTime = window;
+			res = write(dev->fd, signals + written, numThisTime);
+			if (res == -1 && errno != EAGAIN && errno != EINTR) {
+				log_error("irtoy_send: couldn't write command");
+				return 0;
+			}
+			if (res > 0) {
+				written += res;
+				window -= res;
+			}
 		}
-
-		txPtr += numThisTime;
-		numToXmit -= numThisTime;
-
-
-		res = read_with_timeout(dev->fd, &irToyBufLen, 1, IRTOY_TIMEOUT_READYFORDATA);
-
-		if (res != 1) {
+		/* Read one handshake, or the rest of the reply. Anything
+		 * after the reply is received data. */
+		res = read(dev->fd, reply + replied,
+			   replied > 0 ? IRTOY_LEN_XMITRES - replied : 1);
+		if (res > 0) {
+			if (replied > 0 || reply[0] == IRTOY_REPLY_XMITCOUNT) {
+				replied += res;
+			} else {
+				window += reply[0];
+				log_trace("irtoy ready for %d bytes", reply[0]);
+			}
+			continue;
+		}
+		if (res == 0 || (errno != EAGAIN && errno != EINTR)) {
 			log_error("irtoy_send: couldn't read command result");
 			return -1;
 		}
-
-		log_trace("irtoy ready for %d bytes", irToyBufLen);
-	}
-
-
-	res = read_with_timeout(dev->fd, reply, IRTOY_LEN_XMITRES, IRTOY_TIMEOUT_READYFORDATA);
-
-	if (res != IRTOY_LEN_XMITRES) {
-		log_error("irtoy_send: couldn't read command result");
-		return -1;
+		pfd.fd = dev->fd;
+		pfd.events = POLLIN;
+		if (written < length && window > 0)
+			pfd.events |= POLLOUT;
+		pfd.revents = 0;
+		res = curl_poll(&pfd, 1, IRTOY_TIMEOUT_READYFORDATA / 1000);
+		if (res == 0) {
+			log_error("irtoy_send: timeout, %d of %d bytes written",
+				  written, length);
+			return -1;
+		}
 	}
 
 	log_trace("%c %02X %02X %c\n", reply[0], reply[1], reply[2], reply[3]);
@@ -682,6 +696,16 @@ static int send(struct ir_remote* remote, struct ir_ncode* code)
 	length = send_buffer_length();
 	signals = send_buffer_data();
 
+	if (2 * length + 2 > rawSB_size) {
+		unsigned char* buf = realloc(rawSB, 2 * length + 2);
+
+		if (buf == NULL) {
+			log_error("irtoy: send: out of memory");
+			return 0;
+		}
+		rawSB = buf;
+		rawSB_size = 2 * length + 2;
+	}
 	for (i = 0; i < length; i++) {
 		val = (lirc_t)(((double)signals[i]) / IRTOY_UNIT);
 		rawSB[2 * i] = val >> 8;
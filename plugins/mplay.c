@@ -51,7 +51,9 @@
 #include <time.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <poll.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
 #include <sys/timerfd.h>
 #include <sys/ioctl.h>
 
@@ -104,6 +106,9 @@
 #define MPLAY_ROTATION_SENSOR_MASK (MPLAY_ROTATION_SENSOR_MASK_A | \
 				    MPLAY_ROTATION_SENSOR_MASK_B)
 
+/** Slots in the queue from the listener thread, a power of two. */
+#define MPLAY_QUEUE_SIZE 64
+
 /** Mplay serial baud rate. */
 #define MPLAY_BAUD_RATE 38400
 
@@ -146,6 +151,20 @@ static int mplay2_init(void);
 static int mplayfamily_deinit(void);
 static char* mplayfamily_rec(struct ir_remote* remotes);
 static int drvctl_func(unsigned int cmd, void* arg);
+static int mplayfamily_rec_pending(void);
+
+
+/**
+ * @brief A code passed from the listener thread to the LIRC framework.
+ *
+ * count is the number of times code occurred in a row, only wheel turns
+ * are coalesced this way. It is updated by the listener thread as long as
+ * it is non-zero, the reader claims the slot by setting it to zero.
+ */
+struct mplay_event {
+	unsigned char	code;
+	unsigned int	count;
+};
 
 
 /**
@@ -184,10 +203,21 @@ static struct {
 	unsigned char	latest_button;
 	/** File descriptor of serial port where IR is attached to. */
 	int		fd;
-	/** File descriptors of pipe into LIRC framework. */
-	int		pipefd[2];
+	/** Eventfd signalled by the listener thread when queue is updated,
+	 * the fd polled by the LIRC framework. */
+	int		wake_fd;
+	/** Eventfd telling the listener thread to exit. */
+	int		stop_fd;
 	/** ID of thread that listens on the serial port. */
 	pthread_t	tid;
+	/** Single producer, single consumer queue from the listener thread;
+	 * head is written by the listener only, tail by the reader only. */
+	struct mplay_event	queue[MPLAY_QUEUE_SIZE];
+	unsigned int		queue_head;
+	unsigned int		queue_tail;
+	/** Code and number of coalesced wheel turns not yet reported. */
+	unsigned char		wheel_code;
+	unsigned int		wheel_left;
 } mplayfamily_local_data = {
 	.rc_code			= 0,
 	.repeat_flag			= 0,
@@ -196,7 +226,8 @@ static struct {
 	.latest_action			= MPLAY_ACTION_NONE,
 	.latest_button			= MPLAY_CODE_ERROR,
 	.fd				= -1,
-	.pipefd				= { -1,	     -1	  },
+	.wake_fd			= -1,
+	.stop_fd			= -1,
 	.tid				= -1
 };
 
@@ -220,12 +251,13 @@ const struct driver hw_mplay = {
 	.decode_func	= mplayfamily_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
-	.driver_version = "0.9.3",
+	.api_version	= 4,
+	.driver_version = "0.9.4",
 	.info		= "LIRC driver for Vlsys mplay usb ftdi serial"
 			  " port remote control, tested with a Zalman"
 			  " Hd135 case.",
 	.device_hint    = "drvctl",
+	.rec_pending	= mplayfamily_rec_pending,
 };
 
 /**
@@ -248,12 +280,13 @@ const struct driver hw_mplay2 = {
 	.decode_func	= mplayfamily_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= NULL,
-	.api_version	= 3,
-	.driver_version = "0.9.3",
+	.api_version	= 4,
+	.driver_version = "0.9.4",
 	.info		= "LIRC driver for Vlsys mplay usb ftdi serial"
 			  " port remote control, tested with a Moneual"
 			  " Moncaso 312 case",
 	.device_hint    = "drvctl",
+	.rec_pending	= mplayfamily_rec_pending,
 };
 const struct driver* hardwares[] = { &hw_mplay, &hw_mplay2, NULL };
 
@@ -335,12 +368,93 @@ static int mplay2_init_receiver(void)
 }
 
 /**
- * @brief Cleans up resources used by the listener thread.
- * @return   void
+ * @brief Passes a code from the listener thread to the LIRC framework.
+ * @return 1 on success, 0 if the queue is full.
+ *
+ * A wheel turn in the same direction as the latest code still queued is
+ * added to its count instead of using a new slot, so fast turns are not
+ * lost while the LIRC framework is busy.
  */
-static void mplayfamily_listen_cleanup(void* arg)
+static int mplayfamily_post(unsigned char code)
 {
-	close((intptr_t)arg);
+	struct mplay_event* event;
+	uint64_t one = 1;
+	unsigned int head = mplayfamily_local_data.queue_head;
+	unsigned int tail;
+	unsigned int count;
+
+	tail = __atomic_load_n(&mplayfamily_local_data.queue_tail,
+			       __ATOMIC_ACQUIRE);
+	if (head != tail && (code == MPLAY_CODE_TURN_LEFT
+			     || code == MPLAY_CODE_TURN_RIGHT)) {
+		event = &mplayfamily_local_data.queue[
+			(head - 1) % MPLAY_QUEUE_SIZE];
+		count = __atomic_load_n(&event->count, __ATOMIC_RELAXED);
+		while (event->code == code && count > 0) {
+			if (__atomic_compare_exchange_n(
+				    &event->count, &count, count + 1, 0,
+				    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+				log_trace2("mplay coalesced 0x%02x, count %u",
+					   code, count + 1);
+				return 1;
+			}
+		}
+	}
+	if (head - tail >= MPLAY_QUEUE_SIZE) {
+		log_warn("mplay listener queue full, code 0x%02x dropped",
+			 code);
+		return 0;
+	}
+	event = &mplayfamily_local_data.queue[head % MPLAY_QUEUE_SIZE];
+	event->code = code;
+	__atomic_store_n(&event->count, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&mplayfamily_local_data.queue_head, head + 1,
+			 __ATOMIC_RELEASE);
+	if (write(mplayfamily_local_data.wake_fd, &one, sizeof(one)) < 0)
+		log_perror_err("mplay listener eventfd write error");
+	return 1;
+}
+
+/**
+ * @brief Takes next code passed by the listener thread.
+ * @return 1 if a code was stored in *code, 0 if there is none.
+ */
+static int mplayfamily_take(unsigned char* code)
+{
+	struct mplay_event* event;
+	unsigned int tail = mplayfamily_local_data.queue_tail;
+	unsigned int count;
+
+	if (mplayfamily_local_data.wheel_left > 0) {
+		mplayfamily_local_data.wheel_left--;
+		*code = mplayfamily_local_data.wheel_code;
+		return 1;
+	}
+	if (tail == __atomic_load_n(&mplayfamily_local_data.queue_head,
+				    __ATOMIC_ACQUIRE))
+		return 0;
+	event = &mplayfamily_local_data.queue[tail % MPLAY_QUEUE_SIZE];
+	*code = event->code;
+	count = __atomic_exchange_n(&event->count, 0, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&mplayfamily_local_data.queue_tail, tail + 1,
+			 __ATOMIC_RELEASE);
+	if (count > 1) {
+		mplayfamily_local_data.wheel_code = *code;
+		mplayfamily_local_data.wheel_left = count - 1;
+	}
+	return 1;
+}
+
+/**
+ * @brief Tells if codes from the listener thread are waiting.
+ * @return Non-zero if mplayfamily_rec() has a code without reading drv.fd.
+ */
+static int mplayfamily_rec_pending(void)
+{
+	return mplayfamily_local_data.wheel_left > 0
+	       || mplayfamily_local_data.queue_tail
+	       != __atomic_load_n(&mplayfamily_local_data.queue_head,
+				  __ATOMIC_ACQUIRE);
 }
 
 /**
@@ -540,10 +654,10 @@ static unsigned char mplayfamily_get_button(int fd, unsigned int* counter)
  * @brief Polls for button presses and wheel actions.
  * @return   void
  *
- * Polls for button presses and wheel actions; they are piped into the LIRC
- * framework where LIRC accesses the read end of a pipe. The function
- * implements a polling loop and is called in a polling thread, which is
- * cancellation safe.
+ * Polls for button presses and wheel actions; they are queued for the LIRC
+ * framework which polls an eventfd signalled for new codes. The function
+ * implements a polling loop and is called in a polling thread, which exits
+ * when stop_fd is signalled.
  *
  * The function reads every MPLAY_LISTENER_PERIOD_IDLE milliseconds from the
  * serial port and evaluates the serial port status lines. If the wheel is
@@ -579,6 +693,8 @@ static void* mplayfamily_listen(void* arg)
 	unsigned int turned;
 	/* file descriptor polling timer */
 	int fd;
+	/* polling timer and stop request */
+	struct pollfd pfd[2];
 	uint64_t expired;
 	/* button presses */
 	unsigned char code_wheel, code_button;
@@ -601,7 +717,10 @@ static void* mplayfamily_listen(void* arg)
 		log_perror_err("mplay listener could not create timer");
 		return NULL;
 	}
-	pthread_cleanup_push(mplayfamily_listen_cleanup, (void*)(intptr_t)fd);
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = mplayfamily_local_data.stop_fd;
+	pfd[1].events = POLLIN;
 
 	/* Poll for button presses and wheel actions */
 	while (1) {
@@ -618,41 +737,42 @@ static void* mplayfamily_listen(void* arg)
 			}
 		}
 		/* Wait for next event of periodic polling timer */
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_perror_err("mplay listener poll failed");
+			mplayfamily_post(MPLAY_CODE_ERROR);
+			goto poll_exit;
+		}
+		if (pfd[1].revents)
+			goto poll_exit;
 		if (read(fd, &expired, sizeof(uint64_t)) != sizeof(uint64_t)) {
 			log_perror_err("mplay listener timer failed");
+			mplayfamily_post(MPLAY_CODE_ERROR);
 			goto poll_exit;
 		}
 		/* Evaluate wheel status */
 		code_wheel = mplayfamily_get_wheel(fd, &counter, &sensor,
 						   &absolute, &turned);
 		if (code_wheel != MPLAY_CODE_NOP) {
-			/* Pass wheel event to LIRC framework via pipe */
-			if (write(mplayfamily_local_data.pipefd[1],
-				  &code_wheel, sizeof(code_wheel)) < 0) {
-				log_perror_err("mplay listener pipe write error");
+			/* Pass wheel event to LIRC framework */
+			mplayfamily_post(code_wheel);
+			if (code_wheel == MPLAY_CODE_ERROR)
 				goto poll_exit;
-			} else if (code_wheel == MPLAY_CODE_ERROR) {
-				goto poll_exit;
-			}
 		}
 		/* Process all pending button presses and pass them to the LIRC
-		 * framework via pipe */
+		 * framework */
 		code_button = mplayfamily_get_button(fd, &counter);
 		if (code_button != MPLAY_CODE_NOP) {
-			/* Pass button event to LIRC framework via pipe */
-			if (write(mplayfamily_local_data.pipefd[1],
-				  &code_button,
-				  sizeof(code_button)) < 0) {
-				log_perror_err(
-					"mplay listener pipe write error");
-			} else if (code_button == MPLAY_CODE_ERROR) {
+			/* Pass button event to LIRC framework */
+			mplayfamily_post(code_button);
+			if (code_button == MPLAY_CODE_ERROR)
 				goto poll_exit;
-			}
 		}
 	}
 
 poll_exit:
-	pthread_cleanup_pop(1);
+	close(fd);
 	log_trace("Leaving mplayfamily_listen()");
 	return NULL;
 }
@@ -664,10 +784,11 @@ poll_exit:
  * @return 1 on success, 0 on error.
  *
  * Unless the driver specified has appended the option "nowheel" (example:
- * --device="/dev/ttyUSB0,nowheel") the function installs a pipe from a
+ * --device="/dev/ttyUSB0,nowheel") the function installs a queue from a
  * polling listener thread into the LIRC framework. The listener thread
  * watches the serial port, generates remote control button presses (with wheel
- * actions) and pipes them into the LIRC framework.
+ * actions) and queues them for the LIRC framework, which polls an eventfd
+ * signalled by the listener.
  *
  * Otherwise the LIRC framework reads directly from the serial port (using
  * select, thus blocking until actually a button press arrives).
@@ -698,9 +819,17 @@ static int mplayfamily_init(int (*init_receiver)(void), int baud)
 		  "Using device path '%s' (wheel disabled state is %d)",
 		  device, nowheel);
 
-	/* Creation of pipe between this driver and LIRC framework */
-	if (!nowheel && pipe(mplayfamily_local_data.pipefd) == -1) {
-		log_error("Could not create pipe");
+	/* Creation of eventfds between this driver and LIRC framework */
+	if (!nowheel) {
+		mplayfamily_local_data.queue_head = 0;
+		mplayfamily_local_data.queue_tail = 0;
+		mplayfamily_local_data.wheel_left = 0;
+		mplayfamily_local_data.wake_fd = eventfd(0, EFD_NONBLOCK);
+		mplayfamily_local_data.stop_fd = eventfd(0, EFD_NONBLOCK);
+	}
+	if (!nowheel && (mplayfamily_local_data.wake_fd == -1
+			 || mplayfamily_local_data.stop_fd == -1)) {
+		log_error("Could not create eventfd");
 		result = 0;
 	}
 	/* Creation of a lock file for serial port */
@@ -709,13 +838,11 @@ static int mplayfamily_init(int (*init_receiver)(void), int baud)
 		result = 0;
 	}
 	/* Try to open serial port */
-	else if (result == 1) {
-		mplayfamily_local_data.fd =
-			 open(device, O_RDWR | O_NONBLOCK | O_NOCTTY);
-		if (mplayfamily_local_data.fd < 0) {
-			log_error("Could not open serial port '%s'", device);
-			result = 0;
-		}
+	else if ((mplayfamily_local_data.fd =
+		  open(device, O_RDWR | O_NONBLOCK | O_NOCTTY)) < 0) {
+		log_error("Could not open serial port '%s'", device);
+		tty_delete_lock();
+		result = 0;
 	}
 	/* Serial port configuration */
 	else if (!tty_reset(mplayfamily_local_data.fd) ||
@@ -733,7 +860,8 @@ static int mplayfamily_init(int (*init_receiver)(void), int baud)
 	else if (!nowheel && pthread_create(&mplayfamily_local_data.tid, NULL,
 					    mplayfamily_listen, NULL)) {
 		log_error("Could not create \"listener thread\"");
-		return 0;
+		mplayfamily_local_data.tid = -1;
+		result = 0;
 	}
 
 	/* Clean up if an error has occured */
@@ -742,10 +870,10 @@ static int mplayfamily_init(int (*init_receiver)(void), int baud)
 		mplayfamily_deinit();
 	}
 
-	/* Redirect reads from serial port to pipe if wheel should be
+	/* Redirect reads from serial port to queue if wheel should be
 	 * supported */
 	drv.fd = nowheel ? mplayfamily_local_data.fd
-		 : mplayfamily_local_data.pipefd[0];
+		 : mplayfamily_local_data.wake_fd;
 	return result;
 }
 
@@ -776,34 +904,38 @@ int mplay2_init(void)
 }
 
 /**
- * @brief Close serial line and pipe; and release the serial line.
+ * @brief Stop the listener; close serial line and eventfds; and release the
+ * serial line.
  * @return 1 on success, 0 on error.
  */
 int mplayfamily_deinit(void)
 {
+	uint64_t one = 1;
+
 	log_trace("Entering mplayfamily_deinit()");
 	if (mplayfamily_local_data.tid != -1) {
-		if (pthread_cancel(mplayfamily_local_data.tid) < 0) {
-			log_perror_err("mplay could not cancel listener");
+		if (write(mplayfamily_local_data.stop_fd,
+			  &one, sizeof(one)) < 0) {
+			log_perror_err("mplay could not stop listener");
 			return 0;
 		}
 		pthread_join(mplayfamily_local_data.tid, NULL);
 		mplayfamily_local_data.tid = -1;
 	}
-	if (mplayfamily_local_data.pipefd[0] != -1) {
-		close(mplayfamily_local_data.pipefd[0]);
-		mplayfamily_local_data.pipefd[0] = -1;
+	if (mplayfamily_local_data.wake_fd != -1) {
+		close(mplayfamily_local_data.wake_fd);
+		mplayfamily_local_data.wake_fd = -1;
 	}
-	if (mplayfamily_local_data.pipefd[1] != -1) {
-		close(mplayfamily_local_data.pipefd[1]);
-		mplayfamily_local_data.pipefd[1] = -1;
+	if (mplayfamily_local_data.stop_fd != -1) {
+		close(mplayfamily_local_data.stop_fd);
+		mplayfamily_local_data.stop_fd = -1;
 	}
-	if (drv.fd != -1) {
-		close(drv.fd);
+	if (mplayfamily_local_data.fd != -1) {
+		close(mplayfamily_local_data.fd);
 		tty_delete_lock();
-		drv.fd = -1;
 		mplayfamily_local_data.fd = -1;
 	}
+	drv.fd = -1;
 	return 1;
 }
 
@@ -899,16 +1031,29 @@ char* mplayfamily_rec_handle_new(struct ir_remote* remotes,
  * @return NULL if nothing has been received, otherwise a lirc code.
  *
  * This function is called by the LIRC daemon when I/O is pending from a
- * registered client, e.g. irw.
+ * registered client, e.g. irw. With the listener thread, one queued code is
+ * handled per call; mplayfamily_rec_pending() tells about the others.
  */
 char* mplayfamily_rec(struct ir_remote* remotes)
 {
 	unsigned char rc_code;
 	signed int len;
+	uint64_t wakeups;
 	struct timeval current_time;
 
 	log_trace("Entering mplayfamily_rec()");
-	len = read(drv.fd, &rc_code, 1);
+	if (mplayfamily_local_data.wake_fd == -1) {
+		len = read(drv.fd, &rc_code, 1);
+	} else {
+		if (read(drv.fd, &wakeups, sizeof(wakeups)) < 0
+		    && errno != EAGAIN) {
+			len = -1;
+		} else if (!mplayfamily_take(&rc_code)) {
+			return NULL;
+		} else {
+			len = rc_code == MPLAY_CODE_ERROR ? -1 : 1;
+		}
+	}
 	gettimeofday(&current_time, NULL);
 	if (len != 1) {
 		/* Something went wrong during the read, we close the device
@@ -63,6 +63,7 @@ static char* tira_rec(struct ir_remote* remotes);
 static char* tira_rec_mode2(struct ir_remote* remotes);
 static int tira_send(struct ir_remote* remote, struct ir_ncode* code);
 static lirc_t tira_readdata(lirc_t timeout);
+static int tira_readdata_bulk(lirc_t* data, int count, lirc_t timeout);
 static int drvctl_func(unsigned int cmd, void* arg);
 
 const char failwrite[] = "failed writing to device";
@@ -121,10 +122,11 @@ const struct driver hw_tira_raw = {
 	.decode_func	= tira_decode,
 	.drvctl_func	= drvctl_func,
 	.readdata	= tira_readdata,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "See file://@plugindocs@/tira.html",
 	.device_hint    = "drvctl",
+	.readdata_bulk	= tira_readdata_bulk,
 };
 
 const struct driver* hardwares[] = { &hw_tira, &hw_tira_raw, NULL };
@@ -156,6 +158,30 @@ int tira_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
 
 char response[64 + 1];
 
+/** Silence ending a reply of unknown length, see read_reply(). */
+#define REPLY_IDLE_MS 20
+
+/**
+ * Read a reply of unknown length like the firmware version: wait at
+ * most timeout_ms for it to start, then take what arrives until the
+ * line is quiet for REPLY_IDLE_MS or buf is full.
+ */
+static int read_reply(char* buf, size_t size, int timeout_ms)
+{
+	int done;
+	int r;
+
+	done = tty_read_buf(drv.fd, buf, 1, timeout_ms);
+	while (done > 0 && (size_t)done < size) {
+		r = tty_read_buf(drv.fd, buf + done, size - done,
+				 REPLY_IDLE_MS);
+		if (r <= 0)
+			break;
+		done += r;
+	}
+	return done;
+}
+
 void displayonline(void)
 {
 	const char* dflags;
@@ -176,14 +202,11 @@ int tira_setup_sixbytes(void)
 	int i;
 
 	log_info("Switching to 6bytes mode");
-	if (write(drv.fd, "IR", 2) != 2) {
+	if (tty_write_buf(drv.fd, "IR", 2) != 2) {
 		log_error("failed switching device into six byte mode");
 		return 0;
 	}
-	/* wait for the chars to be written */
-	usleep(2 * (100 * 1000));
-
-	i = read(drv.fd, response, 2);
+	i = tty_read_buf(drv.fd, response, 2, 200);
 	if (i != 2) {
 		log_error("failed reading response to six byte mode command");
 		return 0;
@@ -205,10 +228,12 @@ int child_process(int pipe_w, int oldprotocol)
 	signal(SIGHUP, SIG_IGN);
 	signal(SIGALRM, SIG_IGN);
 
-	unsigned char tirabuffer[64];
+	unsigned char tirabuffer[1024];
+	/* Each decoded item may be preceded by a trailing space. */
+	lirc_t pipebuf[sizeof(tirabuffer)];
 	int tirabuflen = 0;
-	int readsize, tmp;
-	lirc_t data, tdata;
+	int readsize, tmp, count;
+	lirc_t data;
 	struct pollfd pfd = {.fd = drv.fd, .events = POLLIN, .revents = 0};
 	struct timeval trailtime, currtime;
 	uint32_t eusec;
@@ -217,28 +242,30 @@ int child_process(int pipe_w, int oldprotocol)
 	trailtime.tv_usec = 0;
 
 	while (1) {
-		tmp = curl_poll(&pfd, 1, 1);  /* 1 ms timeout. */
+		/* Timing is taken on arrival, nothing to do until then. */
+		tmp = curl_poll(&pfd, 1, -1);
 
-		if (tmp == 0)
+		if (tmp == 0 || (tmp < 0 && errno == EINTR))
 			continue;
 		if (tmp < 0) {
 			log_perror_err("child_process: Error  in curl_poll()");
 			return 0;
 		}
 
-		if (!pfd.revents & POLLIN)
+		if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
 			continue;
 		readsize = read(drv.fd, &tirabuffer[tirabuflen], sizeof(tirabuffer) - tirabuflen);
+		if (readsize < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
 		if (readsize <= 0) {
 			log_error("Error reading from Tira");
 			log_perror_err(NULL);
 			return 0;
 		}
-		if (readsize == 0)
-			continue;
 		tirabuflen += readsize;
 
 		tmp = 0;
+		count = 0;
 		while (tmp < tirabuflen - 1) {
 			data = tirabuffer[tmp];
 			data <<= 8;
@@ -278,11 +305,7 @@ int child_process(int pipe_w, int oldprotocol)
 				trailtime.tv_usec = 0;
 				if (eusec > data) {
 					pulse_space = 1;
-					tdata = LIRC_SPACE(eusec);
-					if (write(pipe_w, &tdata, sizeof(tdata)) != sizeof(tdata)) {
-						log_error("Error writing pipe");
-						return 0;
-					}
+					pipebuf[count++] = LIRC_SPACE(eusec);
 				}
 			}
 
@@ -290,10 +313,14 @@ int child_process(int pipe_w, int oldprotocol)
 
 			pulse_space = 1 - pulse_space;
 
-			if (write(pipe_w, &data, sizeof(data)) != sizeof(data)) {
-				log_error("Error writing pipe");
-				return 0;
-			}
+			pipebuf[count++] = data;
+		}
+
+		/* All of this read in one go, lircd reads it the same way. */
+		count *= sizeof(lirc_t);
+		if (count > 0 && write(pipe_w, pipebuf, count) != count) {
+			log_error("Error writing pipe");
+			return 0;
 		}
 
 		//Scroll buffer to next position
@@ -315,14 +342,11 @@ int tira_setup_timing(int oldprotocol)
 
 	log_info("Switching to timing mode");
 	if (!oldprotocol) {
-		if (write(drv.fd, "IC\0\0", 4) != 4) {
+		if (tty_write_buf(drv.fd, "IC\0\0", 4) != 4) {
 			log_error("failed switching device into timing mode");
 			return 0;
 		}
-		/* wait for the chars to be written */
-		usleep(2 * (100 * 1000));
-
-		i = read(drv.fd, response, 3);
+		i = tty_read_buf(drv.fd, response, 3, 200);
 		if (i != 3) {
 			log_error("failed reading response to timing mode command");
 			return 0;
@@ -376,37 +400,32 @@ int tira_setup(void)
 	int ptr;
 
 	/* Clear the port of any random data */
-	while (read(drv.fd, &ptr, 1) >= 0)
-		;
+	tcflush(drv.fd, TCIFLUSH);
 
 	/* Start off with the IP command. This was initially used to
 	 * switch to timing mode on the Tira-1. The Tira-2 also
 	 * supports this mode, however it does not switch the Tira-2
 	 * into timing mode.
 	 */
-	if (write(drv.fd, "IP", 2) != 2) {
+	if (tty_write_buf(drv.fd, "IP", 2) != 2) {
 		log_error(failwrite);
 		return 0;
 	}
-	/* Wait till the chars are written, should use tcdrain but
-	 * that don't seem to work... *shrug*
-	 */
-	usleep(2 * (100 * 1000));
-	chk_read(drv.fd, response, 3);
+	/* The reply: "OIP", the calibration value, the version word. */
+	memset(response, 0, sizeof(response));
+	tty_read_buf(drv.fd, response, 5, 200);
 
 	if (strncmp(response, "OIP", 3) == 0) {
-		chk_read(drv.fd, &ptr, 1);      /* read the calibration value */
-		chk_read(drv.fd, &ptr, 1);      /* read the version word */
+		ptr = (unsigned char)response[4];
 		/* Bits 4:7 in the version word set to one indicates a
 		 * Tira-2 */
 		deviceflags = ptr & 0x0f;
 		if (ptr & 0xF0) {
 			log_info("Tira-2 detected");
 			/* Lets get the firmware version */
-			chk_write(drv.fd, "IV", 2);
-			usleep(2 * (100 * 1000));
+			tty_write_buf(drv.fd, "IV", 2);
 			memset(response, 0, sizeof(response));
-			chk_read(drv.fd, response, sizeof(response) - 1);
+			read_reply(response, sizeof(response) - 1, 200);
 			log_info("firmware version %s", response);
 		} else {
 			log_info("Ira/Tira-1 detected");
@@ -441,16 +460,11 @@ int ira_setup_sixbytes(unsigned char info)
 		return 0;
 	}
 	usleep(200000);
-	if (write(drv.fd, "R", 1) != 1) {
+	if (tty_write_buf(drv.fd, "R", 1) != 1) {
 		log_error(failwrite);
 		return 0;
 	}
-
-	/* Wait till the chars are written, should use tcdrain but
-	 * that don't seem to work... *shrug*
-	 */
-	usleep(100000);
-	i = read(drv.fd, response, 2);
+	i = tty_read_buf(drv.fd, response, 2, 100);
 	if (i != 2)
 		return 0;
 	if (strncmp(response, "OK", 2) != 0)
@@ -463,11 +477,9 @@ int ira_setup_sixbytes(unsigned char info)
 int ira_setup(void)
 {
 	int i;
-	int ptr;
 
 	/* Clear the port of any random data */
-	while (read(drv.fd, &ptr, 1) >= 0)
-		;
+	tcflush(drv.fd, TCIFLUSH);
 
 	if (ira_setup_sixbytes(0) == 0)
 		return 0;
@@ -477,18 +489,13 @@ int ira_setup(void)
 		return 0;
 	}
 	usleep(200000);
-	if (write(drv.fd, "P", 1) != 1) {
+	if (tty_write_buf(drv.fd, "P", 1) != 1) {
 		log_error(failwrite);
 		return 0;
 	}
-
-	/* Wait till the chars are written, should use tcdrain but
-	 * that don't seem to work... *shrug*
-	 */
 	if (!tty_setbaud(drv.fd, 57600))
 		return 0;
-	usleep(50000);
-	i = read(drv.fd, response, 5);
+	i = tty_read_buf(drv.fd, response, 5, 50);
 
 	if (!tty_setbaud(drv.fd, 9600))
 		return 0;
@@ -504,14 +511,12 @@ int ira_setup(void)
 				return 0;
 			}
 			usleep(200000);
-			if (write(drv.fd, "V", 1) != 1) {
+			if (tty_write_buf(drv.fd, "V", 1) != 1) {
 				log_error(failwrite);
 				return 0;
 			}
-
-			usleep(200000);
 			memset(response, 0, sizeof(response));
-			i = read(drv.fd, response, sizeof(response) - 1);
+			i = read_reply(response, sizeof(response) - 1, 200);
 			if (i > 0) {
 				log_info("Ira %s detected", response);
 			} else {
@@ -640,28 +645,33 @@ char* tira_rec(struct ir_remote* remotes)
 {
 	char* m;
 	int i, x;
+	ssize_t r;
 
 	last = end;
 	x = 0;
 	gettimeofday(&start, NULL);
-	for (i = 0; i < 6; i++) {
-		if (i > 0) {
-			if (!waitfordata(20000)) {
-				log_trace("timeout reading byte %d", i);
-				/* likely to be !=6 bytes, so flush. */
-				tcflush(drv.fd, TCIFLUSH);
-				return NULL;
-			}
+	while (x < 6) {
+		/* Take what the tty has, wait only if the code is not all in. */
+		r = read(drv.fd, &b[x], 6 - x);
+		if (r > 0) {
+			x += r;
+			continue;
 		}
-		if (read(drv.fd, &b[i], 1) != 1) {
-			log_error("reading of byte %d failed.", i);
+		if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+			log_error("reading of byte %d failed.", x);
 			log_perror_err(NULL);
 			return NULL;
 		}
-		log_trace("byte %d: %02x", i, b[i]);
-		x++;
+		if (errno == EAGAIN && !waitfordata(20000)) {
+			log_trace("timeout reading byte %d", x);
+			/* likely to be !=6 bytes, so flush. */
+			tcflush(drv.fd, TCIFLUSH);
+			return NULL;
+		}
 	}
 	gettimeofday(&end, NULL);
+	for (i = 0; i < x; i++)
+		log_trace("byte %d: %02x", i, b[i]);
 	code = 0;
 	for (i = 0; i < x; i++) {
 		code |= ((ir_code)b[i]);
@@ -790,18 +800,18 @@ static int tira_send(struct ir_remote* remote, struct ir_ncode* code)
 			i = 0;
 		if (i != 0) {
 			usleep(200000);
-			if (write(drv.fd, &wrtbuf[1], length - 1) != length - 1)
+			if (tty_write_buf(drv.fd, &wrtbuf[1], length - 1)
+			    != length - 1)
 				i = 0;
 		}
 	} else {
-		i = write(drv.fd, wrtbuf, length);
+		i = tty_write_buf(drv.fd, wrtbuf, length);
 	}
 
 	if (i != length) {
 		log_error(failwrite);
 	} else {
-		usleep(200000);
-		i = read(drv.fd, wrtbuf, 3);
+		i = tty_read_buf(drv.fd, wrtbuf, 3, 200);
 		if (i == 3 && strncmp((char *)wrtbuf, "OIX", 3) == 0)
 			retval = 1;
 		else
@@ -831,3 +841,21 @@ lirc_t tira_readdata(lirc_t timeout)
 	}
 	return data;
 }
+
+int tira_readdata_bulk(lirc_t* data, int count, lirc_t timeout)
+{
+	ssize_t ret;
+
+	if (!waitfordata((long)timeout))
+		return 0;
+
+	/* The child writes whole items, all of a burst at once. */
+	ret = read(drv.fd, data, count * sizeof(lirc_t));
+	if (ret <= 0 || ret % sizeof(lirc_t) != 0) {
+		log_error("error reading from %s", drv.device);
+		log_perror_err(NULL);
+		tira_deinit();
+		return 0;
+	}
+	return ret / sizeof(lirc_t);
+}
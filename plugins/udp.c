@@ -42,6 +42,8 @@
  * \note Little endian is not conventional network byte order.
  */
 
+#define _GNU_SOURCE 1
+
 #ifdef HAVE_CONFIG_H
 # include <config.h>
 #endif
@@ -53,7 +55,9 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/fcntl.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <errno.h>
 
 #include "lirc_driver.h"
@@ -69,6 +73,228 @@ static const int LAST_PORT = 6006;
 static int zerofd;              /* /dev/zero */
 static int sockfd;              /* the socket */
 
+/** Datagrams fetched by one recvmmsg(). */
+#define UDP_BATCH 8
+
+/** Max size of a datagram. */
+#define UDP_PACKET_SIZE 8192
+
+/** Max number of senders kept apart, more are dropped. */
+#define MAX_SOURCES 8
+
+/** Bytes queued for each sender. */
+#define SOURCE_BUFSIZE 16384
+
+/** The sample stream of one sender, decoded in its own rec_context. */
+struct udp_source {
+	struct sockaddr_in	addr;
+	struct rec_context*	ctx;
+	u_int8_t		buffer[SOURCE_BUFSIZE];
+	int			buflen;
+	int			bufptr;
+	unsigned long		packets;        /**< Datagrams queued. */
+	unsigned long		dropped;        /**< Full or truncated ones. */
+};
+
+static struct udp_source sources[MAX_SOURCES];
+static int source_count = 0;
+
+/** Datagrams from senders not fitting in sources. */
+static unsigned long unknown_dropped = 0;
+
+/** The source readdata() returns samples from. */
+static struct udp_source* current = NULL;
+
+/** Set while udp_rec() decodes current, which then must not change. */
+static int decoding = 0;
+
+static u_int8_t packets[UDP_BATCH][UDP_PACKET_SIZE];
+static struct sockaddr_in packet_addrs[UDP_BATCH];
+
+
+static const char* source_name(const struct udp_source* src)
+{
+	static char buff[32];
+	char ip[INET_ADDRSTRLEN];
+
+	if (inet_ntop(AF_INET, &src->addr.sin_addr, ip, sizeof(ip)) == NULL)
+		strcpy(ip, "?");
+	snprintf(buff, sizeof(buff), "%s:%d", ip, ntohs(src->addr.sin_port));
+	return buff;
+}
+
+
+/** Return the source for addr, possibly a new one, or NULL if full. */
+static struct udp_source* find_source(const struct sockaddr_in* addr)
+{
+	struct rec_context* prev;
+	struct udp_source* src;
+	int i;
+
+	for (i = 0; i < source_count; i++)
+		if (sources[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr
+		    && sources[i].addr.sin_port == addr->sin_port)
+			return &sources[i];
+	if (source_count == MAX_SOURCES)
+		return NULL;
+	src = &sources[source_count];
+	src->ctx = rec_context_new();
+	if (src->ctx == NULL)
+		return NULL;
+	prev = rec_context_select(src->ctx);
+	rec_buffer_init();
+	rec_context_select(prev);
+	src->addr = *addr;
+	src->buflen = src->bufptr = 0;
+	src->packets = src->dropped = 0;
+	source_count++;
+	log_info("new UDP sender %s", source_name(src));
+	return src;
+}
+
+
+static void add_packet(struct udp_source* src, const u_int8_t* data, int len)
+{
+	len &= ~1;
+	if (src->bufptr > 0) {
+		memmove(src->buffer, src->buffer + src->bufptr,
+			src->buflen - src->bufptr);
+		src->buflen -= src->bufptr;
+		src->bufptr = 0;
+	}
+	if (src->buflen + len > SOURCE_BUFSIZE) {
+		src->dropped++;
+		return;
+	}
+	memcpy(src->buffer + src->buflen, data, len);
+	src->buflen += len;
+	src->packets++;
+}
+
+
+static void queue_packet(const struct sockaddr_in* addr,
+			 const u_int8_t* data, int len, int truncated)
+{
+	struct udp_source* src;
+
+	src = find_source(addr);
+	if (src == NULL)
+		unknown_dropped++;
+	else if (truncated)
+		src->dropped++;
+	else
+		add_packet(src, data, len);
+}
+
+
+/**
+ * Queue all datagrams available in sockfd without blocking.
+ * Return the number of datagrams read, -1 on errors.
+ */
+static int receive_packets(void)
+{
+	int total = 0;
+	int n;
+	int i;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovecs[UDP_BATCH];
+
+	do {
+		for (i = 0; i < UDP_BATCH; i++) {
+			iovecs[i].iov_base = packets[i];
+			iovecs[i].iov_len = UDP_PACKET_SIZE;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &packet_addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(packet_addrs[i]);
+		}
+		n = recvmmsg(sockfd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0)
+			break;
+		for (i = 0; i < n; i++)
+			queue_packet(&packet_addrs[i], packets[i],
+				     msgs[i].msg_len,
+				     msgs[i].msg_hdr.msg_flags & MSG_TRUNC);
+		total += n;
+	} while (n == UDP_BATCH);
+#else
+	socklen_t addrlen;
+
+	do {
+		for (i = 0; i < UDP_BATCH; i++) {
+			addrlen = sizeof(packet_addrs[0]);
+			n = recvfrom(sockfd, packets[0], UDP_PACKET_SIZE,
+				     MSG_DONTWAIT | MSG_TRUNC,
+				     (struct sockaddr*)&packet_addrs[0],
+				     &addrlen);
+			if (n < 0)
+				break;
+			queue_packet(&packet_addrs[0], packets[0],
+				     n > UDP_PACKET_SIZE ? 0 : n,
+				     n > UDP_PACKET_SIZE);
+			total++;
+		}
+	} while (i == UDP_BATCH);
+#endif
+	if (n < 0 && total == 0 && errno != EAGAIN && errno != EWOULDBLOCK
+	    && errno != EINTR) {
+		log_perror_warn("Error reading from UDP socket");
+		return -1;
+	}
+	return total;
+}
+
+
+/** Return true if src has a complete sample queued. */
+static int has_sample(const struct udp_source* src)
+{
+	int avail;
+
+	if (src == NULL)
+		return 0;
+	avail = src->buflen - src->bufptr;
+	if (avail < 2)
+		return 0;
+	/* A zero time is followed by a four byte one. */
+	if (src->buffer[src->bufptr] == 0
+	    && (src->buffer[src->bufptr + 1] & 0x7f) == 0)
+		return avail >= 6;
+	return 1;
+}
+
+
+/** Return a source with a complete sample after current, or NULL. */
+static struct udp_source* next_source(void)
+{
+	int start = current ? current - sources + 1 : 0;
+	int i;
+
+	for (i = 0; i < source_count; i++) {
+		struct udp_source* src = &sources[(start + i) % source_count];
+
+		if (has_sample(src))
+			return src;
+	}
+	return NULL;
+}
+
+
+/** Point drv.fd to /dev/zero while some sample is queued. */
+static void update_fd(void)
+{
+	int i;
+
+	for (i = 0; i < source_count; i++) {
+		if (has_sample(&sources[i])) {
+			drv.fd = zerofd;
+			return;
+		}
+	}
+	drv.fd = sockfd;
+}
+
 
 /** List available udp devices starting at 6000. */
 static int list_devices(glob_t* glob)
@@ -107,6 +333,21 @@ static int list_devices(glob_t* glob)
 }
 
 
+static void get_stats(struct drv_stats* stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->dropped = unknown_dropped;
+	for (i = 0; i < source_count; i++) {
+		log_info("UDP sender %s: %lu packets, %lu dropped",
+			 source_name(&sources[i]),
+			 sources[i].packets, sources[i].dropped);
+		stats->dropped += sources[i].dropped;
+	}
+}
+
+
 /**
  * Driver control.
  *
@@ -129,6 +370,9 @@ static int udp_drvctl_func(unsigned int cmd, void* arg)
 	case DRVCTL_FREE_DEVICES:
 		drv_enum_free((glob_t*) arg);
 		return 0;
+	case DRVCTL_GET_STATS:
+		get_stats((struct drv_stats*)arg);
+		return 0;
 	case DRVCTL_SET_OPTION:
 		opt = (struct option_t*)arg;
 		if (strcmp(opt->key, "clocktick") == 0) {
@@ -218,6 +462,20 @@ int udp_init(void)
  */
 int udp_deinit(void)
 {
+	int i;
+
+	for (i = 0; i < source_count; i++) {
+		log_info("UDP sender %s: %lu packets, %lu dropped",
+			 source_name(&sources[i]),
+			 sources[i].packets, sources[i].dropped);
+		rec_context_free(sources[i].ctx);
+	}
+	if (unknown_dropped > 0)
+		log_info("UDP: %lu packets dropped from too many senders",
+			 unknown_dropped);
+	source_count = 0;
+	unknown_dropped = 0;
+	current = NULL;
 	close(sockfd);
 	close(zerofd);
 	drv.fd = -1;
@@ -227,54 +485,88 @@ int udp_deinit(void)
 /**
  * Receive data from remote.
  *
- * The UDP driver just calls the standard functions.
+ * Decode the next sender with queued data, using the standard functions
+ * in the sender's own rec_context.
  */
 char* udp_rec(struct ir_remote* remotes)
 {
-	if (!rec_buffer_clear())
+	struct rec_context* prev;
+	char* message = NULL;
+
+	if (receive_packets() < 0)
+		return NULL;
+	if (!has_sample(current))
+		current = next_source();
+	if (current == NULL) {
+		update_fd();
 		return NULL;
-	return decode_all(remotes);
+	}
+	decoding = 1;
+	prev = rec_context_select(current->ctx);
+	if (rec_buffer_clear())
+		message = decode_all(remotes);
+	rec_context_select(prev);
+	decoding = 0;
+	update_fd();
+	return message;
+}
+
+/**
+ * Wait for a complete sample from current, or any source unless
+ * decoding. Return 0 on timeout or errors.
+ */
+static int wait_sample(lirc_t timeout)
+{
+	struct timeval start;
+	struct timeval now;
+	unsigned long elapsed;
+
+	get_monotonic_time(&start);
+	while (1) {
+		if (!decoding && !has_sample(current))
+			current = next_source();
+		if (has_sample(current))
+			return 1;
+		drv.fd = sockfd;
+		elapsed = 0;
+		if (timeout > 0) {
+			get_monotonic_time(&now);
+			elapsed = time_elapsed(&start, &now);
+			if (elapsed >= (unsigned long)timeout)
+				return 0;
+		}
+		if (!waitfordata(timeout > 0 ? timeout - elapsed : 0))
+			return 0;
+		if (receive_packets() < 0)
+			return 0;
+	}
 }
 
 /**
  * Read data from the UDP port.
  *
  * Data read from the UDP port is converted to lirc mode2 format and returned
- * one measured time interval at a time.
+ * one measured time interval at a time. While udp_rec() decodes a sender,
+ * only data from that sender is returned.
  * \param timeout  Time to wait for data.
  * \return         IR timing data in lirc mode2 format.
  */
 lirc_t udp_readdata(lirc_t timeout)
 {
-	static u_int8_t buffer[8192];
-	static int buflen = 0;
-	static int bufptr = 0;
+	struct udp_source* src;
 	lirc_t data;
 	u_int8_t packed[4];
 	u_int64_t tmp;
 
-	/* Assume buffer is empty; LIRC should select on the socket */
-	drv.fd = sockfd;
-
-	/* If buffer is empty, get data into it */
-	if ((bufptr + 2) > buflen) {
-		if (!waitfordata(timeout))
-			return 0;
-		buflen = recv(sockfd, &buffer, sizeof(buffer), 0);
-		if (buflen < 0) {
-			log_info("Error reading from UDP socket");
-			return 0;
-		}
-		if (buflen & 1)
-			buflen--;
-		if (buflen == 0)
-			return 0;
-		bufptr = 0;
+	if (!wait_sample(timeout)) {
+		update_fd();
+		return 0;
 	}
+	src = current;
 
 	/* Read as 2 bytes to avoid endian-ness issues */
-	packed[0] = buffer[bufptr++];
-	packed[1] = buffer[bufptr++];
+	packed[0] = src->buffer[src->bufptr++];
+	packed[1] = src->buffer[src->bufptr++];
 
 	/* Low indicates that the receiver has detected the marking state
 	 * i.e. is receiving IR pulses.
@@ -285,28 +577,14 @@ lirc_t udp_readdata(lirc_t timeout)
 	tmp &= 0x7FFF;
 	if (tmp == 0) {
 		/*
-		 * A zero flags the following  bytes as an extended time value.
-		 * If buffer is empty, get data into it.
+		 * A zero flags the following bytes as an extended time value,
+		 * which has_sample() checked to be queued.
+		 * Read as 4 bytes to avoid endian-ness issues.
 		 */
-		if ((bufptr + 4) > buflen) {
-			if (!waitfordata(timeout))
-				return 0;
-			buflen = recv(sockfd, &buffer, sizeof(buffer), 0);
-			if (buflen < 0) {
-				log_info("Error reading from UDP socket");
-				return 0;
-			}
-			if (buflen & 1)
-				buflen--;
-			if (buflen == 0)
-				return 0;
-			bufptr = 0;
-		}
-		/* Read as 4 bytes to avoid endian-ness issues. */
-		packed[0] = buffer[bufptr++];
-		packed[1] = buffer[bufptr++];
-		packed[2] = buffer[bufptr++];
-		packed[3] = buffer[bufptr++];
+		packed[0] = src->buffer[src->bufptr++];
+		packed[1] = src->buffer[src->bufptr++];
+		packed[2] = src->buffer[src->bufptr++];
+		packed[3] = src->buffer[src->bufptr++];
 		tmp = (((u_int64_t) packed[3]) << 24)
 		    | (((u_int64_t) packed[2]) << 16)
 		    | (((u_int64_t) packed[1]) << 8)
@@ -336,9 +614,8 @@ lirc_t udp_readdata(lirc_t timeout)
 
 	data |= tmp;
 
-	/* If our buffer still has data, give LIRC /dev/zero to select on */
-	if ((bufptr + 2) <= buflen)
-		drv.fd = zerofd;
+	/* If some buffer still has data, give LIRC /dev/zero to select on */
+	update_fd();
 
 	return data;
 }
@@ -37,15 +37,29 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <termios.h>
 #include <errno.h>
 
 #include "lirc_driver.h"
+#include "lirc/serial.h"
 
 #include "uirt2_common.h"
 
 #define PRINT_TIME(a) \
 	log_trace("time: %s %li %li", #a, (a)->tv_sec, (a)->tv_usec)
 
+/** Size of the input buffer, bytes read from the tty but not yet used. */
+#define RBUF_SIZE 256
+
+/** Max wait for the rest of a reply or signal once it has started. */
+#define READ_TIMEOUT_MS 20
+
+/**
+ * Silence which makes uirt2_readflush() consider the device idle, some
+ * 200 characters at 115200 baud.
+ */
+#define FLUSH_QUIET_USEC 20000
+
 struct tag_uirt2_t {
 	int		fd;
 	int		flags;
@@ -54,63 +68,93 @@ struct tag_uirt2_t {
 	struct timeval	pre_delay;
 	struct timeval	pre_time;
 	int		new_signal;
+
+	byte_t		rbuf[RBUF_SIZE];
+	int		rbuf_pos;
+	int		rbuf_len;
 };
 
 static const logchannel_t logchannel = LOG_DRIVER;
 
 const int unit = UIRT2_UNIT;
 
-static ssize_t readagain(int fd, void* buf, size_t count)
+/**
+ * Wait at most timeout_ms for input, then read all the tty has into
+ * the input buffer.
+ * @return Number of bytes added, 0 on timeout or a full buffer, -1
+ *     on errors.
+ */
+static int rbuf_fill(uirt2_t* dev, int timeout_ms)
 {
-	ssize_t rc;
-	size_t pos = 0;
-	static const int TIMEOUT_MS = 20;
-	struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
-
-	rc = read(fd, buf, count);
-
-	if (rc > 0)
-		pos += rc;
-
-	while ((rc == -1 && errno == EAGAIN) || (rc >= 0 && pos < count)) {
-		rc = curl_poll(&pfd, 1, TIMEOUT_MS);
-
-		if (rc == 0)
-			/* timeout */
-			break;
-		else if (rc == -1)
-			/* continue for EAGAIN case */
+	struct pollfd pfd = {.fd = dev->fd, .events = POLLIN, .revents = 0};
+	ssize_t r;
+
+	if (dev->rbuf_pos == dev->rbuf_len) {
+		dev->rbuf_pos = 0;
+		dev->rbuf_len = 0;
+	} else if (dev->rbuf_pos > 0) {
+		memmove(dev->rbuf, dev->rbuf + dev->rbuf_pos,
+			dev->rbuf_len - dev->rbuf_pos);
+		dev->rbuf_len -= dev->rbuf_pos;
+		dev->rbuf_pos = 0;
+	}
+	if (dev->rbuf_len == RBUF_SIZE)
+		return 0;
+	while (1) {
+		r = read(dev->fd, dev->rbuf + dev->rbuf_len,
+			 RBUF_SIZE - dev->rbuf_len);
+		if (r > 0) {
+			dev->rbuf_len += r;
+			return r;
+		}
+		if (r == 0)
+			return -1;
+		if (errno == EINTR)
 			continue;
-
-		rc = read(fd, ((char*)buf) + pos, count - pos);
-
-		if (rc > 0)
-			pos += rc;
-
+		if (errno != EAGAIN)
+			return -1;
+		r = curl_poll(&pfd, 1, timeout_ms);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return r;
 	}
-	return (pos == 0) ? -1 : pos;
 }
 
-static int mywaitfordata(uirt2_t* dev, long timeout_usec)
+/**
+ * Copy count bytes to buf from the input buffer, refilling it while
+ * more arrive within READ_TIMEOUT_MS.
+ * @return Number of bytes copied, -1 if none.
+ */
+static int rbuf_read(uirt2_t* dev, void* buf, int count)
 {
-	struct pollfd pfd = {.fd = dev->fd, .events = POLLIN, .revents = 0};
-	int ret;
+	int done = 0;
+	int n;
 
-	ret = curl_poll(&pfd, 1, timeout_usec / 1000);
-	return ret <= 0 ? 0 : 1;
+	while (1) {
+		n = dev->rbuf_len - dev->rbuf_pos;
+		if (n > count - done)
+			n = count - done;
+		memcpy((byte_t*)buf + done, dev->rbuf + dev->rbuf_pos, n);
+		dev->rbuf_pos += n;
+		done += n;
+		if (done == count || rbuf_fill(dev, READ_TIMEOUT_MS) <= 0)
+			break;
+	}
+	return done == 0 ? -1 : done;
 }
 
+/** Drop all input until the device is quiet for timeout us. */
 static int uirt2_readflush(uirt2_t* dev, long timeout)
 {
 	int res;
-	char c;
 
-	while (mywaitfordata(dev, timeout) > 0) {
-		res = readagain(dev->fd, &c, 1);
-		if (res < 1)
-			return -1;
-	}
-	return 0;
+	do {
+		dev->rbuf_pos = dev->rbuf_len;
+		res = rbuf_fill(dev, timeout / 1000);
+	} while (res > 0);
+	dev->rbuf_pos = dev->rbuf_len;
+	return res;
 }
 
 static byte_t checksum(byte_t* data, int len)
@@ -161,7 +205,7 @@ static int command_ext(uirt2_t* dev, const byte_t* in, byte_t* out)
 	log_trace("writing command %02x", buf[0]);
 
 	hexdump("Command: ", tmp, len + 2);
-	res = write(dev->fd, tmp, len + 2);
+	res = tty_write_buf(dev->fd, tmp, len + 2);
 
 	if (res < len + 2) {
 		log_error("uirt2_raw: couldn't write command");
@@ -170,12 +214,12 @@ static int command_ext(uirt2_t* dev, const byte_t* in, byte_t* out)
 
 	log_trace("wrote %d", res);
 
-	if (!mywaitfordata(dev, (long)1000000)) {
+	if (dev->rbuf_pos == dev->rbuf_len && rbuf_fill(dev, 1000) <= 0) {
 		log_error("uirt2_raw: did not receive results");
 		return -1;
 	}
 
-	res = readagain(dev->fd, out + 1, out[0]);
+	res = rbuf_read(dev, out + 1, out[0]);
 
 	if (res < out[0]) {
 		log_error("uirt2_raw: couldn't read command result");
@@ -276,7 +320,8 @@ uirt2_t* uirt2_init(int fd)
 	dev->flags = UIRT2_MODE_UIR;
 	dev->fd = fd;
 
-	uirt2_readflush(dev, 200000);
+	tcflush(fd, TCIFLUSH);
+	uirt2_readflush(dev, FLUSH_QUIET_USEC);
 
 	if (uirt2_getversion(dev, &dev->version) < 0) {
 		free(dev);
@@ -380,7 +425,7 @@ int uirt2_getversion(uirt2_t* dev, int* version)
 	 */
 	log_trace("uirt2: detection of uirt2 failed");
 	log_trace("uirt2: trying to detect newer uirt firmware");
-	uirt2_readflush(dev, 200000);
+	uirt2_readflush(dev, FLUSH_QUIET_USEC);
 
 	out[0] = 8;
 	if (command_ext(dev, in, out) >= 0) {
@@ -488,7 +533,6 @@ int uirt2_refreshgpio(uirt2_t* dev)
 
 int uirt2_read_uir(uirt2_t* dev, byte_t* buf, int length)
 {
-	int pos = 0;
 	int res;
 
 	if (uirt2_getmode(dev) != UIRT2_MODE_UIR) {
@@ -496,19 +540,13 @@ int uirt2_read_uir(uirt2_t* dev, byte_t* buf, int length)
 		return -1;
 	}
 
-	while (1) {
-		res = readagain(dev->fd, buf + pos, 1);
-
-		if (res == -1)
-			return pos;
-
-		pos += res;
-
-		if (pos == 6)
-			break;
-	}
+	res = rbuf_read(dev, buf, 6);
+	return res == -1 ? 0 : res;
+}
 
-	return pos;
+int uirt2_read_pending(uirt2_t* dev)
+{
+	return dev->rbuf_len - dev->rbuf_pos;
 }
 
 lirc_t uirt2_read_raw(uirt2_t* dev, lirc_t timeout)
@@ -525,10 +563,11 @@ lirc_t uirt2_read_raw(uirt2_t* dev, lirc_t timeout)
 		int res;
 		byte_t b;
 
-		if (!waitfordata(timeout))
+		/* Buffered input doesn't make the fd readable. */
+		if (dev->rbuf_pos == dev->rbuf_len && !waitfordata(timeout))
 			return 0;
 
-		res = readagain(dev->fd, &b, 1);
+		res = rbuf_read(dev, &b, 1);
 
 		if (res == -1)
 			return 0;
@@ -553,7 +592,7 @@ lirc_t uirt2_read_raw(uirt2_t* dev, lirc_t timeout)
 			isdly[0] = b;
 			log_trace("dev->new_signal");
 
-			res = readagain(dev->fd, &isdly[1], 1);
+			res = rbuf_read(dev, &isdly[1], 1);
 
 			if (res == -1)
 				return 0;
@@ -620,15 +659,33 @@ int uirt2_send_struct1(uirt2_t* dev, int freq, int bRepeatCount, remstruct1_data
 		res = command(dev, (byte_t*)&rem, sizeof(rem) - 2);
 	}
 	delay = calc_struct1_length(bRepeatCount, buf);
-	gettimeofday(&dev->pre_time, NULL);
-	dev->pre_delay.tv_sec = delay / 1000000;
-	dev->pre_delay.tv_usec = delay % 1000000;
-
-	log_trace("set dev->pre_delay %lu %lu", dev->pre_delay.tv_sec, dev->pre_delay.tv_usec);
+	uirt2_set_busy(dev, delay);
 
 	return res;
 }
 
+void uirt2_set_busy(uirt2_t* dev, uint32_t usec)
+{
+	struct timeval now;
+	struct timeval end;
+	struct timeval delay;
+
+	gettimeofday(&now, NULL);
+	delay.tv_sec = usec / 1000000;
+	delay.tv_usec = usec % 1000000;
+	if (timerisset(&dev->pre_delay)) {
+		/* Keep a later end set before. */
+		timeradd(&dev->pre_time, &dev->pre_delay, &end);
+		timersub(&end, &now, &end);
+		if (timercmp(&end, &delay, >))
+			return;
+	}
+	dev->pre_time = now;
+	dev->pre_delay = delay;
+
+	log_trace("set dev->pre_delay %lu %lu", dev->pre_delay.tv_sec, dev->pre_delay.tv_usec);
+}
+
 int uirt2_calc_freq(int freq)
 {
 	if (freq > 39000)
@@ -115,6 +115,8 @@ int uirt2_getgpiocfg(uirt2_t * dev, int slot, uirt2_code_t code, int *action, in
 int uirt2_setgpio(uirt2_t * dev, int action, int duration);
 int uirt2_read_uir(uirt2_t * dev, byte_t * buf, int length);
 lirc_t uirt2_read_raw(uirt2_t * dev, lirc_t timeout);
+int uirt2_read_pending(uirt2_t * dev);
+void uirt2_set_busy(uirt2_t * dev, uint32_t usec);
 int uirt2_send_raw(uirt2_t * dev, byte_t * buf, int length);
 int uirt2_send_struct1(uirt2_t * dev, int freq, int bRepeatCount, remstruct1_data_t * buf);
 int uirt2_calc_freq(int freq);
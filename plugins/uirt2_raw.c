@@ -60,6 +60,7 @@ static int uirt2_send(struct ir_remote* remote, struct ir_ncode* code);
 static char* uirt2_raw_rec(struct ir_remote* remotes);
 static int uirt2_raw_decode(struct ir_remote* remote, struct decode_ctx_t* ctx);
 static lirc_t uirt2_raw_readdata(lirc_t timeout);
+static int uirt2_raw_rec_pending(void);
 
 /* forwards */
 static int uirt2_send_mode2_raw(uirt2_t* dev, struct ir_remote* remote, const lirc_t* buf, int length);
@@ -85,10 +86,11 @@ const struct driver hw_uirt2_raw = {
 	.decode_func	= uirt2_raw_decode,
 	.drvctl_func	= NULL,
 	.readdata	= uirt2_raw_readdata,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "/dev/tty[0-9]*",
+	.rec_pending	= uirt2_raw_rec_pending,
 };
 
 const struct driver hw_usb_uirt_raw = {
@@ -107,10 +109,11 @@ const struct driver hw_usb_uirt_raw = {
 	.decode_func	= uirt2_raw_decode,
 	.drvctl_func	= NULL,
 	.readdata	= uirt2_raw_readdata,
-	.api_version	= 3,
+	.api_version	= 4,
 	.driver_version = "0.9.3",
 	.info		= "No info available",
 	.device_hint    = "/dev/tty[0-9]*",
+	.rec_pending	= uirt2_raw_rec_pending,
 };
 
 const struct driver* hardwares[] = { &hw_usb_uirt_raw, &hw_uirt2_raw, NULL };
@@ -192,6 +195,14 @@ static lirc_t uirt2_raw_readdata(lirc_t timeout)
 	return data;
 }
 
+/* Input read from the tty is buffered, lircd must not wait on fd. */
+static int uirt2_raw_rec_pending(void)
+{
+	if (dev == NULL)
+		return 0;
+	return !queue_is_empty() || uirt2_read_pending(dev) > 0;
+}
+
 static int uirt2_raw_init(void)
 {
 	int version;
@@ -279,6 +290,8 @@ static int uirt2_raw_deinit(void)
 {
 	int version;
 
+	if (dev == NULL)
+		return 1;       /* Not initialized, or already closed. */
 	if (uirt2_setmodeuir(dev) < 0)
 		log_warn("uirt2_raw: could not set uir mode");
 	if (uirt2_getversion(dev, &version) >= 0 && version >= 0x0905)
@@ -346,18 +359,18 @@ static int uirt2_send(struct ir_remote* remote, struct ir_ncode* code)
 		log_trace("uirt2_send: succeeded");
 	}
 	/*
-	 * Some devices send the sequence in the background.  Wait for
-	 * the sequence to complete before returning in order to avoid
-	 * disturbing DTR which is used by certain hardware revisions
+	 * Some devices send the sequence in the background.  Don't send
+	 * the next command until the sequence is complete, in order to
+	 * avoid disturbing DTR which is used by certain hardware revisions
 	 * to enable the builtin emitter.  We wait 1.1 times the expected
 	 * time in order to handle any differences between the device and
-	 * our clock.
+	 * our clock.  Receiving goes on meanwhile.
 	 */
 	delay = remote->min_remaining_gap;
 	for (i = 0; i < length; i++)
 		delay += signals[i];
 	delay = (delay * 11) / 10;
-	usleep(delay);
+	uirt2_set_busy(dev, delay);
 
 	return res;
 }
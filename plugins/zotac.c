@@ -15,8 +15,6 @@
 #endif
 
 #include <stdio.h>
-#include <poll.h>
-#include <pthread.h>
 #include <sys/fcntl.h>
 #include <signal.h>
 #include <linux/hiddev.h>
@@ -33,7 +31,7 @@ static int zotac_init(void);
 static int zotac_deinit(void);
 static char* zotac_rec(struct ir_remote* remotes);
 static int zotac_decode(struct ir_remote* remote, struct decode_ctx_t* ctx);
-static void* zotac_repeat(void* arg);
+static char* zotac_repeat(struct ir_remote* remotes);
 static int zotac_getcode(void);
 static int drvctl_func(unsigned int cmd, void* arg);
 
@@ -43,19 +41,15 @@ static const logchannel_t logchannel = LOG_DRIVER;
 const unsigned max_repeat_count = 500;
 /** Code that triggers key release */
 const unsigned release_code = 0x00000000;
-/** Code that triggers device remove  */
-const unsigned remove_code = 0x00FFFFFF;
 /** Time to wait before first repetition */
 const unsigned repeat_time1_us = 500000;
 /** Time to wait between two repetitions */
 const unsigned repeat_time2_us = 100000;
-/** Pipe between main thread and repetition thread */
-static int fd_pipe[2] = { -1, -1 };
 
-/** Thread that simulates repetitions */
-static pthread_t repeat_thread;
 /** File descriptor for the real device */
-static int fd_hidraw;
+static int fd_hidraw = -1;
+/** Repetitions simulated since the key was pressed */
+static unsigned repeat_count = 0;
 
 const int main_code_length = 32;
 static signed int main_code = 0;
@@ -289,119 +283,47 @@ static int zotac_init(void)
 	}
 	int flags = HIDDEV_FLAG_UREF | HIDDEV_FLAG_REPORT;
 
-	if (ioctl(fd_hidraw, HIDIOCSFLAG, &flags))
-		return 0;
-	drv.fd = fd_hidraw;
-
-	/* Create pipe so that events sent by the repeat thread will
-	 * trigger main thread */
-	if (pipe(fd_pipe) != 0) {
-		log_perror_err("couldn't open pipe");
+	if (ioctl(fd_hidraw, HIDIOCSFLAG, &flags)) {
 		close(fd_hidraw);
+		fd_hidraw = -1;
 		return 0;
 	}
-	drv.fd = fd_pipe[0];
-	/* Create thread to simulate repetitions */
-	if (pthread_create(&repeat_thread, NULL, zotac_repeat, NULL)) {
-		log_error("Could not create \"repeat thread\"");
-		return 0;
-	}
+	drv.fd = fd_hidraw;
 	return 1;
 }
 
 static int zotac_deinit(void)
 {
-	pthread_cancel(repeat_thread);
+	drv_timer_cancel();
 	if (fd_hidraw != -1) {
 		// Close device if it is open
 		log_info("closing '%s'", drv.device);
 		close(fd_hidraw);
 		fd_hidraw = -1;
 	}
-	// Close pipe input
-	if (fd_pipe[1] >= 0) {
-		close(fd_pipe[1]);
-		fd_pipe[1] = -1;
-	}
-	// Close pipe output
-	if (fd_pipe[0] >= 0) {
-		close(fd_pipe[0]);
-		fd_pipe[0] = -1;
-	}
 	drv.fd = -1;
 	return 1;
 }
 
 /**
- *	Runtime that reads device, forwards codes to main thread
- *	and simulates repetitions.
+ *	Driver timer callback simulating a repetition of the key held
+ *	down, re-armed until the release report.
  */
-static void* zotac_repeat(void* arg)
+static char* zotac_repeat(struct ir_remote* remotes)
 {
-	int repeat_count = 0;
-	unsigned current_code;
-	int ret;
-	int sel;
-	int delay_ms = 0;
-	int pressed = 0;
-	int fd = fd_pipe[1];
-	struct pollfd pfd = {.fd = fd_hidraw, .events = POLLIN, .revents = 0};
-
-	while (1) {
-		// Initialize set to monitor device's events
-		if (pressed)
-			sel = curl_poll(&pfd, 1, delay_ms);
-		else
-			sel = curl_poll(&pfd, 1, 0);
-		switch (sel) {
-		case 1:
-			// Data ready in device's file
-			ret = zotac_getcode();
-
-			if (ret < 0) {
-				// Error
-				log_error("(%s) Could not read %s", __func__, drv.device);
-				goto exit_loop;
-			}
-			if (ret == 1) {
-				// Key code : forward it to main thread
-				pressed = 1;
-				repeat_count = 0;
-				delay_ms = repeat_time1_us / 1000;
-				current_code = probe_code;
-			} else if (ret == 2) {
-				// Release code : stop repetitions
-				pressed = 0;
-				current_code = release_code;
-			} else if (ret == 0) {
-				continue;
-			}
-			break;
-		case 0:
-			repeat_count++;
-			if (repeat_count >= max_repeat_count) {
-				// Too many repetitions, something must have gone wrong
-				log_error("(%s) too many repetitions", __func__);
-				goto exit_loop;
-			}
-			// Timeout : send current_code again to main
-			//           thread to simulate repetition
-			delay_ms = repeat_time2_us / 1000;
-			break;
-		default:
-			// Error
-			log_error("(%s) curl_poll() failed", __func__);
-			goto exit_loop;
-		}
-		// Send code to main thread through pipe
-		chk_write(fd, &current_code, sizeof(current_code));
+	repeat_count++;
+	if (repeat_count >= max_repeat_count) {
+		// Too many repetitions, something must have gone wrong
+		log_error("(%s) too many repetitions", __func__);
+		zotac_deinit();
+		return NULL;
 	}
-exit_loop:
-
-	// Wake up main thread with special key code
-	current_code = remove_code;
-	chk_write(fd, &current_code, sizeof(current_code));
-	return NULL;
+	drv_timer_set(repeat_time2_us, zotac_repeat);
+	last = end;
+	gettimeofday(&start, NULL);
+	repeat_state = RPT_YES;
+	gettimeofday(&end, NULL);
+	return decode_all(remotes);
 }
 
 /*
@@ -411,29 +333,27 @@ exit_loop:
 static char* zotac_rec(struct ir_remote* remotes)
 {
 	unsigned ev;
-	int rd;
+	int ret;
 
 	last = end;
 	gettimeofday(&start, NULL);
-	rd = read(drv.fd, &ev, sizeof(ev));
+	ret = zotac_getcode();
 
-	if (rd == -1) {
-		// Error
-		log_error("(%s) could not read pipe", __func__);
-		zotac_deinit();
+	if (ret < 0) {
+		// Error, the device is closed
+		log_error("(%s) Could not read %s", __func__, drv.device);
 		return 0;
 	}
-
-	if (ev == release_code) {
-		// Release code
+	if (ret == 2) {
+		// Release code : stop repetitions
+		drv_timer_cancel();
 		main_code = 0;
 		return 0;
-	} else if (ev == remove_code) {
-		// Device has been removed
-		zotac_deinit();
+	} else if (ret != 1) {
 		return 0;
 	}
 
+	ev = probe_code;
 	log_trace("zotac : %x", ev);
 	// Record the code and check for repetition
 	if (main_code == ev) {
@@ -442,6 +362,8 @@ static char* zotac_rec(struct ir_remote* remotes)
 		main_code = ev;
 		repeat_state = RPT_NO;
 	}
+	repeat_count = 0;
+	drv_timer_set(repeat_time1_us, zotac_repeat);
 	gettimeofday(&end, NULL);
 	return decode_all(remotes);
 }
@@ -8,6 +8,7 @@ from .client import get_default_lircrc_path
 from .client import get_default_socket_path
 
 from .async_client import AsyncConnection
+from .async_client import AsyncCommandConnection
 from .client import TimeoutException
 from .client import RawConnection
 from .client import CommandConnection
@@ -23,7 +24,9 @@ from .client import SetLogCommand
 from .client import SetTransmittersCommand
 from .client import SimulateCommand
 from .client import StartRepeatCommand
+from .client import SubscribeCommand
 from .client import StopRepeatCommand
+from .client import TimingCommand
 from .client import VersionCommand
 
 from lirc._client import lirc_deinit            # pylint: disable=no-name-in-module
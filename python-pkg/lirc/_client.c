@@ -1,5 +1,10 @@
 #include <Python.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include "lirc_client.h"
+#include "event_record.h"
 
 /**
  *  @file _client.c
@@ -13,6 +18,15 @@
 
 static const char* const LIRCRC_ID = "lircd.lircrc";
 
+/** Max number of strings returned for one code. */
+#define MAX_STRINGS	10
+
+/**
+ * Serializes the lirc_client calls made without the GIL, the library
+ * keeps global state.
+ */
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 /** @see: lirc_init() */
 static PyObject* client_lirc_init(PyObject *self, PyObject *args)
@@ -53,6 +67,7 @@ static PyObject* client_lirc_readconfig(PyObject *self, PyObject *args)
 	struct lirc_config* config;
 	PyObject* lircrc;
 	char text[128];
+	int r;
 
 	if (!PyArg_ParseTuple(args, "s", &path))
 		return NULL;
@@ -61,7 +76,12 @@ static PyObject* client_lirc_readconfig(PyObject *self, PyObject *args)
 		PyErr_SetString(PyExc_RuntimeError, text);
 		return NULL;
 	}
-	if (lirc_readconfig(path, &config, NULL) != 0) {
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&client_lock);
+	r = lirc_readconfig(path, &config, NULL);
+	pthread_mutex_unlock(&client_lock);
+	Py_END_ALLOW_THREADS
+	if (r != 0) {
 		PyErr_SetString(PyExc_RuntimeError,
 				"Cannot parse lircrc file");
 		return NULL;
@@ -85,6 +105,64 @@ static PyObject* client_lirc_freeconfig(PyObject *self, PyObject *args)
 }
 
 
+static void free_strings(char** strings, int count)
+{
+	while (count-- > 0)
+		free(strings[count]);
+}
+
+
+/**
+ * Translate code, storing copies of the resulting strings. Called
+ * without the GIL, holding client_lock.
+ * @return Number of strings stored, -1 if out of memory.
+ */
+static int translate(struct lirc_config* config, char* code,
+		     char* strings[MAX_STRINGS])
+{
+	char* s;
+	int i;
+
+	for (i = 0; i < MAX_STRINGS; i += 1) {
+		if (lirc_code2char(config, code, &s) != 0 || s == NULL || !*s)
+			break;
+		strings[i] = strdup(s);
+		if (strings[i] == NULL) {
+			free_strings(strings, i);
+			return -1;
+		}
+	}
+	return i;
+}
+
+
+/** Move count translated strings to list, always freeing them. */
+static int append_strings(PyObject* list, char** strings, int count)
+{
+	PyObject* string;
+	int r = 0;
+	int i;
+
+	for (i = 0; i < count; i += 1) {
+		if (r == 0) {
+			string = Py_BuildValue("s", strings[i]);
+			if (!string) {
+				PyErr_SetString(PyExc_RuntimeError,
+						"Cannot decode string");
+				r = -1;
+			} else if (PyList_Append(list, string) == -1) {
+				PyErr_SetString(PyExc_RuntimeError,
+						"Cannot append string");
+				r = -1;
+			}
+			Py_XDECREF(string);
+		}
+		free(strings[i]);
+	}
+	return r;
+}
+
+
 /**
  * @return: A possibly empty list of all decoded items.
  * @see: lirc_code2char().
@@ -96,41 +174,506 @@ static PyObject* client_lirc_code2char(PyObject *self, PyObject *args)
 	char* code;
 
 	struct lirc_config* config;
-	char* s;
-	int i;
-	int r;
-	PyObject* list = PyList_New(0);
-	PyObject* string;
+	char* strings[MAX_STRINGS];
+	int count;
+	PyObject* list;
 
 	if (!PyArg_ParseTuple(args, "Oss", &lircrc, &program, &code)) {
 		PyErr_SetString(PyExc_RuntimeError, "Cannot parse arguments");
 		return NULL;
 	}
 	config = PyCapsule_GetPointer(lircrc, LIRCRC_ID);
-	for (i = 0; i < 10; i += 1) {
-		r = lirc_code2char(config, code, &s);
-		if (r != 0 || s == NULL || !*s)
+	if (config == NULL)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&client_lock);
+	count = translate(config, code, strings);
+	pthread_mutex_unlock(&client_lock);
+	Py_END_ALLOW_THREADS
+	if (count < 0)
+		return PyErr_NoMemory();
+	list = PyList_New(0);
+	if (list == NULL || append_strings(list, strings, count) != 0) {
+		Py_XDECREF(list);
+		return NULL;
+	}
+	return list;
+}
+
+
+/**
+ * Translate a sequence of codes in one call.
+ * @return: A possibly empty list of all decoded items, in order.
+ * @see: lirc_code2char().
+ */
+static PyObject* client_code2char_many(PyObject *self, PyObject *args)
+{
+	PyObject* lircrc;
+	char* program;
+	PyObject* codes;
+
+	struct lirc_config* config;
+	PyObject* seq;
+	PyObject* list = NULL;
+	const char** cstrings = NULL;
+	char** strings = NULL;
+	char** item;
+	int* counts = NULL;
+	Py_ssize_t n;
+	Py_ssize_t i;
+	int nomem = 0;
+
+	if (!PyArg_ParseTuple(args, "OsO", &lircrc, &program, &codes)) {
+		PyErr_SetString(PyExc_RuntimeError, "Cannot parse arguments");
+		return NULL;
+	}
+	config = PyCapsule_GetPointer(lircrc, LIRCRC_ID);
+	if (config == NULL)
+		return NULL;
+	seq = PySequence_Fast(codes, "codes must be a sequence");
+	if (seq == NULL)
+		return NULL;
+	n = PySequence_Fast_GET_SIZE(seq);
+	cstrings = PyMem_Calloc(n + 1, sizeof(char*));
+	strings = PyMem_Calloc((n + 1) * MAX_STRINGS, sizeof(char*));
+	counts = PyMem_Calloc(n + 1, sizeof(int));
+	if (cstrings == NULL || strings == NULL || counts == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (i = 0; i < n; i += 1) {
+		cstrings[i] =
+			PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i));
+		if (cstrings[i] == NULL)
+			goto out;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&client_lock);
+	for (i = 0; i < n && !nomem; i += 1) {
+		counts[i] = translate(config, (char*)cstrings[i],
+				      &strings[i * MAX_STRINGS]);
+		if (counts[i] < 0) {
+			counts[i] = 0;
+			nomem = 1;
+		}
+	}
+	pthread_mutex_unlock(&client_lock);
+	Py_END_ALLOW_THREADS
+	list = PyList_New(0);
+	for (i = 0; i < n; i += 1) {
+		item = &strings[i * MAX_STRINGS];
+		if (list == NULL)
+			free_strings(item, counts[i]);
+		else if (append_strings(list, item, counts[i]) != 0)
+			Py_CLEAR(list);
+	}
+	if (nomem) {
+		Py_CLEAR(list);
+		PyErr_NoMemory();
+	}
+out:
+	PyMem_Free(counts);
+	PyMem_Free(strings);
+	PyMem_Free(cstrings);
+	Py_DECREF(seq);
+	return list;
+}
+
+
+/**
+ * Buffered reader splitting lircd output into lines, and parsing them
+ * into (code, reps, button, remote) tuples. Lines are consumed by moving
+ * the head offset, the buffer is compacted only when refilled.
+ *
+ * After set_binary(), the buffer holds event_record.h records. These
+ * are decoded when read into items, the events being tuples made of
+ * the interned names, and the TEXT lines being str.
+ */
+typedef struct {
+	PyObject_HEAD
+	char*	buf;
+	size_t	size;
+	size_t	head;           /**< First unconsumed byte. */
+	size_t	len;            /**< Unconsumed bytes. */
+	int		binary;
+	PyObject*	names;          /**< Binary: list of str by id. */
+	PyObject*	items;          /**< Binary: list of decoded lines. */
+	Py_ssize_t	item_head;      /**< First unconsumed item. */
+	char		text[PACKET_SIZE + 1];  /**< Binary: partial line. */
+	size_t		text_len;
+} LineReader;
+
+
+static const size_t RECV_SIZE = 4096;
+
+
+static void reader_dealloc(LineReader* self)
+{
+	Py_XDECREF(self->names);
+	Py_XDECREF(self->items);
+	free(self->buf);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+/** Return the length of the next line excluding newline, or -1. */
+static Py_ssize_t reader_next_line(const LineReader* self)
+{
+	const char* nl;
+
+	if (self->len == 0)
+		return -1;
+	nl = memchr(self->buf + self->head, '\n', self->len);
+	return nl == NULL ? -1 : nl - (self->buf + self->head);
+}
+
+
+static void reader_consume(LineReader* self, size_t n)
+{
+	self->head += n;
+	self->len -= n;
+	if (self->len == 0)
+		self->head = 0;
+}
+
+
+/** Append the lines in the payload of a TEXT record to items. */
+static int reader_text(LineReader* self, const char* data, size_t size)
+{
+	PyObject* line;
+	size_t i;
+	int r;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] != '\n') {
+			if (self->text_len < PACKET_SIZE)
+				self->text[self->text_len++] = data[i];
+			continue;
+		}
+		line = PyUnicode_DecodeASCII(self->text, self->text_len,
+					     "ignore");
+		self->text_len = 0;
+		if (line == NULL)
+			return -1;
+		r = PyList_Append(self->items, line);
+		Py_DECREF(line);
+		if (r == -1)
+			return -1;
+	}
+	return 0;
+}
+
+
+/** Store the name in a NAME record. */
+static int reader_name(LineReader* self, const struct lirc_record* rec,
+		       const char* payload)
+{
+	PyObject* name;
+
+	while (PyList_GET_SIZE(self->names) <= rec->remote) {
+		if (PyList_Append(self->names, Py_None) == -1)
+			return -1;
+	}
+	name = PyUnicode_DecodeASCII(payload, rec->size, "ignore");
+	if (name == NULL)
+		return -1;
+	return PyList_SetItem(self->names, rec->remote, name);
+}
+
+
+/** Append the (code, reps, button, remote) of an EVENT record. */
+static int reader_event(LineReader* self, const struct lirc_record* rec)
+{
+	PyObject* button;
+	PyObject* remote;
+	PyObject* event;
+	int r;
+
+	if (rec->button >= PyList_GET_SIZE(self->names)
+	    || rec->remote >= PyList_GET_SIZE(self->names))
+		return 0;
+	button = PyList_GET_ITEM(self->names, rec->button);
+	remote = PyList_GET_ITEM(self->names, rec->remote);
+	if (button == Py_None || remote == Py_None)
+		return 0;
+	event = Py_BuildValue("(KIOO)", (unsigned long long)rec->code,
+			      (unsigned int)rec->reps, button, remote);
+	if (event == NULL)
+		return -1;
+	r = PyList_Append(self->items, event);
+	Py_DECREF(event);
+	return r;
+}
+
+
+/** Decode all complete records in buf into items. */
+static int reader_decode(LineReader* self)
+{
+	struct lirc_record rec;
+	const char* payload;
+	size_t size;
+	int r = 0;
+
+	while (r == 0) {
+		size = lirc_record_get(self->buf + self->head, self->len,
+				       &rec);
+		if (size == 0)
+			break;
+		payload = self->buf + self->head + sizeof(rec);
+		switch (rec.type) {
+		case LIRC_RECORD_EVENT:
+			r = reader_event(self, &rec);
+			break;
+		case LIRC_RECORD_NAME:
+			r = reader_name(self, &rec, payload);
+			break;
+		case LIRC_RECORD_RESET:
+			if (rec.code != LIRC_RECORD_MAGIC) {
+				PyErr_SetString(PyExc_ValueError,
+						"Bad binary reset record");
+				return -1;
+			}
+			r = PyList_SetSlice(self->names, 0,
+					    PyList_GET_SIZE(self->names),
+					    NULL);
 			break;
-		string = Py_BuildValue("s", s);
-		if (!string) {
-			PyErr_SetString(
-				PyExc_RuntimeError, "Cannot decode string");
+		case LIRC_RECORD_TEXT:
+			r = reader_text(self, payload, rec.size);
+			break;
+		default:
+			break;
+		}
+		reader_consume(self, size);
+	}
+	return r;
+}
+
+
+/** Drop the consumed items. */
+static int reader_items_compact(LineReader* self)
+{
+	Py_ssize_t head = self->item_head;
+
+	self->item_head = 0;
+	return PyList_SetSlice(self->items, 0, head, NULL);
+}
+
+
+/**
+ * set_binary(): the rest of the input are binary records, the BINARY
+ * reply being consumed.
+ */
+static PyObject* reader_set_binary(LineReader* self, PyObject* args)
+{
+	if (self->binary)
+		Py_RETURN_NONE;
+	self->names = PyList_New(0);
+	self->items = PyList_New(0);
+	if (self->names == NULL || self->items == NULL)
+		return NULL;
+	self->binary = 1;
+	if (reader_decode(self) == -1)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+
+/** fill(fd): recv() once from fd, return number of bytes, 0 on EOF. */
+static PyObject* reader_fill(LineReader* self, PyObject* args)
+{
+	int fd;
+	ssize_t r;
+	char* p;
+
+	if (!PyArg_ParseTuple(args, "i", &fd))
+		return NULL;
+	if (self->head > 0) {
+		memmove(self->buf, self->buf + self->head, self->len);
+		self->head = 0;
+	}
+	if (self->size - self->len < RECV_SIZE) {
+		p = realloc(self->buf, self->len + RECV_SIZE);
+		if (p == NULL)
+			return PyErr_NoMemory();
+		self->buf = p;
+		self->size = self->len + RECV_SIZE;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	r = recv(fd, self->buf + self->len, self->size - self->len, 0);
+	Py_END_ALLOW_THREADS
+	if (r == -1)
+		return PyErr_SetFromErrno(PyExc_OSError);
+	self->len += r;
+	if (self->binary && reader_decode(self) == -1)
+		return NULL;
+	return Py_BuildValue("n", (Py_ssize_t)r);
+}
+
+
+/** has_line(): True if a complete line is buffered. */
+static PyObject* reader_has_line(LineReader* self, PyObject* args)
+{
+	if (self->binary)
+		return PyBool_FromLong(
+			PyList_GET_SIZE(self->items) > self->item_head);
+	return PyBool_FromLong(reader_next_line(self) != -1);
+}
+
+
+/** readline(): Next complete line without newline, or None. */
+static PyObject* reader_readline(LineReader* self, PyObject* args)
+{
+	Py_ssize_t len = reader_next_line(self);
+	char text[2 * PACKET_SIZE + 24];
+	unsigned long long code;
+	unsigned int reps;
+	PyObject* button;
+	PyObject* remote;
+	PyObject* line;
+
+	if (self->binary) {
+		if (PyList_GET_SIZE(self->items) == self->item_head)
+			Py_RETURN_NONE;
+		line = PyList_GET_ITEM(self->items, self->item_head);
+		self->item_head += 1;
+		if (PyTuple_Check(line)) {
+			if (!PyArg_ParseTuple(line, "KIOO",
+					      &code, &reps, &button, &remote))
+				return NULL;
+			snprintf(text, sizeof(text), "%016llx %02x %s %s",
+				 code, reps, PyUnicode_AsUTF8(button),
+				 PyUnicode_AsUTF8(remote));
+			line = PyUnicode_FromString(text);
+		} else {
+			Py_INCREF(line);
+		}
+		if (PyList_GET_SIZE(self->items) == self->item_head
+		    && reader_items_compact(self) == -1) {
+			Py_XDECREF(line);
+			return NULL;
+		}
+		return line;
+	}
+	if (len == -1)
+		Py_RETURN_NONE;
+	line = PyUnicode_DecodeASCII(self->buf + self->head, len, "ignore");
+	if (line != NULL)
+		reader_consume(self, len + 1);
+	return line;
+}
+
+
+/** Parse a "code reps button remote" line, NULL if it isn't one. */
+static PyObject* parse_event(const char* line, Py_ssize_t len)
+{
+	char text[PACKET_SIZE + 1];
+	unsigned long long code;
+	unsigned long reps;
+	char* button;
+	char* remote;
+	char* end;
+
+	if (len > PACKET_SIZE)
+		return NULL;
+	memcpy(text, line, len);
+	text[len] = '\0';
+	if (len > 0 && text[len - 1] == '\r')
+		text[len - 1] = '\0';
+	code = strtoull(text, &end, 16);
+	if (end == text || *end != ' ')
+		return NULL;
+	reps = strtoul(end + 1, &end, 16);
+	if (*end != ' ')
+		return NULL;
+	button = end + 1;
+	remote = strchr(button, ' ');
+	if (remote == NULL || remote == button || remote[1] == '\0')
+		return NULL;
+	*remote++ = '\0';
+	return Py_BuildValue("(Kkss)", code, reps, button, remote);
+}
+
+
+/**
+ * events(): Parse and consume all complete lines, return a possibly
+ * empty list of (code, reps, button, remote) tuples. Lines which are
+ * not button presses, e. g. SIGHUP, are skipped.
+ */
+static PyObject* reader_events(LineReader* self, PyObject* args)
+{
+	PyObject* list = PyList_New(0);
+	PyObject* event;
+	Py_ssize_t len;
+	Py_ssize_t i;
+
+	if (list == NULL)
+		return NULL;
+	if (self->binary) {
+		/* The tuples are already made, TEXT lines are skipped. */
+		for (i = self->item_head; i < PyList_GET_SIZE(self->items); i++) {
+			event = PyList_GET_ITEM(self->items, i);
+			if (PyTuple_Check(event)
+			    && PyList_Append(list, event) == -1) {
+				Py_DECREF(list);
+				return NULL;
+			}
+		}
+		self->item_head = i;
+		if (reader_items_compact(self) == -1) {
 			Py_DECREF(list);
 			return NULL;
 		}
-		if (PyList_Append(list, string) == -1) {
-			PyErr_SetString(PyExc_RuntimeError,
-					"Cannot append string");
-			Py_DECREF(string);
+		return list;
+	}
+	while ((len = reader_next_line(self)) != -1) {
+		event = parse_event(self->buf + self->head, len);
+		reader_consume(self, len + 1);
+		if (event == NULL) {
+			if (PyErr_Occurred()) {
+				Py_DECREF(list);
+				return NULL;
+			}
+			continue;
+		}
+		if (PyList_Append(list, event) == -1) {
+			Py_DECREF(event);
 			Py_DECREF(list);
 			return NULL;
 		}
-		Py_DECREF(string);
+		Py_DECREF(event);
 	}
 	return list;
 }
 
 
+static PyMethodDef LineReaderMethods[] = {
+	{"fill", (PyCFunction)reader_fill, METH_VARARGS,
+		"recv() once from fd, return bytes read, 0 on EOF"},
+	{"has_line", (PyCFunction)reader_has_line, METH_NOARGS,
+		"Return True if a complete line is buffered"},
+	{"readline", (PyCFunction)reader_readline, METH_NOARGS,
+		"Return next line without newline, or None"},
+	{"events", (PyCFunction)reader_events, METH_NOARGS,
+		"Return all buffered (code, reps, button, remote) tuples"},
+	{"set_binary", (PyCFunction)reader_set_binary, METH_NOARGS,
+		"Read binary records from now on, see lircd BINARY"},
+	{0}
+};
+
+
+static PyTypeObject LineReaderType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "_client.LineReader",
+	.tp_doc = "Buffered lircd output line reader and parser",
+	.tp_basicsize = sizeof(LineReader),
+	.tp_itemsize = 0,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_dealloc = (destructor)reader_dealloc,
+	.tp_methods = LineReaderMethods,
+};
+
+
 PyMethodDef ClientMethods[] = {
 	{"lirc_init",  client_lirc_init, METH_VARARGS,
 		"initiate lirc connection"},
@@ -142,6 +685,8 @@ PyMethodDef ClientMethods[] = {
 		"Deallocate memory obtained using lirc_readconfig()"},
 	{"lirc_code2char", client_lirc_code2char, METH_VARARGS,
 		"lircrc-translate a keypress"},
+	{"code2char_many", client_code2char_many, METH_VARARGS,
+		"lircrc-translate a list of keypresses"},
 	{0}
 };
 
@@ -157,5 +702,19 @@ static struct PyModuleDef clientmodule = {
 
 PyMODINIT_FUNC PyInit__client(void)
 {
-	return PyModule_Create(&clientmodule);
+	PyObject* module;
+
+	if (PyType_Ready(&LineReaderType) < 0)
+		return NULL;
+	module = PyModule_Create(&clientmodule);
+	if (module == NULL)
+		return NULL;
+	Py_INCREF(&LineReaderType);
+	if (PyModule_AddObject(module, "LineReader",
+			       (PyObject*)&LineReaderType) < 0) {
+		Py_DECREF(&LineReaderType);
+		Py_DECREF(module);
+		return NULL;
+	}
+	return module;
 }
@@ -36,11 +36,37 @@
 #
 #   Using a LircdConnection with translated values works the same way.
 #   The API is unstable.
+#
+#
+#   Asynchronous commands
+#   ---------------------
+#
+#   AsyncCommandConnection sends commands without waiting for the
+#   replies of earlier ones, so many commands are in flight on one
+#   connection. lircd replies in order, each reply completing the oldest
+#   pending command:
+#
+#          async def list_all(raw_conn, loop):
+#              async with AsyncCommandConnection(raw_conn, loop) as conn:
+#                  remotes = await conn.list_remotes()
+#                  codes = await asyncio.gather(
+#                      *[conn.list_codes(r) for r in remotes])
+#                  return dict(zip(remotes, codes))
+#
+#          with CommandConnection(socket_path) as raw_conn:
+#              loop.run_until_complete(list_all(raw_conn, loop))
+#
+#   The remote and code lists are cached until lircd reports a SIGHUP.
 
 #   pylint: disable=W0613
 
 import asyncio
+import collections
+
 from lirc.client import AbstractConnection as AbstractConnection
+from lirc.client import CommandConnection
+from lirc.client import Command
+from lirc.client import ReplyParser
 
 
 class AsyncConnection(object):
@@ -50,33 +76,73 @@ class AsyncConnection(object):
        - connection: Typically a lirc.RawConnection or lirc.LircdConnection.
        - loop: AbstractEventLoop, typically obtained using
                asyncio.get_event_loop().
+       - maxsize: Max number of lines queued. When reached, the connection
+               is not read until the consumer catches up, leaving the
+               data in the socket. 0 means no limit.
+
+    All complete lines are read on each wakeup, so none are left in the
+    connection buffer waiting for the next one.
     '''
 
     def __init__(self, connection: AbstractConnection,
-                 loop: asyncio.AbstractEventLoop):
+                 loop: asyncio.AbstractEventLoop,
+                 maxsize: int = 1000):
 
         def read_from_fd():
-            ''' Read data from the connection fd and put into queue. '''
+            ''' Read all available lines and put them into queue. '''
+            if self._closed:
+                return
             try:
-                line = self._conn.readline(0)
-                if line:
-                    asyncio.ensure_future(self._queue.put(line))
+                while not self._is_full():
+                    line = self._conn.readline(0)
+                    if line is None:
+                        return
+                    self._queue.put_nowait(line)
+                self._pause()
             except Exception as e:
                 self.close()
                 self._queue.put_nowait(e)
 
         self._conn = connection
         self._loop = loop
-        self._queue = asyncio.Queue(loop=self._loop)
+        self._maxsize = maxsize
+        self._queue = asyncio.Queue()
+        self._reading = True
+        self._closed = False
+        self._read_from_fd = read_from_fd
         self._loop.add_reader(self._conn.fileno(), read_from_fd)
 
+    def _is_full(self) -> bool:
+        ''' Return True if the queue has reached maxsize. '''
+        return self._maxsize > 0 and self._queue.qsize() >= self._maxsize
+
+    def _pause(self):
+        ''' Stop reading the connection while the queue is full. '''
+        if self._reading:
+            self._loop.remove_reader(self._conn.fileno())
+            self._reading = False
+
+    def _resume(self):
+        ''' Read again, starting with lines already buffered. '''
+        if not (self._reading or self._closed or self._is_full()):
+            self._reading = True
+            self._loop.add_reader(self._conn.fileno(), self._read_from_fd)
+            self._loop.call_soon(self._read_from_fd)
+
+    async def _get(self):
+        ''' Return next queued item, resuming reading if paused. '''
+        item = await self._queue.get()
+        self._resume()
+        return item
+
     def close(self):
         ''' Clean up loop and the base connection. '''
         self._loop.remove_reader(self._conn.fileno())
+        self._closed = True
 
     async def readline(self) -> str:
         ''' Asynchronous get next line from the connection. '''
-        line = await self._queue.get()
+        line = await self._get()
         if isinstance(line, Exception):
             raise line
         return line
@@ -87,7 +153,7 @@ class AsyncConnection(object):
 
     async def __anext__(self):
         ''' Implement async iterator.next(). '''
-        line = await self._queue.get()
+        line = await self._get()
         if isinstance(line, Exception):
             raise StopAsyncIteration
         return line
@@ -100,4 +166,170 @@ class AsyncConnection(object):
         ''' Implement exit from "async with". '''
         self.close()
 
+
+class AsyncCommandConnection(object):
+    ''' Asynchronous, pipelined commands on top of a CommandConnection.
+
+    Parameters:
+       - connection: A lirc.CommandConnection.
+       - loop: AbstractEventLoop, typically obtained using
+               asyncio.get_event_loop().
+
+    Commands are written as soon as they are submitted. Each reply is
+    parsed by the ReplyParser of the oldest pending command, lines not
+    part of a reply such as button presses being skipped as in
+    Command.run(). SIGHUP packages in between replies are parsed as well,
+    and drop the cached remote and code lists.
+    '''
+
+    def __init__(self, connection: CommandConnection,
+                 loop: asyncio.AbstractEventLoop):
+        self._conn = connection
+        self._loop = loop
+        self._pending = collections.deque()
+        self._parser = None         # Parsing a reply, or None.
+        self._idle = False          # self._parser has no pending command.
+        self._sighups = 0           # Seen by self._parser.
+        self._output = bytearray()
+        self._writing = False
+        self._closed = False
+        self._cache = {}
+        self._loop.add_reader(self._conn.fileno(), self._read)
+
+    def _fail(self, ex: Exception):
+        ''' Fail all pending commands with ex, and stop reading. '''
+        self.close()
+        while self._pending:
+            parser, future = self._pending.popleft()
+            if not future.done():
+                future.set_exception(ex)
+
+    def _feed(self, line: str):
+        ''' Feed line to the parser of the current reply. '''
+        if self._parser is None \
+                or (self._idle and self._pending and line.strip() == 'BEGIN'):
+            # The next reply, or a SIGHUP package if none is pending.
+            self._idle = not self._pending
+            self._parser = \
+                ReplyParser() if self._idle else self._pending[0][0]
+            self._sighups = self._parser.sighups
+        parser = self._parser
+        try:
+            parser.feed(line)
+        except Exception as ex:             # pylint: disable=broad-except
+            # A bad reply fails its command, the next one goes on.
+            self._parser = None
+            if not self._idle:
+                self._pending.popleft()[1].set_exception(ex)
+            return
+        if parser.sighups != self._sighups:
+            self._sighups = parser.sighups
+            self._cache.clear()
+            if self._idle:
+                self._parser = None
+            return
+        if parser.is_completed():
+            self._parser = None
+            if not self._idle:
+                self._pending.popleft()[1].set_result(parser)
+
+    def _read(self):
+        ''' Parse all available lines. '''
+        try:
+            while not self._closed:
+                line = self._conn.readline(0)
+                if line is None:
+                    return
+                self._feed(line)
+        except Exception as ex:             # pylint: disable=broad-except
+            self._fail(ex)
+
+    def _write(self):
+        ''' Write as much output as the socket takes, without blocking. '''
+        try:
+            while self._output:
+                del self._output[:self._conn.send_nowait(self._output)]
+        except (BlockingIOError, InterruptedError):
+            if not self._writing:
+                self._loop.add_writer(self._conn.fileno(), self._write)
+                self._writing = True
+            return
+        except OSError as ex:
+            self._fail(ex)
+            return
+        if self._writing:
+            self._loop.remove_writer(self._conn.fileno())
+            self._writing = False
+
+    def submit(self, command: (str, Command)) -> asyncio.Future:
+        ''' Send command, a string or a Command, without waiting. Return
+        a future which is done with the Reply. The command string is
+        newline-terminated if it isn't already.
+        '''
+        future = self._loop.create_future()
+        if self._closed:
+            future.set_exception(ConnectionResetError('Connection closed'))
+            return future
+        if isinstance(command, Command):
+            command = command.command
+        if not command.endswith('\n'):
+            command += '\n'
+        self._pending.append((ReplyParser(), future))
+        self._output.extend(command.encode('ascii'))
+        if not self._writing:
+            self._write()
+        return future
+
+    async def run(self, command: (str, Command)):
+        ''' Send command and return its Reply. '''
+        return await self.submit(command)
+
+    async def run_all(self, commands) -> list:
+        ''' Send all commands at once, return the list of Replies. '''
+        return await asyncio.gather(*[self.submit(c) for c in commands])
+
+    async def _cached(self, command: str) -> list:
+        ''' Return the data of command's reply, cached until SIGHUP. '''
+        key = command
+        if key not in self._cache:
+            self._cache[key] = self.submit(command)
+        future = self._cache[key]
+        try:
+            reply = await asyncio.shield(future)
+        except Exception:
+            if self._cache.get(key) is future:
+                del self._cache[key]
+            raise
+        if not reply.success:
+            if self._cache.get(key) is future:
+                del self._cache[key]
+            raise ValueError('%s: %s' % (command, ' '.join(reply.data)))
+        return list(reply.data)
+
+    async def list_remotes(self) -> list:
+        ''' Return the remote names, see LIST in lircd(8). '''
+        return await self._cached('LIST')
+
+    async def list_codes(self, remote: str) -> list:
+        ''' Return the code lines of remote, see LIST in lircd(8). '''
+        return await self._cached('LIST %s' % remote)
+
+    def close(self):
+        ''' Stop using the connection, which is not closed. '''
+        if self._closed:
+            return
+        self._closed = True
+        self._loop.remove_reader(self._conn.fileno())
+        if self._writing:
+            self._loop.remove_writer(self._conn.fileno())
+            self._writing = False
+
+    async def __aenter__(self):
+        ''' Implement "async with". '''
+        return self
+
+    async def __aexit__(self, exc_type, exc, traceback):
+        ''' Implement exit from "async with". '''
+        self.close()
+
 ## @}
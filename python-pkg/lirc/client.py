@@ -13,7 +13,8 @@
 #   Sending is a pure python implementation described in @ref sending.
 #
 #   Reading data uses a C extension module, see @ref receiving. This also
-#   includes AsyncConnection with a small asynchronous interface to read data.
+#   includes AsyncConnection with a small asynchronous interface to read data
+#   and AsyncCommandConnection, running pipelined commands.
 #
 #   The otherwise undocumented file config.py, which can be imported using
 #   <i>import lirc.config</i>,  provides access to the paths defined when
@@ -214,27 +215,59 @@ class RawConnection(AbstractConnection):
         self._socket = socket.fromfd(fd, socket.AF_UNIX, socket.SOCK_STREAM)
         self._select = selectors.DefaultSelector()
         self._select.register(self._socket, selectors.EVENT_READ)
-        self._buffer = bytearray(0)
+        self._reader = _client.LineReader()
 
-    def readline(self, timeout: float = None) -> str:
-        ''' Implements AbstractConnection.readline(). '''
+    def _fill(self, timeout: float = None) -> bool:
+        ''' Wait for and read the next lines; False on timeout. '''
         if timeout:
-            start = time.clock()
-        while b'\n' not in self._buffer:
+            start = time.monotonic()
+        while not self._reader.has_line():
             ready = self._select.select(
-                start + timeout - time.clock() if timeout else timeout)
+                start + timeout - time.monotonic() if timeout else timeout)
             if ready == []:
                 if timeout:
                     raise TimeoutException(
                         "readline: no data within %f seconds" % timeout)
                 else:
-                    return None
-            recv = self._socket.recv(4096)
-            if len(recv) == 0:
+                    return False
+            if self._reader.fill(self._socket.fileno()) == 0:
                 raise ConnectionResetError('Connection lost')
-            self._buffer += recv
-        line, self._buffer = self._buffer.split(b'\n', 1)
-        return line.decode('ascii', 'ignore')
+        return True
+
+    def readline(self, timeout: float = None) -> str:
+        ''' Implements AbstractConnection.readline(). '''
+        if not self._fill(timeout):
+            return None
+        return self._reader.readline()
+
+    def read_events(self, timeout: float = None) -> list:
+        ''' Return all buffered button presses, waiting for at least one
+        line like readline(). Each item is a (code, reps, button, remote)
+        tuple, code and reps being int. The lines are parsed in C, so
+        consumers keep up with bursts of repeats. May return an empty
+        list if the lines read are not button presses.
+        '''
+        if not self._fill(timeout):
+            return []
+        return self._reader.events()
+
+    def set_binary(self, timeout: float = 1.0) -> bool:
+        ''' Make lircd send binary records, see BINARY in lircd(8).
+        readline() and read_events() then work as before, but lircd
+        does not format the events, nor are they parsed here. Lines
+        received before the reply are dropped. Returns False if lircd
+        refuses, remaining a text connection.
+        '''
+        self._socket.sendall(b'BINARY\n')
+        parser = ReplyParser()
+        while not parser.is_completed():
+            line = self.readline(timeout)
+            if line is None:
+                raise TimeoutException('No data from lircd host.')
+            parser.feed(line)
+        if parser.success:
+            self._reader.set_binary()
+        return parser.success
 
     def fileno(self) -> int:
         ''' Implements AbstractConnection.fileno(). '''
@@ -242,7 +275,7 @@ class RawConnection(AbstractConnection):
 
     def has_data(self) -> bool:
         ''' Implements AbstractConnection.has_data() '''
-        return b'\n' in self._buffer
+        return self._reader.has_line()
 
     def close(self):
         ''' Implements AbstractConnection.close() '''
@@ -287,7 +320,7 @@ class LircdConnection(AbstractConnection):
             strings = \
                 _client.lirc_code2char(self._lircrc, self._program, code)
             if not strings or len(strings) == 0:
-                if timeout == 0:
+                if timeout == 0 and not self._connection.has_data():
                     return None
                 continue
             self._buffer.extend(strings)
@@ -377,6 +410,12 @@ class CommandConnection(RawConnection):
             sent = self._socket.send(command)
             command = command[sent:]
 
+    def send_nowait(self, data: bytearray) -> int:
+        ''' Send as much of data as possible without blocking, return the
+        number of bytes sent. Raises BlockingIOError if none.
+        '''
+        return self._socket.send(data, socket.MSG_DONTWAIT)
+
 
 class Result(Enum):
     ''' Public reply parser result, available when completed. '''
@@ -395,6 +434,11 @@ class Command(object):
         self._cmd_string = cmd
         self._parser = ReplyParser()
 
+    @property
+    def command(self) -> str:
+        ''' The command string sent by run(). '''
+        return self._cmd_string
+
     def run(self, timeout: float = None):
         ''' Run the command and return a Reply. Timeout as of
         AbstractConnection.readline()
@@ -417,6 +461,7 @@ class Reply(object):
         data: List of lines, the command DATA payload.
         sighup: bool, reflects if a SIGHUP package has been received
                 (these are otherwise ignored).
+        sighups: int, number of SIGHUP packages received.
         last_line: str, last input line (for error messages).
     '''
     def __init__(self):
@@ -424,6 +469,7 @@ class Reply(object):
         self.success = None
         self.data = []
         self.sighup = False
+        self.sighups = 0
         self.last_line = ''
 
 
@@ -443,21 +489,11 @@ class ReplyParser(Reply):
     def feed(self, line: str):
         ''' Enter a line of data into parsing FSM, update state. '''
 
-        fsm = {
-            self._State.BEGIN: self._begin,
-            self._State.COMMAND: self._command,
-            self._State.RESULT: self._result,
-            self._State.DATA: self._data,
-            self._State.LINE_COUNT: self._line_count,
-            self._State.LINES: self._lines,
-            self._State.END: self._end,
-            self._State.SIGHUP_END: self._sighup_end
-        }
         line = line.strip()
         if not line:
             return
         self.last_line = line
-        fsm[self._state](line)
+        getattr(self, self._HANDLERS[self._state])(line)
         if self._state == self._State.DONE:
             self.result = Result.OK
 
@@ -480,6 +516,17 @@ class ReplyParser(Reply):
         NO_DATA = 9
         SIGHUP_END = 10
 
+    _HANDLERS = {
+        _State.BEGIN: '_begin',
+        _State.COMMAND: '_command',
+        _State.RESULT: '_result',
+        _State.DATA: '_data',
+        _State.LINE_COUNT: '_line_count',
+        _State.LINES: '_lines',
+        _State.END: '_end',
+        _State.SIGHUP_END: '_sighup_end'
+    }
+
     def _bad_packet_exception(self, line):
         self.result = Result.FAIL
         raise BadPacketException(
@@ -535,8 +582,10 @@ class ReplyParser(Reply):
 
     def _sighup_end(self, line):
         if line == 'END':
+            sighups = self.sighups + 1
             ReplyParser.__init__(self)
             self.sighup = True
+            self.sighups = sighups
         else:
             self._bad_packet_exception(line)
 
@@ -645,6 +694,34 @@ class DrvOptionCommand(Command):
         Command.__init__(self, cmd, connection)
 
 
+class TimingCommand(Command):
+    ''' Get or set the timing of a remote, see TIMING in lircd(8) manpage.
+    Without a parameter, just reply with eps, aeps and gap.
+    '''
+
+    def __init__(self, connection: AbstractConnection, remote: str,
+                 param: str = None, value: int = None):
+        cmd = 'TIMING ' + remote
+        if param:
+            cmd += ' %s %d' % (param, value)
+        Command.__init__(self, cmd + '\n', connection)
+
+
+class SubscribeCommand(Command):
+    ''' Only receive matching events, see SUBSCRIBE in lircd(8) manpage.
+    Without a remote, clear all subscriptions.
+    '''
+
+    def __init__(self, connection: AbstractConnection,
+                 remote: str = None, button: str = '*',
+                 events: str = 'all'):
+        if remote:
+            cmd = 'SUBSCRIBE %s %s %s\n' % (remote, button, events)
+        else:
+            cmd = 'SUBSCRIBE\n'
+        Command.__init__(self, cmd, connection)
+
+
 class SetLogCommand(Command):
     ''' Start/stop logging lircd output , see SET_INPUTLOG in lircd(8)
     manpage.
@@ -28,6 +28,12 @@
 # Although python cannot guarantee this, the database is designed as a
 # read-only structure.
 #
+# Parsing the YAML files takes time, so the parsed data and the indexes
+# used for lookups are cached as a pickle in $XDG_CACHE_HOME/lirc (by
+# default ~/.cache/lirc). The cache is keyed by the modification time and
+# size of all files read and the running kernel, and rebuilt silently
+# when stale or unreadable. Nothing is loaded until first used.
+#
 # A simple usage examples is doc/data2table. The lirc-setup script
 # provides a more elaborated example. Data structures are basically
 # documented in the yaml files.
@@ -37,10 +43,13 @@
 
 
 import glob
+import hashlib
 import os
 import os.path
+import pickle
 import subprocess
 import sys
+import tempfile
 
 try:
     import yaml
@@ -54,6 +63,8 @@ available as a pypi package at https://pypi.python.org/pypi/PyYAML.'''
 
 import config
 
+_CACHE_VERSION = 1
+
 
 def _here(path):
     ''' Return path added to current dir for __file__. '''
@@ -80,6 +91,99 @@ def _load_kerneldrivers(configdir):
     return drivers
 
 
+def _cache_path(configdir, yamlpath):
+    ''' Return path to the pickled database for given directories. '''
+    cachedir = os.environ.get('XDG_CACHE_HOME') or \
+        os.path.join(os.path.expanduser('~'), '.cache')
+    dirs = (os.path.abspath(configdir) + ':' + os.path.abspath(yamlpath))
+    digest = hashlib.sha1(dirs.encode('utf-8')).hexdigest()[:16]
+    return os.path.join(cachedir, 'lirc', 'database-%s.pickle' % digest)
+
+
+def _cache_key(configdir, yamlpath):
+    ''' Return a value which changes when any of the inputs changes. '''
+    paths = [os.path.join(configdir, 'kernel-drivers.yaml'),
+             os.path.join(yamlpath, 'confs_by_driver.yaml'),
+             os.path.join(yamlpath, 'drivers.yaml')]
+    paths.extend(sorted(glob.glob(configdir + '/*.conf')))
+    release = os.uname().release
+    paths.append(os.path.join('/lib/modules', release, 'modules.dep'))
+    stats = []
+    for path in paths:
+        try:
+            st = os.stat(path)
+            stats.append((path, st.st_mtime_ns, st.st_size))
+        except OSError:
+            stats.append((path, None, None))
+    return (_CACHE_VERSION, release, config.MODINFO, stats)
+
+
+def _read_cache(path, key):
+    ''' Return cached db if present and matching key, else None. '''
+    try:
+        with open(path, 'rb') as f:
+            cached = pickle.load(f)
+        if cached[0] == key:
+            return cached[1]
+    except Exception:                          # pylint: disable=broad-except
+        pass
+    return None
+
+
+def _write_cache(path, key, db):
+    ''' Atomically store db in the cache, ignoring errors. '''
+    try:
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        fd, tmp = tempfile.mkstemp(dir=os.path.dirname(path))
+        with os.fdopen(fd, 'wb') as f:
+            pickle.dump((key, db), f, pickle.HIGHEST_PROTOCOL)
+        os.replace(tmp, path)
+    except Exception:                          # pylint: disable=broad-except
+        pass
+
+
+def _load_db(configdir, yamlpath):
+    ''' Parse all yaml files and build the lookup indexes. '''
+    db = {}
+    with open(os.path.join(yamlpath, "confs_by_driver.yaml")) as f:
+        cf = yaml.load(f.read())
+    db['lircd_by_driver'] = cf['lircd_by_driver'].copy()
+    db['lircmd_by_driver'] = cf['lircmd_by_driver'].copy()
+
+    db['kernel-drivers'] = _load_kerneldrivers(configdir)
+    db['drivers'] = db['kernel-drivers'].copy()
+    with open(os.path.join(yamlpath, "drivers.yaml")) as f:
+        cf = yaml.load(f.read())
+    db['drivers'].update(cf['drivers'].copy())
+    for key, d in db['drivers'].items():
+        d['id'] = key
+        hint = d['device_hint']
+        if not hint:
+            continue
+        hint = hint.strip()
+        if hint.startswith('"') and hint.endswith('"'):
+            hint = hint[1:-1]
+            hint = hint.replace(r'\"', "@$#!")
+            hint = hint.replace('"', '')
+            hint = hint.replace("@$#!", '"')
+            hint = hint.replace("\\\\", "\\")
+        d['device_hint'] = hint
+
+    configs = {}
+    for path in sorted(glob.glob(configdir + '/*.conf')):
+        with open(path) as f:
+            cf = yaml.load(f.read())
+        configs[cf['config']['id']] = cf['config']
+    db['configs'] = configs
+
+    driver_by_remote = {}
+    for driver, files in db['lircd_by_driver'].items():
+        for remote in files:
+            driver_by_remote.setdefault(remote, driver)
+    db['driver_by_remote'] = driver_by_remote
+    return db
+
+
 class ItemLookupError(Exception):
     """A lookup failed, either too namy or no matches found. """
     pass
@@ -130,38 +234,24 @@ class Database(object):
             raise FileNotFoundError(devel_path + ':' + installed_path)
         if not yamlpath:
             yamlpath = configdir
-        db = {}
-        with open(os.path.join(yamlpath, "confs_by_driver.yaml")) as f:
-            cf = yaml.load(f.read())
-        db['lircd_by_driver'] = cf['lircd_by_driver'].copy()
-        db['lircmd_by_driver'] = cf['lircmd_by_driver'].copy()
+        self._configdir = configdir
+        self._yamlpath = yamlpath
+        self._db = None
+        self._config_index = {}
 
-        db['kernel-drivers'] = _load_kerneldrivers(configdir)
-        db['drivers'] = db['kernel-drivers'].copy()
-        with open(os.path.join(yamlpath, "drivers.yaml")) as f:
-            cf = yaml.load(f.read())
-        db['drivers'].update(cf['drivers'].copy())
-        for key, d in db['drivers'].items():
-            d['id'] = key
-            hint = d['device_hint']
-            if not hint:
-                continue
-            hint = hint.strip()
-            if hint.startswith('"') and hint.endswith('"'):
-                hint = hint[1:-1]
-                hint = hint.replace(r'\"', "@$#!")
-                hint = hint.replace('"', '')
-                hint = hint.replace("@$#!", '"')
-                hint = hint.replace("\\\\", "\\")
-            d['device_hint'] = hint
-
-        configs = {}
-        for path in glob.glob(configdir + '/*.conf'):
-            with open(path) as f:
-                cf = yaml.load(f.read())
-            configs[cf['config']['id']] = cf['config']
-        db['configs'] = configs
-        self.db = db
+    @property
+    def db(self):
+        ''' The parsed data, loaded from cache or yaml files when first
+        used.
+        '''
+        if self._db is None:
+            key = _cache_key(self._configdir, self._yamlpath)
+            path = _cache_path(self._configdir, self._yamlpath)
+            self._db = _read_cache(path, key)
+            if self._db is None:
+                self._db = _load_db(self._configdir, self._yamlpath)
+                _write_cache(path, key, self._db)
+        return self._db
 
     @property
     def kernel_drivers(self):
@@ -199,15 +289,30 @@ class Database(object):
 
     def driver_by_remote(self, remote):
         ''' Return the driver (possibly None) suggested for a remote. '''
-        for driver, files in self.db['lircd_by_driver'].items():
-            if remote in files:
-                return self.db['drivers'][driver]
-        return None
+        try:
+            return self.db['drivers'][self.db['driver_by_remote'][remote]]
+        except KeyError:
+            return None
 
     def find_config(self, key, value):
         ''' Return item (a config) in configs where config[key] == value. '''
-        found = [c for c in self.db['configs'].values()
-                 if key in c and c[key] == value]
+        if key not in self._config_index:
+            index = {}
+            for c in self.db['configs'].values():
+                if key in c:
+                    try:
+                        index.setdefault(c[key], []).append(c)
+                    except TypeError:
+                        index = None
+                        break
+            self._config_index[key] = index
+        index = self._config_index[key]
+        if index is not None:
+            found = index.get(value, []) \
+                if value.__hash__ is not None else []
+        else:
+            found = [c for c in self.db['configs'].values()
+                     if key in c and c[key] == value]
         if len(found) > 1:
             raise ItemLookupError(
                 "find_config: Too many matches for %s, %s): " % (key, value)
@@ -140,6 +140,17 @@ def _parse_commandline():
     parser_drv_option.add_argument('option', help='Option name')
     parser_drv_option.add_argument('value', help='Option value')
 
+    # Command timing
+    parser_timing = subparsers.add_parser(
+        'timing',
+        help='Get or set eps, aeps or gap of a remote')
+    parser_timing.add_argument('remote', help='Name of remote')
+    parser_timing.add_argument(
+        'param', nargs='?', choices=['eps', 'aeps', 'gap'],
+        help='Parameter to set')
+    parser_timing.add_argument(
+        'value', nargs='?', type=int, help='New value')
+
     # Command set_input_logging
     parser_set_input_log =  \
         subparsers.add_parser('set-inputlog', help='Set input logging')
@@ -226,6 +237,18 @@ def _drv_option_command(conn, args):
     return 0 if parser.success else 1
 
 
+def _timing_command(conn, args):
+    ''' Perform a "TIMING <remote> [<param> <value>]" socket command. '''
+    if args.param and args.value is None:
+        print('Missing value for ' + args.param)
+        return 2
+    command = client.TimingCommand(conn, args.remote, args.param, args.value)
+    parser = command.run(args.timeout)
+    for line in parser.data:
+        print(line)
+    return 0 if parser.success else 1
+
+
 def _list_keys_command(conn, args):
     ''' Perform a irsend LIST <remote> socket command. '''
     command = client.ListKeysCommand(conn, args.remote)
@@ -325,6 +348,8 @@ def main():
             lambda: _transmitters_cmd(conn, args),
         'driver-option':
             lambda: _drv_option_command(conn, args),
+        'timing':
+            lambda: _timing_command(conn, args),
         'version':
             lambda: _version_command(conn),
     }
@@ -3,6 +3,8 @@
 import asyncio
 import os
 import os.path
+import socket
+import struct
 import subprocess
 import sys
 import time
@@ -14,7 +16,7 @@ os.chdir(testdir)
 sys.path.insert(0, os.path.abspath(os.path.join(testdir, '..')))
 
 from lirc import RawConnection, LircdConnection, CommandConnection
-from lirc import AsyncConnection
+from lirc import AsyncConnection, AsyncCommandConnection
 import lirc
 
 import signal
@@ -134,6 +136,53 @@ class ReceiveTests(unittest.TestCase):
             self.assertEqual(lines[0], _LINE_0)
             self.assertEqual(lines[9999], _LINE_0.replace(" 00 ", " 09 "))
 
+    def testReceiveRawEvents(self):
+        ''' Receive 10000 raw lines as parsed events. '''
+
+        if os.path.exists(_SOCKET):
+            os.unlink(_SOCKET)
+        cmd = [_SOCAT, 'UNIX-LISTEN:' + _SOCKET,
+                'EXEC:"%s ./dummy-server 0"' % _EXPECT]
+        with subprocess.Popen(cmd,
+                              stdout = subprocess.PIPE,
+                              stderr = subprocess.STDOUT) as child:
+            _wait_for_socket()
+            events = []
+            with RawConnection(socket_path=_SOCKET) as conn:
+                while len(events) < 10000:
+                    events.extend(conn.read_events())
+            self.assertEqual(events[0],
+                             (0x0123456789abcdef, 0, 'KEY_1', 'mceusb'))
+            self.assertEqual(events[9999][1], 9)
+
+    def testReceiveBinaryRecords(self):
+        ''' Decode the records following a BINARY reply. '''
+
+        def record(rtype, payload=b'', remote=0, button=0, reps=0, code=0):
+            return struct.pack('<HHHHIIQQ', rtype, len(payload), remote,
+                               button, reps, 0, code, 0) + payload
+
+        event = record(1, remote=0, button=1, reps=2, code=0x0123456789abcdef)
+        data = b'BEGIN\nBINARY\nSUCCESS\nEND\n'
+        data += record(3, code=0x6c697263)
+        data += record(2, b'mceusb', remote=0) + record(2, b'KEY_1', remote=1)
+        data += event + record(4, b'BEGIN\nSIG') + record(4, b'HUP\nEND\n')
+        data += event
+        reader = lirc._client.LineReader()
+        sender, receiver = socket.socketpair()
+        with sender, receiver:
+            sender.sendall(data)
+            reader.fill(receiver.fileno())
+        for line in ['BEGIN', 'BINARY', 'SUCCESS', 'END']:
+            self.assertEqual(reader.readline(), line)
+        reader.set_binary()
+        self.assertEqual(reader.readline(), '0123456789abcdef 02 KEY_1 mceusb')
+        self.assertEqual(reader.readline(), 'BEGIN')
+        self.assertEqual(reader.readline(), 'SIGHUP')
+        self.assertEqual(reader.events(),
+                         [(0x0123456789abcdef, 2, 'KEY_1', 'mceusb')])
+        self.assertFalse(reader.has_line())
+
     def testReceiveOneLine(self):
         ''' Receive a single, translated line OK. '''
 
@@ -149,6 +198,18 @@ class ReceiveTests(unittest.TestCase):
                 line = conn.readline()
         self.assertEqual(line, 'foo-cmd')
 
+    def testCode2charMany(self):
+        ''' Translate a batch of codes in one call. '''
+
+        lircrc = lirc._client.lirc_readconfig('lircrc.conf')
+        try:
+            strings = lirc._client.code2char_many(
+                lircrc, 'foo', [_PACKET_ONE, 'ff 00 KEY_NONE none',
+                                _PACKET_ONE])
+        finally:
+            lirc._client.lirc_freeconfig(lircrc)
+        self.assertEqual(strings, ['foo-cmd', 'foo-cmd'])
+
     def testReceive1AsyncLines(self):
         ''' Receive 1000 lines using the async interface. '''
 
@@ -307,6 +368,39 @@ class CommandTests(unittest.TestCase):
             self.assertEqual(reply.success, True)
             self.assertEqual(reply.sighup, True)
 
+    def testAsyncPipelinedCommands(self):
+        ''' Pipeline commands, cache LIST until a SIGHUP. '''
+
+        async def run_commands(conn):
+            replies = await conn.run_all(['LIST', 'LIST'])
+            remotes = await conn.list_remotes()
+            cached = await conn.list_remotes()
+            stop = await conn.run(
+                lirc.StopRepeatCommand(None, 'mceusb', 'KEY_1'))
+            return replies, remotes, cached, stop
+
+        if os.path.exists(_SOCKET):
+            os.unlink(_SOCKET)
+        cmd = [_SOCAT, 'UNIX-LISTEN:' + _SOCKET,
+               'EXEC:"%s ./dummy-server 100"' % _EXPECT]
+        with subprocess.Popen(cmd,
+                              stdout = subprocess.PIPE,
+                              stderr = subprocess.STDOUT) as child:
+            _wait_for_socket()
+            with event_loop() as loop:
+                with CommandConnection(socket_path=_SOCKET) as raw_conn:
+                    conn = AsyncCommandConnection(raw_conn, loop)
+                    replies, remotes, cached, stop = \
+                        loop.run_until_complete(run_commands(conn))
+                    self.assertEqual(len(conn._cache), 0)
+                    conn.close()
+            self.assertEqual(len(replies), 2)
+            self.assertEqual(replies[1].data, ['mceusb1', 'mceusb2'])
+            self.assertEqual(remotes, ['mceusb1', 'mceusb2'])
+            self.assertEqual(cached, remotes)
+            self.assertEqual(stop.success, True)
+            self.assertEqual(stop.sighup, True)
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,193 @@
+#ifndef  ATOM_TEST
+#define  ATOM_TEST
+
+#include	<stdio.h>
+#include	<string.h>
+
+#include    <set>
+#include    <string>
+#include    <vector>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_private.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<AtomTest>( \
+                       id,  &AtomTest::func))
+
+#define     ATOM_REMOTE "\
+begin remote\n\
+  name  Atom_Remote\n\
+  bits  16\n\
+  flags SPACE_ENC\n\
+  one   560 1690\n\
+  zero  560 560\n\
+  gap   108000\n\
+  begin codes\n\
+    KEY_Atom_1    0x0001\n\
+    KEY_ATOM_2    0x0002\n\
+  end codes\n\
+end remote\n"
+
+using namespace std;
+
+/**
+ * The table of interned names, and the lookups by name using it. The
+ * table is process wide, so each test uses names of its own.
+ */
+class AtomTest : public CppUnit::TestFixture
+{
+    private:
+        static string name(const char* prefix, int i)
+        {
+            char buff[64];
+
+            snprintf(buff, sizeof(buff), "%s_%d", prefix, i);
+            return buff;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "AtomTest" );
+            ADD_TEST("testCase", testCase);
+            ADD_TEST("testSpellings", testSpellings);
+            ADD_TEST("testFind", testFind);
+            ADD_TEST("testGrow", testGrow);
+            ADD_TEST("testLookup", testLookup);
+            ADD_TEST("testNoAtom", testNoAtom);
+            return testSuite;
+        };
+
+        void testCase()
+        {
+            lirc_atom_t atom = lirc_atom_intern("AtomTest_Case");
+            uint32_t count = lirc_atom_count();
+
+            CPPUNIT_ASSERT(atom != 0);
+            CPPUNIT_ASSERT(lirc_atom_intern("AtomTest_Case") == atom);
+            /* Equal under strcasecmp(), the same atom. */
+            CPPUNIT_ASSERT(lirc_atom_intern("atomtest_case") == atom);
+            CPPUNIT_ASSERT(lirc_atom_intern("ATOMTEST_CASE") == atom);
+            CPPUNIT_ASSERT(lirc_atom_count() == count);
+            CPPUNIT_ASSERT(lirc_atom_intern("AtomTest_Case2") != atom);
+            CPPUNIT_ASSERT(lirc_atom_count() == count + 1);
+            CPPUNIT_ASSERT(lirc_atom_equal("AtomTest_Case", atom,
+                                           "ATOMTEST_CASE", 0));
+            CPPUNIT_ASSERT(!lirc_atom_equal("AtomTest_Case", atom,
+                                            "AtomTest_Case2", 0));
+        }
+
+        void testSpellings()
+        {
+            lirc_atom_t atom1;
+            lirc_atom_t atom2;
+            const char* s1 = lirc_atom_string("AtomTest_Spelling", &atom1);
+            const char* s2 = lirc_atom_string("ATOMTEST_SPELLING", &atom2);
+
+            /* One copy of each spelling, shared. */
+            CPPUNIT_ASSERT(s1 != NULL && s2 != NULL && s1 != s2);
+            CPPUNIT_ASSERT(string(s1) == "AtomTest_Spelling");
+            CPPUNIT_ASSERT(string(s2) == "ATOMTEST_SPELLING");
+            CPPUNIT_ASSERT(atom1 == atom2);
+            CPPUNIT_ASSERT(lirc_atom_string("AtomTest_Spelling", &atom2)
+                           == s1);
+        }
+
+        void testFind()
+        {
+            uint32_t count = lirc_atom_count();
+            lirc_atom_t atom;
+
+            CPPUNIT_ASSERT(lirc_atom_find("AtomTest_Find") == 0);
+            CPPUNIT_ASSERT(lirc_atom_count() == count);
+            atom = lirc_atom_intern("AtomTest_Find");
+            CPPUNIT_ASSERT(lirc_atom_find("AtomTest_Find") == atom);
+            /* Spellings never interned are found too. */
+            CPPUNIT_ASSERT(lirc_atom_find("ATOMTEST_find") == atom);
+            CPPUNIT_ASSERT(lirc_atom_find("AtomTest_Fin") == 0);
+        }
+
+        void testGrow()
+        {
+            vector<lirc_atom_t> atoms;
+            vector<const char*> strings;
+            set<lirc_atom_t> distinct;
+            lirc_atom_t atom;
+            int i;
+
+            /* Rehashed many times, names stored in several chunks. */
+            for (i = 0; i < 5000; i++) {
+                strings.push_back(lirc_atom_string(
+                    name("AtomTest_Grow_With_A_Long_Name", i).c_str(),
+                    &atom));
+                CPPUNIT_ASSERT(strings.back() != NULL);
+                atoms.push_back(atom);
+                distinct.insert(atom);
+            }
+            CPPUNIT_ASSERT(distinct.size() == 5000);
+            for (i = 0; i < 5000; i++) {
+                CPPUNIT_ASSERT(lirc_atom_find(
+                    name("ATOMTEST_GROW_WITH_A_LONG_NAME", i).c_str())
+                               == atoms[i]);
+                CPPUNIT_ASSERT(string(strings[i])
+                    == name("AtomTest_Grow_With_A_Long_Name", i));
+            }
+        }
+
+        void testLookup()
+        {
+            char text[] = ATOM_REMOTE;
+            ir_remote* remotes;
+            FILE* f;
+
+            f = fmemopen(text, strlen(text), "r");
+            CPPUNIT_ASSERT(f != NULL);
+            remotes = read_config(f, "atom.conf");
+            fclose(f);
+            CPPUNIT_ASSERT(remotes != NULL && remotes != (ir_remote*)-1);
+            CPPUNIT_ASSERT(remotes->atom != 0);
+            CPPUNIT_ASSERT(remotes->codes[0].atom
+                           == lirc_atom_find("key_atom_1"));
+            CPPUNIT_ASSERT(get_ir_remote(remotes, "ATOM_REMOTE") == remotes);
+            CPPUNIT_ASSERT(get_ir_remote(remotes, "Atom_Remote2") == NULL);
+            CPPUNIT_ASSERT(get_code_by_name(remotes, "key_atom_2")
+                           == &remotes->codes[1]);
+            CPPUNIT_ASSERT(get_code_by_name(remotes, "KEY_Atom_1")
+                           == &remotes->codes[0]);
+            /* No atom, and no code. */
+            CPPUNIT_ASSERT(get_code_by_name(remotes, "KEY_ATOM_3") == NULL);
+            free_config(remotes);
+        }
+
+        void testNoAtom()
+        {
+            char text[] = ATOM_REMOTE;
+            ir_remote* remotes;
+            FILE* f;
+
+            f = fmemopen(text, strlen(text), "r");
+            CPPUNIT_ASSERT(f != NULL);
+            remotes = read_config(f, "atom.conf");
+            fclose(f);
+            CPPUNIT_ASSERT(remotes != NULL && remotes != (ir_remote*)-1);
+            /* As built by irrecord: compared as strings. */
+            remotes->atom = 0;
+            remotes->codes[1].atom = 0;
+            CPPUNIT_ASSERT(get_ir_remote(remotes, "atom_remote") == remotes);
+            CPPUNIT_ASSERT(get_code_by_name(remotes, "Key_Atom_2")
+                           == &remotes->codes[1]);
+            CPPUNIT_ASSERT(get_code_by_name(remotes, "KEY_ATOM_1")
+                           == &remotes->codes[0]);
+            CPPUNIT_ASSERT(get_code_by_name(remotes, "KEY_ATOM_4") == NULL);
+            free_config(remotes);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
@@ -48,6 +48,7 @@ class ClientTest : public CppUnit::TestFixture
             CppUnit::TestSuite* testSuite =
                  new CppUnit::TestSuite( "ClientTest" );
             ADD_TEST("testReceive", testReceive);
+            ADD_TEST("testBinaryRing", testBinaryRing);
             ADD_TEST("testReadConfig", testReadConfig);
             ADD_TEST("testReadConfig1", testReadConfig1);
             ADD_TEST("testReadConfig2", testReadConfig2);
@@ -218,6 +219,22 @@ class ClientTest : public CppUnit::TestFixture
         };
 
 
+        void testBinaryRing()
+        {
+            char* code = NULL;
+            int status = 0;
+
+            CPPUNIT_ASSERT(lirc_set_binary() == 0);
+            CPPUNIT_ASSERT(lirc_use_ring() == 0);
+            sendCode(fd, 0x1bf3, "KEY_POWER", SEND_DELAY);
+            while (code == NULL && status == 0)
+                status = lirc_nextcode(&code);
+            CPPUNIT_ASSERT(status == 0);
+            CPPUNIT_ASSERT(string(code).find("1bf3") != string::npos);
+            free(code);
+        };
+
+
         void testReadConfigOnly()
         {
             struct lirc_config* config;
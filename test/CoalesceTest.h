@@ -0,0 +1,156 @@
+#ifndef  COALESCE_TEST
+#define  COALESCE_TEST
+
+#include	<signal.h>
+#include	<stdio.h>
+#include	<unistd.h>
+
+#include    <sstream>
+#include    <string>
+#include    <vector>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_client.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<CoalesceTest>( \
+                       id,  &CoalesceTest::func))
+
+/* A queue large enough to hold all of FILL_EVENTS unread. */
+#define     RUN_COALESCE_LIRCD "../daemons/lircd -O client_test.conf \
+                        --nodaemon --queue-size=4000000 \
+                        --logfile=var/coalesce_test.log \
+                        etc/lircd.conf.Aspire_6530G &"
+
+using namespace std;
+
+/**
+ * Repeats sent to a COALESCE client which doesn't read: send_event()
+ * may only replace the last queued message, if it is an unwritten
+ * repeat of the same button.
+ */
+class CoalesceTest : public CppUnit::TestFixture
+{
+    private:
+        /** Fills the socket buffer, so that the rest is queued. */
+        static const int FILL_EVENTS = 5000;
+
+        void simulate(int fd, unsigned code, int reps, const char* button)
+        {
+            CPPUNIT_ASSERT(lircd_simulate(fd, code, reps, button));
+        }
+
+        static string event(unsigned code, int reps, const char* button)
+        {
+            char line[128];
+
+            snprintf(line, sizeof(line), "%016x %02x %s test",
+                     code, reps, button);
+            return line;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "CoalesceTest" );
+            ADD_TEST("testCoalesce", testCoalesce);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            int pid = lircd_pid();
+
+            if (pid > 0 && kill(pid, SIGTERM) == 0)
+                usleep(100000);
+            CPPUNIT_ASSERT(system(RUN_COALESCE_LIRCD) == 0);
+            usleep(500000);
+        };
+
+        void tearDown()
+        {
+            int pid = lircd_pid();
+
+            if (pid > 0)
+                kill(pid, SIGTERM);
+            usleep(100000);
+        };
+
+        void testCoalesce()
+        {
+            vector<string> tail;
+            vector<string> expected;
+            string received;
+            string line;
+            char buff[4096];
+            int fills = 0;
+            int client;
+            int sender;
+            int i;
+
+            client = lirc_get_local_socket("var/lircd.socket", 1);
+            CPPUNIT_ASSERT(client != -1);
+            CPPUNIT_ASSERT(lircd_command(client, "COALESCE ON").find("SUCCESS")
+                           != string::npos);
+            sender = lirc_get_local_socket("var/lircd.socket", 1);
+            CPPUNIT_ASSERT(sender != -1);
+            for (i = 0; i < FILL_EVENTS; i++)
+                simulate(sender, i, 0, "KEY_FILL");
+
+            simulate(sender, 1, 1, "KEY_1");
+            simulate(sender, 1, 2, "KEY_1");
+            simulate(sender, 1, 3, "KEY_1");
+            expected.push_back(event(1, 3, "KEY_1"));
+            /* Another button's repeat is kept, and keeps KEY_1 too. */
+            simulate(sender, 2, 1, "KEY_2");
+            expected.push_back(event(2, 1, "KEY_2"));
+            simulate(sender, 1, 4, "KEY_1");
+            expected.push_back(event(1, 4, "KEY_1"));
+            /* A press in between is never dropped. */
+            simulate(sender, 1, 0, "KEY_1");
+            expected.push_back(event(1, 0, "KEY_1"));
+            simulate(sender, 1, 5, "KEY_1");
+            simulate(sender, 1, 6, "KEY_1");
+            expected.push_back(event(1, 6, "KEY_1"));
+            close(sender);
+
+            /* Nor is a text message, the SIGHUP notice. */
+            CPPUNIT_ASSERT(kill(lircd_pid(), SIGHUP) == 0);
+            usleep(500000);
+            expected.push_back("BEGIN");
+            expected.push_back("SIGHUP");
+            expected.push_back("END");
+            sender = lirc_get_local_socket("var/lircd.socket", 1);
+            CPPUNIT_ASSERT(sender != -1);
+            simulate(sender, 1, 7, "KEY_1");
+            simulate(sender, 1, 8, "KEY_1");
+            expected.push_back(event(1, 8, "KEY_1"));
+            simulate(sender, 3, 0, "KEY_END");
+            expected.push_back(event(3, 0, "KEY_END"));
+            close(sender);
+
+            while (received.find("KEY_END test\n") == string::npos) {
+                i = read(client, buff, sizeof(buff));
+                CPPUNIT_ASSERT(i > 0);
+                received.append(buff, i);
+            }
+            close(client);
+            istringstream lines(received);
+            while (getline(lines, line)) {
+                if (line.find(" KEY_FILL ") != string::npos)
+                    fills++;
+                else
+                    tail.push_back(line);
+            }
+            CPPUNIT_ASSERT(fills == FILL_EVENTS);
+            CPPUNIT_ASSERT(tail == expected);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
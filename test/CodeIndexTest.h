@@ -0,0 +1,319 @@
+#ifndef  CODE_INDEX_TEST
+#define  CODE_INDEX_TEST
+
+#include	<stdio.h>
+#include	<string.h>
+#include	<sys/time.h>
+
+#include    <sstream>
+#include    <string>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_private.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<CodeIndexTest>( \
+                       id,  &CodeIndexTest::func))
+
+using namespace std;
+
+/* Writable as in drivers, the header may be included without IN_DRIVER. */
+extern "C" struct driver drv;
+
+/* 32 bits, the two first codes are used by two buttons each. */
+#define     PLAIN_REMOTE "\
+begin remote\n\
+  name           plain\n\
+  bits           16\n\
+  flags          SPACE_ENC|CONST_LENGTH\n\
+  eps            30\n\
+  aeps           100\n\
+  header         9000 4500\n\
+  one            560 1690\n\
+  zero           560 560\n\
+  ptrail         560\n\
+  pre_data_bits  16\n\
+  pre_data       0x20DF\n\
+  gap            108000\n\
+  %s\n\
+  begin codes\n\
+    KEY_1        0x0001\n\
+    KEY_2        0x0002\n\
+    KEY_ALIAS1   0x0001\n\
+    KEY_ALIAS2   0x0002\n\
+    KEY_3        0x0003\n\
+    %s\n\
+  end codes\n\
+end remote\n"
+
+/* Remotes sharing codes, one with a mask and one of 16 bits. */
+#define     SCANCODE_REMOTES "\
+begin remote\n  name first\n  bits 16\n  flags SPACE_ENC\n\
+  one 560 1690\n  zero 560 560\n  gap 108000\n\
+  pre_data_bits 16\n  pre_data 0x20DF\n  begin codes\n\
+    KEY_1 0x0001\n    KEY_2 0x0002\n  end codes\nend remote\n\
+begin remote\n  name masked\n  bits 16\n  flags SPACE_ENC\n\
+  one 560 1690\n  zero 560 560\n  gap 108000\n\
+  pre_data_bits 16\n  pre_data 0x20DF\n  toggle_bit_mask 0x8000\n\
+  begin codes\n    KEY_3 0x0003\n    KEY_1 0x0001\n  end codes\n\
+end remote\n\
+begin remote\n  name second\n  bits 16\n  flags SPACE_ENC\n\
+  one 560 1690\n  zero 560 560\n  gap 108000\n\
+  pre_data_bits 16\n  pre_data 0x20DF\n  begin codes\n\
+    KEY_1 0x0001\n    KEY_3 0x0003\n    KEY_4 0x0004\n  end codes\n\
+end remote\n\
+begin remote\n  name short\n  bits 8\n  flags SPACE_ENC\n\
+  one 560 1690\n  zero 560 560\n  gap 108000\n\
+  pre_data_bits 8\n  pre_data 0xAB\n  begin codes\n\
+    KEY_1 0x01\n  end codes\nend remote\n"
+
+/**
+ * The hash index of the codes of a remote used by get_code(), and the
+ * scancode index of all remotes used by decode_all(), fed by a LIRCCODE
+ * driver: decoding must give what the linear scans give.
+ */
+class CodeIndexTest : public CppUnit::TestFixture
+{
+    private:
+        ir_remote* remotes;
+        struct timeval now;
+
+        /** Parse a PLAIN_REMOTE with extra options and codes. */
+        void load(const char* options, const char* codes)
+        {
+            char text[2048];
+
+            snprintf(text, sizeof(text), PLAIN_REMOTE, options, codes);
+            loadText(text);
+        }
+
+        void loadText(const char* text)
+        {
+            FILE* f;
+
+            f = fmemopen((void*)text, strlen(text), "r");
+            CPPUNIT_ASSERT(f != NULL);
+            remotes = read_config(f, "plain.conf");
+            fclose(f);
+            CPPUNIT_ASSERT(remotes != NULL && remotes != (ir_remote*)-1);
+        }
+
+        /** Install a LIRCCODE driver delivering bits wide codes. */
+        static void useDriver(int bits)
+        {
+            const struct driver lirccode = {
+                .device         = "",
+                .fd             = -1,
+                .features       = LIRC_CAN_REC_LIRCCODE,
+                .send_mode      = 0,
+                .rec_mode       = LIRC_MODE_LIRCCODE,
+                .code_length    = (uint32_t)bits,
+                .open_func      = NULL,
+                .init_func      = NULL,
+                .deinit_func    = NULL,
+                .send_func      = NULL,
+                .rec_func       = NULL,
+                .decode_func    = receive_decode,
+                .drvctl_func    = NULL,
+                .readdata       = NULL,
+                .name           = "lirccode",
+            };
+
+            memcpy((void*)&drv, &lirccode, sizeof(drv));
+            rec_buffer_init();
+        }
+
+        /** Return the button decode_all() finds for code, "" if none. */
+        string decode(ir_code code)
+        {
+            string button;
+            string name;
+            char* message;
+
+            /* Far apart, never taken as repeats. */
+            now.tv_sec += 10;
+            rec_buffer_set_code(code, &now, 0);
+            message = decode_all(remotes);
+            if (message == NULL)
+                return "";
+            istringstream fields(message);
+            fields >> hex >> code >> button >> button >> name;
+            return button + " " + name;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "CodeIndexTest" );
+            ADD_TEST("testBuilt", testBuilt);
+            ADD_TEST("testLookup", testLookup);
+            ADD_TEST("testFirstMatch", testFirstMatch);
+            ADD_TEST("testSameAsLinear", testSameAsLinear);
+            ADD_TEST("testChangedRemote", testChangedRemote);
+            ADD_TEST("testIgnoreMask", testIgnoreMask);
+            ADD_TEST("testToggleBitMask", testToggleBitMask);
+            ADD_TEST("testScancodeBuilt", testScancodeBuilt);
+            ADD_TEST("testScancodeOrder", testScancodeOrder);
+            ADD_TEST("testScancodeSameAsLinear", testScancodeSameAsLinear);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            remotes = NULL;
+            now.tv_sec = 1000;
+            now.tv_usec = 0;
+            useDriver(32);
+        };
+
+        void tearDown()
+        {
+            ir_remote_set_scancode_index(0);
+            free_config(remotes);
+            last_remote = NULL;
+            repeat_remote = NULL;
+        };
+
+        void testBuilt()
+        {
+            load("", "");
+            CPPUNIT_ASSERT(remotes->code_index != NULL);
+            free_config(remotes);
+            /* find_longest_match() is needed, no index. */
+            load("", "KEY_SEQ 0x0004 0x0005");
+            CPPUNIT_ASSERT(remotes->code_index == NULL);
+            CPPUNIT_ASSERT(decode(0x20DF0001) == "KEY_1 plain");
+        }
+
+        void testLookup()
+        {
+            load("", "");
+            CPPUNIT_ASSERT(decode(0x20DF0001) == "KEY_1 plain");
+            CPPUNIT_ASSERT(decode(0x20DF0003) == "KEY_3 plain");
+            CPPUNIT_ASSERT(decode(0x20DF0009) == "");
+            /* The pre_data is checked before the index is used. */
+            CPPUNIT_ASSERT(decode(0x11110001) == "");
+        }
+
+        void testFirstMatch()
+        {
+            load("", "");
+            /* As the linear scan, the first button with the code. */
+            CPPUNIT_ASSERT(decode(0x20DF0002) == "KEY_2 plain");
+            CPPUNIT_ASSERT(decode(0x20DF0001) == "KEY_1 plain");
+            CPPUNIT_ASSERT(decode(0x20DF0002) == "KEY_2 plain");
+        }
+
+        void testSameAsLinear()
+        {
+            string indexed[64];
+            int i;
+
+            load("", "");
+            for (i = 0; i < 64; i++)
+                indexed[i] = decode(0x20DF0000 + i);
+            ir_remote_free_index(remotes);
+            CPPUNIT_ASSERT(remotes->code_index == NULL);
+            for (i = 0; i < 64; i++)
+                CPPUNIT_ASSERT(decode(0x20DF0000 + i) == indexed[i]);
+        }
+
+        void testChangedRemote()
+        {
+            load("", "");
+            /* A stale index is ignored, the codes are scanned. */
+            remotes->pre_data = 0x1111;
+            CPPUNIT_ASSERT(decode(0x11110001) == "KEY_1 plain");
+            CPPUNIT_ASSERT(decode(0x20DF0001) == "");
+            remotes->codes[2].code = 0x0009;
+            CPPUNIT_ASSERT(decode(0x11110009) == "KEY_ALIAS1 plain");
+            ir_remote_index_codes(remotes);
+            CPPUNIT_ASSERT(remotes->code_index != NULL);
+            CPPUNIT_ASSERT(decode(0x11110009) == "KEY_ALIAS1 plain");
+            CPPUNIT_ASSERT(decode(0x11110001) == "KEY_1 plain");
+        }
+
+        void testIgnoreMask()
+        {
+            load("ignore_mask 0x00ff0000", "");
+            CPPUNIT_ASSERT(remotes->code_index != NULL);
+            CPPUNIT_ASSERT(decode(0x20AB0001) == "KEY_1 plain");
+            CPPUNIT_ASSERT(decode(0x20000002) == "KEY_2 plain");
+            CPPUNIT_ASSERT(decode(0x21DF0002) == "");
+        }
+
+        void testToggleBitMask()
+        {
+            load("toggle_bit_mask 0x8000", "");
+            CPPUNIT_ASSERT(remotes->code_index != NULL);
+            CPPUNIT_ASSERT(decode(0x20DF0003) == "KEY_3 plain");
+            CPPUNIT_ASSERT(decode(0x20DF8003) == "KEY_3 plain");
+            CPPUNIT_ASSERT(decode(0x20DF8001) == "KEY_1 plain");
+            CPPUNIT_ASSERT(decode(0x20DF8009) == "");
+        }
+
+        void testScancodeBuilt()
+        {
+            loadText(SCANCODE_REMOTES);
+            CPPUNIT_ASSERT(decode(0x20DF0002) == "KEY_2 first");
+            CPPUNIT_ASSERT(remotes->scancode_index == NULL);
+            /* Built on first use. */
+            ir_remote_set_scancode_index(1);
+            CPPUNIT_ASSERT(decode(0x20DF0002) == "KEY_2 first");
+            CPPUNIT_ASSERT(remotes->scancode_index != NULL);
+            /* Rebuilt for another code length. */
+            useDriver(16);
+            CPPUNIT_ASSERT(decode(0xAB01) == "KEY_1 short");
+            CPPUNIT_ASSERT(decode(0x0001) == "");
+            ir_remote_free_scancode_index(remotes);
+            CPPUNIT_ASSERT(remotes->scancode_index == NULL);
+            CPPUNIT_ASSERT(decode(0xAB01) == "KEY_1 short");
+        }
+
+        void testScancodeOrder()
+        {
+            uint64_t attempts;
+
+            loadText(SCANCODE_REMOTES);
+            ir_remote_set_scancode_index(1);
+            /* The first remote in the list, indexed or not. */
+            CPPUNIT_ASSERT(decode(0x20DF0001) == "KEY_1 first");
+            CPPUNIT_ASSERT(decode(0x20DF0003) == "KEY_3 masked");
+            CPPUNIT_ASSERT(decode(0x20DF8001) == "KEY_1 masked");
+            attempts = remotes->stats.attempts;
+            CPPUNIT_ASSERT(decode(0x20DF0004) == "KEY_4 second");
+            CPPUNIT_ASSERT(decode(0x20DF0005) == "");
+            /* Only the remotes having the code and masked are tried. */
+            CPPUNIT_ASSERT(remotes->stats.attempts == attempts);
+            /* Not a code of 32 bits. */
+            CPPUNIT_ASSERT(decode(0xAB01) == "");
+        }
+
+        void testScancodeSameAsLinear()
+        {
+            static const ir_code bases[] = {
+                0x20DF0000, 0x20DF8000, 0x10EF0000, 0xAB00, 0
+            };
+            string indexed[4][16];
+            int i;
+            int j;
+
+            loadText(SCANCODE_REMOTES);
+            ir_remote_set_scancode_index(1);
+            for (i = 0; i < 4; i++)
+                for (j = 0; j < 16; j++)
+                    indexed[i][j] = decode(bases[i] + j);
+            ir_remote_set_scancode_index(0);
+            for (i = 0; i < 4; i++)
+                for (j = 0; j < 16; j++)
+                    CPPUNIT_ASSERT(decode(bases[i] + j) == indexed[i][j]);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
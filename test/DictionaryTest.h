@@ -0,0 +1,185 @@
+#ifndef  DICTIONARY_TEST
+#define  DICTIONARY_TEST
+
+#include	<stdio.h>
+
+#include    <string>
+#include    <vector>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/dictionary.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<DictionaryTest>( \
+                       id,  &DictionaryTest::func))
+
+using namespace std;
+
+/** The hash index of dictionary.c, behind the unchanged API. */
+class DictionaryTest : public CppUnit::TestFixture
+{
+    private:
+        dictionary* d;
+
+        static string key(int i)
+        {
+            char buff[32];
+
+            snprintf(buff, sizeof(buff), "section:key%d", i);
+            return buff;
+        }
+
+        /** The index is never more than half full, lookups end. */
+        bool indexOk()
+        {
+            return d->index_size >= 16
+                   && (d->index_size & (d->index_size - 1)) == 0
+                   && 2 * (unsigned)(d->n + d->deleted) <= d->index_size;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "DictionaryTest" );
+            ADD_TEST("testGrow", testGrow);
+            ADD_TEST("testOverwrite", testOverwrite);
+            ADD_TEST("testUnset", testUnset);
+            ADD_TEST("testTombstones", testTombstones);
+            ADD_TEST("testOrder", testOrder);
+            ADD_TEST("testWraparound", testWraparound);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            d = dictionary_new(0);
+            CPPUNIT_ASSERT(d != NULL);
+        };
+
+        void tearDown()
+        {
+            dictionary_del(d);
+        };
+
+        void testGrow()
+        {
+            int i;
+
+            /* 128 slots at start, doubled and reindexed four times. */
+            for (i = 0; i < 2000; i++) {
+                CPPUNIT_ASSERT(dictionary_set(d, key(i).c_str(),
+                                              key(i).c_str()) == 0);
+                CPPUNIT_ASSERT(indexOk());
+            }
+            CPPUNIT_ASSERT(d->n == 2000);
+            CPPUNIT_ASSERT(d->size == 2048);
+            for (i = 0; i < 2000; i++)
+                CPPUNIT_ASSERT(string(dictionary_get(d, key(i).c_str(), ""))
+                               == key(i));
+            CPPUNIT_ASSERT(dictionary_get(d, "section:nokey", NULL) == NULL);
+        }
+
+        void testOverwrite()
+        {
+            CPPUNIT_ASSERT(dictionary_set(d, "a", "1") == 0);
+            CPPUNIT_ASSERT(dictionary_set(d, "a", "2") == 0);
+            CPPUNIT_ASSERT(d->n == 1);
+            CPPUNIT_ASSERT(string(dictionary_get(d, "a", "")) == "2");
+            /* A NULL value is stored, not taken as missing. */
+            CPPUNIT_ASSERT(dictionary_set(d, "a", NULL) == 0);
+            CPPUNIT_ASSERT(dictionary_get(d, "a", "def") == NULL);
+            CPPUNIT_ASSERT(d->n == 1);
+        }
+
+        void testUnset()
+        {
+            int i;
+
+            for (i = 0; i < 300; i++)
+                dictionary_set(d, key(i).c_str(), "v");
+            for (i = 0; i < 300; i += 2)
+                dictionary_unset(d, key(i).c_str());
+            CPPUNIT_ASSERT(d->n == 150);
+            for (i = 0; i < 300; i++) {
+                const char* v = dictionary_get(d, key(i).c_str(), NULL);
+
+                /* Probes go on past the deleted entries. */
+                CPPUNIT_ASSERT((v == NULL) == (i % 2 == 0));
+            }
+            dictionary_unset(d, "section:nokey");
+            CPPUNIT_ASSERT(d->n == 150);
+        }
+
+        void testTombstones()
+        {
+            int i;
+
+            for (i = 0; i < 100; i++)
+                dictionary_set(d, key(i).c_str(), "v");
+            /* Churn rebuilds the index at half load, it doesn't grow. */
+            for (i = 100; i < 20000; i++) {
+                dictionary_set(d, key(i).c_str(), "v");
+                dictionary_unset(d, key(i - 100).c_str());
+                CPPUNIT_ASSERT(indexOk());
+            }
+            CPPUNIT_ASSERT(d->n == 100);
+            CPPUNIT_ASSERT(d->size == 128);
+            for (i = 19900; i < 20000; i++)
+                CPPUNIT_ASSERT(dictionary_get(d, key(i).c_str(), NULL)
+                               != NULL);
+            CPPUNIT_ASSERT(dictionary_get(d, key(0).c_str(), NULL) == NULL);
+        }
+
+        void testOrder()
+        {
+            vector<string> keys;
+            int i;
+
+            dictionary_set(d, "s:a", "1");
+            dictionary_set(d, "s:b", "2");
+            dictionary_set(d, "s:c", "3");
+            /* The ciniparser iterates the slots, in insertion order. */
+            for (i = 0; i < d->size; i++)
+                if (d->key[i] != NULL)
+                    keys.push_back(d->key[i]);
+            CPPUNIT_ASSERT(keys.size() == 3);
+            CPPUNIT_ASSERT(keys[0] == "s:a" && keys[2] == "s:c");
+            /* A hole left by unset is filled first. */
+            dictionary_unset(d, "s:b");
+            dictionary_set(d, "s:d", "4");
+            CPPUNIT_ASSERT(string(d->key[1]) == "s:d");
+            dictionary_unset(d, "s:d");
+            dictionary_unset(d, "s:c");
+            CPPUNIT_ASSERT(d->used == 1);
+        }
+
+        void testWraparound()
+        {
+            unsigned mask = d->index_size - 1;
+            vector<string> keys;
+            int i;
+
+            /* Keys hashing to the last index entries probe from 0 on. */
+            for (i = 0; keys.size() < 8; i++)
+                if ((dictionary_hash(key(i).c_str()) & mask) >= mask - 1)
+                    keys.push_back(key(i));
+            for (i = 0; i < (int)keys.size(); i++)
+                dictionary_set(d, keys[i].c_str(), keys[i].c_str());
+            CPPUNIT_ASSERT(d->index_size == mask + 1);
+            for (i = 0; i < (int)keys.size(); i++)
+                CPPUNIT_ASSERT(string(dictionary_get(d, keys[i].c_str(), ""))
+                               == keys[i]);
+            dictionary_unset(d, keys[0].c_str());
+            for (i = 1; i < (int)keys.size(); i++)
+                CPPUNIT_ASSERT(dictionary_get(d, keys[i].c_str(), NULL)
+                               != NULL);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
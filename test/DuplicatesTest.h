@@ -0,0 +1,205 @@
+#ifndef  DUPLICATES_TEST
+#define  DUPLICATES_TEST
+
+#include	<stdio.h>
+#include	<string.h>
+
+#include    <fstream>
+#include    <sstream>
+#include    <string>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_private.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<DuplicatesTest>( \
+                       id,  &DuplicatesTest::func))
+
+#define     DUPLICATES_LOG  "var/duplicates_test.log"
+
+using namespace std;
+
+/**
+ * The sets of code names and values read_config() checks duplicates
+ * with, rebuilt as they fill up: each duplicate must be logged once,
+ * wherever it is, and nothing else.
+ */
+class DuplicatesTest : public CppUnit::TestFixture
+{
+    private:
+        string codes;
+
+        /** Add button name with the given code(s), a text. */
+        void add(const char* name, const char* code)
+        {
+            codes += string("    ") + name + " " + code + "\n";
+        }
+
+        /** Add count codes KEY_<n> with value n, n from first. */
+        void addCodes(int first, int count)
+        {
+            char name[32];
+            char code[32];
+            int i;
+
+            for (i = first; i < first + count; i++) {
+                snprintf(name, sizeof(name), "KEY_%d", i);
+                snprintf(code, sizeof(code), "0x%04x", i);
+                add(name, code);
+            }
+        }
+
+        /** Parse a remote with codes, return the log. */
+        string parse()
+        {
+            string text = string("begin remote\n"
+                                 "  name  dups\n"
+                                 "  bits  16\n"
+                                 "  flags SPACE_ENC\n"
+                                 "  one   560 1690\n"
+                                 "  zero  560 560\n"
+                                 "  gap   108000\n"
+                                 "  begin codes\n")
+                          + codes
+                          + "  end codes\nend remote\n";
+            ir_remote* remotes;
+            stringstream buffer;
+            FILE* f;
+
+            unlink(DUPLICATES_LOG);
+            lirc_log_set_file(DUPLICATES_LOG);
+            lirc_log_open("DuplicatesTest", 0, LIRC_NOTICE);
+            f = fmemopen((void*)text.c_str(), text.size(), "r");
+            CPPUNIT_ASSERT(f != NULL);
+            remotes = read_config(f, "dups.conf");
+            fclose(f);
+            lirc_log_close();
+            CPPUNIT_ASSERT(remotes != NULL && remotes != (ir_remote*)-1);
+            free_config(remotes);
+            ifstream log(DUPLICATES_LOG);
+            buffer << log.rdbuf();
+            return buffer.str();
+        }
+
+        static int count(const string& log, const string& what)
+        {
+            size_t pos = 0;
+            int n = 0;
+
+            while ((pos = log.find(what, pos)) != string::npos) {
+                pos += what.size();
+                n++;
+            }
+            return n;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "DuplicatesTest" );
+            ADD_TEST("testNone", testNone);
+            ADD_TEST("testName", testName);
+            ADD_TEST("testValue", testValue);
+            ADD_TEST("testSequences", testSequences);
+            ADD_TEST("testGrow", testGrow);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            codes = "";
+        };
+
+        void tearDown()
+        {
+            unlink(DUPLICATES_LOG);
+        };
+
+        void testNone()
+        {
+            addCodes(0, 1000);
+            CPPUNIT_ASSERT(count(parse(), "Multiple") == 0);
+        }
+
+        void testName()
+        {
+            string log;
+
+            addCodes(0, 10);
+            add("KEY_3", "0x1000");
+            log = parse();
+            CPPUNIT_ASSERT(count(log, "Multiple") == 1);
+            CPPUNIT_ASSERT(count(log, "dups.conf: dups: "
+                                      "Multiple definitions of: KEY_3\n")
+                           == 1);
+        }
+
+        void testValue()
+        {
+            string log;
+
+            addCodes(0, 10);
+            add("KEY_OTHER", "0x0007");
+            log = parse();
+            CPPUNIT_ASSERT(count(log, "Multiple") == 1);
+            CPPUNIT_ASSERT(count(log, "Multiple values for same code: "
+                                      "KEY_OTHER\n") == 1);
+        }
+
+        void testSequences()
+        {
+            string log;
+
+            /* The whole chain is compared, not only the first code. */
+            add("KEY_SEQ1", "0x0001 0x0002");
+            add("KEY_SEQ2", "0x0001 0x0003");
+            add("KEY_SEQ3", "0x0001");
+            add("KEY_SEQ4", "0x0001 0x0002");
+            log = parse();
+            CPPUNIT_ASSERT(count(log, "Multiple") == 1);
+            CPPUNIT_ASSERT(count(log, "Multiple values for same code: "
+                                      "KEY_SEQ4\n") == 1);
+        }
+
+        void testGrow()
+        {
+            char name[32];
+            char code[32];
+            string log;
+            int dups = 0;
+            int i;
+
+            /*
+             * Across the rebuilds, from 64 to 4096 slots: duplicates of
+             * the first code and of one added a few codes before.
+             */
+            for (i = 1; i < 1000; i += 7) {
+                addCodes(i, 7);
+                snprintf(code, sizeof(code), "0x%04x", 0x8000 + i);
+                add("KEY_1", code);
+                snprintf(name, sizeof(name), "KEY_VALUE%d", i);
+                add(name, "0x0001");
+                snprintf(name, sizeof(name), "KEY_%d", i + 2);
+                snprintf(code, sizeof(code), "0x%04x", 0x9000 + i);
+                add(name, code);
+                snprintf(name, sizeof(name), "KEY_VALUE%d", i + 2);
+                snprintf(code, sizeof(code), "0x%04x", i + 2);
+                add(name, code);
+                dups += 2;
+            }
+            log = parse();
+            CPPUNIT_ASSERT(count(log, "Multiple definitions of: KEY_")
+                           == dups);
+            CPPUNIT_ASSERT(count(log, "Multiple values for same code: "
+                                      "KEY_VALUE") == dups);
+            CPPUNIT_ASSERT(count(log, "Multiple") == 2 * dups);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
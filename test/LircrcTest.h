@@ -0,0 +1,296 @@
+#ifndef  LIRCRC_TEST
+#define  LIRCRC_TEST
+
+#include	<stdio.h>
+
+#include    <fstream>
+#include    <string>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_client.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<LircrcTest>( \
+                       id,  &LircrcTest::func))
+
+#define     LIRCRC_PATH     "var/lircrc_test.lircrc"
+
+/* Indexed entries, interleaved with those always checked. */
+#define     LIRCRC_ENTRIES "\
+begin\n  prog = test\n  remote = Remote1\n  button = KEY_A\n  config = a1\nend\n\
+begin\n  prog = test\n  button = KEY_A\n  config = any-a\nend\n\
+begin\n  prog = test\n  remote = remote1\n  button = key_a\n  config = a2\nend\n\
+begin\n  prog = test\n  remote = *\n  button = *\n  config = all\nend\n\
+begin\n  prog = test\n  remote = Remote2\n  button = KEY_A\n  config = r2-a\nend\n\
+begin\n  prog = test\n  remote = Remote1\n  button = KEY_B\n  config = b\n\
+  flags = quit\nend\n\
+begin\n  prog = test\n  remote = Remote1\n  button = KEY_B\n  config = b-quit\nend\n\
+begin\n  prog = test\n  remote = Remote1\n  button = KEY_M\n  config = m\n\
+  mode = numeric\nend\n\
+begin numeric\n\
+  begin\n    prog = test\n    remote = Remote1\n    button = KEY_M\n\
+    config = numeric-m\n    flags = mode\n  end\n\
+  begin\n    prog = test\n    remote = Remote1\n    button = KEY_A\n\
+    config = numeric-a\n  end\n\
+end numeric\n"
+
+/* Button sequences, compiled but the last. */
+#define     LIRCRC_SEQUENCES "\
+begin\n  prog = test\n  remote = R\n  button = KEY_A\n\
+  button = KEY_A\n  button = KEY_B\n  config = aab\nend\n\
+begin\n  prog = test\n  remote = R\n  button = KEY_A\n\
+  button = KEY_B\n  button = KEY_A\n  button = KEY_C\n\
+  config = abac\nend\n\
+begin\n  prog = test\n  remote = R\n  button = KEY_B\n  config = b\nend\n\
+begin\n  prog = test\n  remote = R\n  button = KEY_C\n\
+  button = KEY_C\n  config = cc\nend\n\
+begin\n  prog = test\n  remote = *\n  button = KEY_X\n\
+  button = *\n  config = x-any\nend\n"
+
+using namespace std;
+
+/**
+ * The index of lircrc entries by remote and button used by
+ * lirc_code2char(), and the button sequences matched with it: the
+ * strings and their order must be the ones of the linear search.
+ */
+class LircrcTest : public CppUnit::TestFixture
+{
+    private:
+        struct lirc_config* config;
+
+        void load(const char* text)
+        {
+            ofstream(LIRCRC_PATH) << text;
+            CPPUNIT_ASSERT(lirc_readconfig_only(LIRCRC_PATH, &config, NULL)
+                           == 0);
+            CPPUNIT_ASSERT(config->sockfd == -1);
+        }
+
+        /** Return all strings for button on remote, space separated. */
+        string strings(const char* button, const char* remote, int reps = 0)
+        {
+            char code[128];
+            string all;
+            char* s;
+            int i;
+
+            snprintf(code, sizeof(code), "0000000000000001 %02x %s %s\n",
+                     reps, button, remote);
+            for (i = 0; ; i++) {
+                /* Ends with a NULL string. */
+                CPPUNIT_ASSERT(i < 100);
+                CPPUNIT_ASSERT(lirc_code2char(config, code, &s) == 0);
+                if (s == NULL)
+                    return all;
+                all += all.empty() ? s : string(" ") + s;
+            }
+        }
+
+        /** Return the strings for each press of buttons, ";" separated. */
+        string presses(const char* buttons)
+        {
+            char button[] = "KEY_?";
+            string all;
+
+            for (; *buttons != '\0'; buttons++) {
+                button[4] = *buttons;
+                all += strings(button, "R") + ";";
+            }
+            return all;
+        }
+
+        /** As strings(), without the index. */
+        string linearStrings(const char* button, const char* remote,
+                             int reps = 0)
+        {
+            struct lirc_config_index* index = config->index;
+            string all;
+
+            config->index = NULL;
+            all = strings(button, remote, reps);
+            config->index = index;
+            return all;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "LircrcTest" );
+            ADD_TEST("testIndexed", testIndexed);
+            ADD_TEST("testOrder", testOrder);
+            ADD_TEST("testCase", testCase);
+            ADD_TEST("testQuit", testQuit);
+            ADD_TEST("testMode", testMode);
+            ADD_TEST("testSameAsLinear", testSameAsLinear);
+            ADD_TEST("testNextChanged", testNextChanged);
+            ADD_TEST("testSequence", testSequence);
+            ADD_TEST("testSequenceRebase", testSequenceRebase);
+            ADD_TEST("testSequenceAll", testSequenceAll);
+            ADD_TEST("testSequenceSameAsLinear", testSequenceSameAsLinear);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            /* Any prog, used or not by other tests. */
+            lirc_deinit();
+            config = NULL;
+            load(LIRCRC_ENTRIES);
+        };
+
+        void tearDown()
+        {
+            if (config != NULL)
+                lirc_freeconfig(config);
+            unlink(LIRCRC_PATH);
+        };
+
+        void testIndexed()
+        {
+            CPPUNIT_ASSERT(config->index != NULL);
+        }
+
+        void testOrder()
+        {
+            /* Bucket and LIRC_ALL entries merged in lircrc order. */
+            CPPUNIT_ASSERT(strings("KEY_A", "Remote1")
+                           == "a1 any-a a2 all");
+            CPPUNIT_ASSERT(strings("KEY_A", "Remote2") == "any-a all r2-a");
+            CPPUNIT_ASSERT(strings("KEY_C", "Remote1") == "all");
+            CPPUNIT_ASSERT(strings("KEY_A", "Remote1")
+                           == "a1 any-a a2 all");
+        }
+
+        void testCase()
+        {
+            CPPUNIT_ASSERT(strings("key_a", "REMOTE1") == "a1 any-a a2 all");
+            CPPUNIT_ASSERT(strings("Key_B", "remote1") == "all b");
+        }
+
+        void testQuit()
+        {
+            /* Nothing after a quit entry, neither indexed nor not. */
+            CPPUNIT_ASSERT(strings("KEY_B", "Remote1") == "all b");
+        }
+
+        void testMode()
+        {
+            /* The mode set by m is used by the next entry. */
+            CPPUNIT_ASSERT(strings("KEY_M", "Remote1") == "all m numeric-m");
+            /* Left by numeric-m. */
+            CPPUNIT_ASSERT(config->current_mode == NULL);
+            CPPUNIT_ASSERT(strings("KEY_A", "Remote1") == "a1 any-a a2 all");
+            CPPUNIT_ASSERT(lirc_setmode(config, "numeric") != NULL);
+            CPPUNIT_ASSERT(strings("KEY_A", "Remote1")
+                           == "a1 any-a a2 all numeric-a");
+        }
+
+        void testSameAsLinear()
+        {
+            const char* buttons[] = { "KEY_A", "key_b", "KEY_M", "KEY_C" };
+            const char* remotes[] = { "Remote1", "REMOTE2", "Remote3" };
+            string indexed;
+            int i;
+            int j;
+
+            for (i = 0; i < 4; i++) {
+                for (j = 0; j < 3; j++) {
+                    indexed = strings(buttons[i], remotes[j]);
+                    /* Same mode for both. */
+                    free(config->current_mode);
+                    config->current_mode = NULL;
+                    lirc_freeconfig(config);
+                    config = NULL;
+                    load(LIRCRC_ENTRIES);
+                    CPPUNIT_ASSERT(linearStrings(buttons[i], remotes[j])
+                                   == indexed);
+                }
+            }
+        }
+
+        void testNextChanged()
+        {
+            /* The application skips a1, the index isn't used. */
+            config->next = config->first->next;
+            CPPUNIT_ASSERT(strings("KEY_A", "Remote1") == "any-a a2 all");
+            /* From the start again. */
+            CPPUNIT_ASSERT(strings("KEY_A", "Remote1")
+                           == "a1 any-a a2 all");
+        }
+
+        void testSequence()
+        {
+            lirc_freeconfig(config);
+            load(LIRCRC_SEQUENCES);
+            CPPUNIT_ASSERT(presses("AAB") == ";;aab b;");
+            /* Restarted once complete. */
+            CPPUNIT_ASSERT(presses("AB") == ";b;");
+            CPPUNIT_ASSERT(presses("CCC") == ";cc;;");
+            CPPUNIT_ASSERT(presses("C") == "cc;");
+            /* Repeats don't advance a sequence. */
+            CPPUNIT_ASSERT(strings("KEY_A", "R") == "");
+            CPPUNIT_ASSERT(strings("KEY_A", "R", 1) == "");
+            CPPUNIT_ASSERT(strings("KEY_B", "R") == "b");
+        }
+
+        void testSequenceRebase()
+        {
+            lirc_freeconfig(config);
+            load(LIRCRC_SEQUENCES);
+            /* A A A B: the partial match A A is rebased to A A. */
+            CPPUNIT_ASSERT(presses("AAAB") == ";;;aab b;");
+            /* A B A B A C: A B A broken by B is rebased to A B. */
+            CPPUNIT_ASSERT(presses("ABABAC") == ";b;;b;;abac;");
+            /* Other remotes break a sequence. */
+            CPPUNIT_ASSERT(presses("AA") == ";;");
+            CPPUNIT_ASSERT(strings("KEY_A", "Other") == "");
+            CPPUNIT_ASSERT(presses("B") == "b;");
+        }
+
+        void testSequenceAll()
+        {
+            lirc_freeconfig(config);
+            load(LIRCRC_SEQUENCES);
+            CPPUNIT_ASSERT(strings("KEY_X", "Other") == "");
+            CPPUNIT_ASSERT(strings("KEY_Y", "Other") == "x-any");
+            CPPUNIT_ASSERT(presses("XXB") == ";x-any;b;");
+        }
+
+        void testSequenceSameAsLinear()
+        {
+            const char buttons[] = "AABCX";
+            string indexed;
+            string linear;
+            unsigned seed = 1;
+            char button[] = "KEY_?";
+            int reps[1000];
+            int i;
+
+            lirc_freeconfig(config);
+            load(LIRCRC_SEQUENCES);
+            for (i = 0; i < 1000; i++) {
+                seed = seed * 1103515245 + 12345;
+                button[4] = buttons[(seed >> 16) % 5];
+                reps[i] = (seed >> 8) % 4 == 0;
+                indexed += strings(button, "R", reps[i]) + ";";
+            }
+            lirc_freeconfig(config);
+            load(LIRCRC_SEQUENCES);
+            seed = 1;
+            for (i = 0; i < 1000; i++) {
+                seed = seed * 1103515245 + 12345;
+                button[4] = buttons[(seed >> 16) % 5];
+                linear += linearStrings(button, "R", reps[i]) + ";";
+            }
+            CPPUNIT_ASSERT(indexed == linear);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
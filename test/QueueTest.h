@@ -0,0 +1,181 @@
+#ifndef  QUEUE_TEST
+#define  QUEUE_TEST
+
+#include	<signal.h>
+#include	<stdio.h>
+#include	<unistd.h>
+
+#include    <fstream>
+#include    <sstream>
+#include    <string>
+#include    <vector>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_client.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<QueueTest>( \
+                       id,  &QueueTest::func))
+
+#define     QUEUE_LOG       "var/queue_test.log"
+
+/* The smallest queue, which the events overflow many times. */
+#define     RUN_QUEUE_LIRCD "../daemons/lircd -O client_test.conf \
+                        --nodaemon --queue-size=1024 --logfile=" QUEUE_LOG \
+                        " %s etc/lircd.conf.Aspire_6530G &"
+
+using namespace std;
+
+/**
+ * The bounded output queue of a client which doesn't read, filled by
+ * events sent faster than the socket takes them.
+ */
+class QueueTest : public CppUnit::TestFixture
+{
+    private:
+        static const int EVENTS = 5000;
+
+        int client;
+        int sender;
+
+        void startLircd(const char* args)
+        {
+            char cmd[256];
+
+            unlink(QUEUE_LOG);
+            snprintf(cmd, sizeof(cmd), RUN_QUEUE_LIRCD, args);
+            CPPUNIT_ASSERT(system(cmd) == 0);
+            usleep(500000);
+            client = lirc_get_local_socket("var/lircd.socket", 1);
+            CPPUNIT_ASSERT(client != -1);
+            sender = lirc_get_local_socket("var/lircd.socket", 1);
+            CPPUNIT_ASSERT(sender != -1);
+        }
+
+        /** Read from client until EOF or the event with code last. */
+        string readEvents(unsigned last)
+        {
+            char end[64];
+            char buff[4096];
+            string received;
+            ssize_t r;
+
+            snprintf(end, sizeof(end), "%016x 00 KEY_FILL test\n", last);
+            while (received.find(end) == string::npos) {
+                r = read(client, buff, sizeof(buff));
+                if (r <= 0)
+                    break;
+                received.append(buff, r);
+            }
+            return received;
+        }
+
+        bool logContains(const char* what)
+        {
+            ifstream log(QUEUE_LOG);
+            stringstream buffer;
+
+            buffer << log.rdbuf();
+            return buffer.str().find(what) != string::npos;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "QueueTest" );
+            ADD_TEST("testDropOldest", testDropOldest);
+            ADD_TEST("testDropClient", testDropClient);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            int pid = lircd_pid();
+
+            if (pid > 0 && kill(pid, SIGTERM) == 0)
+                usleep(100000);
+            client = -1;
+            sender = -1;
+        };
+
+        void tearDown()
+        {
+            int pid = lircd_pid();
+
+            if (client != -1)
+                close(client);
+            if (sender != -1)
+                close(sender);
+            if (pid > 0)
+                kill(pid, SIGTERM);
+            usleep(100000);
+        };
+
+        void testDropOldest()
+        {
+            vector<unsigned> codes;
+            string line;
+            unsigned code;
+            size_t queued = 0;
+            int gaps = 0;
+            int i;
+
+            startLircd("");
+            for (i = 0; i < EVENTS; i++)
+                CPPUNIT_ASSERT(lircd_simulate(sender, i, 0, "KEY_FILL"));
+            istringstream lines(readEvents(EVENTS - 1));
+            while (getline(lines, line)) {
+                /* Only complete messages are dropped, none is cut. */
+                CPPUNIT_ASSERT(line.size() == 33);
+                CPPUNIT_ASSERT(sscanf(line.c_str(), "%x", &code) == 1);
+                codes.push_back(code);
+            }
+            CPPUNIT_ASSERT(codes.size() < (size_t)EVENTS);
+            CPPUNIT_ASSERT(codes.front() == 0);
+            CPPUNIT_ASSERT(codes.back() == (unsigned)EVENTS - 1);
+            /* The socket got the first ones, the queue the newest. */
+            for (i = 1; i < (int)codes.size(); i++) {
+                CPPUNIT_ASSERT(codes[i] > codes[i - 1]);
+                if (codes[i] != codes[i - 1] + 1) {
+                    gaps++;
+                    queued = codes.size() - i;
+                }
+            }
+            CPPUNIT_ASSERT(gaps == 1);
+            /* Besides a partially written message. */
+            CPPUNIT_ASSERT((queued - 1) * 34 <= 1024);
+            CPPUNIT_ASSERT(queued * 34 > 1024 - 2 * 34);
+            /* The client and lircd go on. */
+            CPPUNIT_ASSERT(lircd_command(client, "VERSION").find("SUCCESS")
+                           != string::npos);
+            CPPUNIT_ASSERT(logContains("Slow client missed"));
+        }
+
+        void testDropClient()
+        {
+            string received;
+            char last[64];
+            int i;
+
+            startLircd("--queue-overflow=drop-client");
+            for (i = 0; i < EVENTS; i++)
+                CPPUNIT_ASSERT(lircd_simulate(sender, i, 0, "KEY_FILL"));
+            /* Disconnected before the last, at the first overflow. */
+            received = readEvents(EVENTS - 1);
+            snprintf(last, sizeof(last), "%016x", EVENTS - 1);
+            CPPUNIT_ASSERT(received.size() > 0);
+            CPPUNIT_ASSERT(received.find(last) == string::npos);
+            CPPUNIT_ASSERT(readEvents(EVENTS - 1) == "");
+            CPPUNIT_ASSERT(logContains("dropping client"));
+            CPPUNIT_ASSERT(lircd_command(sender, "VERSION").find("SUCCESS")
+                           != string::npos);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
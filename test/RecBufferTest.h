@@ -0,0 +1,196 @@
+#ifndef  REC_BUFFER_TEST
+#define  REC_BUFFER_TEST
+
+#include	<stdio.h>
+#include	<string.h>
+
+#include    <fstream>
+#include    <sstream>
+#include    <string>
+#include    <vector>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_config.h"
+#include	"../lib/lirc_private.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<RecBufferTest>( \
+                       id,  &RecBufferTest::func))
+
+using namespace std;
+
+/* Writable as in drivers, the header may be included without IN_DRIVER. */
+extern "C" struct driver drv;
+
+/** The mode2 input of the memory driver. */
+static vector<lirc_t> rec_input;
+static size_t rec_input_pos;
+
+/** Like the file driver: the end of input is a timeout with LIRC_EOF. */
+static lirc_t rec_input_readdata(lirc_t timeout)
+{
+    if (rec_input_pos < rec_input.size())
+        return rec_input[rec_input_pos++];
+    return LIRC_EOF | LIRC_MODE2_TIMEOUT | timeout;
+}
+
+/**
+ * The rec_buffer ring, fed with the captures in tests/ by a memory
+ * driver. A small ring wraps many times in each capture, the decoded
+ * output must be the one expected by the regression tests.
+ */
+class RecBufferTest : public CppUnit::TestFixture
+{
+    private:
+        ir_remote* remotes;
+
+        /** Load the config and capture of the case in tests/dir. */
+        void load(const char* dir, const char* config)
+        {
+            string path = string("tests/") + dir + "/" + config;
+            string capture = string("tests/") + dir + "/durations";
+            ifstream in(capture.c_str());
+            string what;
+            lirc_t value;
+            FILE* f;
+
+            f = fopen(path.c_str(), "r");
+            CPPUNIT_ASSERT(f != NULL);
+            remotes = read_config(f, path.c_str());
+            fclose(f);
+            CPPUNIT_ASSERT(remotes != NULL && remotes != (ir_remote*)-1);
+            rec_input.clear();
+            while (in >> what >> value)
+                rec_input.push_back((value & PULSE_MASK)
+                                    | (what == "pulse" ? PULSE_BIT : 0));
+            CPPUNIT_ASSERT(rec_input.size() > 1000);
+        }
+
+        /** Decode all input, like irsimreceive. */
+        string decode()
+        {
+            string output;
+            char* code;
+
+            rec_input_pos = 0;
+            rec_buffer_init();
+            while (rec_input_pos < rec_input.size()) {
+                if (!rec_buffer_clear())
+                    continue;
+                code = decode_all(remotes);
+                if (code != NULL && strstr(code, "__EOF") == NULL)
+                    output += code;
+            }
+            return output;
+        }
+
+        static string expected(const char* dir)
+        {
+            string path = string("tests/") + dir + "/decoded.txt";
+            ifstream in(path.c_str());
+            stringstream buffer;
+
+            buffer << in.rdbuf();
+            return buffer.str();
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "RecBufferTest" );
+            ADD_TEST("testSize", testSize);
+            ADD_TEST("testDecode", testDecode);
+            ADD_TEST("testWraparound", testWraparound);
+            ADD_TEST("testOverflow", testOverflow);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            const struct driver mode2 = {
+                .device         = "",
+                .fd             = -1,
+                .features       = LIRC_CAN_REC_MODE2,
+                .send_mode      = 0,
+                .rec_mode       = LIRC_MODE_MODE2,
+                .code_length    = 0,
+                .open_func      = NULL,
+                .init_func      = NULL,
+                .deinit_func    = NULL,
+                .send_func      = NULL,
+                .rec_func       = NULL,
+                .decode_func    = receive_decode,
+                .drvctl_func    = NULL,
+                .readdata       = rec_input_readdata,
+                .name           = "memory",
+            };
+
+            memcpy((void*)&drv, &mode2, sizeof(drv));
+            rec_set_virtual_clock(1);
+            remotes = NULL;
+        };
+
+        void tearDown()
+        {
+            free_config(remotes);
+            last_remote = NULL;
+            repeat_remote = NULL;
+            rec_buffer_set_size(512);
+            rec_set_virtual_clock(0);
+        };
+
+        void testSize()
+        {
+            CPPUNIT_ASSERT(rec_buffer_set_size(63) == 0);
+            CPPUNIT_ASSERT(rec_buffer_set_size(64) == 1);
+            CPPUNIT_ASSERT(rec_buffer_set_size(64) == 1);
+            CPPUNIT_ASSERT(rec_buffer_set_size(4096) == 1);
+        }
+
+        void testDecode()
+        {
+            load("rc5", "RC-5500.conf");
+            CPPUNIT_ASSERT(decode() == expected("rc5"));
+        }
+
+        void testWraparound()
+        {
+            /* Frames of 25 edges, the ring wraps every other. */
+            CPPUNIT_ASSERT(rec_buffer_set_size(64) == 1);
+            load("rc5", "RC-5500.conf");
+            CPPUNIT_ASSERT(decode() == expected("rc5"));
+            free_config(remotes);
+            /* Up to 69 edges in a frame. */
+            CPPUNIT_ASSERT(rec_buffer_set_size(128) == 1);
+            load("rc6", "RC1974502_00.conf");
+            CPPUNIT_ASSERT(decode() == expected("rc6"));
+        }
+
+        void testOverflow()
+        {
+            string known = expected("rc6");
+            string line;
+            int lines = 0;
+
+            /* Some frames overflow the ring, the others must decode. */
+            CPPUNIT_ASSERT(rec_buffer_set_size(64) == 1);
+            load("rc6", "RC1974502_00.conf");
+            istringstream decoded(decode());
+            while (getline(decoded, line)) {
+                /* Repeat counts differ, frames are missing. */
+                line.replace(16, 4, " 00 ");
+                CPPUNIT_ASSERT(known.find(line) != string::npos);
+                lines++;
+            }
+            /* Kept from the longest gap, not dropped on overflow. */
+            CPPUNIT_ASSERT(lines >= 40);
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
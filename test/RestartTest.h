@@ -0,0 +1,132 @@
+#ifndef  RESTART_TEST
+#define  RESTART_TEST
+
+#include	<signal.h>
+#include	<stdio.h>
+#include	<unistd.h>
+
+#include    <fstream>
+#include    <iostream>
+#include    <sstream>
+#include    <string>
+#include    <cppunit/TestFixture.h>
+#include    <cppunit/TestSuite.h>
+#include    <cppunit/TestCaller.h>
+
+#include	"../lib/lirc_client.h"
+
+#undef      ADD_TEST
+#define     ADD_TEST(id, func) \
+    testSuite->addTest(new CppUnit::TestCaller<RestartTest>( \
+                       id,  &RestartTest::func))
+
+#define     RESTART_LOG     "var/restart_test.log"
+
+/* Not daemonized, the new process must find the relative paths. */
+#define     RUN_RESTART_LIRCD "../daemons/lircd -O client_test.conf \
+                        --nodaemon --logfile=" RESTART_LOG " %s \
+                        etc/lircd.conf.Aspire_6530G &"
+
+using namespace std;
+
+/** SIGUSR2 re-executes lircd, keeping its clients. */
+class RestartTest : public CppUnit::TestFixture
+{
+    private:
+        int fd;
+
+        void startLircd(const char* args)
+        {
+            char cmd[256];
+
+            unlink(RESTART_LOG);
+            snprintf(cmd, sizeof(cmd), RUN_RESTART_LIRCD, args);
+            CPPUNIT_ASSERT(system(cmd) == 0);
+            usleep(500000);
+            fd = lirc_get_local_socket("var/lircd.socket", 1);
+            CPPUNIT_ASSERT(fd != -1);
+        }
+
+        /** Return true if lircd answers VERSION on the kept client. */
+        bool clientWorks()
+        {
+            return lircd_command(fd, "VERSION").find("SUCCESS")
+                   != string::npos;
+        }
+
+        bool logContains(const char* what)
+        {
+            ifstream log(RESTART_LOG);
+            stringstream buffer;
+
+            buffer << log.rdbuf();
+            return buffer.str().find(what) != string::npos;
+        }
+
+    public:
+        static CppUnit::Test* suite()
+        {
+            CppUnit::TestSuite* testSuite =
+                 new CppUnit::TestSuite( "RestartTest" );
+            ADD_TEST("testRestart", testRestart);
+            ADD_TEST("testRestartEffectiveUser", testRestartEffectiveUser);
+            return testSuite;
+        };
+
+        void setUp()
+        {
+            int pid = lircd_pid();
+
+            if (pid > 0 && kill(pid, SIGTERM) == 0)
+                usleep(100000);
+            fd = -1;
+        };
+
+        void tearDown()
+        {
+            int pid = lircd_pid();
+
+            if (fd != -1)
+                close(fd);
+            if (pid > 0)
+                kill(pid, SIGTERM);
+            usleep(100000);
+        };
+
+        void testRestart()
+        {
+            int pid;
+
+            startLircd("");
+            pid = lircd_pid();
+            CPPUNIT_ASSERT(kill(pid, SIGUSR2) == 0);
+            usleep(1000000);
+            CPPUNIT_ASSERT(logContains("Restarted, got 1 clients"));
+            CPPUNIT_ASSERT(lircd_pid() == pid);
+            CPPUNIT_ASSERT(kill(pid, 0) == 0);
+            CPPUNIT_ASSERT(clientWorks());
+        }
+
+        void testRestartEffectiveUser()
+        {
+            int pid;
+
+            if (getuid() != 0) {
+                cout << "Skipping testRestartEffectiveUser, not root\n";
+                return;
+            }
+            startLircd("--effective-user=nobody");
+            pid = lircd_pid();
+            CPPUNIT_ASSERT(kill(pid, SIGUSR2) == 0);
+            usleep(1000000);
+            /* Refused, lircd and its clients are left alone. */
+            CPPUNIT_ASSERT(logContains("Cannot restart"));
+            CPPUNIT_ASSERT(!logContains("Restarting"));
+            CPPUNIT_ASSERT(kill(pid, 0) == 0);
+            CPPUNIT_ASSERT(clientWorks());
+        }
+};
+
+#endif
+
+// vim: set expandtab ts=4 sw=4:
@@ -7,9 +7,13 @@
 #include	<sys/un.h>
 
 
+#include	<stdio.h>
 #include	<unistd.h>
 #include	<string.h>
 
+#include    <fstream>
+#include    <string>
+
 
 using namespace std;
 
@@ -27,6 +31,45 @@ const char* abspath(const char* relpath)
 
 void dummy_load(int argc, char** const argv) { return; };
 
+/** Return the pid in var/lircd.pid, -1 if none. */
+int lircd_pid()
+{
+    ifstream pidfile("var/lircd.pid");
+    int pid = -1;
+
+    pidfile >> pid;
+    return pid;
+};
+
+/** Send cmd to lircd on fd, return the reply or "" on errors. */
+string lircd_command(int fd, const string& cmd)
+{
+    string line = cmd + "\n";
+    string reply;
+    char buff[256];
+    ssize_t r;
+
+    if (write(fd, line.c_str(), line.size()) != (ssize_t)line.size())
+        return "";
+    while (reply.find("END\n") == string::npos) {
+        r = read(fd, buff, sizeof(buff));
+        if (r <= 0)
+            return "";
+        reply.append(buff, r);
+    }
+    return reply;
+};
+
+/** SIMULATE an event of remote "test", return true on success. */
+bool lircd_simulate(int fd, unsigned code, int reps, const char* button)
+{
+    char cmd[128];
+
+    snprintf(cmd, sizeof(cmd), "SIMULATE %016x %02x %s test",
+             code, reps, button);
+    return lircd_command(fd, cmd).find("SUCCESS") != string::npos;
+};
+
 #endif
 
 // vim: set expandtab ts=4 sw=4:
@@ -0,0 +1,564 @@
+/****************************************************************************
+** codec-test.c ************************************************************
+****************************************************************************
+*
+* codec-test.c - Decode the test captures in-process and check the result.
+*
+* Each case is a directory with a config, a capture named durations or
+* durations.txt and optionally the expected output, decoded.txt or
+* codes.txt, as irsimreceive prints it. The capture is decoded and
+* compared with the expected output. Every code of the config is also
+* encoded with init_sim() and must decode as itself; configs with only
+* raw codes, which are not encoded, skip this.
+*
+* Configs are parsed and codes encoded up front, then the decoding runs
+* in a pool of threads, each with its own receiver context and its own
+* copy of the remotes. Input is fed from memory by a driver in this file
+* which ends like the file driver, so the output is the one of
+* irsimreceive. The virtual clock makes it independent of the load.
+*
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The memory driver below is installed in drv. */
+#define IN_DRIVER
+#include "lirc_config.h"
+#include "lirc_private.h"
+
+static const char* const USAGE =
+	"Usage: codec-test [options] <case directory>...\n\n"
+	"Options:\n"
+	"    -j, --jobs <n>:     Decode in n threads (number of CPUs).\n"
+	"    -v, --verbose       Print the decoded output of failed cases.\n"
+	"    -h, --help          Print this message.\n";
+
+static const struct option options[] = {
+	{ "help",    no_argument,	NULL, 'h' },
+	{ "jobs",    required_argument, NULL, 'j' },
+	{ "verbose", no_argument,	NULL, 'v' },
+	{ 0,	     0,			0,    0	  }
+};
+
+/** Expected output files, tried in this order. */
+static const char* const EXPECTED[] = { "decoded.txt", "codes.txt", NULL };
+
+/** Captures, tried in this order. */
+static const char* const CAPTURES[] = { "durations", "durations.txt", NULL };
+
+
+/** The signals fed to the decoder. */
+struct durations {
+	lirc_t*		data;
+	size_t		count;
+	size_t		size;
+};
+
+/** Output lines collected from decode_all(). */
+struct lines {
+	char*		text;
+	size_t		len;
+	size_t		size;
+	int		count;
+};
+
+/** One decoding run, capture or simulated codes. */
+struct job {
+	const char*		name;           /**< Case directory. */
+	const char*		kind;           /**< "capture" or "encoded". */
+	int			names_only;     /**< Check code names only. */
+	struct ir_remote*	remotes;        /**< Private copy. */
+	struct durations	input;
+	struct lines		output;
+	char*			expected;       /**< NULL: check not wanted. */
+	int			failed;
+	char			error[256];
+};
+
+static struct job* jobs = NULL;
+static int job_count = 0;
+static int next_job = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The input of the calling thread. */
+static __thread const struct durations* input = NULL;
+static __thread size_t input_pos = 0;
+static __thread int at_eof = 0;
+
+
+/** Like the file driver: the end of input is a timeout with LIRC_EOF. */
+static lirc_t memory_readdata(lirc_t timeout)
+{
+	if (input_pos < input->count)
+		return input->data[input_pos++];
+	at_eof = 1;
+	return LIRC_EOF | LIRC_MODE2_TIMEOUT | timeout;
+}
+
+
+static int memory_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
+{
+	return receive_decode(remote, ctx);
+}
+
+
+static const struct driver memory_driver = {
+	.name		= "memory",
+	.device		= "",
+	.fd		= -1,
+	.features	= LIRC_CAN_REC_MODE2,
+	.send_mode	= 0,
+	.rec_mode	= LIRC_MODE_MODE2,
+	.code_length	= 0,
+	.decode_func	= memory_decode,
+	.readdata	= memory_readdata,
+	.api_version	= 3,
+	.driver_version = "0.9.3",
+	.info		= "codec-test memory input",
+};
+
+
+static int add_duration(struct durations* d, lirc_t value)
+{
+	lirc_t* data;
+
+	if (d->count == d->size) {
+		d->size = d->size ? 2 * d->size : 4096;
+		data = (lirc_t*)realloc(d->data, d->size * sizeof(lirc_t));
+		if (data == NULL)
+			return 0;
+		d->data = data;
+	}
+	d->data[d->count++] = value;
+	return 1;
+}
+
+
+static int add_line(struct lines* l, const char* line)
+{
+	size_t len = strlen(line);
+	char* text;
+
+	if (l->len + len + 2 > l->size) {
+		l->size = l->size ? 2 * l->size + len : 4096 + len;
+		text = (char*)realloc(l->text, l->size);
+		if (text == NULL)
+			return 0;
+		l->text = text;
+	}
+	memcpy(l->text + l->len, line, len);
+	l->len += len;
+	if (len == 0 || line[len - 1] != '\n')
+		l->text[l->len++] = '\n';
+	l->text[l->len] = '\0';
+	l->count++;
+	return 1;
+}
+
+
+/** Load path like the file driver does. */
+static int read_durations(const char* path, struct durations* d)
+{
+	char line[64];
+	char what[16];
+	int value;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%15s %d", what, &value) != 2) {
+			value = 0;
+		} else {
+			value &= PULSE_MASK;
+			if (strstr(what, "pulse") != NULL)
+				value |= PULSE_BIT;
+		}
+		if (!add_duration(d, value)) {
+			fclose(f);
+			return 0;
+		}
+	}
+	fclose(f);
+	return 1;
+}
+
+
+/** Return the contents of path, NULL if missing. */
+static char* read_file(const char* path)
+{
+	char* text = NULL;
+	size_t size = 0;
+	size_t len = 0;
+	size_t n;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return NULL;
+	do {
+		if (len + 4096 + 1 > size) {
+			size = 2 * size + 4096 + 1;
+			text = (char*)realloc(text, size);
+			if (text == NULL) {
+				fclose(f);
+				return NULL;
+			}
+		}
+		n = fread(text + len, 1, 4096, f);
+		len += n;
+	} while (n > 0);
+	fclose(f);
+	text[len] = '\0';
+	return text;
+}
+
+
+static struct ir_remote* read_remotes(const char* path)
+{
+	struct ir_remote* remotes;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return NULL;
+	remotes = read_config(f, path);
+	fclose(f);
+	if (remotes == (void*)-1 || remotes == NULL)
+		return NULL;
+	return remotes;
+}
+
+
+/** The gap init_send() would leave after the signal, unset by init_sim(). */
+static lirc_t sim_gap(const struct ir_remote* remote)
+{
+	if (is_const(remote) && min_gap(remote) > send_buffer_sum())
+		return min_gap(remote) - send_buffer_sum();
+	return min_gap(remote);
+}
+
+
+/**
+ * Encode each code of remotes, separated by a long space so that none
+ * is taken as a repeat. The expected output is the name of each code,
+ * the first one of the same value for duplicates. Only names are
+ * compared: the printed code includes pre and post data, and identical
+ * remotes decode as the first of them.
+ */
+static int encode(struct job* job)
+{
+	struct lines expected = { NULL, 0, 0, 0 };
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	struct ir_ncode* first;
+	int i;
+
+	if (!add_duration(&job->input, 1000000))
+		return 0;
+	for (remote = job->remotes; remote != NULL; remote = remote->next) {
+		if (is_raw(remote))
+			/* The code value of raw codes is not decoded. */
+			continue;
+		for (code = remote->codes; code && code->name; code++) {
+			if (code->next != NULL || !init_sim(remote, code, 0))
+				continue;
+			for (i = 0; i < send_buffer_length(); i++) {
+				lirc_t value = send_buffer_data()[i];
+
+				if (i % 2 == 0)
+					value |= PULSE_BIT;
+				if (!add_duration(&job->input, value))
+					return 0;
+			}
+			if (!add_duration(&job->input, sim_gap(remote))
+			    || !add_duration(&job->input, 1000000))
+				return 0;
+			for (first = remote->codes; first->code != code->code;
+			     first++)
+				;
+			if (!add_line(&expected, first->name))
+				return 0;
+		}
+	}
+	job->names_only = 1;
+	job->expected = expected.text != NULL ? expected.text : strdup("");
+	return job->expected != NULL;
+}
+
+
+/** Decode the input of job, like irsimreceive does. */
+static void decode(struct job* job)
+{
+	char name[PACKET_SIZE + 1];
+	char* code;
+
+	input = &job->input;
+	input_pos = 0;
+	at_eof = 0;
+	rec_buffer_init();
+	while (1) {
+		if (at_eof)
+			break;
+		if (!rec_buffer_clear()) {
+			if (at_eof)
+				break;
+			continue;
+		}
+		code = decode_all(job->remotes);
+		if (code != NULL && job->names_only) {
+			if (sscanf(code, "%*s %*s %256s", name) != 1)
+				continue;
+			code = name;
+		}
+		if (code != NULL && !add_line(&job->output, code)) {
+			snprintf(job->error, sizeof(job->error),
+				 "out of memory");
+			job->failed = 1;
+			return;
+		}
+	}
+}
+
+
+/** Compare output and expected, describe the first difference. */
+static void check(struct job* job)
+{
+	const char* out = job->output.text ? job->output.text : "";
+	const char* exp = job->expected;
+	size_t start = 0;
+	int line = 1;
+	size_t i;
+
+	if (job->failed || exp == NULL)
+		return;
+	for (i = 0; out[i] == exp[i] && out[i] != '\0'; i++) {
+		if (out[i] == '\n') {
+			start = i + 1;
+			line++;
+		}
+	}
+	if (out[i] == exp[i])
+		return;
+	job->failed = 1;
+	snprintf(job->error, sizeof(job->error),
+		 "%s differs at line %d: got \"%.*s\", expected \"%.*s\"",
+		 job->kind, line,
+		 (int)strcspn(out + start, "\n"), out + start,
+		 (int)strcspn(exp + start, "\n"), exp + start);
+}
+
+
+static void* worker(void* arg)
+{
+	struct rec_context* ctx;
+	int i;
+
+	ctx = rec_context_new();
+	if (ctx == NULL)
+		return NULL;
+	rec_context_select(ctx);
+	while (1) {
+		pthread_mutex_lock(&job_lock);
+		i = next_job < job_count ? next_job++ : -1;
+		pthread_mutex_unlock(&job_lock);
+		if (i == -1)
+			break;
+		decode(&jobs[i]);
+		check(&jobs[i]);
+	}
+	rec_context_free(ctx);
+	return NULL;
+}
+
+
+/** Return the first of names existing in dir, NULL if none. */
+static char* find_file(const char* dir, const char* const* names)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; names[i] != NULL; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+		if (access(path, R_OK) == 0)
+			return strdup(path);
+	}
+	return NULL;
+}
+
+
+/** Return the config in dir, the only *.conf but lirc_options.conf. */
+static char* find_config(const char* dir)
+{
+	char path[PATH_MAX];
+	struct dirent* ent;
+	DIR* d;
+	size_t len;
+	int found = 0;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return NULL;
+	while ((ent = readdir(d)) != NULL) {
+		len = strlen(ent->d_name);
+		if (len < 5 || strcmp(ent->d_name + len - 5, ".conf") != 0
+		    || strcmp(ent->d_name, "lirc_options.conf") == 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		found++;
+	}
+	closedir(d);
+	return found == 1 ? strdup(path) : NULL;
+}
+
+
+static struct job* new_job(const char* name, const char* kind,
+			   const char* config)
+{
+	struct job* job;
+
+	job = (struct job*)realloc(jobs, (job_count + 1) * sizeof(*job));
+	if (job == NULL)
+		return NULL;
+	jobs = job;
+	job = &jobs[job_count];
+	memset(job, 0, sizeof(*job));
+	job->name = name;
+	job->kind = kind;
+	job->remotes = read_remotes(config);
+	if (job->remotes == NULL) {
+		fprintf(stderr, "%s: cannot parse %s\n", name, config);
+		return NULL;
+	}
+	job_count++;
+	return job;
+}
+
+
+/** Add the jobs of the case in dir. 0 on errors. */
+static int add_case(const char* dir)
+{
+	char* config = find_config(dir);
+	char* capture = find_file(dir, CAPTURES);
+	char* expected = find_file(dir, EXPECTED);
+	struct job* job;
+	int r = 0;
+
+	if (config == NULL || capture == NULL) {
+		fprintf(stderr, "%s: no config or capture\n", dir);
+		goto out;
+	}
+	job = new_job(dir, "capture", config);
+	if (job == NULL)
+		goto out;
+	if (!read_durations(capture, &job->input)) {
+		fprintf(stderr, "%s: cannot read %s\n", dir, capture);
+		goto out;
+	}
+	if (expected != NULL)
+		job->expected = read_file(expected);
+	job = new_job(dir, "encoded", config);
+	if (job == NULL)
+		goto out;
+	if (!encode(job)) {
+		fputs("Out of memory\n", stderr);
+		goto out;
+	}
+	if (job->expected[0] == '\0') {
+		/* Only raw codes, an empty run would pass unchecked. */
+		printf("SKIP: %s encoded, no codes to encode\n", dir);
+		free_config(job->remotes);
+		free(job->input.data);
+		free(job->expected);
+		job_count--;
+	}
+	r = 1;
+out:
+	free(config);
+	free(capture);
+	free(expected);
+	return r;
+}
+
+
+int main(int argc, char** argv)
+{
+	pthread_t* threads;
+	long threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+	int verbose = 0;
+	int failed = 0;
+	int c;
+	int i;
+
+	lirc_log_set_file("codec-test.log");
+	lirc_log_open("codec-test", 0, LIRC_ERROR);
+	options_load(argc, argv, NULL, NULL);
+	memcpy(&drv, &memory_driver, sizeof(drv));
+	send_buffer_init();
+	rec_set_virtual_clock(1);
+	while ((c = getopt_long(argc, argv, "hj:v", options, NULL)) != EOF) {
+		switch (c) {
+		case 'h':
+			fputs(USAGE, stdout);
+			return EXIT_SUCCESS;
+		case 'j':
+			threads_count = atol(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fputs(USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind == argc || threads_count < 1) {
+		fputs(USAGE, stderr);
+		return EXIT_FAILURE;
+	}
+	for (; optind < argc; optind++)
+		if (!add_case(argv[optind]))
+			return EXIT_FAILURE;
+	if (threads_count > job_count)
+		threads_count = job_count;
+	threads = (pthread_t*)calloc(threads_count, sizeof(pthread_t));
+	if (threads == NULL)
+		return EXIT_FAILURE;
+	for (i = 0; i < threads_count; i++)
+		if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+			fputs("Cannot create thread\n", stderr);
+			return EXIT_FAILURE;
+		}
+	for (i = 0; i < threads_count; i++)
+		pthread_join(threads[i], NULL);
+	for (i = 0; i < job_count; i++) {
+		if (!jobs[i].failed) {
+			printf("OK: %s %s, %d codes%s\n", jobs[i].name,
+			       jobs[i].kind, jobs[i].output.count,
+			       jobs[i].expected ? "" : " (not checked)");
+			continue;
+		}
+		failed++;
+		printf("FAIL: %s %s\n", jobs[i].name, jobs[i].error);
+		if (verbose && jobs[i].output.text != NULL)
+			fputs(jobs[i].output.text, stdout);
+	}
+	for (i = 0; i < job_count; i++) {
+		free_config(jobs[i].remotes);
+		free(jobs[i].input.data);
+		free(jobs[i].output.text);
+		free(jobs[i].expected);
+	}
+	free(jobs);
+	free(threads);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,447 @@
+/****************************************************************************
+** config-bench.c **********************************************************
+****************************************************************************
+*
+* config-bench.c - Time read_config() on lircd.conf files.
+*
+* Each file given, or each *.conf file in a given directory, is parsed
+* repeatedly. With -g a remote with the given number of codes is
+* generated in memory and parsed as well, exposing costs growing faster
+* than the number of codes. Peak RSS is reported once at the end. With
+* -m the exit status is non-zero if any file takes longer than the given
+* time, so the benchmark works as a regression check.
+*
+* With -k the remotes of all files are kept loaded at once, as lircd
+* does with an include directory, and the memory they use is reported.
+* -r sets a limit for the peak RSS, making that a regression check too.
+*
+* Files given with -l are lircrc files, parsed by lirc_readconfig_only().
+* Dispatching a code for each button of it with lirc_code2char() is
+* timed as well.
+*
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "lirc_private.h"
+#include "lirc_client.h"
+
+static const char* const USAGE =
+	"Usage: config-bench [options] <config | directory>...\n\n"
+	"<config> is a lircd.conf type configuration, directories are\n"
+	"searched for *.conf files.\n\n"
+	"Options:\n"
+	"    -g, --generate <codes>:     Also parse a remote with this many\n"
+	"                                generated codes.\n"
+	"    -n, --count <n>:            Parse each config n times (100).\n"
+	"    -m, --max-time <ms>:        Fail if a parse takes longer.\n"
+	"    -l, --lircrc <file>:        Time parsing and dispatch of lircrc.\n"
+	"    -k, --keep                  Keep all configs loaded, report\n"
+	"                                their memory.\n"
+	"    -r, --max-rss <kB>:         Fail if peak RSS is larger.\n"
+	"    -h, --help                  Print this message.\n";
+
+static const struct option options[] = {
+	{ "help",     no_argument,	 NULL, 'h' },
+	{ "generate", required_argument, NULL, 'g' },
+	{ "count",    required_argument, NULL, 'n' },
+	{ "max-time", required_argument, NULL, 'm' },
+	{ "lircrc",   required_argument, NULL, 'l' },
+	{ "keep",     no_argument,	 NULL, 'k' },
+	{ "max-rss",  required_argument, NULL, 'r' },
+	{ 0,	      0,		 0,    0   }
+};
+
+
+/** The text of one config, parsed from memory. */
+struct config_text {
+	char*		data;
+	size_t		size;
+};
+
+static long count = 100;
+static double max_ms = 0;
+static int slow = 0;
+
+/** The configs kept loaded with -k. */
+static int keep = 0;
+static struct ir_remote** kept = NULL;
+static size_t kept_count = 0;
+
+
+static int read_text(const char* path, struct config_text* text)
+{
+	FILE* f;
+	long size;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+		fprintf(stderr, "Cannot size %s\n", path);
+		fclose(f);
+		return 0;
+	}
+	rewind(f);
+	text->data = (char*)malloc(size + 1);
+	if (text->data == NULL
+	    || fread(text->data, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "Cannot read %s\n", path);
+		fclose(f);
+		free(text->data);
+		return 0;
+	}
+	text->size = size;
+	fclose(f);
+	return 1;
+}
+
+
+/** Create a space encoded remote with codes distinct codes. */
+static int generate_text(long codes, struct config_text* text)
+{
+	FILE* f;
+	long i;
+
+	f = open_memstream(&text->data, &text->size);
+	if (f == NULL)
+		return 0;
+	fprintf(f, "begin remote\n"
+		"  name  generated\n"
+		"  bits  32\n"
+		"  flags SPACE_ENC|CONST_LENGTH\n"
+		"  eps   30\n"
+		"  aeps  100\n"
+		"  header 9000 4500\n"
+		"  one   560 1690\n"
+		"  zero  560 560\n"
+		"  ptrail 560\n"
+		"  gap   108000\n"
+		"  begin codes\n");
+	for (i = 0; i < codes; i++)
+		fprintf(f, "    KEY_%ld 0x%08lX\n", i, (unsigned long)i);
+	fprintf(f, "  end codes\nend remote\n");
+	return fclose(f) == 0;
+}
+
+
+static double elapsed_ns(const struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9
+	       + (now.tv_nsec - start->tv_nsec);
+}
+
+
+/** Parse text once, append the remotes to kept. */
+static void keep_config(const char* path, const struct config_text* text)
+{
+	struct ir_remote* remotes;
+	struct ir_remote** p;
+	FILE* f;
+
+	f = fmemopen(text->data, text->size, "r");
+	if (f == NULL)
+		return;
+	remotes = read_config(f, path);
+	fclose(f);
+	if (remotes == (void*)-1 || remotes == NULL)
+		return;
+	p = (struct ir_remote**)realloc(kept,
+					(kept_count + 1) * sizeof(*kept));
+	if (p == NULL) {
+		free_config(remotes);
+		return;
+	}
+	kept = p;
+	kept[kept_count++] = remotes;
+}
+
+
+static void report_kept(void)
+{
+	struct config_memory usage = { 0, 0 };
+	const struct ir_remote* remote;
+	size_t remotes = 0;
+	size_t i;
+
+	for (i = 0; i < kept_count; i++) {
+		config_memory(kept[i], &usage);
+		for (remote = kept[i]; remote != NULL; remote = remote->next)
+			remotes++;
+	}
+	printf("Kept: %zu configs %zu remotes %zu kB config %zu kB raw codes"
+	       " %zu kB names\n",
+	       kept_count, remotes, usage.config / 1024, usage.raw / 1024,
+	       lirc_atom_memory() / 1024);
+	for (i = 0; i < kept_count; i++)
+		free_config(kept[i]);
+	free(kept);
+}
+
+
+/** Parse text once, return the number of remotes or -1 on errors. */
+static int parse_pass(const char* path, const struct config_text* text)
+{
+	struct ir_remote* remotes;
+	struct ir_remote* remote;
+	int remote_count = 0;
+	FILE* f;
+
+	f = fmemopen(text->data, text->size, "r");
+	if (f == NULL)
+		return -1;
+	remotes = read_config(f, path);
+	fclose(f);
+	if (remotes == (void*)-1 || remotes == NULL)
+		return -1;
+	for (remote = remotes; remote != NULL; remote = remote->next)
+		remote_count++;
+	free_config(remotes);
+	return remote_count;
+}
+
+
+static int bench(const char* path, const struct config_text* text)
+{
+	struct timespec start;
+	const char* label;
+	int remotes;
+	double ns;
+	long i;
+
+	label = strrchr(path, '/');
+	label = label ? label + 1 : path;
+	remotes = parse_pass(path, text);       /* Warm up. */
+	if (remotes < 0) {
+		printf("%-32s parse error\n", label);
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++)
+		parse_pass(path, text);
+	ns = elapsed_ns(&start) / count;
+	printf("%-32s %4d remotes %8zu bytes %10.0f ns/parse %8.1f MB/s%s\n",
+	       label, remotes, text->size, ns, text->size * 1e3 / ns,
+	       max_ms > 0 && ns > max_ms * 1e6 ? "  TOO SLOW" : "");
+	if (max_ms > 0 && ns > max_ms * 1e6)
+		slow = 1;
+	if (keep)
+		keep_config(path, text);
+	return 1;
+}
+
+
+/** Parse file, or all *.conf files below a directory. */
+static int bench_path(const char* path)
+{
+	struct config_text text = { NULL, 0 };
+	struct dirent** entries;
+	struct stat st;
+	char file[4096];
+	const char* dot;
+	int ok = 1;
+	int n;
+	int i;
+
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		if (!read_text(path, &text))
+			return 0;
+		ok = bench(path, &text);
+		free(text.data);
+		return ok;
+	}
+	n = scandir(path, &entries, NULL, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(file, sizeof(file), "%s/%s", path, entries[i]->d_name);
+		dot = strrchr(entries[i]->d_name, '.');
+		if (entries[i]->d_name[0] != '.'
+		    && strcmp(entries[i]->d_name, "lirc_options.conf") != 0
+		    && ((dot != NULL && strcmp(dot, ".conf") == 0)
+			|| (stat(file, &st) == 0 && S_ISDIR(st.st_mode))))
+			ok = bench_path(file) && ok;
+		free(entries[i]);
+	}
+	free(entries);
+	return ok;
+}
+
+
+/** Return malloc'ed code lines for all buttons in config, NULL-ended. */
+static char** lircrc_codes(const struct lirc_config* config)
+{
+	const struct lirc_config_entry* entry;
+	const struct lirc_code* code;
+	const char* remote;
+	const char* button;
+	char** lines = NULL;
+	size_t count = 0;
+	size_t size;
+	char** p;
+
+	for (entry = config->first; entry != NULL; entry = entry->next) {
+		for (code = entry->code; code != NULL; code = code->next) {
+			p = (char**)realloc(lines, (count + 2) * sizeof(char*));
+			if (p == NULL)
+				return lines;
+			lines = p;
+			lines[count] = NULL;
+			remote = code->remote == LIRC_ALL ?
+				 "bench" : code->remote;
+			button = code->button == LIRC_ALL ?
+				 "KEY_BENCH" : code->button;
+			size = strlen(button) + strlen(remote) + 24;
+			lines[count] = (char*)malloc(size);
+			if (lines[count] == NULL)
+				return lines;
+			snprintf(lines[count], size,
+				 "0000000000000000 00 %s %s\n",
+				 button, remote);
+			lines[++count] = NULL;
+		}
+	}
+	return lines;
+}
+
+
+static int bench_lircrc(const char* path)
+{
+	struct lirc_config* config;
+	struct timespec start;
+	const char* label;
+	char** lines;
+	char* s;
+	unsigned long dispatched = 0;
+	unsigned long lookups = 0;
+	double parse_ns;
+	double ns;
+	long i;
+	int j;
+
+	label = strrchr(path, '/');
+	label = label ? label + 1 : path;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++) {
+		if (lirc_readconfig_only(path, &config, NULL) != 0) {
+			printf("%-32s parse error\n", label);
+			return 0;
+		}
+		lirc_freeconfig(config);
+	}
+	parse_ns = elapsed_ns(&start) / count;
+	if (lirc_readconfig_only(path, &config, NULL) != 0)
+		return 0;
+	lines = lircrc_codes(config);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; lines != NULL && i < count; i++) {
+		for (j = 0; lines[j] != NULL; j++) {
+			lookups++;
+			while (lirc_code2char(config, lines[j], &s) == 0
+			       && s != NULL)
+				dispatched++;
+		}
+	}
+	ns = elapsed_ns(&start);
+	printf("%-32s %4lu buttons %10.0f ns/parse %10.0f ns/dispatch"
+	       " %6.2f strings/dispatch\n",
+	       label, lookups / count, parse_ns,
+	       lookups ? ns / lookups : 0,
+	       lookups ? (double)dispatched / lookups : 0);
+	for (j = 0; lines != NULL && lines[j] != NULL; j++)
+		free(lines[j]);
+	free(lines);
+	lirc_freeconfig(config);
+	if (max_ms > 0 && parse_ns > max_ms * 1e6)
+		slow = 1;
+	return 1;
+}
+
+
+int main(int argc, char** argv)
+{
+	struct config_text text = { NULL, 0 };
+	struct rusage usage;
+	const char* lircrcs[16];
+	int lircrc_count = 0;
+	long codes = 0;
+	long max_rss = 0;
+	int ok = 1;
+	int c;
+
+	lirc_log_set_file("config-bench.log");
+	lirc_log_open("config-bench", 0, LIRC_ERROR);
+	while ((c = getopt_long(argc, argv, "hg:n:m:l:kr:", options, NULL))
+	       != EOF) {
+		switch (c) {
+		case 'h':
+			fputs(USAGE, stdout);
+			return EXIT_SUCCESS;
+		case 'g':
+			codes = atol(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'm':
+			max_ms = atof(optarg);
+			break;
+		case 'l':
+			if (lircrc_count < 16)
+				lircrcs[lircrc_count++] = optarg;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'r':
+			max_rss = atol(optarg);
+			break;
+		default:
+			fputs(USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (count <= 0
+	    || (optind == argc && codes <= 0 && lircrc_count == 0)) {
+		fputs(USAGE, stderr);
+		return EXIT_FAILURE;
+	}
+	for (; optind < argc; optind++)
+		ok = bench_path(argv[optind]) && ok;
+	if (codes > 0) {
+		if (!generate_text(codes, &text)) {
+			fputs("Out of memory\n", stderr);
+			return EXIT_FAILURE;
+		}
+		ok = bench("generated.conf", &text) && ok;
+		free(text.data);
+	}
+	for (c = 0; c < lircrc_count; c++)
+		ok = bench_lircrc(lircrcs[c]) && ok;
+	getrusage(RUSAGE_SELF, &usage);
+	if (keep)
+		report_kept();
+	printf("Peak RSS: %ld kB\n", usage.ru_maxrss);
+	if (slow)
+		fprintf(stderr, "Parse time above %g ms\n", max_ms);
+	if (max_rss > 0 && usage.ru_maxrss > max_rss) {
+		fprintf(stderr, "Peak RSS above %ld kB\n", max_rss);
+		ok = 0;
+	}
+	return ok && !slow ? EXIT_SUCCESS : EXIT_FAILURE;
+}
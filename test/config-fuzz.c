@@ -0,0 +1,73 @@
+/****************************************************************************
+** config-fuzz.c ***********************************************************
+****************************************************************************
+*
+* config-fuzz.c - libFuzzer target for the lircd.conf and lircrc parsers.
+*
+* Each input is parsed by read_config() from memory, and by
+* lirc_readconfig_only() from a temporary file: lirc_readconfig() is
+* the same parser but may start lircrcd. Build with clang, see the
+* config-fuzz target in the Makefile.
+*
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lirc_private.h"
+#include "lirc_client.h"
+
+static char lircrc_path[] = "/tmp/config-fuzz-XXXXXX";
+static int lircrc_fd = -1;
+
+
+int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+	lirc_log_set_file("/dev/null");
+	lirc_log_open("config-fuzz", 0, LIRC_ERROR);
+	lircrc_fd = mkstemp(lircrc_path);
+	if (lircrc_fd == -1) {
+		perror("mkstemp");
+		exit(EXIT_FAILURE);
+	}
+	unlink(lircrc_path);
+	snprintf(lircrc_path, sizeof(lircrc_path), "/dev/fd/%d", lircrc_fd);
+	return 0;
+}
+
+
+static void fuzz_read_config(const uint8_t* data, size_t size)
+{
+	struct ir_remote* remotes;
+	FILE* f;
+
+	f = fmemopen((void*)data, size, "r");
+	if (f == NULL)
+		return;
+	remotes = read_config(f, "fuzz.conf");
+	fclose(f);
+	if (remotes != NULL && remotes != (void*)-1)
+		free_config(remotes);
+}
+
+
+static void fuzz_lirc_readconfig(const uint8_t* data, size_t size)
+{
+	struct lirc_config* config;
+
+	if (ftruncate(lircrc_fd, 0) != 0
+	    || pwrite(lircrc_fd, data, size, 0) != (ssize_t)size)
+		return;
+	if (lirc_readconfig_only(lircrc_path, &config, NULL) == 0)
+		lirc_freeconfig(config);
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	fuzz_read_config(data, size);
+	fuzz_lirc_readconfig(data, size);
+	return 0;
+}
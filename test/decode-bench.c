@@ -0,0 +1,382 @@
+/****************************************************************************
+** decode-bench.c **********************************************************
+****************************************************************************
+*
+* decode-bench.c - Time decode_all() on captured and simulated signals.
+*
+* Each config + durations pair is a capture replayed with the remotes of
+* the config loaded. The configs given with -s are loaded together, and
+* every code of every remote is encoded with init_sim() and decoded with
+* all of them loaded. Input is fed from memory by a driver in this file,
+* so only the decoding is measured. The encoding of the simulated set is
+* timed separately.
+*
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The memory driver below is installed in drv. */
+#define IN_DRIVER
+#include "lirc_private.h"
+
+static const char* const USAGE =
+	"Usage: decode-bench [options] [<config> <durations>]...\n\n"
+	"<config> is a lircd.conf type configuration.\n"
+	"<durations> is a list of pulse/space durations captured for it.\n\n"
+	"Options:\n"
+	"    -s, --simulate <config>:    Add remotes to the simulated set.\n"
+	"    -t, --time <ms>:            Run each benchmark this long (500).\n"
+	"    -h, --help                  Print this message.\n";
+
+static const struct option options[] = {
+	{ "help",     no_argument,	 NULL, 'h' },
+	{ "simulate", required_argument, NULL, 's' },
+	{ "time",     required_argument, NULL, 't' },
+	{ 0,	      0,		 0,    0   }
+};
+
+/* Allocation counting, glibc specific. */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long alloc_count = 0;
+
+void* malloc(size_t size)
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+
+
+/** The signals fed to the decoder. */
+struct durations {
+	lirc_t*		data;
+	size_t		count;
+	size_t		size;
+};
+
+static const struct durations* input = NULL;
+static size_t input_pos = 0;
+
+static lirc_t bench_readdata(lirc_t timeout)
+{
+	if (input_pos >= input->count)
+		return 0;
+	return input->data[input_pos++];
+}
+
+
+static int bench_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
+{
+	return receive_decode(remote, ctx);
+}
+
+
+static const struct driver bench_driver = {
+	.name		= "bench",
+	.device		= "",
+	.fd		= -1,
+	.features	= LIRC_CAN_REC_MODE2,
+	.send_mode	= 0,
+	.rec_mode	= LIRC_MODE_MODE2,
+	.code_length	= 0,
+	.decode_func	= bench_decode,
+	.readdata	= bench_readdata,
+	.api_version	= 3,
+	.driver_version = "0.9.3",
+	.info		= "decode-bench memory input",
+};
+
+
+static int add_duration(struct durations* d, lirc_t value)
+{
+	lirc_t* data;
+
+	if (d->count == d->size) {
+		d->size = d->size ? 2 * d->size : 4096;
+		data = (lirc_t*)realloc(d->data, d->size * sizeof(lirc_t));
+		if (data == NULL)
+			return 0;
+		d->data = data;
+	}
+	d->data[d->count++] = value;
+	return 1;
+}
+
+
+static int read_durations(const char* path, struct durations* d)
+{
+	char line[64];
+	char what[16];
+	int value;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	d->count = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%15s %d", what, &value) != 2)
+			continue;
+		value &= PULSE_MASK;
+		if (strcmp(what, "pulse") == 0)
+			value |= PULSE_BIT;
+		else if (strcmp(what, "space") != 0)
+			continue;
+		if (!add_duration(d, value)) {
+			fclose(f);
+			return 0;
+		}
+	}
+	fclose(f);
+	/* Terminate the last code. */
+	return add_duration(d, 1000000);
+}
+
+
+static struct ir_remote* read_remotes(const char* path)
+{
+	struct ir_remote* remotes;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	remotes = read_config(f, path);
+	fclose(f);
+	if (remotes == (void*)-1 || remotes == NULL) {
+		fprintf(stderr, "Cannot parse %s\n", path);
+		return NULL;
+	}
+	return remotes;
+}
+
+
+/** The gap init_send() would leave after the signal, unset by init_sim(). */
+static lirc_t sim_gap(const struct ir_remote* remote, int repeat)
+{
+	if (has_repeat_gap(remote) && repeat && has_repeat(remote))
+		return remote->repeat_gap;
+	if (is_const(remote) && min_gap(remote) > send_buffer_sum())
+		return min_gap(remote) - send_buffer_sum();
+	return min_gap(remote);
+}
+
+
+/** Encode each code of remotes, once and as a repeat. */
+static int simulate(struct ir_remote* remotes, struct durations* d)
+{
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	int repeat;
+	int i;
+
+	if (!add_duration(d, 1000000))
+		return 0;
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		for (code = remote->codes; code && code->name; code++) {
+			for (repeat = 0; repeat < 2; repeat++) {
+				if (!init_sim(remote, code, repeat))
+					continue;
+				for (i = 0; i < send_buffer_length(); i++) {
+					lirc_t value = send_buffer_data()[i];
+
+					if (i % 2 == 0)
+						value |= PULSE_BIT;
+					if (!add_duration(d, value))
+						return 0;
+				}
+				if (!add_duration(d, sim_gap(remote, repeat)))
+					return 0;
+			}
+		}
+	}
+	/* Other remotes must not be sent back to back. */
+	return add_duration(d, 1000000);
+}
+
+
+static double elapsed_ns(const struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9
+	       + (now.tv_nsec - start->tv_nsec);
+}
+
+
+/** Decode all of d once, return the number of decoded codes. */
+static unsigned long decode_pass(struct ir_remote* remotes,
+				 const struct durations* d)
+{
+	unsigned long decoded = 0;
+
+	input = d;
+	input_pos = 0;
+	rec_buffer_init();
+	while (input_pos < d->count) {
+		if (!rec_buffer_clear())
+			continue;
+		if (decode_all(remotes) != NULL)
+			decoded++;
+	}
+	return decoded;
+}
+
+
+static void bench(const char* label,
+		  struct ir_remote* remotes,
+		  const struct durations* d,
+		  long msec)
+{
+	struct ir_remote* remote;
+	struct timespec start;
+	unsigned long allocs;
+	unsigned long decoded = 0;
+	unsigned long passes = 0;
+	int remote_count = 0;
+	double ns;
+
+	for (remote = remotes; remote != NULL; remote = remote->next)
+		remote_count++;
+	decode_pass(remotes, d);        /* Warm up. */
+	allocs = alloc_count;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		decoded += decode_pass(remotes, d);
+		passes++;
+		ns = elapsed_ns(&start);
+	} while (ns < msec * 1e6);
+	allocs = alloc_count - allocs;
+	if (decoded == 0) {
+		printf("%-32s %4d remotes: nothing decoded\n",
+		       label, remote_count);
+		return;
+	}
+	printf("%-32s %4d remotes %6lu codes %9.0f ns/decode %9.0f decodes/s"
+	       " %6.2f allocs/decode\n",
+	       label, remote_count, decoded / passes, ns / decoded,
+	       decoded * 1e9 / ns, (double)allocs / decoded);
+}
+
+
+/** Time encoding every code of remotes, once and as a repeat. */
+static void bench_encode(struct ir_remote* remotes, long msec)
+{
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	struct timespec start;
+	unsigned long encoded = 0;
+	unsigned long passes = 0;
+	int remote_count = 0;
+	int repeat;
+	double ns;
+
+	for (remote = remotes; remote != NULL; remote = remote->next)
+		remote_count++;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (remote = remotes; remote != NULL; remote = remote->next) {
+			for (code = remote->codes; code && code->name; code++) {
+				for (repeat = 0; repeat < 2; repeat++)
+					encoded += init_sim(remote, code, repeat);
+			}
+		}
+		passes++;
+		ns = elapsed_ns(&start);
+	} while (ns < msec * 1e6);
+	if (encoded == 0) {
+		printf("%-32s %4d remotes: nothing encoded\n",
+		       "encode", remote_count);
+		return;
+	}
+	printf("%-32s %4d remotes %6lu codes %9.0f ns/encode %9.0f encodes/s\n",
+	       "encode", remote_count, encoded / passes, ns / encoded,
+	       encoded * 1e9 / ns);
+}
+
+
+int main(int argc, char** argv)
+{
+	struct ir_remote* all = NULL;
+	struct ir_remote** tail = &all;
+	struct ir_remote* remotes;
+	struct durations d = { NULL, 0, 0 };
+	const char* label;
+	long msec = 500;
+	int c;
+
+	lirc_log_set_file("decode-bench.log");
+	lirc_log_open("decode-bench", 0, LIRC_ERROR);
+	options_load(argc, argv, NULL, NULL);
+	memcpy(&drv, &bench_driver, sizeof(drv));
+	send_buffer_init();
+	while ((c = getopt_long(argc, argv, "hs:t:", options, NULL)) != EOF) {
+		switch (c) {
+		case 'h':
+			fputs(USAGE, stdout);
+			return EXIT_SUCCESS;
+		case 's':
+			remotes = read_remotes(optarg);
+			if (remotes == NULL)
+				return EXIT_FAILURE;
+			*tail = remotes;
+			while (*tail != NULL)
+				tail = &(*tail)->next;
+			break;
+		case 't':
+			msec = atol(optarg);
+			break;
+		default:
+			fputs(USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if ((argc - optind) % 2 != 0 || (optind == argc && all == NULL)) {
+		fputs(USAGE, stderr);
+		return EXIT_FAILURE;
+	}
+	for (; optind < argc; optind += 2) {
+		remotes = read_remotes(argv[optind]);
+		if (remotes == NULL || !read_durations(argv[optind + 1], &d))
+			return EXIT_FAILURE;
+		label = strrchr(argv[optind], '/');
+		bench(label ? label + 1 : argv[optind], remotes, &d, msec);
+		free_config(remotes);
+	}
+	if (all != NULL) {
+		d.count = 0;
+		if (!simulate(all, &d)) {
+			fputs("Out of memory\n", stderr);
+			return EXIT_FAILURE;
+		}
+		bench("simulated", all, &d, msec);
+		bench_encode(all, msec);
+		free_config(all);
+	}
+	free(d.data);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,364 @@
+/****************************************************************************
+** irtoy-bench.c ***********************************************************
+****************************************************************************
+*
+* irtoy-bench.c - Time transmission through the irtoy plugin.
+*
+* The plugin is loaded and talks to an emulated USB IR Toy on a pty. The
+* emulator models the firmware's double buffer: a 62 byte packet is
+* transmitted while the next one is received, and the handshake asking
+* for more is sent when a packet starts transmitting, after a USB
+* latency. A packet arriving after the previous one has been sent is a
+* gap in the IR signal.
+*
+* Every code of the config is sent, and the time of each send() is
+* compared to the time the signal is on the air. The plugin wants a
+* lock file for the pty, so this must run as a user allowed to create
+* one.
+*
+*/
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IN_DRIVER
+#include "lirc_private.h"
+
+static const char* const USAGE =
+	"Usage: irtoy-bench [options] <config>\n\n"
+	"<config> is a lircd.conf type configuration.\n\n"
+	"Options:\n"
+	"    -p, --plugin <path>:        irtoy plugin"
+	" (../plugins/.libs/irtoy.so).\n"
+	"    -l, --latency <us>:         USB latency of the device (1000).\n"
+	"    -x, --speed <factor>:       Speed up the on air time (1).\n"
+	"    -n, --count <n>:            Send each code n times (1).\n"
+	"    -h, --help                  Print this message.\n";
+
+static const struct option options[] = {
+	{ "help",    no_argument,	NULL, 'h' },
+	{ "plugin",  required_argument, NULL, 'p' },
+	{ "latency", required_argument, NULL, 'l' },
+	{ "speed",   required_argument, NULL, 'x' },
+	{ "count",   required_argument, NULL, 'n' },
+	{ 0,	     0,			0,    0	  }
+};
+
+/** Sample unit of the device, us. */
+#define TOY_UNIT 21.3333
+
+/** Size of a firmware packet buffer. */
+#define TOY_PACKET 62
+
+enum toy_state { TOY_COMMAND, TOY_ARGS, TOY_TRANSMIT };
+
+/** The emulated device. */
+struct toy {
+	int		fd;             /**< pty master. */
+	long		latency;        /**< us, before each reply. */
+	double		speed;
+	enum toy_state	state;
+	int		args;           /**< Left to skip in TOY_ARGS. */
+	int		high;           /**< First byte of a sample, or -1. */
+	int		bytes;          /**< In the current transmission. */
+	int		packet;         /**< Bytes in the current packet. */
+	double		duration;       /**< Of the current packet, us. */
+	double		tx_end;         /**< Time the last packet is sent. */
+	int		sending;        /**< tx_end is valid. */
+	unsigned long	packets;
+	unsigned long	gaps;
+	double		gap_us;
+};
+
+static struct toy toy;
+
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+static void sleep_until(double when)
+{
+	double left = when - now_us();
+	struct timespec ts;
+
+	if (left <= 0)
+		return;
+	ts.tv_sec = (time_t)(left / 1e6);
+	ts.tv_nsec = (long)((left - ts.tv_sec * 1e6) * 1e3);
+	nanosleep(&ts, NULL);
+}
+
+
+static void toy_reply(const void* data, size_t size, double when)
+{
+	sleep_until(when + toy.latency);
+	if (write(toy.fd, data, size) != (ssize_t)size)
+		perror("irtoy-bench: write");
+}
+
+
+/** A packet is complete, schedule it after the one being sent. */
+static double toy_packet_done(void)
+{
+	double now = now_us();
+	double start = now;
+
+	if (toy.sending && now > toy.tx_end) {
+		toy.gaps++;
+		toy.gap_us += now - toy.tx_end;
+	}
+	if (toy.sending && toy.tx_end > now)
+		start = toy.tx_end;
+	toy.tx_end = start + toy.duration / toy.speed;
+	toy.sending = 1;
+	toy.packets++;
+	toy.packet = 0;
+	toy.duration = 0;
+	return start;
+}
+
+
+static void toy_transmit(unsigned char c)
+{
+	static const unsigned char handshake = TOY_PACKET;
+	unsigned char reply[4];
+	int value;
+
+	toy.bytes++;
+	toy.packet++;
+	if (toy.high < 0) {
+		toy.high = c;
+	} else {
+		value = toy.high << 8 | c;
+		toy.high = -1;
+		if (value == 0xffff) {
+			/* The last packet is acknowledged as well. */
+			toy_reply(&handshake, 1, toy_packet_done());
+			reply[0] = 't';
+			reply[1] = toy.bytes >> 8;
+			reply[2] = toy.bytes & 0xff;
+			reply[3] = 'C';
+			toy_reply(reply, sizeof(reply), toy.tx_end);
+			toy.sending = 0;
+			toy.state = TOY_COMMAND;
+			return;
+		}
+		toy.duration += value * TOY_UNIT;
+	}
+	if (toy.packet == TOY_PACKET)
+		toy_reply(&handshake, 1, toy_packet_done());
+}
+
+
+static void toy_input(unsigned char c)
+{
+	static const unsigned char handshake = TOY_PACKET;
+
+	switch (toy.state) {
+	case TOY_TRANSMIT:
+		toy_transmit(c);
+		break;
+	case TOY_ARGS:
+		if (--toy.args == 0)
+			toy.state = TOY_COMMAND;
+		break;
+	case TOY_COMMAND:
+		switch (c) {
+		case 'v':
+			toy_reply("V222", 4, now_us());
+			break;
+		case 's':
+			toy_reply("S01", 3, now_us());
+			break;
+		case 0x30:
+		case 0x31:
+			toy.args = 2;
+			toy.state = TOY_ARGS;
+			break;
+		case 0x03:
+			toy.state = TOY_TRANSMIT;
+			toy.high = -1;
+			toy.bytes = 0;
+			toy.packet = 0;
+			toy.duration = 0;
+			toy_reply(&handshake, 1, now_us());
+			break;
+		default:
+			break;
+		}
+		break;
+	}
+}
+
+
+static void* toy_main(void* arg)
+{
+	unsigned char buf[256];
+	ssize_t r;
+	ssize_t i;
+
+	while ((r = read(toy.fd, buf, sizeof(buf))) > 0 || errno == EINTR) {
+		for (i = 0; i < r; i++)
+			toy_input(buf[i]);
+	}
+	return NULL;
+}
+
+
+static struct ir_remote* read_remotes(const char* path)
+{
+	struct ir_remote* remotes;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	remotes = read_config(f, path);
+	fclose(f);
+	if (remotes == (void*)-1 || remotes == NULL) {
+		fprintf(stderr, "Cannot parse %s\n", path);
+		return NULL;
+	}
+	return remotes;
+}
+
+
+static int load_plugin(const char* path, const char* device)
+{
+	const struct driver* const* hardwares;
+	void* handle;
+
+	handle = dlopen(path, RTLD_NOW);
+	if (handle == NULL) {
+		fprintf(stderr, "Cannot load %s: %s\n", path, dlerror());
+		return 0;
+	}
+	hardwares = (const struct driver* const*)dlsym(handle, "hardwares");
+	if (hardwares == NULL || hardwares[0] == NULL) {
+		fprintf(stderr, "No driver in %s\n", path);
+		return 0;
+	}
+	memcpy(&drv, hardwares[0], sizeof(drv));
+	drv.device = device;
+	if (!drv.init_func()) {
+		fprintf(stderr, "Cannot init the driver, see irtoy-bench.log\n");
+		return 0;
+	}
+	return 1;
+}
+
+
+int main(int argc, char** argv)
+{
+	const char* plugin = "../plugins/.libs/irtoy.so";
+	struct ir_remote* remotes;
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	struct termios tio;
+	pthread_t thread;
+	char device[64];
+	unsigned long sends = 0;
+	unsigned long failed = 0;
+	double on_air = 0;
+	double wall = 0;
+	double start;
+	const char* label;
+	int count = 1;
+	int slave;
+	int c;
+	int i;
+
+	toy.latency = 1000;
+	toy.speed = 1;
+	while ((c = getopt_long(argc, argv, "hp:l:x:n:", options, NULL))
+	       != EOF) {
+		switch (c) {
+		case 'h':
+			fputs(USAGE, stdout);
+			return EXIT_SUCCESS;
+		case 'p':
+			plugin = optarg;
+			break;
+		case 'l':
+			toy.latency = atol(optarg);
+			break;
+		case 'x':
+			toy.speed = atof(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			fputs(USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1 || toy.speed <= 0 || count < 1) {
+		fputs(USAGE, stderr);
+		return EXIT_FAILURE;
+	}
+	lirc_log_set_file("irtoy-bench.log");
+	lirc_log_open("irtoy-bench", 0, LIRC_ERROR);
+	options_load(argc, argv, NULL, NULL);
+	remotes = read_remotes(argv[optind]);
+	if (remotes == NULL)
+		return EXIT_FAILURE;
+
+	if (openpty(&toy.fd, &slave, device, NULL, NULL) == -1) {
+		perror("openpty");
+		return EXIT_FAILURE;
+	}
+	tcgetattr(toy.fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(toy.fd, TCSANOW, &tio);
+	pthread_create(&thread, NULL, toy_main, NULL);
+	if (!load_plugin(plugin, device))
+		return EXIT_FAILURE;
+
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		for (code = remote->codes; code && code->name; code++) {
+			for (i = 0; i < count; i++) {
+				start = now_us();
+				if (!drv.send_func(remote, code)) {
+					failed++;
+					continue;
+				}
+				wall += now_us() - start;
+				on_air += send_buffer_sum() / toy.speed;
+				sends++;
+			}
+		}
+	}
+	drv.deinit_func();
+	free_config(remotes);
+	close(toy.fd);
+	close(slave);
+	label = strrchr(argv[optind], '/');
+	label = label ? label + 1 : argv[optind];
+	if (sends == 0) {
+		printf("%-32s nothing sent, %lu failed\n", label, failed);
+		return EXIT_FAILURE;
+	}
+	printf("%-32s %6lu sends %9.0f us/send %9.0f us on air"
+	       " %7.0f us overhead %5lu gaps %7.0f us gaps/send %lu failed\n",
+	       label, sends, wall / sends, on_air / sends,
+	       (wall - on_air) / sends, toy.gaps, toy.gap_us / sends, failed);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
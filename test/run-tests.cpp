@@ -9,6 +9,15 @@
 #include        "ClientTest.h"
 #include        "DrvAdminTest.h"
 #include        "DecodeTest.h"
+#include        "RestartTest.h"
+#include        "CoalesceTest.h"
+#include        "DictionaryTest.h"
+#include        "QueueTest.h"
+#include        "CodeIndexTest.h"
+#include        "RecBufferTest.h"
+#include        "LircrcTest.h"
+#include        "DuplicatesTest.h"
+#include        "AtomTest.h"
 
 
 int main()
@@ -20,6 +29,15 @@ int main()
         runner.addTest(ClientTest::suite());
         runner.addTest(DrvAdminTest::suite());
         runner.addTest(DecodeTest::suite());
+        runner.addTest(RestartTest::suite());
+        runner.addTest(CoalesceTest::suite());
+        runner.addTest(DictionaryTest::suite());
+        runner.addTest(QueueTest::suite());
+        runner.addTest(CodeIndexTest::suite());
+        runner.addTest(RecBufferTest::suite());
+        runner.addTest(LircrcTest::suite());
+        runner.addTest(DuplicatesTest::suite());
+        runner.addTest(AtomTest::suite());
         runner.run();
         system("pkill lircd");
         unlink("var/lircd.pid");
@@ -0,0 +1,543 @@
+/****************************************************************************
+** socket-bench.c **********************************************************
+****************************************************************************
+*
+* socket-bench.c - Measure lircd broadcast throughput and latency.
+*
+* A number of clients connect to a running lircd, on the local socket
+* and optionally on the TCP port of --listen. One more connection sends
+* SIMULATE commands at a given rate, the simulated code being a sequence
+* number. Each client measures the time from sending to receiving every
+* event, and counts the events it never got. An optional slow client
+* reads a little now and then, or never, like a stuck consumer; its
+* events are reported separately and are not counted as lost.
+*
+* With --ramp the rate is doubled after each step until events are lost
+* or lircd cannot keep up with the commands, reporting the last rate
+* without problems. lircd must run with --allow-simulate.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char* const USAGE =
+	"Usage: socket-bench [options]\n\n"
+	"Options:\n"
+	"    -s, --socket <path>:        lircd socket (var/lircd.socket).\n"
+	"    -c, --clients <n>:          Clients on the socket (4).\n"
+	"    -t, --tcp <host:port>:      Address of lircd --listen.\n"
+	"    -T, --tcp-clients <n>:      Clients on the TCP port (0).\n"
+	"    -r, --rate <events/s>:      SIMULATE rate (1000).\n"
+	"    -d, --duration <s>:         Length of each run (5).\n"
+	"    -S, --slow <ms>:            Add a client reading 64 bytes each\n"
+	"                                ms, 0: never reading.\n"
+	"    -R, --ramp:                 Double rate until events are lost.\n"
+	"    -h, --help                  Print this message.\n";
+
+static const struct option options[] = {
+	{ "help",	 no_argument,	    NULL, 'h' },
+	{ "socket",	 required_argument, NULL, 's' },
+	{ "clients",	 required_argument, NULL, 'c' },
+	{ "tcp",	 required_argument, NULL, 't' },
+	{ "tcp-clients", required_argument, NULL, 'T' },
+	{ "rate",	 required_argument, NULL, 'r' },
+	{ "duration",	 required_argument, NULL, 'd' },
+	{ "slow",	 required_argument, NULL, 'S' },
+	{ "ramp",	 no_argument,	    NULL, 'R' },
+	{ 0,		 0,		    0,	  0   }
+};
+
+/** Max SIMULATE commands sent but not replied to. */
+#define MAX_PENDING     128
+
+/** Max events in one run. */
+#define MAX_EVENTS      (1 << 22)
+
+/** The simulated event, the code being the sequence number. */
+#define EVENT_FORMAT    "%016llx 00 BENCH socket-bench"
+
+
+/** One connection to lircd. */
+struct client {
+	int		fd;
+	int		slow;           /**< The slow reader. */
+	int		closed;         /**< Closed by lircd. */
+	char		buf[4096];
+	size_t		len;
+	unsigned long	received;       /**< Events, this run. */
+};
+
+/** The command connection, reading replies. */
+struct commander {
+	struct client	conn;
+	int		in_reply;       /**< Between BEGIN and END. */
+	unsigned long	pending;        /**< Commands not replied to. */
+	unsigned long	errors;         /**< ERROR replies. */
+};
+
+/** Result of one run. */
+struct run {
+	double		rate;           /**< Requested, events/s. */
+	double		sent_rate;      /**< Achieved. */
+	unsigned long	sent;
+	unsigned long	received;       /**< By the normal clients. */
+	unsigned long	lost;
+	unsigned long	slow_received;
+	uint32_t*	latencies;      /**< us, normal clients. */
+	size_t		latency_count;
+	size_t		latency_size;
+};
+
+static const char* socket_path = "var/lircd.socket";
+static const char* tcp_address = NULL;
+static int local_clients = 4;
+static int tcp_clients = 0;
+static double rate = 1000;
+static double duration = 5;
+static long slow_ms = -1;
+
+static struct client* clients;
+static int client_count;
+static struct commander cmd;
+static uint64_t* sent_at;
+static uint64_t slow_read_at;
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static int connect_local(const char* path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		fprintf(stderr, "Cannot connect to %s: %s\n",
+			path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static int connect_tcp(const char* address)
+{
+	struct addrinfo hints;
+	struct addrinfo* ai;
+	char host[256];
+	char* port;
+	int fd;
+	int r;
+
+	snprintf(host, sizeof(host), "%s", address);
+	port = strrchr(host, ':');
+	if (port == NULL) {
+		fprintf(stderr, "Bad address (use host:port): %s\n", address);
+		return -1;
+	}
+	*port++ = '\0';
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	r = getaddrinfo(host, port, &hints, &ai);
+	if (r != 0) {
+		fprintf(stderr, "Cannot resolve %s: %s\n",
+			address, gai_strerror(r));
+		return -1;
+	}
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+		fprintf(stderr, "Cannot connect to %s: %s\n",
+			address, strerror(errno));
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai);
+	return fd;
+}
+
+
+static int add_client(int fd, int slow)
+{
+	if (fd == -1)
+		return 0;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	memset(&clients[client_count], 0, sizeof(struct client));
+	clients[client_count].fd = fd;
+	clients[client_count].slow = slow;
+	client_count++;
+	return 1;
+}
+
+
+static void add_latency(struct run* run, uint32_t usecs)
+{
+	uint32_t* latencies;
+
+	if (run->latency_count == run->latency_size) {
+		run->latency_size = run->latency_size
+				    ? 2 * run->latency_size : 65536;
+		latencies = (uint32_t*)realloc(run->latencies,
+					       run->latency_size
+					       * sizeof(uint32_t));
+		if (latencies == NULL) {
+			run->latency_size = run->latency_count;
+			return;
+		}
+		run->latencies = latencies;
+	}
+	run->latencies[run->latency_count++] = usecs;
+}
+
+
+/** Handle a line from a client, return 1 if an event of this run. */
+static int parse_event(const char* line, unsigned long sent, uint64_t now,
+		       uint32_t* latency)
+{
+	unsigned long long seq;
+	char button[16];
+
+	if (sscanf(line, "%16llx %*x %15s", &seq, button) != 2
+	    || strcmp(button, "BENCH") != 0 || seq >= sent)
+		return 0;
+	*latency = now - sent_at[seq];
+	return 1;
+}
+
+
+/** Read what is available on c, handing complete lines to func. */
+static int read_lines(struct client* c, size_t max,
+		      void (*func)(struct client* c, const char* line,
+				   void* arg),
+		      void* arg)
+{
+	char* start;
+	char* nl;
+	ssize_t r;
+
+	if (max > sizeof(c->buf) - c->len - 1)
+		max = sizeof(c->buf) - c->len - 1;
+	r = read(c->fd, c->buf + c->len, max);
+	if (r == 0 || (r == -1 && errno != EAGAIN && errno != EINTR)) {
+		c->closed = 1;
+		return 0;
+	}
+	if (r < 0)
+		return 1;
+	c->len += r;
+	c->buf[c->len] = '\0';
+	start = c->buf;
+	while ((nl = strchr(start, '\n')) != NULL) {
+		*nl = '\0';
+		func(c, start, arg);
+		start = nl + 1;
+	}
+	c->len -= start - c->buf;
+	memmove(c->buf, start, c->len);
+	return 1;
+}
+
+
+static void client_line(struct client* c, const char* line, void* arg)
+{
+	struct run* run = (struct run*)arg;
+	uint32_t latency;
+
+	if (!parse_event(line, run->sent, now_us(), &latency))
+		return;
+	c->received++;
+	if (!c->slow)
+		add_latency(run, latency);
+}
+
+
+static void command_line(struct client* c, const char* line, void* arg)
+{
+	if (strcmp(line, "BEGIN") == 0) {
+		cmd.in_reply = 1;
+	} else if (cmd.in_reply && strcmp(line, "END") == 0) {
+		cmd.in_reply = 0;
+		if (cmd.pending > 0)
+			cmd.pending--;
+	} else if (cmd.in_reply && strcmp(line, "ERROR") == 0) {
+		cmd.errors++;
+	}
+}
+
+
+/** Send the SIMULATE commands due, return 0 on errors. */
+static int send_due(struct run* run, uint64_t start, uint64_t now,
+		    unsigned long total)
+{
+	char buf[MAX_PENDING * 64];
+	unsigned long due;
+	size_t len = 0;
+	ssize_t r;
+
+	due = (now - start) * run->rate / 1e6;
+	if (due > total)
+		due = total;
+	while (run->sent < due && cmd.pending < MAX_PENDING
+	       && len < sizeof(buf) - 64) {
+		len += snprintf(buf + len, sizeof(buf) - len,
+				"SIMULATE " EVENT_FORMAT "\n",
+				(unsigned long long)run->sent);
+		sent_at[run->sent++] = now;
+		cmd.pending++;
+	}
+	if (len == 0)
+		return 1;
+	r = write(cmd.conn.fd, buf, len);
+	if (r != (ssize_t)len) {
+		fprintf(stderr, "Command write failed: %s\n",
+			r == -1 ? strerror(errno) : "short write");
+		return 0;
+	}
+	return 1;
+}
+
+
+/** Poll all connections for timeout_ms, reading what's there. */
+static int poll_clients(struct run* run, int timeout_ms, uint64_t now)
+{
+	struct pollfd fds[client_count + 1];
+	int i;
+
+	fds[0].fd = cmd.conn.fd;
+	fds[0].events = POLLIN;
+	for (i = 0; i < client_count; i++) {
+		fds[i + 1].fd = clients[i].closed || clients[i].slow
+				? -1 : clients[i].fd;
+		fds[i + 1].events = POLLIN;
+	}
+	if (poll(fds, client_count + 1, timeout_ms) == -1 && errno != EINTR)
+		return 0;
+	if (fds[0].revents
+	    && !read_lines(&cmd.conn, sizeof(cmd.conn.buf), command_line, NULL))
+		return 0;
+	for (i = 0; i < client_count; i++) {
+		if (fds[i + 1].revents)
+			read_lines(&clients[i], sizeof(clients[i].buf),
+				   client_line, run);
+		if (clients[i].slow && slow_ms > 0 && !clients[i].closed
+		    && now - slow_read_at >= slow_ms * 1000ULL) {
+			read_lines(&clients[i], 64, client_line, run);
+			slow_read_at = now;
+		}
+	}
+	return 1;
+}
+
+
+static int cmp_u32(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static double percentile(const struct run* run, double p)
+{
+	size_t i;
+
+	if (run->latency_count == 0)
+		return 0;
+	i = (size_t)(p / 100 * (run->latency_count - 1));
+	return run->latencies[i];
+}
+
+
+/** Run duration seconds at run->rate, return 0 on errors. */
+static int run_once(struct run* run)
+{
+	unsigned long total = run->rate * duration;
+	uint64_t start;
+	uint64_t end;
+	uint64_t now;
+	uint64_t last_event;
+	unsigned long received;
+	int i;
+
+	if (total > MAX_EVENTS)
+		total = MAX_EVENTS;
+	for (i = 0; i < client_count; i++)
+		clients[i].received = 0;
+	cmd.pending = 0;
+	cmd.errors = 0;
+	start = now_us();
+	do {
+		now = now_us();
+		if (!send_due(run, start, now, total))
+			return 0;
+		if (!poll_clients(run, 1, now))
+			return 0;
+	} while (run->sent < total && now - start < 3 * duration * 1e6);
+	end = now_us();
+	run->sent_rate = run->sent * 1e6 / (end - start);
+	/* Wait for the last events, at most 2 s, until idle for 200 ms. */
+	now = end;
+	last_event = end;
+	received = 0;
+	while (now - end < 2000000 && now - last_event < 200000) {
+		if (!poll_clients(run, 10, now))
+			return 0;
+		now = now_us();
+		if (run->latency_count != received) {
+			received = run->latency_count;
+			last_event = now;
+		}
+	}
+	for (i = 0; i < client_count; i++) {
+		if (clients[i].slow) {
+			run->slow_received += clients[i].received;
+		} else {
+			run->received += clients[i].received;
+			run->lost += run->sent - clients[i].received;
+		}
+	}
+	qsort(run->latencies, run->latency_count, sizeof(uint32_t), cmp_u32);
+	return 1;
+}
+
+
+static void print_run(const struct run* run)
+{
+	int slow_closed = 0;
+	int i;
+
+	for (i = 0; i < client_count; i++)
+		slow_closed |= clients[i].slow && clients[i].closed;
+	printf("rate %8.0f/s sent %8.0f/s lost %7lu  latency us: p50 %6.0f"
+	       " p90 %6.0f p99 %6.0f p99.9 %6.0f max %6.0f",
+	       run->rate, run->sent_rate, run->lost,
+	       percentile(run, 50), percentile(run, 90),
+	       percentile(run, 99), percentile(run, 99.9),
+	       percentile(run, 100));
+	if (slow_ms >= 0)
+		printf("  slow: %lu%s", run->slow_received,
+		       slow_closed ? " (dropped)" : "");
+	if (cmd.errors > 0)
+		printf("  %lu errors", cmd.errors);
+	printf("\n");
+}
+
+
+int main(int argc, char** argv)
+{
+	struct run run;
+	double good_rate = 0;
+	int ramp = 0;
+	int ok = 1;
+	int c;
+	int i;
+
+	while ((c = getopt_long(argc, argv, "hs:c:t:T:r:d:S:R",
+				options, NULL)) != EOF) {
+		switch (c) {
+		case 'h':
+			fputs(USAGE, stdout);
+			return EXIT_SUCCESS;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'c':
+			local_clients = atoi(optarg);
+			break;
+		case 't':
+			tcp_address = optarg;
+			break;
+		case 'T':
+			tcp_clients = atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'S':
+			slow_ms = atol(optarg);
+			break;
+		case 'R':
+			ramp = 1;
+			break;
+		default:
+			fputs(USAGE, stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc || rate <= 0 || duration <= 0
+	    || local_clients < 0 || tcp_clients < 0
+	    || (tcp_clients > 0 && tcp_address == NULL)) {
+		fputs(USAGE, stderr);
+		return EXIT_FAILURE;
+	}
+	clients = (struct client*)calloc(local_clients + tcp_clients + 1,
+					 sizeof(struct client));
+	sent_at = (uint64_t*)calloc(MAX_EVENTS, sizeof(uint64_t));
+	if (clients == NULL || sent_at == NULL) {
+		fputs("Out of memory\n", stderr);
+		return EXIT_FAILURE;
+	}
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.conn.fd = connect_local(socket_path);
+	if (cmd.conn.fd == -1)
+		return EXIT_FAILURE;
+	fcntl(cmd.conn.fd, F_SETFL, fcntl(cmd.conn.fd, F_GETFL) | O_NONBLOCK);
+	for (i = 0; i < local_clients; i++) {
+		if (!add_client(connect_local(socket_path), 0))
+			return EXIT_FAILURE;
+	}
+	for (i = 0; i < tcp_clients; i++) {
+		if (!add_client(connect_tcp(tcp_address), 0))
+			return EXIT_FAILURE;
+	}
+	if (slow_ms >= 0 && !add_client(connect_local(socket_path), 1))
+		return EXIT_FAILURE;
+	printf("%d socket clients, %d TCP clients%s, %g s runs\n",
+	       local_clients, tcp_clients,
+	       slow_ms >= 0 ? ", 1 slow client" : "", duration);
+	do {
+		memset(&run, 0, sizeof(run));
+		run.rate = rate;
+		ok = run_once(&run);
+		if (ok)
+			print_run(&run);
+		free(run.latencies);
+		if (!ok || run.lost > 0 || cmd.errors > 0
+		    || run.sent_rate < 0.9 * run.rate)
+			break;
+		good_rate = rate;
+		rate *= 2;
+	} while (ramp);
+	if (ramp)
+		printf("Max rate without losses: %.0f events/s\n", good_rate);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,18 +2,66 @@
 
 ''' Simple lirc config files sanity tool. '''
 
+import argparse
 import glob
+import json
+import os
+import multiprocessing
+
 import yaml
 
+
+def load_config(path):
+    ''' Return the config dict in the yaml file on path. '''
+    with open(path) as f:
+        return yaml.safe_load(f.read())['config']
+
+
+def load_configs(paths, jobs, cache_path):
+    ''' Return {path: config}, parsing files changed since cache_path
+    was written in a pool of jobs processes.
+    '''
+    cache = {}
+    if cache_path and os.path.exists(cache_path):
+        with open(cache_path) as f:
+            cache = json.load(f)
+    configs = {}
+    todo = []
+    for path in paths:
+        mtime = os.stat(path).st_mtime
+        if path in cache and cache[path][0] == mtime:
+            configs[path] = cache[path][1]
+        else:
+            todo.append(path)
+    if jobs > 1 and len(todo) > 1:
+        with multiprocessing.Pool(jobs) as pool:
+            parsed = pool.map(load_config, todo)
+    else:
+        parsed = [load_config(path) for path in todo]
+    configs.update(zip(todo, parsed))
+    if cache_path:
+        cache = {p: [os.stat(p).st_mtime, configs[p]] for p in paths}
+        with open(cache_path + '.tmp', 'w') as f:
+            json.dump(cache, f)
+        os.replace(cache_path + '.tmp', cache_path)
+    return configs
+
+
 def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('-j', '--jobs', type=int,
+                        default=multiprocessing.cpu_count(),
+                        help='Parse files in this many processes')
+    parser.add_argument('-c', '--cache',
+                        help='Reuse configs unchanged since last run')
+    args = parser.parse_args()
     configs = {}
-    for path in glob.glob('*.conf'):
-        with open(path) as f:
-            cf = yaml.load(f.read())
-        if cf['config']['id'] + '.conf' != path:
-            print( "Id: %s, path: %s" % (cf['config']['id'], path))
-        configs[cf['config']['id']] = cf['config']
-    for config in configs:
+    loaded = load_configs(sorted(glob.glob('*.conf')), args.jobs, args.cache)
+    for path, config in loaded.items():
+        if config['id'] + '.conf' != path:
+            print( "Id: %s, path: %s" % (config['id'], path))
+        configs[config['id']] = config
+    for config in configs.values():
         if 'supports' in config:
             if config['supports'] == 'lirccode':
                 if not 'lircd_conf' in config:
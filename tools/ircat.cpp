@@ -42,10 +42,42 @@
 #include <string.h>
 #include <getopt.h>
 #include "lirc_client.h"
+#include "lirc_log.h"
 
 #define PROG_NAME "ircat"
 #define PROG_VERSION (PROG_NAME VERSION)
 
+/** Events handled per lirc_nextevents() call. */
+#define EVENT_BATCH 64
+
+/** Output collected before it is written. */
+static char outbuf[65536];
+static size_t outlen = 0;
+
+
+static void flush_out(void)
+{
+	chk_write(STDOUT_FILENO, outbuf, outlen);
+	outlen = 0;
+}
+
+
+static void print_string(const char* s)
+{
+	size_t len = strlen(s);
+
+	if (outlen + len + 1 > sizeof(outbuf))
+		flush_out();
+	if (len + 1 > sizeof(outbuf)) {
+		chk_write(STDOUT_FILENO, s, len);
+		chk_write(STDOUT_FILENO, "\n", 1);
+		return;
+	}
+	memcpy(outbuf + outlen, s, len);
+	outbuf[outlen + len] = '\n';
+	outlen += len + 1;
+}
+
 void print_usage(char* prog_name)
 {
 	printf("Usage: %s [options] <prog>\n", prog_name);
@@ -97,22 +129,27 @@ int main(int argc, char* argv[])
 
 	r = lirc_readconfig(config_file, &config, NULL);
 	if (r == 0) {
-		char* code;
+		static struct lirc_event events[EVENT_BATCH];
 		char* c;
-		int r;
-
-		while (lirc_nextcode(&code) == 0) {
-			if (code == NULL || !*code)
-				continue;
-			while ((r = lirc_code2char(config, code, &c)) == 0) {
-				if (c == NULL || !*c)
-					break;
-				printf("%s\n", c);
-				fflush(stdout);
+		int count;
+		int i;
+
+		/*
+		 * Translate all events from one socket read, and write
+		 * the strings with a single write() when done.
+		 */
+		r = 0;
+		while (r == 0 && (count = lirc_nextevents(events,
+							  EVENT_BATCH)) >= 0) {
+			for (i = 0; r == 0 && i < count; i++) {
+				while ((r = lirc_event2char(config, &events[i],
+							    &c)) == 0) {
+					if (c == NULL || !*c)
+						break;
+					print_string(c);
+				}
 			}
-			free(code);
-			if (r == -1)
-				break;
+			flush_out();
 		}
 		lirc_freeconfig(config);
 	}
@@ -24,9 +24,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+
 #include "lirc_client.h"
 #include "lirc_log.h"
 
@@ -56,43 +64,258 @@ static const char* opt_progname	= "irexec";
 static char path[256] = {0};
 
 
-/** Run shell command line in isolated process using double fork(). */
-static void run_command(const char* cmd)
+/** Characters which makes a command line require a shell. */
+static const char* const SHELL_CHARS = "|&;<>()$`\\\"'*?[]#~=%{}!\n";
+
+/** Max number of words in a command run without a shell. */
+#define MAX_ARGS	32
+
+/** Max number of fifos and sockets kept open by actions. */
+#define MAX_TARGETS	16
+
+/** Kinds of in-process actions, selected by a config string prefix. */
+enum action_type {
+	ACTION_NONE,
+	ACTION_FIFO,    /**< "fifo:path message": write message to fifo. */
+	ACTION_UNIX     /**< "unix:path message": send to unix socket. */
+};
+
+/** An open action file or socket, kept between button presses. */
+struct action_target {
+	enum action_type	type;
+	char			path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+	int			fd;
+};
+
+static struct action_target targets[MAX_TARGETS];
+static int target_count = 0;
+
+
+/** Reap all terminated children, SIGCHLD handler. */
+static void reap_children(int sig)
+{
+	int saved_errno = errno;
+
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+	errno = saved_errno;
+}
+
+
+/**
+ * Split a command line without shell metacharacters into words.
+ * @return Word count, 0 if the command needs to be run using a shell.
+ */
+static int split_command(char* cmd, char** argv)
+{
+	char* token;
+	int argc = 0;
+
+	if (strpbrk(cmd, SHELL_CHARS) != NULL)
+		return 0;
+	for (token = strtok(cmd, " \t"); token != NULL;
+	     token = strtok(NULL, " \t")) {
+		if (argc == MAX_ARGS)
+			return 0;
+		argv[argc++] = token;
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+
+/** Open the fifo or connect to the socket at path, return fd or -1. */
+static int target_open(enum action_type type, const char* path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (type == ACTION_FIFO)
+		return open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/** Return the cached target for type and path, opening it if required. */
+static struct action_target* target_get(enum action_type type,
+					const char* path)
+{
+	struct action_target* target;
+	int i;
+
+	for (i = 0; i < target_count; i++) {
+		target = &targets[i];
+		if (target->fd != -1 && target->type == type
+		    && strcmp(target->path, path) == 0)
+			return target;
+	}
+	for (i = 0; i < target_count; i++)
+		if (targets[i].fd == -1)
+			break;
+	if (i == MAX_TARGETS) {
+		/* Table full: recycle the last one. */
+		i = MAX_TARGETS - 1;
+		close(targets[i].fd);
+	} else if (i == target_count) {
+		target_count++;
+	}
+	target = &targets[i];
+	target->type = type;
+	snprintf(target->path, sizeof(target->path), "%s", path);
+	target->fd = target_open(type, path);
+	return target->fd == -1 ? NULL : target;
+}
+
+
+/** Write message to the target, reopening it once if it was closed. */
+static void target_write(enum action_type type,
+			 const char* path,
+			 const char* message,
+			 size_t size)
 {
-	pid_t pid1;
-	pid_t pid2;
-
-	pid1 = fork();
-	if (pid1 < 0) {
-		log_perror_err("Cannot fork");
-		perror("Cannot fork()");
-		exit(EXIT_FAILURE);
-	}
-	if (pid1 == 0) {
-		pid2 = fork();
-		if (pid2 < 0) {
-			log_perror_err("Cannot do secondary fork()");
-			exit(EXIT_FAILURE);
+	struct action_target* target;
+	int tries;
+
+	for (tries = 0; tries < 2; tries++) {
+		target = target_get(type, path);
+		if (target == NULL)
+			break;
+		if (write(target->fd, message, size) == (ssize_t)size)
+			return;
+		close(target->fd);
+		target->fd = -1;
+	}
+	log_perror_err("Cannot write to %s", path);
+}
+
+
+/**
+ * Run config strings like "fifo:/path message" in-process.
+ * @return 1 if cmd is an action and has been handled, else 0.
+ */
+static int run_action(const char* cmd)
+{
+	static const struct {
+		const char*		prefix;
+		enum action_type	type;
+	} prefixes[] = {
+		{ "fifo:", ACTION_FIFO },
+		{ "unix:", ACTION_UNIX },
+		{ NULL,	   ACTION_NONE }
+	};
+	char path[sizeof(((struct action_target*)0)->path)];
+	char message[1024];
+	enum action_type type = ACTION_NONE;
+	size_t len;
+	int i;
+
+	for (i = 0; prefixes[i].prefix != NULL; i++) {
+		len = strlen(prefixes[i].prefix);
+		if (strncmp(cmd, prefixes[i].prefix, len) == 0) {
+			type = prefixes[i].type;
+			cmd += len;
+			break;
 		}
-		if (pid2 == 0) {
-			log_debug("Execing command \"%s\"", cmd);
-			char* const vp[] = {strdup(SH_PATH),
-			      strdup("-c"),
-			      strdup(cmd),
-			      NULL
-			};
-			execvp(SH_PATH, vp);
-			/* not reached, unless there was an error */
-			log_perror_err("execvp failed");
-			fputs("execvp failed\n", stderr);
-			exit(EXIT_FAILURE);
-		} else {
-			waitpid(pid2, NULL, WNOHANG);
-			exit(0);
+	}
+	if (type == ACTION_NONE)
+		return 0;
+	len = strcspn(cmd, " \t");
+	if (len == 0 || len >= sizeof(path)) {
+		log_error("Bad action path in \"%s\"", cmd);
+		return 1;
+	}
+	memcpy(path, cmd, len);
+	path[len] = '\0';
+	cmd += len;
+	cmd += strspn(cmd, " \t");
+	len = snprintf(message, sizeof(message), "%s\n", cmd);
+	if (len >= sizeof(message)) {
+		log_error("Action message too long: \"%s\"", cmd);
+		return 1;
+	}
+	log_debug("Writing \"%s\" to %s", cmd, path);
+	target_write(type, path, message, len);
+	return 1;
+}
+
+
+/** Start argv as a child process, reaped by reap_children(). */
+static int spawn(char* const* argv)
+{
+	pid_t pid;
+
+#ifdef HAVE_POSIX_SPAWN
+	posix_spawnattr_t attr;
+	sigset_t sigmask;
+	sigset_t sigdefault;
+	int r;
+
+	sigemptyset(&sigmask);
+	sigemptyset(&sigdefault);
+	sigaddset(&sigdefault, SIGPIPE);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &sigmask);
+	posix_spawnattr_setsigdefault(&attr, &sigdefault);
+	posix_spawnattr_setflags(&attr,
+				 POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	r = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (r != 0) {
+		errno = r;
+		return -1;
+	}
+#else
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		signal(SIGPIPE, SIG_DFL);
+		execvp(argv[0], argv);
+		/* not reached, unless there was an error */
+		fputs("execvp failed\n", stderr);
+		_exit(EXIT_FAILURE);
+	}
+#endif
+	return 0;
+}
+
+
+/**
+ * Run command line asynchronously. Actions are handled in-process, simple
+ * commands are executed directly, others using SH_PATH -c.
+ */
+static void run_command(const char* cmd)
+{
+	char buff[1024];
+	char* argv[MAX_ARGS + 1];
+
+	if (run_action(cmd))
+		return;
+	log_debug("Execing command \"%s\"", cmd);
+	if (strlen(cmd) < sizeof(buff)) {
+		strcpy(buff, cmd);
+		if (split_command(buff, argv) > 0) {
+			if (spawn(argv) == -1)
+				log_perror_err("Cannot run %s", argv[0]);
+			return;
 		}
-	} else {
-		waitpid(pid1, NULL, 0);
 	}
+	argv[0] = (char*)SH_PATH;
+	argv[1] = (char*)"-c";
+	argv[2] = (char*)cmd;
+	argv[3] = NULL;
+	if (spawn(argv) == -1)
+		log_perror_err("Cannot run " SH_PATH);
 }
 
 
@@ -121,6 +344,7 @@ static void process_input(struct lirc_config* config)
 int irexec(const char* configfile)
 {
 	struct lirc_config* config;
+	struct sigaction act;
 
 	if (opt_daemonize) {
 		if (daemon(0, 0) == -1) {
@@ -140,6 +364,14 @@ int irexec(const char* configfile)
 	lirc_log_set_file(path);
 	lirc_log_open("irexec", 1, opt_loglevel);
 
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = reap_children;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &act, NULL);
+	/* Closed action fifos and sockets are handled by target_write(). */
+	signal(SIGPIPE, SIG_IGN);
+
 	process_input(config);
 	lirc_deinit();
 
@@ -17,9 +17,12 @@
 #endif
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdint.h>
 #include <unistd.h>
 
+#include <sys/wait.h>
+
 #include "lirc_private.h"
 #include "irrecord.h"
 
@@ -33,6 +36,7 @@ static const int DEFAULT_GAP = 50000;
 #define USAGE       "Usage: irrecord [options] [config file]\n" \
 	"	    irrecord -u <config file>\n" \
 	"	    irrecord -a <config file>\n" \
+	"	    irrecord -b [-j jobs] <mode2 file>...\n" \
 	"	    irrecord -l\n"
 
 static const char* const help =
@@ -41,6 +45,8 @@ static const char* const help =
 	"\t -H --driver=driver\tUse given driver\n"
 	"\t -d --device=device\tRead from given device\n"
 	"\t -a --analyse\t\tAnalyse raw_codes config files\n"
+	"\t -b --batch\t\tAnalyse mode2 capture files\n"
+	"\t -j --jobs=jobs\t\tRun up to jobs --batch analyses at a time\n"
 	"\t -k --keep-root\t\tDon't drop root privileges\n"
 	"\t -l --list-namespace\tList valid button names\n"
 	"\t -u --update\t\tAmend buttons to existing file\n"
@@ -58,6 +64,8 @@ static const struct option long_options[] = {
 	{"help",	      no_argument,	 NULL, 'h'},
 	{"version",	      no_argument,	 NULL, 'v'},
 	{"analyse",	      no_argument,	 NULL, 'a'},
+	{"batch",	      no_argument,	 NULL, 'b'},
+	{"jobs",	      required_argument, NULL, 'j'},
 	{"device",	      required_argument, NULL, 'd'},
 	{"options-file",      required_argument, NULL, 'O'},
 	{"debug",	      required_argument, NULL, 'D'},
@@ -129,8 +137,8 @@ static const char* MSG_LENGTHS_INIT =
 	"It is very important that you press many different buttons randomly\n"
 	"and hold them down for approximately one second. Each button should\n"
 	"generate at least one dot but never more than ten dots of output.\n"
-	"Don't stop pressing buttons until two lines of dots (2x80) have\n"
-	"been generated.\n";
+	"Don't stop pressing buttons until the timing is found, which takes\n"
+	"at most two lines of dots (2x80).\n";
 
 static const char* const MSG_NOISE_INTRO =
 	"Checking for ambient light  creating too much disturbances.\n"
@@ -172,6 +180,7 @@ enum init_status {
 	STS_INIT_BAD_DRIVER,
 	STS_INIT_BAD_FILE,
 	STS_INIT_ANALYZE,
+	STS_INIT_BATCH,
 	STS_INIT_TESTED,
 	STS_INIT_FOPEN,
 	STS_INIT_OK,
@@ -272,6 +281,8 @@ static void add_defaults(void)
 		"irrecord:driver",      driver ? driver : "default",
 		"irrecord:device",      device ? device : LIRC_DRIVER_DEVICE,
 		"irrecord:analyse",     "False",
+		"irrecord:batch",       "False",
+		"irrecord:jobs",        "0",
 		"irrecord:force",       "False",
 		"irrecord:update",      "False",
 		"irrecord:disable-namespace",
@@ -320,7 +331,7 @@ static void parse_options(int argc, char** const argv)
 {
 	int c;
 
-	const char* const optstring = "had:D:H:fknlO:pPtiTU:uvYA:";
+	const char* const optstring = "habd:D:H:fj:knlO:pPtiTU:uvYA:";
 
 	add_defaults();
 	optind = 1;
@@ -330,6 +341,16 @@ static void parse_options(int argc, char** const argv)
 		case 'a':
 			options_set_opt("irrecord:analyse", "True");
 			break;
+		case 'b':
+			options_set_opt("irrecord:batch", "True");
+			break;
+		case 'j':
+			if (atoi(optarg) <= 0) {
+				fprintf(stderr, "Bad jobs count: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			options_set_opt("irrecord:jobs", optarg);
+			break;
 		case 'D':
 			if (string2loglevel(optarg) == LIRC_BADLEVEL) {
 				fprintf(stderr, "Bad debug level: %s\n", optarg);
@@ -395,7 +416,12 @@ static void parse_options(int argc, char** const argv)
 			exit(EXIT_FAILURE);
 		}
 	}
-	if (optind == argc - 1) {
+	if (options_getboolean("irrecord:batch")) {
+		if (optind == argc) {
+			fputs("irrecord: --batch needs input files\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	} else if (optind == argc - 1) {
 		options_set_opt("irrecord:filename", argv[optind]);
 	} else if (optind != argc) {
 		fputs("irrecord: invalid argument count\n", stderr);
@@ -424,13 +450,16 @@ static enum init_status init(struct opts* opts, struct main_state* state)
 			opts->driver, opts->device);
 	}
 	hw_choose_driver(NULL);
-	if (!opts->analyse && hw_choose_driver(opts->driver) != 0)
+	if (!opts->analyse && !opts->batch
+	    && hw_choose_driver(opts->driver) != 0)
 		return STS_INIT_BAD_DRIVER;
 	ir_remote_init(opts->dynamic_codes);
 	lirc_log_get_clientlog("irrecord", logpath, sizeof(logpath));
 	(void)unlink(logpath);
 	lirc_log_set_file(logpath);
 	lirc_log_open("irrecord", 0, opts->loglevel);
+	if (opts->batch)
+		return STS_INIT_BATCH;
 	if (strcmp(curr_driver->name, "null") == 0 && !opts->analyse)
 		return STS_INIT_NO_DRIVER;
 	f = fopen(opts->filename, "r");
@@ -562,6 +591,8 @@ static int get_options(int argc,
 	options->force = 0;
 	options_load(argc, argv, NULL, parse_options);
 	options->analyse = options_getboolean("irrecord:analyse");
+	options->batch = options_getboolean("irrecord:batch");
+	options->jobs = options_getint("irrecord:jobs");
 	options->device = options_getstring("irrecord:device");
 	options->loglevel =
 		string2loglevel(options_getstring("irrecord:debug"));
@@ -634,6 +665,122 @@ static void do_get_toggle_bit_mask(struct ir_remote* remote,
 }
 
 
+/**
+ * Split capture path into the remote name, the basename without
+ * extension, and the output path, the same with a .lircd.conf extension.
+ */
+static void batch_paths(const char* path,
+			char* name, size_t name_size,
+			char* out, size_t out_size)
+{
+	const char* base = strrchr(path, '/');
+	const char* ext;
+
+	base = base == NULL ? path : base + 1;
+	ext = strrchr(base, '.');
+	if (ext == NULL || ext == base)
+		ext = base + strlen(base);
+	snprintf(name, name_size, "%.*s", (int)(ext - base), base);
+	snprintf(out, out_size, "%.*s.lircd.conf", (int)(ext - path), path);
+}
+
+
+/** Analyse one capture, in a child process. Returns exit status. */
+static int batch_analyse(const struct opts* opts, const char* path)
+{
+	char name[128];
+	char out[PATH_MAX];
+	FILE* f;
+	int ok;
+
+	batch_paths(path, name, sizeof(name), out, sizeof(out));
+	f = fopen(out, "w");
+	if (f == NULL) {
+		perror(out);
+		return EXIT_FAILURE;
+	}
+	ok = analyse_capture(path, name, opts, f);
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok)
+		unlink(out);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+ * The --batch task: analyse all captures, each in its own process as
+ * the analysis lives in globals. Runs up to opts->jobs at a time,
+ * by default one for each online cpu. Returns boolean ok/fail.
+ */
+static int do_batch(const struct opts* opts)
+{
+	char name[128];
+	char out[PATH_MAX];
+	pid_t* pids;
+	pid_t pid;
+	int jobs = opts->jobs;
+	int running = 0;
+	int failed = 0;
+	int next = 0;
+	int status;
+	int i;
+
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+	pids = (pid_t*)calloc(opts->capture_count, sizeof(pid_t));
+	if (pids == NULL) {
+		fputs("Out of memory\n", stderr);
+		return 0;
+	}
+	while (next < opts->capture_count || running > 0) {
+		if (next < opts->capture_count && running < jobs) {
+			fflush(NULL);
+			pid = fork();
+			if (pid == 0)
+				_exit(batch_analyse(opts,
+						    opts->captures[next]));
+			if (pid == -1) {
+				perror("Cannot fork");
+				failed++;
+			} else {
+				running++;
+			}
+			pids[next++] = pid;
+			continue;
+		}
+		pid = wait(&status);
+		if (pid == -1) {
+			perror("wait");
+			break;
+		}
+		running--;
+		for (i = 0; i < opts->capture_count; i++)
+			if (pids[i] == pid)
+				break;
+		if (i == opts->capture_count)
+			continue;
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+			batch_paths(opts->captures[i],
+				    name, sizeof(name), out, sizeof(out));
+			printf("%s: wrote %s\n", opts->captures[i], out);
+		} else if (WIFSIGNALED(status)) {
+			fprintf(stderr, "%s: analysis killed by signal %d\n",
+				opts->captures[i], WTERMSIG(status));
+			failed++;
+		} else {
+			fprintf(stderr, "%s: analysis failed\n",
+				opts->captures[i]);
+			failed++;
+		}
+	}
+	free(pids);
+	return failed == 0;
+}
+
+
 /** View part of init: run init() and handle results. Returns or exits. */
 static void
 do_init(struct opts* opts, struct main_state* state)
@@ -680,6 +827,8 @@ do_init(struct opts* opts, struct main_state* state)
 	case STS_INIT_ANALYZE:
 		do_analyse(opts, state);
 		exit(EXIT_SUCCESS);
+	case STS_INIT_BATCH:
+		exit(do_batch(opts) ? EXIT_SUCCESS : EXIT_FAILURE);
 	case STS_INIT_OK:
 		return;
 	}
@@ -930,6 +1079,7 @@ static int mode2_get_lengths(const struct opts* opts, struct main_state* state)
 		flushhw();
 		sts = STS_LEN_AGAIN;
 		lengths_state_init(&lengths_state);
+		lengths_state.incremental = 1;
 		while (sts == STS_LEN_AGAIN) {
 			sts = get_lengths(&lengths_state,
 					  &remote,
@@ -1002,6 +1152,7 @@ void lirccode_get_lengths(const struct opts* opts, struct main_state* state)
 		return;
 	flushhw();
 	gap_state_init(&gap_state);
+	gap_state.incremental = 1;
 	sts = STS_GAP_INIT;
 	while (1) {
 		switch (sts) {
@@ -1142,6 +1293,10 @@ int main(int argc, char** argv)
 	int r = 1;
 
 	get_options(argc, argv, argv[optind], &opts);
+	if (opts.batch) {
+		opts.captures = argv + optind;
+		opts.capture_count = argc - optind;
+	}
 	if (opts.list_namespace) {
 		fprint_namespace(stdout);
 		exit(EXIT_SUCCESS);
@@ -24,9 +24,12 @@
 #  include "config.h"
 #endif
 
+#include <ctype.h>
 #include <getopt.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "lirc_log.h"
 #include "lirc_client.h"
@@ -41,12 +44,18 @@ static const char* const help =
 	"    irsend [options] LIST remote\n"
 	"    irsend [options] SET_TRANSMITTERS remote num [num...]\n"
 	"    irsend [options] SIMULATE \"scancode repeat keysym remote\"\n"
+	"    irsend [options] --file=file\n"
 	"Options:\n"
 	"    -h --help\t\t\tdisplay usage summary\n"
 	"    -v --version\t\tdisplay version\n"
 	"    -d --device=device\t\tuse given lircd socket [" LIRCD "]\n"
 	"    -a --address=host[:port]\tconnect to lircd at this address\n"
-	"    -# --count=n\t\tsend command n times\n";
+	"    -# --count=n\t\tsend command n times\n"
+	"    -f --file=file\t\trun the commands in file, - for stdin\n"
+	"    -w --delay=ms\t\twith --file, wait this long after each command\n";
+
+/** Commands run by --file at most at once, bounding memory use. */
+static const int BATCH_MAX = 1024;
 
 const char* prog;
 
@@ -63,6 +72,197 @@ int send_packet(lirc_cmd_ctx* ctx, int fd)
 	return r == 0 ? 0 : -1;
 }
 
+/** Send directive for all codes, pipelined. */
+static int send_codes(const char* directive,
+		      const char* remote,
+		      char** codes,
+		      int code_count,
+		      unsigned long count,
+		      int fd)
+{
+	lirc_cmd_ctx* ctx;
+	int* results;
+	int i;
+	int r;
+
+	ctx = (lirc_cmd_ctx*)calloc(code_count, sizeof(lirc_cmd_ctx));
+	results = (int*)calloc(code_count, sizeof(int));
+	if (ctx == NULL || results == NULL) {
+		fprintf(stderr, "%s: out of memory\n", prog);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < code_count; i++) {
+		if (strcasecmp(directive, "SEND_ONCE") == 0 && count > 1)
+			r = lirc_command_init(&ctx[i], "%s %s %s %lu\n",
+					      directive, remote, codes[i],
+					      count);
+		else
+			r = lirc_command_init(&ctx[i], "%s %s %s\n",
+					      directive, remote, codes[i]);
+		if (r != 0) {
+			fprintf(stderr, "%s: input too long\n", prog);
+			exit(EXIT_FAILURE);
+		}
+		lirc_command_reply_to_stdout(&ctx[i]);
+	}
+	r = lirc_command_run_batch(ctx, code_count, results, fd);
+	for (i = 0; i < code_count; i++)
+		if (results[i] != 0)
+			fprintf(stderr, "Error running command: %s\n",
+				strerror(results[i]));
+	free(results);
+	free(ctx);
+	return r == 0 ? 0 : -1;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static void sleep_ms(unsigned long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+
+/** State of a --file run, passed to report(). */
+struct batch {
+	lirc_cmd_ctx*	ctx;
+	int*		lines;          /**< Input line number of each ctx. */
+	int		count;
+	double		last;           /**< Time of the last reply, ms. */
+	int		errors;
+	int		total;
+	int		broken;         /**< Connection or protocol error. */
+};
+
+
+/** lirc_command_done callback: print result and time of a command. */
+static void report(lirc_cmd_ctx* ctx, int index, int result, void* arg)
+{
+	struct batch* batch = (struct batch*)arg;
+	double now = now_ms();
+	int len = strcspn(ctx->packet, "\n");
+
+	if (result != 0)
+		batch->errors++;
+	if (result != 0 && result != EIO)
+		batch->broken = 1;
+	batch->total++;
+	printf("%d: %s %.3f ms: %.*s", batch->lines[index],
+	       result == 0 ? "OK" : "ERROR", now - batch->last, len,
+	       ctx->packet);
+	if (result == 0 && ctx->reply[0] != '\0')
+		printf("\n%s", ctx->reply);
+	else if (result != 0 && result != EIO)
+		printf(": %s", strerror(result));
+	else if (result != 0)
+		printf(": %s", ctx->reply);
+	putchar('\n');
+	fflush(stdout);
+	batch->last = now;
+}
+
+
+/** Pipeline the queued commands, wait for all replies. */
+static int run_batch(struct batch* batch, int fd)
+{
+	if (batch->count == 0)
+		return 0;
+	batch->last = now_ms();
+	lirc_command_run_notify(batch->ctx, batch->count, NULL, fd,
+				report, batch);
+	batch->count = 0;
+	/* Failed commands are reported, a broken connection stops. */
+	return batch->broken ? -1 : 0;
+}
+
+
+/**
+ * Run the directives in path, one per line, on one connection. Lines
+ * are pipelined up to a DELAY <ms> line, EOF or delay_ms being set.
+ * Empty lines and lines starting with # are skipped.
+ */
+static int send_file(const char* path, unsigned long delay_ms, int fd)
+{
+	struct batch batch;
+	char line[PACKET_SIZE + 1];
+	unsigned long ms;
+	double start;
+	int lineno = 0;
+	FILE* f;
+	char* s;
+
+	f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (f == NULL) {
+		perrorf("Cannot open %s", path);
+		return -1;
+	}
+	memset(&batch, 0, sizeof(batch));
+	batch.ctx = (lirc_cmd_ctx*)calloc(BATCH_MAX, sizeof(lirc_cmd_ctx));
+	batch.lines = (int*)calloc(BATCH_MAX, sizeof(int));
+	if (batch.ctx == NULL || batch.lines == NULL) {
+		fprintf(stderr, "%s: out of memory\n", prog);
+		exit(EXIT_FAILURE);
+	}
+	start = now_ms();
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		if (strchr(line, '\n') == NULL && !feof(f)) {
+			fprintf(stderr, "%s: line %d too long\n", prog, lineno);
+			goto error;
+		}
+		line[strcspn(line, "\r\n")] = '\0';
+		s = line + strspn(line, " \t");
+		if (*s == '\0' || *s == '#')
+			continue;
+		if (strncasecmp(s, "DELAY", 5) == 0 && isspace(s[5])) {
+			ms = strtoul(s + 6, NULL, 10);
+			if (run_batch(&batch, fd) == -1)
+				goto error;
+			sleep_ms(ms);
+			continue;
+		}
+		if (lirc_command_init(&batch.ctx[batch.count], "%s\n", s) != 0) {
+			fprintf(stderr, "%s: line %d too long\n", prog, lineno);
+			goto error;
+		}
+		batch.lines[batch.count++] = lineno;
+		if (delay_ms > 0 || batch.count == BATCH_MAX) {
+			if (run_batch(&batch, fd) == -1)
+				goto error;
+			sleep_ms(delay_ms);
+		}
+	}
+	if (run_batch(&batch, fd) == -1)
+		goto error;
+	printf("%d commands, %d errors, %.3f ms\n",
+	       batch.total, batch.errors, now_ms() - start);
+	if (f != stdin)
+		fclose(f);
+	free(batch.ctx);
+	free(batch.lines);
+	return batch.errors == 0 ? 0 : -1;
+
+error:
+	if (f != stdin)
+		fclose(f);
+	free(batch.ctx);
+	free(batch.lines);
+	return -1;
+}
+
+
 void reformat_simarg(char* code, char buffer[])
 {
 	unsigned int scancode;
@@ -95,6 +295,8 @@ int main(int argc, char** argv)
 	char* address = NULL;
 	unsigned short port = LIRC_INET_PORT;
 	unsigned long count = 1;
+	unsigned long delay_ms = 0;
+	const char* file = NULL;
 	int fd;
 	char buffer[PACKET_SIZE + 1];
 	int r;
@@ -110,9 +312,11 @@ int main(int argc, char** argv)
 			{ "device",  required_argument, NULL, 'd' },
 			{ "address", required_argument, NULL, 'a' },
 			{ "count",   required_argument, NULL, '#' },
+			{ "file",    required_argument, NULL, 'f' },
+			{ "delay",   required_argument, NULL, 'w' },
 			{ 0,	     0,			0,    0	  }
 		};
-		c = getopt_long(argc, argv, "hvd:a:#:", long_options, NULL);
+		c = getopt_long(argc, argv, "hvd:a:#:f:w:", long_options, NULL);
 		if (c == -1)
 			break;
 		switch (c) {
@@ -159,11 +363,29 @@ int main(int argc, char** argv)
 			}
 			break;
 		}
+		case 'f':
+			file = optarg;
+			break;
+		case 'w':
+		{
+			char* end;
+
+			delay_ms = strtoul(optarg, &end, 10);
+			if (!*optarg || *end) {
+				fprintf(stderr, "%s: invalid delay: %s\n", prog, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		}
 		default:
 			return EXIT_FAILURE;
 		}
 	}
-	if (optind + 2 > argc) {
+	if (file != NULL && optind != argc) {
+		fprintf(stderr, "%s: --file takes no commands\n", prog);
+		return EXIT_FAILURE;
+	}
+	if (file == NULL && optind + 2 > argc) {
 		fprintf(stderr, "%s: not enough arguments\n", prog);
 		return EXIT_FAILURE;
 	}
@@ -182,6 +404,11 @@ int main(int argc, char** argv)
 	if (address)
 		free(address);
 	address = NULL;
+	if (file != NULL) {
+		r = send_file(file, delay_ms, fd);
+		close(fd);
+		return r == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
 	directive = argv[optind++];
 
@@ -228,22 +455,9 @@ int main(int argc, char** argv)
 			fprintf(stderr, "%s: not enough arguments\n", prog);
 			exit(EXIT_FAILURE);
 		}
-		while (optind < argc) {
-			code = argv[optind++];
-			if (strcasecmp(directive, "SEND_ONCE") == 0 && count > 1)
-				r = lirc_command_init(&ctx, "%s %s %s %lu\n",
-						      directive, remote, code, count);
-			else
-				r = lirc_command_init(&ctx, "%s %s %s\n",
-						      directive, remote, code);
-			if (r != 0) {
-				fprintf(stderr, "%s: input too long\n", prog);
-				exit(EXIT_FAILURE);
-			}
-			lirc_command_reply_to_stdout(&ctx);
-			if (send_packet(&ctx, fd) == -1)
-				exit(EXIT_FAILURE);
-		}
+		if (send_codes(directive, remote, argv + optind,
+			       argc - optind, count, fd) == -1)
+			exit(EXIT_FAILURE);
 	}
 	close(fd);
 	return EXIT_SUCCESS;
@@ -0,0 +1,458 @@
+/****************************************************************************
+** irsimbench.cpp **********************************************************
+****************************************************************************
+*
+* irsimbench - time the encoding of all codes in given config files.
+*
+*/
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <getopt.h>
+#include <glob.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "lirc_private.h"
+#include "lirc_client.h"
+
+static const logchannel_t logchannel = LOG_APP;
+
+static const char* const USAGE =
+	"Time encoding of all codes in config files, per protocol.\n\n"
+	"Synopsis:\n"
+	"    irsimbench [-U path] [-c count] [--verify] <file|dir>...\n"
+	"    irsimbench [-h | -v]\n\n"
+	"<file> is a lircd.conf type config file, all *.conf files in a <dir>\n"
+	"are used.\n\n"
+	"Options:\n"
+	"    -U, --plugindir <path>:     Load drivers from <path>.\n"
+	"    -c, --count <count>:        Encode each code <count> times (100).\n"
+	"    -V, --verify                Decode each code and check the result.\n"
+	"    -v, --version               Print version.\n"
+	"    -h, --help                  Print this message.\n";
+
+static struct option options[] = {
+	{ "help",	no_argument,	   NULL, 'h' },
+	{ "version",	no_argument,	   NULL, 'v' },
+	{ "count",	required_argument, NULL, 'c' },
+	{ "verify",	no_argument,	   NULL, 'V' },
+	{ "pluginpath", required_argument, NULL, 'U' },
+	{ 0,		0,		   0,	 0   }
+};
+
+enum protocol {
+	P_RAW, P_RC5, P_RC6, P_RCMM, P_SPACE_ENC, P_SPACE_FIRST, P_XMP,
+	P_GRUNDIG, P_BO, P_SERIAL, P_OTHER, P_COUNT
+};
+
+static const char* const protocol_names[P_COUNT] = {
+	"raw", "rc5", "rc6", "rcmm", "space-enc", "space-first", "xmp",
+	"grundig", "bo", "serial", "other"
+};
+
+/** Accumulated results for one protocol family. */
+struct protocol_stats {
+	int		remotes;
+	int		codes;
+	long		encodes;
+	double		ns;
+	long		length_sum;
+	int		length_max;
+	int		failed;
+	int		verified;
+	int		mismatched;
+};
+
+static struct protocol_stats stats[P_COUNT];
+
+static int opt_count = 100;
+static int opt_verify = 0;
+
+static char infile_path[] = "/tmp/irsimbench-XXXXXX";
+static FILE* infile = NULL;
+
+/** A code written to the verify input file. */
+struct sent_code {
+	struct ir_remote*	remote;
+	struct ir_ncode*	code;
+};
+
+
+/** Set up default values for all command line options. */
+static void add_defaults(void)
+{
+	static char plugindir[128];
+	const char* defaults[] = {
+		"lircd:plugindir",	plugindir,
+		"irsimbench:count",	"100",
+		"irsimbench:verify",	"False",
+		(const char*)NULL,	(const char*)NULL
+	};
+	const char* s = getenv("LIRC_PLUGIN_PATH");
+
+	strncpy(plugindir, s != NULL ? s : PLUGINDIR, sizeof(plugindir) - 1);
+	options_add_defaults(defaults);
+}
+
+
+static void parse_options(int argc, char** const argv)
+{
+	long c;
+
+	add_defaults();
+
+	while ((c = getopt_long(argc, argv, "c:hU:vV", options, NULL))
+	       != EOF) {
+		switch (c) {
+		case 'h':
+			fputs(USAGE, stdout);
+			exit(EXIT_SUCCESS);
+		case 'c':
+			errno = 0;
+			c = strtol(optarg, NULL, 10);
+			if (c > INT_MAX || c <= 0 || errno != 0) {
+				fputs("Illegal count value\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+			options_set_opt("irsimbench:count", optarg);
+			break;
+		case 'v':
+			printf("%s\n", "irsimbench " VERSION);
+			exit(EXIT_SUCCESS);
+		case 'V':
+			options_set_opt("irsimbench:verify", "True");
+			break;
+		case 'U':
+			options_set_opt("lircd:plugindir", optarg);
+			break;
+		case '?':
+			fprintf(stderr, "unrecognized option: -%c\n", optopt);
+			fputs("Try `irsimbench -h' for more information.\n",
+			      stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc == optind) {
+		fputs(USAGE, stderr);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static enum protocol get_protocol(const struct ir_remote* remote)
+{
+	if (is_raw(remote))
+		return P_RAW;
+	if (is_rc6(remote))
+		return P_RC6;
+	if (is_rc5(remote))
+		return P_RC5;
+	if (is_rcmm(remote))
+		return P_RCMM;
+	if (is_space_enc(remote))
+		return P_SPACE_ENC;
+	if (is_space_first(remote))
+		return P_SPACE_FIRST;
+	if (is_xmp(remote))
+		return P_XMP;
+	if (is_grundig(remote))
+		return P_GRUNDIG;
+	if (is_bo(remote))
+		return P_BO;
+	if (is_serial(remote))
+		return P_SERIAL;
+	return P_OTHER;
+}
+
+
+static double elapsed_ns(const struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9
+	       + (now.tv_nsec - start->tv_nsec);
+}
+
+
+/** Load the file driver used to decode in --verify mode. */
+static void setup_verify(void)
+{
+	int fd;
+
+	if (hw_choose_driver("file") == -1) {
+		fputs("Cannot load file driver (bad plugin path?)\n",
+		      stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (curr_driver->open_func("/dev/null") == 0
+	    || curr_driver->init_func() == 0) {
+		fputs("Cannot open driver\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	fd = mkstemp(infile_path);
+	if (fd == -1) {
+		perror("Cannot create temporary file");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+}
+
+
+/** Append the signal in the send buffer to the verify input file. */
+static void write_signal(FILE* f)
+{
+	const lirc_t* data = send_buffer_data();
+	int i;
+
+	for (i = 0; i < send_buffer_length(); i++)
+		fprintf(f, "%s %d\n",
+			i % 2 == 0 ? "pulse" : "space", data[i]);
+	fputs("space 1000000\n", f);
+}
+
+
+/** Return 1 if the decoded message s is code in remote. */
+static int is_decoded_as(const char* s,
+			 const struct ir_remote* remote,
+			 const struct ir_ncode* code)
+{
+	char expected[256];
+	size_t s_len = strlen(s);
+	size_t len;
+
+	snprintf(expected, sizeof(expected), " %s %s\n",
+		 code->name, remote->name);
+	len = strlen(expected);
+	return s_len > len && strcmp(s + s_len - len, expected) == 0;
+}
+
+
+static void mismatch(const struct sent_code* sent, const char* decoded)
+{
+	if (decoded != NULL)
+		printf("%s %s: decoded as %s",
+		       sent->remote->name, sent->code->name, decoded);
+	else
+		printf("%s %s: not decoded\n",
+		       sent->remote->name, sent->code->name);
+	stats[get_protocol(sent->remote)].mismatched++;
+}
+
+
+/**
+ * Decode the verify input file with remotes loaded, and check that it
+ * decodes as the sent codes, in order.
+ */
+static void verify_file(struct ir_remote* remotes,
+		       const struct sent_code* sent,
+		       int count)
+{
+	struct option_t option;
+	int next = 0;
+	int at_eof;
+	char* s;
+	int i;
+
+	strcpy(option.key, "set-infile");
+	strncpy(option.value, infile_path, sizeof(option.value));
+	if (curr_driver->drvctl_func(DRVCTL_SET_OPTION, (void*)&option) != 0) {
+		fputs("Cannot set driver infile.\n", stderr);
+		return;
+	}
+	do {
+		s = curr_driver->rec_func(remotes);
+		at_eof = s != NULL && strstr(s, "__EOF") != NULL;
+		if (s == NULL || at_eof || next >= count)
+			continue;
+		/* Codes not decoded at all are skipped by the decoder. */
+		for (i = next; i < count; i++)
+			if (is_decoded_as(s, sent[i].remote, sent[i].code))
+				break;
+		if (i == count) {
+			mismatch(&sent[next++], s);
+			continue;
+		}
+		while (next < i)
+			mismatch(&sent[next++], NULL);
+		next++;
+	} while (!at_eof);
+	while (next < count)
+		mismatch(&sent[next++], NULL);
+}
+
+
+static void bench_code(struct ir_remote* remote,
+		       struct ir_ncode* code,
+		       struct protocol_stats* st)
+{
+	struct timespec start;
+	int repeat;
+	int i;
+
+	st->codes++;
+	for (repeat = 0; repeat <= (has_repeat(remote) ? 1 : 0); repeat++) {
+		if (!init_sim(remote, code, repeat)) {
+			st->failed++;
+			return;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < opt_count; i++)
+			init_sim(remote, code, repeat);
+		st->ns += elapsed_ns(&start);
+		st->encodes += opt_count;
+		st->length_sum += (long)send_buffer_length() * opt_count;
+		if (send_buffer_length() > st->length_max)
+			st->length_max = send_buffer_length();
+		if (opt_verify && !repeat)
+			write_signal(infile);
+	}
+}
+
+
+static void bench_file(const char* path)
+{
+	struct ir_remote* remotes;
+	struct ir_remote* remote;
+	struct ir_ncode* code;
+	struct protocol_stats* st;
+	struct sent_code* sent = NULL;
+	int sent_count = 0;
+	int sent_size = 0;
+	int failed;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s for read\n", path);
+		return;
+	}
+	remotes = read_config(f, path);
+	fclose(f);
+	if (remotes == (void*)-1 || remotes == NULL) {
+		fprintf(stderr, "Cannot parse %s\n", path);
+		return;
+	}
+	if (opt_verify) {
+		infile = fopen(infile_path, "w");
+		if (infile == NULL) {
+			perror("Cannot write temporary file");
+			exit(EXIT_FAILURE);
+		}
+		fputs("space 1000000\n", infile);
+	}
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		st = &stats[get_protocol(remote)];
+		st->remotes++;
+		for (code = remote->codes; code && code->name; code++) {
+			failed = st->failed;
+			bench_code(remote, code, st);
+			if (!opt_verify || st->failed != failed)
+				continue;
+			if (sent_count == sent_size) {
+				sent_size = sent_size ? 2 * sent_size : 64;
+				sent = (struct sent_code*)realloc(
+					sent, sent_size * sizeof(*sent));
+				if (sent == NULL) {
+					fputs("Out of memory\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+			}
+			sent[sent_count].remote = remote;
+			sent[sent_count].code = code;
+			sent_count++;
+			st->verified++;
+		}
+	}
+	if (opt_verify) {
+		fclose(infile);
+		infile = NULL;
+		verify_file(remotes, sent, sent_count);
+		free(sent);
+	}
+	free_config(remotes);
+}
+
+
+static void bench_path(const char* path)
+{
+	char pattern[PATH_MAX];
+	struct stat sb;
+	glob_t globbuf;
+	size_t i;
+
+	if (stat(path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+		bench_file(path);
+		return;
+	}
+	snprintf(pattern, sizeof(pattern), "%s/*.conf", path);
+	if (glob(pattern, 0, NULL, &globbuf) != 0)
+		return;
+	for (i = 0; i < globbuf.gl_pathc; i++)
+		bench_file(globbuf.gl_pathv[i]);
+	globfree(&globbuf);
+}
+
+
+static void print_stats(void)
+{
+	const struct protocol_stats* st;
+	int i;
+
+	printf("%-12s %7s %7s %9s %11s %9s %9s %7s",
+	       "protocol", "remotes", "codes", "encodes", "ns/encode",
+	       "avg len", "max len", "failed");
+	if (opt_verify)
+		printf(" %9s %10s", "verified", "mismatched");
+	putchar('\n');
+	for (i = 0; i < P_COUNT; i++) {
+		st = &stats[i];
+		if (st->remotes == 0)
+			continue;
+		printf("%-12s %7d %7d %9ld %11.0f %9.1f %9d %7d",
+		       protocol_names[i], st->remotes, st->codes, st->encodes,
+		       st->encodes ? st->ns / st->encodes : 0.0,
+		       st->encodes ? (double)st->length_sum / st->encodes
+				   : 0.0,
+		       st->length_max, st->failed);
+		if (opt_verify)
+			printf(" %9d %10d", st->verified, st->mismatched);
+		putchar('\n');
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	char path[128];
+	int mismatched = 0;
+	int i;
+	const loglevel_t level = options_get_app_loglevel("irsimbench");
+
+	lirc_log_get_clientlog("irsimbench", path, sizeof(path));
+	lirc_log_set_file(path);
+	lirc_log_open("irsimbench", 1, level);
+
+	options_load(argc, argv, NULL, parse_options);
+	opt_count = options_getint("irsimbench:count");
+	opt_verify = options_getboolean("irsimbench:verify");
+
+	if (opt_verify)
+		setup_verify();
+	send_buffer_init();
+	for (i = optind; i < argc; i++)
+		bench_path(argv[i]);
+	if (opt_verify)
+		unlink(infile_path);
+	print_stats();
+	for (i = 0; i < P_COUNT; i++)
+		mismatched += stats[i].mismatched;
+	return mismatched == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
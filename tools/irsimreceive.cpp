@@ -8,19 +8,47 @@
 
 #include <config.h>
 
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <time.h>
 
+/* --bench replaces the file driver's input in drv. */
+#define IN_DRIVER
 #include "lirc_private.h"
 #include "lirc_client.h"
 
 static const logchannel_t logchannel = LOG_APP;
 
+/** Durations replayed by --bench. */
+struct durations {
+	lirc_t*		data;
+	size_t		count;
+	size_t		size;
+};
+
+/** Latencies of the rec_func() calls returning a code, in ns. */
+struct latencies {
+	double*		data;
+	size_t		count;
+	size_t		size;
+};
+
+static struct durations input = { NULL, 0, 0 };
+static size_t input_pos = 0;
+
+static int (*plugin_decode)(struct ir_remote*, struct decode_ctx_t*);
+static double decode_ns = 0;
+
+
 static void add_defaults(void)
 {
 	static char plugindir[128];
         const static char* defaults[] = {
 		"lircd:plugindir",	plugindir,
+		"irsimreceive:bench",	"0",
+		"irsimreceive:remember-bursts", "False",
 		(const char*)NULL,	(const char*)NULL
 	};
 	const char* s = getenv("LIRC_PLUGIN_PATH");
@@ -36,12 +64,16 @@ static const char* const USAGE =
 	"<datafile> is a list of pulse/space durations.\n\n"
 	"Options:\n"
 	"    -U, --plugindir <path>:     Load drivers from <path>.\n"
+	"    -b, --bench <passes>:       Time decoding <datafile> <passes> times.\n"
+	"    -r, --remember-bursts       Decode as lircd --remember-bursts.\n"
 	"    -v, --version               Print version.\n"
 	"    -h, --help                  Print this message.\n";
 
 static struct option options[] = {
 	{ "help",	no_argument,	   NULL, 'h' },
 	{ "version",	no_argument,	   NULL, 'v' },
+	{ "bench",	required_argument, NULL, 'b' },
+	{ "remember-bursts", no_argument,  NULL, 'r' },
 	{ "pluginpath", required_argument, NULL, 'U' },
 	{ 0,		0,		   0,	 0   }
 };
@@ -53,9 +85,21 @@ static void parse_options(int argc, char** const argv)
 
 	add_defaults();
 
-	while ((c = getopt_long(argc, argv, "hvU:", options, NULL))
+	while ((c = getopt_long(argc, argv, "b:hrvU:", options, NULL))
 	       != EOF) {
 		switch (c) {
+		case 'b':
+			errno = 0;
+			c = strtol(optarg, NULL, 10);
+			if (c > INT_MAX || c <= 0 || errno != 0) {
+				fputs("Illegal bench passes value\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+			options_set_opt("irsimreceive:bench", optarg);
+			break;
+		case 'r':
+			options_set_opt("irsimreceive:remember-bursts", "True");
+			break;
 		case 'h':
 			fputs(USAGE, stdout);
 			exit(EXIT_SUCCESS);
@@ -174,10 +218,169 @@ int simreceive(struct ir_remote* remotes)
 }
 
 
+static int add_duration(struct durations* d, lirc_t value)
+{
+	lirc_t* data;
+
+	if (d->count == d->size) {
+		d->size = d->size ? 2 * d->size : 4096;
+		data = (lirc_t*)realloc(d->data, d->size * sizeof(lirc_t));
+		if (data == NULL)
+			return 0;
+		d->data = data;
+	}
+	d->data[d->count++] = value;
+	return 1;
+}
+
+
+/** Load path into d, as parsed by the file driver. */
+static int read_durations(const char* path, struct durations* d)
+{
+	char line[64];
+	char what[16];
+	int value;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s for read\n", path);
+		return 0;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%15s %d", what, &value) != 2)
+			continue;
+		value &= PULSE_MASK;
+		if (strstr(what, "pulse") != NULL)
+			value |= PULSE_BIT;
+		if (!add_duration(d, value)) {
+			fclose(f);
+			return 0;
+		}
+	}
+	fclose(f);
+	/* Terminate the last code. */
+	return add_duration(d, 1000000);
+}
+
+
+static lirc_t bench_readdata(lirc_t timeout)
+{
+	if (input_pos >= input.count)
+		return 0;
+	return input.data[input_pos++];
+}
+
+
+static double elapsed_ns(const struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9
+	       + (now.tv_nsec - start->tv_nsec);
+}
+
+
+/** The driver's decode_func, i. e. receive_decode(), timed. */
+static int bench_decode(struct ir_remote* remote, struct decode_ctx_t* ctx)
+{
+	struct timespec start;
+	int r;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	r = plugin_decode(remote, ctx);
+	decode_ns += elapsed_ns(&start);
+	return r;
+}
+
+
+static int add_latency(struct latencies* l, double ns)
+{
+	double* data;
+
+	if (l->count == l->size) {
+		l->size = l->size ? 2 * l->size : 4096;
+		data = (double*)realloc(l->data, l->size * sizeof(double));
+		if (data == NULL)
+			return 0;
+		l->data = data;
+	}
+	l->data[l->count++] = ns;
+	return 1;
+}
+
+
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ * The --bench task: replay the loaded durations passes times through
+ * the file driver's rec_func(), and report how fast codes are decoded.
+ */
+static int simbench(struct ir_remote* remotes, int passes)
+{
+	struct latencies latencies = { NULL, 0, 0 };
+	struct timespec start;
+	double total_ns = 0;
+	double ns;
+	char* code;
+	int i;
+	int (*decode_func)(struct ir_remote*, struct decode_ctx_t*);
+	lirc_t (*readdata)(lirc_t) = bench_readdata;
+	int (*readdata_bulk)(lirc_t*, int, lirc_t) = NULL;
+
+	/* The members of struct driver are const. */
+	plugin_decode = drv.decode_func;
+	decode_func = bench_decode;
+	memcpy((void*)&drv.decode_func, &decode_func, sizeof(decode_func));
+	memcpy((void*)&drv.readdata, &readdata, sizeof(readdata));
+	memcpy((void*)&drv.readdata_bulk, &readdata_bulk,
+	       sizeof(readdata_bulk));
+	for (i = 0; i < passes; i++) {
+		input_pos = 0;
+		rec_buffer_init();
+		while (input_pos < input.count) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			code = curr_driver->rec_func(remotes);
+			ns = elapsed_ns(&start);
+			total_ns += ns;
+			if (code != NULL && !add_latency(&latencies, ns)) {
+				fputs("Out of memory\n", stderr);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (latencies.count == 0) {
+		fputs("Nothing decoded\n", stderr);
+		return EXIT_FAILURE;
+	}
+	qsort(latencies.data, latencies.count, sizeof(double), cmp_double);
+	printf("%d passes, %lu codes/pass, %.3f s\n", passes,
+	       (unsigned long)latencies.count / passes, total_ns / 1e9);
+	printf("%.0f decodes/s\n", latencies.count * 1e9 / total_ns);
+	printf("Latency p50: %.0f ns, p99: %.0f ns\n",
+	       latencies.data[latencies.count / 2],
+	       latencies.data[latencies.count * 99 / 100]);
+	printf("receive_decode(): %.1f %%, get_code() and the rest: %.1f %%\n",
+	       decode_ns * 100 / total_ns,
+	       (total_ns - decode_ns) * 100 / total_ns);
+	free(latencies.data);
+	return EXIT_SUCCESS;
+}
+
+
 int main(int argc, char* argv[])
 {
 	struct ir_remote* remotes;
 	char path[128];
+	int passes;
 	const loglevel_t level = options_get_app_loglevel("irsimreceive");
 
 	lirc_log_get_clientlog("irsimreceive", path, sizeof(path));
@@ -187,5 +390,12 @@ int main(int argc, char* argv[])
 	options_load(argc, argv, NULL, parse_options);
 	setup(argv[optind + 1]);
 	remotes = read_lircd_conf(argv[optind]);
+	rec_set_recall(options_getboolean("irsimreceive:remember-bursts"));
+	passes = options_getint("irsimreceive:bench");
+	if (passes > 0) {
+		if (!read_durations(argv[optind + 1], &input))
+			return EXIT_FAILURE;
+		return simbench(remotes, passes);
+	}
 	return simreceive(remotes);
 }
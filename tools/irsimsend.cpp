@@ -10,10 +10,14 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include <errno.h>
 #include <getopt.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "lirc_private.h"
 #include "lirc_client.h"
@@ -26,15 +30,21 @@ static const char* const USAGE =
 	"    irsimsend [-U path] [-s time] [-c count] <file>\n"
 	"    irsimsend [-k keysym | -l listfile] [-U path] [-s time] [-c count]"
 	" <file>\n"
+	"    irsimsend -o dir [-j jobs] [-U path] [-s time] [-c count]"
+	" <file|dir>...\n"
 	"    irsimsend [-h | -v]\n\n"
 	"<file> is a lircd.conf type config file. In the first form, all keys in\n"
-	"that file are sent.\n\n"
+	"that file are sent. With -o, all keys of all remotes in the files, or\n"
+	"in all *.conf files in a <dir>, are written in binary mode2 format to\n"
+	"dir/<file>.<remote>.m2, instead of to simsend.out.\n\n"
 	"Options:\n"
 	"    -U, --plugindir <path>:     Load drivers from <path>.\n"
 	"    -c, --config <count>:       Repeat each key <count> times.\n"
 	"    -l, --listfile <file>       Send symbols in file.\n"
 	"    -k, --keysym <keysym>       Send a single keysym.\n"
 	"    -s, --start-space <time>    Send a start space <time> us\n"
+	"    -o, --output-dir <dir>      Write binary files to <dir>.\n"
+	"    -j, --jobs <jobs>           Encode <jobs> remotes at a time with -o.\n"
 	"    -v, --version               Print version.\n"
 	"    -h, --help                  Print this message.\n";
 
@@ -46,6 +56,8 @@ static struct option options[] = {
 	{ "listfile",	 required_argument, NULL, 'l' },
 	{ "pluginpath",	 required_argument, NULL, 'U' },
 	{ "start-space", required_argument, NULL, 's' },
+	{ "output-dir",	 required_argument, NULL, 'o' },
+	{ "jobs",	 required_argument, NULL, 'j' },
 	{ 0,		 0,		    0,	  0   }
 };
 
@@ -55,6 +67,21 @@ static int opt_count = 1;
 static int opt_startspace = -1;
 static const char* opt_keysym = NULL;
 static const char* opt_listfile = NULL;
+static const char* opt_outdir = NULL;
+static int opt_jobs = 0;
+
+/** A remote to encode with --output-dir, and the file it's from. */
+struct bulk_remote {
+	struct ir_remote*	remote;
+	const char*		path;
+};
+
+/** Durations encoded in memory with --output-dir. */
+struct durations {
+	lirc_t*		data;
+	size_t		count;
+	size_t		size;
+};
 
 
 /** Set up default values for all command line options + filename. */
@@ -67,7 +94,9 @@ static void add_defaults(void)
 		"irsimsend:count",	      "1",
 		"irsimsend:keysym",	      (const char*)NULL,
 		"irsimsend:listfile",	      (const char*)NULL,
-		"irsimsend:start-space"	      "-1",
+		"irsimsend:start-space",      "-1",
+		"irsimsend:output-dir",	      (const char*)NULL,
+		"irsimsend:jobs",	      "0",
 		(const char*)NULL,	      (const char*)NULL
 	};
 	const char* s = getenv("LIRC_PLUGIN_PATH");
@@ -96,7 +125,7 @@ static void parse_options(int argc, char** const argv)
 
 	add_defaults();
 
-	while ((c = getopt_long(argc, argv, "c:hk:l:s:U:v", options, NULL))
+	while ((c = getopt_long(argc, argv, "c:hj:k:l:o:s:U:v", options, NULL))
 	       != EOF) {
 		switch (c) {
 		case 'h':
@@ -122,6 +151,13 @@ static void parse_options(int argc, char** const argv)
 			(void) parse_uint_arg(optarg, "Illegal space value\n");
 			options_set_opt("irsimsend:start-space", optarg);
 			break;
+		case 'o':
+			options_set_opt("irsimsend:output-dir", optarg);
+			break;
+		case 'j':
+			(void) parse_uint_arg(optarg, "Illegal jobs value\n");
+			options_set_opt("irsimsend:jobs", optarg);
+			break;
 		case '?':
 			fprintf(stderr, "unrecognized option: -%c\n", optopt);
 			fputs("Try `irsimsend -h' for more information.\n",
@@ -129,7 +165,12 @@ static void parse_options(int argc, char** const argv)
 			exit(EXIT_FAILURE);
 		}
 	}
-	if (argc != optind + 1) {
+	if (options_getstring("irsimsend:output-dir") != NULL) {
+		if (argc == optind) {
+			fputs(USAGE, stderr);
+			exit(EXIT_FAILURE);
+		}
+	} else if (argc != optind + 1) {
 		fputs(USAGE, stderr);
 		exit(EXIT_FAILURE);
 	}
@@ -266,6 +307,230 @@ static int simsend_list(struct ir_remote* remote)
 	return 0;
 }
 
+static int add_duration(struct durations* d, lirc_t value)
+{
+	lirc_t* data;
+
+	if (d->count == d->size) {
+		d->size = d->size ? 2 * d->size : 4096;
+		data = (lirc_t*)realloc(d->data, d->size * sizeof(lirc_t));
+		if (data == NULL)
+			return 0;
+		d->data = data;
+	}
+	d->data[d->count++] = value;
+	return 1;
+}
+
+
+/**
+ * Encode code like send_code(), but into d, appending the gap as the
+ * file driver does.
+ */
+static int encode_code(struct ir_remote* remote,
+		       struct ir_ncode* code,
+		       struct durations* d)
+{
+	int i;
+	int j;
+
+	code->transmit_state = NULL;
+	if (has_toggle_mask(remote))
+		remote->toggle_mask_state = 0;
+	if (has_toggle_bit_mask(remote))
+		remote->toggle_bit_mask_state =
+			(remote->toggle_bit_mask_state ^ remote->toggle_bit_mask);
+	for (i = 0; i < opt_count; i++) {
+		repeat_remote = i > 0 ? remote : NULL;
+		if (!send_buffer_put(remote, code)) {
+			repeat_remote = NULL;
+			return 0;
+		}
+		for (j = 0; j < send_buffer_length(); j++) {
+			if (!add_duration(d, send_buffer_data()[j]
+					  | (j % 2 == 0 ? PULSE_BIT : 0)))
+				return 0;
+		}
+		if (!add_duration(d, remote->min_remaining_gap))
+			return 0;
+	}
+	repeat_remote = NULL;
+	return 1;
+}
+
+
+/** Output path for remote from config file path, in opt_outdir. */
+static void bulk_path(const struct bulk_remote* bulk,
+		      char* buff, size_t size)
+{
+	const char* base = strrchr(bulk->path, '/');
+	const char* ext;
+	char* s;
+	int len;
+
+	base = base == NULL ? bulk->path : base + 1;
+	ext = strstr(base, ".conf");
+	len = ext != NULL ? (int)(ext - base) : (int)strlen(base);
+	snprintf(buff, size, "%s/%.*s.%s.m2",
+		 opt_outdir, len, base, bulk->remote->name);
+	for (s = buff + strlen(opt_outdir) + 1; *s != '\0'; s++)
+		if (*s == '/')
+			*s = '_';
+}
+
+
+/** Encode all codes of one remote into its binary file. */
+static int bulk_remote(const struct bulk_remote* bulk)
+{
+	struct durations d = { NULL, 0, 0 };
+	struct ir_remote* remote = bulk->remote;
+	struct ir_ncode* code;
+	char path[PATH_MAX];
+	int ok = 1;
+	FILE* f;
+
+	remote->min_repeat = 0;
+	if (opt_startspace != -1)
+		ok = add_duration(&d, opt_startspace);
+	for (code = remote->codes; ok && code && code->name; code++) {
+		if (!encode_code(remote, code, &d))
+			fprintf(stderr, "%s: %s: cannot encode %s\n",
+				bulk->path, remote->name, code->name);
+	}
+	bulk_path(bulk, path, sizeof(path));
+	f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		free(d.data);
+		return 0;
+	}
+	if (ok) {
+		ok = mode2_file_write_header(f, "irsimsend", 0)
+		     && fwrite(d.data, sizeof(lirc_t), d.count, f) == d.count;
+	}
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		unlink(path);
+	}
+	free(d.data);
+	return ok;
+}
+
+
+/** Add all remotes in config file path to *bulk. */
+static void bulk_add_file(const char* path,
+			  struct bulk_remote** bulk, int* count, int* size)
+{
+	struct ir_remote* remotes;
+	struct ir_remote* remote;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s for read\n", path);
+		return;
+	}
+	remotes = read_config(f, path);
+	fclose(f);
+	if (remotes == (void*)-1 || remotes == NULL) {
+		fprintf(stderr, "Cannot parse %s\n", path);
+		return;
+	}
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		if (*count == *size) {
+			*size = *size ? 2 * *size : 64;
+			*bulk = (struct bulk_remote*)realloc(
+				*bulk, *size * sizeof(**bulk));
+			if (*bulk == NULL) {
+				fputs("Out of memory\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		(*bulk)[*count].remote = remote;
+		(*bulk)[*count].path = strdup(path);
+		*count += 1;
+	}
+}
+
+
+/**
+ * The --output-dir task: encode all remotes in the files and dirs,
+ * spread over opt_jobs processes, by default one per online cpu.
+ */
+static int simsend_bulk(char** paths, int path_count)
+{
+	char pattern[PATH_MAX];
+	struct bulk_remote* bulk = NULL;
+	struct stat sb;
+	glob_t globbuf;
+	pid_t* pids;
+	int count = 0;
+	int size = 0;
+	int failed = 0;
+	int status;
+	int jobs;
+	int i;
+	size_t j;
+
+	for (i = 0; i < path_count; i++) {
+		if (stat(paths[i], &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+			bulk_add_file(paths[i], &bulk, &count, &size);
+			continue;
+		}
+		snprintf(pattern, sizeof(pattern), "%s/*.conf", paths[i]);
+		if (glob(pattern, 0, NULL, &globbuf) != 0)
+			continue;
+		for (j = 0; j < globbuf.gl_pathc; j++)
+			bulk_add_file(globbuf.gl_pathv[j],
+				      &bulk, &count, &size);
+		globfree(&globbuf);
+	}
+	if (count == 0) {
+		fputs("No remotes found\n", stderr);
+		return EXIT_FAILURE;
+	}
+	jobs = opt_jobs > 0 ? opt_jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+	if (jobs > count)
+		jobs = count;
+	send_buffer_init();
+	pids = (pid_t*)calloc(jobs, sizeof(pid_t));
+	if (pids == NULL) {
+		fputs("Out of memory\n", stderr);
+		return EXIT_FAILURE;
+	}
+	fflush(NULL);
+	for (i = 0; i < jobs; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			status = EXIT_SUCCESS;
+			for (j = i; j < (size_t)count; j += jobs)
+				if (!bulk_remote(&bulk[j]))
+					status = EXIT_FAILURE;
+			fflush(NULL);
+			_exit(status);
+		}
+		if (pids[i] == -1) {
+			perror("Cannot fork");
+			failed = 1;
+		}
+	}
+	for (i = 0; i < jobs; i++) {
+		if (pids[i] == -1)
+			continue;
+		if (waitpid(pids[i], &status, 0) == -1
+		    || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = 1;
+	}
+	free(pids);
+	printf("%d remotes written to %s\n", count, opt_outdir);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
 int main(int argc, char* argv[])
 {
 	struct ir_remote* remote;
@@ -281,6 +546,11 @@ int main(int argc, char* argv[])
         opt_count = options_getint("irsimsend:count");
         opt_keysym = options_getstring("irsimsend:keysym");
         opt_listfile = options_getstring("irsimsend:listfile");
+	opt_outdir = options_getstring("irsimsend:output-dir");
+	opt_jobs = options_getint("irsimsend:jobs");
+
+	if (opt_outdir != NULL)
+		return simsend_bulk(argv + optind, argc - optind);
 
 	remote = setup(argv[optind]);
 	if (opt_startspace != -1)
@@ -21,13 +21,14 @@
 #include <sys/un.h>
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
 
 #include "lirc_client.h"
 #include "lirc_private.h"
 
 static const char* const USAGE =
 	"Synopsis:\n"
-	"irtestcase [-p prog -l lircrc] [-t testdata] <socket>\n"
+	"irtestcase [-p prog -l lircrc] [-t testdata [-f]] <socket>\n"
 	"irtestcase [ħ | -v]\n\n"
 	"<socket> is the socket connecting to lircd. Defaults to a hardcoded\n"
 	"default value, usually /var/run/lirc/lircd. Respects LIRC_SOCKET_PATH in\n"
@@ -36,6 +37,7 @@ static const char* const USAGE =
 	"   -l  lircrc  Log also translated symbols using lircrc type config file.\n"
 	"   -p  prog    Program name used to match entries in lircrc.\n"
 	"   -t  path    Use testdata from path.\n"
+	"   -f  fast    Replay testdata at once using lircd's virtual clock.\n"
 	"   -v  version Print version.\n"
 	"   -h  help    Print this message.\n";
 
@@ -43,6 +45,7 @@ static struct option opts[] = {
 	{ "prog",     required_argument, NULL, 'p' },
 	{ "lircrc",   required_argument, NULL, 'l' },
 	{ "testdata", required_argument, NULL, 't' },
+	{ "fast",     no_argument,	 NULL, 'f' },
 	{ "help",     no_argument,	 NULL, 'h' },
 	{ "version",  no_argument,	 NULL, 'v' },
 	{ 0,	      0,		 0,    0   }
@@ -61,6 +64,10 @@ static const int TESTDATA_DELAY = 1000000;
 static const char* opt_testdata = NULL;
 static const char* opt_lircrc = NULL;
 static const char* opt_prog = DEFAULT_PROG;
+static int opt_fast = 0;
+
+/** Command socket, used to restore the lircd clock on exit. */
+static int clock_fd = -1;
 
 static FILE* app_log = NULL;
 static FILE* code_log = NULL;
@@ -97,6 +104,52 @@ static void set_testinput(int fd, const char* path)
 }
 
 
+/** Select the lircd receive clock, "virtual" or "monotonic". */
+static int set_clock(int fd, const char* clock)
+{
+	lirc_cmd_ctx command;
+
+	lirc_command_init(&command, "SET_CLOCK %s\n", clock);
+	return lirc_command_run(&command, fd);
+}
+
+
+/** atexit() handler restoring the clock set by --fast. */
+static void restore_clock(void)
+{
+	if (clock_fd >= 0)
+		set_clock(clock_fd, "monotonic");
+}
+
+
+/** Restore the clock also when stopped by ctrl-C. */
+static void on_signal(int sig)
+{
+	restore_clock();
+	_exit(128 + sig);
+}
+
+
+/**
+ * Replay testdata as fast as lircd reads it. Since the virtual clock
+ * times the data, no delay is needed; the client is connected before
+ * the data is sent.
+ */
+static void send_now(int fd, const char* path)
+{
+	if (set_clock(fd, "virtual") != 0) {
+		fputs("Cannot set lircd virtual clock (too old lircd?)\n",
+		      stderr);
+		exit(2);
+	}
+	clock_fd = fd;
+	atexit(restore_clock);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	set_testinput(fd, path);
+}
+
+
 /** Setup and clear the hardcoded output directory. */
 static void init_testdir(void)
 {
@@ -209,7 +262,7 @@ int main(int argc, char* argv[])
 	int c;
 	const loglevel_t level = options_get_app_loglevel("irtestcase");
 
-	while ((c = getopt_long(argc, argv, "hl:p:t:v", opts, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "fhl:p:t:v", opts, NULL)) != EOF) {
 		switch (c) {
 		case 'l':
 			opt_lircrc = optarg;
@@ -220,6 +273,9 @@ int main(int argc, char* argv[])
 		case 't':
 			opt_testdata = optarg;
 			break;
+		case 'f':
+			opt_fast = 1;
+			break;
 		case 'h':
 			puts(USAGE);
 			return EXIT_SUCCESS;
@@ -241,6 +297,10 @@ int main(int argc, char* argv[])
 		fputs("--prog requires --lircrc/-l. Giving up.\n", stderr);
 		return EXIT_FAILURE;
 	}
+	if (opt_fast && opt_testdata == NULL) {
+		fputs("--fast requires --testdata/-t. Giving up.\n", stderr);
+		return EXIT_FAILURE;
+	}
 	if (opt_lircrc != NULL && strcmp(opt_prog, DEFAULT_PROG) == 0) {
 		fputs("--lircrc requires --prog/-p. Giving up.\n", stderr);
 		return EXIT_FAILURE;
@@ -256,7 +316,7 @@ int main(int argc, char* argv[])
 		exit(3);
 	}
 	set_devicelog(fd_cmd, DEVICE_LOG);
-	if (opt_testdata != NULL)
+	if (opt_testdata != NULL && !opt_fast)
 		send_later(fd_cmd, opt_testdata);
 
 	lirc_log_get_clientlog("irtestcase", path, sizeof(path));
@@ -269,6 +329,8 @@ int main(int argc, char* argv[])
 		fputs("Cannot run lirc_init.\n", stderr);
 		exit(3);
 	}
+	if (opt_fast)
+		send_now(fd_cmd, opt_testdata);
 
 	return irtestcase(fd_io, fd_cmd);
 }
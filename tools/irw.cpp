@@ -25,15 +25,30 @@
 #include <sys/un.h>
 #include <errno.h>
 #include <getopt.h>
+#include <time.h>
 
 #include "lirc_log.h"
 
 static struct option long_options[] = {
 	{ "help",    no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'v' },
+	{ "stats",   no_argument, NULL, 's' },
 	{ 0,	     0,		  0,	0   }
 };
 
+/** Log2 buckets of inter-arrival times, bucket i is < 2^i us. */
+#define STAT_BUCKETS 40
+
+/** Event statistics for --stats, for the last period and in total. */
+struct stats {
+	unsigned long long	events;
+	unsigned long long	buckets[STAT_BUCKETS];
+	unsigned long long	max_us;
+};
+
+static int opt_stats = 0;
+static volatile sig_atomic_t done = 0;
+
 
 void sigusr1(int sig)
 {
@@ -41,12 +56,104 @@ void sigusr1(int sig)
 }
 
 
+static void sigstop(int sig)
+{
+	done = 1;
+}
+
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static void stats_add(struct stats* st, unsigned long long delta)
+{
+	int i = 0;
+
+	while (i < STAT_BUCKETS - 1 && delta >= (1ULL << i))
+		i++;
+	st->buckets[i] += 1;
+	st->events += 1;
+	if (delta > st->max_us)
+		st->max_us = delta;
+}
+
+
+/** Return upper bound (us) of the bucket holding the given fraction. */
+static unsigned long long stats_percentile(const struct stats* st,
+					   double fraction)
+{
+	unsigned long long sum = 0;
+	int i;
+
+	for (i = 0; i < STAT_BUCKETS; i++) {
+		sum += st->buckets[i];
+		if (sum > 0 && sum >= st->events * fraction)
+			return 1ULL << i;
+	}
+	return 0;
+}
+
+
+static void stats_print(const char* what, const struct stats* st,
+			unsigned long long period_us)
+{
+	double rate = period_us > 0 ? st->events * 1e6 / period_us : 0;
+
+	printf("%s: %llu events, %.1f/s, inter-arrival p50 < %llu us,"
+	       " p99 < %llu us, max %llu us\n",
+	       what, st->events, rate,
+	       stats_percentile(st, 0.5), stats_percentile(st, 0.99),
+	       st->max_us);
+	fflush(stdout);
+}
+
+
+/**
+ * Count the events (lines) in buf received at time now, print and
+ * reset the period stats each second.
+ */
+static void stats_update(const char* buf, int size, unsigned long long now,
+			 struct stats* period, struct stats* total)
+{
+	static unsigned long long last_event = 0;
+	static unsigned long long period_start = 0;
+	unsigned long long delta;
+	int i;
+
+	if (period_start == 0)
+		period_start = now;
+	for (i = 0; i < size; i++) {
+		if (buf[i] != '\n')
+			continue;
+		/* Events in the same read arrived together. */
+		delta = last_event == 0 ? 0 : now - last_event;
+		last_event = now;
+		stats_add(period, delta);
+		stats_add(total, delta);
+	}
+	if (now - period_start >= 1000000) {
+		stats_print("last second", period, now - period_start);
+		memset(period, 0, sizeof(*period));
+		period_start = now;
+	}
+}
+
+
 
 int main(int argc, char* argv[])
 {
 	struct sigaction act;
 	int fd, i;
-	char buf[128];
+	static char buf[65536];
+	struct stats period;
+	struct stats total;
+	unsigned long long start;
 	struct sockaddr_un addr;
 	int c;
 	const char* progname;
@@ -60,17 +167,22 @@ int main(int argc, char* argv[])
 
 	addr.sun_family = AF_UNIX;
 
-	while ((c = getopt_long(argc, argv, "hv", long_options, NULL))
+	while ((c = getopt_long(argc, argv, "hvs", long_options, NULL))
 	       != EOF) {
 		switch (c) {
 		case 'h':
 			printf("Usage: %s [socket]\n", argv[0]);
 			printf("\t -h --help \t\tdisplay usage summary\n");
 			printf("\t -v --version \t\tdisplay version\n");
+			printf("\t -s --stats \t\tprint event rate and"
+			       " inter-arrival times\n");
 			return EXIT_SUCCESS;
 		case 'v':
 			printf("%s\n", progname);
 			return EXIT_SUCCESS;
+		case 's':
+			opt_stats = 1;
+			break;
 		case '?':
 			fprintf(stderr, "unrecognized option: -%c\n", optopt);
 			fprintf(stderr, "Try `%s --help' for more information.\n", progname);
@@ -97,14 +209,34 @@ int main(int argc, char* argv[])
 		perrorf("Cannot connect to socket %s", addr.sun_path);
 		exit(errno);
 	}
-	for (;; ) {
-		i = read(fd, buf, 128);
+	if (opt_stats) {
+		/* Interrupt read() to print the summary. */
+		act.sa_handler = sigstop;
+		act.sa_flags = 0;
+		sigaction(SIGUSR1, &act, NULL);
+		sigaction(SIGINT, &act, NULL);
+		sigaction(SIGTERM, &act, NULL);
+	}
+	memset(&period, 0, sizeof(period));
+	memset(&total, 0, sizeof(total));
+	start = now_us();
+	/* Copy all data available with one write per read(). */
+	while (!done) {
+		i = read(fd, buf, sizeof(buf));
+		if (i == -1 && errno == EINTR)
+			continue;
 		if (i == -1) {
 			perror("read");
 			exit(errno);
 		}
 		if (!i)
-			exit(0);
-		chk_write(STDOUT_FILENO, buf, i);
+			break;
+		if (opt_stats)
+			stats_update(buf, i, now_us(), &period, &total);
+		else
+			chk_write(STDOUT_FILENO, buf, i);
 	}
+	if (opt_stats)
+		stats_print("total", &total, now_us() - start);
+	return 0;
 }
@@ -85,9 +85,13 @@
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include <map>
+#include <string>
+
 #include "lirc_client.h"
 #include "lirc_log.h"
 
@@ -125,6 +129,13 @@ static Window root;
 static XEvent xev;
 static Window subw;
 
+/*
+ * Windows found by name. Entries are dropped when the window is
+ * destroyed or renamed, everything when windows are created or
+ * reparented, since a new window may match a cached name first.
+ */
+static std::map<std::string, Window> window_cache;
+
 static Time fake_timestamp(void)
 /*seems that xfree86 computes the timestamps like this     */
 /*strange but it relies on the *1000-32bit-wrap-around     */
@@ -218,6 +229,67 @@ static Window find_window(Window top, char* name)
 	return top;
 }
 
+static void uncache_window(Window w)
+{
+	std::map<std::string, Window>::iterator it = window_cache.begin();
+
+	while (it != window_cache.end()) {
+		if (it->second == w)
+			window_cache.erase(it++);
+		else
+			++it;
+	}
+}
+
+/* Update window_cache from the pending X events. */
+static void handle_x_events(void)
+{
+	XEvent ev;
+
+	while (XPending(dpy) > 0) {
+		XNextEvent(dpy, &ev);
+		switch (ev.type) {
+		case CreateNotify:
+		case ReparentNotify:
+			window_cache.clear();
+			break;
+		case DestroyNotify:
+			uncache_window(ev.xdestroywindow.window);
+			break;
+		case PropertyNotify:
+			if (ev.xproperty.atom == XA_WM_NAME
+			    || ev.xproperty.atom == XA_WM_ICON_NAME
+			    || ev.xproperty.atom == XA_WM_CLASS)
+				uncache_window(ev.xproperty.window);
+			break;
+		}
+	}
+}
+
+/* find_window() from root, using window_cache. */
+static Window lookup_window(char* name)
+{
+	std::map<std::string, Window>::iterator it;
+	Window w;
+
+	if (!strcmp(active_window_name, name)
+	    || !strcmp(root_window_name, name))
+		return find_window(root, name);
+	handle_x_events();
+	it = window_cache.find(name);
+	if (it != window_cache.end()) {
+		log_debug("cached window 0x%x\n", it->second);
+		return it->second;
+	}
+	w = find_window(root, name);
+	if (w) {
+		/* Tell us when it's destroyed or renamed. */
+		XSelectInput(dpy, w, StructureNotifyMask | PropertyChangeMask);
+		window_cache[name] = w;
+	}
+	return w;
+}
+
 static Window find_sub_sub_window(Window top, int* x, int* y)
 {
 	Window base;
@@ -281,7 +353,7 @@ static Window find_sub_window(Window top, char* name, int* x, int* y)
 	int rel_x, rel_y, new_x = 1, new_y = 1;
 	unsigned int nc, width, height, border, depth, targetsize = 1000000;
 
-	base = find_window(top, name);
+	base = lookup_window(name);
 	if (!base)
 		return base;
 	;
@@ -335,7 +407,7 @@ static Window find_window_focused(Window top, char* name)
 	/* return the currently focused window if it is a direct match or a
 	 * subwindow of the named window */
 
-	w = find_window(top, name);
+	w = lookup_window(name);
 	if (w) {
 		XGetInputFocus(dpy, &cur, &tmp);
 		log_debug("current window: 0x%x named window: 0x%x\n", cur, w);
@@ -456,7 +528,6 @@ static void sendfocus(Window w, int in_out)
 	focev.mode = NotifyNormal;
 	focev.detail = NotifyPointer;
 	XSendEvent(dpy, w, True, FocusChangeMask, (XEvent*)&focev);
-	XSync(dpy, True);
 }
 
 static void sendpointer_enter_or_leave(Window w, int in_out)
@@ -479,7 +550,6 @@ static void sendpointer_enter_or_leave(Window w, int in_out)
 	crossev.focus = True;
 	crossev.state = 0;
 	XSendEvent(dpy, w, True, EnterWindowMask | LeaveWindowMask, (XEvent*)&crossev);
-	XSync(dpy, True);
 }
 
 static void sendkey(char* keyname, int x, int y, Window w, Window s)
@@ -492,15 +562,13 @@ static void sendkey(char* keyname, int x, int y, Window w, Window s)
 		sendfocus(s, FocusIn);
 
 	XSendEvent(dpy, w, True, KeyPressMask, &xev);
-	XFlush(dpy);
 
+	/* Released 20 ms later, by the timestamp. */
 	xev.type = KeyRelease;
-	usleep(20000);
-	xev.xkey.time = fake_timestamp();
+	xev.xkey.time += 20;
 	if (s)
 		sendfocus(s, FocusOut);
 	XSendEvent(dpy, w, True, KeyReleaseMask, &xev);
-	XSync(dpy, True);
 }
 
 static void sendbutton(int button, int x, int y, Window w, Window s)
@@ -512,15 +580,12 @@ static void sendbutton(int button, int x, int y, Window w, Window s)
 	sendpointer_enter_or_leave(s, EnterNotify);
 
 	XSendEvent(dpy, w, True, ButtonPressMask, &xev);
-	XSync(dpy, True);
 	xev.type = ButtonRelease;
 	xev.xkey.state |= 0x100;
-	usleep(1000);
-	xev.xkey.time = fake_timestamp();
+	xev.xkey.time += 1;
 	XSendEvent(dpy, w, True, ButtonReleaseMask, &xev);
 	sendpointer_enter_or_leave(s, LeaveNotify);
 	sendpointer_enter_or_leave(w, LeaveNotify);
-	XSync(dpy, True);
 }
 
 int errorHandler(Display* di, XErrorEvent* ev)
@@ -622,6 +687,8 @@ int main(int argc, char* argv[])
 		exit(1);
 	}
 	root = RootWindow(dpy, DefaultScreen(dpy));
+	/* CreateNotify and ReparentNotify invalidate window_cache. */
+	XSelectInput(dpy, root, SubstructureNotifyMask);
 
 	// windows may get closed at wrong time. Override default error handler...
 	XSetErrorHandler(errorHandler);
@@ -694,7 +761,7 @@ int main(int argc, char* argv[])
 					   || 4 == sscanf(c, "xy_Key %d %d %s %s\n", &pointer_x, &pointer_y, keyname,
 							  windowname)) {
 					log_debug("name: %s\n", windowname);
-					WindowID = find_window(root, windowname);
+					WindowID = lookup_window(windowname);
 					if (WindowID == 0) {
 						log_debug("target window '%s' not found\n", windowname);
 						continue;
@@ -728,6 +795,8 @@ int main(int argc, char* argv[])
 					}
 					break;
 				}
+				/* All events of the action at once. */
+				XFlush(dpy);
 			}
 			free(ir);
 			if (ret == -1)
@@ -9,6 +9,7 @@
 #endif
 
 #include <dlfcn.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -26,6 +27,8 @@
 	"\nSynopsis:\n" \
 	"    lirc-lsplugins [-l] [-q] [-U plugindir] [drivers]\n" \
 	"    lirc-lsplugins -e [-q] [-U plugindir]\n" \
+	"    lirc-lsplugins -w [-U plugindir]\n" \
+	"    lirc-lsplugins -d [-U plugindir] [drivers]\n" \
 	"    lirc-lsplugins [-s|-p|-h|-v]\n\n" \
 	"If [drivers] is given list matching plugins, else list all.\n\n" \
 	"Options:\n" \
@@ -34,6 +37,8 @@
 	"    -l, --long\t\tLots of info (a. k. a. long listing).\n" \
 	"    -y, --yaml\t\tGenerate a YAML plugins config file.\n" \
 	"    -e, --errors\tList plugins which can't load driver(s).\n" \
+	"    -d, --devices\tList devices of drivers which can list them.\n" \
+	"    -w, --write-index\tWrite plugin index used by lircd etc.\n" \
 	"    -s, --summary\tPrint summary on plugins status.\n" \
 	"    -q, --quiet\t\tBe less verbose.\n" \
 	"    -p, --default-path\tPrint default search path and exit.\n" \
@@ -67,6 +72,8 @@ const struct option options[] = {
 	{ "errors",	  no_argument,	     NULL, 'e' },
 	{ "summary",	  no_argument,	     NULL, 's' },
 	{ "yaml",	  no_argument,	     NULL, 'y' },
+	{ "write-index",  no_argument,	     NULL, 'w' },
+	{ "devices",	  no_argument,	     NULL, 'd' },
 	{ "default-path", no_argument,	     NULL, 'p' },
 	{ "version",	  no_argument,	     NULL, 'v' },
 	{ "help",	  no_argument,	     NULL, 'h' }
@@ -101,6 +108,19 @@ static int opt_long = 0;                /**< --long option */
 static int opt_summary = 0;             /**< --summary option */
 static int opt_listerrors = 0;          /**< --errors option */
 static int opt_yaml = 0;                /**< --yaml option */
+static int opt_write_index = 0;         /**< --write-index option */
+static int opt_devices = 0;             /**< --devices option */
+
+/** A driver which can list devices, see --devices. */
+typedef struct {
+	const struct driver*	driver;
+	glob_t			devices;
+	int			result;         /**< Of DRVCTL_GET_DEVICES. */
+} probe_t;
+
+static probe_t probes[MAX_PLUGINS];
+static int probe_count = 0;
+static int next_probe = 0;              /**< Next to run, atomic. */
 
 static int sum_drivers = 0;
 static int sum_plugins = 0;
@@ -353,7 +373,10 @@ static void format_drivers(struct driver**	drivers,
 		line->type = what;
 		what = ((*drivers)->features & CAN_SEND) ? "yes" : "no";
 		line->can_send = what;
-		can_list = strcmp((*drivers)->device_hint, "drvctl") == 0;
+		can_list = (*drivers)->device_hint != NULL
+			   && strcmp((*drivers)->device_hint, "drvctl") == 0;
+		if (can_list && probe_count < MAX_PLUGINS)
+			probes[probe_count++].driver = *drivers;
 		snprintf(buf, sizeof(buf), "-%c%c%c",
 			 get(CAN_ANY, 'a', *drivers),
 			 get(CAN_SEND, 's', *drivers),
@@ -458,6 +481,92 @@ void lsplugins(const char* pluginpath, const char* which)
 }
 
 
+/** Worker thread: run DRVCTL_GET_DEVICES for probes until none left. */
+static void* probe_main(void* arg)
+{
+	probe_t* probe;
+	int i;
+
+	(void)arg;
+	while ((i = __atomic_fetch_add(&next_probe, 1, __ATOMIC_RELAXED))
+	       < probe_count) {
+		probe = &probes[i];
+		memset(&probe->devices, 0, sizeof(probe->devices));
+		if (probe->driver->drvctl_func == NULL) {
+			probe->result = DRV_ERR_NOT_IMPLEMENTED;
+			continue;
+		}
+		probe->result = probe->driver->drvctl_func(DRVCTL_GET_DEVICES,
+							   &probe->devices);
+	}
+	return NULL;
+}
+
+
+static int probe_cmp(const void* a, const void* b)
+{
+	return strcmp(((const probe_t*)a)->driver->name,
+		      ((const probe_t*)b)->driver->name);
+}
+
+
+/**
+ * The --devices option: list the devices of all matching drivers which
+ * can list them. The drivers are probed in parallel, one thread for
+ * each online cpu; they share the snapshot in drv_enum.c and so scan
+ * the system once. Each line is the driver name and a device entry.
+ */
+static int list_devices(const char* pluginpath, const char* which)
+{
+	pthread_t* threads;
+	long jobs;
+	size_t k;
+	int i;
+	int j;
+
+	opt_listerrors = 0;
+	for_each_plugin(format_plugin, (void*)which, pluginpath);
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+	if (jobs > probe_count)
+		jobs = probe_count;
+	threads = (pthread_t*)calloc(jobs > 0 ? jobs : 1, sizeof(pthread_t));
+	if (threads == NULL) {
+		fputs("Out of memory\n", stderr);
+		return 1;
+	}
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, probe_main, NULL) != 0)
+			break;
+	}
+	if (i == 0)
+		probe_main(NULL);
+	for (j = 0; j < i; j++)
+		pthread_join(threads[j], NULL);
+	free(threads);
+
+	qsort(probes, probe_count, sizeof(probe_t), probe_cmp);
+	for (i = 0; i < probe_count; i++) {
+		if (probes[i].result == DRV_ERR_ENUM_EMPTY)
+			continue;
+		if (probes[i].result != 0) {
+			if (!opt_quiet)
+				printf("# %s: Cannot list devices (%d)\n",
+				       probes[i].driver->name,
+				       probes[i].result);
+			continue;
+		}
+		for (k = 0; k < probes[i].devices.gl_pathc; k++)
+			printf("%s %s\n", probes[i].driver->name,
+			       probes[i].devices.gl_pathv[k]);
+		probes[i].driver->drvctl_func(DRVCTL_FREE_DEVICES,
+					      &probes[i].devices);
+	}
+	return 0;
+}
+
+
 int main(int argc, char** argv)
 {
 	const char* pluginpath;
@@ -470,7 +579,7 @@ int main(int argc, char** argv)
 	if (getenv(PLUGINDIR_VAR) != NULL)
 		pluginpath = getenv(PLUGINDIR_VAR);
 	while ((c = getopt_long(argc, argv,
-				"selpqvhU:y", options, NULL)) != -1) {
+				"selpqvhU:ywd", options, NULL)) != -1) {
 		switch (c) {
 		case 'U':
 			pluginpath = optarg;
@@ -500,6 +609,12 @@ int main(int argc, char** argv)
 			opt_yaml = 1;
 			opt_quiet = 1;
 			break;
+		case 'w':
+			opt_write_index = 1;
+			break;
+		case 'd':
+			opt_devices = 1;
+			break;
 		default:
 			fputs(USAGE, stderr);
 			exit(1);
@@ -517,6 +632,10 @@ int main(int argc, char** argv)
 	lirc_log_set_file(path);
 	lirc_log_open("lirc-lsplugins", 1, level);
 
+	if (opt_write_index)
+		return hw_write_index(pluginpath) == 0 ? 0 : 1;
+	if (opt_devices)
+		return list_devices(pluginpath, which);
 	lsplugins(pluginpath, which);
 	return sum_errors == 0 ? 0 : 1;
 }
@@ -15,9 +15,11 @@
 #include <glob.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "lirc_private.h"
@@ -27,6 +29,28 @@ static const logchannel_t logchannel = LOG_APP;
 
 static int opt_silent = 0;
 static int opt_dump = 0;
+static int opt_jobs = 1;
+static const char* opt_cache = NULL;
+
+/** First line of a cache file, bump when the format changes. */
+static const char* const CACHE_MAGIC = "# lirc-lsremotes cache 1\n";
+
+/** A lircd.conf file in the database and its index lines. */
+struct entry {
+	char*		path;
+	time_t		mtime;
+	off_t		size;
+	time_t		dir_mtime;      /**< lircmd and photo siblings. */
+	char*		output;         /**< Index lines, malloc()'d. */
+	size_t		len;
+};
+
+/** A growing array of entries. */
+struct entries {
+	struct entry*	items;
+	size_t		count;
+	size_t		size;
+};
 
 static const char* current_dir = NULL;
 
@@ -41,6 +65,8 @@ static const char* const USAGE =
 	"Options:\n"
 	"    -s  --silent       Just parse and print diagnostics.\n"
 	"    -d  --dump         Dump complete configuration (noisy).\n"
+	"    -j  --jobs <n>     Parse files in n parallel processes.\n"
+	"    -c  --cache <file> Reuse lines for files unchanged since last run.\n"
 	"    -v, --version      Print version.\n"
 	"    -h, --help         Print this message.\n";
 
@@ -48,6 +74,8 @@ static const char* const USAGE =
 static struct option options[] = {
 	{ "dump",    no_argument, NULL, 'd' },
 	{ "silent",  no_argument, NULL, 's' },
+	{ "jobs",    required_argument, NULL, 'j' },
+	{ "cache",   required_argument, NULL, 'c' },
 	{ "help",    no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'v' },
 	{ 0,	     0,		  0,	0   }
@@ -112,7 +140,7 @@ void get_photo(const char* const path, char* buff, ssize_t size)
 
 
 /** Print a line for each remote definition in lircd.conf file on path. */
-void print_remotes(const char* path)
+void print_remotes(const char* path, FILE* out)
 {
 	char my_path[256];
 	char photo[256];
@@ -142,7 +170,7 @@ void print_remotes(const char* path)
 		strncpy(photo, path, sizeof(photo));
 		get_photo(path, photo, sizeof(photo));
 		get_lircmd(path, lircmd, sizeof(lircmd));
-		printf("%s;%s;%s;%s;%s;%s;%s;%s\n",
+		fprintf(out, "%s;%s;%s;%s;%s;%s;%s;%s\n",
 		       dir,
 		       base,
 		       lircmd,
@@ -151,9 +179,9 @@ void print_remotes(const char* path)
 		       timing,
 		       is_raw(r) ? "raw" : "no_raw",
 		       r->driver != NULL ? r->driver : "no_driver");
-		fflush(stdout);
+		fflush(out);
 		if (opt_dump)
-			fprint_remote(stdout, r, "Dumped by lirc-lsremotes");
+			fprint_remote(out, r, "Dumped by lirc-lsremotes");
 		r = r->next;
 	}
 	;
@@ -196,12 +224,53 @@ int isfile(const struct dirent* ent)
 }
 
 
-/** List all remotes found in files in dir. */
-void listdir(const char* dirname)
+static void entries_add(struct entries* list, const char* path,
+			time_t dir_mtime)
+{
+	struct entry* e;
+	struct stat statbuf;
+
+	if (list->count == list->size) {
+		list->size = list->size == 0 ? 256 : 2 * list->size;
+		list->items = (struct entry*)realloc(
+			list->items, list->size * sizeof(struct entry));
+		if (list->items == NULL) {
+			fputs("Out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	e = &list->items[list->count++];
+	memset(e, 0, sizeof(*e));
+	e->path = strdup(path);
+	e->dir_mtime = dir_mtime;
+	if (stat(path, &statbuf) == 0) {
+		e->mtime = statbuf.st_mtime;
+		e->size = statbuf.st_size;
+	}
+}
+
+
+static void entries_free(struct entries* list)
+{
+	size_t i;
+
+	for (i = 0; i < list->count; i++) {
+		free(list->items[i].path);
+		free(list->items[i].output);
+	}
+	free(list->items);
+	memset(list, 0, sizeof(*list));
+}
+
+
+/** Add all lircd.conf files in dir to list. */
+void listdir(const char* dirname, struct entries* list)
 {
 	char dirpath[512];
 	char filepath[512];
 	struct dirent** namelist;
+	struct stat statbuf;
+	time_t dir_mtime = 0;
 	int size;
 	int i;
 
@@ -210,35 +279,291 @@ void listdir(const char* dirname)
 	if (strlen(dirname) > 0 && dirname[0] == '.')
 		return;
 	snprintf(dirpath, sizeof(dirpath), "%s/%s", current_dir, dirname);
+	if (stat(dirpath, &statbuf) == 0)
+		dir_mtime = statbuf.st_mtime;
 	size = scandir(dirpath, &namelist, isfile, alphasort);
 	for (i = 0; i < size; i += 1) {
 		snprintf(filepath, sizeof(filepath), "%s/%s",
 			 dirpath, namelist[i]->d_name);
 		free(namelist[i]);
-		print_remotes(filepath);
+		entries_add(list, filepath, dir_mtime);
+	}
+	if (size >= 0)
+		free(namelist);
+}
+
+
+/** Set e->output to the index lines for e->path. */
+static void parse_entry(struct entry* e)
+{
+	FILE* out;
+
+	out = open_memstream(&e->output, &e->len);
+	if (out == NULL) {
+		perror("open_memstream");
+		exit(EXIT_FAILURE);
+	}
+	print_remotes(e->path, out);
+	fclose(out);
+}
+
+
+static int write_all(int fd, const void* buff, size_t size)
+{
+	const char* p = (const char*)buff;
+	ssize_t r;
+
+	while (size > 0) {
+		r = write(fd, p, size);
+		if (r <= 0)
+			return 0;
+		p += r;
+		size -= r;
+	}
+	return 1;
+}
+
+
+static int read_all(int fd, void* buff, size_t size)
+{
+	char* p = (char*)buff;
+	ssize_t r;
+
+	while (size > 0) {
+		r = read(fd, p, size);
+		if (r <= 0)
+			return 0;
+		p += r;
+		size -= r;
+	}
+	return 1;
+}
+
+
+/**
+ * Parse the todo entries in opt_jobs child processes. Child k parses
+ * todo[k], todo[k + jobs]... and writes a length and the lines for
+ * each on its own pipe. The parent reads them back in todo order, so
+ * the output order does not depend on the scheduling.
+ */
+static void parse_parallel(struct entry** todo, size_t count)
+{
+	int jobs = opt_jobs;
+	int fds[jobs];
+	pid_t pids[jobs];
+	int pipefd[2];
+	uint64_t len;
+	size_t i;
+	int k;
+
+	if ((size_t)jobs > count)
+		jobs = count;
+	fflush(stdout);
+	fflush(stderr);
+	for (k = 0; k < jobs; k++) {
+		if (pipe(pipefd) == -1) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+		pids[k] = fork();
+		if (pids[k] == -1) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if (pids[k] == 0) {
+			close(pipefd[0]);
+			for (i = k; i < count; i += jobs) {
+				parse_entry(todo[i]);
+				len = todo[i]->len;
+				if (!write_all(pipefd[1], &len, sizeof(len))
+				    || !write_all(pipefd[1],
+						  todo[i]->output, len))
+					_exit(EXIT_FAILURE);
+			}
+			_exit(EXIT_SUCCESS);
+		}
+		close(pipefd[1]);
+		fds[k] = pipefd[0];
+	}
+	for (i = 0; i < count; i++) {
+		k = i % jobs;
+		if (!read_all(fds[k], &len, sizeof(len))) {
+			fprintf(stderr, "Worker failed on %s\n", todo[i]->path);
+			exit(EXIT_FAILURE);
+		}
+		todo[i]->output = (char*)malloc(len + 1);
+		if (todo[i]->output == NULL
+		    || !read_all(fds[k], todo[i]->output, len)) {
+			fprintf(stderr, "Worker failed on %s\n", todo[i]->path);
+			exit(EXIT_FAILURE);
+		}
+		todo[i]->output[len] = '\0';
+		todo[i]->len = len;
+	}
+	for (k = 0; k < jobs; k++) {
+		close(fds[k]);
+		waitpid(pids[k], NULL, 0);
+	}
+}
+
+
+static int cmp_entry_path(const void* a, const void* b)
+{
+	return strcmp(((const struct entry*)a)->path,
+		      ((const struct entry*)b)->path);
+}
+
+
+/** Load cache entries from path, sorted by path. Missing is empty. */
+static void load_cache(const char* path, struct entries* cache)
+{
+	char line[1024];
+	struct entry* e;
+	long long mtime;
+	long long dir_mtime;
+	long long size;
+	size_t len;
+	int n;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return;
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strcmp(line, CACHE_MAGIC) != 0) {
+		fprintf(stderr, "Ignoring invalid cache %s\n", path);
+		fclose(f);
+		return;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "F %lld %lld %lld %zu %n",
+			   &mtime, &size, &dir_mtime, &len, &n) != 4)
+			break;
+		line[strcspn(line, "\n")] = '\0';
+		entries_add(cache, line + n, 0);
+		e = &cache->items[cache->count - 1];
+		e->mtime = mtime;
+		e->size = size;
+		e->dir_mtime = dir_mtime;
+		e->output = (char*)malloc(len + 1);
+		if (e->output == NULL || fread(e->output, 1, len, f) != len) {
+			cache->count -= 1;
+			free(e->path);
+			free(e->output);
+			break;
+		}
+		e->output[len] = '\0';
+		e->len = len;
+	}
+	fclose(f);
+	qsort(cache->items, cache->count, sizeof(struct entry),
+	      cmp_entry_path);
+}
+
+
+/** Write list to path, atomically replacing any old cache. */
+static void save_cache(const char* path, const struct entries* list)
+{
+	char tmp[PATH_MAX];
+	const struct entry* e;
+	FILE* f;
+	size_t i;
+	int ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		perror(tmp);
+		return;
+	}
+	ok = fputs(CACHE_MAGIC, f) >= 0;
+	for (i = 0; ok && i < list->count; i++) {
+		e = &list->items[i];
+		ok = fprintf(f, "F %lld %lld %lld %zu %s\n",
+			     (long long)e->mtime, (long long)e->size,
+			     (long long)e->dir_mtime, e->len, e->path) > 0
+		     && fwrite(e->output, 1, e->len, f) == e->len;
+	}
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, path) == -1) {
+		perror(path);
+		unlink(tmp);
 	}
 }
 
 
+/** Take over the cached output for e if it is still valid. */
+static int use_cached(struct entry* e, struct entries* cache)
+{
+	struct entry* hit;
+
+	hit = (struct entry*)bsearch(e, cache->items, cache->count,
+				     sizeof(struct entry), cmp_entry_path);
+	if (hit == NULL || hit->output == NULL
+	    || hit->mtime != e->mtime || hit->size != e->size
+	    || hit->dir_mtime != e->dir_mtime)
+		return 0;
+	e->output = hit->output;
+	e->len = hit->len;
+	hit->output = NULL;
+	return 1;
+}
+
+
 int lsremotes(const char* dirpath, const char* remote)
 {
 	struct dirent** namelist;
+	struct entries list = { NULL, 0, 0 };
+	struct entries cache = { NULL, 0, 0 };
+	struct entry** todo;
+	size_t todo_count = 0;
+	int use_cache;
 	int size;
-	int i;
+	size_t i;
+	int j;
 	struct stat statbuf;
 
 	if (stat(dirpath, &statbuf) == -1)
 		return 2;
 	if (!S_ISDIR(statbuf.st_mode)) {
-		print_remotes(dirpath);
+		print_remotes(dirpath, stdout);
 		return 0;
 	}
 	current_dir = dirpath;
 	size = scandir(dirpath, &namelist, isdir, alphasort);
-	for (i = 0; i < size; i += 1) {
-		listdir(namelist[i]->d_name);
-		free(namelist[i]);
+	for (j = 0; j < size; j += 1) {
+		listdir(namelist[j]->d_name, &list);
+		free(namelist[j]);
 	}
+	if (size >= 0)
+		free(namelist);
+
+	/* Cached lines would skip the diagnostics and dumps. */
+	use_cache = opt_cache != NULL && !opt_dump && !opt_silent;
+	if (use_cache)
+		load_cache(opt_cache, &cache);
+	todo = (struct entry**)calloc(list.count + 1, sizeof(struct entry*));
+	for (i = 0; i < list.count; i++) {
+		if (!use_cache || !use_cached(&list.items[i], &cache))
+			todo[todo_count++] = &list.items[i];
+	}
+	if (opt_jobs > 1 && todo_count > 1) {
+		parse_parallel(todo, todo_count);
+	} else {
+		for (i = 0; i < todo_count; i++)
+			parse_entry(todo[i]);
+	}
+	for (i = 0; i < list.count; i++)
+		fwrite(list.items[i].output, 1, list.items[i].len, stdout);
+	fflush(stdout);
+	if (use_cache) {
+		log_info("%zu of %zu files parsed", todo_count, list.count);
+		save_cache(opt_cache, &list);
+	}
+	free(todo);
+	entries_free(&cache);
+	entries_free(&list);
 	return 0;
 }
 
@@ -271,7 +596,7 @@ int main(int argc, char** argv)
 	char path[128];
 	int c;
 
-	while ((c = getopt_long(argc, argv, "shdv", options, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "shdvj:c:", options, NULL)) != EOF) {
 		switch (c) {
 		case 'd':
 			opt_dump = 1;
@@ -279,6 +604,16 @@ int main(int argc, char** argv)
 		case 's':
 			opt_silent = 1;
 			break;
+		case 'j':
+			opt_jobs = atoi(optarg);
+			if (opt_jobs < 1) {
+				fprintf(stderr, "Bad --jobs value: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			opt_cache = optarg;
+			break;
 		case 'h':
 			puts(USAGE);
 			return EXIT_SUCCESS;
@@ -314,12 +314,44 @@ class SerialDeviceListModel(DeviceListModel):
                 self.label_by_device[dev] = dev
 
 
+_DEVICES_BY_DRIVER = None
+
+
+def _devices_by_driver():
+    ''' Return a dict of device lines by driver for all drivers which
+    can list devices, from a single lirc-lsplugins --devices run probing
+    them all. The result is cached. Returns None if it cannot be run
+    e. g., with an older lirc-lsplugins.
+    '''
+    global _DEVICES_BY_DRIVER         # pylint: disable=global-statement
+    if _DEVICES_BY_DRIVER is not None:
+        return _DEVICES_BY_DRIVER
+    trypath = os.path.abspath(_here("../lirc-lsplugins"))
+    plugindir = "../../plugins/.libs"
+    if not os.path.exists(trypath):
+        trypath = os.path.join(config.SBINDIR, "lirc-lsplugins")
+        plugindir = None
+    cmd = [trypath, "--quiet", "--devices"]
+    if plugindir:
+        cmd.extend(["-U", plugindir])
+    try:
+        result = subprocess.check_output(cmd, universal_newlines=True,
+                                         stderr=subprocess.DEVNULL)
+    except (OSError, subprocess.CalledProcessError):
+        return None
+    _DEVICES_BY_DRIVER = {}
+    for line in result.split("\n"):
+        words = line.split(None, 1)
+        if len(words) == 2 and not line.startswith('#'):
+            _DEVICES_BY_DRIVER.setdefault(words[0], []).append(words[1])
+    return _DEVICES_BY_DRIVER
+
+
 class DrvctlDeviceListModel(DeviceListModel):
     '''A device list for a driver supporting drvctl enumeration. '''
 
-    def list_devices(self):
-        ''' Return a dict label_by_device, labels for matching devices. '''
-        self.label_by_device = {}
+    def _run_mode2(self):
+        ''' Return the mode2 --list-devices output for the driver. '''
         trypath = os.path.abspath(_here("../mode2"))
         if not os.path.exists(trypath):
             trypath = os.path.join(config.BINDIR, "mode2")
@@ -332,14 +364,20 @@ class DrvctlDeviceListModel(DeviceListModel):
         if plugindir:
             cmd.extend(["-U", plugindir])
         try:
-            result = subprocess.check_output(cmd, universal_newlines=True)
+            return subprocess.check_output(cmd, universal_newlines=True)
         except (OSError, subprocess.CalledProcessError):
             sys.stderr.write("Error invoking: " + " ".join(cmd))
-            result = None
-        if not result:
-            self.label_by_device['dev_null'] = 'No devices found'
-            return
-        devices = result.split("\n")
+            return None
+
+    def list_devices(self):
+        ''' Return a dict label_by_device, labels for matching devices. '''
+        self.label_by_device = {}
+        all_devices = _devices_by_driver()
+        if all_devices is not None:
+            devices = all_devices.get(self.driver_id, [])
+        else:
+            result = self._run_mode2()
+            devices = result.split("\n") if result else []
         for device in devices:
             words = device.split(None, 1)
             if len(words) == 0:
@@ -348,6 +386,8 @@ class DrvctlDeviceListModel(DeviceListModel):
                 self.label_by_device[words[0]] = words[0]
             else:
                 self.label_by_device[words[0]] = " ".join(words)
+        if not self.label_by_device:
+            self.label_by_device['dev_null'] = 'No devices found'
 
 
 class UdpPortDeviceList(DeviceListModel):
@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
@@ -36,6 +37,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <glob.h>
+#include <poll.h>
 #include <syslog.h>
 #include <time.h>
 #include <pwd.h>
@@ -52,6 +54,13 @@ static int t_div = 500;
 static unsigned int opt_gap = 10000;
 static int opt_raw_access = 0;
 static int opt_list_devices = 0;
+static int opt_flush_ms = -1;
+
+/** Pulse/space values read from the device at a time. */
+#define READ_BULK 256
+
+static struct timespec last_flush;
+static int unflushed = 0;
 
 static const char* const help =
 	"Usage: mode2 [options]\n"
@@ -64,6 +73,8 @@ static const char* const help =
 	"\t -r --raw\t\tAccess device directly without driver\n"
 	"\t -g --gap=time\t\tTreat spaces longer than time as the gap\n"
 	"\t -s --scope=time\t'Scope' like display with time us per char\n"
+	"\t -b --binary\t\tWrite binary mode2 data as read by the file driver\n"
+	"\t -F --flush=ms\t\tBuffer output, flush at most every ms\n"
 	"\t -A --driver-options=key:value[|key:value...]\n"
 	"\t\t\t\tSet driver options\n"
 	"\t -D --loglevel=level\t'error', 'info', 'notice',... or 3..10\n"
@@ -84,6 +95,8 @@ static const struct option options[] = {
 	{"raw",            no_argument,       NULL, 'r'},
 	{"gap",            required_argument, NULL, 'g'},
 	{"scope",          required_argument, NULL, 's'},
+	{"binary",         no_argument,       NULL, 'b'},
+	{"flush",          required_argument, NULL, 'F'},
 	{"plugindir",      required_argument, NULL, 'U'},
 	{"driver-options", required_argument, NULL, 'A'},
 	{0,	           0,		      0,    0  }
@@ -153,7 +166,7 @@ static void add_defaults(void)
 static void parse_options(int argc, char** argv)
 {
 	int c;
-	static const char* const optstring = "hvD:d:H:mklrg:s:U:A:";
+	static const char* const optstring = "hvD:d:H:mklrg:s:bF:U:A:";
 
 	add_defaults();
 	while ((c = getopt_long(argc, argv, optstring, options, NULL)) != -1) {
@@ -193,6 +206,16 @@ static void parse_options(int argc, char** argv)
 		case 'm':
 			opt_dmode = 1;
 			break;
+		case 'b':
+			opt_dmode = 3;
+			break;
+		case 'F':
+			opt_flush_ms = atoi(optarg);
+			if (opt_flush_ms < 0) {
+				fputs("Bad --flush interval\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'r':
 			opt_raw_access = 1;
 			break;
@@ -322,6 +345,58 @@ unsigned int get_codelength(int fd, int use_raw_access)
 }
 
 
+static void flush_output(void)
+{
+	fflush(stdout);
+	unflushed = 0;
+	clock_gettime(CLOCK_MONOTONIC, &last_flush);
+}
+
+
+static long ms_since_flush(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - last_flush.tv_sec) * 1000
+	       + (now.tv_nsec - last_flush.tv_nsec) / 1000000;
+}
+
+
+/**
+ * Flush output after printing, end_of_signal is set after a gap.
+ * Without --flush, every line is flushed and binary output after each
+ * signal; else output is flushed when the interval has passed.
+ */
+static void output_done(int end_of_signal)
+{
+	unflushed = 1;
+	if (opt_flush_ms < 0) {
+		if (opt_dmode != 3 || end_of_signal)
+			flush_output();
+	} else if (ms_since_flush() >= opt_flush_ms) {
+		flush_output();
+	}
+}
+
+
+/**
+ * Wait until fd is readable, flushing pending --flush output if the
+ * interval expires first, so nothing lingers in the buffer while idle.
+ */
+static void wait_input(int fd)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	long left;
+
+	if (opt_flush_ms < 0 || !unflushed || fd < 0)
+		return;
+	left = opt_flush_ms - ms_since_flush();
+	if (poll(&pfd, 1, left > 0 ? left : 0) == 0)
+		flush_output();
+}
+
+
 /** Print mode2 data as pulse/space durations, one per line. */
 void print_mode2_data(unsigned int data)
 {
@@ -366,8 +441,14 @@ void print_mode2_data(unsigned int data)
 			       "------------" : "____________");
 		}
 		break;
+	case 3: {
+		lirc_t value = data;
+
+		fwrite(&value, sizeof(value), 1, stdout);
+		break;
 	}
-	fflush(stdout);
+	}
+	output_done(!(data & PULSE_BIT) && (data & PULSE_MASK) > opt_gap);
 }
 
 
@@ -380,44 +461,78 @@ void print_lirccode_data(char* buffer, size_t count)
 	for (i = 0; i < count; i++)
 		printf("%02x", (unsigned char)buffer[i]);
 	puts("");
-	fflush(stdout);
+	output_done(1);
 }
 
 
 /**
- * Process next button press and print a dump, return boolean OK/FAIL.
+ * Read and print the mode2 data available, in bulk where possible,
+ * return boolean OK/FAIL. Raw reads may end in the middle of a value
+ * on pipes, the rest is kept until the next call.
  */
-int next_press(int fd, int mode, int bytes)
+static int next_mode2(int fd)
 {
-	char buffspace[bytes];
+	static union {
+		char	bytes[READ_BULK * sizeof(lirc_t)];
+		lirc_t	data[READ_BULK];
+	} buf;
+	static size_t fill = 0;
+	int count;
 	int r;
-        union {
-		char* buffer;
-		lirc_t data;
-	} input;
-
-	input.buffer = buffspace;
-	if (opt_raw_access || mode != LIRC_MODE_MODE2) {
-		r = read(fd, input.buffer, bytes);
+	int i;
+
+	wait_input(fd);
+	if (opt_raw_access) {
+		r = read(fd, buf.bytes + fill, sizeof(buf) - fill);
 		if (r == -1)
 			perrorf("read() error on %s", opt_device);
-		else if (r != (int)bytes)
-			fprintf(stderr, "Partial read %d bytes on %s",
-				r, opt_device);
-		if (r != (int)bytes)
+		else if (r == 0)
+			fprintf(stderr, "End of input on %s\n", opt_device);
+		if (r <= 0)
 			return 0;
-		if (mode == LIRC_MODE_MODE2)
-			print_mode2_data(input.data);
-		else
-			print_lirccode_data(input.buffer, bytes);
+		fill += r;
+		count = fill / sizeof(lirc_t);
+	} else if (curr_driver->api_version >= 4
+		   && curr_driver->readdata_bulk != NULL) {
+		count = curr_driver->readdata_bulk(buf.data, READ_BULK, 0);
 	} else {
-		input.data = curr_driver->readdata(0);
-		if (input.data == 0) {
-			fputs("readdata() failed\n", stderr);
-			return 0;
-		}
-		print_mode2_data(input.data);
+		buf.data[0] = curr_driver->readdata(0);
+		count = buf.data[0] == 0 ? 0 : 1;
 	}
+	if (count == 0 && !opt_raw_access) {
+		fputs("readdata() failed\n", stderr);
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+		print_mode2_data(buf.data[i]);
+	if (opt_raw_access) {
+		fill -= count * sizeof(lirc_t);
+		memmove(buf.bytes, buf.bytes + count * sizeof(lirc_t), fill);
+	}
+	return 1;
+}
+
+
+/**
+ * Process next button press and print a dump, return boolean OK/FAIL.
+ */
+int next_press(int fd, int mode, int bytes)
+{
+	char buffer[bytes];
+	int r;
+
+	if (mode == LIRC_MODE_MODE2)
+		return next_mode2(fd);
+	wait_input(fd);
+	r = read(fd, buffer, bytes);
+	if (r == -1)
+		perrorf("read() error on %s", opt_device);
+	else if (r != (int)bytes)
+		fprintf(stderr, "Partial read %d bytes on %s",
+			r, opt_device);
+	if (r != (int)bytes)
+		return 0;
+	print_lirccode_data(buffer, bytes);
 	return 1;
 }
 
@@ -491,8 +606,19 @@ int main(int argc, char** argv)
 	if (mode == LIRC_MODE_LIRCCODE) {
 		code_length = get_codelength(fd, opt_raw_access);
 		bytes = (code_length + CHAR_BIT - 1) / CHAR_BIT;
+	} else if (opt_dmode == 3) {
+		if (!mode2_file_write_header(stdout, curr_driver->name,
+					     curr_driver->resolution)) {
+			perror("Cannot write header");
+			return EXIT_FAILURE;
+		}
+		fflush(stdout);
 	}
+	if (opt_flush_ms >= 0)
+		setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+	clock_gettime(CLOCK_MONOTONIC, &last_flush);
 	while (next_press(fd, mode, bytes))
 		;
+	flush_output();
 	return EXIT_SUCCESS;
 }
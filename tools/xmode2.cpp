@@ -52,6 +52,7 @@
 #include <sys/ioctl.h>
 #include <limits.h>
 #include <errno.h>
+#include <poll.h>
 #include <syslog.h>
 #include <time.h>
 
@@ -90,7 +91,8 @@ XFontStruct* f1_str;
 XColor xc1, xc2;
 Colormap cm1;
 XGCValues gcval1;
-GC gc1, gc2;
+GC gc1, gc2, gc3;               /* grid, trace and text, background */
+Pixmap pm1;                     /* off-screen copy of w1 */
 XSetWindowAttributes winatt1;
 
 long event_mask1;
@@ -107,6 +109,28 @@ static int use_raw_access = 0;
 static const char* device = "";
 static char* geometry = NULL;
 
+/** Samples queued between frames, the oldest are dropped on overflow. */
+#define RING_SIZE 65536
+
+/** Pulse/space values read at a time. */
+#define READ_BULK 256
+
+/** Minimum time between redraws. */
+#define FRAME_MS 33
+
+/** Line segments drawn by one XDrawSegments() call. */
+#define SEGMENTS 1024
+
+static lirc_t ring[RING_SIZE];
+static unsigned int ring_head = 0;      /* free running, written by reader */
+static unsigned int ring_tail = 0;      /* free running, read by drawing */
+
+static XSegment segments[SEGMENTS];
+static int segment_count = 0;
+
+static lirc_t trace_x = 0, trace_y = 20; /* current trace position */
+static int dirty = 1;                   /* pm1 changed since last copy */
+
 static struct option options[] = {
 	{"help",           no_argument,	      NULL, 'h'},
 	{"version",        no_argument,	      NULL, 'v'},
@@ -289,40 +313,342 @@ void initscreen(char* geometry)
 	gc1 = XCreateGC(d1, w1, GCForeground | GCLineStyle, &gcval1);
 	gcval1.foreground = WhitePixel(d1, 0);
 	gc2 = XCreateGC(d1, w1, GCForeground | GCLineStyle | GCFont, &gcval1);
+	gcval1.foreground = BlackPixel(d1, 0);
+	gc3 = XCreateGC(d1, w1, GCForeground, &gcval1);
+	pm1 = XCreatePixmap(d1, w1, w1_w, w1_h, DefaultDepth(d1, 0));
 }
 
 
 void closescreen(void)
 {
+	XFreePixmap(d1, pm1);
 	XUnmapWindow(d1, w1);
 	XCloseDisplay(d1);
 }
 
+
+/** Draw the queued segments on pm1. */
+static void flush_segments(void)
+{
+	if (segment_count > 0)
+		XDrawSegments(d1, pm1, gc2, segments, segment_count);
+	segment_count = 0;
+}
+
+
+static void add_segment(int xa, int ya, int xb, int yb)
+{
+	XSegment* seg;
+
+	if (segment_count == SEGMENTS)
+		flush_segments();
+	seg = &segments[segment_count++];
+	seg->x1 = xa;
+	seg->y1 = ya;
+	seg->x2 = xb;
+	seg->y2 = yb;
+}
+
+
 void drawGrid(int div)
 {
 	char textbuffer[80];
+	XSegment lines[SEGMENTS];
+	int count = 0;
 	int x;
 
-	XClearWindow(d1, w1);
-	for (x = 0; x < (int)w1_w; x += 10)
-		XDrawLine(d1, w1, gc1,  x, 0,  x, w1_h);
+	flush_segments();
+	XFillRectangle(d1, pm1, gc3, 0, 0, w1_w, w1_h);
+	for (x = 0; x < (int)w1_w; x += 10) {
+		lines[count].x1 = x;
+		lines[count].y1 = 0;
+		lines[count].x2 = x;
+		lines[count].y2 = w1_h;
+		if (++count == SEGMENTS) {
+			XDrawSegments(d1, pm1, gc1, lines, count);
+			count = 0;
+		}
+	}
+	XDrawSegments(d1, pm1, gc1, lines, count);
 
 	sprintf(textbuffer, "%5.3f ms/div", div/100.0);
-	XDrawString(d1, w1, gc2, w1_w - 100, 10, textbuffer, strlen(textbuffer));
+	XDrawString(d1, pm1, gc2, w1_w - 100, 10, textbuffer, strlen(textbuffer));
+	dirty = 1;
+}
+
+
+/** Reallocate pm1 for a new window size and clear it. */
+static void resize_pixmap(void)
+{
+	XFreePixmap(d1, pm1);
+	pm1 = XCreatePixmap(d1, w1, w1_w, w1_h, DefaultDepth(d1, 0));
+	trace_y = 20;
+	trace_x = 0;
+	drawGrid(div_);
+}
+
+
+/** Queue a sample for the next frame. */
+static void ring_put(lirc_t data)
+{
+	if (lirc_log_is_enabled_for(LIRC_DEBUG)) {
+		if (data & PULSE_BIT)
+			printf("%.8x\t", data);
+		else
+			printf("%.8x\n", data);
+	}
+	if (ring_head - ring_tail == RING_SIZE)
+		ring_tail++;
+	ring[ring_head++ % RING_SIZE] = data;
+}
+
+
+/** Add the trace segments for a sample at trace_x, trace_y. */
+static void draw_sample(lirc_t data)
+{
+	lirc_t dx;
+	int y_from;
+	int y_to;
+
+	dx = (data & PULSE_MASK) / (div_);
+	if (dx > 400) {
+		if (!dmode)
+			trace_y += 15;
+		else
+			trace_y++;
+		trace_x = 0;
+	} else {
+		if (trace_x == 0) {
+			if (!dmode)
+				add_segment(trace_x, trace_y + 10, trace_x + 10, trace_y + 10);
+			trace_x += 10;
+			if (!dmode)
+				add_segment(trace_x, trace_y + 10, trace_x, trace_y);
+		}
+		if (trace_x < (int) w1_w) {
+			if (dmode) {
+				if (data & PULSE_BIT)
+					add_segment(trace_x, trace_y, trace_x + dx, trace_y);
+				trace_x += dx;
+			} else {
+				y_from = (data & PULSE_BIT) ? trace_y : trace_y + 10;
+				y_to = (data & PULSE_BIT) ? trace_y + 10 : trace_y;
+				add_segment(trace_x, y_from, trace_x + dx, y_from);
+				trace_x += dx;
+				add_segment(trace_x, y_from, trace_x, y_to);
+			}
+		}
+	}
+	if (trace_y > (lirc_t) w1_h) {
+		trace_x = 0;
+		trace_y = 20;
+		drawGrid(div_);
+	}
+}
+
+
+/** Draw the queued samples on pm1 and copy it to the window. */
+static void draw_frame(void)
+{
+	while (ring_tail != ring_head)
+		draw_sample(ring[ring_tail++ % RING_SIZE]);
+	flush_segments();
+	XCopyArea(d1, pm1, w1, gc2, 0, 0, w1_w, w1_h, 0, 0);
 	XFlush(d1);
+	dirty = 0;
+}
+
+
+/**
+ * Queue complete "pulse 850" lines from stdin, which are read in
+ * blocks rather than by stdio so select() sees all pending input.
+ * Returns 0 at EOF.
+ */
+static int read_stdin(int fd)
+{
+	static char buf[4096];
+	static size_t fill = 0;
+	char what[16];
+	unsigned long value;
+	char* line;
+	char* nl;
+	ssize_t r;
+
+	r = read(fd, buf + fill, sizeof(buf) - fill - 1);
+	if (r <= 0)
+		return 0;
+	fill += r;
+	buf[fill] = '\0';
+	line = buf;
+	while ((nl = strchr(line, '\n')) != NULL) {
+		*nl = '\0';
+		if (sscanf(line, "%15s %lu", what, &value) == 2) {
+			if (strcmp(what, "pulse") == 0)
+				ring_put((lirc_t)value | PULSE_BIT);
+			else if (strcmp(what, "space") == 0)
+				ring_put((lirc_t)value);
+		}
+		line = nl + 1;
+	}
+	fill -= line - buf;
+	if (fill == sizeof(buf) - 1)
+		fill = 0;       /* Overlong line, drop it. */
+	memmove(buf, line, fill);
+	return 1;
+}
+
+
+/**
+ * Queue the samples available on fd, in bulk where possible. Return 0
+ * if there is no more input.
+ */
+static int read_input(int fd)
+{
+	static union {
+		char	bytes[READ_BULK * sizeof(lirc_t)];
+		lirc_t	data[READ_BULK];
+	} buf;
+	static size_t fill = 0;
+	size_t count;
+	size_t i;
+	ssize_t r;
+
+	if (use_stdin)
+		return read_stdin(fd);
+	if (use_raw_access) {
+		r = read(fd, buf.bytes + fill, sizeof(buf) - fill);
+		if (r <= 0)
+			return 0;
+		fill += r;
+		count = fill / sizeof(lirc_t);
+		for (i = 0; i < count; i++)
+			ring_put(buf.data[i]);
+		fill -= count * sizeof(lirc_t);
+		memmove(buf.bytes, buf.bytes + count * sizeof(lirc_t), fill);
+		return 1;
+	}
+	/*
+	 * Must use the driver read function, the UDP driver reformats the data!
+	 */
+	if (curr_driver->api_version >= 4
+	    && curr_driver->readdata_bulk != NULL) {
+		count = curr_driver->readdata_bulk(buf.data, READ_BULK, 0);
+	} else {
+		buf.data[0] = curr_driver->readdata(0);
+		count = buf.data[0] == 0 ? 0 : 1;
+	}
+	if (count == 0) {
+		fprintf(stderr, "readdata() failed\n");
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+		ring_put(buf.data[i]);
+	return 1;
+}
+
+
+static long ms_until(const struct timeval* when)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (when->tv_sec - now.tv_sec) * 1000
+	       + (when->tv_usec - now.tv_usec) / 1000;
 }
 
+
+/** Handle pending X events, return 0 when asked to quit. */
+static int handle_events(void)
+{
+	char textbuffer[80];
+
+	while (XPending(d1) > 0) {
+		XNextEvent(d1, &event_return1);
+		switch (event_return1.type) {
+		case KeyPress:
+			if (1 == XLookupString(&event_return1.xkey,
+					       textbuffer,
+					       sizeof(textbuffer),
+					       NULL, NULL)) {
+				switch (textbuffer[0]) {
+				case 'q':
+					return 0;
+				case 'm':
+					dmode = !dmode;
+					break;
+				/*
+				 * Switch the time-base, the screen is not cleared because it is useful to see
+				 * the IR data with different time-bases on the same screen. The new time-base
+				 * text is drawn to the screen and the waveform is set to start on a new line.
+				 */
+				case '.':
+					point = 1;	/* Remember the decimal point */
+					break;
+				case '1':
+					div_ = 100;	/* 1ms, 1000us per division / 10 pixels per division. */
+					showText = 1;
+					break;
+				case '2':
+					div_ = 200;
+					showText = 1;
+					break;
+				case '5':
+					div_ = 500;
+					showText = 1;
+					break;
+				}
+				if (showText) {
+					/* Samples queued so far belong to the old time-base. */
+					while (ring_tail != ring_head)
+						draw_sample(ring[ring_tail++ % RING_SIZE]);
+					flush_segments();
+					showText = 0;
+					if (point) {
+						point = 0;
+						div_ /= 10;
+					}
+					trace_y += 25;
+					sprintf(textbuffer, "%5.3f ms/div", div_ / 100.0);
+					XDrawString(d1, pm1, gc2,
+						    w1_w - 100,
+						    trace_y,
+						    textbuffer,
+						    strlen(textbuffer));
+					trace_y += 5;
+					trace_x = 0;
+					dirty = 1;
+				}
+			}
+			break;
+		case Expose:
+			dirty = 1;
+			break;
+		case ConfigureNotify:
+			if ((int) w1_w == event_return1.xconfigure.width &&
+			    (int) w1_h == event_return1.xconfigure.height)
+				continue;
+			w1_w = event_return1.xconfigure.width;
+			w1_h = event_return1.xconfigure.height;
+			resize_pixmap();
+			break;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+
+
 int main(int argc, char** argv)
 {
-	fd_set rfds;
-	int xfd, maxfd;
+	struct pollfd pfds[2];
+	struct timeval next_frame;
+	long timeout;
+	int pending;
+	int xfd;
 
 	int fd;
 	uint32_t mode;
-	lirc_t data = 0;
-	lirc_t x1, y1, dx;
-	int result;
-	char textbuffer[80];
 	const char* opt;
 	char logpath[256];
 	const loglevel_t level = options_get_app_loglevel("xmode2");
@@ -401,168 +727,34 @@ int main(int argc, char** argv)
 		drop_root_cli(setuid);
 	initscreen(geometry);
 	xfd = XConnectionNumber(d1);
-	maxfd = fd > xfd ? fd : xfd;
-	y1 = 20;
-	x1 = 0;
 	drawGrid(div_);
-	while (1) {
-		while (XPending(d1) > 0) {
-			XNextEvent(d1, &event_return1);
-			switch (event_return1.type) {
-			case KeyPress:
-				if (1 == XLookupString(&event_return1.xkey,
-						       textbuffer,
-						       sizeof(textbuffer),
-						       NULL, NULL)) {
-					switch (textbuffer[0]) {
-					case 'q':
-					closescreen();
-					exit(1);
-					case 'm':
-						dmode = !dmode;
-						break;
-					/*
-					 * Switch the time-base, the screen is not cleared because it is useful to see
-					 * the IR data with different time-bases on the same screen. The new time-base
-					 * text is drawn to the screen and the waveform is set to start on a new line.
-					 */
-					case '.':
-						point = 1;	/* Remember the decimal point */
-						break;
-					case '1':
-						div_ = 100;	/* 1ms, 1000us per division / 10 pixels per division. */
-						showText = 1;
-						break;
-					case '2':
-						div_ = 200;
-						showText = 1;
-						break;
-					case '5':
-						div_ = 500;
-						showText = 1;
-						break;
-					}
-					if (showText) {
-						showText = 0;
-						if (point) {
-							point = 0;
-							div_ /= 10;
-						}
-						y1 += 25;
-						sprintf(textbuffer, "%5.3f ms/div", div_ / 100.0);
-						XDrawString(d1, w1, gc2,
-							    w1_w - 100,
-							    y1,
-							    textbuffer,
-							    strlen(textbuffer));
-						y1 += 5;
-						x1 = 0;
-					}
-				}
-				break;
-			case Expose:
-			case ConfigureNotify:
-				switch (event_return1.type) {
-				case Expose:
-					break;
-				case ConfigureNotify:
-					if ((int) w1_w == event_return1.xconfigure.width &&
-					    (int) w1_h == event_return1.xconfigure.height)
-						continue;
-
-					w1_w = event_return1.xconfigure.width;
-					w1_h = event_return1.xconfigure.height;
-					break;
-				}
-				y1 = 20;
-				x1 = 0;
-				drawGrid(div_);
-				break;
-			default:
-				break;
-			}
-		}
-
-		FD_ZERO(&rfds);
-		FD_SET(fd, &rfds);
-		FD_SET(xfd, &rfds);
-
-		select(maxfd + 1, &rfds, NULL, NULL, NULL);
-
-		if (FD_ISSET(fd, &rfds)) {
-			if (use_stdin) {
-				static int space = 1;
-				unsigned long scan;
-
-				if (space)
-					result = fscanf(stdin, "space %ld\n", &scan);
-				else
-					result = fscanf(stdin, "pulse %ld\n", &scan);
-				if (result == 1) {
-					data = (lirc_t)scan;
-					if (!space)
-						data |= PULSE_BIT;
-				} else {
-					fd = STDOUT_FILENO;
-				}
-				space = !space;
-			} else {
-				/*
-				 * Must use the driver read function, the UDP driver reformats the data!
-				 */
-				data = curr_driver->readdata(0);
-				if (data == 0) {
-					fprintf(stderr, "readdata() failed\n");
-					result = 0;
-				} else {
-					result = 1;
-				}
-			}
-			if (result != 0) {
-				if lirc_log_is_enabled_for(LIRC_DEBUG) {
-					if (data & PULSE_BIT)
-						printf("%.8x\t", data);
-					else
-						printf("%.8x\n", data);
-				}
-				dx = (data & PULSE_MASK) / (div_);
-				if (dx > 400) {
-					if (!dmode)
-						y1 += 15;
-					else
-						y1++;
-					x1 = 0;
-				} else {
-					if (x1 == 0) {
-						if (!dmode)
-							XDrawLine(d1, w1, gc2, x1, y1 + 10, x1 + 10, y1 + 10);
-						x1 += 10;
-						if (!dmode)
-							XDrawLine(d1, w1, gc2, x1, y1 + 10, x1, y1);
-					}
-					if (x1 < (int) w1_w) {
-						if (dmode) {
-							if (data & PULSE_BIT)
-								XDrawLine(d1, w1, gc2, x1, y1, x1 + dx, y1);
-							x1 += dx;
-						} else {
-							XDrawLine(d1, w1, gc2,
-								x1,      ((data & PULSE_BIT) ? y1 : y1 + 10),
-								x1 + dx, ((data & PULSE_BIT) ? y1 : y1 + 10));
-							x1 += dx;
-							XDrawLine(d1, w1, gc2,
-								x1, ((data & PULSE_BIT) ? y1 : y1 + 10),
-								x1, ((data & PULSE_BIT) ? y1 + 10 : y1));
-						}
-					}
-				}
-				if (y1 > (lirc_t) w1_h) {
-					x1 = 0;
-					drawGrid(div_);
-				}
+	gettimeofday(&next_frame, NULL);
+	/*
+	 * Input is queued as it arrives and drawn on the pixmap at most
+	 * once per FRAME_MS, then copied to the window in one request.
+	 */
+	while (handle_events()) {
+		pending = ring_tail != ring_head || dirty;
+		timeout = pending ? ms_until(&next_frame) : -1;
+		if (pending && timeout <= 0) {
+			draw_frame();
+			gettimeofday(&next_frame, NULL);
+			next_frame.tv_usec += FRAME_MS * 1000;
+			if (next_frame.tv_usec >= 1000000) {
+				next_frame.tv_sec += 1;
+				next_frame.tv_usec -= 1000000;
 			}
-			XFlush(d1);
+			continue;
 		}
+		pfds[0].fd = fd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = xfd;
+		pfds[1].events = POLLIN;
+		if (poll(pfds, 2, timeout) <= 0)
+			continue;
+		if ((pfds[0].revents & (POLLIN | POLLHUP)) && !read_input(fd))
+			fd = -1;        /* End of input, keep the window. */
 	}
-	exit(EXIT_SUCCESS);
+	closescreen();
+	exit(1);
 }